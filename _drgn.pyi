@@ -16,8 +16,10 @@ from typing import (
     Dict,
     Iterable,
     Iterator,
+    List,
     Optional,
     Sequence,
+    Tuple,
     Union,
     overload,
 )
@@ -88,6 +90,45 @@ class Program:
     this is determined from the language of ``main`` in the program, falling
     back to :attr:`Language.C`. This heuristic may change in the future.
     """
+
+    num_threads: int
+    """
+    Maximum number of threads that this program may use for parallel work,
+    like indexing debugging information, including the calling thread.
+
+    This defaults to the number of CPUs that the process may run on. Setting
+    it to 1 disables multithreading, and setting it to 0 restores the default.
+    """
+
+    direct_io: int
+    """
+    Size in bytes of the cache used to read the core dump with direct I/O, or
+    0 if direct I/O is disabled (the default).
+
+    With direct I/O, the core dump is read in aligned blocks with
+    ``O_DIRECT`` into a cache owned by the program instead of through the
+    kernel page cache, so analyzing a core dump much larger than memory
+    doesn't evict other processes' data. Sequential reads are read ahead. This
+    is only supported for ELF core dumps on file systems which support
+    ``O_DIRECT``. It can also be enabled by setting the
+    ``DRGN_DIRECT_IO_CACHE_MB`` environment variable to the cache size in MiB
+    before the core dump is set.
+
+    A core dump read over HTTP is always read through this cache, which can't
+    be changed after the core dump is set (see :meth:`set_core_dump()`).
+    """
+
+    memory_budget: int
+    """
+    Maximum estimated size in bytes of this program's caches, or 0 for no
+    limit (the default).
+
+    The program caches types, structure members, paths, direct I/O blocks, and
+    more as they are used. When the caches exceed the budget, the least
+    recently used ones are shrunk, so a long session gets slower instead of
+    running out of memory. Types can't be evicted because objects refer to
+    them, but they count toward the budget. See :meth:`memory_usage()`.
+    """
     def __getitem__(self, name: str) -> Object:
         """
         Implement ``self[name]``. Get the object (variable, constant, or
@@ -288,6 +329,30 @@ class Program:
         :raises FaultError: if the address is invalid; see :meth:`read()`
         """
         ...
+    def memory_holes(
+        self, address: IntegerLike, size: IntegerLike, physical: bool = False
+    ) -> List[Tuple[int, int]]:
+        """
+        Get the holes in a range of the program's memory.
+
+        A hole is memory which is known to contain only zeroes without reading
+        it: a hole in a sparse core dump file, or a part of a core dump segment
+        that isn't in the file. Reading a hole is cheap, but code that scans a
+        large range of memory for something nonzero (e.g., a pointer or a
+        string) can skip holes entirely.
+
+        >>> holes = prog.memory_holes(0xffff888000000000, 0x100000000)
+        >>> [(hex(start), hex(end)) for start, end in holes]
+        [('0xffff888000100000', '0xffff88800f000000')]
+
+        :param address: Start of the range.
+        :param size: Size of the range in bytes.
+        :param physical: Whether *address* is a physical memory address; see
+            :meth:`read()`.
+        :return: List of ``(start, end)`` address ranges of holes, sorted and
+            truncated to the range. Adjacent holes are combined.
+        """
+        ...
     def add_memory_segment(
         self,
         address: IntegerLike,
@@ -352,7 +417,16 @@ class Program:
         mapped executable and libraries. It does not load any debugging
         symbols; see :meth:`load_default_debug_info()`.
 
-        :param path: Core dump file path.
+        An ELF core dump (e.g., a kernel vmcore) can also be read from an HTTP
+        or HTTPS server that supports range requests by passing its URL, so a
+        huge core dump can be analyzed without copying it first. The headers
+        and notes are read up front, and memory is fetched on demand into a
+        cache of :attr:`direct_io` bytes (64 MiB by default, or the size in MiB
+        in the ``DRGN_DIRECT_IO_CACHE_MB`` environment variable), in parallel
+        ranges and with read-ahead for sequential reads. This requires drgn to
+        be built with libcurl.
+
+        :param path: Core dump file path or URL.
         """
         ...
     def set_kernel(self) -> None:
@@ -375,11 +449,128 @@ class Program:
         :param pid: Process ID.
         """
         ...
+    def set_guest_memory(
+        self,
+        path: Path,
+        pgtable: Optional[IntegerLike] = None,
+        low_ram_size: Optional[IntegerLike] = None,
+    ) -> None:
+        """
+        Set the program to the Linux kernel running in a QEMU/KVM virtual
+        machine whose RAM is backed by a file.
+
+        The guest must be started with file-backed, shared memory, e.g.,
+        ``-object memory-backend-file,id=mem,size=4G,mem-path=/dev/shm/vm,share=on
+        -machine memory-backend=mem``. The file is mapped read-only, so the
+        guest can be inspected while it runs without pausing it, but it may
+        change under drgn's feet. The kernel is found by scanning the guest RAM
+        for its ``VMCOREINFO`` note. This is only supported for x86-64 guests.
+
+        >>> prog = drgn.Program()
+        >>> prog.set_guest_memory("/dev/shm/vm")
+        >>> prog.load_default_debug_info()
+
+        :param path: Path of the file backing the guest RAM.
+        :param pgtable: Guest physical address of the page table to translate
+            virtual addresses with, e.g., the guest's CR3 register. Defaults to
+            the kernel page table, ``swapper_pg_dir``.
+        :param low_ram_size: Number of bytes of the file mapped below 4 GiB in
+            the guest physical address space. The rest of the file is mapped
+            starting at 4 GiB. QEMU leaves a hole below 4 GiB for PCI devices;
+            for the ``q35`` machine type, this is 2 GiB for guests with more
+            than 2.75 GiB of RAM, and for ``pc``, it is 3 GiB for guests with
+            more than 3.5 GiB. Defaults to the whole file.
+        """
+        ...
+    def flush_translation_cache(self) -> None:
+        """
+        Flush the cache of virtual to physical address translations.
+
+        Page table walks for reads from core dumps are cached. The cache is not
+        used for the running kernel or a running guest (see
+        :meth:`set_guest_memory()`), whose page tables may change at any time.
+        Call this if the page tables of a core dump were changed, e.g., by
+        adding a memory segment.
+        """
+        ...
+    def direct_io_stats(self) -> Dict[str, int]:
+        """
+        Get statistics about reading the core dump with direct I/O. See
+        :attr:`direct_io`.
+
+        The returned dictionary has the following keys:
+
+        * ``hits``: number of blocks that were found in the cache.
+        * ``misses``: number of reads from the core dump file.
+        * ``readahead_blocks``: number of blocks that were read ahead of
+          sequential accesses.
+        * ``evictions``: number of blocks evicted from the cache.
+        * ``bytes_read``: number of bytes read from the core dump file without
+          going through the page cache.
+        * ``bytes_copied``: number of bytes copied out of the cache to satisfy
+          reads. The difference from ``bytes_read`` is I/O saved by the cache.
+
+        All of the statistics are zero if direct I/O is disabled, and they are
+        reset when :attr:`direct_io` is changed.
+        """
+        ...
+    def memory_usage(self) -> Dict[str, Dict[str, int]]:
+        """
+        Get the memory used by each part of this program.
+
+        >>> usage = prog.memory_usage()
+        >>> usage["dwarf_index_dies"]
+        {'size': 181403648, 'count': 5668864, 'evictions': 0}
+        >>> sorted(usage, key=lambda name: usage[name]["size"])[-3:]
+        ['dwarf_index_names', 'dwarf_index_dies', 'module_sections']
+
+        The returned dictionary maps the name of each part to a dictionary
+        with the following keys:
+
+        * ``size``: number of bytes allocated.
+        * ``count``: number of objects, e.g., DIEs, types, or cached paths.
+        * ``evictions``: number of times that the part was shrunk to fit
+          :attr:`memory_budget`. This is always zero for parts that aren't
+          caches.
+
+        The parts are:
+
+        * ``created_types``: structure, union, class, enumerated, and function
+          types and their members, enumerators, and parameters.
+        * ``deduplicated_types``: all other types.
+        * ``members``: the cache of structure members by name.
+        * ``module_sections``: DWARF sections of loaded debugging information
+          files.
+        * ``dwarf_types``: the cache of types parsed from DWARF.
+        * ``dwarf_index_dies``: indexed DIEs.
+        * ``dwarf_index_names``: maps from names to indexed DIEs.
+        * ``dwarf_index_specifications``: the map from declarations to
+          definitions.
+        * ``dwarf_index_type_units``: the map of type units by signature.
+        * ``dwarf_index_cus``: indexed compilation units and their
+          abbreviation tables.
+        * ``prstatus``: the cache of ``NT_PRSTATUS`` notes by CPU or thread.
+        * ``memory_reader``: memory segments.
+        * ``direct_io``: the :attr:`direct_io` block cache.
+        * ``translation_cache``: the cache of virtual to physical address
+          translations; see :meth:`flush_translation_cache()`.
+        * ``dentry_paths``: the cache of paths used by
+          :func:`~drgn.helpers.linux.fs.d_path()` and related helpers.
+
+        Nothing is counted until this is called, so it doesn't slow anything
+        else down, but it may take a moment for a program with a lot of
+        debugging information. Memory used internally by libelf and libdw isn't
+        included.
+        """
+        ...
     def load_debug_info(
         self,
         paths: Optional[Iterable[Path]] = None,
         default: bool = False,
         main: bool = False,
+        *,
+        index: IndexCategory = IndexCategory.ALL,
+        main_index: Optional[IndexCategory] = None,
     ) -> None:
         """
         Load debugging information for a list of executable or library files.
@@ -403,6 +594,14 @@ class Program:
             For the Linux kernel, this tries to load ``vmlinux``.
 
             This is currently ignored for userspace programs.
+        :param index: Categories of names to index up front. Names in other
+            categories are indexed the first time they are looked up, so
+            skipping categories that will never be used speeds up loading.
+        :param main_index: Categories of names to index up front for the main
+            program (``vmlinux`` or the executable), or ``None`` to use
+            *index*. For example, ``index=IndexCategory.TYPES,
+            main_index=IndexCategory.ALL`` fully indexes ``vmlinux`` but only
+            indexes types in kernel modules.
         :raises MissingDebugInfoError: if debugging information was not
             available for some files; other files with debugging information
             are still loaded
@@ -743,6 +942,23 @@ class FindObjectFlags(enum.Flag):
     ANY = ...
     ""
 
+class IndexCategory(enum.Flag):
+    """
+    ``IndexCategory`` are flags for :meth:`Program.load_debug_info()` selecting
+    which kinds of names to index when loading debugging information.
+    """
+
+    TYPES = ...
+    ""
+    VARIABLES = ...
+    ""
+    CONSTANTS = ...
+    ""
+    FUNCTIONS = ...
+    ""
+    ALL = ...
+    ""
+
 def filename_matches(haystack: Optional[str], needle: Optional[str]) -> bool:
     """
     Return whether a filename containing a definition (*haystack*) matches a
@@ -1393,6 +1609,95 @@ class StackFrame:
         """
         ...
 
+class Watch:
+    """
+    A ``Watch`` samples the values of a fixed set of objects repeatedly with
+    as little overhead as possible, for example, to follow kernel counters at
+    a high frequency.
+
+    The objects are translated to locations in the underlying memory file
+    (e.g., ``/proc/kcore``) once, when the first sample is taken. Nearby
+    locations are merged, and each sample reads all of them at once. Objects
+    whose location can't be determined in advance are read normally.
+
+    Samples are kept in a ring buffer; once it is full, each new sample
+    replaces the oldest one. ``len(watch)`` is the number of samples in the
+    buffer.
+
+    >>> watch = Watch(prog, [prog["jiffies"], prog["nr_threads"]])
+    >>> watch.run(0.001, 1000)
+    >>> watch.samples()[-1]
+    (1234567890123, (Object(prog, 'volatile unsigned long', value=4295433164), Object(prog, 'int', value=352)))
+    """
+
+    def __init__(
+        self, prog: Program, objects: Iterable[Object], capacity: IntegerLike = 1024
+    ) -> None:
+        """
+        :param prog: Program to read from.
+        :param objects: Reference objects to watch.
+        :param capacity: Maximum number of samples to keep.
+        :raises ValueError: if an object is not a reference or *capacity* is
+            zero
+        """
+        ...
+    def __len__(self) -> int: ...
+    def sample(self) -> None:
+        """
+        Take one sample of the watched objects.
+
+        Objects can't be added to the watch after this is first called, even
+        if the memory layout of the program changes.
+
+        :raises FaultError: if a watched object can't be read
+        """
+        ...
+    def run(self, interval: float, count: IntegerLike) -> None:
+        """
+        Take *count* samples, *interval* seconds apart.
+
+        Samples are scheduled at fixed times so that the time taken by each
+        sample doesn't accumulate. If a sample is late, the schedule starts
+        over from that sample instead of taking several samples at once to
+        catch up.
+
+        :param interval: Time between samples in seconds.
+        :param count: Number of samples to take.
+        """
+        ...
+    def samples(self) -> List[Tuple[int, Tuple[Object, ...]]]:
+        """
+        Get the samples in the buffer, oldest first.
+
+        :return: List of ``(timestamp, values)`` tuples, where *timestamp* is
+            the ``CLOCK_MONOTONIC`` time when the sample was started in
+            nanoseconds and *values* contains a value object for each watched
+            object.
+        """
+        ...
+    def clear(self) -> None:
+        """Remove all of the samples from the buffer."""
+        ...
+    def stats(self) -> Dict[str, Any]:
+        """
+        Get statistics about the cost of sampling.
+
+        The returned dictionary contains:
+
+        * ``samples``: Total number of samples taken.
+        * ``dropped``: Number of samples that were overwritten because the
+          buffer was full.
+        * ``reads_per_sample``: Number of reads from the memory file in each
+          sample.
+        * ``untranslated``: Number of objects that aren't read directly from
+          the memory file.
+        * ``batched``: Whether the reads of each sample are submitted together
+          with a single system call.
+        * ``last_ns``, ``max_ns``, ``total_ns``: Time taken by the last
+          sample, the slowest sample, and all samples in nanoseconds.
+        """
+        ...
+
 class Type:
     """
     A ``Type`` object describes a type in a program. Each kind of type (e.g.,
@@ -1761,6 +2066,7 @@ class OutOfBoundsError(Exception):
 
     ...
 
+_with_libcurl: bool
 _with_libkdumpfile: bool
 
 def _linux_helper_read_vm(
@@ -1821,6 +2127,225 @@ def _linux_helper_find_task(
     """
     ...
 
+def _linux_helper_d_path(vfsmnt: Object, dentry: Object) -> bytes:
+    """
+    Return the full path of a dentry given a mount and dentry.
+
+    :param vfsmnt: ``struct vfsmount *``
+    :param dentry: ``struct dentry *``
+    """
+    ...
+
+def _linux_helper_d_paths(paths: Iterable[Object]) -> List[bytes]:
+    """
+    Return the full paths of multiple dentries given ``struct path``\ s.
+
+    This is equivalent to ``[d_path(path) for path in paths]``, but it is
+    faster for many paths, since the path of each directory is only resolved
+    once. Paths are cached per program, so this also benefits from earlier
+    calls; on live kernels, cached paths are only reused within a single call.
+
+    :param paths: ``struct path`` or ``struct path *`` objects.
+    """
+    ...
+
+def _linux_helper_dentry_path(dentry: Object) -> bytes:
+    """
+    Return the path of a dentry from the root of its filesystem.
+
+    :param dentry: ``struct dentry *``
+    """
+    ...
+
+def _linux_helper_find_open_files(
+    prog: Program,
+    tasks: Optional[Iterable[IntegerLike]] = None,
+    *,
+    inode: Optional[IntegerLike] = None,
+    super_block: Optional[IntegerLike] = None,
+    f_op: Optional[IntegerLike] = None,
+) -> List[Tuple[Object, int, Object]]:
+    """
+    Find open files in the file descriptor tables of tasks.
+
+    This reads each file descriptor table in bulk, so it is much faster than
+    calling :func:`for_each_file()` for every task.
+
+    >>> for task, fd, file in find_open_files(prog, inode=inode):
+    ...     print(task.pid.value_(), fd)
+    ...
+    1234 3
+
+    Threads usually share a file descriptor table. A table shared by multiple
+    tasks is only reported once, for the first of those tasks.
+
+    :param tasks: ``struct task_struct *`` objects to search. Defaults to every
+        thread of every process.
+    :param inode: If given, only return files for this ``struct inode *``.
+    :param super_block: If given, only return files on this ``struct
+        super_block *``.
+    :param f_op: If given, only return files with this ``const struct
+        file_operations *`` (e.g., ``prog["socket_file_ops"].address_of_()``).
+    :return: List of (``struct task_struct *``, fd, ``struct file *``) tuples.
+    """
+    ...
+
+def _linux_helper_bpf_map_items(
+    map: Object, *, sum_percpu: IntegerLike = 0
+) -> Iterator[Tuple[bytes, bytes]]:
+    """
+    Iterate over the entries in a BPF map, reading them in batches.
+
+    :param map: ``struct bpf_map *``
+    :param sum_percpu: See :func:`~drgn.helpers.linux.bpf.bpf_map_items()`.
+    """
+    ...
+
+def _linux_helper_ftrace_events(
+    prog: Program, trace_array: Optional[Object] = None, *, text: bool = False
+) -> Iterator[Any]:
+    """
+    Iterate over ftrace ring buffer events.
+
+    :param trace_array: ``struct trace_array *``, or ``None`` for the global
+        trace buffer.
+    :param text: Return formatted lines instead of (CPU, timestamp, name,
+        data) tuples.
+    """
+    ...
+
+def _linux_helper_ftrace_write_trace_dat(
+    prog: Program, file: Any, trace_array: Optional[Object] = None
+) -> None:
+    """
+    Write the ftrace ring buffer in the ``trace.dat`` format.
+
+    :param file: Binary file object with a ``write()`` method.
+    :param trace_array: ``struct trace_array *``, or ``None`` for the global
+        trace buffer.
+    """
+    ...
+
+def _linux_helper_wait_graph(prog: Program, state_mask: IntegerLike) -> List[
+    Tuple[
+        int,
+        Optional[StackTrace],
+        Optional[int],
+        Optional[str],
+        int,
+        int,
+        Optional[int],
+        int,
+        bool,
+    ]
+]:
+    """
+    Build the wait-for graph of tasks whose state is in *state_mask*.
+
+    :return: List of (task address, stack trace, blocking frame index, lock
+        type, lock address, owner address, index of blocked owner, chain
+        length, in cycle) tuples. See
+        :func:`~drgn.helpers.linux.deadlock.blocked_tasks()`.
+    """
+    ...
+
+def _linux_helper_runqueue_snapshot(
+    prog: Program,
+) -> Tuple[
+    List[Tuple[int, int, int, int, int, int, int]],
+    List[Tuple[int, int, str, int, int, int, int, int]],
+]:
+    """
+    Read the runqueue of every possible CPU.
+
+    :return: List of (CPU, ``struct rq *`` address, current task address,
+        clock, clock_task, nr_running, min_vruntime) tuples and list of (CPU,
+        task address, queue, policy, prio, vruntime, deadline,
+        sum_exec_runtime) tuples. See
+        :func:`~drgn.helpers.linux.sched.runqueue_snapshot()`.
+    """
+    ...
+
+def _linux_helper_vmap_areas(
+    prog: Program, validate: bool = False
+) -> Tuple[
+    List[Tuple[int, int, int, int, int, int, int, int]],
+    List[Tuple[int, int, int, int, int]],
+]:
+    """
+    Read all allocated vmap areas.
+
+    :param validate: Whether to count the mapped pages of each area by
+        walking the kernel page table.
+    :return: List of (``struct vmap_area *`` address, start, size,
+        ``struct vm_struct *`` address, flags, caller, nr_pages, mapped pages)
+        tuples sorted by start, and list of (caller, count, size, nr_pages,
+        mapped pages) tuples sorted by size. Mapped pages are ``2**64 - 1`` if
+        *validate* is false. See :func:`~drgn.helpers.linux.mm.vmap_areas()`.
+    """
+    ...
+
+def _linux_helper_timers(
+    prog: Program,
+) -> Tuple[List[Tuple[int, str, int, int, int, int]], List[Tuple[int, int, int]]]:
+    """
+    Read the pending timers of every possible CPU.
+
+    :return: List of (CPU, ``"timer"`` or ``"hrtimer"``, base index, timer
+        address, expiration time, callback address) tuples, and list of
+        (callback address, number of timers, number of hrtimers) tuples. See
+        :func:`~drgn.helpers.linux.timer.pending_timers()`.
+    """
+    ...
+
+def _linux_helper_blk_mq_requests(
+    prog: Program, queues: Sequence[IntegerLike]
+) -> List[
+    Tuple[int, int, int, int, int, int, int, int, int, int, int, Optional[int]]
+]:
+    """
+    Read the in-flight requests of blk-mq request queues.
+
+    :param queues: ``struct request_queue *`` addresses.
+    :return: List of (index in *queues*, hardware queue address, hardware queue
+        number, request address, tag, internal tag, operation, ``cmd_flags``,
+        sector, size in bytes, start time in nanoseconds, state or ``None``)
+        tuples. See :func:`~drgn.helpers.linux.block.inflight_requests()`.
+    """
+    ...
+
+def _linux_helper_page_usage(
+    prog: Program,
+    vmemmap: IntegerLike,
+    start_pfn: IntegerLike,
+    end_pfn: IntegerLike,
+    max_inodes: IntegerLike,
+) -> Tuple[List[Tuple[int, int, int, int, int]], List[Tuple[int, int, int]]]:
+    """
+    Count the pages in a range of page frame numbers by memory cgroup and kind.
+
+    :param vmemmap: ``struct page *`` address of page frame number 0.
+    :return: List of (``struct mem_cgroup *`` address, anonymous pages, file
+        pages, slab pages, unevictable pages) tuples, and list of (index in
+        the first list, ``struct inode *`` address, page cache pages) tuples.
+        See :func:`~drgn.helpers.linux.memcontrol.memcg_page_usage()`.
+    """
+    ...
+
+def _linux_helper_memcg_lru_sizes(
+    prog: Program, memcgs: Sequence[IntegerLike], num_nodes: IntegerLike
+) -> List[List[Tuple[int, ...]]]:
+    """
+    Get the LRU list sizes of memory cgroups.
+
+    :param memcgs: ``struct mem_cgroup *`` addresses.
+    :param num_nodes: Number of NUMA nodes.
+    :return: For each memory cgroup, for each node, the number of pages on
+        each LRU list in ``enum lru_list`` order. See
+        :func:`~drgn.helpers.linux.memcontrol.memcg_lru_sizes()`.
+    """
+    ...
+
 def _linux_helper_kaslr_offset(prog: Program) -> int:
     """
     Get the kernel address space layout randomization offset (zero if it is
@@ -50,6 +50,7 @@ from _drgn import (
     Architecture,
     FaultError,
     FindObjectFlags,
+    IndexCategory,
     IntegerLike,
     Language,
     MissingDebugInfoError,
@@ -71,6 +72,8 @@ from _drgn import (
     TypeKind,
     TypeMember,
     TypeParameter,
+    Watch,
+    _with_libcurl as _with_libcurl,
     _with_libkdumpfile as _with_libkdumpfile,
     cast,
     container_of,
@@ -88,6 +91,7 @@ __all__ = (
     "Architecture",
     "FaultError",
     "FindObjectFlags",
+    "IndexCategory",
     "IntegerLike",
     "Language",
     "MissingDebugInfoError",
@@ -110,6 +114,7 @@ __all__ = (
     "TypeKind",
     "TypeMember",
     "TypeParameter",
+    "Watch",
     "cast",
     "container_of",
     "execscript",
@@ -23,9 +23,9 @@ useful for scripts or for implementing other helpers.
 
 import enum
 import typing
-from typing import Container, Iterable, List, Tuple
+from typing import Container, Dict, Iterable, List, Optional, Tuple
 
-from drgn import Type
+from drgn import Program, Symbol, Type
 
 
 def escape_ascii_character(
@@ -117,3 +117,25 @@ def enum_type_to_class(
         if name not in exclude
     ]
     return enum.IntEnum(name, enumerators)  # type: ignore  # python/mypy#4865
+
+
+def symbolize_addresses(
+    prog: Program, addresses: Iterable[int]
+) -> Dict[int, Optional[Symbol]]:
+    """
+    Look up the symbols containing many addresses, e.g., the callers or
+    callbacks returned by a helper. Each distinct address is only looked up
+    once.
+
+    :return: Mapping from each address to its :class:`drgn.Symbol`, or
+        ``None`` if the address is zero or not in a known symbol.
+    """
+    symbols: Dict[int, Optional[Symbol]] = {}
+    for address in addresses:
+        if address in symbols:
+            continue
+        try:
+            symbols[address] = prog.symbol(address) if address else None
+        except LookupError:
+            symbols[address] = None
+    return symbols
@@ -10,18 +10,21 @@ Linux block layer, including disks (``struct gendisk``) and partitions
 (``struct hd_struct``).
 """
 
-from typing import Iterator
+from typing import Iterable, Iterator, List, NamedTuple, Optional
 
+from _drgn import _linux_helper_blk_mq_requests
 from drgn import Object, Program, container_of
 from drgn.helpers import escape_ascii_string
 from drgn.helpers.linux.device import MAJOR, MINOR, MKDEV
 from drgn.helpers.linux.list import list_for_each_entry
 
 __all__ = (
+    "InflightRequest",
     "disk_devt",
     "disk_name",
     "for_each_disk",
     "for_each_partition",
+    "inflight_requests",
     "part_devt",
     "part_name",
     "print_disks",
@@ -126,3 +129,74 @@ def print_partitions(prog: Program) -> None:
         print(
             f"{MAJOR(devt)}:{MINOR(devt)} {name} ({part.type_.type_name()})0x{part.value_():x}"
         )
+
+
+class InflightRequest(NamedTuple):
+    """An in-flight request returned by :func:`inflight_requests()`."""
+
+    disk: Object
+    """``struct gendisk *``"""
+    hctx: Object
+    """``struct blk_mq_hw_ctx *``"""
+    hctx_index: int
+    """Number of the hardware queue (``hctx->queue_num``)."""
+    rq: Object
+    """``struct request *``"""
+    tag: int
+    """Driver tag, or -1 if the request hasn't been dispatched to the driver."""
+    internal_tag: int
+    """Scheduler tag, or -1 if the queue doesn't have an I/O scheduler."""
+    op: int
+    """Operation (``REQ_OP_READ``, ``REQ_OP_WRITE``, etc.)."""
+    cmd_flags: int
+    sector: int
+    size: int
+    """Size in bytes."""
+    start_time_ns: int
+    """
+    Time that the request was allocated in nanoseconds, or 0 if it is unknown.
+    """
+    state: Optional[int]
+    """
+    ``enum mq_rq_state`` (e.g., ``MQ_RQ_IN_FLIGHT``), or ``None`` if it is
+    unknown.
+    """
+
+
+def inflight_requests(
+    prog: Program, disks: Optional[Iterable[Object]] = None
+) -> List[InflightRequest]:
+    """
+    Get the in-flight requests of blk-mq disks, sorted by disk, hardware queue,
+    and tag.
+
+    The tags of hardware queues are scanned in C, with each shared tag set only
+    scanned once, and the requests are read in bulk, so this is practical even
+    for NVMe devices with hundreds of hardware queues.
+
+    >>> for r in inflight_requests(prog):
+    ...     print(disk_name(r.disk), r.hctx_index, r.tag, r.sector, r.size)
+    ...
+    b'nvme0n1' 3 17 1843296 4096
+    b'nvme0n1' 12 5 392 131072
+
+    :param disks: ``struct gendisk *`` objects. Defaults to all disks. Disks
+        that don't use blk-mq are skipped.
+    """
+    if disks is None:
+        disks = for_each_disk(prog)
+    mq_disks = [disk for disk in disks if disk.queue]
+    hctx_type = prog.type("struct blk_mq_hw_ctx *")
+    rq_type = prog.type("struct request *")
+    return [
+        InflightRequest(
+            mq_disks[queue],
+            Object(prog, hctx_type, value=hctx),
+            hctx_index,
+            Object(prog, rq_type, value=rq),
+            *rest,
+        )
+        for queue, hctx, hctx_index, rq, *rest in _linux_helper_blk_mq_requests(
+            prog, [disk.queue.value_() for disk in mq_disks]
+        )
+    ]
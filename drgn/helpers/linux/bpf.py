@@ -12,14 +12,16 @@ etc.
 
 
 import itertools
-from typing import Iterator
+from typing import Iterator, Tuple
 
+from _drgn import _linux_helper_bpf_map_items
 from drgn import IntegerLike, Object, Program, cast
 from drgn.helpers.linux.idr import idr_for_each
 from drgn.helpers.linux.list import list_for_each_entry
 
 __all__ = (
     "bpf_map_for_each",
+    "bpf_map_items",
     "bpf_prog_for_each",
     "cgroup_bpf_prog_for_each",
     "cgroup_bpf_prog_for_each_effective",
@@ -36,6 +38,33 @@ def bpf_map_for_each(prog: Program) -> Iterator[Object]:
         yield cast("struct bpf_map *", entry)
 
 
+def bpf_map_items(
+    map: Object, sum_percpu: IntegerLike = 0
+) -> Iterator[Tuple[bytes, bytes]]:
+    """
+    Iterate over the entries in a BPF map.
+
+    Hash, array, per-CPU hash, per-CPU array, and LRU hash maps are supported.
+    Entries are read in large batches in C, so this is suitable for maps with
+    millions of entries.
+
+    >>> for key, value in bpf_map_items(map):
+    ...     print(key.hex(), value.hex())
+    ...
+    0a000001 0100000000000000
+
+    Values of per-CPU maps are padded to 8 bytes and concatenated for each
+    possible CPU, like ``bpf_map_lookup_elem()`` from user space returns them.
+
+    :param map: ``struct bpf_map *``
+    :param sum_percpu: If non-zero, sum the values of per-CPU maps across all
+        possible CPUs instead, treating each value as an array of unsigned
+        integers of this size in bytes (1, 2, 4, or 8).
+    :return: Iterator of (key, value) tuples of :class:`bytes`.
+    """
+    return _linux_helper_bpf_map_items(map, sum_percpu=sum_percpu)
+
+
 def bpf_prog_for_each(prog: Program) -> Iterator[Object]:
     """
     Iterate over all BPF programs.
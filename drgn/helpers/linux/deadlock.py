@@ -0,0 +1,236 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+"""
+Deadlocks
+---------
+
+The ``drgn.helpers.linux.deadlock`` module provides helpers for analyzing
+blocked tasks, e.g., after a hung task panic. It finds the mutex, rw_semaphore,
+or completion that each blocked task is waiting for and the task that owns it,
+which forms a wait-for graph. Cycles in the graph are deadlocks.
+"""
+
+from typing import List, Optional
+
+from _drgn import _linux_helper_wait_graph
+from drgn import Object, Program, StackFrame, StackTrace
+
+__all__ = (
+    "BlockedTask",
+    "blocked_tasks",
+    "find_deadlocks",
+    "longest_wait_chains",
+    "wait_graph_report",
+)
+
+_TASK_INTERRUPTIBLE = 0x1
+_TASK_UNINTERRUPTIBLE = 0x2
+
+_LOCK_TYPES = {
+    "mutex": "struct mutex *",
+    "rwsem": "struct rw_semaphore *",
+    "completion": "struct completion *",
+}
+
+
+class BlockedTask:
+    """A task in the wait-for graph."""
+
+    task: Object
+    """``struct task_struct *``"""
+
+    stack_trace: Optional[StackTrace]
+    """Stack trace of the task, or ``None`` if it couldn't be unwound."""
+
+    blocking_frame: Optional[StackFrame]
+    """Frame in :attr:`stack_trace` that blocked on :attr:`lock`."""
+
+    lock_type: Optional[str]
+    """``"mutex"``, ``"rwsem"``, ``"completion"``, or ``None`` if unknown."""
+
+    lock: Optional[Object]
+    """
+    ``struct mutex *``, ``struct rw_semaphore *``, or ``struct completion *``
+    that the task is waiting for, or ``None`` if it wasn't found.
+    """
+
+    owner: Optional[Object]
+    """
+    ``struct task_struct *`` that owns :attr:`lock`, or ``None`` if it is
+    unknown. Completions and read-locked rw_semaphores have no known owner.
+    """
+
+    waits_for: Optional["BlockedTask"]
+    """:attr:`owner` if it is also blocked."""
+
+    chain_length: int
+    """
+    Number of tasks that this task transitively waits for, or the length of
+    the cycle if :attr:`in_cycle`.
+    """
+
+    in_cycle: bool
+    """Whether this task is part of a deadlock."""
+
+    def __repr__(self) -> str:
+        return (
+            f"BlockedTask(pid={self.task.pid.value_()}, "
+            f"lock_type={self.lock_type!r}, "
+            f"lock={None if self.lock is None else hex(self.lock.value_())}, "
+            f"owner={None if self.owner is None else self.owner.pid.value_()})"
+        )
+
+
+def blocked_tasks(prog: Program, interruptible: bool = False) -> List[BlockedTask]:
+    """
+    Build the wait-for graph of blocked tasks.
+
+    Tasks are enumerated and their stacks are scanned in C, so this is fast
+    even with many tasks.
+
+    :param interruptible: Also include tasks in interruptible sleep (e.g.,
+        waiting in ``mutex_lock_interruptible()``), not just uninterruptible
+        sleep.
+    """
+    state_mask = _TASK_UNINTERRUPTIBLE
+    if interruptible:
+        state_mask |= _TASK_INTERRUPTIBLE
+    raw = _linux_helper_wait_graph(prog, state_mask)
+    result = []
+    for (
+        task,
+        trace,
+        frame,
+        lock_type,
+        lock,
+        owner,
+        _,
+        chain_length,
+        in_cycle,
+    ) in raw:
+        blocked = BlockedTask()
+        blocked.task = Object(prog, "struct task_struct *", value=task)
+        blocked.stack_trace = trace
+        blocked.blocking_frame = (
+            None if trace is None or frame is None else trace[frame]
+        )
+        blocked.lock_type = lock_type
+        blocked.lock = (
+            Object(prog, _LOCK_TYPES[lock_type], value=lock)
+            if lock_type is not None and lock
+            else None
+        )
+        blocked.owner = (
+            Object(prog, "struct task_struct *", value=owner) if owner else None
+        )
+        blocked.chain_length = chain_length
+        blocked.in_cycle = in_cycle
+        result.append(blocked)
+    for blocked, item in zip(result, raw):
+        owner_index = item[6]
+        blocked.waits_for = None if owner_index is None else result[owner_index]
+    return result
+
+
+def _chain(blocked: BlockedTask) -> List[BlockedTask]:
+    chain = [blocked]
+    seen = {id(blocked)}
+    while chain[-1].waits_for is not None and id(chain[-1].waits_for) not in seen:
+        chain.append(chain[-1].waits_for)
+        seen.add(id(chain[-1]))
+    return chain
+
+
+def find_deadlocks(graph: List[BlockedTask]) -> List[List[BlockedTask]]:
+    """
+    Find the cycles in a wait-for graph.
+
+    :param graph: Return value of :func:`blocked_tasks()`.
+    :return: List of cycles, each of which is a list of tasks where each task
+        waits for the next one and the last one waits for the first.
+    """
+    cycles = []
+    seen = set()
+    for blocked in graph:
+        if blocked.in_cycle and id(blocked) not in seen:
+            cycle = _chain(blocked)
+            seen.update(id(b) for b in cycle)
+            cycles.append(cycle)
+    return cycles
+
+
+def longest_wait_chains(
+    graph: List[BlockedTask], n: int = 5
+) -> List[List[BlockedTask]]:
+    """
+    Find the longest chains of tasks waiting for each other that aren't
+    deadlocks.
+
+    :param graph: Return value of :func:`blocked_tasks()`.
+    :param n: Maximum number of chains to return.
+    :return: List of chains, longest first. Each chain is a list of tasks where
+        each task waits for the next one. The owner of the last task's lock (if
+        known) is not blocked.
+    """
+    # Only chains starting at a task that nobody waits for are interesting;
+    # the others are suffixes of those.
+    waited_for = {id(b.waits_for) for b in graph if b.waits_for is not None}
+    heads = [
+        b
+        for b in graph
+        if not b.in_cycle and b.chain_length > 0 and id(b) not in waited_for
+    ]
+    heads.sort(key=lambda b: b.chain_length, reverse=True)
+    return [_chain(b) for b in heads[:n]]
+
+
+def _format_task(blocked: BlockedTask) -> str:
+    task = blocked.task
+    line = f"PID {task.pid.value_()} ({task.comm.string_().decode(errors='replace')})"
+    if blocked.lock is not None:
+        line += f" waiting for {blocked.lock_type} {hex(blocked.lock.value_())}"
+    elif blocked.lock_type is not None:
+        line += f" waiting for unknown {blocked.lock_type}"
+    if blocked.owner is not None:
+        line += f" owned by PID {blocked.owner.pid.value_()}"
+    return line
+
+
+def wait_graph_report(
+    prog: Program, num_chains: int = 5, interruptible: bool = False
+) -> str:
+    """
+    Analyze blocked tasks and format a report of deadlocks and the longest wait
+    chains, including the stack trace of each task involved.
+
+    >>> print(wait_graph_report(prog))
+
+    :param num_chains: Maximum number of wait chains to include.
+    :param interruptible: See :func:`blocked_tasks()`.
+    """
+    graph = blocked_tasks(prog, interruptible)
+    lines = [f"{len(graph)} blocked tasks"]
+
+    def append_tasks(tasks: List[BlockedTask]) -> None:
+        for blocked in tasks:
+            lines.append("  " + _format_task(blocked))
+            if blocked.stack_trace is not None:
+                for trace_line in str(blocked.stack_trace).splitlines():
+                    lines.append("    " + trace_line)
+
+    deadlocks = find_deadlocks(graph)
+    for i, cycle in enumerate(deadlocks):
+        lines.append("")
+        lines.append(f"Deadlock {i + 1} ({len(cycle)} tasks):")
+        append_tasks(cycle)
+    if not deadlocks:
+        lines.append("No deadlocks found")
+    for i, chain in enumerate(longest_wait_chains(graph, num_chains)):
+        lines.append("")
+        lines.append(f"Wait chain {i + 1} ({len(chain)} tasks):")
+        append_tasks(chain)
+        last = chain[-1]
+        if last.owner is not None and last.waits_for is None:
+            lines.append(f"  PID {last.owner.pid.value_()} (not blocked)")
+    return "\n".join(lines)
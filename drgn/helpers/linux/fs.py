@@ -12,7 +12,13 @@ Linux virtual filesystem (VFS) layer, including mounts, dentries, and inodes.
 import os
 from typing import Iterator, Optional, Tuple, Union, overload
 
-from drgn import IntegerLike, Object, Path, Program, container_of, sizeof
+from _drgn import (
+    _linux_helper_d_path,
+    _linux_helper_d_paths as d_paths,
+    _linux_helper_dentry_path as dentry_path,
+    _linux_helper_find_open_files as find_open_files,
+)
+from drgn import IntegerLike, Object, Path, Program, container_of
 from drgn.helpers import escape_ascii_string
 from drgn.helpers.linux.list import (
     hlist_empty,
@@ -24,6 +30,7 @@ from drgn.helpers.linux.list import (
 __all__ = (
     "path_lookup",
     "d_path",
+    "d_paths",
     "dentry_path",
     "inode_path",
     "inode_paths",
@@ -34,6 +41,7 @@ __all__ = (
     "print_mounts",
     "fget",
     "for_each_file",
+    "find_open_files",
     "print_files",
 )
 
@@ -155,52 +163,9 @@ def d_path(  # type: ignore  # Need positional-only arguments.
     path_or_vfsmnt: Object, dentry: Optional[Object] = None
 ) -> bytes:
     if dentry is None:
-        vfsmnt = path_or_vfsmnt.mnt
-        dentry = path_or_vfsmnt.dentry.read_()
+        return _linux_helper_d_path(path_or_vfsmnt.mnt, path_or_vfsmnt.dentry)
     else:
-        vfsmnt = path_or_vfsmnt
-        dentry = dentry.read_()
-    mnt = container_of(vfsmnt, "struct mount", "mnt")
-
-    d_op = dentry.d_op.read_()
-    if d_op and d_op.d_dname:
-        return b"[" + dentry.d_inode.i_sb.s_type.name.string_() + b"]"
-
-    components = []
-    while True:
-        if dentry == mnt.mnt.mnt_root:
-            mnt_parent = mnt.mnt_parent.read_()
-            if mnt == mnt_parent:
-                break
-            dentry = mnt.mnt_mountpoint.read_()
-            mnt = mnt_parent
-            continue
-        d_parent = dentry.d_parent.read_()
-        if dentry == d_parent:
-            break
-        components.append(dentry.d_name.name.string_())
-        components.append(b"/")
-        dentry = d_parent
-    if components:
-        return b"".join(reversed(components))
-    else:
-        return b"/"
-
-
-def dentry_path(dentry: Object) -> bytes:
-    """
-    Return the path of a dentry from the root of its filesystem.
-
-    :param dentry: ``struct dentry *``
-    """
-    components = []
-    while True:
-        d_parent = dentry.d_parent.read_()
-        if dentry == d_parent:
-            break
-        components.append(dentry.d_name.name.string_())
-        dentry = d_parent
-    return b"/".join(reversed(components))
+        return _linux_helper_d_path(path_or_vfsmnt, dentry)
 
 
 def inode_path(inode: Object) -> Optional[bytes]:
@@ -339,15 +304,8 @@ def for_each_file(task: Object) -> Iterator[Tuple[int, Object]]:
     :param task: ``struct task_struct *``
     :return: Iterator of (fd, ``struct file *``) tuples.
     """
-    fdt = task.files.fdt.read_()
-    bits_per_long = 8 * sizeof(fdt.open_fds.type_.type)
-    for i in range((fdt.max_fds.value_() + bits_per_long - 1) // bits_per_long):
-        word = fdt.open_fds[i].value_()
-        for j in range(bits_per_long):
-            if word & (1 << j):
-                fd = i * bits_per_long + j
-                file = fdt.fd[fd].read_()
-                yield fd, file
+    for _, fd, file in find_open_files(task.prog_, [task]):
+        yield fd, file
 
 
 def print_files(task: Object) -> None:
@@ -0,0 +1,75 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+"""
+Ftrace
+------
+
+The ``drgn.helpers.linux.ftrace`` module provides helpers for extracting the
+contents of the ftrace ring buffer (:linux:`kernel/trace/ring_buffer.c`), which
+is useful for seeing what the kernel was doing leading up to a crash.
+"""
+
+from typing import BinaryIO, Iterator, Optional, Tuple
+
+from _drgn import (
+    _linux_helper_ftrace_events,
+    _linux_helper_ftrace_write_trace_dat,
+)
+from drgn import Object, Program
+
+__all__ = (
+    "ftrace_events",
+    "ftrace_lines",
+    "ftrace_write_trace_dat",
+)
+
+
+def ftrace_events(
+    prog: Program, trace_array: Optional[Object] = None
+) -> Iterator[Tuple[int, int, Optional[str], bytes]]:
+    """
+    Iterate over the events in the ftrace ring buffer of every CPU, merged in
+    timestamp order.
+
+    Event formats are read once up front, and buffer pages are decoded lazily,
+    so this is suitable for large buffers.
+
+    :param trace_array: ``struct trace_array *`` of a tracing instance. Defaults
+        to the global trace buffer.
+    :return: Iterator of (CPU, timestamp, event name, raw event data) tuples.
+        The event name is ``None`` if the event type is not known.
+    """
+    return _linux_helper_ftrace_events(prog, trace_array)
+
+
+def ftrace_lines(prog: Program, trace_array: Optional[Object] = None) -> Iterator[str]:
+    """
+    Iterate over the events in the ftrace ring buffer formatted as text, like
+    the ``trace`` file in tracefs.
+
+    Each line contains the PID, CPU, timestamp, event name, and the value of
+    each field of the event, but the event's ``print fmt`` is not interpreted.
+
+    :param trace_array: See :func:`ftrace_events()`.
+    """
+    return _linux_helper_ftrace_events(prog, trace_array, text=True)
+
+
+def ftrace_write_trace_dat(
+    prog: Program, file: BinaryIO, trace_array: Optional[Object] = None
+) -> None:
+    """
+    Write the ftrace ring buffer to a file in the ``trace.dat`` format used by
+    ``trace-cmd``, which can then be analyzed with ``trace-cmd report`` or
+    KernelShark.
+
+    >>> with open("trace.dat", "wb") as f:
+    ...     ftrace_write_trace_dat(prog, f)
+
+    Kernel symbols and saved command lines are not included.
+
+    :param file: Binary file to write to.
+    :param trace_array: See :func:`ftrace_events()`.
+    """
+    _linux_helper_ftrace_write_trace_dat(prog, file, trace_array)
@@ -11,12 +11,23 @@ implemented.
 """
 
 import operator
-from typing import Any, Iterator, List, Optional, Union, overload
+from typing import (
+    Any,
+    Iterator,
+    List,
+    NamedTuple,
+    Optional,
+    Union,
+    overload,
+)
 
-from _drgn import _linux_helper_read_vm
-from drgn import IntegerLike, Object, Program, cast
+from _drgn import _linux_helper_read_vm, _linux_helper_vmap_areas
+from drgn import IntegerLike, Object, Program, Symbol, cast
+from drgn.helpers import symbolize_addresses
 
 __all__ = (
+    "VmallocCaller",
+    "VmapArea",
     "access_process_vm",
     "access_remote_vm",
     "cmdline",
@@ -28,6 +39,8 @@ __all__ = (
     "pfn_to_virt",
     "virt_to_page",
     "virt_to_pfn",
+    "vmalloc_callers",
+    "vmap_areas",
 )
 
 
@@ -273,3 +286,106 @@ def environ(task: Object) -> List[bytes]:
     env_start = mm.env_start.value_()
     env_end = mm.env_end.value_()
     return access_remote_vm(mm, env_start, env_end - env_start).split(b"\0")[:-1]
+
+
+_NOT_VALIDATED = 2 ** 64 - 1
+
+
+class VmapArea(NamedTuple):
+    """An allocated vmalloc/vmap area returned by :func:`vmap_areas()`."""
+
+    va: Object
+    """``struct vmap_area *``"""
+    start: int
+    size: int
+    """Size of the address range, including any guard page."""
+    vm: Object
+    """
+    ``struct vm_struct *``, or ``NULL`` if the area doesn't have one (e.g.,
+    ``vm_map_ram()`` areas).
+    """
+    flags: int
+    """``VM_*`` flags."""
+    caller: int
+    """Address of the function that created the area, or 0."""
+    symbol: Optional[Symbol]
+    """Symbol containing :attr:`caller`, or ``None`` if it is unknown."""
+    nr_pages: int
+    """Number of pages allocated by ``vmalloc()``."""
+    mapped_pages: Optional[int]
+    """
+    Number of pages mapped in the kernel page table, or ``None`` if the area
+    wasn't validated.
+    """
+
+
+class VmallocCaller(NamedTuple):
+    """Totals of the vmap areas created by one caller."""
+
+    caller: int
+    """Address of the caller, or 0 for areas without a ``struct vm_struct``."""
+    symbol: Optional[Symbol]
+    count: int
+    size: int
+    nr_pages: int
+    mapped_pages: Optional[int]
+
+
+def vmap_areas(prog: Program, validate: bool = False) -> List[VmapArea]:
+    """
+    Get all allocated vmalloc/vmap areas, sorted by start address.
+
+    The areas are read in C, and each distinct caller is only symbolized once,
+    so this is practical even with hundreds of thousands of areas.
+
+    :param validate: Also count the pages of each area that are actually mapped
+        by walking the kernel page table.
+    """
+    areas, callers = _linux_helper_vmap_areas(prog, validate)
+    symbols = symbolize_addresses(prog, [caller[0] for caller in callers])
+    va_type = prog.type("struct vmap_area *")
+    vm_type = prog.type("struct vm_struct *")
+    return [
+        VmapArea(
+            Object(prog, va_type, value=va),
+            start,
+            size,
+            Object(prog, vm_type, value=vm),
+            flags,
+            caller,
+            symbols[caller],
+            nr_pages,
+            None if mapped_pages == _NOT_VALIDATED else mapped_pages,
+        )
+        for va, start, size, vm, flags, caller, nr_pages, mapped_pages in areas
+    ]
+
+
+def vmalloc_callers(prog: Program, validate: bool = False) -> List[VmallocCaller]:
+    """
+    Get the total number and size of vmalloc/vmap areas created by each
+    caller, largest first. This is useful for finding vmalloc leaks.
+
+    >>> for c in vmalloc_callers(prog)[:3]:
+    ...     print(c.symbol.name if c.symbol else hex(c.caller), c.count, c.size)
+    ...
+    load_module 95 12136448
+    alloc_thread_stack_node 571 9355264
+    bpf_prog_alloc_no_stats 84 1376256
+
+    :param validate: Also count the pages that are actually mapped by walking
+        the kernel page table.
+    """
+    _, callers = _linux_helper_vmap_areas(prog, validate)
+    symbols = symbolize_addresses(prog, [caller[0] for caller in callers])
+    return [
+        VmallocCaller(
+            caller,
+            symbols[caller],
+            count,
+            size,
+            nr_pages,
+            None if mapped_pages == _NOT_VALIDATED else mapped_pages,
+        )
+        for caller, count, size, nr_pages, mapped_pages in callers
+    ]
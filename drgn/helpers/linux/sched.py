@@ -9,9 +9,17 @@ The ``drgn.helpers.linux.sched`` module provides helpers for working with the
 Linux CPU scheduler.
 """
 
-from drgn import Object
+from typing import Dict, List, NamedTuple
 
-__all__ = ("task_state_to_char",)
+from _drgn import _linux_helper_runqueue_snapshot
+from drgn import Object, Program
+
+__all__ = (
+    "RunqueueSnapshot",
+    "RunqueueTask",
+    "runqueue_snapshot",
+    "task_state_to_char",
+)
 
 _TASK_NOLOAD = 0x400
 
@@ -56,3 +64,86 @@ def task_state_to_char(task: Object) -> str:
         return "I"
     else:
         return char
+
+
+class RunqueueTask(NamedTuple):
+    """A runnable task in a :class:`RunqueueSnapshot`."""
+
+    task: Object
+    """``struct task_struct *``"""
+    queue: str
+    """
+    ``"current"`` if the task is running on the CPU, otherwise the class of
+    the queue it is on: ``"dl"``, ``"rt"``, or ``"fair"``.
+    """
+    policy: int
+    """Scheduling policy (e.g., ``SCHED_NORMAL``)."""
+    prio: int
+    """Effective priority."""
+    vruntime: int
+    """Virtual runtime in nanoseconds (fair scheduling class)."""
+    deadline: int
+    """Absolute deadline (``SCHED_DEADLINE`` only)."""
+    sum_exec_runtime: int
+    """Total time spent on the CPU in nanoseconds."""
+
+
+class RunqueueSnapshot(NamedTuple):
+    """State of the runqueue of a CPU."""
+
+    cpu: int
+    rq: Object
+    """``struct rq *``"""
+    curr: Object
+    """``struct task_struct *`` running on the CPU."""
+    clock: int
+    clock_task: int
+    nr_running: int
+    min_vruntime: int
+    """Minimum virtual runtime of the root CFS runqueue."""
+    tasks: List[RunqueueTask]
+    """
+    Runnable tasks: the current task first, followed by the deadline,
+    real-time, and fair queues in the order that the scheduler would pick from
+    them. Tasks in task groups are included in place of their group.
+    """
+
+
+def runqueue_snapshot(prog: Program) -> List[RunqueueSnapshot]:
+    """
+    Get the runqueue of every possible CPU.
+
+    This reads each ``struct rq`` at once and walks the CFS, real-time, and
+    deadline queues in C, which is much faster than walking them with
+    :mod:`drgn.helpers.linux.rbtree` and :mod:`drgn.helpers.linux.list` on
+    machines with many CPUs.
+    """
+    cpus, tasks = _linux_helper_runqueue_snapshot(prog)
+    task_type = prog.type("struct task_struct *")
+    rq_type = prog.type("struct rq *")
+    tasks_by_cpu: Dict[int, List[RunqueueTask]] = {}
+    for cpu, task, queue, policy, prio, vruntime, deadline, sum_exec_runtime in tasks:
+        tasks_by_cpu.setdefault(cpu, []).append(
+            RunqueueTask(
+                Object(prog, task_type, value=task),
+                queue,
+                policy,
+                prio,
+                vruntime,
+                deadline,
+                sum_exec_runtime,
+            )
+        )
+    return [
+        RunqueueSnapshot(
+            cpu,
+            Object(prog, rq_type, value=rq),
+            Object(prog, task_type, value=curr),
+            clock,
+            clock_task,
+            nr_running,
+            min_vruntime,
+            tasks_by_cpu.get(cpu, []),
+        )
+        for cpu, rq, curr, clock, clock_task, nr_running, min_vruntime in cpus
+    ]
@@ -0,0 +1,103 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+"""
+Timers
+------
+
+The ``drgn.helpers.linux.timer`` module provides helpers for finding pending
+timers in the timer wheel (``struct timer_list``) and high-resolution timers
+(``struct hrtimer``), e.g., to debug stuck timers or timer storms.
+"""
+
+from typing import List, NamedTuple, Optional
+
+from _drgn import _linux_helper_timers
+from drgn import Object, Program, Symbol
+from drgn.helpers import symbolize_addresses
+
+__all__ = (
+    "PendingTimer",
+    "TimerCallback",
+    "pending_timers",
+    "timer_callbacks",
+)
+
+
+class PendingTimer(NamedTuple):
+    """A pending timer returned by :func:`pending_timers()`."""
+
+    cpu: int
+    kind: str
+    """``"timer"`` for the timer wheel or ``"hrtimer"``."""
+    base: int
+    """
+    Index of the timer base in ``timer_bases`` (e.g., ``BASE_STD`` or
+    ``BASE_DEF``) or of the clock base in ``hrtimer_cpu_base::clock_base``
+    (e.g., ``HRTIMER_BASE_MONOTONIC``).
+    """
+    timer: Object
+    """``struct timer_list *`` or ``struct hrtimer *``"""
+    expires: int
+    """Expiration time in jiffies for timers and nanoseconds for hrtimers."""
+    function: int
+    """Address of the callback."""
+    symbol: Optional[Symbol]
+    """Symbol of the callback, or ``None`` if it is unknown."""
+
+
+class TimerCallback(NamedTuple):
+    """Number of pending timers with one callback."""
+
+    function: int
+    symbol: Optional[Symbol]
+    timers: int
+    hrtimers: int
+
+
+def pending_timers(prog: Program) -> List[PendingTimer]:
+    """
+    Get the pending timers of every possible CPU, sorted by CPU, kind, base,
+    and expiration time.
+
+    The timer wheels and hrtimer queues of all CPUs are read in C, and each
+    distinct callback is only symbolized once, so this is practical on machines
+    with hundreds of CPUs.
+    """
+    timers, callbacks = _linux_helper_timers(prog)
+    symbols = symbolize_addresses(prog, [callback[0] for callback in callbacks])
+    types = {
+        "timer": prog.type("struct timer_list *"),
+        "hrtimer": prog.type("struct hrtimer *"),
+    }
+    return [
+        PendingTimer(
+            cpu,
+            kind,
+            base,
+            Object(prog, types[kind], value=timer),
+            expires,
+            function,
+            symbols[function],
+        )
+        for cpu, kind, base, timer, expires, function in timers
+    ]
+
+
+def timer_callbacks(prog: Program) -> List[TimerCallback]:
+    """
+    Count the pending timers of every possible CPU by callback, most first.
+
+    >>> for c in timer_callbacks(prog)[:3]:
+    ...     print(c.symbol.name, c.timers, c.hrtimers)
+    ...
+    delayed_work_timer_fn 1204 0
+    tick_sched_timer 0 384
+    process_timeout 97 0
+    """
+    _, callbacks = _linux_helper_timers(prog)
+    symbols = symbolize_addresses(prog, [callback[0] for callback in callbacks])
+    return [
+        TimerCallback(function, symbols[function], timers, hrtimers)
+        for function, timers, hrtimers in callbacks
+    ]
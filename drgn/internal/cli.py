@@ -43,7 +43,8 @@ def displayhook(value: Any) -> None:
 def main() -> None:
     python_version = ".".join(str(v) for v in sys.version_info[:3])
     libkdumpfile = f'with{"" if drgn._with_libkdumpfile else "out"} libkdumpfile'
-    version = f"drgn {drgn.__version__} (using Python {python_version}, {libkdumpfile})"
+    libcurl = f'with{"" if drgn._with_libcurl else "out"} libcurl'
+    version = f"drgn {drgn.__version__} (using Python {python_version}, {libkdumpfile}, {libcurl})"
     parser = argparse.ArgumentParser(prog="drgn", description="Scriptable debugger")
 
     program_group = parser.add_argument_group(
@@ -53,7 +54,11 @@ def main() -> None:
         "-k", "--kernel", action="store_true", help="debug the running kernel (default)"
     )
     program_group.add_argument(
-        "-c", "--core", metavar="PATH", type=str, help="debug the given core dump"
+        "-c",
+        "--core",
+        metavar="PATH",
+        type=str,
+        help="debug the given core dump file or URL",
     )
     program_group.add_argument(
         "-p",
@@ -62,6 +67,12 @@ def main() -> None:
         type=int,
         help="debug the running process with the given PID",
     )
+    program_group.add_argument(
+        "--guest",
+        metavar="PATH",
+        type=str,
+        help="debug the running x86-64 virtual machine whose RAM is backed by the given file",
+    )
 
     symbol_group = parser.add_argument_group("debugging symbols")
     symbol_group.add_argument(
@@ -111,6 +122,8 @@ def main() -> None:
         prog.set_core_dump(args.core)
     elif args.pid is not None:
         prog.set_pid(args.pid or os.getpid())
+    elif args.guest is not None:
+        prog.set_guest_memory(args.guest)
     else:
         prog.set_kernel()
     if args.default_symbols is None:
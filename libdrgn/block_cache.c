@@ -0,0 +1,421 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "block_cache.h"
+#include "error.h"
+#include "hash_table.h"
+#include "minmax.h"
+#include "util.h"
+
+/* Minimum number of blocks in a cache. */
+#define DRGN_BLOCK_CACHE_MIN_BLOCKS (4 * DRGN_BLOCK_CACHE_MAX_READAHEAD)
+
+DEFINE_HASH_MAP(drgn_block_cache_map, uint64_t, uint32_t, int_key_hash_pair,
+		scalar_key_eq)
+
+enum {
+	DRGN_BLOCK_CACHE_FREE,
+	DRGN_BLOCK_CACHE_PROBATION,
+	DRGN_BLOCK_CACHE_PROTECTED,
+	DRGN_BLOCK_CACHE_NUM_LISTS,
+};
+
+struct drgn_block_cache_slot {
+	/* Block number in the file. */
+	uint64_t block;
+	/* Number of valid bytes. Only the last block in a file is short. */
+	uint32_t len;
+	/* Links in the slot's list. */
+	uint32_t prev, next;
+	uint8_t list;
+	/* Whether the block was read ahead and hasn't been accessed yet. */
+	bool readahead;
+};
+
+struct drgn_block_fd_source {
+	struct drgn_block_source source;
+	int fd;
+};
+
+struct drgn_block_cache {
+	struct drgn_block_source *source;
+	/* Used as the source if the cache was created from a file descriptor. */
+	struct drgn_block_fd_source fd_source;
+	uint32_t num_blocks;
+	/* Maximum number of blocks in the protected segment. */
+	uint32_t max_protected;
+	uint32_t num_protected;
+	uint32_t max_readahead;
+	/* Number of blocks to read on the next sequential miss. */
+	uint32_t readahead;
+	/* Block accessed most recently. */
+	uint64_t last_block;
+	unsigned char *data;
+	/*
+	 * num_blocks slots followed by the heads of the free, probation, and
+	 * protected lists. The lists are circular and ordered from most to
+	 * least recently used.
+	 */
+	struct drgn_block_cache_slot *slots;
+	struct drgn_block_cache_map map;
+	struct drgn_direct_io_stats stats;
+};
+
+static inline uint32_t list_head(struct drgn_block_cache *cache, int list)
+{
+	return cache->num_blocks + list;
+}
+
+static void list_remove(struct drgn_block_cache *cache, uint32_t i)
+{
+	struct drgn_block_cache_slot *slot = &cache->slots[i];
+	cache->slots[slot->prev].next = slot->next;
+	cache->slots[slot->next].prev = slot->prev;
+	if (slot->list == DRGN_BLOCK_CACHE_PROTECTED)
+		cache->num_protected--;
+}
+
+/* Add a slot to the most recently used end of a list. */
+static void list_add(struct drgn_block_cache *cache, uint32_t i, int list)
+{
+	uint32_t head = list_head(cache, list);
+	struct drgn_block_cache_slot *slot = &cache->slots[i];
+	slot->list = list;
+	slot->prev = head;
+	slot->next = cache->slots[head].next;
+	cache->slots[slot->next].prev = i;
+	cache->slots[head].next = i;
+	if (list == DRGN_BLOCK_CACHE_PROTECTED)
+		cache->num_protected++;
+}
+
+/* Get the least recently used slot in a list, or UINT32_MAX if it's empty. */
+static uint32_t list_last(struct drgn_block_cache *cache, int list)
+{
+	uint32_t head = list_head(cache, list);
+	uint32_t i = cache->slots[head].prev;
+	return i == head ? UINT32_MAX : i;
+}
+
+static struct drgn_error *
+drgn_block_fd_source_read(struct drgn_block_source *source,
+			  const struct iovec *iov, int iovcnt, uint64_t offset,
+			  size_t *ret)
+{
+	struct drgn_block_fd_source *fd_source =
+		container_of(source, struct drgn_block_fd_source, source);
+	ssize_t r;
+	do {
+		r = preadv(fd_source->fd, iov, iovcnt, offset);
+	} while (r == -1 && errno == EINTR);
+	if (r == -1)
+		return drgn_error_create_os("preadv", errno, NULL);
+	*ret = r;
+	return NULL;
+}
+
+static void drgn_block_fd_source_destroy(struct drgn_block_source *source)
+{
+	struct drgn_block_fd_source *fd_source =
+		container_of(source, struct drgn_block_fd_source, source);
+	close(fd_source->fd);
+}
+
+struct drgn_error *drgn_block_cache_create(int fd, size_t size,
+					   struct drgn_block_cache **ret)
+{
+	struct drgn_error *err;
+	struct drgn_block_cache *cache;
+	err = drgn_block_cache_create_from_source(NULL, size, &cache);
+	if (err)
+		return err;
+	cache->fd_source.source.read = drgn_block_fd_source_read;
+	cache->fd_source.source.destroy = drgn_block_fd_source_destroy;
+	cache->fd_source.fd = fd;
+	cache->source = &cache->fd_source.source;
+	*ret = cache;
+	return NULL;
+}
+
+struct drgn_error *
+drgn_block_cache_create_from_source(struct drgn_block_source *source,
+				    size_t size,
+				    struct drgn_block_cache **ret)
+{
+	size_t num_blocks = size / DRGN_BLOCK_CACHE_BLOCK_SIZE;
+	if (num_blocks < DRGN_BLOCK_CACHE_MIN_BLOCKS)
+		num_blocks = DRGN_BLOCK_CACHE_MIN_BLOCKS;
+	if (num_blocks > UINT32_MAX - DRGN_BLOCK_CACHE_NUM_LISTS)
+		return &drgn_enomem;
+
+	struct drgn_block_cache *cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return &drgn_enomem;
+	cache->slots = malloc_array(num_blocks + DRGN_BLOCK_CACHE_NUM_LISTS,
+				    sizeof(*cache->slots));
+	if (!cache->slots)
+		goto err_cache;
+	/* O_DIRECT needs aligned buffers. Page alignment is always enough. */
+	size_t data_size;
+	if (__builtin_mul_overflow(num_blocks,
+				   (size_t)DRGN_BLOCK_CACHE_BLOCK_SIZE,
+				   &data_size) ||
+	    posix_memalign((void **)&cache->data, sysconf(_SC_PAGESIZE),
+			   data_size))
+		goto err_slots;
+
+	cache->source = source;
+	cache->num_blocks = num_blocks;
+	cache->max_protected = num_blocks - num_blocks / 4;
+	cache->max_readahead = min((size_t)DRGN_BLOCK_CACHE_MAX_READAHEAD,
+				   num_blocks / 4);
+	cache->readahead = 1;
+	cache->last_block = UINT64_MAX - 1;
+	for (int list = 0; list < DRGN_BLOCK_CACHE_NUM_LISTS; list++) {
+		uint32_t head = list_head(cache, list);
+		cache->slots[head].prev = cache->slots[head].next = head;
+	}
+	for (uint32_t i = 0; i < num_blocks; i++)
+		list_add(cache, i, DRGN_BLOCK_CACHE_FREE);
+	drgn_block_cache_map_init(&cache->map);
+	*ret = cache;
+	return NULL;
+
+err_slots:
+	free(cache->slots);
+err_cache:
+	free(cache);
+	return &drgn_enomem;
+}
+
+void drgn_block_cache_destroy(struct drgn_block_cache *cache)
+{
+	if (!cache)
+		return;
+	drgn_block_cache_map_deinit(&cache->map);
+	free(cache->data);
+	free(cache->slots);
+	cache->source->destroy(cache->source);
+	free(cache);
+}
+
+size_t drgn_block_cache_size(struct drgn_block_cache *cache)
+{
+	return (size_t)cache->num_blocks * DRGN_BLOCK_CACHE_BLOCK_SIZE;
+}
+
+const struct drgn_direct_io_stats *
+drgn_block_cache_stats(struct drgn_block_cache *cache)
+{
+	return &cache->stats;
+}
+
+static inline unsigned char *slot_data(struct drgn_block_cache *cache,
+				       uint32_t i)
+{
+	return cache->data + (size_t)i * DRGN_BLOCK_CACHE_BLOCK_SIZE;
+}
+
+/* Get a slot to read into, evicting a block if necessary. */
+static uint32_t drgn_block_cache_get_slot(struct drgn_block_cache *cache)
+{
+	uint32_t i = list_last(cache, DRGN_BLOCK_CACHE_FREE);
+	if (i == UINT32_MAX) {
+		i = list_last(cache, DRGN_BLOCK_CACHE_PROBATION);
+		if (i == UINT32_MAX)
+			i = list_last(cache, DRGN_BLOCK_CACHE_PROTECTED);
+		drgn_block_cache_map_delete(&cache->map,
+					    &cache->slots[i].block);
+		cache->stats.evictions++;
+	}
+	list_remove(cache, i);
+	return i;
+}
+
+size_t drgn_block_cache_resident(struct drgn_block_cache *cache)
+{
+	return drgn_block_cache_map_size(&cache->map) *
+	       DRGN_BLOCK_CACHE_BLOCK_SIZE;
+}
+
+void drgn_block_cache_shrink(struct drgn_block_cache *cache, size_t target)
+{
+	while (drgn_block_cache_resident(cache) > target) {
+		uint32_t i = list_last(cache, DRGN_BLOCK_CACHE_PROBATION);
+		if (i == UINT32_MAX)
+			i = list_last(cache, DRGN_BLOCK_CACHE_PROTECTED);
+		if (i == UINT32_MAX)
+			break;
+		drgn_block_cache_map_delete(&cache->map,
+					    &cache->slots[i].block);
+		cache->stats.evictions++;
+		list_remove(cache, i);
+		list_add(cache, i, DRGN_BLOCK_CACHE_FREE);
+		/* The data is read again before it's used. */
+		madvise(slot_data(cache, i), DRGN_BLOCK_CACHE_BLOCK_SIZE,
+			MADV_DONTNEED);
+	}
+}
+
+/* Record an access to a cached block. */
+static void drgn_block_cache_touch(struct drgn_block_cache *cache, uint32_t i)
+{
+	struct drgn_block_cache_slot *slot = &cache->slots[i];
+	int list;
+	if (slot->readahead) {
+		/* The first access to a block that was read ahead. */
+		slot->readahead = false;
+		list = DRGN_BLOCK_CACHE_PROBATION;
+	} else if (slot->block == cache->last_block) {
+		/*
+		 * Consecutive accesses to the same block (e.g., reading a
+		 * structure field by field) count as one.
+		 */
+		list = slot->list;
+	} else {
+		list = DRGN_BLOCK_CACHE_PROTECTED;
+	}
+	list_remove(cache, i);
+	list_add(cache, i, list);
+	if (cache->num_protected > cache->max_protected) {
+		uint32_t demote = list_last(cache, DRGN_BLOCK_CACHE_PROTECTED);
+		list_remove(cache, demote);
+		list_add(cache, demote, DRGN_BLOCK_CACHE_PROBATION);
+	}
+}
+
+/*
+ * Read a block that isn't cached, any following blocks needed by the current
+ * read, and possibly some blocks after those. Returns the slot of the first
+ * block.
+ */
+static struct drgn_error *drgn_block_cache_fill(struct drgn_block_cache *cache,
+						uint64_t block, uint64_t demand,
+						bool sequential, uint32_t *ret)
+{
+	uint32_t count = min(demand, (uint64_t)cache->max_readahead);
+	if (sequential) {
+		count = min(count + cache->readahead, cache->max_readahead);
+		cache->readahead = min(cache->readahead * 2,
+				       cache->max_readahead);
+	} else {
+		cache->readahead = 1;
+	}
+
+	uint32_t slots[DRGN_BLOCK_CACHE_MAX_READAHEAD];
+	struct iovec iov[DRGN_BLOCK_CACHE_MAX_READAHEAD];
+	uint32_t n = 0;
+	do {
+		slots[n] = drgn_block_cache_get_slot(cache);
+		iov[n].iov_base = slot_data(cache, slots[n]);
+		iov[n].iov_len = DRGN_BLOCK_CACHE_BLOCK_SIZE;
+		n++;
+	} while (n < count &&
+		 drgn_block_cache_map_search(&cache->map,
+					     &(uint64_t){ block + n }).entry == NULL);
+
+	size_t r;
+	struct drgn_error *err =
+		cache->source->read(cache->source, iov, n,
+				    block * DRGN_BLOCK_CACHE_BLOCK_SIZE, &r);
+	if (err) {
+		for (uint32_t j = 0; j < n; j++)
+			list_add(cache, slots[j], DRGN_BLOCK_CACHE_FREE);
+		return err;
+	}
+	cache->stats.misses++;
+	cache->stats.bytes_read += r;
+
+	for (uint32_t j = 0; j < n; j++) {
+		struct drgn_block_cache_slot *slot = &cache->slots[slots[j]];
+		size_t start = (size_t)j * DRGN_BLOCK_CACHE_BLOCK_SIZE;
+		/* Don't cache blocks past the end of the file. */
+		if (j > 0 && r <= start) {
+			list_add(cache, slots[j], DRGN_BLOCK_CACHE_FREE);
+			continue;
+		}
+		slot->block = block + j;
+		slot->len = r <= start ? 0 :
+			    min(r - start,
+				(size_t)DRGN_BLOCK_CACHE_BLOCK_SIZE);
+		slot->readahead = j >= demand;
+		struct drgn_block_cache_map_entry entry = {
+			.key = slot->block,
+			.value = slots[j],
+		};
+		if (drgn_block_cache_map_insert(&cache->map, &entry,
+						NULL) == -1) {
+			list_add(cache, slots[j], DRGN_BLOCK_CACHE_FREE);
+			if (j == 0)
+				return &drgn_enomem;
+			continue;
+		}
+		list_add(cache, slots[j], DRGN_BLOCK_CACHE_PROBATION);
+		if (slot->readahead)
+			cache->stats.readahead_blocks++;
+	}
+	*ret = slots[0];
+	return NULL;
+}
+
+struct drgn_error *drgn_block_cache_read(struct drgn_block_cache *cache,
+					 void *buf, size_t count,
+					 uint64_t offset, size_t *done_ret)
+{
+	struct drgn_error *err;
+	char *p = buf;
+	size_t done = 0;
+
+	if (!count) {
+		*done_ret = 0;
+		return NULL;
+	}
+	/*
+	 * Reads that start in or right after the last block that was accessed
+	 * continue a sequential scan.
+	 */
+	uint64_t end_block = (offset + count - 1) / DRGN_BLOCK_CACHE_BLOCK_SIZE;
+	bool sequential =
+		offset / DRGN_BLOCK_CACHE_BLOCK_SIZE - cache->last_block <= 1;
+	while (done < count) {
+		uint64_t block = offset / DRGN_BLOCK_CACHE_BLOCK_SIZE;
+		size_t block_offset = offset % DRGN_BLOCK_CACHE_BLOCK_SIZE;
+
+		struct drgn_block_cache_map_iterator it =
+			drgn_block_cache_map_search(&cache->map, &block);
+		uint32_t i;
+		if (it.entry) {
+			i = it.entry->value;
+			cache->stats.hits++;
+			drgn_block_cache_touch(cache, i);
+		} else {
+			err = drgn_block_cache_fill(cache, block,
+						    end_block - block + 1,
+						    sequential, &i);
+			if (err)
+				return err;
+		}
+		cache->last_block = block;
+
+		struct drgn_block_cache_slot *slot = &cache->slots[i];
+		if (block_offset >= slot->len)
+			break;
+		size_t n = min(count - done, slot->len - block_offset);
+		memcpy(p + done, slot_data(cache, i) + block_offset, n);
+		done += n;
+		offset += n;
+		if (slot->len < DRGN_BLOCK_CACHE_BLOCK_SIZE)
+			break;
+	}
+	cache->stats.bytes_copied += done;
+	*done_ret = done;
+	return NULL;
+}
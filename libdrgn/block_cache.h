@@ -0,0 +1,124 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+/**
+ * @file
+ *
+ * Direct I/O block cache.
+ *
+ * See @ref BlockCache.
+ */
+
+#ifndef DRGN_BLOCK_CACHE_H
+#define DRGN_BLOCK_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "drgn.h"
+
+/**
+ * @ingroup Internals
+ *
+ * @defgroup BlockCache Block cache
+ *
+ * Cache of file blocks read with direct I/O.
+ *
+ * A @ref drgn_block_cache reads a file opened with @c O_DIRECT in aligned
+ * blocks into a fixed-size cache in user space. This keeps huge core dumps
+ * from flooding the kernel page cache and avoids copying the data through it.
+ *
+ * The cache is a segmented LRU. Blocks enter a probationary segment and are
+ * only promoted to a protected segment if they are accessed again later, so a
+ * sequential scan over a huge file can only evict other blocks that were used
+ * once. When misses are sequential, the cache reads ahead, doubling the number
+ * of blocks read at a time up to @ref DRGN_BLOCK_CACHE_MAX_READAHEAD.
+ *
+ * Blocks are usually read from a file descriptor, but they can be read from
+ * any @ref drgn_block_source (e.g., a file on an HTTP server). The blocks
+ * missed by a read are always requested from the source at once, so a source
+ * with high latency can fetch them in parallel.
+ *
+ * @{
+ */
+
+/** Size of a block in a @ref drgn_block_cache. */
+#define DRGN_BLOCK_CACHE_BLOCK_SIZE (64 * 1024)
+
+/** Maximum number of blocks read at a time by a @ref drgn_block_cache. */
+#define DRGN_BLOCK_CACHE_MAX_READAHEAD 32
+
+struct drgn_block_cache;
+
+/** Source of the data cached by a @ref drgn_block_cache. */
+struct drgn_block_source {
+	/**
+	 * Read into @p iov starting at @p offset.
+	 *
+	 * @param[out] ret Returned number of bytes read. This is only less
+	 * than the total length of @p iov if the end of the file was reached.
+	 */
+	struct drgn_error *(*read)(struct drgn_block_source *source,
+				   const struct iovec *iov, int iovcnt,
+				   uint64_t offset, size_t *ret);
+	/** Free the source. */
+	void (*destroy)(struct drgn_block_source *source);
+};
+
+/**
+ * Create a @ref drgn_block_cache.
+ *
+ * @param[in] fd File descriptor opened with @c O_DIRECT. It is owned by the
+ * cache on success.
+ * @param[in] size Size of the cache in bytes. This is rounded up to a
+ * reasonable minimum.
+ * @param[out] ret Returned cache.
+ */
+struct drgn_error *drgn_block_cache_create(int fd, size_t size,
+					   struct drgn_block_cache **ret);
+
+/**
+ * Create a @ref drgn_block_cache reading from a @ref drgn_block_source.
+ *
+ * @param[in] source Source. It is owned by the cache on success.
+ * @param[in] size See @ref drgn_block_cache_create().
+ * @param[out] ret Returned cache.
+ */
+struct drgn_error *
+drgn_block_cache_create_from_source(struct drgn_block_source *source,
+				    size_t size,
+				    struct drgn_block_cache **ret);
+
+/** Destroy a @ref drgn_block_cache and close its file descriptor or source. */
+void drgn_block_cache_destroy(struct drgn_block_cache *cache);
+
+/** Get the size of a @ref drgn_block_cache in bytes. */
+size_t drgn_block_cache_size(struct drgn_block_cache *cache);
+
+/** Get the number of bytes of the file cached in a @ref drgn_block_cache. */
+size_t drgn_block_cache_resident(struct drgn_block_cache *cache);
+
+/**
+ * Evict the least recently used blocks from a @ref drgn_block_cache until at
+ * most @p target bytes are cached, and return their memory to the system.
+ */
+void drgn_block_cache_shrink(struct drgn_block_cache *cache, size_t target);
+
+/**
+ * Read from the file of a @ref drgn_block_cache.
+ *
+ * @param[out] done_ret Returned number of bytes read. This is less than @p
+ * count if the end of the file was reached.
+ */
+struct drgn_error *drgn_block_cache_read(struct drgn_block_cache *cache,
+					 void *buf, size_t count,
+					 uint64_t offset, size_t *done_ret);
+
+/** Get the statistics of a @ref drgn_block_cache. */
+const struct drgn_direct_io_stats *
+drgn_block_cache_stats(struct drgn_block_cache *cache);
+
+/** @} */
+
+#endif /* DRGN_BLOCK_CACHE_H */
@@ -70,6 +70,7 @@ def gen_constants(input_file, output_file):
 
 PyObject *Architecture_class;
 PyObject *FindObjectFlags_class;
+PyObject *IndexCategory_class;
 PyObject *PrimitiveType_class;
 PyObject *PlatformFlags_class;
 PyObject *ProgramFlags_class;
@@ -88,6 +89,14 @@ PyObject *TypeKind_class;
         (),
         r"DRGN_FIND_OBJECT_([a-zA-Z0-9_]+)",
     )
+    gen_constant_class(
+        drgn_h,
+        output_file,
+        "IndexCategory",
+        "Flag",
+        (),
+        r"DRGN_INDEX_([a-zA-Z0-9_]+)",
+    )
     gen_constant_class(
         drgn_h,
         output_file,
@@ -136,6 +145,7 @@ int add_module_constants(PyObject *m)
 
 	if (add_Architecture(m, enum_module) == -1 ||
 	    add_FindObjectFlags(m, enum_module) == -1 ||
+	    add_IndexCategory(m, enum_module) == -1 ||
 	    add_PrimitiveType(m, enum_module) == -1 ||
 	    add_PlatformFlags(m, enum_module) == -1 ||
 	    add_ProgramFlags(m, enum_module) == -1 ||
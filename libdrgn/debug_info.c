@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: GPL-3.0+
 
 #include <assert.h>
+#include <byteswap.h>
 #include <dwarf.h>
 #include <elf.h>
 #include <elfutils/known-dwarf.h>
@@ -25,6 +26,7 @@
 #include "object.h"
 #include "path.h"
 #include "program.h"
+#include "thread_pool.h"
 #include "type.h"
 #include "util.h"
 #include "vector.h"
@@ -58,9 +60,12 @@ static const char *dwarf_tag_str(Dwarf_Die *die, char buf[DW_TAG_BUF_LEN])
 
 static const char * const drgn_debug_scn_names[] = {
 	[DRGN_SCN_DEBUG_INFO] = ".debug_info",
+	[DRGN_SCN_DEBUG_TYPES] = ".debug_types",
 	[DRGN_SCN_DEBUG_ABBREV] = ".debug_abbrev",
 	[DRGN_SCN_DEBUG_STR] = ".debug_str",
 	[DRGN_SCN_DEBUG_LINE] = ".debug_line",
+	[DRGN_SCN_DEBUG_STR_OFFSETS] = ".debug_str_offsets",
+	[DRGN_SCN_DEBUG_LINE_STR] = ".debug_line_str",
 };
 
 
@@ -68,14 +73,55 @@ struct drgn_error *drgn_error_debug_info(struct drgn_debug_info_module *module,
 					 enum drgn_debug_info_scn scn,
 					 const char *ptr, const char *message)
 {
-	const char *name = dwfl_module_info(module->dwfl_module, NULL, NULL,
-					    NULL, NULL, NULL, NULL, NULL);
-	return drgn_error_format(DRGN_ERROR_OTHER, "%s: %s+%#tx: %s",
+	const char *name;
+	if (module->is_alt || module->is_dwo) {
+		name = module->name;
+	} else {
+		name = dwfl_module_info(module->dwfl_module, NULL, NULL, NULL,
+					NULL, NULL, NULL, NULL);
+	}
+	return drgn_error_format(DRGN_ERROR_OTHER, "%s: %s%s+%#tx: %s",
 				 name, drgn_debug_scn_names[scn],
+				 module->is_dwo ? ".dwo" : "",
 				 ptr - (const char *)module->scns[scn]->d_buf,
 				 message);
 }
 
+struct drgn_error *
+drgn_debug_info_module_get_dwarf(struct drgn_debug_info_module *module,
+				 Dwarf **ret, Dwarf_Addr *bias_ret)
+{
+	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, bias_ret);
+	if (!dwarf)
+		return drgn_error_libdwfl();
+	if (module->is_alt) {
+		dwarf = dwarf_getalt(dwarf);
+		if (!dwarf)
+			return drgn_error_libdw();
+	} else if (module->is_dwo) {
+		/*
+		 * libdw opens the split unit itself and links it to the
+		 * skeleton unit, which it needs for attributes like
+		 * DW_AT_addr_base.
+		 */
+		Dwarf_Die skeleton, split;
+		if (!dwarf_offdie(dwarf, module->skeleton_offset, &skeleton) ||
+		    dwarf_cu_info(skeleton.cu, NULL, NULL, NULL, &split, NULL,
+				  NULL, NULL))
+			return drgn_error_libdw();
+		if (!split.cu) {
+			return drgn_error_format(DRGN_ERROR_OTHER,
+						 "%s: could not find split unit",
+						 module->name);
+		}
+		dwarf = dwarf_cu_getdwarf(split.cu);
+		if (!dwarf)
+			return drgn_error_libdw();
+	}
+	*ret = dwarf;
+	return NULL;
+}
+
 struct drgn_error *drgn_debug_info_buffer_error(struct binary_buffer *bb,
 						const char *pos,
 						const char *message)
@@ -322,6 +368,42 @@ static void drgn_debug_info_free_modules(struct drgn_debug_info *dbinfo,
 		} while (module);
 	}
 
+	/*
+	 * Alternate debug files are only used by modules indexed at the same
+	 * time or later, so they can be finished or freed along with the
+	 * modules that first referenced them.
+	 */
+	for (struct drgn_debug_info_module_table_iterator it =
+	     drgn_debug_info_module_table_first(&dbinfo->alt_modules);
+	     it.entry; ) {
+		struct drgn_debug_info_module *alt = *it.entry;
+		if (finish_indexing &&
+		    alt->state == DRGN_DEBUG_INFO_MODULE_INDEXING)
+			alt->state = DRGN_DEBUG_INFO_MODULE_INDEXED;
+		if (free_all || alt->state != DRGN_DEBUG_INFO_MODULE_INDEXED) {
+			it = drgn_debug_info_module_table_delete_iterator(&dbinfo->alt_modules,
+									  it);
+			drgn_debug_info_module_destroy(alt);
+		} else {
+			it = drgn_debug_info_module_table_next(it);
+		}
+	}
+
+	/* The same goes for split DWARF object files. */
+	size_t num_dwo_modules = 0;
+	for (size_t i = 0; i < dbinfo->dwo_modules.size; i++) {
+		struct drgn_debug_info_module *dwo =
+			dbinfo->dwo_modules.data[i];
+		if (finish_indexing &&
+		    dwo->state == DRGN_DEBUG_INFO_MODULE_INDEXING)
+			dwo->state = DRGN_DEBUG_INFO_MODULE_INDEXED;
+		if (free_all || dwo->state != DRGN_DEBUG_INFO_MODULE_INDEXED)
+			drgn_debug_info_module_destroy(dwo);
+		else
+			dbinfo->dwo_modules.data[num_dwo_modules++] = dwo;
+	}
+	dbinfo->dwo_modules.size = num_dwo_modules;
+
 	dwfl_report_begin(dbinfo->dwfl);
 	struct drgn_dwfl_module_removed_arg arg = {
 		.dbinfo = dbinfo,
@@ -819,28 +901,10 @@ out:
 }
 
 static struct drgn_error *
-drgn_get_debug_sections(struct drgn_debug_info_module *module)
+drgn_read_debug_sections(struct drgn_debug_info_module *module, Elf *elf)
 {
 	struct drgn_error *err;
 
-	if (module->elf) {
-		err = apply_elf_relocations(module->elf);
-		if (err)
-			return err;
-	}
-
-	/*
-	 * Note: not dwfl_module_getelf(), because then libdwfl applies
-	 * ELF relocations to all sections, not just debug sections.
-	 */
-	Dwarf_Addr bias;
-	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, &bias);
-	if (!dwarf)
-		return drgn_error_libdwfl();
-	Elf *elf = dwarf_getelf(dwarf);
-	if (!elf)
-		return drgn_error_libdw();
-
 	module->little_endian = elf_getident(elf, NULL)[EI_DATA] == ELFDATA2LSB;
 
 	size_t shstrndx;
@@ -862,8 +926,11 @@ drgn_get_debug_sections(struct drgn_debug_info_module *module)
 			continue;
 
 		for (size_t i = 0; i < DRGN_NUM_DEBUG_SCNS; i++) {
+			size_t len = strlen(drgn_debug_scn_names[i]);
 			if (!module->scns[i] &&
-			    strcmp(scnname, drgn_debug_scn_names[i]) == 0) {
+			    strncmp(scnname, drgn_debug_scn_names[i], len) == 0 &&
+			    strcmp(scnname + len,
+				   module->is_dwo ? ".dwo" : "") == 0) {
 				err = read_elf_section(scn, &module->scns[i]);
 				if (err)
 					return err;
@@ -874,21 +941,432 @@ drgn_get_debug_sections(struct drgn_debug_info_module *module)
 
 	/*
 	 * Truncate any extraneous bytes so that we can assume that a pointer
-	 * within .debug_str is always null-terminated.
+	 * within .debug_str or .debug_line_str is always null-terminated.
 	 */
-	Elf_Data *debug_str = module->scns[DRGN_SCN_DEBUG_STR];
-	if (debug_str) {
-		const char *buf = debug_str->d_buf;
-		const char *nul = memrchr(buf, '\0', debug_str->d_size);
+	static const enum drgn_debug_info_scn str_scns[] = {
+		DRGN_SCN_DEBUG_STR, DRGN_SCN_DEBUG_LINE_STR,
+	};
+	for (size_t i = 0; i < ARRAY_SIZE(str_scns); i++) {
+		Elf_Data *data = module->scns[str_scns[i]];
+		if (!data)
+			continue;
+		const char *buf = data->d_buf;
+		const char *nul = memrchr(buf, '\0', data->d_size);
 		if (nul)
-			debug_str->d_size = nul - buf + 1;
+			data->d_size = nul - buf + 1;
 		else
-			debug_str->d_size = 0;
+			data->d_size = 0;
+	}
+	return NULL;
+}
+
+static struct drgn_error *
+drgn_get_debug_sections(struct drgn_debug_info_module *module)
+{
+	struct drgn_error *err;
+
+	if (module->elf) {
+		err = apply_elf_relocations(module->elf);
+		if (err)
+			return err;
+	}
+
+	/*
+	 * Note: not dwfl_module_getelf(), because then libdwfl applies
+	 * ELF relocations to all sections, not just debug sections.
+	 */
+	Dwarf_Addr bias;
+	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, &bias);
+	if (!dwarf)
+		return drgn_error_libdwfl();
+	Elf *elf = dwarf_getelf(dwarf);
+	if (!elf)
+		return drgn_error_libdw();
+
+	return drgn_read_debug_sections(module, elf);
+}
+
+/*
+ * Find the alternate debug file for a module. If it hasn't been seen before,
+ * start indexing it.
+ */
+static struct drgn_error *
+drgn_debug_info_module_find_alt(struct drgn_debug_info_load_state *load,
+				struct drgn_dwarf_index_update_state *dindex_state,
+				struct drgn_debug_info_module *module)
+{
+	struct drgn_debug_info *dbinfo = load->dbinfo;
+	struct drgn_error *err;
+
+	Dwarf_Addr bias;
+	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, &bias);
+	if (!dwarf)
+		return drgn_error_libdwfl();
+	Dwarf *alt_dwarf = dwarf_getalt(dwarf);
+	if (!alt_dwarf)
+		return NULL;
+	const char *alt_name;
+	const void *build_id;
+	ssize_t build_id_len = dwelf_dwarf_gnu_debugaltlink(dwarf, &alt_name,
+							    &build_id);
+	if (build_id_len < 0)
+		return drgn_error_libdw();
+	else if (build_id_len == 0)
+		return NULL;
 
+	struct drgn_debug_info_module_key key = {
+		.build_id = build_id,
+		.build_id_len = build_id_len,
+	};
+	struct hash_pair hp = drgn_debug_info_module_table_hash(&key);
+	struct drgn_debug_info_module *alt = NULL;
+	bool new_alt = false;
+	err = NULL;
+	pthread_mutex_lock(&load->lock);
+	{
+		struct drgn_debug_info_module_table_iterator it =
+			drgn_debug_info_module_table_search_hashed(&dbinfo->alt_modules,
+								   &key, hp);
+		if (it.entry) {
+			alt = *it.entry;
+		} else {
+			alt = calloc(1, sizeof(*alt));
+			if (alt) {
+				alt->build_id = build_id;
+				alt->build_id_len = build_id_len;
+				alt->name = strdup(alt_name);
+				alt->dwfl_module = module->dwfl_module;
+				alt->fd = -1;
+				alt->state = DRGN_DEBUG_INFO_MODULE_INDEXING;
+				alt->is_alt = true;
+				alt->index_categories =
+					module->index_categories;
+			}
+			Elf *alt_elf;
+			if (!alt || !alt->name) {
+				err = &drgn_enomem;
+			} else if (!(alt_elf = dwarf_getelf(alt_dwarf))) {
+				err = drgn_error_libdw();
+			} else if (!(err = drgn_read_debug_sections(alt,
+								    alt_elf)) &&
+				   drgn_debug_info_module_table_insert_searched(&dbinfo->alt_modules,
+										&alt,
+										hp,
+										NULL) == -1) {
+				err = &drgn_enomem;
+			}
+			if (err) {
+				drgn_debug_info_module_destroy(alt);
+				alt = NULL;
+			} else {
+				new_alt = true;
+			}
+		}
 	}
+	pthread_mutex_unlock(&load->lock);
+	if (err)
+		return err;
+
+	module->alt = alt;
+	if (new_alt && alt->scns[DRGN_SCN_DEBUG_INFO] &&
+	    alt->scns[DRGN_SCN_DEBUG_ABBREV])
+		drgn_dwarf_index_read_module(dindex_state, alt);
 	return NULL;
 }
 
+/*
+ * Check whether a split DWARF object file contains the split unit with the
+ * given ID. Only DWARF 5 has the ID in the unit header; the GNU extension for
+ * DWARF 4 is assumed to match.
+ */
+static struct drgn_error *
+drgn_dwo_has_split_unit(struct drgn_debug_info_module *dwo, uint64_t dwo_id,
+			bool *ret)
+{
+	struct drgn_error *err;
+	struct drgn_debug_info_buffer buffer;
+	drgn_debug_info_buffer_init(&buffer, dwo, DRGN_SCN_DEBUG_INFO);
+	while (binary_buffer_has_next(&buffer.bb)) {
+		uint32_t unit_length32;
+		if ((err = binary_buffer_next_u32(&buffer.bb, &unit_length32)))
+			return err;
+		bool is_64_bit = unit_length32 == UINT32_C(0xffffffff);
+		uint64_t unit_length;
+		if (is_64_bit) {
+			if ((err = binary_buffer_next_u64(&buffer.bb,
+							  &unit_length)))
+				return err;
+		} else {
+			unit_length = unit_length32;
+		}
+		if (unit_length > buffer.bb.end - buffer.bb.pos) {
+			return binary_buffer_error(&buffer.bb,
+						   "unit length is out of bounds");
+		}
+		const char *unit_end = buffer.bb.pos + unit_length;
+
+		uint16_t version;
+		if ((err = binary_buffer_next_u16(&buffer.bb, &version)))
+			return err;
+		if (version < 5) {
+			*ret = true;
+			return NULL;
+		}
+		uint8_t unit_type;
+		if ((err = binary_buffer_next_u8(&buffer.bb, &unit_type)))
+			return err;
+		if (unit_type == DW_UT_split_compile) {
+			/* Skip address_size and debug_abbrev_offset. */
+			uint64_t id;
+			if ((err = binary_buffer_skip(&buffer.bb,
+						      is_64_bit ? 9 : 5)) ||
+			    (err = binary_buffer_next_u64(&buffer.bb, &id)))
+				return err;
+			if (id == dwo_id) {
+				*ret = true;
+				return NULL;
+			}
+		}
+		buffer.bb.pos = unit_end;
+	}
+	*ret = false;
+	return NULL;
+}
+
+/*
+ * Open and index the split DWARF object file for a skeleton unit. The file is
+ * searched for the same way that libdw does: first relative to the directory
+ * containing the skeleton unit, then relative to DW_AT_comp_dir.
+ */
+static struct drgn_error *
+drgn_debug_info_read_dwo(struct drgn_debug_info_load_state *load,
+			 struct drgn_dwarf_index_update_state *dindex_state,
+			 struct drgn_debug_info_module *module, int dir_len,
+			 const char *dir, const char *dwo_name,
+			 const char *comp_dir, uint64_t dwo_id,
+			 uint64_t skeleton_offset)
+{
+	struct drgn_error *err;
+	char *path = NULL;
+	int fd = -1;
+	Elf *elf = NULL;
+	if (dwo_name[0] == '/') {
+		static const char * const path_formats[] = { "%s", NULL };
+		err = find_elf_file(&path, &fd, &elf, path_formats, dwo_name);
+	} else {
+		static const char * const path_formats[] = { "%.*s/%s", NULL };
+		static const char * const comp_dir_path_formats[] = {
+			"%s/%s", NULL
+		};
+		static const char * const relative_comp_dir_path_formats[] = {
+			"%.*s/%s/%s", NULL
+		};
+		err = NULL;
+		if (dir) {
+			err = find_elf_file(&path, &fd, &elf, path_formats,
+					    dir_len, dir, dwo_name);
+		}
+		if (!err && !elf && comp_dir) {
+			if (comp_dir[0] == '/') {
+				err = find_elf_file(&path, &fd, &elf,
+						    comp_dir_path_formats,
+						    comp_dir, dwo_name);
+			} else if (dir) {
+				err = find_elf_file(&path, &fd, &elf,
+						    relative_comp_dir_path_formats,
+						    dir_len, dir, comp_dir,
+						    dwo_name);
+			}
+		}
+	}
+	if (err || !elf) {
+		pthread_mutex_lock(&load->lock);
+		err = drgn_debug_info_report_error(load, dwo_name,
+						   err ? NULL : "could not find split DWARF object file",
+						   err);
+		pthread_mutex_unlock(&load->lock);
+		return err;
+	}
+
+	struct drgn_debug_info_module *dwo = calloc(1, sizeof(*dwo));
+	if (!dwo) {
+		elf_end(elf);
+		close(fd);
+		free(path);
+		return &drgn_enomem;
+	}
+	dwo->name = path;
+	dwo->dwfl_module = module->dwfl_module;
+	dwo->elf = elf;
+	dwo->fd = fd;
+	dwo->state = DRGN_DEBUG_INFO_MODULE_INDEXING;
+	dwo->is_dwo = true;
+	dwo->skeleton_offset = skeleton_offset;
+	dwo->index_categories = module->index_categories;
+
+	const char *message = NULL;
+	bool has_split_unit;
+	err = drgn_read_debug_sections(dwo, elf);
+	if (!err) {
+		if (!dwo->scns[DRGN_SCN_DEBUG_INFO] ||
+		    !dwo->scns[DRGN_SCN_DEBUG_ABBREV])
+			message = "no debugging information";
+		else if (!(err = drgn_dwo_has_split_unit(dwo, dwo_id,
+							 &has_split_unit)) &&
+			 !has_split_unit)
+			message = "split DWARF object file does not match skeleton unit";
+	}
+	if (err || message) {
+		pthread_mutex_lock(&load->lock);
+		err = drgn_debug_info_report_error(load, dwo->name, message,
+						   err);
+		pthread_mutex_unlock(&load->lock);
+		drgn_debug_info_module_destroy(dwo);
+		return err;
+	}
+
+	pthread_mutex_lock(&load->lock);
+	if (!drgn_debug_info_module_vector_append(&load->dbinfo->dwo_modules,
+						  &dwo))
+		err = &drgn_enomem;
+	pthread_mutex_unlock(&load->lock);
+	if (err) {
+		drgn_debug_info_module_destroy(dwo);
+		return err;
+	}
+	drgn_dwarf_index_read_module(dindex_state, dwo);
+	return NULL;
+}
+
+struct read_dwo_arg {
+	struct drgn_debug_info_load_state *load;
+	struct drgn_dwarf_index_update_state *dindex_state;
+	struct drgn_debug_info_module *module;
+	int dir_len;
+	const char *dir;
+	const char *dwo_name;
+	const char *comp_dir;
+	uint64_t dwo_id;
+	uint64_t skeleton_offset;
+};
+
+static struct drgn_error *read_dwo_task(struct drgn_task_group *group,
+					void *arg)
+{
+	struct read_dwo_arg *a = arg;
+	return drgn_debug_info_read_dwo(a->load, a->dindex_state, a->module,
+					a->dir_len, a->dir, a->dwo_name,
+					a->comp_dir, a->dwo_id,
+					a->skeleton_offset);
+}
+
+/*
+ * Find the split DWARF object files (.dwo) referenced by the skeleton units in
+ * a module and index each one in its own task.
+ *
+ * Note that DWARF packages (.dwp) are not supported, since the version of
+ * libdw that we use can't look up DIEs in them.
+ */
+static struct drgn_error *
+drgn_debug_info_module_find_dwos(struct drgn_debug_info_load_state *load,
+				 struct drgn_dwarf_index_update_state *dindex_state,
+				 struct drgn_debug_info_module *module)
+{
+	Dwarf_Addr bias;
+	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, &bias);
+	if (!dwarf)
+		return drgn_error_libdwfl();
+
+	const char *mainfile, *debugfile;
+	dwfl_module_info(module->dwfl_module, NULL, NULL, NULL, NULL, NULL,
+			 &mainfile, &debugfile);
+	const char *dir = debugfile ? debugfile : mainfile;
+	int dir_len = 0;
+	if (dir) {
+		const char *slash = strrchr(dir, '/');
+		if (slash) {
+			dir_len = slash - dir;
+		} else {
+			dir = ".";
+			dir_len = 1;
+		}
+	}
+
+	Dwarf_CU *cu = NULL;
+	uint8_t unit_type;
+	Dwarf_Die cudie;
+	int ret;
+	while ((ret = dwarf_get_units(dwarf, cu, &cu, NULL, &unit_type,
+				      &cudie, NULL)) == 0) {
+		if (unit_type != DW_UT_skeleton)
+			continue;
+		if (drgn_dwarf_index_update_cancelled(dindex_state))
+			break;
+
+		uint64_t dwo_id;
+		if (dwarf_cu_info(cu, NULL, NULL, NULL, NULL, &dwo_id, NULL,
+				  NULL))
+			return drgn_error_libdw();
+		Dwarf_Attribute attr_mem, *attr;
+		if (!(attr = dwarf_attr(&cudie, DW_AT_dwo_name, &attr_mem)) &&
+		    !(attr = dwarf_attr(&cudie, DW_AT_GNU_dwo_name, &attr_mem)))
+			continue;
+		const char *dwo_name = dwarf_formstring(attr);
+		if (!dwo_name)
+			return drgn_error_libdw();
+		struct read_dwo_arg arg = {
+			.load = load,
+			.dindex_state = dindex_state,
+			.module = module,
+			.dir_len = dir_len,
+			.dir = dir,
+			.dwo_name = dwo_name,
+			.comp_dir =
+				dwarf_formstring(dwarf_attr(&cudie,
+							    DW_AT_comp_dir,
+							    &attr_mem)),
+			.dwo_id = dwo_id,
+			.skeleton_offset = dwarf_dieoffset(&cudie),
+		};
+		drgn_task_group_spawn(&dindex_state->group, read_dwo_task,
+				      &arg, sizeof(arg));
+	}
+	if (ret < 0)
+		return drgn_error_libdw();
+	return NULL;
+}
+
+/*
+ * Return whether a module is the main program for the purposes of a @ref
+ * drgn_index_profile: vmlinux for the Linux kernel, or the executable (as
+ * opposed to a shared library) for userspace programs.
+ */
+static bool drgn_debug_info_module_is_main(struct drgn_debug_info *dbinfo,
+					   struct drgn_debug_info_module *module)
+{
+	if (dbinfo->prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL)
+		return module->name && strcmp(module->name, "kernel") == 0;
+
+	Dwarf_Addr bias;
+	Dwarf *dwarf = dwfl_module_getdwarf(module->dwfl_module, &bias);
+	Elf *elf = dwarf ? dwarf_getelf(dwarf) : NULL;
+	GElf_Ehdr ehdr_mem, *ehdr = elf ? gelf_getehdr(elf, &ehdr_mem) : NULL;
+	if (!ehdr)
+		return false;
+	if (ehdr->e_type == ET_EXEC)
+		return true;
+	/* A position-independent executable has an interpreter. */
+	size_t phnum;
+	if (ehdr->e_type != ET_DYN || elf_getphdrnum(elf, &phnum))
+		return false;
+	for (size_t i = 0; i < phnum; i++) {
+		GElf_Phdr phdr_mem, *phdr = gelf_getphdr(elf, i, &phdr_mem);
+		if (phdr && phdr->p_type == PT_INTERP)
+			return true;
+	}
+	return false;
+}
+
 static struct drgn_error *
 drgn_debug_info_read_module(struct drgn_debug_info_load_state *load,
 			    struct drgn_dwarf_index_update_state *dindex_state,
@@ -904,9 +1382,33 @@ drgn_debug_info_read_module(struct drgn_debug_info_load_state *load,
 		}
 		if (module->scns[DRGN_SCN_DEBUG_INFO] &&
 		    module->scns[DRGN_SCN_DEBUG_ABBREV]) {
+			module->index_categories =
+				drgn_debug_info_module_is_main(load->dbinfo,
+							       module) ?
+				load->profile.main : load->profile.other;
+			err = drgn_debug_info_module_find_alt(load,
+							      dindex_state,
+							      module);
+			if (err) {
+				module->err = err;
+				continue;
+			}
 			module->state = DRGN_DEBUG_INFO_MODULE_INDEXING;
 			drgn_dwarf_index_read_module(dindex_state, module);
-			return NULL;
+			err = drgn_debug_info_module_find_dwos(load,
+							       dindex_state,
+							       module);
+			if (err) {
+				const char *name =
+					dwfl_module_info(module->dwfl_module,
+							 NULL, NULL, NULL, NULL,
+							 NULL, NULL, NULL);
+				pthread_mutex_lock(&load->lock);
+				err = drgn_debug_info_report_error(load, name,
+								   NULL, err);
+				pthread_mutex_unlock(&load->lock);
+			}
+			return err;
 		}
 	}
 	/*
@@ -917,7 +1419,7 @@ drgn_debug_info_read_module(struct drgn_debug_info_load_state *load,
 	 * unused files.)
 	 */
 	err = NULL;
-	#pragma omp critical(drgn_debug_info_read_module_error)
+	pthread_mutex_lock(&load->lock);
 	for (module = head; module; module = module->next) {
 		const char *name =
 			dwfl_module_info(module->dwfl_module, NULL, NULL, NULL,
@@ -934,9 +1436,23 @@ drgn_debug_info_read_module(struct drgn_debug_info_load_state *load,
 		if (err)
 			break;
 	}
+	pthread_mutex_unlock(&load->lock);
 	return err;
 }
 
+struct read_module_arg {
+	struct drgn_debug_info_load_state *load;
+	struct drgn_dwarf_index_update_state *dindex_state;
+	struct drgn_debug_info_module *head;
+};
+
+static struct drgn_error *read_module_task(struct drgn_task_group *group,
+					   void *arg)
+{
+	struct read_module_arg *a = arg;
+	return drgn_debug_info_read_module(a->load, a->dindex_state, a->head);
+}
+
 static struct drgn_error *
 drgn_debug_info_update_index(struct drgn_debug_info_load_state *load)
 {
@@ -948,24 +1464,20 @@ drgn_debug_info_update_index(struct drgn_debug_info_load_state *load)
 				  load->new_modules.size))
 		return &drgn_enomem;
 	struct drgn_dwarf_index_update_state dindex_state;
-	drgn_dwarf_index_update_begin(&dindex_state, &dbinfo->dindex);
-	/*
-	 * In OpenMP 5.0, this could be "#pragma omp parallel master taskloop"
-	 * (added in GCC 9 and Clang 10).
-	 */
-	#pragma omp parallel
-	#pragma omp master
-	#pragma omp taskloop
+	struct drgn_error *err =
+		drgn_dwarf_index_update_begin(&dindex_state, &dbinfo->dindex);
+	if (err)
+		return err;
 	for (size_t i = 0; i < load->new_modules.size; i++) {
-		if (drgn_dwarf_index_update_cancelled(&dindex_state))
-			continue;
-		struct drgn_error *module_err =
-			drgn_debug_info_read_module(load, &dindex_state,
-						    load->new_modules.data[i]);
-		if (module_err)
-			drgn_dwarf_index_update_cancel(&dindex_state, module_err);
+		struct read_module_arg arg = {
+			.load = load,
+			.dindex_state = &dindex_state,
+			.head = load->new_modules.data[i],
+		};
+		drgn_task_group_spawn(&dindex_state.group, read_module_task,
+				      &arg, sizeof(arg));
 	}
-	struct drgn_error *err = drgn_dwarf_index_update_end(&dindex_state);
+	err = drgn_dwarf_index_update_end(&dindex_state);
 	if (err)
 		return err;
 	drgn_debug_info_free_modules(dbinfo, true, false);
@@ -1003,9 +1515,10 @@ drgn_debug_info_report_finalize_errors(struct drgn_debug_info_load_state *load)
 	}
 }
 
-struct drgn_error *drgn_debug_info_load(struct drgn_debug_info *dbinfo,
-					const char **paths, size_t n,
-					bool load_default, bool load_main)
+struct drgn_error *
+drgn_debug_info_load(struct drgn_debug_info *dbinfo, const char **paths,
+		     size_t n, bool load_default, bool load_main,
+		     const struct drgn_index_profile *profile)
 {
 	struct drgn_program *prog = dbinfo->prog;
 	struct drgn_error *err;
@@ -1020,8 +1533,13 @@ struct drgn_error *drgn_debug_info_load(struct drgn_debug_info *dbinfo,
 		.num_paths = n,
 		.load_default = load_default,
 		.load_main = load_main,
+		.profile = profile ? *profile : (struct drgn_index_profile){
+			.main = DRGN_INDEX_ALL,
+			.other = DRGN_INDEX_ALL,
+		},
 		.new_modules = VECTOR_INIT,
 		.max_errors = max_errors ? atoi(max_errors) : 5,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
 	};
 	dwfl_report_begin_add(dbinfo->dwfl);
 	if (prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL)
@@ -1134,7 +1652,37 @@ static struct drgn_error *dwarf_die_byte_order(Dwarf_Die *die,
 	return err;
 }
 
-static int dwarf_type(Dwarf_Die *die, Dwarf_Die *ret)
+/*
+ * Like dwarf_formref_die(), but a DW_FORM_ref_sig8 reference is resolved to the
+ * type unit with that signature in the DWARF index, which may be in a different
+ * module. This avoids a linear search of the module's type units in libdw, and
+ * it means that a type unit duplicated across modules is only parsed once.
+ */
+static Dwarf_Die *drgn_dwarf_formref_die(struct drgn_debug_info *dbinfo,
+					 Dwarf_Attribute *attr, Dwarf_Die *ret)
+{
+	if (dwarf_whatform(attr) == DW_FORM_ref_sig8) {
+		Elf *elf = dwarf_getelf(dwarf_cu_getdwarf(attr->cu));
+		bool little_endian =
+			elf_getident(elf, NULL)[EI_DATA] == ELFDATA2LSB;
+		uint64_t signature;
+		memcpy(&signature, attr->valp, sizeof(signature));
+		if (little_endian !=
+		    (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__))
+			signature = bswap_64(signature);
+		struct drgn_error *err =
+			drgn_dwarf_index_find_type_unit(&dbinfo->dindex,
+							signature, ret);
+		if (!err)
+			return ret;
+		/* Fall back to libdw. */
+		drgn_error_destroy(err);
+	}
+	return dwarf_formref_die(attr, ret);
+}
+
+static int dwarf_type(struct drgn_debug_info *dbinfo, Dwarf_Die *die,
+		      Dwarf_Die *ret)
 {
 	Dwarf_Attribute attr_mem;
 	Dwarf_Attribute *attr;
@@ -1142,7 +1690,7 @@ static int dwarf_type(Dwarf_Die *die, Dwarf_Die *ret)
 	if (!(attr = dwarf_attr_integrate(die, DW_AT_type, &attr_mem)))
 		return 1;
 
-	return dwarf_formref_die(attr, ret) ? 0 : -1;
+	return drgn_dwarf_formref_die(dbinfo, attr, ret) ? 0 : -1;
 }
 
 static int dwarf_flag(Dwarf_Die *die, unsigned int name, bool *ret)
@@ -1238,7 +1786,7 @@ drgn_lazy_type_from_dwarf(struct drgn_debug_info *dbinfo, Dwarf_Die *parent_die,
 	}
 
 	Dwarf_Die type_die;
-	if (!dwarf_formref_die(attr, &type_die)) {
+	if (!drgn_dwarf_formref_die(dbinfo, attr, &type_die)) {
 		return drgn_error_format(DRGN_ERROR_OTHER,
 					 "%s has invalid DW_AT_type",
 					 dwarf_tag_str(parent_die, tag_buf));
@@ -1306,7 +1854,7 @@ drgn_type_from_dwarf_child(struct drgn_debug_info *dbinfo,
 	}
 
 	Dwarf_Die type_die;
-	if (!dwarf_formref_die(attr, &type_die)) {
+	if (!drgn_dwarf_formref_die(dbinfo, attr, &type_die)) {
 		return drgn_error_format(DRGN_ERROR_OTHER,
 					 "%s has invalid DW_AT_type",
 					 dwarf_tag_str(parent_die, tag_buf));
@@ -1364,7 +1912,7 @@ drgn_base_type_from_dwarf(struct drgn_debug_info *dbinfo, Dwarf_Die *die,
 	 */
 	case DW_ATE_complex_float: {
 		Dwarf_Die child;
-		if (dwarf_type(die, &child)) {
+		if (dwarf_type(dbinfo, die, &child)) {
 			return drgn_error_create(DRGN_ERROR_OTHER,
 						 "DW_TAG_base_type has missing or invalid DW_AT_type");
 		}
@@ -1809,7 +2357,7 @@ drgn_enum_type_from_dwarf(struct drgn_debug_info *dbinfo, Dwarf_Die *die,
 	}
 
 	struct drgn_type *compatible_type;
-	r = dwarf_type(die, &child);
+	r = dwarf_type(dbinfo, die, &child);
 	if (r == -1) {
 		err = drgn_error_create(DRGN_ERROR_OTHER,
 					"DW_TAG_enumeration_type has invalid DW_AT_type");
@@ -2253,6 +2801,7 @@ drgn_type_from_dwarf_internal(struct drgn_debug_info *dbinfo, Dwarf_Die *die,
 		 */
 		return &drgn_enomem;
 	}
+	drgn_cache_charge(&dbinfo->types_cache);
 	if (is_incomplete_array_ret)
 		*is_incomplete_array_ret = entry.value.is_incomplete_array;
 	return NULL;
@@ -2532,6 +3081,15 @@ drgn_debug_info_find_object(const char *name, size_t name_len,
 	return &drgn_not_found;
 }
 
+static size_t drgn_debug_info_types_cost(struct drgn_cache *cache)
+{
+	struct drgn_debug_info *dbinfo =
+		container_of(cache, struct drgn_debug_info, types_cache);
+	return (drgn_dwarf_type_map_size(&dbinfo->types) +
+		drgn_dwarf_type_map_size(&dbinfo->cant_be_incomplete_array_types)) *
+	       sizeof(struct drgn_dwarf_type_map_entry);
+}
+
 struct drgn_error *drgn_debug_info_create(struct drgn_program *prog,
 					  struct drgn_debug_info **ret)
 {
@@ -2552,10 +3110,18 @@ struct drgn_error *drgn_debug_info_create(struct drgn_program *prog,
 		return drgn_error_libdwfl();
 	}
 	drgn_debug_info_module_table_init(&dbinfo->modules);
+	drgn_debug_info_module_table_init(&dbinfo->alt_modules);
+	drgn_debug_info_module_vector_init(&dbinfo->dwo_modules);
 	c_string_set_init(&dbinfo->module_names);
-	drgn_dwarf_index_init(&dbinfo->dindex);
+	drgn_dwarf_index_init(&dbinfo->dindex, prog);
 	drgn_dwarf_type_map_init(&dbinfo->types);
 	drgn_dwarf_type_map_init(&dbinfo->cant_be_incomplete_array_types);
+	/*
+	 * Clearing these maps would just parse the same types again into
+	 * duplicates that are never freed, so they aren't evictable.
+	 */
+	drgn_cache_register(&prog->memory_budget, &dbinfo->types_cache,
+			    "dwarf_types", drgn_debug_info_types_cost, NULL);
 	dbinfo->depth = 0;
 	*ret = dbinfo;
 	return NULL;
@@ -2565,6 +3131,7 @@ void drgn_debug_info_destroy(struct drgn_debug_info *dbinfo)
 {
 	if (!dbinfo)
 		return;
+	drgn_cache_unregister(&dbinfo->types_cache);
 	drgn_dwarf_type_map_deinit(&dbinfo->cant_be_incomplete_array_types);
 	drgn_dwarf_type_map_deinit(&dbinfo->types);
 	drgn_dwarf_index_deinit(&dbinfo->dindex);
@@ -2572,10 +3139,65 @@ void drgn_debug_info_destroy(struct drgn_debug_info *dbinfo)
 	drgn_debug_info_free_modules(dbinfo, false, true);
 	assert(drgn_debug_info_module_table_empty(&dbinfo->modules));
 	drgn_debug_info_module_table_deinit(&dbinfo->modules);
+	assert(drgn_debug_info_module_table_empty(&dbinfo->alt_modules));
+	drgn_debug_info_module_table_deinit(&dbinfo->alt_modules);
+	assert(dbinfo->dwo_modules.size == 0);
+	drgn_debug_info_module_vector_deinit(&dbinfo->dwo_modules);
 	dwfl_end(dbinfo->dwfl);
 	free(dbinfo);
 }
 
+static void
+drgn_debug_info_module_memory_usage(struct drgn_debug_info_module *module,
+				    struct drgn_memory_usage *usage)
+{
+	usage->count++;
+	for (int i = 0; i < DRGN_NUM_DEBUG_SCNS; i++) {
+		if (module->scns[i])
+			usage->size += module->scns[i]->d_size;
+	}
+}
+
+struct drgn_error *drgn_debug_info_memory_usage(struct drgn_debug_info *dbinfo,
+						drgn_memory_usage_fn *fn,
+						void *arg)
+{
+	struct drgn_error *err;
+	struct drgn_memory_usage sections = { .name = "module_sections" };
+	struct drgn_memory_usage types = { .name = "dwarf_types" };
+	if (dbinfo) {
+		for (struct drgn_debug_info_module_table_iterator it =
+		     drgn_debug_info_module_table_first(&dbinfo->modules);
+		     it.entry; it = drgn_debug_info_module_table_next(it)) {
+			for (struct drgn_debug_info_module *module = *it.entry;
+			     module; module = module->next) {
+				drgn_debug_info_module_memory_usage(module,
+								    &sections);
+			}
+		}
+		for (struct drgn_debug_info_module_table_iterator it =
+		     drgn_debug_info_module_table_first(&dbinfo->alt_modules);
+		     it.entry; it = drgn_debug_info_module_table_next(it))
+			drgn_debug_info_module_memory_usage(*it.entry, &sections);
+		for (size_t i = 0; i < dbinfo->dwo_modules.size; i++) {
+			drgn_debug_info_module_memory_usage(dbinfo->dwo_modules.data[i],
+							    &sections);
+		}
+
+		types.count =
+			drgn_dwarf_type_map_size(&dbinfo->types) +
+			drgn_dwarf_type_map_size(&dbinfo->cant_be_incomplete_array_types);
+		types.size =
+			drgn_dwarf_type_map_memory_usage(&dbinfo->types) +
+			drgn_dwarf_type_map_memory_usage(&dbinfo->cant_be_incomplete_array_types);
+		types.evictions = dbinfo->types_cache.evictions;
+	}
+	if ((err = fn(&sections, arg)) || (err = fn(&types, arg)))
+		return err;
+	return drgn_dwarf_index_memory_usage(dbinfo ? &dbinfo->dindex : NULL,
+					     fn, arg);
+}
+
 struct drgn_error *open_elf_file(const char *path, int *fd_ret, Elf **elf_ret)
 {
 	struct drgn_error *err;
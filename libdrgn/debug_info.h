@@ -14,11 +14,13 @@
 
 #include <elfutils/libdwfl.h>
 #include <libelf.h>
+#include <pthread.h>
 
 #include "binary_buffer.h"
 #include "drgn.h"
 #include "dwarf_index.h"
 #include "hash_table.h"
+#include "memory_budget.h"
 #include "string_builder.h"
 #include "vector.h"
 
@@ -47,9 +49,12 @@ enum drgn_debug_info_module_state {
 
 enum drgn_debug_info_scn {
 	DRGN_SCN_DEBUG_INFO,
+	DRGN_SCN_DEBUG_TYPES,
 	DRGN_SCN_DEBUG_ABBREV,
 	DRGN_SCN_DEBUG_STR,
 	DRGN_SCN_DEBUG_LINE,
+	DRGN_SCN_DEBUG_STR_OFFSETS,
+	DRGN_SCN_DEBUG_LINE_STR,
 	DRGN_NUM_DEBUG_SCNS,
 };
 
@@ -85,8 +90,34 @@ struct drgn_debug_info_module {
 	int fd;
 	enum drgn_debug_info_module_state state;
 	bool little_endian;
+	/**
+	 * Whether this is an alternate debug file (see @ref alt) rather than
+	 * a module. In that case, @ref dwfl_module is the first module which
+	 * referenced it, and @ref name is the path from .gnu_debugaltlink.
+	 */
+	bool is_alt;
+	/**
+	 * Whether this is a split DWARF object file (.dwo) rather than a
+	 * module. In that case, @ref dwfl_module is the module containing the
+	 * skeleton unit, and @ref name is the path of the .dwo file.
+	 */
+	bool is_dwo;
+	/** If @ref is_dwo, offset of the skeleton unit DIE in the module. */
+	uint64_t skeleton_offset;
+	/**
+	 * Categories of names to index up front. Alternate debug files and
+	 * split DWARF object files use the categories of the module that
+	 * referenced them.
+	 */
+	enum drgn_index_category index_categories;
 	/** Error while loading. */
 	struct drgn_error *err;
+	/**
+	 * Alternate debug file referenced by .gnu_debugaltlink (as created by
+	 * dwz), or @c NULL. Alternate debug files are shared by every module
+	 * that references them and are only indexed once.
+	 */
+	struct drgn_debug_info_module *alt;
 	/**
 	 * Next module with same build ID and address range.
 	 *
@@ -102,6 +133,19 @@ struct drgn_error *drgn_error_debug_info(struct drgn_debug_info_module *module,
 					 enum drgn_debug_info_scn scn,
 					 const char *ptr, const char *message);
 
+/**
+ * Get the libdw handle for a @ref drgn_debug_info_module.
+ *
+ * For an alternate debug file or a split DWARF object file, this is the handle
+ * of that file rather than of @ref drgn_debug_info_module::dwfl_module.
+ *
+ * @param[out] bias_ret Returned difference between addresses in the module and
+ * addresses in the program.
+ */
+struct drgn_error *
+drgn_debug_info_module_get_dwarf(struct drgn_debug_info_module *module,
+				 Dwarf **ret, Dwarf_Addr *bias_ret);
+
 struct drgn_debug_info_buffer {
 	struct binary_buffer bb;
 	struct drgn_debug_info_module *module;
@@ -146,6 +190,9 @@ DEFINE_HASH_TABLE_TYPE(drgn_debug_info_module_table,
 
 DEFINE_HASH_SET_TYPE(c_string_set, const char *)
 
+DEFINE_VECTOR_TYPE(drgn_debug_info_module_vector,
+		   struct drgn_debug_info_module *)
+
 /** Cached type in a @ref drgn_debug_info. */
 struct drgn_dwarf_type {
 	struct drgn_type *type;
@@ -170,6 +217,13 @@ struct drgn_debug_info {
 	Dwfl *dwfl;
 	/** Modules keyed by build ID and address range. */
 	struct drgn_debug_info_module_table modules;
+	/**
+	 * Alternate debug files keyed by build ID (with an empty address
+	 * range).
+	 */
+	struct drgn_debug_info_module_table alt_modules;
+	/** Split DWARF object files referenced by skeleton units. */
+	struct drgn_debug_info_module_vector dwo_modules;
 	/**
 	 * Names of indexed modules.
 	 *
@@ -194,6 +248,11 @@ struct drgn_debug_info {
 	 * See @ref drgn_type_from_dwarf_internal().
 	 */
 	struct drgn_dwarf_type_map cant_be_incomplete_array_types;
+	/**
+	 * Budget registration of @ref drgn_debug_info::types and @ref
+	 * drgn_debug_info::cant_be_incomplete_array_types.
+	 */
+	struct drgn_cache types_cache;
 	/** Current parsing recursion depth. */
 	int depth;
 };
@@ -205,8 +264,16 @@ struct drgn_error *drgn_debug_info_create(struct drgn_program *prog,
 /** Destroy a @ref drgn_debug_info. */
 void drgn_debug_info_destroy(struct drgn_debug_info *dbinfo);
 
-DEFINE_VECTOR_TYPE(drgn_debug_info_module_vector,
-		   struct drgn_debug_info_module *)
+/**
+ * Report the memory usage of a @ref drgn_debug_info: the debugging information
+ * sections of its modules, its type caches, and its DWARF index.
+ *
+ * @param[in] dbinfo Debugging information, or @c NULL to report that nothing
+ * is used.
+ */
+struct drgn_error *drgn_debug_info_memory_usage(struct drgn_debug_info *dbinfo,
+						drgn_memory_usage_fn *fn,
+						void *arg);
 
 /** State tracked while loading debugging information. */
 struct drgn_debug_info_load_state {
@@ -215,6 +282,8 @@ struct drgn_debug_info_load_state {
 	const size_t num_paths;
 	const bool load_default;
 	const bool load_main;
+	/** Which names to index. */
+	const struct drgn_index_profile profile;
 	/** Newly added modules to be indexed. */
 	struct drgn_debug_info_module_vector new_modules;
 	/** Formatted errors reported by @ref drgn_debug_info_report_error(). */
@@ -223,6 +292,11 @@ struct drgn_debug_info_load_state {
 	unsigned int num_errors;
 	/** Maximum number of errors to report before truncating. */
 	unsigned int max_errors;
+	/**
+	 * Protects @ref errors, @ref num_errors, and the modules of @ref
+	 * dbinfo while indexing.
+	 */
+	pthread_mutex_t lock;
 };
 
 /**
@@ -278,9 +352,10 @@ drgn_debug_info_report_flush(struct drgn_debug_info_load_state *load);
  *
  * @sa drgn_program_load_debug_info
  */
-struct drgn_error *drgn_debug_info_load(struct drgn_debug_info *dbinfo,
-					const char **paths, size_t n,
-					bool load_default, bool load_main);
+struct drgn_error *
+drgn_debug_info_load(struct drgn_debug_info *dbinfo, const char **paths,
+		     size_t n, bool load_default, bool load_main,
+		     const struct drgn_index_profile *profile);
 
 /**
  * Return whether a @ref drgn_debug_info has indexed a module with the given
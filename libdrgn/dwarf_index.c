@@ -14,7 +14,9 @@
 #include "dwarf_index.h"
 #include "error.h"
 #include "path.h"
+#include "program.h"
 #include "siphash.h"
+#include "thread_pool.h"
 #include "util.h"
 
 /*
@@ -22,13 +24,16 @@
  * An instruction <= INSN_MAX_SKIP indicates a number of bytes to be skipped
  * over. The next few instructions mean that the corresponding attribute can be
  * skipped over. The remaining instructions indicate that the corresponding
- * attribute should be parsed. Finally, every sequence of instructions
- * corresponding to a DIE is terminated by a zero byte followed by the DIE
- * flags, which are a bitmask of flags combined with the DWARF tag (which may be
- * set to zero if the tag is not of interest); see DIE_FLAG_*.
+ * attribute should be parsed. A few instructions for attributes with
+ * DW_FORM_implicit_const are followed by the constant encoded as a ULEB128
+ * number, since the value is stored in the abbreviation rather than the DIE.
+ * Finally, every sequence of instructions corresponding to a DIE is terminated
+ * by a zero byte followed by the DIE flags, which are a bitmask of flags
+ * combined with the DWARF tag (which may be set to zero if the tag is not of
+ * interest); see DIE_FLAG_*.
  */
 enum {
-	INSN_MAX_SKIP = 226,
+	INSN_MAX_SKIP = 214,
 	ATTRIB_BLOCK1,
 	ATTRIB_BLOCK2,
 	ATTRIB_BLOCK4,
@@ -42,14 +47,25 @@ enum {
 	ATTRIB_SIBLING_REF_UDATA,
 	ATTRIB_NAME_STRP4,
 	ATTRIB_NAME_STRP8,
+	ATTRIB_NAME_STRP_ALT4,
+	ATTRIB_NAME_STRP_ALT8,
 	ATTRIB_NAME_STRING,
+	ATTRIB_NAME_STRX,
+	ATTRIB_NAME_STRX1,
+	ATTRIB_NAME_STRX2,
+	ATTRIB_NAME_STRX3,
+	ATTRIB_NAME_STRX4,
 	ATTRIB_STMT_LIST_LINEPTR4,
 	ATTRIB_STMT_LIST_LINEPTR8,
+	ATTRIB_STR_OFFSETS_BASE4,
+	ATTRIB_STR_OFFSETS_BASE8,
 	ATTRIB_DECL_FILE_DATA1,
 	ATTRIB_DECL_FILE_DATA2,
 	ATTRIB_DECL_FILE_DATA4,
 	ATTRIB_DECL_FILE_DATA8,
 	ATTRIB_DECL_FILE_UDATA,
+	/* Followed by the ULEB128-encoded file index. */
+	ATTRIB_DECL_FILE_IMPLICIT,
 	ATTRIB_DECLARATION_FLAG,
 	ATTRIB_SPECIFICATION_REF1,
 	ATTRIB_SPECIFICATION_REF2,
@@ -58,7 +74,9 @@ enum {
 	ATTRIB_SPECIFICATION_REF_UDATA,
 	ATTRIB_SPECIFICATION_REF_ADDR4,
 	ATTRIB_SPECIFICATION_REF_ADDR8,
-	ATTRIB_MAX_INSN = ATTRIB_SPECIFICATION_REF_ADDR8,
+	ATTRIB_SPECIFICATION_REF_ALT4,
+	ATTRIB_SPECIFICATION_REF_ALT8,
+	ATTRIB_MAX_INSN = ATTRIB_SPECIFICATION_REF_ALT8,
 };
 
 enum {
@@ -75,11 +93,24 @@ DEFINE_VECTOR(uint64_vector, uint64_t)
 
 struct drgn_dwarf_index_cu {
 	struct drgn_debug_info_module *module;
+	/* Section containing the unit: .debug_info or .debug_types. */
+	enum drgn_debug_info_scn scn;
 	const char *buf;
 	size_t len;
 	uint8_t version;
+	uint8_t unit_type;
 	uint8_t address_size;
 	bool is_64_bit;
+	/* Size of the unit header, i.e., offset of the first DIE in the unit. */
+	uint8_t header_size;
+	/* Categories of names which have been indexed in this unit. */
+	enum drgn_index_category index_categories;
+	/*
+	 * If this is a type unit, its type signature and the offset of the
+	 * type DIE from the beginning of the unit.
+	 */
+	uint64_t type_signature;
+	uint64_t type_offset;
 	/*
 	 * This is indexed on the DWARF abbreviation code minus one. It maps the
 	 * abbreviation code to an index in abbrev_insns where the instruction
@@ -92,8 +123,19 @@ struct drgn_dwarf_index_cu {
 	uint32_t *abbrev_decls;
 	size_t num_abbrev_decls;
 	uint8_t *abbrev_insns;
+	size_t num_abbrev_insns;
+	/*
+	 * This is indexed directly on DW_AT_decl_file. Before DWARF 5, file 0
+	 * means no file, so the first entry is unused.
+	 */
 	uint64_t *file_name_hashes;
 	size_t num_file_names;
+	/*
+	 * This CU's contribution to .debug_str_offsets (starting at
+	 * DW_AT_str_offsets_base), or NULL if there is none.
+	 */
+	const char *str_offsets;
+	size_t num_str_offsets;
 };
 
 struct drgn_dwarf_index_cu_buffer {
@@ -107,8 +149,8 @@ drgn_dwarf_index_cu_buffer_error(struct binary_buffer *bb, const char *pos,
 {
 	struct drgn_dwarf_index_cu_buffer *buffer =
 		container_of(bb, struct drgn_dwarf_index_cu_buffer, bb);
-	return drgn_error_debug_info(buffer->cu->module, DRGN_SCN_DEBUG_INFO,
-				     pos, message);
+	return drgn_error_debug_info(buffer->cu->module, buffer->cu->scn, pos,
+				     message);
 }
 
 static void
@@ -127,8 +169,10 @@ DEFINE_VECTOR_FUNCTIONS(drgn_dwarf_index_cu_vector)
 struct drgn_dwarf_index_pending_die {
 	/* Index of compilation unit containing DIE. */
 	size_t cu;
-	/* Offset of DIE in .debug_info. */
+	/* Offset of DIE in the section containing the compilation unit. */
 	size_t offset;
+	/* Categories of names to index in the children of the DIE. */
+	enum drgn_index_category categories;
 };
 
 DEFINE_VECTOR_FUNCTIONS(drgn_dwarf_index_pending_die_vector)
@@ -138,6 +182,8 @@ DEFINE_HASH_TABLE_FUNCTIONS(drgn_dwarf_index_die_map, string_hash_pair,
 DEFINE_VECTOR_FUNCTIONS(drgn_dwarf_index_die_vector)
 DEFINE_HASH_TABLE_FUNCTIONS(drgn_dwarf_index_specification_map,
 			    int_key_hash_pair, scalar_key_eq)
+DEFINE_HASH_TABLE_FUNCTIONS(drgn_dwarf_index_type_unit_map, int_key_hash_pair,
+			    scalar_key_eq)
 
 static inline size_t hash_pair_to_shard(struct hash_pair hp)
 {
@@ -156,7 +202,7 @@ drgn_dwarf_index_namespace_init(struct drgn_dwarf_index_namespace *ns,
 {
 	for (size_t i = 0; i < ARRAY_SIZE(ns->shards); i++) {
 		struct drgn_dwarf_index_shard *shard = &ns->shards[i];
-		omp_init_lock(&shard->lock);
+		pthread_mutex_init(&shard->lock, NULL);
 		drgn_dwarf_index_die_map_init(&shard->map);
 		drgn_dwarf_index_die_vector_init(&shard->dies);
 	}
@@ -165,11 +211,17 @@ drgn_dwarf_index_namespace_init(struct drgn_dwarf_index_namespace *ns,
 	ns->saved_err = NULL;
 }
 
-void drgn_dwarf_index_init(struct drgn_dwarf_index *dindex)
+void drgn_dwarf_index_init(struct drgn_dwarf_index *dindex,
+			   struct drgn_program *prog)
 {
 	drgn_dwarf_index_namespace_init(&dindex->global, dindex);
 	drgn_dwarf_index_specification_map_init(&dindex->specifications);
+	pthread_mutex_init(&dindex->specifications_lock, NULL);
+	drgn_dwarf_index_type_unit_map_init(&dindex->type_units);
+	pthread_mutex_init(&dindex->type_units_lock, NULL);
 	drgn_dwarf_index_cu_vector_init(&dindex->cus);
+	dindex->indexed_categories = DRGN_INDEX_ALL;
+	dindex->prog = prog;
 }
 
 static void drgn_dwarf_index_cu_deinit(struct drgn_dwarf_index_cu *cu)
@@ -195,7 +247,7 @@ drgn_dwarf_index_namespace_deinit(struct drgn_dwarf_index_namespace *ns)
 		}
 		drgn_dwarf_index_die_vector_deinit(&shard->dies);
 		drgn_dwarf_index_die_map_deinit(&shard->map);
-		omp_destroy_lock(&shard->lock);
+		pthread_mutex_destroy(&shard->lock);
 	}
 }
 
@@ -206,26 +258,135 @@ void drgn_dwarf_index_deinit(struct drgn_dwarf_index *dindex)
 	for (size_t i = 0; i < dindex->cus.size; i++)
 		drgn_dwarf_index_cu_deinit(&dindex->cus.data[i]);
 	drgn_dwarf_index_cu_vector_deinit(&dindex->cus);
+	pthread_mutex_destroy(&dindex->type_units_lock);
+	drgn_dwarf_index_type_unit_map_deinit(&dindex->type_units);
+	pthread_mutex_destroy(&dindex->specifications_lock);
 	drgn_dwarf_index_specification_map_deinit(&dindex->specifications);
 	drgn_dwarf_index_namespace_deinit(&dindex->global);
 }
 
-void drgn_dwarf_index_update_begin(struct drgn_dwarf_index_update_state *state,
-				   struct drgn_dwarf_index *dindex)
+static void
+drgn_dwarf_index_namespace_memory_usage(struct drgn_dwarf_index_namespace *ns,
+					struct drgn_memory_usage *dies,
+					struct drgn_memory_usage *names)
+{
+	dies->size += (ns->pending_dies.capacity *
+		       sizeof(ns->pending_dies.data[0]));
+	for (size_t i = 0; i < ARRAY_SIZE(ns->shards); i++) {
+		struct drgn_dwarf_index_shard *shard = &ns->shards[i];
+		dies->count += shard->dies.size;
+		dies->size += shard->dies.capacity * sizeof(shard->dies.data[0]);
+		names->count += drgn_dwarf_index_die_map_size(&shard->map);
+		names->size +=
+			drgn_dwarf_index_die_map_memory_usage(&shard->map);
+		for (size_t j = 0; j < shard->dies.size; j++) {
+			struct drgn_dwarf_index_die *die = &shard->dies.data[j];
+			if (die->tag == DW_TAG_namespace && die->namespace) {
+				names->size += sizeof(*die->namespace);
+				drgn_dwarf_index_namespace_memory_usage(die->namespace,
+									dies,
+									names);
+			}
+		}
+	}
+}
+
+struct drgn_error *drgn_dwarf_index_memory_usage(struct drgn_dwarf_index *dindex,
+						 drgn_memory_usage_fn *fn,
+						 void *arg)
 {
+	struct drgn_error *err;
+	struct drgn_memory_usage dies = { .name = "dwarf_index_dies" };
+	struct drgn_memory_usage names = { .name = "dwarf_index_names" };
+	struct drgn_memory_usage specifications = {
+		.name = "dwarf_index_specifications",
+	};
+	struct drgn_memory_usage type_units = {
+		.name = "dwarf_index_type_units",
+	};
+	struct drgn_memory_usage cus = { .name = "dwarf_index_cus" };
+	if (dindex) {
+		drgn_dwarf_index_namespace_memory_usage(&dindex->global, &dies,
+							&names);
+		specifications.count =
+			drgn_dwarf_index_specification_map_size(&dindex->specifications);
+		specifications.size =
+			drgn_dwarf_index_specification_map_memory_usage(&dindex->specifications);
+		type_units.count =
+			drgn_dwarf_index_type_unit_map_size(&dindex->type_units);
+		type_units.size =
+			drgn_dwarf_index_type_unit_map_memory_usage(&dindex->type_units);
+		/*
+		 * Each unit's abbreviation table and file name hashes are
+		 * allocated separately.
+		 */
+		cus.count = dindex->cus.size;
+		cus.size = dindex->cus.capacity * sizeof(dindex->cus.data[0]);
+		for (size_t i = 0; i < dindex->cus.size; i++) {
+			struct drgn_dwarf_index_cu *cu = &dindex->cus.data[i];
+			cus.size += (cu->num_abbrev_decls *
+				     sizeof(cu->abbrev_decls[0]) +
+				     cu->num_abbrev_insns +
+				     cu->num_file_names *
+				     sizeof(cu->file_name_hashes[0]));
+		}
+	}
+	if ((err = fn(&dies, arg)) || (err = fn(&names, arg)) ||
+	    (err = fn(&specifications, arg)) || (err = fn(&type_units, arg)))
+		return err;
+	return fn(&cus, arg);
+}
+
+struct drgn_error *
+drgn_dwarf_index_update_begin(struct drgn_dwarf_index_update_state *state,
+			      struct drgn_dwarf_index *dindex)
+{
+	struct drgn_thread_pool *pool;
+	struct drgn_error *err = drgn_program_thread_pool(dindex->prog, &pool);
+	if (err)
+		return err;
 	state->dindex = dindex;
 	state->old_cus_size = dindex->cus.size;
-	state->err = NULL;
+	drgn_task_group_init(&state->group, pool);
+	pthread_mutex_init(&state->cus_lock, NULL);
+	return NULL;
 }
 
 void drgn_dwarf_index_update_cancel(struct drgn_dwarf_index_update_state *state,
 				    struct drgn_error *err)
 {
-	#pragma omp critical(drgn_dwarf_index_update_cancel)
-	if (state->err)
-		drgn_error_destroy(err);
-	else
-		state->err = err;
+	drgn_task_group_cancel(&state->group, err);
+}
+
+/* Append the operand of an instruction for DW_FORM_implicit_const. */
+static bool append_insn_uleb128(struct uint8_vector *insns, uint64_t value)
+{
+	do {
+		uint8_t byte = value & 0x7f;
+		value >>= 7;
+		if (value)
+			byte |= 0x80;
+		if (!uint8_vector_append(insns, &byte))
+			return false;
+	} while (value);
+	return true;
+}
+
+/*
+ * Decode an operand appended by append_insn_uleb128(). We generated it
+ * ourselves, so it doesn't need to be validated.
+ */
+static uint64_t next_insn_uleb128(uint8_t **insnp)
+{
+	uint64_t value = 0;
+	int shift = 0;
+	uint8_t byte;
+	do {
+		byte = *(*insnp)++;
+		value |= (uint64_t)(byte & 0x7f) << shift;
+		shift += 7;
+	} while (byte & 0x80);
+	return value;
 }
 
 static struct drgn_error *
@@ -331,12 +492,55 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 				else
 					insn = ATTRIB_NAME_STRP4;
 				goto append_insn;
+			case DW_FORM_GNU_strp_alt:
+			case DW_FORM_strp_sup:
+				if (!cu->module->alt ||
+				    !cu->module->alt->scns[DRGN_SCN_DEBUG_STR]) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_FORM_GNU_strp_alt without alternate .debug_str section");
+				}
+				if (cu->is_64_bit)
+					insn = ATTRIB_NAME_STRP_ALT8;
+				else
+					insn = ATTRIB_NAME_STRP_ALT4;
+				goto append_insn;
 			case DW_FORM_string:
 				insn = ATTRIB_NAME_STRING;
 				goto append_insn;
+			case DW_FORM_strx:
+			case DW_FORM_GNU_str_index:
+				insn = ATTRIB_NAME_STRX;
+				goto name_strx;
+			case DW_FORM_strx1:
+				insn = ATTRIB_NAME_STRX1;
+				goto name_strx;
+			case DW_FORM_strx2:
+				insn = ATTRIB_NAME_STRX2;
+				goto name_strx;
+			case DW_FORM_strx3:
+				insn = ATTRIB_NAME_STRX3;
+				goto name_strx;
+			case DW_FORM_strx4:
+				insn = ATTRIB_NAME_STRX4;
+name_strx:
+				if (!cu->module->scns[DRGN_SCN_DEBUG_STR] ||
+				    !cu->module->scns[DRGN_SCN_DEBUG_STR_OFFSETS]) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_FORM_strx without .debug_str or .debug_str_offsets section");
+				}
+				goto append_insn;
 			default:
 				break;
 			}
+		} else if (name == DW_AT_str_offsets_base &&
+			   cu->module->scns[DRGN_SCN_DEBUG_STR_OFFSETS]) {
+			if (form == DW_FORM_sec_offset) {
+				if (cu->is_64_bit)
+					insn = ATTRIB_STR_OFFSETS_BASE8;
+				else
+					insn = ATTRIB_STR_OFFSETS_BASE4;
+				goto append_insn;
+			}
 		} else if (name == DW_AT_stmt_list &&
 			   cu->module->scns[DRGN_SCN_DEBUG_LINE]) {
 			switch (form) {
@@ -380,6 +584,28 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 			case DW_FORM_udata:
 				insn = ATTRIB_DECL_FILE_UDATA;
 				goto append_insn;
+			case DW_FORM_implicit_const: {
+				int64_t implicit_const;
+				if ((err = binary_buffer_next_sleb128(&buffer->bb,
+								      &implicit_const)))
+					return err;
+				if (implicit_const < 0) {
+					return binary_buffer_error(&buffer->bb,
+								   "invalid DW_AT_decl_file %" PRId64,
+								   implicit_const);
+				}
+				insn = ATTRIB_DECL_FILE_IMPLICIT;
+				if (!uint8_vector_append(insns, &insn) ||
+				    !append_insn_uleb128(insns, implicit_const))
+					return &drgn_enomem;
+				/*
+				 * The operand must not be mistaken for a skip
+				 * instruction that can be merged with the next
+				 * one.
+				 */
+				first = true;
+				continue;
+			}
 			default:
 				break;
 			}
@@ -396,6 +622,15 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 				 */
 				die_flags |= DIE_FLAG_DECLARATION;
 				break;
+			case DW_FORM_implicit_const: {
+				int64_t implicit_const;
+				if ((err = binary_buffer_next_sleb128(&buffer->bb,
+								      &implicit_const)))
+					return err;
+				if (implicit_const)
+					die_flags |= DIE_FLAG_DECLARATION;
+				continue;
+			}
 			default:
 				return binary_buffer_error(&buffer->bb,
 							   "unknown attribute form %" PRIu64 " for DW_AT_declaration",
@@ -435,6 +670,24 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 									   cu->address_size);
 				}
 				goto append_insn;
+			case DW_FORM_GNU_ref_alt:
+				if (cu->is_64_bit)
+					insn = ATTRIB_SPECIFICATION_REF_ALT8;
+				else
+					insn = ATTRIB_SPECIFICATION_REF_ALT4;
+				goto specification_alt;
+			case DW_FORM_ref_sup4:
+				insn = ATTRIB_SPECIFICATION_REF_ALT4;
+				goto specification_alt;
+			case DW_FORM_ref_sup8:
+				insn = ATTRIB_SPECIFICATION_REF_ALT8;
+specification_alt:
+				if (!cu->module->alt ||
+				    !cu->module->alt->scns[DRGN_SCN_DEBUG_INFO]) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_FORM_GNU_ref_alt without alternate .debug_info section");
+				}
+				goto append_insn;
 			default:
 				return binary_buffer_error(&buffer->bb,
 							   "unknown attribute form %" PRIu64 " for DW_AT_specification",
@@ -462,8 +715,29 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 		case DW_FORM_data8:
 		case DW_FORM_ref8:
 		case DW_FORM_ref_sig8:
+		case DW_FORM_ref_sup8:
 			insn = 8;
 			break;
+		case DW_FORM_data16:
+			insn = 16;
+			break;
+		case DW_FORM_strx1:
+		case DW_FORM_addrx1:
+			insn = 1;
+			break;
+		case DW_FORM_strx2:
+		case DW_FORM_addrx2:
+			insn = 2;
+			break;
+		case DW_FORM_strx3:
+		case DW_FORM_addrx3:
+			insn = 3;
+			break;
+		case DW_FORM_strx4:
+		case DW_FORM_addrx4:
+		case DW_FORM_ref_sup4:
+			insn = 4;
+			break;
 		case DW_FORM_block1:
 			insn = ATTRIB_BLOCK1;
 			goto append_insn;
@@ -479,11 +753,21 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 		case DW_FORM_sdata:
 		case DW_FORM_udata:
 		case DW_FORM_ref_udata:
+		case DW_FORM_strx:
+		case DW_FORM_addrx:
+		case DW_FORM_loclistx:
+		case DW_FORM_rnglistx:
+		case DW_FORM_GNU_addr_index:
+		case DW_FORM_GNU_str_index:
 			insn = ATTRIB_LEB128;
 			goto append_insn;
 		case DW_FORM_ref_addr:
 		case DW_FORM_sec_offset:
 		case DW_FORM_strp:
+		case DW_FORM_line_strp:
+		case DW_FORM_strp_sup:
+		case DW_FORM_GNU_ref_alt:
+		case DW_FORM_GNU_strp_alt:
 			insn = cu->is_64_bit ? 8 : 4;
 			break;
 		case DW_FORM_string:
@@ -491,6 +775,11 @@ read_abbrev_decl(struct drgn_debug_info_buffer *buffer,
 			goto append_insn;
 		case DW_FORM_flag_present:
 			continue;
+		case DW_FORM_implicit_const:
+			/* The value is in the abbreviation, not the DIE. */
+			if ((err = binary_buffer_skip_leb128(&buffer->bb)))
+				return err;
+			continue;
 		case DW_FORM_indirect:
 			return binary_buffer_error(&buffer->bb,
 						   "DW_FORM_indirect is not implemented");
@@ -546,6 +835,7 @@ static struct drgn_error *read_abbrev_table(struct drgn_dwarf_index_cu *cu,
 	cu->abbrev_decls = decls.data;
 	cu->num_abbrev_decls = decls.size;
 	cu->abbrev_insns = insns.data;
+	cu->num_abbrev_insns = insns.size;
 	return NULL;
 }
 
@@ -556,13 +846,31 @@ static struct drgn_error *read_cu(struct drgn_dwarf_index_cu_buffer *buffer)
 	uint16_t version;
 	if ((err = binary_buffer_next_u16(&buffer->bb, &version)))
 		return err;
-	if (version < 2 || version > 4) {
+	if (version < 2 || version > 5) {
 		return binary_buffer_error(&buffer->bb,
 					   "unknown DWARF CU version %" PRIu16,
 					   version);
 	}
 	buffer->cu->version = version;
 
+	if (version >= 5) {
+		if ((err = binary_buffer_next_u8(&buffer->bb,
+						 &buffer->cu->unit_type)))
+			return err;
+		if (buffer->cu->unit_type < DW_UT_compile ||
+		    buffer->cu->unit_type > DW_UT_split_type) {
+			return binary_buffer_error(&buffer->bb,
+						   "unknown DWARF unit type");
+		}
+		if ((err = binary_buffer_next_u8(&buffer->bb,
+						 &buffer->cu->address_size)))
+			return err;
+	} else if (buffer->cu->scn == DRGN_SCN_DEBUG_TYPES) {
+		buffer->cu->unit_type = DW_UT_type;
+	} else {
+		buffer->cu->unit_type = DW_UT_compile;
+	}
+
 	uint64_t debug_abbrev_offset;
 	if (buffer->cu->is_64_bit) {
 		if ((err = binary_buffer_next_u64(&buffer->bb,
@@ -579,14 +887,47 @@ static struct drgn_error *read_cu(struct drgn_dwarf_index_cu_buffer *buffer)
 					   "debug_abbrev_offset is out of bounds");
 	}
 
-	if ((err = binary_buffer_next_u8(&buffer->bb,
-					 &buffer->cu->address_size)))
-		return err;
+	if (version < 5) {
+		if ((err = binary_buffer_next_u8(&buffer->bb,
+						 &buffer->cu->address_size)))
+			return err;
+	} else if (buffer->cu->unit_type == DW_UT_skeleton ||
+		   buffer->cu->unit_type == DW_UT_split_compile) {
+		/* dwo_id */
+		if ((err = binary_buffer_skip(&buffer->bb, 8)))
+			return err;
+	}
+
+	bool is_type_unit = (buffer->cu->unit_type == DW_UT_type ||
+			     buffer->cu->unit_type == DW_UT_split_type);
+	if (is_type_unit) {
+		if ((err = binary_buffer_next_u64(&buffer->bb,
+						  &buffer->cu->type_signature)))
+			return err;
+		if (buffer->cu->is_64_bit) {
+			if ((err = binary_buffer_next_u64(&buffer->bb,
+							  &buffer->cu->type_offset)))
+				return err;
+		} else {
+			if ((err = binary_buffer_next_u32_into_u64(&buffer->bb,
+								   &buffer->cu->type_offset)))
+				return err;
+		}
+	}
+	buffer->cu->header_size = buffer->bb.pos - buffer->cu->buf;
+	if (is_type_unit &&
+	    (buffer->cu->type_offset < buffer->cu->header_size ||
+	     buffer->cu->type_offset >= buffer->cu->len)) {
+		return binary_buffer_error(&buffer->bb,
+					   "type_offset is out of bounds");
+	}
 
 	return read_abbrev_table(buffer->cu, debug_abbrev_offset);
 }
 
-static struct drgn_error *skip_lnp_header(struct drgn_debug_info_buffer *buffer)
+static struct drgn_error *skip_lnp_header(struct drgn_debug_info_buffer *buffer,
+					  uint16_t *version_ret,
+					  bool *is_64_bit_ret)
 {
 	struct drgn_error *err;
 	uint32_t tmp;
@@ -600,7 +941,7 @@ static struct drgn_error *skip_lnp_header(struct drgn_debug_info_buffer *buffer)
 	uint16_t version;
 	if ((err = binary_buffer_next_u16(&buffer->bb, &version)))
 		return err;
-	if (version < 2 || version > 4) {
+	if (version < 2 || version > 5) {
 		return binary_buffer_error(&buffer->bb,
 					   "unknown DWARF LNP version %" PRIu16,
 					   version);
@@ -608,9 +949,11 @@ static struct drgn_error *skip_lnp_header(struct drgn_debug_info_buffer *buffer)
 
 	/*
 	 * Skip:
+	 * address_size (DWARF 5 only)
+	 * segment_selector_size (DWARF 5 only)
 	 * header_length
 	 * minimum_instruction_length
-	 * maximum_operations_per_instruction (DWARF 4 only)
+	 * maximum_operations_per_instruction (DWARF 4 and 5 only)
 	 * default_is_stmt
 	 * line_base
 	 * line_range
@@ -618,11 +961,14 @@ static struct drgn_error *skip_lnp_header(struct drgn_debug_info_buffer *buffer)
 	 */
 	uint8_t opcode_base;
 	if ((err = binary_buffer_skip(&buffer->bb,
+				      (version >= 5 ? 2 : 0) +
 				      (is_64_bit ? 8 : 4) + 4 + (version >= 4))) ||
 	    (err = binary_buffer_next_u8(&buffer->bb, &opcode_base)) ||
 	    (err = binary_buffer_skip(&buffer->bb, opcode_base - 1)))
 		return err;
 
+	*version_ret = version;
+	*is_64_bit_ret = is_64_bit;
 	return NULL;
 }
 
@@ -650,113 +996,322 @@ static void hash_directory(struct siphash *hash, const char *path,
 
 DEFINE_VECTOR(siphash_vector, struct siphash)
 
+/*
+ * We don't care about hash flooding attacks, so don't bother with the random
+ * key.
+ */
+static const uint64_t siphash_key[2];
+
 static struct drgn_error *
-read_file_name_table(struct drgn_dwarf_index *dindex,
-		     struct drgn_dwarf_index_cu *cu, size_t stmt_list)
+read_file_name_table_v2(struct drgn_debug_info_buffer *buffer,
+			struct siphash_vector *directories,
+			struct uint64_vector *file_name_hashes)
 {
-	/*
-	 * We don't care about hash flooding attacks, so don't bother with the
-	 * random key.
-	 */
-	static const uint64_t siphash_key[2];
 	struct drgn_error *err;
 
-	struct drgn_debug_info_buffer buffer;
-	drgn_debug_info_buffer_init(&buffer, cu->module, DRGN_SCN_DEBUG_LINE);
-	/* Checked in index_cu_first_pass(). */
-	buffer.bb.pos += stmt_list;
-
-	if ((err = skip_lnp_header(&buffer)))
-		return err;
-
-	struct siphash_vector directories = VECTOR_INIT;
+	/* Directory 0 is the compilation directory, which we don't hash. */
+	struct siphash *hash = siphash_vector_append_entry(directories);
+	if (!hash)
+		return &drgn_enomem;
+	siphash_init(hash, siphash_key);
 	for (;;) {
 		const char *path;
 		size_t path_len;
-		if ((err = binary_buffer_next_string(&buffer.bb, &path,
+		if ((err = binary_buffer_next_string(&buffer->bb, &path,
 						     &path_len)))
-			goto out_directories;
+			return err;
 		if (!path_len)
 			break;
 
-		struct siphash *hash =
-			siphash_vector_append_entry(&directories);
-		if (!hash) {
-			err = &drgn_enomem;
-			goto out_directories;
-		}
+		hash = siphash_vector_append_entry(directories);
+		if (!hash)
+			return &drgn_enomem;
 		siphash_init(hash, siphash_key);
 		hash_directory(hash, path, path_len);
 	}
 
-	struct uint64_vector file_name_hashes = VECTOR_INIT;
+	/* File 0 means no file. */
+	uint64_t file_name_hash = 0;
+	if (!uint64_vector_append(file_name_hashes, &file_name_hash))
+		return &drgn_enomem;
 	for (;;) {
 		const char *path;
 		size_t path_len;
-		if ((err = binary_buffer_next_string(&buffer.bb, &path,
+		if ((err = binary_buffer_next_string(&buffer->bb, &path,
 						     &path_len)))
-			goto out_hashes;
+			return err;
 		if (!path_len)
 			break;
 
 		uint64_t directory_index;
-		if ((err = binary_buffer_next_uleb128(&buffer.bb,
+		if ((err = binary_buffer_next_uleb128(&buffer->bb,
 						      &directory_index)))
-			goto out_hashes;
-		if (directory_index > directories.size) {
-			err = binary_buffer_error(&buffer.bb,
-						  "directory index %" PRIu64 " is invalid",
-						  directory_index);
-			goto out_hashes;
+			return err;
+		if (directory_index >= directories->size) {
+			return binary_buffer_error(&buffer->bb,
+						   "directory index %" PRIu64 " is invalid",
+						   directory_index);
 		}
 
 		/* mtime, size */
-		if ((err = binary_buffer_skip_leb128(&buffer.bb)) ||
-		    (err = binary_buffer_skip_leb128(&buffer.bb)))
-			goto out_hashes;
-
-		struct siphash hash;
-		if (directory_index)
-			hash = directories.data[directory_index - 1];
-		else
-			siphash_init(&hash, siphash_key);
+		if ((err = binary_buffer_skip_leb128(&buffer->bb)) ||
+		    (err = binary_buffer_skip_leb128(&buffer->bb)))
+			return err;
+
+		struct siphash hash = directories->data[directory_index];
 		siphash_update(&hash, path, path_len);
+		file_name_hash = siphash_final(&hash);
+		if (!uint64_vector_append(file_name_hashes, &file_name_hash))
+			return &drgn_enomem;
+	}
+	return NULL;
+}
 
-		uint64_t file_name_hash = siphash_final(&hash);
-		if (!uint64_vector_append(&file_name_hashes, &file_name_hash)) {
-			err = &drgn_enomem;
-			goto out_hashes;
+/*
+ * Skip a DWARF 5 directory or file name entry format description, returning
+ * where it starts.
+ */
+static struct drgn_error *
+skip_lnp_entry_format(struct drgn_debug_info_buffer *buffer,
+		      const char **format_ret, uint8_t *format_count_ret)
+{
+	struct drgn_error *err;
+	if ((err = binary_buffer_next_u8(&buffer->bb, format_count_ret)))
+		return err;
+	*format_ret = buffer->bb.pos;
+	for (uint8_t i = 0; i < *format_count_ret; i++) {
+		/* content type, form */
+		if ((err = binary_buffer_skip_leb128(&buffer->bb)) ||
+		    (err = binary_buffer_skip_leb128(&buffer->bb)))
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Read a DWARF 5 directory or file name entry with the given format. Only
+ * DW_LNCT_path and DW_LNCT_directory_index are returned; other content types
+ * are skipped.
+ */
+static struct drgn_error *
+read_lnp_entry(struct drgn_debug_info_buffer *buffer, bool is_64_bit,
+	       const char *format, uint8_t format_count, const char **path_ret,
+	       size_t *path_len_ret, uint64_t *directory_index_ret)
+{
+	struct drgn_error *err;
+	struct drgn_debug_info_buffer format_buffer = *buffer;
+	format_buffer.bb.pos = format;
+
+	*path_ret = NULL;
+	*path_len_ret = 0;
+	*directory_index_ret = 0;
+	for (uint8_t i = 0; i < format_count; i++) {
+		uint64_t content_type, form;
+		if ((err = binary_buffer_next_uleb128(&format_buffer.bb,
+						      &content_type)) ||
+		    (err = binary_buffer_next_uleb128(&format_buffer.bb,
+						      &form)))
+			return err;
+
+		uint64_t value;
+		enum drgn_debug_info_scn scn;
+		switch (form) {
+		case DW_FORM_string: {
+			const char *str;
+			size_t len;
+			if ((err = binary_buffer_next_string(&buffer->bb, &str,
+							     &len)))
+				return err;
+			if (content_type == DW_LNCT_path) {
+				*path_ret = str;
+				*path_len_ret = len;
+			}
+			continue;
 		}
+		case DW_FORM_line_strp:
+			scn = DRGN_SCN_DEBUG_LINE_STR;
+			goto strp;
+		case DW_FORM_strp:
+			scn = DRGN_SCN_DEBUG_STR;
+strp:
+			if (is_64_bit)
+				err = binary_buffer_next_u64(&buffer->bb, &value);
+			else
+				err = binary_buffer_next_u32_into_u64(&buffer->bb,
+								      &value);
+			if (err)
+				return err;
+			if (content_type == DW_LNCT_path) {
+				Elf_Data *data = buffer->module->scns[scn];
+				if (!data || value >= data->d_size) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_LNCT_path is out of bounds");
+				}
+				*path_ret = (const char *)data->d_buf + value;
+				*path_len_ret = strlen(*path_ret);
+			}
+			continue;
+		case DW_FORM_data1:
+			err = binary_buffer_next_u8_into_u64(&buffer->bb,
+							     &value);
+			break;
+		case DW_FORM_data2:
+			err = binary_buffer_next_u16_into_u64(&buffer->bb,
+							      &value);
+			break;
+		case DW_FORM_data4:
+			err = binary_buffer_next_u32_into_u64(&buffer->bb,
+							      &value);
+			break;
+		case DW_FORM_data8:
+			err = binary_buffer_next_u64(&buffer->bb, &value);
+			break;
+		case DW_FORM_udata:
+			err = binary_buffer_next_uleb128(&buffer->bb, &value);
+			break;
+		case DW_FORM_data16:
+			err = binary_buffer_skip(&buffer->bb, 16);
+			value = 0;
+			break;
+		case DW_FORM_block:
+			if ((err = binary_buffer_next_uleb128(&buffer->bb,
+							      &value)))
+				return err;
+			err = binary_buffer_skip(&buffer->bb, value);
+			value = 0;
+			break;
+		default:
+			return binary_buffer_error(&buffer->bb,
+						   "unknown attribute form %" PRIu64 " for line number program entry",
+						   form);
+		}
+		if (err)
+			return err;
+		if (content_type == DW_LNCT_directory_index)
+			*directory_index_ret = value;
 	}
+	return NULL;
+}
 
-	cu->file_name_hashes = file_name_hashes.data;
-	cu->num_file_names = file_name_hashes.size;
-	err = NULL;
-	goto out_directories;
+static struct drgn_error *
+read_file_name_table_v5(struct drgn_debug_info_buffer *buffer, bool is_64_bit,
+			struct siphash_vector *directories,
+			struct uint64_vector *file_name_hashes)
+{
+	struct drgn_error *err;
+
+	const char *format;
+	uint8_t format_count;
+	uint64_t count;
+	if ((err = skip_lnp_entry_format(buffer, &format, &format_count)) ||
+	    (err = binary_buffer_next_uleb128(&buffer->bb, &count)))
+		return err;
+	for (uint64_t i = 0; i < count; i++) {
+		const char *path;
+		size_t path_len;
+		uint64_t directory_index;
+		if ((err = read_lnp_entry(buffer, is_64_bit, format,
+					  format_count, &path, &path_len,
+					  &directory_index)))
+			return err;
+
+		struct siphash *hash =
+			siphash_vector_append_entry(directories);
+		if (!hash)
+			return &drgn_enomem;
+		siphash_init(hash, siphash_key);
+		/*
+		 * Directory 0 is the compilation directory. It is implicit
+		 * before DWARF 5, so don't hash it in order to get the same
+		 * hashes as older versions.
+		 */
+		if (i > 0 && path)
+			hash_directory(hash, path, path_len);
+	}
+
+	if ((err = skip_lnp_entry_format(buffer, &format, &format_count)) ||
+	    (err = binary_buffer_next_uleb128(&buffer->bb, &count)))
+		return err;
+	for (uint64_t i = 0; i < count; i++) {
+		const char *path;
+		size_t path_len;
+		uint64_t directory_index;
+		if ((err = read_lnp_entry(buffer, is_64_bit, format,
+					  format_count, &path, &path_len,
+					  &directory_index)))
+			return err;
+		if (!path) {
+			return binary_buffer_error(&buffer->bb,
+						   "file name entry has no DW_LNCT_path");
+		}
+		if (directory_index >= directories->size) {
+			return binary_buffer_error(&buffer->bb,
+						   "directory index %" PRIu64 " is invalid",
+						   directory_index);
+		}
+
+		struct siphash hash = directories->data[directory_index];
+		siphash_update(&hash, path, path_len);
+		uint64_t file_name_hash = siphash_final(&hash);
+		if (!uint64_vector_append(file_name_hashes, &file_name_hash))
+			return &drgn_enomem;
+	}
+	return NULL;
+}
 
-out_hashes:
-	uint64_vector_deinit(&file_name_hashes);
-out_directories:
+static struct drgn_error *
+read_file_name_table(struct drgn_dwarf_index *dindex,
+		     struct drgn_dwarf_index_cu *cu, size_t stmt_list)
+{
+	struct drgn_error *err;
+
+	struct drgn_debug_info_buffer buffer;
+	drgn_debug_info_buffer_init(&buffer, cu->module, DRGN_SCN_DEBUG_LINE);
+	/* Checked in index_cu_first_pass(). */
+	buffer.bb.pos += stmt_list;
+
+	uint16_t version;
+	bool is_64_bit;
+	if ((err = skip_lnp_header(&buffer, &version, &is_64_bit)))
+		return err;
+
+	struct siphash_vector directories = VECTOR_INIT;
+	struct uint64_vector file_name_hashes = VECTOR_INIT;
+	if (version >= 5) {
+		err = read_file_name_table_v5(&buffer, is_64_bit, &directories,
+					      &file_name_hashes);
+	} else {
+		err = read_file_name_table_v2(&buffer, &directories,
+					      &file_name_hashes);
+	}
+	if (err) {
+		uint64_vector_deinit(&file_name_hashes);
+	} else {
+		cu->file_name_hashes = file_name_hashes.data;
+		cu->num_file_names = file_name_hashes.size;
+	}
 	siphash_vector_deinit(&directories);
 	return err;
 }
 
 static struct drgn_error *
 index_specification(struct drgn_dwarf_index *dindex, uintptr_t declaration,
-		    Dwfl_Module *module, size_t offset)
+		    struct drgn_debug_info_module *module, size_t offset,
+		    bool debug_types)
 {
 	struct drgn_dwarf_index_specification entry = {
 		.declaration = declaration,
 		.module = module,
 		.offset = offset,
+		.debug_types = debug_types,
 	};
 	struct hash_pair hp =
 		drgn_dwarf_index_specification_map_hash(&declaration);
-	int ret;
-	#pragma omp critical(drgn_index_specification)
-	ret = drgn_dwarf_index_specification_map_insert_hashed(&dindex->specifications,
-							       &entry, hp,
-							       NULL);
+	pthread_mutex_lock(&dindex->specifications_lock);
+	int ret = drgn_dwarf_index_specification_map_insert_hashed(&dindex->specifications,
+								   &entry, hp,
+								   NULL);
+	pthread_mutex_unlock(&dindex->specifications_lock);
 	/*
 	 * There may be duplicates if multiple DIEs reference one declaration,
 	 * but we ignore them.
@@ -774,11 +1329,12 @@ index_cu_first_pass(struct drgn_dwarf_index *dindex,
 {
 	struct drgn_error *err;
 	struct drgn_dwarf_index_cu *cu = buffer->cu;
-	Elf_Data *debug_info = cu->module->scns[DRGN_SCN_DEBUG_INFO];
-	const char *debug_info_buffer = debug_info->d_buf;
+	const char *debug_info_buffer =
+		cu->module->scns[DRGN_SCN_DEBUG_INFO]->d_buf;
+	const char *scn_buffer = cu->module->scns[cu->scn]->d_buf;
 	unsigned int depth = 0;
 	for (;;) {
-		size_t die_offset = buffer->bb.pos - debug_info_buffer;
+		size_t die_offset = buffer->bb.pos - scn_buffer;
 
 		uint64_t code;
 		if ((err = binary_buffer_next_uleb128(&buffer->bb, &code)))
@@ -799,6 +1355,8 @@ index_cu_first_pass(struct drgn_dwarf_index *dindex,
 		uintptr_t specification = 0;
 		const char *stmt_list_ptr = NULL;
 		uint64_t stmt_list;
+		const char *str_offsets_base_ptr = NULL;
+		uint64_t str_offsets_base;
 		const char *sibling = NULL;
 		uint8_t insn;
 		while ((insn = *insnp++)) {
@@ -825,6 +1383,7 @@ index_cu_first_pass(struct drgn_dwarf_index *dindex,
 					return err;
 				goto skip;
 			case ATTRIB_LEB128:
+			case ATTRIB_NAME_STRX:
 			case ATTRIB_DECL_FILE_UDATA:
 				if ((err = binary_buffer_skip_leb128(&buffer->bb)))
 					return err;
@@ -882,20 +1441,43 @@ sibling:
 								  &stmt_list)))
 					return err;
 				break;
+			case ATTRIB_STR_OFFSETS_BASE4:
+				str_offsets_base_ptr = buffer->bb.pos;
+				if ((err = binary_buffer_next_u32_into_u64(&buffer->bb,
+									   &str_offsets_base)))
+					return err;
+				break;
+			case ATTRIB_STR_OFFSETS_BASE8:
+				str_offsets_base_ptr = buffer->bb.pos;
+				if ((err = binary_buffer_next_u64(&buffer->bb,
+								  &str_offsets_base)))
+					return err;
+				break;
+			case ATTRIB_NAME_STRX1:
 			case ATTRIB_DECL_FILE_DATA1:
 				skip = 1;
 				goto skip;
+			case ATTRIB_NAME_STRX2:
 			case ATTRIB_DECL_FILE_DATA2:
 				skip = 2;
 				goto skip;
+			case ATTRIB_NAME_STRX3:
+				skip = 3;
+				goto skip;
 			case ATTRIB_NAME_STRP4:
+			case ATTRIB_NAME_STRP_ALT4:
+			case ATTRIB_NAME_STRX4:
 			case ATTRIB_DECL_FILE_DATA4:
 				skip = 4;
 				goto skip;
 			case ATTRIB_NAME_STRP8:
+			case ATTRIB_NAME_STRP_ALT8:
 			case ATTRIB_DECL_FILE_DATA8:
 				skip = 8;
 				goto skip;
+			case ATTRIB_DECL_FILE_IMPLICIT:
+				next_insn_uleb128(&insnp);
+				break;
 			case ATTRIB_DECLARATION_FLAG: {
 				uint8_t flag;
 				if ((err = binary_buffer_next_u8(&buffer->bb,
@@ -944,6 +1526,20 @@ specification:
 specification_ref_addr:
 				specification = (uintptr_t)debug_info_buffer + tmp;
 				break;
+			case ATTRIB_SPECIFICATION_REF_ALT4:
+				if ((err = binary_buffer_next_u32_into_u64(&buffer->bb,
+									   &tmp)))
+					return err;
+				goto specification_ref_alt;
+			case ATTRIB_SPECIFICATION_REF_ALT8:
+				if ((err = binary_buffer_next_u64(&buffer->bb,
+								  &tmp)))
+					return err;
+specification_ref_alt:
+				specification =
+					(uintptr_t)cu->module->alt->scns[DRGN_SCN_DEBUG_INFO]->d_buf +
+					tmp;
+				break;
 			default:
 				skip = insn;
 skip:
@@ -956,6 +1552,49 @@ skip:
 		insn = *insnp;
 
 		if (depth == 0) {
+			Elf_Data *debug_str_offsets =
+				cu->module->scns[DRGN_SCN_DEBUG_STR_OFFSETS];
+			if (str_offsets_base_ptr) {
+				if (str_offsets_base > debug_str_offsets->d_size) {
+					return binary_buffer_error_at(&buffer->bb,
+								      str_offsets_base_ptr,
+								      "DW_AT_str_offsets_base is out of bounds");
+				}
+			} else if (debug_str_offsets && cu->version < 5) {
+				/*
+				 * The GNU split DWARF extension for DWARF 4
+				 * uses .debug_str_offsets.dwo without a
+				 * header.
+				 */
+				str_offsets_base = 0;
+			} else if (debug_str_offsets) {
+				/*
+				 * Without DW_AT_str_offsets_base, assume that
+				 * the unit uses the first contribution in the
+				 * section, which starts after its header.
+				 */
+				uint32_t unit_length = 0;
+				if (debug_str_offsets->d_size >= sizeof(unit_length)) {
+					memcpy(&unit_length,
+					       debug_str_offsets->d_buf,
+					       sizeof(unit_length));
+				}
+				str_offsets_base =
+					unit_length == UINT32_C(0xffffffff) ?
+					16 : 8;
+				if (str_offsets_base > debug_str_offsets->d_size)
+					str_offsets_base = debug_str_offsets->d_size;
+			}
+			if (debug_str_offsets) {
+				cu->str_offsets =
+					(const char *)debug_str_offsets->d_buf +
+					str_offsets_base;
+				cu->num_str_offsets =
+					(debug_str_offsets->d_size -
+					 str_offsets_base) /
+					(cu->is_64_bit ? 8 : 4);
+			}
+
 			if (stmt_list_ptr) {
 				if (stmt_list >
 				    cu->module->scns[DRGN_SCN_DEBUG_LINE]->d_size) {
@@ -966,6 +1605,15 @@ skip:
 				if ((err = read_file_name_table(dindex, cu,
 								stmt_list)))
 					return err;
+			} else if (cu->module->is_dwo &&
+				   cu->module->scns[DRGN_SCN_DEBUG_LINE]) {
+				/*
+				 * Split units don't have DW_AT_stmt_list;
+				 * DW_AT_decl_file refers to the file name
+				 * table at the start of .debug_line.dwo.
+				 */
+				if ((err = read_file_name_table(dindex, cu, 0)))
+					return err;
 			}
 		} else if (specification) {
 			if (insn & DIE_FLAG_DECLARATION)
@@ -978,8 +1626,9 @@ skip:
 			 */
 			if (!declaration &&
 			    (err = index_specification(dindex, specification,
-						       cu->module->dwfl_module,
-						       die_offset)))
+						       cu->module, die_offset,
+						       cu->scn ==
+						       DRGN_SCN_DEBUG_TYPES)))
 				return err;
 		}
 
@@ -996,12 +1645,96 @@ skip:
 	return NULL;
 }
 
-void drgn_dwarf_index_read_module(struct drgn_dwarf_index_update_state *state,
-				  struct drgn_debug_info_module *module)
+/*
+ * Record the signature of a type unit. On success, *ret is set to whether this
+ * is the first type unit with that signature, i.e., whether it should be
+ * indexed. Returns false if allocating memory failed.
+ */
+static bool index_type_unit(struct drgn_dwarf_index *dindex,
+			    struct drgn_dwarf_index_cu *cu, bool *ret)
+{
+	struct drgn_dwarf_index_type_unit entry = {
+		.signature = cu->type_signature,
+		.module = cu->module,
+		.offset = (cu->buf - (char *)cu->module->scns[cu->scn]->d_buf +
+			   cu->type_offset),
+		.debug_types = cu->scn == DRGN_SCN_DEBUG_TYPES,
+	};
+	pthread_mutex_lock(&dindex->type_units_lock);
+	int r = drgn_dwarf_index_type_unit_map_insert(&dindex->type_units,
+						      &entry, NULL);
+	pthread_mutex_unlock(&dindex->type_units_lock);
+	if (r == -1)
+		return false;
+	*ret = r == 1;
+	return true;
+}
+
+struct read_cu_arg {
+	struct drgn_dwarf_index_update_state *state;
+	struct drgn_debug_info_module *module;
+	enum drgn_debug_info_scn scn;
+	const char *buf;
+	size_t len;
+	bool is_64_bit;
+};
+
+static struct drgn_error *read_cu_task(struct drgn_task_group *group,
+				       void *arg)
+{
+	struct read_cu_arg *a = arg;
+	struct drgn_dwarf_index_update_state *state = a->state;
+	struct drgn_dwarf_index_cu cu = {
+		.module = a->module,
+		.scn = a->scn,
+		.buf = a->buf,
+		.len = a->len,
+		.is_64_bit = a->is_64_bit,
+		.index_categories = a->module->index_categories,
+	};
+	struct drgn_dwarf_index_cu_buffer cu_buffer;
+	drgn_dwarf_index_cu_buffer_init(&cu_buffer, &cu);
+	struct drgn_error *err = read_cu(&cu_buffer);
+	if (err)
+		goto err;
+
+	if (cu.unit_type == DW_UT_type || cu.unit_type == DW_UT_split_type) {
+		bool new_type_unit;
+		if (!index_type_unit(state->dindex, &cu, &new_type_unit)) {
+			err = &drgn_enomem;
+			goto err;
+		}
+		/* Another copy of this type unit was already indexed. */
+		if (!new_type_unit) {
+			drgn_dwarf_index_cu_deinit(&cu);
+			return NULL;
+		}
+	}
+
+	err = index_cu_first_pass(state->dindex, &cu_buffer);
+	if (err)
+		goto err;
+
+	pthread_mutex_lock(&state->cus_lock);
+	if (!drgn_dwarf_index_cu_vector_append(&state->dindex->cus, &cu))
+		err = &drgn_enomem;
+	pthread_mutex_unlock(&state->cus_lock);
+	if (err)
+		goto err;
+	return NULL;
+
+err:
+	drgn_dwarf_index_cu_deinit(&cu);
+	return err;
+}
+
+static void read_units(struct drgn_dwarf_index_update_state *state,
+		       struct drgn_debug_info_module *module,
+		       enum drgn_debug_info_scn scn)
 {
 	struct drgn_error *err;
 	struct drgn_debug_info_buffer buffer;
-	drgn_debug_info_buffer_init(&buffer, module, DRGN_SCN_DEBUG_INFO);
+	drgn_debug_info_buffer_init(&buffer, module, scn);
 	while (binary_buffer_has_next(&buffer.bb)) {
 		const char *cu_buf = buffer.bb.pos;
 		uint32_t unit_length32;
@@ -1026,36 +1759,17 @@ void drgn_dwarf_index_read_module(struct drgn_dwarf_index_update_state *state,
 						      unit_length32)))
 				goto err;
 		}
-		size_t cu_len = buffer.bb.pos - cu_buf;
-
-		#pragma omp task
-		{
-			struct drgn_dwarf_index_cu cu = {
-				.module = module,
-				.buf = cu_buf,
-				.len = cu_len,
-				.is_64_bit = is_64_bit,
-			};
-			struct drgn_dwarf_index_cu_buffer cu_buffer;
-			drgn_dwarf_index_cu_buffer_init(&cu_buffer, &cu);
-			struct drgn_error *cu_err = read_cu(&cu_buffer);
-			if (cu_err)
-				goto cu_err;
-
-			cu_err = index_cu_first_pass(state->dindex, &cu_buffer);
-			if (cu_err)
-				goto cu_err;
-
-			#pragma omp critical(drgn_dwarf_index_cus)
-			if (!drgn_dwarf_index_cu_vector_append(&state->dindex->cus,
-							       &cu))
-				cu_err = &drgn_enomem;
-			if (cu_err) {
-cu_err:
-				drgn_dwarf_index_cu_deinit(&cu);
-				drgn_dwarf_index_update_cancel(state, cu_err);
-			}
-		}
+
+		struct read_cu_arg arg = {
+			.state = state,
+			.module = module,
+			.scn = scn,
+			.buf = cu_buf,
+			.len = buffer.bb.pos - cu_buf,
+			.is_64_bit = is_64_bit,
+		};
+		drgn_task_group_spawn(&state->group, read_cu_task, &arg,
+				      sizeof(arg));
 	}
 	return;
 
@@ -1063,8 +1777,23 @@ err:
 	drgn_dwarf_index_update_cancel(state, err);
 }
 
+/*
+ * Every unit is indexed directly, including partial units (e.g., from dwz)
+ * in the module or its alternate debug file. So, DW_TAG_imported_unit doesn't
+ * need to be followed, and a partial unit is only scanned once no matter how
+ * many units import it.
+ */
+void drgn_dwarf_index_read_module(struct drgn_dwarf_index_update_state *state,
+				  struct drgn_debug_info_module *module)
+{
+	read_units(state, module, DRGN_SCN_DEBUG_INFO);
+	if (module->scns[DRGN_SCN_DEBUG_TYPES])
+		read_units(state, module, DRGN_SCN_DEBUG_TYPES);
+}
+
 static bool find_definition(struct drgn_dwarf_index *dindex, uintptr_t die_addr,
-			    Dwfl_Module **module_ret, size_t *offset_ret)
+			    struct drgn_debug_info_module **module_ret,
+			    size_t *offset_ret, bool *debug_types_ret)
 {
 	struct drgn_dwarf_index_specification_map_iterator it =
 		drgn_dwarf_index_specification_map_search(&dindex->specifications,
@@ -1073,13 +1802,15 @@ static bool find_definition(struct drgn_dwarf_index *dindex, uintptr_t die_addr,
 		return false;
 	*module_ret = it.entry->module;
 	*offset_ret = it.entry->offset;
+	*debug_types_ret = it.entry->debug_types;
 	return true;
 }
 
 static bool append_die_entry(struct drgn_dwarf_index *dindex,
 			     struct drgn_dwarf_index_shard *shard, uint8_t tag,
-			     uint64_t file_name_hash, Dwfl_Module *module,
-			     size_t offset)
+			     uint64_t file_name_hash,
+			     struct drgn_debug_info_module *module,
+			     size_t offset, bool debug_types)
 {
 	if (shard->dies.size == UINT32_MAX)
 		return false;
@@ -1089,6 +1820,7 @@ static bool append_die_entry(struct drgn_dwarf_index *dindex,
 		return false;
 	die->next = UINT32_MAX;
 	die->tag = tag;
+	die->debug_types = debug_types;
 	if (die->tag == DW_TAG_namespace) {
 		die->namespace = malloc(sizeof(*die->namespace));
 		if (!die->namespace) {
@@ -1109,7 +1841,9 @@ static struct drgn_error *index_die(struct drgn_dwarf_index_namespace *ns,
 				    struct drgn_dwarf_index_cu *cu,
 				    const char *name, uint8_t tag,
 				    uint64_t file_name_hash,
-				    Dwfl_Module *module, size_t offset)
+				    struct drgn_debug_info_module *module,
+				    size_t offset, bool debug_types,
+				    enum drgn_index_category categories)
 {
 	struct drgn_error *err;
 	struct drgn_dwarf_index_die_map_entry entry = {
@@ -1126,12 +1860,12 @@ static struct drgn_error *index_die(struct drgn_dwarf_index_namespace *ns,
 
 	hp = drgn_dwarf_index_die_map_hash(&entry.key);
 	shard = &ns->shards[hash_pair_to_shard(hp)];
-	omp_set_lock(&shard->lock);
+	pthread_mutex_lock(&shard->lock);
 	it = drgn_dwarf_index_die_map_search_hashed(&shard->map, &entry.key,
 						    hp);
 	if (!it.entry) {
 		if (!append_die_entry(ns->dindex, shard, tag, file_name_hash,
-				      module, offset)) {
+				      module, offset, debug_types)) {
 			err = &drgn_enomem;
 			goto err;
 		}
@@ -1160,7 +1894,7 @@ static struct drgn_error *index_die(struct drgn_dwarf_index_namespace *ns,
 
 	index = die - shard->dies.data;
 	if (!append_die_entry(ns->dindex, shard, tag, file_name_hash, module,
-			      offset)) {
+			      offset, debug_types)) {
 		err = &drgn_enomem;
 		goto err;
 	}
@@ -1176,28 +1910,60 @@ out:
 		}
 		pending->cu = cu - ns->dindex->cus.data;
 		pending->offset = offset;
+		pending->categories = categories;
 	}
 	err = NULL;
 err:
-	omp_unset_lock(&shard->lock);
+	pthread_mutex_unlock(&shard->lock);
 	return err;
 }
 
-/* Second pass: index the actual DIEs. */
+/*
+ * Return the category of names that a DIE tag belongs to, or 0 for namespaces,
+ * which are always indexed.
+ */
+static enum drgn_index_category dw_tag_index_category(uint64_t tag)
+{
+	switch (tag) {
+	case DW_TAG_base_type:
+	case DW_TAG_class_type:
+	case DW_TAG_enumeration_type:
+	case DW_TAG_structure_type:
+	case DW_TAG_typedef:
+	case DW_TAG_union_type:
+		return DRGN_INDEX_TYPES;
+	case DW_TAG_variable:
+		return DRGN_INDEX_VARIABLES;
+	case DW_TAG_enumerator:
+		return DRGN_INDEX_CONSTANTS;
+	case DW_TAG_subprogram:
+		return DRGN_INDEX_FUNCTIONS;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Second pass: index the actual DIEs. Only names in the given categories (and
+ * namespaces) are indexed.
+ */
 static struct drgn_error *
 index_cu_second_pass(struct drgn_dwarf_index_namespace *ns,
-		     struct drgn_dwarf_index_cu_buffer *buffer)
+		     struct drgn_dwarf_index_cu_buffer *buffer,
+		     enum drgn_index_category categories)
 {
 	struct drgn_error *err;
 	struct drgn_dwarf_index_cu *cu = buffer->cu;
-	Elf_Data *debug_info = cu->module->scns[DRGN_SCN_DEBUG_INFO];
-	const char *debug_info_buffer = debug_info->d_buf;
+	const char *scn_buffer = cu->module->scns[cu->scn]->d_buf;
 	Elf_Data *debug_str = cu->module->scns[DRGN_SCN_DEBUG_STR];
+	/* Checked in read_abbrev_decl() if it is used. */
+	Elf_Data *alt_debug_str =
+		cu->module->alt ? cu->module->alt->scns[DRGN_SCN_DEBUG_STR] : NULL;
 	unsigned int depth = 0;
 	uint8_t depth1_tag = 0;
 	size_t depth1_offset = 0;
 	for (;;) {
-		size_t die_offset = buffer->bb.pos - debug_info_buffer;
+		size_t die_offset = buffer->bb.pos - scn_buffer;
 
 		uint64_t code;
 		if ((err = binary_buffer_next_uleb128(&buffer->bb, &code)))
@@ -1302,6 +2068,59 @@ sibling:
 			case ATTRIB_NAME_STRP8:
 				if ((err = binary_buffer_next_u64(&buffer->bb, &tmp)))
 					return err;
+				goto strp;
+			case ATTRIB_NAME_STRX:
+				if ((err = binary_buffer_next_uleb128(&buffer->bb,
+								      &tmp)))
+					return err;
+				goto strx;
+			case ATTRIB_NAME_STRX1:
+				if ((err = binary_buffer_next_u8_into_u64(&buffer->bb,
+									  &tmp)))
+					return err;
+				goto strx;
+			case ATTRIB_NAME_STRX2:
+				if ((err = binary_buffer_next_u16_into_u64(&buffer->bb,
+									   &tmp)))
+					return err;
+				goto strx;
+			case ATTRIB_NAME_STRX3: {
+				const uint8_t *p = (const uint8_t *)buffer->bb.pos;
+				if ((err = binary_buffer_skip(&buffer->bb, 3)))
+					return err;
+				if (cu->module->little_endian) {
+					tmp = ((uint64_t)p[0] |
+					       (uint64_t)p[1] << 8 |
+					       (uint64_t)p[2] << 16);
+				} else {
+					tmp = ((uint64_t)p[0] << 16 |
+					       (uint64_t)p[1] << 8 |
+					       (uint64_t)p[2]);
+				}
+				goto strx;
+			}
+			case ATTRIB_NAME_STRX4:
+				if ((err = binary_buffer_next_u32_into_u64(&buffer->bb,
+									   &tmp)))
+					return err;
+strx:
+				if (tmp >= cu->num_str_offsets) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_AT_name index is out of bounds");
+				}
+				if (cu->is_64_bit) {
+					uint64_t offset;
+					memcpy(&offset, cu->str_offsets + tmp * 8,
+					       sizeof(offset));
+					tmp = buffer->bb.bswap ?
+					      bswap_64(offset) : offset;
+				} else {
+					uint32_t offset;
+					memcpy(&offset, cu->str_offsets + tmp * 4,
+					       sizeof(offset));
+					tmp = buffer->bb.bswap ?
+					      bswap_32(offset) : offset;
+				}
 strp:
 				if (tmp > debug_str->d_size) {
 					return binary_buffer_error(&buffer->bb,
@@ -1310,10 +2129,28 @@ strp:
 				name = (const char *)debug_str->d_buf + tmp;
 				__builtin_prefetch(name);
 				break;
+			case ATTRIB_NAME_STRP_ALT4:
+				if ((err = binary_buffer_next_u32_into_u64(&buffer->bb,
+									   &tmp)))
+					return err;
+				goto strp_alt;
+			case ATTRIB_NAME_STRP_ALT8:
+				if ((err = binary_buffer_next_u64(&buffer->bb, &tmp)))
+					return err;
+strp_alt:
+				if (tmp > alt_debug_str->d_size) {
+					return binary_buffer_error(&buffer->bb,
+								   "DW_AT_name is out of bounds");
+				}
+				name = (const char *)alt_debug_str->d_buf + tmp;
+				__builtin_prefetch(name);
+				break;
 			case ATTRIB_STMT_LIST_LINEPTR4:
+			case ATTRIB_STR_OFFSETS_BASE4:
 				skip = 4;
 				goto skip;
 			case ATTRIB_STMT_LIST_LINEPTR8:
+			case ATTRIB_STR_OFFSETS_BASE8:
 				skip = 8;
 				goto skip;
 			case ATTRIB_DECL_FILE_DATA1:
@@ -1346,6 +2183,10 @@ strp:
 								      &decl_file)))
 					return err;
 				break;
+			case ATTRIB_DECL_FILE_IMPLICIT:
+				decl_file_ptr = buffer->bb.pos;
+				decl_file = next_insn_uleb128(&insnp);
+				break;
 			case ATTRIB_DECLARATION_FLAG: {
 				uint8_t flag;
 				if ((err = binary_buffer_next_u8(&buffer->bb,
@@ -1365,11 +2206,13 @@ strp:
 				goto skip;
 			case ATTRIB_SPECIFICATION_REF4:
 			case ATTRIB_SPECIFICATION_REF_ADDR4:
+			case ATTRIB_SPECIFICATION_REF_ALT4:
 				specification = true;
 				skip = 4;
 				goto skip;
 			case ATTRIB_SPECIFICATION_REF8:
 			case ATTRIB_SPECIFICATION_REF_ADDR8:
+			case ATTRIB_SPECIFICATION_REF_ALT8:
 				specification = true;
 				skip = 8;
 				goto skip;
@@ -1390,10 +2233,20 @@ skip:
 			depth1_offset = die_offset;
 		}
 		if (depth == (tag == DW_TAG_enumerator ? 2 : 1) && name &&
-		    !specification) {
+		    !specification &&
+		    (tag == DW_TAG_namespace ||
+		     (dw_tag_index_category(tag) & categories))) {
 			if (insn & DIE_FLAG_DECLARATION)
 				declaration = true;
-			Dwfl_Module *module = cu->module->dwfl_module;
+			/*
+			 * Namespaces are merged, so a namespace declaration
+			 * (like the one enclosing a type in a type unit) is as
+			 * good as a definition.
+			 */
+			if (tag == DW_TAG_namespace)
+				declaration = false;
+			struct drgn_debug_info_module *module = cu->module;
+			bool debug_types = cu->scn == DRGN_SCN_DEBUG_TYPES;
 			if (tag == DW_TAG_enumerator) {
 				if (depth1_tag != DW_TAG_enumeration_type)
 					goto next;
@@ -1406,26 +2259,32 @@ skip:
 				die_offset = depth1_offset;
 			} else if (declaration &&
 				   !find_definition(ns->dindex,
-						    (uintptr_t)debug_info_buffer +
+						    (uintptr_t)scn_buffer +
 						    die_offset,
-						    &module, &die_offset)) {
+						    &module, &die_offset,
+						    &debug_types)) {
 					goto next;
 			}
 
+			/*
+			 * Before DWARF 5, file 0 means no file. As of DWARF 5,
+			 * it is the primary source file.
+			 */
 			uint64_t file_name_hash;
-			if (decl_file) {
-				if (decl_file > cu->num_file_names) {
+			if (decl_file_ptr && (decl_file || cu->version >= 5)) {
+				if (decl_file >= cu->num_file_names) {
 					return binary_buffer_error_at(&buffer->bb,
 								      decl_file_ptr,
 								      "invalid DW_AT_decl_file %" PRIu64,
 								      decl_file);
 				}
-				file_name_hash = cu->file_name_hashes[decl_file - 1];
+				file_name_hash = cu->file_name_hashes[decl_file];
 			} else {
 				file_name_hash = 0;
 			}
 			if ((err = index_die(ns, cu, name, tag, file_name_hash,
-					     module, die_offset)))
+					     module, die_offset, debug_types,
+					     categories)))
 				return err;
 		}
 
@@ -1463,11 +2322,8 @@ static void drgn_dwarf_index_rollback(struct drgn_dwarf_index *dindex)
 		while (shard->dies.size) {
 			struct drgn_dwarf_index_die *die =
 				&shard->dies.data[shard->dies.size - 1];
-			void **userdatap;
-			dwfl_module_info(die->module, &userdatap, NULL,
-					 NULL, NULL, NULL, NULL, NULL);
-			struct drgn_debug_info_module *module = *userdatap;
-			if (module->state == DRGN_DEBUG_INFO_MODULE_INDEXED)
+			if (die->module->state ==
+			    DRGN_DEBUG_INFO_MODULE_INDEXED)
 				break;
 			if (die->tag == DW_TAG_namespace) {
 				drgn_dwarf_index_namespace_deinit(die->namespace);
@@ -1482,7 +2338,7 @@ static void drgn_dwarf_index_rollback(struct drgn_dwarf_index *dindex)
 		 * entries must also be new, so there's no need to preserve
 		 * them.
 		 */
-		for (size_t index = 0; index < shard->dies.size; i++) {
+		for (size_t index = 0; index < shard->dies.size; index++) {
 			struct drgn_dwarf_index_die *die =
 				&shard->dies.data[index];
 			if (die->next != UINT32_MAX &&
@@ -1506,51 +2362,75 @@ static void drgn_dwarf_index_rollback(struct drgn_dwarf_index *dindex)
 	for (struct drgn_dwarf_index_specification_map_iterator it =
 	     drgn_dwarf_index_specification_map_first(&dindex->specifications);
 	     it.entry; ) {
-		void **userdatap;
-		dwfl_module_info(it.entry->module, &userdatap, NULL, NULL, NULL,
-				 NULL, NULL, NULL);
-		struct drgn_debug_info_module *module = *userdatap;
-		if (module->state == DRGN_DEBUG_INFO_MODULE_INDEXED) {
+		if (it.entry->module->state == DRGN_DEBUG_INFO_MODULE_INDEXED) {
 			it = drgn_dwarf_index_specification_map_next(it);
 		} else {
 			it = drgn_dwarf_index_specification_map_delete_iterator(&dindex->specifications,
 										it);
 		}
 	}
+
+	for (struct drgn_dwarf_index_type_unit_map_iterator it =
+	     drgn_dwarf_index_type_unit_map_first(&dindex->type_units);
+	     it.entry; ) {
+		if (it.entry->module->state == DRGN_DEBUG_INFO_MODULE_INDEXED) {
+			it = drgn_dwarf_index_type_unit_map_next(it);
+		} else {
+			it = drgn_dwarf_index_type_unit_map_delete_iterator(&dindex->type_units,
+									    it);
+		}
+	}
+}
+
+static struct drgn_error *index_new_cu(size_t i, void *arg)
+{
+	struct drgn_dwarf_index *dindex = arg;
+	struct drgn_dwarf_index_cu *cu = &dindex->cus.data[i];
+	struct drgn_dwarf_index_cu_buffer buffer;
+	drgn_dwarf_index_cu_buffer_init(&buffer, cu);
+	buffer.bb.pos += cu->header_size;
+	return index_cu_second_pass(&dindex->global, &buffer,
+				    cu->index_categories);
 }
 
 struct drgn_error *
 drgn_dwarf_index_update_end(struct drgn_dwarf_index_update_state *state)
 {
 	struct drgn_dwarf_index *dindex = state->dindex;
+	struct drgn_thread_pool *pool = state->group.pool;
 
-	if (state->err)
+	struct drgn_error *err = drgn_task_group_wait(&state->group);
+	pthread_mutex_destroy(&state->cus_lock);
+	if (err)
 		goto err;
 
-	#pragma omp parallel for schedule(dynamic)
-	for (size_t i = state->old_cus_size; i < dindex->cus.size; i++) {
-		if (drgn_dwarf_index_update_cancelled(state))
-			continue;
-		struct drgn_dwarf_index_cu *cu = &dindex->cus.data[i];
-		struct drgn_dwarf_index_cu_buffer buffer;
-		drgn_dwarf_index_cu_buffer_init(&buffer, cu);
-		buffer.bb.pos += cu->is_64_bit ? 23 : 11;
-		struct drgn_error *cu_err =
-			index_cu_second_pass(&dindex->global, &buffer);
-		if (cu_err)
-			drgn_dwarf_index_update_cancel(state, cu_err);
-	}
-	if (state->err) {
-		drgn_dwarf_index_rollback(state->dindex);
+	err = drgn_thread_pool_for_each(pool, state->old_cus_size,
+					dindex->cus.size, index_new_cu, dindex);
+	if (err) {
+		drgn_dwarf_index_rollback(dindex);
 		goto err;
 	}
+	for (size_t i = state->old_cus_size; i < dindex->cus.size; i++)
+		dindex->indexed_categories &= dindex->cus.data[i].index_categories;
 	return NULL;
 
 err:
 	for (size_t i = state->old_cus_size; i < dindex->cus.size; i++)
 		drgn_dwarf_index_cu_deinit(&dindex->cus.data[i]);
 	dindex->cus.size = state->old_cus_size;
-	return state->err;
+	return err;
+}
+
+static struct drgn_error *index_pending_die(size_t i, void *arg)
+{
+	struct drgn_dwarf_index_namespace *ns = arg;
+	struct drgn_dwarf_index_pending_die *pending = &ns->pending_dies.data[i];
+	struct drgn_dwarf_index_cu *cu = &ns->dindex->cus.data[pending->cu];
+	struct drgn_dwarf_index_cu_buffer buffer;
+	drgn_dwarf_index_cu_buffer_init(&buffer, cu);
+	buffer.bb.pos = ((const char *)cu->module->scns[cu->scn]->d_buf +
+			 pending->offset);
+	return index_cu_second_pass(ns, &buffer, pending->categories);
 }
 
 static struct drgn_error *index_namespace(struct drgn_dwarf_index_namespace *ns)
@@ -1558,28 +2438,13 @@ static struct drgn_error *index_namespace(struct drgn_dwarf_index_namespace *ns)
 	if (ns->saved_err)
 		return drgn_error_copy(ns->saved_err);
 
-	struct drgn_error *err = NULL;
-	#pragma omp for schedule(dynamic)
-	for (size_t i = 0; i < ns->pending_dies.size; i++) {
-		if (!err) {
-			struct drgn_dwarf_index_pending_die *pending =
-				&ns->pending_dies.data[i];
-			struct drgn_dwarf_index_cu *cu =
-				&ns->dindex->cus.data[pending->cu];
-			struct drgn_dwarf_index_cu_buffer buffer;
-			drgn_dwarf_index_cu_buffer_init(&buffer, cu);
-			buffer.bb.pos += pending->offset;
-			struct drgn_error *cu_err =
-				index_cu_second_pass(ns, &buffer);
-			if (cu_err) {
-				#pragma omp critical(drgn_index_namespace)
-				if (err)
-					drgn_error_destroy(cu_err);
-				else
-					err = cu_err;
-			}
-		}
-	}
+	struct drgn_thread_pool *pool;
+	struct drgn_error *err = drgn_program_thread_pool(ns->dindex->prog,
+							  &pool);
+	if (err)
+		return err;
+	err = drgn_thread_pool_for_each(pool, 0, ns->pending_dies.size,
+					index_pending_die, ns);
 	if (err) {
 		ns->saved_err = err;
 		return drgn_error_copy(ns->saved_err);
@@ -1588,13 +2453,76 @@ static struct drgn_error *index_namespace(struct drgn_dwarf_index_namespace *ns)
 	return err;
 }
 
+struct fill_cu_arg {
+	struct drgn_dwarf_index *dindex;
+	enum drgn_index_category categories;
+};
+
+static struct drgn_error *fill_cu(size_t i, void *arg)
+{
+	struct fill_cu_arg *a = arg;
+	struct drgn_dwarf_index_cu *cu = &a->dindex->cus.data[i];
+	enum drgn_index_category missing =
+		a->categories & ~cu->index_categories;
+	if (!missing)
+		return NULL;
+	struct drgn_dwarf_index_cu_buffer buffer;
+	drgn_dwarf_index_cu_buffer_init(&buffer, cu);
+	buffer.bb.pos += cu->header_size;
+	struct drgn_error *err = index_cu_second_pass(&a->dindex->global,
+						      &buffer, missing);
+	if (!err)
+		cu->index_categories |= missing;
+	return err;
+}
+
+/*
+ * Index names in the given categories in every unit that skipped them.
+ *
+ * Indexing a unit again doesn't add duplicate entries, so units which fail are
+ * simply retried (and fail again) the next time.
+ */
+static struct drgn_error *
+drgn_dwarf_index_fill(struct drgn_dwarf_index *dindex,
+		      enum drgn_index_category categories)
+{
+	if (!(categories & ~dindex->indexed_categories))
+		return NULL;
+
+	struct drgn_thread_pool *pool;
+	struct drgn_error *err = drgn_program_thread_pool(dindex->prog, &pool);
+	if (err)
+		return err;
+	struct fill_cu_arg arg = {
+		.dindex = dindex,
+		.categories = categories,
+	};
+	err = drgn_thread_pool_for_each(pool, 0, dindex->cus.size, fill_cu,
+					&arg);
+
+	enum drgn_index_category indexed = DRGN_INDEX_ALL;
+	for (size_t i = 0; i < dindex->cus.size; i++)
+		indexed &= dindex->cus.data[i].index_categories;
+	dindex->indexed_categories = indexed;
+	return err;
+}
+
 struct drgn_error *
 drgn_dwarf_index_iterator_init(struct drgn_dwarf_index_iterator *it,
 			       struct drgn_dwarf_index_namespace *ns,
 			       const char *name, size_t name_len,
 			       const uint64_t *tags, size_t num_tags)
 {
-	struct drgn_error *err = index_namespace(ns);
+	enum drgn_index_category categories = 0;
+	for (size_t i = 0; i < num_tags; i++)
+		categories |= dw_tag_index_category(tags[i]);
+	struct drgn_error *err = drgn_dwarf_index_fill(ns->dindex,
+						       num_tags ?
+						       categories :
+						       DRGN_INDEX_ALL);
+	if (err)
+		return err;
+	err = index_namespace(ns);
 	if (err)
 		return err;
 	it->ns = ns;
@@ -1686,17 +2614,46 @@ drgn_dwarf_index_iterator_next(struct drgn_dwarf_index_iterator *it)
 	return die;
 }
 
-struct drgn_error *drgn_dwarf_index_get_die(struct drgn_dwarf_index_die *die,
-					    Dwarf_Die *die_ret,
-					    uint64_t *bias_ret)
+static struct drgn_error *get_die(struct drgn_debug_info_module *module,
+				  size_t offset, bool debug_types,
+				  Dwarf_Die *die_ret, uint64_t *bias_ret)
 {
+	Dwarf *dwarf;
 	Dwarf_Addr bias;
-	Dwarf *dwarf = dwfl_module_getdwarf(die->module, &bias);
-	if (!dwarf)
-		return drgn_error_libdwfl();
-	if (!dwarf_offdie(dwarf, die->offset, die_ret))
-		return drgn_error_libdw();
+	struct drgn_error *err = drgn_debug_info_module_get_dwarf(module,
+								  &dwarf,
+								  &bias);
+	if (err)
+		return err;
+	if (debug_types) {
+		if (!dwarf_offdie_types(dwarf, offset, die_ret))
+			return drgn_error_libdw();
+	} else {
+		if (!dwarf_offdie(dwarf, offset, die_ret))
+			return drgn_error_libdw();
+	}
 	if (bias_ret)
 		*bias_ret = bias;
 	return NULL;
 }
+
+struct drgn_error *drgn_dwarf_index_get_die(struct drgn_dwarf_index_die *die,
+					    Dwarf_Die *die_ret,
+					    uint64_t *bias_ret)
+{
+	return get_die(die->module, die->offset, die->debug_types, die_ret,
+		       bias_ret);
+}
+
+struct drgn_error *
+drgn_dwarf_index_find_type_unit(struct drgn_dwarf_index *dindex,
+				uint64_t signature, Dwarf_Die *die_ret)
+{
+	struct drgn_dwarf_index_type_unit_map_iterator it =
+		drgn_dwarf_index_type_unit_map_search(&dindex->type_units,
+						      &signature);
+	if (!it.entry)
+		return &drgn_not_found;
+	return get_die(it.entry->module, it.entry->offset,
+		       it.entry->debug_types, die_ret, NULL);
+}
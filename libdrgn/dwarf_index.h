@@ -14,21 +14,14 @@
 
 #include <elfutils/libdw.h>
 #include <elfutils/libdwfl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
-#ifdef _OPENMP
-#include <omp.h>
-#else
-typedef struct {} omp_lock_t;
-#define omp_init_lock(lock) do {} while (0)
-#define omp_destroy_lock(lock) do {} while (0)
-#define omp_set_lock(lock) do {} while (0)
-#define omp_unset_lock(lock) do {} while (0)
-#endif
-
+#include "drgn.h"
 #include "hash_table.h"
+#include "thread_pool.h"
 #include "vector.h"
 
 struct drgn_debug_info_module;
@@ -71,6 +64,8 @@ struct drgn_dwarf_index_die {
 	 */
 	uint32_t next;
 	uint8_t tag;
+	/* Whether the DIE is in .debug_types rather than .debug_info. */
+	bool debug_types;
 	union {
 		/*
 		 * If tag != DW_TAG_namespace (namespaces are merged, so they
@@ -80,7 +75,11 @@ struct drgn_dwarf_index_die {
 		/* If tag == DW_TAG_namespace. */
 		struct drgn_dwarf_index_namespace *namespace;
 	};
-	Dwfl_Module *module;
+	/*
+	 * Module containing the DIE. This may be an alternate debug file or a
+	 * split DWARF object file.
+	 */
+	struct drgn_debug_info_module *module;
 	size_t offset;
 };
 
@@ -89,7 +88,7 @@ DEFINE_VECTOR_TYPE(drgn_dwarf_index_die_vector, struct drgn_dwarf_index_die)
 
 struct drgn_dwarf_index_shard {
 	/** @privatesection */
-	omp_lock_t lock;
+	pthread_mutex_t lock;
 	/*
 	 * Map from name to list of DIEs with that name (as the index in
 	 * drgn_dwarf_index_shard::dies of the first DIE with that name).
@@ -112,8 +111,10 @@ struct drgn_dwarf_index_specification {
 	 */
 	uintptr_t declaration;
 	/* Module and offset of DIE. */
-	Dwfl_Module *module;
+	struct drgn_debug_info_module *module;
 	size_t offset;
+	/* Whether the DIE is in .debug_types. */
+	bool debug_types;
 };
 
 static inline uintptr_t
@@ -126,6 +127,26 @@ DEFINE_HASH_TABLE_TYPE(drgn_dwarf_index_specification_map,
 		       struct drgn_dwarf_index_specification,
 		       drgn_dwarf_index_specification_to_key)
 
+/* A type unit, identified by its type signature. */
+struct drgn_dwarf_index_type_unit {
+	uint64_t signature;
+	/* Module and offset of the type DIE in the unit. */
+	struct drgn_debug_info_module *module;
+	size_t offset;
+	/* Whether the unit is in .debug_types. */
+	bool debug_types;
+};
+
+static inline uint64_t
+drgn_dwarf_index_type_unit_to_key(const struct drgn_dwarf_index_type_unit *entry)
+{
+	return entry->signature;
+}
+
+DEFINE_HASH_TABLE_TYPE(drgn_dwarf_index_type_unit_map,
+		       struct drgn_dwarf_index_type_unit,
+		       drgn_dwarf_index_type_unit_to_key)
+
 DEFINE_VECTOR_TYPE(drgn_dwarf_index_cu_vector, struct drgn_dwarf_index_cu)
 
 DEFINE_VECTOR_TYPE(drgn_dwarf_index_pending_die_vector,
@@ -169,12 +190,32 @@ struct drgn_dwarf_index {
 	 * a program to cause contention.
 	 */
 	struct drgn_dwarf_index_specification_map specifications;
+	/** Protects @ref specifications while indexing. */
+	pthread_mutex_t specifications_lock;
+	/**
+	 * Map from type signature to the type unit that defines it.
+	 *
+	 * Identical type units are typically emitted by many compilation units
+	 * and modules. Only the first one found with a given signature is
+	 * indexed, and @c DW_FORM_ref_sig8 references are resolved to it.
+	 */
+	struct drgn_dwarf_index_type_unit_map type_units;
+	/** Protects @ref type_units while indexing. */
+	pthread_mutex_t type_units_lock;
 	/** Indexed compilation units. */
 	struct drgn_dwarf_index_cu_vector cus;
+	/**
+	 * Categories of names which have been indexed in every unit in @ref
+	 * cus. Other categories are indexed on demand when they are looked up.
+	 */
+	enum drgn_index_category indexed_categories;
+	/** Program whose thread pool is used for indexing. */
+	struct drgn_program *prog;
 };
 
 /** Initialize a @ref drgn_dwarf_index. */
-void drgn_dwarf_index_init(struct drgn_dwarf_index *dindex);
+void drgn_dwarf_index_init(struct drgn_dwarf_index *dindex,
+			   struct drgn_program *prog);
 
 /**
  * Deinitialize a @ref drgn_dwarf_index.
@@ -184,28 +225,43 @@ void drgn_dwarf_index_init(struct drgn_dwarf_index *dindex);
  */
 void drgn_dwarf_index_deinit(struct drgn_dwarf_index *dindex);
 
+/**
+ * Report the memory usage of a @ref drgn_dwarf_index: its DIEs, name maps,
+ * specification map, type unit map, and compilation units.
+ *
+ * @param[in] dindex Index, or @c NULL to report that nothing is used.
+ */
+struct drgn_error *drgn_dwarf_index_memory_usage(struct drgn_dwarf_index *dindex,
+						 drgn_memory_usage_fn *fn,
+						 void *arg);
+
 /** State tracked while updating a @ref drgn_dwarf_index. */
 struct drgn_dwarf_index_update_state {
 	struct drgn_dwarf_index *dindex;
 	size_t old_cus_size;
-	struct drgn_error *err;
+	/** Tasks reading modules and units for the update. */
+	struct drgn_task_group group;
+	/** Protects @ref drgn_dwarf_index::cus while reading units. */
+	pthread_mutex_t cus_lock;
 };
 
 /**
  * Prepare to update a @ref drgn_dwarf_index.
  *
- * @param[out] state Initialized update state. Must be passed to @ref
- * drgn_dwarf_index_update_end().
+ * @param[out] state Initialized update state. On success, must be passed to
+ * @ref drgn_dwarf_index_update_end().
  */
-void drgn_dwarf_index_update_begin(struct drgn_dwarf_index_update_state *state,
-				   struct drgn_dwarf_index *dindex);
+struct drgn_error *
+drgn_dwarf_index_update_begin(struct drgn_dwarf_index_update_state *state,
+			      struct drgn_dwarf_index *dindex);
 
 /**
  * Finish updating a @ref drgn_dwarf_index.
  *
- * This should be called once all of the tasks created by @ref
- * drgn_dwarf_index_read_module() have completed (even if the update was
- * cancelled).
+ * This waits for all of the tasks in @ref
+ * drgn_dwarf_index_update_state::group (including those created by @ref
+ * drgn_dwarf_index_read_module()) to complete, even if the update was
+ * cancelled.
  *
  * If the update was not cancelled, this finishes indexing all modules reported
  * by @ref drgn_dwarf_index_read_module(). If it was cancelled or there is an
@@ -241,18 +297,14 @@ void drgn_dwarf_index_update_cancel(struct drgn_dwarf_index_update_state *state,
 static inline bool
 drgn_dwarf_index_update_cancelled(struct drgn_dwarf_index_update_state *state)
 {
-	/*
-	 * No need for omp critical/omp atomic since this is a best-effort
-	 * optimization.
-	 */
-	return state->err != NULL;
+	return drgn_task_group_cancelled(&state->group);
 }
 
 /**
  * Read a module for updating a @ref drgn_dwarf_index.
  *
- * This creates OpenMP tasks to begin indexing the module. It may cancel the
- * update.
+ * This creates tasks in @ref drgn_dwarf_index_update_state::group to begin
+ * indexing the module. It may cancel the update.
  */
 void drgn_dwarf_index_read_module(struct drgn_dwarf_index_update_state *state,
 				  struct drgn_debug_info_module *module);
@@ -276,6 +328,9 @@ struct drgn_dwarf_index_iterator {
 /**
  * Create an iterator over DIEs in a DWARF index namespace.
  *
+ * If a module was indexed with a profile that skipped the categories of names
+ * matching @p tags, those names are indexed first.
+ *
  * @param[out] it DWARF index iterator to initialize.
  * @param[in] ns DWARF index namespace.
  * @param[in] name Name of DIE to search for, or @c NULL for any name.
@@ -319,6 +374,20 @@ struct drgn_error *drgn_dwarf_index_get_die(struct drgn_dwarf_index_die *die,
 					    Dwarf_Die *die_ret,
 					    uint64_t *bias_ret);
 
+/**
+ * Get the type DIE of an indexed type unit.
+ *
+ * @param[in] dindex DWARF index.
+ * @param[in] signature Type signature, e.g., from a @c DW_FORM_ref_sig8
+ * attribute.
+ * @param[out] die_ret Returned DIE.
+ * @return @c NULL on success, &@ref drgn_not_found if no type unit with the
+ * given signature was indexed, non-@c NULL on other error.
+ */
+struct drgn_error *
+drgn_dwarf_index_find_type_unit(struct drgn_dwarf_index *dindex,
+				uint64_t signature, Dwarf_Die *die_ret);
+
 /** @} */
 
 #endif /* DRGN_DWARF_INDEX_H */
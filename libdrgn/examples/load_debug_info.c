@@ -71,7 +71,7 @@ int main(int argc, char **argv)
 	if (err)
 		goto out;
 
-	err = drgn_program_load_debug_info(prog, NULL, 0, true, true);
+	err = drgn_program_load_debug_info(prog, NULL, 0, true, true, NULL);
 
 out:;
 	int status;
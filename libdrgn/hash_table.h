@@ -172,6 +172,13 @@ size_t hash_table_size(struct hash_table *table);
  */
 void hash_table_clear(struct hash_table *table);
 
+/**
+ * Return the number of bytes allocated by a @ref hash_table.
+ *
+ * This does not include memory referenced by the entries.
+ */
+size_t hash_table_memory_usage(struct hash_table *table);
+
 /**
  * Reserve entries in a @ref hash_table.
  *
@@ -1053,6 +1060,21 @@ __attribute__((unused))								\
 static void table##_clear(struct table *table)					\
 {										\
 	table##_do_clear(table, false);						\
+}										\
+										\
+__attribute__((unused))								\
+static size_t table##_memory_usage(struct table *table)			\
+{										\
+	if (table->chunks == hash_table_empty_chunk)				\
+		return 0;							\
+	size_t chunk_count = table##_chunk_mask(table) + 1;			\
+	size_t capacity_scale = table##_chunk_capacity_scale(table->chunks);	\
+	size_t size = table##_chunk_alloc_size(chunk_count, capacity_scale);	\
+	if (table##_vector_policy) {						\
+		size += (table##_compute_capacity(chunk_count, capacity_scale) *\
+			 sizeof(table##_entry_type));				\
+	}									\
+	return size;								\
 }										\
 										\
 										\
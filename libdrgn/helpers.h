@@ -13,16 +13,47 @@
 #ifndef DRGN_HELPERS_H
 #define DRGN_HELPERS_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 struct drgn_object;
 struct drgn_program;
+struct drgn_stack_trace;
 
 struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
 					uint64_t pgtable, uint64_t virt_addr,
 					void *buf, size_t count);
 
+/*
+ * Translate a virtual address to a physical address with a page table. Also
+ * return the number of bytes from the address to the end of the page (or huge
+ * page) containing it.
+ */
+struct drgn_error *linux_helper_translate_vm(struct drgn_program *prog,
+					     uint64_t pgtable,
+					     uint64_t virt_addr,
+					     uint64_t *phys_addr_ret,
+					     uint64_t *size_ret);
+
+/*
+ * linux_helper_read_vm() caches address translations for programs that aren't
+ * live.
+ */
+struct linux_helper_translation_cache;
+
+void
+linux_helper_translation_cache_destroy(struct linux_helper_translation_cache *cache);
+
+/* Forget all cached translations. The cache may be NULL. */
+void
+linux_helper_translation_cache_flush(struct linux_helper_translation_cache *cache);
+
+/* Fill in the size and count of the cache, which may be NULL. */
+void
+linux_helper_translation_cache_memory_usage(struct linux_helper_translation_cache *cache,
+					    struct drgn_memory_usage *ret);
+
 struct drgn_error *
 linux_helper_radix_tree_lookup(struct drgn_object *res,
 			       const struct drgn_object *root, uint64_t index);
@@ -43,4 +74,448 @@ struct drgn_error *linux_helper_find_task(struct drgn_object *res,
 					  const struct drgn_object *ns,
 					  uint64_t pid);
 
+struct linux_helper_dentry_path_cache;
+
+void
+linux_helper_dentry_path_cache_destroy(struct linux_helper_dentry_path_cache *cache);
+
+/* Fill in the size, count, and evictions of the cache, which may be NULL. */
+void
+linux_helper_dentry_path_cache_memory_usage(struct linux_helper_dentry_path_cache *cache,
+					    struct drgn_memory_usage *ret);
+
+/*
+ * The returned paths are not null-terminated. They are valid until the next
+ * call to one of these helpers for the same program.
+ */
+
+struct drgn_error *linux_helper_d_path(struct drgn_program *prog,
+				       uint64_t vfsmnt, uint64_t dentry,
+				       const char **ret, size_t *len_ret);
+
+typedef struct drgn_error *linux_helper_d_path_fn(size_t i, const char *path,
+						  size_t len, void *arg);
+
+/* Like linux_helper_d_path(), but reuses cached paths across every call. */
+struct drgn_error *linux_helper_d_paths(struct drgn_program *prog,
+					const uint64_t *vfsmnts,
+					const uint64_t *dentries, size_t n,
+					linux_helper_d_path_fn *fn, void *arg);
+
+struct drgn_error *linux_helper_dentry_path(struct drgn_program *prog,
+					    uint64_t dentry, const char **ret,
+					    size_t *len_ret);
+
+/* Only files matching every non-zero field are reported. */
+struct linux_helper_file_filter {
+	/* struct inode * */
+	uint64_t inode;
+	/* struct super_block * */
+	uint64_t super_block;
+	/* const struct file_operations * */
+	uint64_t f_op;
+};
+
+typedef struct drgn_error *linux_helper_file_fn(uint64_t task, uint64_t fd,
+						uint64_t file, void *arg);
+
+/*
+ * Call fn for every open file of the given tasks, or of every thread if tasks
+ * is NULL. A files_struct shared by multiple tasks is only reported once, for
+ * the first task that uses it.
+ */
+struct drgn_error *
+linux_helper_for_each_task_file(struct drgn_program *prog,
+				const uint64_t *tasks, size_t num_tasks,
+				const struct linux_helper_file_filter *filter,
+				linux_helper_file_fn *fn, void *arg);
+
+typedef struct drgn_error *linux_helper_bpf_map_fn(const void *key,
+						   size_t key_size,
+						   const void *value,
+						   size_t value_size,
+						   void *arg);
+
+/* Reader for the entries of a BPF map. */
+struct linux_helper_bpf_map;
+
+/*
+ * Create a reader for a hash, array, per-CPU, or LRU BPF map. The map's layout,
+ * the type constants, and the possible CPUs are looked up once here. Per-CPU
+ * values are padded to 8 bytes and concatenated for each possible CPU, like
+ * BPF_MAP_LOOKUP_ELEM, unless sum_size is non-zero, in which case they are
+ * summed as arrays of unsigned integers of that size.
+ */
+struct drgn_error *linux_helper_bpf_map_create(struct drgn_program *prog,
+					       uint64_t map,
+					       unsigned int sum_size,
+					       struct linux_helper_bpf_map **ret);
+
+void linux_helper_bpf_map_destroy(struct linux_helper_bpf_map *it);
+
+/*
+ * Call fn for the entries in the next batch_size buckets or indices of a BPF
+ * map, or return &drgn_stop if there are no more.
+ */
+struct drgn_error *linux_helper_bpf_map_read(struct linux_helper_bpf_map *it,
+					     uint64_t batch_size,
+					     linux_helper_bpf_map_fn *fn,
+					     void *arg);
+
+/* Decoder for the ftrace ring buffer of a trace_array. */
+struct linux_helper_ftrace;
+
+/*
+ * Create an ftrace decoder for a struct trace_array *, or the global trace
+ * array if it is 0. Event formats are read once here.
+ */
+struct drgn_error *linux_helper_ftrace_create(struct drgn_program *prog,
+					      uint64_t trace_array,
+					      struct linux_helper_ftrace **ret);
+
+void linux_helper_ftrace_destroy(struct linux_helper_ftrace *ftrace);
+
+struct linux_helper_ftrace_event {
+	uint64_t cpu;
+	/* Raw ring buffer timestamp, usually in nanoseconds. */
+	uint64_t timestamp;
+	uint16_t type;
+	/* Event name, or NULL if the type is unknown. */
+	const char *name;
+	/* Raw event data, starting with the common fields. */
+	const void *data;
+	size_t size;
+};
+
+/*
+ * Get the next event from every CPU in timestamp order, or &drgn_stop if there
+ * are no more events. The event is valid until the next call.
+ */
+struct drgn_error *
+linux_helper_ftrace_next(struct linux_helper_ftrace *ftrace,
+			 const struct linux_helper_ftrace_event **ret);
+
+/*
+ * Format an event as a line of text (without a newline) similar to the trace
+ * file. The string is valid until the next call.
+ */
+struct drgn_error *
+linux_helper_ftrace_format(struct linux_helper_ftrace *ftrace,
+			   const struct linux_helper_ftrace_event *event,
+			   const char **ret, size_t *len_ret);
+
+typedef struct drgn_error *linux_helper_write_fn(const void *buf, size_t count,
+						 void *arg);
+
+/*
+ * Write the ring buffer in the trace.dat format of trace-cmd (version 6) to fn.
+ * This is independent of linux_helper_ftrace_next().
+ */
+struct drgn_error *
+linux_helper_ftrace_write_trace_dat(struct linux_helper_ftrace *ftrace,
+				    linux_helper_write_fn *fn, void *arg);
+
+enum linux_helper_lock_kind {
+	LINUX_HELPER_LOCK_NONE,
+	LINUX_HELPER_LOCK_MUTEX,
+	LINUX_HELPER_LOCK_RWSEM,
+	LINUX_HELPER_LOCK_COMPLETION,
+};
+
+struct linux_helper_blocked_task {
+	/* struct task_struct * */
+	uint64_t task;
+	/* Stack trace, or NULL if the task couldn't be unwound. */
+	struct drgn_stack_trace *trace;
+	/* Index of the frame that blocked on a lock, or SIZE_MAX. */
+	size_t frame;
+	enum linux_helper_lock_kind kind;
+	/* Address of the waiter on the task's stack, or 0 if not found. */
+	uint64_t waiter;
+	/* struct mutex *, struct rw_semaphore *, or struct completion *. */
+	uint64_t lock;
+	/* struct task_struct * holding the lock, or 0 if unknown. */
+	uint64_t owner;
+	/* Index of the owner in the graph if it is also blocked. */
+	size_t owner_index;
+	/*
+	 * Number of wait-for edges followed from this task through lock
+	 * owners, or the length of the cycle if the task is in one.
+	 */
+	size_t chain_length;
+	bool in_cycle;
+};
+
+struct linux_helper_wait_graph {
+	struct linux_helper_blocked_task *tasks;
+	size_t num_tasks;
+};
+
+/*
+ * Build the wait-for graph of tasks whose state is in state_mask (e.g.,
+ * TASK_UNINTERRUPTIBLE), finding the lock that each one is waiting for and the
+ * lock's owner.
+ */
+struct drgn_error *
+linux_helper_wait_graph_create(struct drgn_program *prog, uint64_t state_mask,
+			       struct linux_helper_wait_graph **ret);
+
+void linux_helper_wait_graph_destroy(struct linux_helper_wait_graph *graph);
+
+struct linux_helper_rq_cpu {
+	uint64_t cpu;
+	/* struct rq * */
+	uint64_t rq;
+	/* struct task_struct * */
+	uint64_t curr;
+	uint64_t clock;
+	uint64_t clock_task;
+	uint64_t nr_running;
+	uint64_t min_vruntime;
+};
+
+enum linux_helper_rq_queue {
+	/* Running on the CPU. */
+	LINUX_HELPER_RQ_CURRENT,
+	LINUX_HELPER_RQ_DEADLINE,
+	LINUX_HELPER_RQ_RT,
+	LINUX_HELPER_RQ_FAIR,
+};
+
+struct linux_helper_rq_task {
+	uint64_t cpu;
+	/* struct task_struct * */
+	uint64_t task;
+	enum linux_helper_rq_queue queue;
+	uint32_t policy;
+	int32_t prio;
+	uint64_t vruntime;
+	/* Only meaningful for SCHED_DEADLINE tasks. */
+	uint64_t deadline;
+	/* Total time spent on the CPU in nanoseconds. */
+	uint64_t sum_exec_runtime;
+};
+
+/*
+ * Runnable tasks of each possible CPU. For each CPU, the current task comes
+ * first, followed by the deadline, real-time, and fair queues in the order
+ * that the scheduler would pick from them.
+ */
+struct linux_helper_rq_snapshot {
+	struct linux_helper_rq_cpu *cpus;
+	size_t num_cpus;
+	struct linux_helper_rq_task *tasks;
+	size_t num_tasks;
+};
+
+struct drgn_error *
+linux_helper_rq_snapshot_create(struct drgn_program *prog,
+				struct linux_helper_rq_snapshot **ret);
+
+void linux_helper_rq_snapshot_destroy(struct linux_helper_rq_snapshot *snapshot);
+
+struct linux_helper_vmap_area {
+	/* struct vmap_area * */
+	uint64_t va;
+	uint64_t start;
+	/* Size of the address range, including any guard page. */
+	uint64_t size;
+	/*
+	 * struct vm_struct *, or 0 if the area doesn't have one, in which case
+	 * flags, caller, and nr_pages are also 0.
+	 */
+	uint64_t vm;
+	/* VM_* flags. */
+	uint64_t flags;
+	/* Address of the function that created the area. */
+	uint64_t caller;
+	/* Number of pages allocated by vmalloc(). */
+	uint64_t nr_pages;
+	/* Number of pages mapped in the page table, or UINT64_MAX. */
+	uint64_t mapped_pages;
+};
+
+/* Totals of the vmap areas created by one caller. */
+struct linux_helper_vmap_caller {
+	/* Address of the caller, or 0 for areas without a struct vm_struct. */
+	uint64_t caller;
+	size_t count;
+	uint64_t size;
+	uint64_t nr_pages;
+	/* Number of pages mapped in the page table, or UINT64_MAX. */
+	uint64_t mapped_pages;
+};
+
+/*
+ * Allocated vmap areas sorted by start address, and callers sorted by the
+ * total size of their areas, largest first.
+ */
+struct linux_helper_vmap_areas {
+	struct linux_helper_vmap_area *areas;
+	size_t num_areas;
+	struct linux_helper_vmap_caller *callers;
+	size_t num_callers;
+};
+
+/*
+ * Get all allocated vmap areas. If validate is true, the pages of each area
+ * that are actually mapped are counted by walking the kernel page table.
+ */
+struct drgn_error *
+linux_helper_vmap_areas_create(struct drgn_program *prog, bool validate,
+			       struct linux_helper_vmap_areas **ret);
+
+void linux_helper_vmap_areas_destroy(struct linux_helper_vmap_areas *areas);
+
+enum linux_helper_timer_kind {
+	/* struct timer_list in the timer wheel. */
+	LINUX_HELPER_TIMER_WHEEL,
+	/* struct hrtimer. */
+	LINUX_HELPER_TIMER_HRTIMER,
+};
+
+struct linux_helper_timer {
+	uint64_t cpu;
+	enum linux_helper_timer_kind kind;
+	/* Index in timer_bases or in hrtimer_cpu_base::clock_base. */
+	uint32_t base;
+	/* struct timer_list * or struct hrtimer * */
+	uint64_t timer;
+	/* In jiffies for the timer wheel and nanoseconds for hrtimers. */
+	uint64_t expires;
+	/* Address of the callback. */
+	uint64_t function;
+};
+
+/* Number of pending timers with one callback. */
+struct linux_helper_timer_callback {
+	uint64_t function;
+	size_t num_timers;
+	size_t num_hrtimers;
+};
+
+/*
+ * Pending timers sorted by CPU, kind, base, and expiration time, and callbacks
+ * sorted by the number of timers, most first.
+ */
+struct linux_helper_timers {
+	struct linux_helper_timer *timers;
+	size_t num_timers;
+	struct linux_helper_timer_callback *callbacks;
+	size_t num_callbacks;
+};
+
+/*
+ * Get the pending timers in the timer wheel and the hrtimer queues of every
+ * possible CPU.
+ */
+struct drgn_error *linux_helper_timers_create(struct drgn_program *prog,
+					      struct linux_helper_timers **ret);
+
+void linux_helper_timers_destroy(struct linux_helper_timers *timers);
+
+struct linux_helper_blk_mq_request {
+	/* Index of the queue in the array that was scanned. */
+	size_t queue;
+	/* struct blk_mq_hw_ctx * and its queue_num. */
+	uint64_t hctx;
+	uint32_t hctx_index;
+	/* struct request * */
+	uint64_t rq;
+	/* Driver tag, or -1 if the request hasn't been dispatched. */
+	int32_t tag;
+	/* I/O scheduler tag, or -1 without a scheduler. */
+	int32_t internal_tag;
+	/* REQ_OP_* */
+	uint32_t op;
+	uint64_t cmd_flags;
+	uint64_t sector;
+	/* Size in bytes. */
+	uint64_t size;
+	/* ktime_get_ns() when the request was allocated, or 0 if unknown. */
+	uint64_t start_time_ns;
+	/* enum mq_rq_state, or UINT32_MAX if unknown. */
+	uint32_t state;
+};
+
+/* Requests sorted by queue, hardware queue, and tag. */
+struct linux_helper_blk_mq_requests {
+	struct linux_helper_blk_mq_request *requests;
+	size_t num_requests;
+};
+
+/*
+ * Get the requests which have a driver or I/O scheduler tag allocated in each
+ * hardware queue of the given struct request_queue *s.
+ */
+struct drgn_error *
+linux_helper_blk_mq_requests_create(struct drgn_program *prog,
+				    const uint64_t *queues, size_t num_queues,
+				    struct linux_helper_blk_mq_requests **ret);
+
+void
+linux_helper_blk_mq_requests_destroy(struct linux_helper_blk_mq_requests *requests);
+
+enum linux_helper_page_kind {
+	LINUX_HELPER_PAGE_ANON,
+	LINUX_HELPER_PAGE_FILE,
+	LINUX_HELPER_PAGE_SLAB,
+	LINUX_HELPER_PAGE_UNEVICTABLE,
+	LINUX_HELPER_NUM_PAGE_KINDS,
+};
+
+struct linux_helper_memcg_usage {
+	/* struct mem_cgroup *, or 0 for pages not charged to a single memcg. */
+	uint64_t memcg;
+	uint64_t pages[LINUX_HELPER_NUM_PAGE_KINDS];
+};
+
+struct linux_helper_memcg_inode {
+	/* Index of the memcg in linux_helper_page_usage::memcgs. */
+	size_t memcg;
+	/* struct inode * */
+	uint64_t inode;
+	/* Number of page cache pages. */
+	uint64_t pages;
+};
+
+/*
+ * Pages by memcg sorted by total number of pages, most first, and the inodes
+ * with the most page cache pages in each memcg, grouped by memcg in the same
+ * order and sorted by number of pages.
+ */
+struct linux_helper_page_usage {
+	struct linux_helper_memcg_usage *memcgs;
+	size_t num_memcgs;
+	struct linux_helper_memcg_inode *inodes;
+	size_t num_inodes;
+};
+
+/*
+ * Count the pages in a range of PFNs by memcg and kind, where vmemmap is the
+ * address of the struct page of PFN 0. Pages which are neither slab pages nor
+ * on an LRU list (e.g., free pages) aren't counted. At most max_inodes inodes
+ * are returned per memcg.
+ */
+struct drgn_error *
+linux_helper_page_usage_create(struct drgn_program *prog, uint64_t vmemmap,
+			       uint64_t start_pfn, uint64_t end_pfn,
+			       size_t max_inodes,
+			       struct linux_helper_page_usage **ret);
+
+void linux_helper_page_usage_destroy(struct linux_helper_page_usage *usage);
+
+/*
+ * Get the LRU list sizes of the first num_nodes NUMA nodes of each given
+ * struct mem_cgroup *, summed over zones. The returned array has
+ * num_memcgs * num_nodes * *num_lrus_ret entries indexed by memcg, node, and
+ * enum lru_list, and must be freed with free().
+ */
+struct drgn_error *linux_helper_memcg_lru_sizes(struct drgn_program *prog,
+						const uint64_t *memcgs,
+						size_t num_memcgs,
+						uint64_t num_nodes,
+						uint64_t **ret,
+						size_t *num_lrus_ret);
+
 #endif /* DRGN_HELPERS_H */
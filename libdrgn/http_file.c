@@ -0,0 +1,354 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <curl/curl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "http_file.h"
+#include "minmax.h"
+#include "util.h"
+
+/* Minimum number of bytes in each range fetched in parallel. */
+#define DRGN_HTTP_FILE_MIN_PART (256 * 1024)
+/* Seconds to wait for a connection to be established. */
+#define DRGN_HTTP_FILE_CONNECT_TIMEOUT 30L
+/*
+ * A transfer slower than this many bytes per second for this many seconds is
+ * considered stalled and aborted.
+ */
+#define DRGN_HTTP_FILE_LOW_SPEED_LIMIT 1L
+#define DRGN_HTTP_FILE_LOW_SPEED_TIME 60L
+
+/* One range request of a read. */
+struct drgn_http_part {
+	CURL *curl;
+	/* Current position in the destination of the request. */
+	const struct iovec *iov;
+	size_t iov_offset;
+	/* Offset of the range in the file. */
+	uint64_t start;
+	/* Number of bytes requested and not received yet. */
+	size_t requested;
+	size_t remaining;
+	CURLcode result;
+	bool done;
+	/* Response code, once it was checked. */
+	long code;
+	/* The server didn't return a partial response. */
+	bool not_partial;
+	/* The server returned more data than requested. */
+	bool overflow;
+	char range[64];
+	char error[CURL_ERROR_SIZE];
+};
+
+struct drgn_http_file {
+	struct drgn_block_source source;
+	char *url;
+	CURLM *multi;
+	struct drgn_http_part parts[DRGN_HTTP_FILE_MAX_CONNECTIONS];
+};
+
+static pthread_once_t curl_init_once = PTHREAD_ONCE_INIT;
+static CURLcode curl_init_result;
+
+static void drgn_curl_init(void)
+{
+	curl_init_result = curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+/* Advance an iovec position by @p n bytes. */
+static void iov_advance(const struct iovec **iov, size_t *iov_offset, size_t n)
+{
+	while (n) {
+		size_t len = min(n, (*iov)->iov_len - *iov_offset);
+		*iov_offset += len;
+		n -= len;
+		if (*iov_offset == (*iov)->iov_len) {
+			(*iov)++;
+			*iov_offset = 0;
+		}
+	}
+}
+
+/*
+ * Servers may return the whole file instead of a range that covers all of it,
+ * so a complete response is also allowed for a range starting at 0 (if the
+ * file is bigger than the range, the response overflows and is rejected).
+ */
+static bool is_partial_response(struct drgn_http_part *part, long code)
+{
+	return code == 206 || (code == 200 && part->start == 0);
+}
+
+static size_t drgn_http_part_write(char *ptr, size_t size, size_t nmemb,
+				   void *userdata)
+{
+	struct drgn_http_part *part = userdata;
+	size_t len = size * nmemb;
+
+	if (!part->code) {
+		/*
+		 * A server that doesn't support range requests returns the
+		 * whole file, which we don't want to download.
+		 */
+		curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE,
+				  &part->code);
+		if (!is_partial_response(part, part->code)) {
+			part->not_partial = true;
+			return 0;
+		}
+	}
+	if (len > part->remaining) {
+		if (part->code == 200)
+			part->not_partial = true;
+		else
+			part->overflow = true;
+		return 0;
+	}
+	size_t done = 0;
+	while (done < len) {
+		size_t n = min(len - done,
+			       part->iov->iov_len - part->iov_offset);
+		memcpy((char *)part->iov->iov_base + part->iov_offset,
+		       ptr + done, n);
+		iov_advance(&part->iov, &part->iov_offset, n);
+		done += n;
+	}
+	part->remaining -= len;
+	return len;
+}
+
+/*
+ * Get the number of bytes received for a finished request, which is short if
+ * the end of the file was reached.
+ */
+static struct drgn_error *drgn_http_part_finish(struct drgn_http_file *file,
+						struct drgn_http_part *part,
+						size_t *ret)
+{
+	long code = 0;
+	curl_easy_getinfo(part->curl, CURLINFO_RESPONSE_CODE, &code);
+	if (part->result == CURLE_HTTP_RETURNED_ERROR && code == 416) {
+		/* The range starts past the end of the file. */
+		*ret = 0;
+		return NULL;
+	}
+	if (part->not_partial ||
+	    (part->result == CURLE_OK && !is_partial_response(part, code))) {
+		return drgn_error_format(DRGN_ERROR_OTHER,
+					 "%s: server does not support range requests",
+					 file->url);
+	}
+	if (part->overflow) {
+		return drgn_error_format(DRGN_ERROR_OTHER,
+					 "%s: server returned more data than requested",
+					 file->url);
+	}
+	if (part->result == CURLE_HTTP_RETURNED_ERROR) {
+		return drgn_error_format(DRGN_ERROR_OTHER, "%s: HTTP error %ld",
+					 file->url, code);
+	}
+	if (part->result == CURLE_OPERATION_TIMEDOUT) {
+		/* Like an I/O error, this is a fault at the unread offset. */
+		return drgn_error_format_fault(part->start + part->requested -
+					       part->remaining,
+					       "%s: %s", file->url,
+					       part->error[0] ?
+					       part->error :
+					       curl_easy_strerror(part->result));
+	}
+	if (part->result != CURLE_OK) {
+		return drgn_error_format(DRGN_ERROR_OTHER, "%s: %s", file->url,
+					 part->error[0] ?
+					 part->error :
+					 curl_easy_strerror(part->result));
+	}
+	*ret = part->requested - part->remaining;
+	return NULL;
+}
+
+static struct drgn_error *drgn_http_file_read(struct drgn_block_source *source,
+					      const struct iovec *iov,
+					      int iovcnt, uint64_t offset,
+					      size_t *ret)
+{
+	struct drgn_error *err = NULL;
+	struct drgn_http_file *file =
+		container_of(source, struct drgn_http_file, source);
+
+	size_t total = 0;
+	for (int i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+	if (!total) {
+		*ret = 0;
+		return NULL;
+	}
+
+	/* Split the read into ranges of roughly equal size. */
+	size_t num_parts = min(total / DRGN_HTTP_FILE_MIN_PART,
+			       (size_t)DRGN_HTTP_FILE_MAX_CONNECTIONS);
+	if (!num_parts)
+		num_parts = 1;
+	size_t part_size = (total + num_parts - 1) / num_parts;
+	const struct iovec *cur_iov = iov;
+	size_t cur_iov_offset = 0;
+	size_t num_added = 0;
+	for (size_t i = 0; i < num_parts; i++) {
+		struct drgn_http_part *part = &file->parts[i];
+		size_t start = i * part_size;
+		size_t len = min(part_size, total - start);
+		part->iov = cur_iov;
+		part->iov_offset = cur_iov_offset;
+		part->start = offset + start;
+		part->requested = part->remaining = len;
+		part->result = CURLE_OK;
+		part->code = 0;
+		part->done = false;
+		part->not_partial = part->overflow = false;
+		part->error[0] = '\0';
+		snprintf(part->range, sizeof(part->range),
+			 "%" PRIu64 "-%" PRIu64, part->start,
+			 part->start + len - 1);
+		curl_easy_setopt(part->curl, CURLOPT_RANGE, part->range);
+		if (curl_multi_add_handle(file->multi, part->curl)) {
+			err = &drgn_enomem;
+			goto out;
+		}
+		num_added++;
+		iov_advance(&cur_iov, &cur_iov_offset, len);
+	}
+
+	int running;
+	do {
+		CURLMcode mc = curl_multi_perform(file->multi, &running);
+		if (mc == CURLM_OK && running) {
+			mc = curl_multi_wait(file->multi, NULL, 0, 1000,
+					     NULL);
+		}
+		if (mc != CURLM_OK) {
+			err = drgn_error_format(DRGN_ERROR_OTHER, "%s: %s",
+						file->url,
+						curl_multi_strerror(mc));
+			goto out;
+		}
+	} while (running);
+
+	CURLMsg *msg;
+	int msgs_left;
+	while ((msg = curl_multi_info_read(file->multi, &msgs_left))) {
+		if (msg->msg != CURLMSG_DONE)
+			continue;
+		for (size_t i = 0; i < num_parts; i++) {
+			if (file->parts[i].curl == msg->easy_handle) {
+				file->parts[i].result = msg->data.result;
+				file->parts[i].done = true;
+				break;
+			}
+		}
+	}
+
+	/* The data is only usable up to the first short range. */
+	size_t done = 0;
+	for (size_t i = 0; i < num_parts; i++) {
+		struct drgn_http_part *part = &file->parts[i];
+		if (!part->done) {
+			err = drgn_error_format(DRGN_ERROR_OTHER,
+						"%s: request did not finish",
+						file->url);
+			goto out;
+		}
+		size_t n;
+		err = drgn_http_part_finish(file, part, &n);
+		if (err)
+			goto out;
+		done += n;
+		if (n < part->requested)
+			break;
+	}
+	*ret = done;
+
+out:
+	for (size_t i = 0; i < num_added; i++)
+		curl_multi_remove_handle(file->multi, file->parts[i].curl);
+	return err;
+}
+
+static void drgn_http_file_destroy(struct drgn_block_source *source)
+{
+	struct drgn_http_file *file =
+		container_of(source, struct drgn_http_file, source);
+	for (size_t i = 0; i < DRGN_HTTP_FILE_MAX_CONNECTIONS; i++)
+		curl_easy_cleanup(file->parts[i].curl);
+	curl_multi_cleanup(file->multi);
+	free(file->url);
+	free(file);
+}
+
+struct drgn_error *drgn_http_file_open(const char *url,
+				       struct drgn_block_source **ret)
+{
+	struct drgn_error *err;
+
+	pthread_once(&curl_init_once, drgn_curl_init);
+	if (curl_init_result != CURLE_OK) {
+		return drgn_error_format(DRGN_ERROR_OTHER,
+					 "curl_global_init: %s",
+					 curl_easy_strerror(curl_init_result));
+	}
+
+	struct drgn_http_file *file = calloc(1, sizeof(*file));
+	if (!file)
+		return &drgn_enomem;
+	file->source.read = drgn_http_file_read;
+	file->source.destroy = drgn_http_file_destroy;
+	file->url = strdup(url);
+	file->multi = curl_multi_init();
+	if (!file->url || !file->multi) {
+		err = &drgn_enomem;
+		goto err;
+	}
+	for (size_t i = 0; i < DRGN_HTTP_FILE_MAX_CONNECTIONS; i++) {
+		struct drgn_http_part *part = &file->parts[i];
+		part->curl = curl_easy_init();
+		if (!part->curl ||
+		    curl_easy_setopt(part->curl, CURLOPT_URL, url) !=
+		    CURLE_OK) {
+			err = &drgn_enomem;
+			goto err;
+		}
+		curl_easy_setopt(part->curl, CURLOPT_WRITEFUNCTION,
+				 drgn_http_part_write);
+		curl_easy_setopt(part->curl, CURLOPT_WRITEDATA, part);
+		curl_easy_setopt(part->curl, CURLOPT_ERRORBUFFER, part->error);
+		curl_easy_setopt(part->curl, CURLOPT_FAILONERROR, 1L);
+		curl_easy_setopt(part->curl, CURLOPT_FOLLOWLOCATION, 1L);
+		curl_easy_setopt(part->curl, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(part->curl, CURLOPT_CONNECTTIMEOUT,
+				 DRGN_HTTP_FILE_CONNECT_TIMEOUT);
+		curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_LIMIT,
+				 DRGN_HTTP_FILE_LOW_SPEED_LIMIT);
+		curl_easy_setopt(part->curl, CURLOPT_LOW_SPEED_TIME,
+				 DRGN_HTTP_FILE_LOW_SPEED_TIME);
+		curl_easy_setopt(part->curl, CURLOPT_USERAGENT, "drgn");
+	}
+
+	/* Fail early if the file doesn't exist or can't be read by range. */
+	char c;
+	size_t n;
+	err = drgn_http_file_read(&file->source,
+				  &(struct iovec){ .iov_base = &c, .iov_len = 1 },
+				  1, 0, &n);
+	if (err)
+		goto err;
+
+	*ret = &file->source;
+	return NULL;
+
+err:
+	drgn_http_file_destroy(&file->source);
+	return err;
+}
@@ -0,0 +1,75 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+/**
+ * @file
+ *
+ * Files read over HTTP.
+ *
+ * See @ref HttpFile.
+ */
+
+#ifndef DRGN_HTTP_FILE_H
+#define DRGN_HTTP_FILE_H
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "block_cache.h"
+#include "error.h"
+
+/**
+ * @ingroup Internals
+ *
+ * @defgroup HttpFile HTTP files
+ *
+ * Remote files read with HTTP range requests.
+ *
+ * An HTTP file is a @ref drgn_block_source, so it is always read through a
+ * @ref drgn_block_cache, which coalesces misses into large contiguous reads and
+ * reads ahead of sequential scans. Each read is split into several ranges
+ * that are fetched in parallel over persistent connections, which hides most
+ * of the latency of a distant server.
+ *
+ * HTTP files are implemented with libcurl, so they also support HTTPS.
+ * Connecting and stalled transfers time out, which is reported as a @ref
+ * DRGN_ERROR_FAULT rather than hanging forever.
+ *
+ * @{
+ */
+
+/** Maximum number of ranges fetched in parallel from an HTTP file. */
+#define DRGN_HTTP_FILE_MAX_CONNECTIONS 8
+
+/** Return whether a path is an HTTP or HTTPS URL. */
+static inline bool drgn_is_http_url(const char *path)
+{
+	return (strncmp(path, "http://", sizeof("http://") - 1) == 0 ||
+		strncmp(path, "https://", sizeof("https://") - 1) == 0);
+}
+
+#ifdef WITH_LIBCURL
+/**
+ * Open a file on an HTTP server.
+ *
+ * This fails if the file doesn't exist or the server doesn't support range
+ * requests.
+ *
+ * @param[in] url HTTP or HTTPS URL of the file.
+ * @param[out] ret Returned source for @ref
+ * drgn_block_cache_create_from_source().
+ */
+struct drgn_error *drgn_http_file_open(const char *url,
+				       struct drgn_block_source **ret);
+#else
+static inline struct drgn_error *
+drgn_http_file_open(const char *url, struct drgn_block_source **ret)
+{
+	return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+				 "drgn was built without libcurl support");
+}
+#endif
+
+/** @} */
+
+#endif /* DRGN_HTTP_FILE_H */
@@ -2589,7 +2589,7 @@ struct drgn_error *c_bit_offset(struct drgn_program *prog,
 		case INT_MIN:
 		case C_TOKEN_DOT:
 			if (token.kind == C_TOKEN_IDENTIFIER) {
-				struct drgn_member_value *member;
+				struct drgn_member_value member;
 				struct drgn_qualified_type member_type;
 
 				err = drgn_program_find_member(prog, type,
@@ -2599,13 +2599,13 @@ struct drgn_error *c_bit_offset(struct drgn_program *prog,
 				if (err)
 					goto out;
 				if (__builtin_add_overflow(bit_offset,
-							   member->bit_offset,
+							   member.bit_offset,
 							   &bit_offset)) {
 					err = drgn_error_create(DRGN_ERROR_OVERFLOW,
 								"offset is too large");
 					goto out;
 				}
-				err = drgn_lazy_type_evaluate(member->type,
+				err = drgn_lazy_type_evaluate(member.type,
 							      &member_type);
 				if (err)
 					goto out;
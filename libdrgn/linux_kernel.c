@@ -79,6 +79,7 @@ struct drgn_error *parse_vmcoreinfo(const char *desc, size_t descsz,
 	ret->osrelease[0] = '\0';
 	ret->page_size = 0;
 	ret->kaslr_offset = 0;
+	ret->phys_base = 0;
 	ret->pgtable_l5_enabled = false;
 	while (line < end) {
 		const char *newline;
@@ -109,6 +110,10 @@ struct drgn_error *parse_vmcoreinfo(const char *desc, size_t descsz,
 					  &ret->swapper_pg_dir);
 			if (err)
 				return err;
+		} else if (linematch(&line, "NUMBER(phys_base)=")) {
+			err = line_to_u64(line, newline, 0, &ret->phys_base);
+			if (err)
+				return err;
 		} else if (linematch(&line, "NUMBER(pgtable_l5_enabled)=")) {
 			uint64_t tmp;
 
@@ -131,7 +136,7 @@ struct drgn_error *parse_vmcoreinfo(const char *desc, size_t descsz,
 		return drgn_error_create(DRGN_ERROR_OTHER,
 					 "VMCOREINFO does not contain valid swapper_pg_dir");
 	}
-	/* KERNELOFFSET and pgtable_l5_enabled are optional. */
+	/* KERNELOFFSET, phys_base, and pgtable_l5_enabled are optional. */
 	return NULL;
 }
 
@@ -1,25 +1,27 @@
 // Copyright (c) Facebook, Inc. and its affiliates.
 // SPDX-License-Identifier: GPL-3.0+
 
+#include <byteswap.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <inttypes.h>
 
 #include "drgn.h"
+#include "error.h"
+#include "hash_table.h"
+#include "helpers.h"
 #include "minmax.h"
 #include "platform.h"
 #include "program.h"
+#include "string_builder.h"
+#include "thread_pool.h"
+#include "util.h"
+#include "vector.h"
 
-struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
-					uint64_t pgtable, uint64_t virt_addr,
-					void *buf, size_t count)
+static struct drgn_error *kernel_pgtable_check(struct drgn_program *prog)
 {
-	struct drgn_error *err;
-	struct pgtable_iterator *it;
-	pgtable_iterator_next_fn *next;
-	uint64_t read_addr = 0;
-	size_t read_size = 0;
-
 	if (!(prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL)) {
 		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
 					 "virtual address translation is only available for the Linux kernel");
@@ -33,9 +35,18 @@ struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
 					 "virtual address translation is not implemented for %s architecture",
 					 prog->platform.arch->name);
 	}
+	return NULL;
+}
 
-	if (!count)
-		return NULL;
+/*
+ * Start translating virt_addr with the program's page table iterator. The
+ * caller must set prog->pgtable_it_in_use to false when it is done.
+ */
+static struct drgn_error *
+kernel_pgtable_iterator_begin(struct drgn_program *prog, uint64_t pgtable,
+			      uint64_t virt_addr, struct pgtable_iterator **ret)
+{
+	struct pgtable_iterator *it;
 
 	if (prog->pgtable_it_in_use) {
 		return drgn_error_create_fault("recursive address translation; "
@@ -57,22 +68,192 @@ struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
 	it->virt_addr = virt_addr;
 	prog->pgtable_it_in_use = true;
 	prog->platform.arch->pgtable_iterator_arch_init(it->arch);
+	*ret = it;
+	return NULL;
+}
+
+/* log2 of the number of entries in a translation cache. */
+#define TRANSLATION_CACHE_BITS 10
+
+/* A virtual address range that a page table maps to contiguous memory. */
+struct translation_cache_entry {
+	uint64_t pgtable;
+	uint64_t virt_addr;
+	/* Size of the range, or 0 if the entry is empty. */
+	uint64_t size;
+	uint64_t phys_addr;
+};
+
+/*
+ * Cache of recent address translations. Entries are direct-mapped by page
+ * table and virtual page, and pages of different sizes (e.g., 4 KB pages and 2
+ * MB huge pages) are indexed with their own page number.
+ */
+struct linux_helper_translation_cache {
+	/* Bit i is set if a range of size 2^i was cached. */
+	uint64_t shifts;
+	struct translation_cache_entry entries[1 << TRANSLATION_CACHE_BITS];
+};
+
+void
+linux_helper_translation_cache_destroy(struct linux_helper_translation_cache *cache)
+{
+	free(cache);
+}
+
+void
+linux_helper_translation_cache_flush(struct linux_helper_translation_cache *cache)
+{
+	if (cache)
+		memset(cache, 0, sizeof(*cache));
+}
+
+void
+linux_helper_translation_cache_memory_usage(struct linux_helper_translation_cache *cache,
+					    struct drgn_memory_usage *ret)
+{
+	ret->size = ret->count = ret->evictions = 0;
+	if (!cache)
+		return;
+	ret->size = sizeof(*cache);
+	for (size_t i = 0; i < ARRAY_SIZE(cache->entries); i++) {
+		if (cache->entries[i].size)
+			ret->count++;
+	}
+}
+
+static inline size_t translation_cache_index(uint64_t pgtable,
+					     uint64_t virt_addr, int shift)
+{
+	uint64_t key = (virt_addr >> shift) ^ (pgtable >> 12) ^
+		       ((uint64_t)shift << 56);
+	return (key * UINT64_C(0x9e3779b97f4a7c15)) >>
+	       (64 - TRANSLATION_CACHE_BITS);
+}
+
+static struct translation_cache_entry *
+translation_cache_lookup(struct linux_helper_translation_cache *cache,
+			 uint64_t pgtable, uint64_t virt_addr)
+{
+	for (uint64_t shifts = cache->shifts; shifts; shifts &= shifts - 1) {
+		int shift = __builtin_ctzll(shifts);
+		struct translation_cache_entry *entry =
+			&cache->entries[translation_cache_index(pgtable,
+								virt_addr,
+								shift)];
+		if (entry->size && entry->pgtable == pgtable &&
+		    virt_addr - entry->virt_addr < entry->size)
+			return entry;
+	}
+	return NULL;
+}
+
+static void
+translation_cache_insert(struct linux_helper_translation_cache *cache,
+			 uint64_t pgtable, uint64_t virt_addr, uint64_t size,
+			 uint64_t phys_addr)
+{
+	/* Only aligned, power-of-two sized ranges can be found again. */
+	if (!size || (size & (size - 1)) || (virt_addr & (size - 1)))
+		return;
+	int shift = __builtin_ctzll(size);
+	struct translation_cache_entry *entry =
+		&cache->entries[translation_cache_index(pgtable, virt_addr,
+							shift)];
+	entry->pgtable = pgtable;
+	entry->virt_addr = virt_addr;
+	entry->size = size;
+	entry->phys_addr = phys_addr;
+	cache->shifts |= UINT64_C(1) << shift;
+}
+
+/*
+ * Get the translation cache of a program, or NULL if translations can't be
+ * cached because the page tables of a live kernel or running guest may change
+ * at any time.
+ */
+static struct drgn_error *
+translation_cache_get(struct drgn_program *prog,
+		      struct linux_helper_translation_cache **ret)
+{
+	if (drgn_program_memory_may_change(prog)) {
+		*ret = NULL;
+		return NULL;
+	}
+	if (!prog->translation_cache) {
+		prog->translation_cache =
+			calloc(1, sizeof(*prog->translation_cache));
+		if (!prog->translation_cache)
+			return &drgn_enomem;
+	}
+	*ret = prog->translation_cache;
+	return NULL;
+}
+
+struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
+					uint64_t pgtable, uint64_t virt_addr,
+					void *buf, size_t count)
+{
+	struct drgn_error *err;
+	struct pgtable_iterator *it = NULL;
+	pgtable_iterator_next_fn *next;
+	struct linux_helper_translation_cache *cache;
+	uint64_t read_addr = 0;
+	size_t read_size = 0;
+
+	err = kernel_pgtable_check(prog);
+	if (err)
+		return err;
+
+	if (!count)
+		return NULL;
+
+	err = translation_cache_get(prog, &cache);
+	if (err)
+		return err;
 	next = prog->platform.arch->linux_kernel_pgtable_iterator_next;
 	do {
-		uint64_t virt_addr, start_virt_addr, end_virt_addr;
+		uint64_t start_virt_addr, end_virt_addr;
 		uint64_t start_phys_addr, end_phys_addr;
 		size_t n;
 
-		virt_addr = it->virt_addr;
-		err = next(it, &start_virt_addr, &start_phys_addr);
-		if (err)
-			break;
-		if (start_phys_addr == UINT64_MAX) {
-			err = drgn_error_create_fault("address is not mapped",
-						      virt_addr);
-			break;
+		struct translation_cache_entry *entry =
+			cache ? translation_cache_lookup(cache, pgtable,
+							 virt_addr) : NULL;
+		if (entry) {
+			start_virt_addr = entry->virt_addr;
+			start_phys_addr = entry->phys_addr;
+			end_virt_addr = entry->virt_addr + entry->size;
+		} else {
+			if (!it) {
+				err = kernel_pgtable_iterator_begin(prog,
+								    pgtable,
+								    virt_addr,
+								    &it);
+				if (err)
+					return err;
+			} else if (it->virt_addr != virt_addr) {
+				/* Cache hits skipped ahead of the iterator. */
+				it->virt_addr = virt_addr;
+				prog->platform.arch->pgtable_iterator_arch_init(it->arch);
+			}
+			err = next(it, &start_virt_addr, &start_phys_addr);
+			if (err)
+				break;
+			if (start_phys_addr == UINT64_MAX) {
+				err = drgn_error_create_fault("address is not mapped",
+							      virt_addr);
+				break;
+			}
+			end_virt_addr = it->virt_addr;
+			if (cache) {
+				translation_cache_insert(cache, pgtable,
+							 start_virt_addr,
+							 end_virt_addr -
+							 start_virt_addr,
+							 start_phys_addr);
+			}
 		}
-		end_virt_addr = it->virt_addr;
 		end_phys_addr = start_phys_addr + (end_virt_addr - start_virt_addr);
 		n = min(end_virt_addr - virt_addr, (uint64_t)count);
 		if (read_size && end_phys_addr == read_addr + read_size) {
@@ -89,16 +270,70 @@ struct drgn_error *linux_helper_read_vm(struct drgn_program *prog,
 			read_addr = start_phys_addr + (virt_addr - start_virt_addr);
 			read_size = n;
 		}
+		virt_addr += n;
 		count -= n;
 	} while (count);
 	if (!err) {
 		err = drgn_program_read_memory(prog, buf, read_addr, read_size,
 					       true);
 	}
-	prog->pgtable_it_in_use = false;
+	if (it)
+		prog->pgtable_it_in_use = false;
 	return err;
 }
 
+struct drgn_error *linux_helper_translate_vm(struct drgn_program *prog,
+					     uint64_t pgtable,
+					     uint64_t virt_addr,
+					     uint64_t *phys_addr_ret,
+					     uint64_t *size_ret)
+{
+	struct drgn_error *err;
+	struct linux_helper_translation_cache *cache;
+	uint64_t start_virt_addr, end_virt_addr, start_phys_addr;
+
+	err = kernel_pgtable_check(prog);
+	if (err)
+		return err;
+	err = translation_cache_get(prog, &cache);
+	if (err)
+		return err;
+
+	struct translation_cache_entry *entry =
+		cache ? translation_cache_lookup(cache, pgtable, virt_addr) : NULL;
+	if (entry) {
+		start_virt_addr = entry->virt_addr;
+		start_phys_addr = entry->phys_addr;
+		end_virt_addr = entry->virt_addr + entry->size;
+	} else {
+		struct pgtable_iterator *it;
+		err = kernel_pgtable_iterator_begin(prog, pgtable, virt_addr,
+						    &it);
+		if (err)
+			return err;
+		err = prog->platform.arch->linux_kernel_pgtable_iterator_next(it,
+									     &start_virt_addr,
+									     &start_phys_addr);
+		end_virt_addr = it->virt_addr;
+		prog->pgtable_it_in_use = false;
+		if (err)
+			return err;
+		if (start_phys_addr == UINT64_MAX) {
+			return drgn_error_create_fault("address is not mapped",
+						       virt_addr);
+		}
+		if (cache) {
+			translation_cache_insert(cache, pgtable,
+						 start_virt_addr,
+						 end_virt_addr - start_virt_addr,
+						 start_phys_addr);
+		}
+	}
+	*phys_addr_ret = start_phys_addr + (virt_addr - start_virt_addr);
+	*size_ret = end_virt_addr - virt_addr;
+	return NULL;
+}
+
 struct drgn_error *
 linux_helper_radix_tree_lookup(struct drgn_object *res,
 			       const struct drgn_object *root, uint64_t index)
@@ -510,3 +745,7098 @@ out:
 	drgn_object_deinit(&pid_obj);
 	return err;
 }
+
+/* Offset and size of a structure member in bytes. */
+struct kernel_field {
+	uint64_t offset;
+	uint64_t size;
+};
+
+static struct drgn_error *
+kernel_member_info(struct drgn_program *prog, const char *type_name,
+		   const char *member_name, struct drgn_member_info *ret)
+{
+	struct drgn_error *err;
+	struct drgn_qualified_type qualified_type;
+	err = drgn_program_find_type(prog, type_name, NULL, &qualified_type);
+	if (err)
+		return err;
+	return drgn_program_member_info(prog, qualified_type.type, member_name,
+					ret);
+}
+
+static struct drgn_error *kernel_member_offset(struct drgn_program *prog,
+					       const char *type_name,
+					       const char *member_name,
+					       uint64_t *ret)
+{
+	struct drgn_member_info member;
+	struct drgn_error *err = kernel_member_info(prog, type_name,
+						    member_name, &member);
+	if (err)
+		return err;
+	*ret = member.bit_offset / 8;
+	return NULL;
+}
+
+/*
+ * Get the offset of the struct rb_root in a tree member, which is an
+ * rb_root_cached since Linux 4.14.
+ */
+static struct drgn_error *kernel_rb_root_offset(struct drgn_program *prog,
+						const char *type_name,
+						const char *member_name,
+						uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_member_info member;
+	err = kernel_member_info(prog, type_name, member_name, &member);
+	if (err)
+		return err;
+	*ret = member.bit_offset / 8;
+	struct drgn_type *type = member.qualified_type.type;
+	const char *tag = drgn_type_tag(type);
+	if (tag && strcmp(tag, "rb_root_cached") == 0) {
+		struct drgn_member_info root;
+		err = drgn_program_member_info(prog, type, "rb_root", &root);
+		if (err)
+			return err;
+		*ret += root.bit_offset / 8;
+	}
+	return NULL;
+}
+
+/* Find a pointer or integer member which is read from memory. */
+static struct drgn_error *
+kernel_find_field(struct drgn_program *prog, const char *type_name,
+		  const char *member_name, struct kernel_field *ret)
+{
+	struct drgn_error *err;
+	struct drgn_member_info member;
+	err = kernel_member_info(prog, type_name, member_name, &member);
+	if (err)
+		return err;
+	err = drgn_type_sizeof(member.qualified_type.type, &ret->size);
+	if (err)
+		return err;
+	if (member.bit_offset % 8 || member.bit_field_size ||
+	    (ret->size != 1 && ret->size != 2 && ret->size != 4 &&
+	     ret->size != 8)) {
+		return drgn_error_format(DRGN_ERROR_TYPE,
+					 "unsupported %s member %s", type_name,
+					 member_name);
+	}
+	ret->offset = member.bit_offset / 8;
+	return NULL;
+}
+
+/* Find an optional member, leaving the size 0 if it doesn't exist. */
+static struct drgn_error *
+kernel_find_optional_field(struct drgn_program *prog, const char *type_name,
+			   const char *member_name, struct kernel_field *ret)
+{
+	struct drgn_error *err = kernel_find_field(prog, type_name,
+						   member_name, ret);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		*ret = (struct kernel_field){};
+		return NULL;
+	}
+	return err;
+}
+
+/* Get the value of an optional constant, or UINT64_MAX if it is missing. */
+static struct drgn_error *kernel_optional_constant(struct drgn_program *prog,
+						   const char *name,
+						   uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_object obj;
+	union drgn_value value;
+
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, name, NULL,
+				       DRGN_FIND_OBJECT_CONSTANT, &obj);
+	if (!err)
+		err = drgn_object_read_integer(&obj, &value);
+	if (!err) {
+		*ret = value.uvalue;
+	} else if (err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = NULL;
+		*ret = UINT64_MAX;
+	}
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+/*
+ * Compute the range of bytes covering all of the given fields. Missing optional
+ * fields are ignored.
+ */
+static void kernel_field_span(const struct kernel_field *fields,
+			      size_t num_fields, uint64_t *start_ret,
+			      uint64_t *size_ret)
+{
+	uint64_t start = UINT64_MAX, end = 0;
+	for (size_t i = 0; i < num_fields; i++) {
+		if (!fields[i].size)
+			continue;
+		start = min(start, fields[i].offset);
+		end = max(end, fields[i].offset + fields[i].size);
+	}
+	*start_ret = start;
+	*size_ret = end - start;
+}
+
+/*
+ * Get a field from a buffer read starting at span_start, or 0 if it is a
+ * missing optional field.
+ */
+static uint64_t kernel_field_get(const char *buf, uint64_t span_start,
+				 struct kernel_field field, bool bswap)
+{
+	const char *p = buf + (field.offset - span_start);
+	switch (field.size) {
+	case 0:
+		return 0;
+	case 1:
+		return *(const uint8_t *)p;
+	case 2: {
+		uint16_t value;
+		memcpy(&value, p, sizeof(value));
+		return bswap ? bswap_16(value) : value;
+	}
+	case 4: {
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+		return bswap ? bswap_32(value) : value;
+	}
+	default: {
+		uint64_t value;
+		memcpy(&value, p, sizeof(value));
+		return bswap ? bswap_64(value) : value;
+	}
+	}
+}
+
+static struct drgn_error *kernel_read_field(struct drgn_program *prog,
+					    bool bswap, uint64_t address,
+					    struct kernel_field field,
+					    uint64_t *ret)
+{
+	char buf[8];
+	struct drgn_error *err =
+		drgn_program_read_memory(prog, buf, address + field.offset,
+					 field.size, false);
+	if (err)
+		return err;
+	*ret = kernel_field_get(buf, field.offset, field, bswap);
+	return NULL;
+}
+
+DEFINE_VECTOR(kernel_char_vector, char)
+DEFINE_VECTOR(kernel_uint64_vector, uint64_t)
+
+/* Read a null-terminated string in chunks rather than one byte at a time. */
+static struct drgn_error *
+kernel_read_c_string(struct drgn_program *prog, uint64_t address,
+		     struct kernel_char_vector *vec)
+{
+	struct drgn_error *err;
+	for (;;) {
+		/*
+		 * Chunks are aligned so that they never cross into a page that
+		 * may not be mapped.
+		 */
+		size_t chunk = 64 - address % 64;
+		if (!kernel_char_vector_reserve(vec, vec->size + chunk))
+			return &drgn_enomem;
+		char *p = vec->data + vec->size;
+		err = drgn_program_read_memory(prog, p, address, chunk, false);
+		if (err)
+			return err;
+		char *nul = memchr(p, '\0', chunk);
+		if (nul) {
+			vec->size = nul - vec->data;
+			return NULL;
+		}
+		vec->size += chunk;
+		address += chunk;
+	}
+}
+
+/*
+ * Scattered reads which are at most this far apart are merged into one read.
+ */
+#define KERNEL_READ_GAP 4096
+/* Maximum number of bytes to read at once for scattered reads. */
+#define KERNEL_READ_MAX (16 * 1024 * 1024)
+
+struct kernel_read {
+	uint64_t address;
+	/* Index of the destination in the output buffer. */
+	size_t index;
+};
+
+DEFINE_VECTOR(kernel_read_vector, struct kernel_read)
+
+static int kernel_read_cmp(const void *_a, const void *_b)
+{
+	const struct kernel_read *a = _a, *b = _b;
+	if (a->address < b->address)
+		return -1;
+	else if (a->address > b->address)
+		return 1;
+	else
+		return 0;
+}
+
+/*
+ * Read size bytes from each address in reads into out at the corresponding
+ * index, using staging as a scratch buffer. Nearby addresses are read together.
+ * If a merged read faults, its addresses are retried one at a time, and if
+ * zero_faults is true, the destinations of the ones that still fault are zeroed
+ * instead of returning an error.
+ */
+static struct drgn_error *
+kernel_read_scattered(struct drgn_program *prog,
+		      struct kernel_read_vector *reads, size_t size,
+		      bool zero_faults, struct kernel_char_vector *staging,
+		      char *out)
+{
+	struct drgn_error *err;
+	struct kernel_read *data = reads->data;
+	size_t n = reads->size;
+
+	qsort(data, n, sizeof(data[0]), kernel_read_cmp);
+	for (size_t i = 0; i < n;) {
+		uint64_t start = data[i].address;
+		uint64_t end = start + size;
+		size_t j = i + 1;
+		while (j < n &&
+		       (data[j].address <= end ||
+			data[j].address - end <= KERNEL_READ_GAP) &&
+		       data[j].address + size - start <= KERNEL_READ_MAX) {
+			end = max(end, data[j].address + size);
+			j++;
+		}
+		if (!kernel_char_vector_reserve(staging, end - start))
+			return &drgn_enomem;
+		err = drgn_program_read_memory(prog, staging->data, start,
+					       end - start, false);
+		if (err && err->code == DRGN_ERROR_FAULT &&
+		    (j - i > 1 || zero_faults)) {
+			drgn_error_destroy(err);
+			for (; i < j; i++) {
+				char *dst = out + data[i].index * size;
+				err = drgn_program_read_memory(prog, dst,
+							       data[i].address,
+							       size, false);
+				if (err && err->code == DRGN_ERROR_FAULT &&
+				    zero_faults) {
+					drgn_error_destroy(err);
+					memset(dst, 0, size);
+				} else if (err) {
+					return err;
+				}
+			}
+			continue;
+		} else if (err) {
+			return err;
+		}
+		for (; i < j; i++) {
+			memcpy(out + data[i].index * size,
+			       staging->data + (data[i].address - start), size);
+		}
+	}
+	return NULL;
+}
+
+DEFINE_HASH_SET(kernel_uint64_set, uint64_t, int_key_hash_pair, scalar_key_eq)
+
+typedef struct drgn_error *kernel_task_fn(uint64_t task, void *arg);
+
+struct kernel_task_walk {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	kernel_task_fn *fn;
+	void *arg;
+	/* Offsets of the list nodes used to iterate over tasks. */
+	uint64_t tasks_offset, thread_node_offset, thread_group_offset;
+	struct kernel_field signal;
+	uint64_t thread_head_offset;
+	/* Whether threads are listed in signal->thread_head. */
+	bool has_thread_node;
+};
+
+static struct drgn_error *kernel_task_walk_read_word(struct kernel_task_walk *walk,
+						     uint64_t address,
+						     uint64_t *ret)
+{
+	struct kernel_field field = { .size = walk->word_size };
+	return kernel_read_field(walk->prog, walk->bswap, address, field, ret);
+}
+
+/* Call fn for every thread in the thread group of a group leader. */
+static struct drgn_error *kernel_task_walk_threads(struct kernel_task_walk *walk,
+						   uint64_t leader)
+{
+	struct drgn_error *err;
+	uint64_t head, pos;
+
+	if (walk->has_thread_node) {
+		uint64_t signal;
+		err = kernel_read_field(walk->prog, walk->bswap, leader,
+					walk->signal, &signal);
+		if (err)
+			return err;
+		head = signal + walk->thread_head_offset;
+		err = kernel_task_walk_read_word(walk, head, &pos);
+		if (err)
+			return err;
+		while (pos != head) {
+			err = walk->fn(pos - walk->thread_node_offset,
+				       walk->arg);
+			if (err)
+				return err;
+			err = kernel_task_walk_read_word(walk, pos, &pos);
+			if (err)
+				return err;
+		}
+		return NULL;
+	}
+
+	/* thread_group is a list with no separate head. */
+	err = walk->fn(leader, walk->arg);
+	if (err)
+		return err;
+	head = leader + walk->thread_group_offset;
+	err = kernel_task_walk_read_word(walk, head, &pos);
+	if (err)
+		return err;
+	while (pos != head) {
+		err = walk->fn(pos - walk->thread_group_offset, walk->arg);
+		if (err)
+			return err;
+		err = kernel_task_walk_read_word(walk, pos, &pos);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Call fn for every thread of every process, like for_each_task(), reading
+ * only the list pointers rather than going through drgn objects.
+ */
+static struct drgn_error *kernel_for_each_task(struct drgn_program *prog,
+					       kernel_task_fn *fn, void *arg)
+{
+	struct drgn_error *err;
+	struct drgn_member_info member;
+	struct kernel_task_walk walk = {
+		.prog = prog,
+		.fn = fn,
+		.arg = arg,
+	};
+
+	err = drgn_program_bswap(prog, &walk.bswap);
+	if (err)
+		return err;
+	err = drgn_program_word_size(prog, &walk.word_size);
+	if (err)
+		return err;
+	err = kernel_member_info(prog, "struct task_struct", "tasks", &member);
+	if (err)
+		return err;
+	walk.tasks_offset = member.bit_offset / 8;
+	err = kernel_member_info(prog, "struct task_struct", "thread_node",
+				 &member);
+	if (!err) {
+		walk.has_thread_node = true;
+		walk.thread_node_offset = member.bit_offset / 8;
+		err = kernel_find_field(prog, "struct task_struct", "signal",
+					&walk.signal);
+		if (err)
+			return err;
+		err = kernel_member_info(prog, "struct signal_struct",
+					 "thread_head", &member);
+		if (err)
+			return err;
+		walk.thread_head_offset = member.bit_offset / 8;
+	} else if (err->code == DRGN_ERROR_LOOKUP) {
+		/* Before Linux 3.14, threads were only in thread_group. */
+		drgn_error_destroy(err);
+		err = kernel_member_info(prog, "struct task_struct",
+					 "thread_group", &member);
+		if (err)
+			return err;
+		walk.thread_group_offset = member.bit_offset / 8;
+	} else {
+		return err;
+	}
+
+	struct drgn_object init_task;
+	drgn_object_init(&init_task, prog);
+	err = drgn_program_find_object(prog, "init_task", NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &init_task);
+	if (err)
+		goto out;
+	if (!init_task.is_reference) {
+		err = drgn_error_create(DRGN_ERROR_TYPE,
+					"init_task is not a reference");
+		goto out;
+	}
+	/*
+	 * init_task itself is the idle task, which isn't included, as in
+	 * for_each_task().
+	 */
+	uint64_t head = init_task.reference.address + walk.tasks_offset;
+	uint64_t pos;
+	err = kernel_task_walk_read_word(&walk, head, &pos);
+	if (err)
+		goto out;
+	while (pos != head) {
+		err = kernel_task_walk_threads(&walk, pos - walk.tasks_offset);
+		if (err)
+			goto out;
+		err = kernel_task_walk_read_word(&walk, pos, &pos);
+		if (err)
+			goto out;
+	}
+	err = NULL;
+out:
+	drgn_object_deinit(&init_task);
+	return err;
+}
+
+/*
+ * Get the number and per-CPU offset of each possible CPU, in order. Either
+ * vector may be NULL.
+ */
+static struct drgn_error *
+kernel_possible_cpus(struct drgn_program *prog, bool bswap, uint8_t word_size,
+		     struct kernel_uint64_vector *cpus_ret,
+		     struct kernel_uint64_vector *offsets_ret)
+{
+	struct drgn_error *err;
+	struct drgn_object obj;
+	struct kernel_uint64_vector cpus = VECTOR_INIT;
+	struct kernel_field word_field = { .size = word_size };
+	char *buf = NULL;
+
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, "__cpu_possible_mask", NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (err)
+		goto out;
+	uint64_t mask_size;
+	err = drgn_object_sizeof(&obj, &mask_size);
+	if (err)
+		goto out;
+	if (!obj.is_reference || mask_size % word_size) {
+		err = drgn_error_create(DRGN_ERROR_TYPE,
+					"unexpected __cpu_possible_mask");
+		goto out;
+	}
+	buf = malloc(mask_size);
+	if (!buf) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	err = drgn_program_read_memory(prog, buf, obj.reference.address,
+				       mask_size, false);
+	if (err)
+		goto out;
+
+	unsigned int bits_per_word = 8 * word_size;
+	for (uint64_t i = 0; i < mask_size; i += word_size) {
+		uint64_t word = kernel_field_get(buf + i, 0, word_field, bswap);
+		while (word) {
+			uint64_t cpu = (i / word_size) * bits_per_word +
+				       __builtin_ctzll(word);
+			word &= word - 1;
+			if (!kernel_uint64_vector_append(&cpus, &cpu)) {
+				err = &drgn_enomem;
+				goto out;
+			}
+		}
+	}
+	if (!cpus.size) {
+		err = drgn_error_create(DRGN_ERROR_OTHER, "no possible CPUs");
+		goto out;
+	}
+	if (cpus_ret) {
+		for (size_t i = 0; i < cpus.size; i++) {
+			if (!kernel_uint64_vector_append(cpus_ret,
+							 &cpus.data[i])) {
+				err = &drgn_enomem;
+				goto out;
+			}
+		}
+	}
+	if (!offsets_ret)
+		goto out;
+
+	err = drgn_program_find_object(prog, "__per_cpu_offset", NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		/* Per-CPU variables aren't relocated without CONFIG_SMP. */
+		drgn_error_destroy(err);
+		err = NULL;
+		uint64_t zero = 0;
+		if (!kernel_uint64_vector_append(offsets_ret, &zero))
+			err = &drgn_enomem;
+		goto out;
+	} else if (err) {
+		goto out;
+	}
+	if (!obj.is_reference) {
+		err = drgn_error_create(DRGN_ERROR_TYPE,
+					"unexpected __per_cpu_offset");
+		goto out;
+	}
+	uint64_t max_cpu = cpus.data[cpus.size - 1];
+	size_t offsets_size = (max_cpu + 1) * word_size;
+	char *offsets = realloc(buf, offsets_size);
+	if (!offsets) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	buf = offsets;
+	err = drgn_program_read_memory(prog, offsets, obj.reference.address,
+				       offsets_size, false);
+	if (err)
+		goto out;
+	for (size_t i = 0; i < cpus.size; i++) {
+		uint64_t offset = kernel_field_get(offsets +
+						   cpus.data[i] * word_size,
+						   0, word_field, bswap);
+		if (!kernel_uint64_vector_append(offsets_ret, &offset)) {
+			err = &drgn_enomem;
+			goto out;
+		}
+	}
+out:
+	free(buf);
+	kernel_uint64_vector_deinit(&cpus);
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+/*
+ * Paths of dentries are cached by (struct mount *, struct dentry *), with the
+ * mount being 0 for paths relative to the root of the file system. Resolving
+ * a path caches the path of every ancestor visited along the way, so the
+ * common prefixes of many paths are only walked once.
+ */
+struct dentry_path_key {
+	uint64_t mnt;
+	uint64_t dentry;
+};
+
+struct dentry_path_value {
+	/* Path with a leading '/', or "" for the root. Not null-terminated. */
+	char *path;
+	size_t len;
+	/*
+	 * Generation that the path was resolved in. Entries from older
+	 * generations are stale.
+	 */
+	uint64_t generation;
+};
+
+static struct hash_pair dentry_path_key_hash_pair(const struct dentry_path_key *key)
+{
+	return hash_pair_from_avalanching_hash(hash_combine(key->mnt,
+							   key->dentry));
+}
+
+static bool dentry_path_key_eq(const struct dentry_path_key *a,
+			       const struct dentry_path_key *b)
+{
+	return a->mnt == b->mnt && a->dentry == b->dentry;
+}
+
+DEFINE_HASH_MAP(dentry_path_map, struct dentry_path_key,
+		struct dentry_path_value, dentry_path_key_hash_pair,
+		dentry_path_key_eq)
+
+/* Dentry or mount crossing visited while resolving a path. */
+struct dentry_path_component {
+	struct dentry_path_key key;
+	/* Offset of the name in the names buffer, or SIZE_MAX for none. */
+	size_t name_offset;
+	size_t name_len;
+};
+
+DEFINE_VECTOR(dentry_path_component_vector, struct dentry_path_component)
+
+struct linux_helper_dentry_path_cache {
+	struct dentry_path_map map;
+	/* Total length of the paths in map. */
+	size_t path_bytes;
+	/*
+	 * Paths returned by a call are valid until the next one, so the cache
+	 * stays busy between calls and is only shrunk when a call starts.
+	 */
+	struct drgn_cache budget_cache;
+	/* Incremented for every call on a live program. */
+	uint64_t generation;
+	bool bswap;
+	/* Offset of mnt in struct mount. */
+	uint64_t mount_mnt_offset;
+	/* Fields relative to the beginning of struct mount. */
+	struct kernel_field mnt_parent, mnt_mountpoint, mnt_root;
+	struct kernel_field d_parent, d_name_len, d_name_name, d_op,
+				 d_inode;
+	struct kernel_field d_dname, i_sb, s_type, fs_name;
+	/*
+	 * The fields of struct mount and struct dentry needed for each step are
+	 * read at once.
+	 */
+	uint64_t mount_span_start, mount_span_size;
+	uint64_t dentry_span_start, dentry_span_size;
+	char *buf;
+	struct dentry_path_component_vector components;
+	struct kernel_char_vector names;
+	/* Results which aren't cached. */
+	struct kernel_char_vector result;
+};
+
+void
+linux_helper_dentry_path_cache_destroy(struct linux_helper_dentry_path_cache *cache)
+{
+	if (!cache)
+		return;
+	drgn_cache_unregister(&cache->budget_cache);
+	for (struct dentry_path_map_iterator it =
+		     dentry_path_map_first(&cache->map);
+	     it.entry; it = dentry_path_map_next(it))
+		free(it.entry->value.path);
+	dentry_path_map_deinit(&cache->map);
+	kernel_char_vector_deinit(&cache->result);
+	kernel_char_vector_deinit(&cache->names);
+	dentry_path_component_vector_deinit(&cache->components);
+	free(cache->buf);
+	free(cache);
+}
+
+static size_t dentry_path_cache_cost(struct drgn_cache *budget_cache)
+{
+	struct linux_helper_dentry_path_cache *cache =
+		container_of(budget_cache, struct linux_helper_dentry_path_cache,
+			     budget_cache);
+	return dentry_path_map_size(&cache->map) *
+	       sizeof(struct dentry_path_map_entry) + cache->path_bytes;
+}
+
+static void dentry_path_cache_shrink(struct drgn_cache *budget_cache,
+				     size_t target)
+{
+	struct linux_helper_dentry_path_cache *cache =
+		container_of(budget_cache, struct linux_helper_dentry_path_cache,
+			     budget_cache);
+	/* Paths share their prefixes, so we can only drop all of them. */
+	for (struct dentry_path_map_iterator it =
+		     dentry_path_map_first(&cache->map);
+	     it.entry; it = dentry_path_map_next(it))
+		free(it.entry->value.path);
+	dentry_path_map_deinit(&cache->map);
+	dentry_path_map_init(&cache->map);
+	cache->path_bytes = 0;
+}
+
+void
+linux_helper_dentry_path_cache_memory_usage(struct linux_helper_dentry_path_cache *cache,
+					    struct drgn_memory_usage *ret)
+{
+	if (!cache) {
+		ret->size = ret->count = ret->evictions = 0;
+		return;
+	}
+	ret->size = (dentry_path_map_memory_usage(&cache->map) +
+		     cache->path_bytes +
+		     max(cache->mount_span_size, cache->dentry_span_size) +
+		     cache->components.capacity *
+		     sizeof(cache->components.data[0]) +
+		     cache->names.capacity + cache->result.capacity);
+	ret->count = dentry_path_map_size(&cache->map);
+	ret->evictions = cache->budget_cache.evictions;
+}
+
+static struct drgn_error *
+linux_helper_dentry_path_cache_create(struct drgn_program *prog,
+				      struct linux_helper_dentry_path_cache **ret)
+{
+	struct drgn_error *err;
+	struct linux_helper_dentry_path_cache *cache = calloc(1, sizeof(*cache));
+	if (!cache)
+		return &drgn_enomem;
+	dentry_path_map_init(&cache->map);
+	dentry_path_component_vector_init(&cache->components);
+	kernel_char_vector_init(&cache->names);
+	kernel_char_vector_init(&cache->result);
+	drgn_cache_register(&prog->memory_budget, &cache->budget_cache,
+			    "dentry_paths", dentry_path_cache_cost,
+			    dentry_path_cache_shrink);
+	drgn_cache_begin(&cache->budget_cache);
+
+	err = drgn_program_bswap(prog, &cache->bswap);
+	if (err)
+		goto err;
+
+	struct drgn_member_info mount_mnt, d_name;
+	struct kernel_field qstr_len, qstr_name;
+	if ((err = kernel_member_info(prog, "struct mount", "mnt",
+				      &mount_mnt)) ||
+	    (err = kernel_find_field(prog, "struct mount", "mnt_parent",
+				     &cache->mnt_parent)) ||
+	    (err = kernel_find_field(prog, "struct mount",
+				     "mnt_mountpoint",
+				     &cache->mnt_mountpoint)) ||
+	    (err = kernel_find_field(prog, "struct vfsmount", "mnt_root",
+				     &cache->mnt_root)) ||
+	    (err = kernel_find_field(prog, "struct dentry", "d_parent",
+				     &cache->d_parent)) ||
+	    (err = kernel_member_info(prog, "struct dentry", "d_name",
+				      &d_name)) ||
+	    (err = kernel_find_field(prog, "struct qstr", "len",
+				     &qstr_len)) ||
+	    (err = kernel_find_field(prog, "struct qstr", "name",
+				     &qstr_name)) ||
+	    (err = kernel_find_field(prog, "struct dentry", "d_op",
+				     &cache->d_op)) ||
+	    (err = kernel_find_field(prog, "struct dentry", "d_inode",
+				     &cache->d_inode)) ||
+	    (err = kernel_find_field(prog, "struct dentry_operations",
+				     "d_dname", &cache->d_dname)) ||
+	    (err = kernel_find_field(prog, "struct inode", "i_sb",
+				     &cache->i_sb)) ||
+	    (err = kernel_find_field(prog, "struct super_block", "s_type",
+				     &cache->s_type)) ||
+	    (err = kernel_find_field(prog, "struct file_system_type",
+				     "name", &cache->fs_name)))
+		goto err;
+	cache->mount_mnt_offset = mount_mnt.bit_offset / 8;
+	cache->mnt_root.offset += cache->mount_mnt_offset;
+	cache->d_name_len = qstr_len;
+	cache->d_name_len.offset += d_name.bit_offset / 8;
+	cache->d_name_name = qstr_name;
+	cache->d_name_name.offset += d_name.bit_offset / 8;
+
+	struct kernel_field mount_fields[] = {
+		cache->mnt_parent, cache->mnt_mountpoint, cache->mnt_root,
+	};
+	kernel_field_span(mount_fields, ARRAY_SIZE(mount_fields),
+			  &cache->mount_span_start, &cache->mount_span_size);
+	struct kernel_field dentry_fields[] = {
+		cache->d_parent, cache->d_name_len, cache->d_name_name,
+	};
+	kernel_field_span(dentry_fields, ARRAY_SIZE(dentry_fields),
+			  &cache->dentry_span_start, &cache->dentry_span_size);
+	cache->buf = malloc(max(cache->mount_span_size,
+				cache->dentry_span_size));
+	if (!cache->buf) {
+		err = &drgn_enomem;
+		goto err;
+	}
+	*ret = cache;
+	return NULL;
+
+err:
+	linux_helper_dentry_path_cache_destroy(cache);
+	return err;
+}
+
+static struct drgn_error *
+linux_helper_dentry_path_cache_get(struct drgn_program *prog,
+				   struct linux_helper_dentry_path_cache **ret)
+{
+	if (!prog->dentry_path_cache) {
+		struct drgn_error *err =
+			linux_helper_dentry_path_cache_create(prog,
+							      &prog->dentry_path_cache);
+		if (err)
+			return err;
+	} else {
+		/* Paths returned by the previous call may be freed now. */
+		drgn_cache_end(&prog->dentry_path_cache->budget_cache);
+		drgn_cache_begin(&prog->dentry_path_cache->budget_cache);
+	}
+	/*
+	 * The dentry tree of a live kernel or running guest may change at any
+	 * time, so paths are only reused within a single call.
+	 */
+	if (drgn_program_memory_may_change(prog))
+		prog->dentry_path_cache->generation++;
+	*ret = prog->dentry_path_cache;
+	return NULL;
+}
+
+static uint64_t dentry_path_get_field(struct linux_helper_dentry_path_cache *cache,
+				      uint64_t span_start,
+				      struct kernel_field field)
+{
+	return kernel_field_get(cache->buf, span_start, field, cache->bswap);
+}
+
+static struct drgn_error *
+dentry_path_read_field(struct drgn_program *prog,
+		       struct linux_helper_dentry_path_cache *cache,
+		       uint64_t address, struct kernel_field field,
+		       uint64_t *ret)
+{
+	struct drgn_error *err =
+		drgn_program_read_memory(prog, cache->buf,
+					 address + field.offset, field.size,
+					 false);
+	if (err)
+		return err;
+	*ret = dentry_path_get_field(cache, field.offset, field);
+	return NULL;
+}
+
+static struct drgn_error *
+dentry_path_read_mount(struct drgn_program *prog,
+		       struct linux_helper_dentry_path_cache *cache,
+		       uint64_t mnt, uint64_t *mnt_root_ret,
+		       uint64_t *mnt_parent_ret, uint64_t *mnt_mountpoint_ret)
+{
+	struct drgn_error *err =
+		drgn_program_read_memory(prog, cache->buf,
+					 mnt + cache->mount_span_start,
+					 cache->mount_span_size, false);
+	if (err)
+		return err;
+	*mnt_root_ret = dentry_path_get_field(cache, cache->mount_span_start,
+					      cache->mnt_root);
+	*mnt_parent_ret = dentry_path_get_field(cache, cache->mount_span_start,
+						cache->mnt_parent);
+	*mnt_mountpoint_ret = dentry_path_get_field(cache,
+						    cache->mount_span_start,
+						    cache->mnt_mountpoint);
+	return NULL;
+}
+
+static struct drgn_error *
+dentry_path_resolve(struct drgn_program *prog,
+		    struct linux_helper_dentry_path_cache *cache, uint64_t mnt,
+		    uint64_t dentry, const char **ret, size_t *len_ret)
+{
+	struct drgn_error *err;
+	/* Cycles can only come from corrupted memory. */
+	static const size_t max_depth = 4096;
+	uint64_t mnt_root = 0, mnt_parent = 0, mnt_mountpoint = 0;
+
+	cache->components.size = 0;
+	cache->names.size = 0;
+	struct dentry_path_key key = { mnt, dentry };
+	const char *prefix = "";
+	size_t prefix_len = 0;
+	if (key.mnt) {
+		err = dentry_path_read_mount(prog, cache, key.mnt, &mnt_root,
+					     &mnt_parent, &mnt_mountpoint);
+		if (err)
+			return err;
+	}
+	for (;;) {
+		struct dentry_path_map_iterator it =
+			dentry_path_map_search(&cache->map, &key);
+		if (it.entry && it.entry->value.generation == cache->generation) {
+			prefix = it.entry->value.path;
+			prefix_len = it.entry->value.len;
+			break;
+		}
+
+		if (cache->components.size >= max_depth) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "dentry path is too deep");
+		}
+		struct dentry_path_component *component =
+			dentry_path_component_vector_append_entry(&cache->components);
+		if (!component)
+			return &drgn_enomem;
+		component->key = key;
+		component->name_offset = SIZE_MAX;
+
+		if (key.mnt && key.dentry == mnt_root) {
+			if (mnt_parent == key.mnt)
+				break;
+			key.mnt = mnt_parent;
+			key.dentry = mnt_mountpoint;
+			err = dentry_path_read_mount(prog, cache, key.mnt,
+						     &mnt_root, &mnt_parent,
+						     &mnt_mountpoint);
+			if (err)
+				return err;
+			continue;
+		}
+
+		err = drgn_program_read_memory(prog, cache->buf,
+					       key.dentry + cache->dentry_span_start,
+					       cache->dentry_span_size, false);
+		if (err)
+			return err;
+		uint64_t d_parent = dentry_path_get_field(cache,
+							  cache->dentry_span_start,
+							  cache->d_parent);
+		if (d_parent == key.dentry)
+			break;
+		uint64_t name_len = dentry_path_get_field(cache,
+							  cache->dentry_span_start,
+							  cache->d_name_len);
+		uint64_t name = dentry_path_get_field(cache,
+						      cache->dentry_span_start,
+						      cache->d_name_name);
+		/* Names are limited to NAME_MAX, but be generous. */
+		if (name_len > 4096) {
+			return drgn_error_create_fault("invalid dentry name length",
+						       key.dentry);
+		}
+		if (!kernel_char_vector_reserve(&cache->names,
+						     cache->names.size + name_len))
+			return &drgn_enomem;
+		err = drgn_program_read_memory(prog,
+					       cache->names.data + cache->names.size,
+					       name, name_len, false);
+		if (err)
+			return err;
+		/* The vector may have been reallocated. */
+		component = &cache->components.data[cache->components.size - 1];
+		component->name_offset = cache->names.size;
+		component->name_len = name_len;
+		cache->names.size += name_len;
+		key.dentry = d_parent;
+	}
+
+	/* Build the paths from the top down, caching every one. */
+	for (size_t i = cache->components.size; i-- > 0;) {
+		struct dentry_path_component *component =
+			&cache->components.data[i];
+		size_t len = prefix_len;
+		if (component->name_offset != SIZE_MAX)
+			len += 1 + component->name_len;
+		char *path = malloc(len ? len : 1);
+		if (!path)
+			return &drgn_enomem;
+		memcpy(path, prefix, prefix_len);
+		if (component->name_offset != SIZE_MAX) {
+			path[prefix_len] = '/';
+			memcpy(path + prefix_len + 1,
+			       cache->names.data + component->name_offset,
+			       component->name_len);
+		}
+
+		struct dentry_path_map_entry entry = {
+			.key = component->key,
+			.value = { path, len, cache->generation },
+		};
+		struct dentry_path_map_iterator it;
+		int r = dentry_path_map_insert(&cache->map, &entry, &it);
+		if (r < 0) {
+			free(path);
+			return &drgn_enomem;
+		} else if (r == 0) {
+			/* Replace a stale entry. */
+			cache->path_bytes -= it.entry->value.len;
+			free(it.entry->value.path);
+			it.entry->value = entry.value;
+		}
+		cache->path_bytes += len;
+		prefix = path;
+		prefix_len = len;
+	}
+	if (cache->components.size)
+		drgn_cache_charge(&cache->budget_cache);
+	*ret = prefix;
+	*len_ret = prefix_len;
+	return NULL;
+}
+
+/*
+ * Dentries with a d_dname operation (e.g., pipes and sockets) don't have a
+ * real path. Like the Python helper, this returns the file system type name in
+ * brackets for them.
+ */
+static struct drgn_error *
+dentry_path_dname(struct drgn_program *prog,
+		  struct linux_helper_dentry_path_cache *cache, uint64_t dentry,
+		  bool *ret)
+{
+	struct drgn_error *err;
+	uint64_t address;
+	err = dentry_path_read_field(prog, cache, dentry, cache->d_op,
+				     &address);
+	if (err)
+		return err;
+	if (address) {
+		err = dentry_path_read_field(prog, cache, address,
+					     cache->d_dname, &address);
+		if (err)
+			return err;
+	}
+	if (!address) {
+		*ret = false;
+		return NULL;
+	}
+	if ((err = dentry_path_read_field(prog, cache, dentry, cache->d_inode,
+					  &address)) ||
+	    (err = dentry_path_read_field(prog, cache, address, cache->i_sb,
+					  &address)) ||
+	    (err = dentry_path_read_field(prog, cache, address, cache->s_type,
+					  &address)) ||
+	    (err = dentry_path_read_field(prog, cache, address,
+					  cache->fs_name, &address)))
+		return err;
+	cache->result.size = 0;
+	if (!kernel_char_vector_append(&cache->result, &(char){'['}))
+		return &drgn_enomem;
+	err = kernel_read_c_string(prog, address, &cache->result);
+	if (err)
+		return err;
+	if (!kernel_char_vector_append(&cache->result, &(char){']'}))
+		return &drgn_enomem;
+	*ret = true;
+	return NULL;
+}
+
+static struct drgn_error *
+d_path_cached(struct drgn_program *prog,
+	      struct linux_helper_dentry_path_cache *cache, uint64_t vfsmnt,
+	      uint64_t dentry, const char **ret, size_t *len_ret)
+{
+	struct drgn_error *err;
+	bool dname;
+	err = dentry_path_dname(prog, cache, dentry, &dname);
+	if (err)
+		return err;
+	if (dname) {
+		*ret = cache->result.data;
+		*len_ret = cache->result.size;
+		return NULL;
+	}
+	err = dentry_path_resolve(prog, cache,
+				  vfsmnt - cache->mount_mnt_offset, dentry,
+				  ret, len_ret);
+	if (!err && !*len_ret) {
+		*ret = "/";
+		*len_ret = 1;
+	}
+	return err;
+}
+
+struct drgn_error *linux_helper_d_path(struct drgn_program *prog,
+				       uint64_t vfsmnt, uint64_t dentry,
+				       const char **ret, size_t *len_ret)
+{
+	struct drgn_error *err;
+	struct linux_helper_dentry_path_cache *cache;
+	err = linux_helper_dentry_path_cache_get(prog, &cache);
+	if (err)
+		return err;
+	return d_path_cached(prog, cache, vfsmnt, dentry, ret, len_ret);
+}
+
+struct drgn_error *linux_helper_d_paths(struct drgn_program *prog,
+					const uint64_t *vfsmnts,
+					const uint64_t *dentries, size_t n,
+					linux_helper_d_path_fn *fn, void *arg)
+{
+	struct drgn_error *err;
+	struct linux_helper_dentry_path_cache *cache;
+	err = linux_helper_dentry_path_cache_get(prog, &cache);
+	if (err)
+		return err;
+	for (size_t i = 0; i < n; i++) {
+		const char *path;
+		size_t len;
+		err = d_path_cached(prog, cache, vfsmnts[i], dentries[i], &path,
+				    &len);
+		if (err)
+			return err;
+		err = fn(i, path, len, arg);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+struct drgn_error *linux_helper_dentry_path(struct drgn_program *prog,
+					    uint64_t dentry, const char **ret,
+					    size_t *len_ret)
+{
+	struct drgn_error *err;
+	struct linux_helper_dentry_path_cache *cache;
+	err = linux_helper_dentry_path_cache_get(prog, &cache);
+	if (err)
+		return err;
+	err = dentry_path_resolve(prog, cache, 0, dentry, ret, len_ret);
+	if (err)
+		return err;
+	/* Unlike d_path(), this doesn't have a leading '/'. */
+	if (*len_ret) {
+		(*ret)++;
+		(*len_ret)--;
+	}
+	return NULL;
+}
+
+/* Number of open_fds words whose file pointers are read at once. */
+#define TASK_FILES_WINDOW_WORDS 64
+
+struct task_files_scan {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	const struct linux_helper_file_filter *filter;
+	linux_helper_file_fn *fn;
+	void *arg;
+	struct kernel_field files, fdt, max_fds, open_fds, fd;
+	uint64_t fdtable_span_start, fdtable_span_size;
+	struct kernel_field f_inode, f_op, i_sb;
+	uint64_t file_span_start, file_span_size;
+	/* Addresses of files_structs which were already scanned. */
+	struct kernel_uint64_set seen;
+	char *bitmap;
+	size_t bitmap_capacity;
+	char *fds;
+	char buf[64];
+};
+
+static struct drgn_error *task_files_read_field(struct task_files_scan *scan,
+						uint64_t address,
+						struct kernel_field field,
+						uint64_t *ret)
+{
+	return kernel_read_field(scan->prog, scan->bswap, address, field, ret);
+}
+
+static struct drgn_error *task_files_scan_init(struct task_files_scan *scan,
+					       struct drgn_program *prog,
+					       const struct linux_helper_file_filter *filter,
+					       linux_helper_file_fn *fn,
+					       void *arg)
+{
+	struct drgn_error *err;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->prog = prog;
+	scan->filter = filter;
+	scan->fn = fn;
+	scan->arg = arg;
+	kernel_uint64_set_init(&scan->seen);
+
+	err = drgn_program_bswap(prog, &scan->bswap);
+	if (err)
+		return err;
+	err = drgn_program_word_size(prog, &scan->word_size);
+	if (err)
+		return err;
+
+	if ((err = kernel_find_field(prog, "struct task_struct", "files",
+				     &scan->files)) ||
+	    (err = kernel_find_field(prog, "struct files_struct", "fdt",
+				     &scan->fdt)) ||
+	    (err = kernel_find_field(prog, "struct fdtable", "max_fds",
+				     &scan->max_fds)) ||
+	    (err = kernel_find_field(prog, "struct fdtable", "open_fds",
+				     &scan->open_fds)) ||
+	    (err = kernel_find_field(prog, "struct fdtable", "fd",
+				     &scan->fd)))
+		return err;
+	struct kernel_field fdtable_fields[] = {
+		scan->max_fds, scan->open_fds, scan->fd,
+	};
+	kernel_field_span(fdtable_fields, ARRAY_SIZE(fdtable_fields),
+			  &scan->fdtable_span_start, &scan->fdtable_span_size);
+
+	if (filter->inode || filter->super_block) {
+		err = kernel_find_field(prog, "struct file", "f_inode",
+					&scan->f_inode);
+		if (err)
+			return err;
+	}
+	if (filter->super_block) {
+		err = kernel_find_field(prog, "struct inode", "i_sb",
+					&scan->i_sb);
+		if (err)
+			return err;
+	}
+	if (filter->f_op) {
+		err = kernel_find_field(prog, "struct file", "f_op",
+					&scan->f_op);
+		if (err)
+			return err;
+	}
+	struct kernel_field file_fields[2];
+	size_t num_file_fields = 0;
+	if (scan->f_inode.size)
+		file_fields[num_file_fields++] = scan->f_inode;
+	if (scan->f_op.size)
+		file_fields[num_file_fields++] = scan->f_op;
+	if (num_file_fields) {
+		kernel_field_span(file_fields, num_file_fields,
+				  &scan->file_span_start,
+				  &scan->file_span_size);
+	}
+
+	uint64_t max_span = max(scan->fdtable_span_size, scan->file_span_size);
+	if (max_span > sizeof(scan->buf)) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "unexpected struct fdtable or struct file layout");
+	}
+
+	scan->fds = malloc_array(TASK_FILES_WINDOW_WORDS * 8 * scan->word_size,
+				 scan->word_size);
+	if (!scan->fds)
+		return &drgn_enomem;
+	return NULL;
+}
+
+static void task_files_scan_deinit(struct task_files_scan *scan)
+{
+	free(scan->fds);
+	free(scan->bitmap);
+	kernel_uint64_set_deinit(&scan->seen);
+}
+
+static struct drgn_error *task_files_filter(struct task_files_scan *scan,
+					    uint64_t file, bool *ret)
+{
+	struct drgn_error *err;
+	const struct linux_helper_file_filter *filter = scan->filter;
+
+	if (!scan->file_span_size) {
+		*ret = true;
+		return NULL;
+	}
+	err = drgn_program_read_memory(scan->prog, scan->buf,
+				       file + scan->file_span_start,
+				       scan->file_span_size, false);
+	if (err)
+		return err;
+	if (filter->f_op &&
+	    kernel_field_get(scan->buf, scan->file_span_start, scan->f_op,
+			     scan->bswap) != filter->f_op) {
+		*ret = false;
+		return NULL;
+	}
+	uint64_t inode = 0;
+	if (scan->f_inode.size) {
+		inode = kernel_field_get(scan->buf, scan->file_span_start,
+					 scan->f_inode, scan->bswap);
+	}
+	if (filter->inode && inode != filter->inode) {
+		*ret = false;
+		return NULL;
+	}
+	if (filter->super_block) {
+		uint64_t sb;
+		if (!inode) {
+			*ret = false;
+			return NULL;
+		}
+		err = task_files_read_field(scan, inode, scan->i_sb, &sb);
+		if (err)
+			return err;
+		if (sb != filter->super_block) {
+			*ret = false;
+			return NULL;
+		}
+	}
+	*ret = true;
+	return NULL;
+}
+
+/* Get word i of the open_fds bitmap, ignoring any stray bits past max_fds. */
+static uint64_t task_files_bitmap_word(struct task_files_scan *scan, size_t i,
+				       uint64_t max_fds)
+{
+	unsigned int bits_per_word = 8 * scan->word_size;
+	struct kernel_field field = {
+		.offset = i * scan->word_size,
+		.size = scan->word_size,
+	};
+	uint64_t word = kernel_field_get(scan->bitmap, 0, field, scan->bswap);
+	if (max_fds - i * bits_per_word < bits_per_word)
+		word &= (UINT64_C(1) << (max_fds - i * bits_per_word)) - 1;
+	return word;
+}
+
+/*
+ * Report the files for the bits set in open_fds words [start, end). The file
+ * pointers between the lowest and highest set bits are read at once.
+ */
+static struct drgn_error *task_files_scan_window(struct task_files_scan *scan,
+						 uint64_t task, uint64_t max_fds,
+						 uint64_t fd_array, size_t start,
+						 size_t end)
+{
+	struct drgn_error *err;
+	unsigned int bits_per_word = 8 * scan->word_size;
+	struct kernel_field word_field = { .size = scan->word_size };
+
+	uint64_t lo = UINT64_MAX, hi = 0;
+	for (size_t i = start; i < end; i++) {
+		uint64_t word = task_files_bitmap_word(scan, i, max_fds);
+		if (!word)
+			continue;
+		if (lo == UINT64_MAX)
+			lo = i * bits_per_word + __builtin_ctzll(word);
+		hi = i * bits_per_word + 63 - __builtin_clzll(word);
+	}
+	if (lo == UINT64_MAX)
+		return NULL;
+
+	err = drgn_program_read_memory(scan->prog, scan->fds,
+				       fd_array + lo * scan->word_size,
+				       (hi - lo + 1) * scan->word_size, false);
+	if (err)
+		return err;
+
+	for (size_t i = start; i < end; i++) {
+		uint64_t word = task_files_bitmap_word(scan, i, max_fds);
+		while (word) {
+			uint64_t fd = i * bits_per_word + __builtin_ctzll(word);
+			word &= word - 1;
+			word_field.offset = (fd - lo) * scan->word_size;
+			uint64_t file = kernel_field_get(scan->fds, 0,
+							 word_field,
+							 scan->bswap);
+			/* The fd may be allocated but not installed yet. */
+			if (!file)
+				continue;
+			bool match;
+			err = task_files_filter(scan, file, &match);
+			if (err)
+				return err;
+			if (match) {
+				err = scan->fn(task, fd, file, scan->arg);
+				if (err)
+					return err;
+			}
+		}
+	}
+	return NULL;
+}
+
+static struct drgn_error *task_files_scan_task(struct task_files_scan *scan,
+					       uint64_t task)
+{
+	struct drgn_error *err;
+
+	uint64_t files;
+	err = task_files_read_field(scan, task, scan->files, &files);
+	if (err)
+		return err;
+	/* Exited tasks don't have a files_struct. */
+	if (!files)
+		return NULL;
+	/* Threads usually share a files_struct; only scan it once. */
+	int r = kernel_uint64_set_insert(&scan->seen, &files, NULL);
+	if (r <= 0)
+		return r < 0 ? &drgn_enomem : NULL;
+
+	uint64_t fdt;
+	err = task_files_read_field(scan, files, scan->fdt, &fdt);
+	if (err)
+		return err;
+	err = drgn_program_read_memory(scan->prog, scan->buf,
+				       fdt + scan->fdtable_span_start,
+				       scan->fdtable_span_size, false);
+	if (err)
+		return err;
+	uint64_t max_fds = kernel_field_get(scan->buf,
+					    scan->fdtable_span_start,
+					    scan->max_fds, scan->bswap);
+	uint64_t open_fds = kernel_field_get(scan->buf,
+					     scan->fdtable_span_start,
+					     scan->open_fds, scan->bswap);
+	uint64_t fd_array = kernel_field_get(scan->buf,
+					     scan->fdtable_span_start,
+					     scan->fd, scan->bswap);
+
+	unsigned int bits_per_word = 8 * scan->word_size;
+	size_t num_words = (max_fds + bits_per_word - 1) / bits_per_word;
+	if (!num_words)
+		return NULL;
+	size_t bitmap_size = num_words * scan->word_size;
+	if (bitmap_size > scan->bitmap_capacity) {
+		char *bitmap = realloc(scan->bitmap, bitmap_size);
+		if (!bitmap)
+			return &drgn_enomem;
+		scan->bitmap = bitmap;
+		scan->bitmap_capacity = bitmap_size;
+	}
+	err = drgn_program_read_memory(scan->prog, scan->bitmap, open_fds,
+				       bitmap_size, false);
+	if (err)
+		return err;
+	for (size_t i = 0; i < num_words; i += TASK_FILES_WINDOW_WORDS) {
+		err = task_files_scan_window(scan, task, max_fds, fd_array, i,
+					     min(i + TASK_FILES_WINDOW_WORDS,
+						 num_words));
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+static struct drgn_error *task_files_scan_task_fn(uint64_t task, void *arg)
+{
+	return task_files_scan_task(arg, task);
+}
+
+struct drgn_error *
+linux_helper_for_each_task_file(struct drgn_program *prog,
+				const uint64_t *tasks, size_t num_tasks,
+				const struct linux_helper_file_filter *filter,
+				linux_helper_file_fn *fn, void *arg)
+{
+	struct drgn_error *err;
+	struct task_files_scan scan;
+
+	err = task_files_scan_init(&scan, prog, filter, fn, arg);
+	if (err)
+		goto out;
+	if (tasks) {
+		for (size_t i = 0; i < num_tasks; i++) {
+			err = task_files_scan_task(&scan, tasks[i]);
+			if (err)
+				goto out;
+		}
+	} else {
+		err = kernel_for_each_task(prog, task_files_scan_task_fn,
+					   &scan);
+	}
+out:
+	task_files_scan_deinit(&scan);
+	return err;
+}
+
+struct bpf_map_reader {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	bool is_hash;
+	bool is_percpu;
+	uint32_t key_size, value_size, max_entries;
+	/* Per-CPU values are summed as integers of this size, or 0. */
+	unsigned int sum_size;
+	/* Size of each value passed to the callback. */
+	size_t out_value_size;
+	/* struct bpf_array: value or pptrs and the stride between them. */
+	uint64_t array_values;
+	uint32_t array_elem_size;
+	/* struct bpf_htab */
+	uint64_t buckets;
+	uint32_t n_buckets;
+	uint32_t htab_elem_size;
+	uint64_t bucket_size, bucket_first_offset;
+	uint64_t hash_node_offset, key_offset;
+	/* __per_cpu_offset of each possible CPU. */
+	struct kernel_uint64_vector cpu_offsets;
+	struct kernel_read_vector reads;
+	struct kernel_char_vector staging;
+	struct kernel_char_vector elems;
+	struct kernel_char_vector percpu_values;
+	struct kernel_char_vector out_value;
+	struct kernel_uint64_vector nodes, next_nodes, pptrs;
+	linux_helper_bpf_map_fn *fn;
+	void *arg;
+};
+
+static void bpf_map_reader_deinit(struct bpf_map_reader *reader)
+{
+	kernel_uint64_vector_deinit(&reader->pptrs);
+	kernel_uint64_vector_deinit(&reader->next_nodes);
+	kernel_uint64_vector_deinit(&reader->nodes);
+	kernel_char_vector_deinit(&reader->out_value);
+	kernel_char_vector_deinit(&reader->percpu_values);
+	kernel_char_vector_deinit(&reader->elems);
+	kernel_char_vector_deinit(&reader->staging);
+	kernel_read_vector_deinit(&reader->reads);
+	kernel_uint64_vector_deinit(&reader->cpu_offsets);
+}
+
+static uint64_t bpf_map_get_uint(struct bpf_map_reader *reader,
+				 const char *p, size_t size)
+{
+	struct kernel_field field = { .size = size };
+	return kernel_field_get(p, 0, field, reader->bswap);
+}
+
+static void bpf_map_put_uint(struct bpf_map_reader *reader, char *p,
+			     size_t size, uint64_t value)
+{
+	switch (size) {
+	case 1:
+		*(uint8_t *)p = value;
+		break;
+	case 2: {
+		uint16_t value16 = reader->bswap ? bswap_16(value) : value;
+		memcpy(p, &value16, sizeof(value16));
+		break;
+	}
+	case 4: {
+		uint32_t value32 = reader->bswap ? bswap_32(value) : value;
+		memcpy(p, &value32, sizeof(value32));
+		break;
+	}
+	default:
+		if (reader->bswap)
+			value = bswap_64(value);
+		memcpy(p, &value, sizeof(value));
+		break;
+	}
+}
+
+/*
+ * Read the per-CPU values of the pointers in reader->pptrs into
+ * reader->percpu_values, indexed by element and then by CPU.
+ */
+static struct drgn_error *bpf_map_read_percpu(struct bpf_map_reader *reader)
+{
+	size_t num_cpus = reader->cpu_offsets.size;
+	size_t n = reader->pptrs.size * num_cpus;
+
+	reader->reads.size = 0;
+	if (!kernel_read_vector_reserve(&reader->reads, n) ||
+	    !kernel_char_vector_reserve(&reader->percpu_values,
+					 n * reader->value_size))
+		return &drgn_enomem;
+	for (size_t i = 0; i < reader->pptrs.size; i++) {
+		for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+			struct kernel_read *read =
+				kernel_read_vector_append_entry(&reader->reads);
+			read->address = (reader->pptrs.data[i] +
+					 reader->cpu_offsets.data[cpu]);
+			read->index = i * num_cpus + cpu;
+		}
+	}
+	return kernel_read_scattered(reader->prog, &reader->reads,
+				     reader->value_size, false,
+				     &reader->staging,
+				     reader->percpu_values.data);
+}
+
+/* Combine the per-CPU values of element i and report them. */
+static struct drgn_error *bpf_map_report_percpu(struct bpf_map_reader *reader,
+						const void *key, size_t i)
+{
+	size_t num_cpus = reader->cpu_offsets.size;
+	const char *values = (reader->percpu_values.data +
+			      i * num_cpus * reader->value_size);
+	char *out = reader->out_value.data;
+
+	if (reader->sum_size) {
+		size_t size = reader->sum_size;
+		for (size_t j = 0; j < reader->value_size; j += size) {
+			uint64_t sum = 0;
+			for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+				sum += bpf_map_get_uint(reader,
+							values + cpu * reader->value_size + j,
+							size);
+			}
+			bpf_map_put_uint(reader, out + j, size, sum);
+		}
+	} else {
+		/* Like BPF_MAP_LOOKUP_ELEM, each value is padded to 8 bytes. */
+		size_t stride = (reader->value_size + 7) & ~(size_t)7;
+		memset(out, 0, reader->out_value_size);
+		for (size_t cpu = 0; cpu < num_cpus; cpu++) {
+			memcpy(out + cpu * stride,
+			       values + cpu * reader->value_size,
+			       reader->value_size);
+		}
+	}
+	return reader->fn(key, reader->key_size, out, reader->out_value_size,
+			  reader->arg);
+}
+
+static struct drgn_error *bpf_map_read_array(struct bpf_map_reader *reader,
+					     uint64_t start, uint64_t end)
+{
+	struct drgn_error *err;
+	size_t count = end - start;
+	size_t size = reader->is_percpu ? reader->word_size :
+		      reader->array_elem_size;
+
+	if (!kernel_char_vector_reserve(&reader->elems, count * size))
+		return &drgn_enomem;
+	err = drgn_program_read_memory(reader->prog, reader->elems.data,
+				       reader->array_values + start * size,
+				       count * size, false);
+	if (err)
+		return err;
+
+	if (reader->is_percpu) {
+		reader->pptrs.size = 0;
+		if (!kernel_uint64_vector_reserve(&reader->pptrs, count))
+			return &drgn_enomem;
+		for (size_t i = 0; i < count; i++) {
+			reader->pptrs.data[reader->pptrs.size++] =
+				bpf_map_get_uint(reader,
+						 reader->elems.data + i * size,
+						 size);
+		}
+		err = bpf_map_read_percpu(reader);
+		if (err)
+			return err;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		char key[4];
+		bpf_map_put_uint(reader, key, sizeof(key), start + i);
+		if (reader->is_percpu) {
+			err = bpf_map_report_percpu(reader, key, i);
+		} else {
+			err = reader->fn(key, sizeof(key),
+					 reader->elems.data + i * size,
+					 reader->value_size, reader->arg);
+		}
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Read the hash table buckets [start, end). The chains are walked one level at
+ * a time so that the elements at each level can be read together.
+ */
+static struct drgn_error *bpf_map_read_hash(struct bpf_map_reader *reader,
+					    uint64_t start, uint64_t end)
+{
+	struct drgn_error *err;
+	size_t count = end - start;
+
+	if (!kernel_char_vector_reserve(&reader->elems,
+					 count * reader->bucket_size))
+		return &drgn_enomem;
+	err = drgn_program_read_memory(reader->prog, reader->elems.data,
+				       reader->buckets +
+				       start * reader->bucket_size,
+				       count * reader->bucket_size, false);
+	if (err)
+		return err;
+	reader->nodes.size = 0;
+	for (size_t i = 0; i < count; i++) {
+		uint64_t first =
+			bpf_map_get_uint(reader,
+					 reader->elems.data +
+					 i * reader->bucket_size +
+					 reader->bucket_first_offset,
+					 reader->word_size);
+		/* The end of an hlist_nulls chain has the low bit set. */
+		if (!(first & 1)) {
+			if (!kernel_uint64_vector_append(&reader->nodes,
+							  &first))
+				return &drgn_enomem;
+		}
+	}
+
+	/* Bound the chains in case the map is being modified or corrupted. */
+	uint64_t max_depth = (uint64_t)reader->max_entries +
+			     reader->cpu_offsets.size + 1;
+	for (uint64_t depth = 0; reader->nodes.size; depth++) {
+		if (depth > max_depth) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "BPF map hash chain is too long");
+		}
+
+		size_t n = reader->nodes.size;
+		reader->reads.size = 0;
+		if (!kernel_read_vector_reserve(&reader->reads, n) ||
+		    !kernel_char_vector_reserve(&reader->elems,
+						 n * reader->htab_elem_size))
+			return &drgn_enomem;
+		for (size_t i = 0; i < n; i++) {
+			struct kernel_read *read =
+				kernel_read_vector_append_entry(&reader->reads);
+			read->address = (reader->nodes.data[i] -
+					 reader->hash_node_offset);
+			read->index = i;
+		}
+		err = kernel_read_scattered(reader->prog, &reader->reads,
+					    reader->htab_elem_size, false,
+					    &reader->staging,
+					    reader->elems.data);
+		if (err)
+			return err;
+
+		if (reader->is_percpu) {
+			reader->pptrs.size = 0;
+			if (!kernel_uint64_vector_reserve(&reader->pptrs, n))
+				return &drgn_enomem;
+			for (size_t i = 0; i < n; i++) {
+				/*
+				 * The per-CPU pointer follows the unaligned
+				 * key; see htab_elem_get_ptr().
+				 */
+				const char *elem = (reader->elems.data +
+						    i * reader->htab_elem_size);
+				reader->pptrs.data[reader->pptrs.size++] =
+					bpf_map_get_uint(reader,
+							 elem +
+							 reader->key_offset +
+							 reader->key_size,
+							 reader->word_size);
+			}
+			err = bpf_map_read_percpu(reader);
+			if (err)
+				return err;
+		}
+
+		reader->next_nodes.size = 0;
+		for (size_t i = 0; i < n; i++) {
+			const char *elem = (reader->elems.data +
+					    i * reader->htab_elem_size);
+			const char *key = elem + reader->key_offset;
+			if (reader->is_percpu) {
+				err = bpf_map_report_percpu(reader, key, i);
+			} else {
+				size_t value_offset =
+					(reader->key_size + 7) & ~(size_t)7;
+				err = reader->fn(key, reader->key_size,
+						 key + value_offset,
+						 reader->value_size,
+						 reader->arg);
+			}
+			if (err)
+				return err;
+
+			/* hlist_nulls_node::next */
+			uint64_t next =
+				bpf_map_get_uint(reader,
+						 elem + reader->hash_node_offset,
+						 reader->word_size);
+			if (!(next & 1)) {
+				if (!kernel_uint64_vector_append(&reader->next_nodes,
+								  &next))
+					return &drgn_enomem;
+			}
+		}
+		struct kernel_uint64_vector tmp = reader->nodes;
+		reader->nodes = reader->next_nodes;
+		reader->next_nodes = tmp;
+	}
+	return NULL;
+}
+
+static struct drgn_error *bpf_map_reader_init_cpus(struct bpf_map_reader *reader)
+{
+	return kernel_possible_cpus(reader->prog, reader->bswap,
+				    reader->word_size, NULL,
+				    &reader->cpu_offsets);
+}
+
+static struct drgn_error *bpf_map_reader_init(struct bpf_map_reader *reader,
+					      struct drgn_program *prog,
+					      uint64_t map,
+					      unsigned int sum_size)
+{
+	struct drgn_error *err;
+
+	memset(reader, 0, sizeof(*reader));
+	reader->prog = prog;
+	reader->sum_size = sum_size;
+	kernel_uint64_vector_init(&reader->cpu_offsets);
+	kernel_read_vector_init(&reader->reads);
+	kernel_char_vector_init(&reader->staging);
+	kernel_char_vector_init(&reader->elems);
+	kernel_char_vector_init(&reader->percpu_values);
+	kernel_char_vector_init(&reader->out_value);
+	kernel_uint64_vector_init(&reader->nodes);
+	kernel_uint64_vector_init(&reader->next_nodes);
+	kernel_uint64_vector_init(&reader->pptrs);
+
+	if (sum_size != 0 && sum_size != 1 && sum_size != 2 &&
+	    sum_size != 4 && sum_size != 8) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "per-CPU sum size must be 1, 2, 4, or 8");
+	}
+	err = drgn_program_bswap(prog, &reader->bswap);
+	if (err)
+		return err;
+	err = drgn_program_word_size(prog, &reader->word_size);
+	if (err)
+		return err;
+
+	struct kernel_field map_type, key_size, value_size, max_entries;
+	if ((err = kernel_find_field(prog, "struct bpf_map", "map_type",
+				     &map_type)) ||
+	    (err = kernel_find_field(prog, "struct bpf_map", "key_size",
+				     &key_size)) ||
+	    (err = kernel_find_field(prog, "struct bpf_map", "value_size",
+				     &value_size)) ||
+	    (err = kernel_find_field(prog, "struct bpf_map", "max_entries",
+				     &max_entries)))
+		return err;
+	struct kernel_field map_fields[] = {
+		map_type, key_size, value_size, max_entries,
+	};
+	uint64_t span_start, span_size;
+	kernel_field_span(map_fields, ARRAY_SIZE(map_fields), &span_start,
+			  &span_size);
+	if (!kernel_char_vector_reserve(&reader->elems, span_size))
+		return &drgn_enomem;
+	err = drgn_program_read_memory(prog, reader->elems.data,
+				       map + span_start, span_size, false);
+	if (err)
+		return err;
+	uint64_t type = kernel_field_get(reader->elems.data, span_start,
+					 map_type, reader->bswap);
+	reader->key_size = kernel_field_get(reader->elems.data, span_start,
+					    key_size, reader->bswap);
+	reader->value_size = kernel_field_get(reader->elems.data, span_start,
+					      value_size, reader->bswap);
+	reader->max_entries = kernel_field_get(reader->elems.data, span_start,
+					       max_entries, reader->bswap);
+
+	static const struct {
+		const char *name;
+		bool is_hash;
+		bool is_percpu;
+	} map_types[] = {
+		{ "BPF_MAP_TYPE_HASH", true, false },
+		{ "BPF_MAP_TYPE_ARRAY", false, false },
+		{ "BPF_MAP_TYPE_PERCPU_HASH", true, true },
+		{ "BPF_MAP_TYPE_PERCPU_ARRAY", false, true },
+		{ "BPF_MAP_TYPE_LRU_HASH", true, false },
+		{ "BPF_MAP_TYPE_LRU_PERCPU_HASH", true, true },
+	};
+	size_t i;
+	for (i = 0; i < ARRAY_SIZE(map_types); i++) {
+		uint64_t value;
+		err = kernel_optional_constant(prog, map_types[i].name, &value);
+		if (err)
+			return err;
+		if (value == type)
+			break;
+	}
+	if (i == ARRAY_SIZE(map_types)) {
+		return drgn_error_format(DRGN_ERROR_INVALID_ARGUMENT,
+					 "unsupported BPF map type %" PRIu64,
+					 type);
+	}
+	reader->is_hash = map_types[i].is_hash;
+	reader->is_percpu = map_types[i].is_percpu;
+
+	struct drgn_member_info member;
+	if (reader->is_hash) {
+		struct kernel_field buckets, n_buckets, elem_size;
+		if ((err = kernel_find_field(prog, "struct bpf_htab",
+					     "buckets", &buckets)) ||
+		    (err = kernel_find_field(prog, "struct bpf_htab",
+					     "n_buckets", &n_buckets)) ||
+		    (err = kernel_find_field(prog, "struct bpf_htab",
+					     "elem_size", &elem_size)) ||
+		    (err = kernel_member_info(prog, "struct bucket", "head",
+					      &member)))
+			return err;
+		reader->bucket_first_offset = member.bit_offset / 8;
+		struct drgn_qualified_type bucket_type;
+		if ((err = drgn_program_find_type(prog, "struct bucket", NULL,
+						  &bucket_type)) ||
+		    (err = drgn_type_sizeof(bucket_type.type,
+					    &reader->bucket_size)) ||
+		    (err = kernel_member_info(prog, "struct htab_elem",
+					      "hash_node", &member)))
+			return err;
+		reader->hash_node_offset = member.bit_offset / 8;
+		err = kernel_member_info(prog, "struct htab_elem", "key",
+					 &member);
+		if (err)
+			return err;
+		reader->key_offset = member.bit_offset / 8;
+
+		/* The map is the first member of struct bpf_htab. */
+		uint64_t value;
+		if ((err = kernel_read_field(prog, reader->bswap, map,
+					     buckets, &reader->buckets)) ||
+		    (err = kernel_read_field(prog, reader->bswap, map,
+					     n_buckets, &value)))
+			return err;
+		reader->n_buckets = value;
+		err = kernel_read_field(prog, reader->bswap, map, elem_size,
+					&value);
+		if (err)
+			return err;
+		reader->htab_elem_size = value;
+		if (reader->htab_elem_size < reader->key_offset +
+		    reader->key_size + (reader->is_percpu ?
+					reader->word_size :
+					reader->value_size)) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "BPF hash map element is too small");
+		}
+	} else {
+		struct kernel_field elem_size;
+		err = kernel_find_field(prog, "struct bpf_array", "elem_size",
+					&elem_size);
+		if (err)
+			return err;
+		err = kernel_member_info(prog, "struct bpf_array",
+					 reader->is_percpu ? "pptrs" : "value",
+					 &member);
+		if (err)
+			return err;
+		reader->array_values = map + member.bit_offset / 8;
+		uint64_t value;
+		err = kernel_read_field(prog, reader->bswap, map, elem_size,
+					&value);
+		if (err)
+			return err;
+		reader->array_elem_size = value;
+		if (!reader->is_percpu &&
+		    reader->array_elem_size < reader->value_size) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "BPF array map element is too small");
+		}
+	}
+
+	if (reader->is_percpu) {
+		if (sum_size && reader->value_size % sum_size) {
+			return drgn_error_format(DRGN_ERROR_INVALID_ARGUMENT,
+						 "BPF map value size %" PRIu32 " is not a multiple of %u",
+						 reader->value_size, sum_size);
+		}
+		err = bpf_map_reader_init_cpus(reader);
+		if (err)
+			return err;
+		if (sum_size) {
+			reader->out_value_size = reader->value_size;
+		} else {
+			reader->out_value_size =
+				((reader->value_size + 7) & ~(size_t)7) *
+				reader->cpu_offsets.size;
+		}
+		if (!kernel_char_vector_reserve(&reader->out_value,
+						 reader->out_value_size))
+			return &drgn_enomem;
+	}
+	return NULL;
+}
+
+struct linux_helper_bpf_map {
+	struct bpf_map_reader reader;
+	/* Next bucket or index to read, and the number of them. */
+	uint64_t pos, end;
+};
+
+struct drgn_error *linux_helper_bpf_map_create(struct drgn_program *prog,
+					       uint64_t map,
+					       unsigned int sum_size,
+					       struct linux_helper_bpf_map **ret)
+{
+	struct drgn_error *err;
+	struct linux_helper_bpf_map *it = malloc(sizeof(*it));
+	if (!it)
+		return &drgn_enomem;
+	err = bpf_map_reader_init(&it->reader, prog, map, sum_size);
+	if (err) {
+		bpf_map_reader_deinit(&it->reader);
+		free(it);
+		return err;
+	}
+	it->pos = 0;
+	it->end = (it->reader.is_hash ? it->reader.n_buckets :
+		   it->reader.max_entries);
+	*ret = it;
+	return NULL;
+}
+
+void linux_helper_bpf_map_destroy(struct linux_helper_bpf_map *it)
+{
+	if (it) {
+		bpf_map_reader_deinit(&it->reader);
+		free(it);
+	}
+}
+
+struct drgn_error *linux_helper_bpf_map_read(struct linux_helper_bpf_map *it,
+					     uint64_t batch_size,
+					     linux_helper_bpf_map_fn *fn,
+					     void *arg)
+{
+	struct drgn_error *err;
+	struct bpf_map_reader *reader = &it->reader;
+
+	if (it->pos >= it->end)
+		return &drgn_stop;
+	if (!reader->is_hash) {
+		/* Don't read too much at once for huge values. */
+		uint64_t size = reader->is_percpu ? reader->word_size :
+				reader->array_elem_size;
+		uint64_t max_batch = size ? KERNEL_READ_MAX / size : 1;
+		if (batch_size > max_batch)
+			batch_size = max_batch ? max_batch : 1;
+	}
+	if (batch_size == 0)
+		batch_size = 1;
+	if (batch_size > it->end - it->pos)
+		batch_size = it->end - it->pos;
+	reader->fn = fn;
+	reader->arg = arg;
+	if (reader->is_hash)
+		err = bpf_map_read_hash(reader, it->pos, it->pos + batch_size);
+	else
+		err = bpf_map_read_array(reader, it->pos, it->pos + batch_size);
+	if (err)
+		return err;
+	it->pos += batch_size;
+	return NULL;
+}
+
+/*
+ * ftrace ring buffer.
+ *
+ * Each CPU has a ring of struct buffer_page, each of which points to a struct
+ * buffer_data_page containing a timestamp, the number of committed bytes, and
+ * the events. Reading swaps a spare reader page with the head of the ring, so
+ * the unread part of the reader page comes first, followed by the ring from
+ * the head page through the commit page.
+ */
+
+/* Types of struct ring_buffer_event. */
+#define FTRACE_TYPE_DATA_TYPE_LEN_MAX 28
+#define FTRACE_TYPE_PADDING 29
+#define FTRACE_TYPE_TIME_EXTEND 30
+#define FTRACE_TYPE_TIME_STAMP 31
+#define FTRACE_TS_SHIFT 27
+/* Absolute timestamps don't include the most significant bits. */
+#define FTRACE_TS_MSB (UINT64_C(0xf8) << 56)
+/* The rest of buffer_data_page::commit is flags. */
+#define FTRACE_COMMIT_MASK ((UINT64_C(1) << 27) - 1)
+/* Bound on list walks in case of corruption. */
+#define FTRACE_MAX_LIST_LENGTH (1 << 20)
+
+struct ftrace_field {
+	char *name;
+	char *type;
+	uint32_t offset;
+	uint32_t size;
+	bool is_signed;
+};
+
+DEFINE_VECTOR(ftrace_field_vector, struct ftrace_field)
+
+struct ftrace_event_format {
+	uint16_t id;
+	char *name;
+	char *system;
+	char *print_fmt;
+	struct ftrace_field_vector fields;
+};
+
+DEFINE_VECTOR(ftrace_event_format_vector, struct ftrace_event_format)
+/* Map from event type ID to index in the format vector. */
+DEFINE_HASH_MAP(ftrace_event_id_map, uint16_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+
+struct ftrace_cpu {
+	uint64_t cpu;
+	/* Addresses of struct buffer_data_page to read, in order. */
+	struct kernel_uint64_vector pages;
+	/* Number of bytes already consumed from the first page. */
+	uint64_t reader_read;
+	size_t next_page;
+	char *page;
+	/* Offsets in page. */
+	size_t pos, data_end, skip_end;
+	uint64_t ts;
+	bool has_event;
+	struct linux_helper_ftrace_event event;
+};
+
+struct linux_helper_ftrace {
+	struct drgn_program *prog;
+	bool bswap;
+	bool little_endian;
+	uint8_t word_size;
+	uint64_t page_size;
+	/* struct buffer_data_page */
+	struct kernel_field time_stamp, commit;
+	uint64_t data_offset;
+	struct ftrace_cpu *cpus;
+	size_t num_cpus;
+	/* Min-heap of indices of CPUs with a pending event. */
+	size_t *heap;
+	size_t heap_size;
+	bool started;
+	/* CPU of the last returned event, which is advanced lazily. */
+	struct ftrace_cpu *last;
+	struct ftrace_event_format_vector formats;
+	struct ftrace_event_id_map ids;
+	struct ftrace_field_vector common_fields;
+	struct string_builder text;
+};
+
+static void ftrace_fields_deinit(struct ftrace_field_vector *fields)
+{
+	for (size_t i = 0; i < fields->size; i++) {
+		free(fields->data[i].name);
+		free(fields->data[i].type);
+	}
+	ftrace_field_vector_deinit(fields);
+}
+
+void linux_helper_ftrace_destroy(struct linux_helper_ftrace *ftrace)
+{
+	if (!ftrace)
+		return;
+	free(ftrace->text.str);
+	ftrace_fields_deinit(&ftrace->common_fields);
+	ftrace_event_id_map_deinit(&ftrace->ids);
+	for (size_t i = 0; i < ftrace->formats.size; i++) {
+		struct ftrace_event_format *format = &ftrace->formats.data[i];
+		free(format->name);
+		free(format->system);
+		free(format->print_fmt);
+		ftrace_fields_deinit(&format->fields);
+	}
+	ftrace_event_format_vector_deinit(&ftrace->formats);
+	free(ftrace->heap);
+	for (size_t i = 0; i < ftrace->num_cpus; i++) {
+		free(ftrace->cpus[i].page);
+		kernel_uint64_vector_deinit(&ftrace->cpus[i].pages);
+	}
+	free(ftrace->cpus);
+	free(ftrace);
+}
+
+static struct drgn_error *ftrace_read_word(struct linux_helper_ftrace *ftrace,
+					   uint64_t address, uint64_t *ret)
+{
+	struct kernel_field field = { .size = ftrace->word_size };
+	return kernel_read_field(ftrace->prog, ftrace->bswap, address, field,
+				 ret);
+}
+
+/* Read a string, or return NULL for a NULL pointer. */
+static struct drgn_error *ftrace_read_string(struct linux_helper_ftrace *ftrace,
+					     uint64_t address, char **ret)
+{
+	struct drgn_error *err;
+	if (!address) {
+		*ret = NULL;
+		return NULL;
+	}
+	struct kernel_char_vector vec = VECTOR_INIT;
+	err = kernel_read_c_string(ftrace->prog, address, &vec);
+	if (!err && !kernel_char_vector_append(&vec, &(char){'\0'}))
+		err = &drgn_enomem;
+	if (err) {
+		kernel_char_vector_deinit(&vec);
+		return err;
+	}
+	kernel_char_vector_shrink_to_fit(&vec);
+	*ret = vec.data;
+	return NULL;
+}
+
+struct ftrace_field_info {
+	uint64_t link_offset, list_prev_offset;
+	struct kernel_field name, type, offset, size, is_signed;
+};
+
+/*
+ * Read a list of struct ftrace_event_field. The list is walked backwards,
+ * which is the order that the fields were defined in.
+ */
+static struct drgn_error *ftrace_read_fields(struct linux_helper_ftrace *ftrace,
+					     const struct ftrace_field_info *info,
+					     uint64_t head,
+					     struct ftrace_field_vector *fields)
+{
+	struct drgn_error *err;
+	uint64_t pos;
+	err = ftrace_read_word(ftrace, head + info->list_prev_offset, &pos);
+	if (err)
+		return err;
+	for (size_t i = 0; pos != head; i++) {
+		if (i >= FTRACE_MAX_LIST_LENGTH) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "ftrace event field list is too long");
+		}
+		uint64_t field_address = pos - info->link_offset;
+		uint64_t name, type, offset, size, is_signed;
+		if ((err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					     field_address, info->name,
+					     &name)) ||
+		    (err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					     field_address, info->type,
+					     &type)) ||
+		    (err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					     field_address, info->offset,
+					     &offset)) ||
+		    (err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					     field_address, info->size,
+					     &size)) ||
+		    (err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					     field_address, info->is_signed,
+					     &is_signed)))
+			return err;
+		struct ftrace_field *field =
+			ftrace_field_vector_append_entry(fields);
+		if (!field)
+			return &drgn_enomem;
+		*field = (struct ftrace_field){
+			.offset = offset,
+			.size = size,
+			.is_signed = is_signed,
+		};
+		if ((err = ftrace_read_string(ftrace, name, &field->name)) ||
+		    (err = ftrace_read_string(ftrace, type, &field->type)))
+			return err;
+		if (!field->name || !field->type) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "ftrace event field has no name or type");
+		}
+		err = ftrace_read_word(ftrace, pos + info->list_prev_offset,
+				       &pos);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+static struct drgn_error *ftrace_list_head_address(struct drgn_program *prog,
+						   const char *name,
+						   uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_object obj;
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, name, NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (!err) {
+		if (obj.is_reference) {
+			*ret = obj.reference.address;
+		} else {
+			err = drgn_error_format(DRGN_ERROR_TYPE,
+						"%s is not a reference", name);
+		}
+	}
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+/* Read the formats of every event from the ftrace_events list once. */
+static struct drgn_error *ftrace_load_formats(struct linux_helper_ftrace *ftrace)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = ftrace->prog;
+	struct drgn_member_info member;
+	struct ftrace_field_info field_info;
+
+	if ((err = kernel_member_info(prog, "struct ftrace_event_field",
+				      "link", &member)))
+		return err;
+	field_info.link_offset = member.bit_offset / 8;
+	if ((err = kernel_member_info(prog, "struct list_head", "prev",
+				      &member)))
+		return err;
+	field_info.list_prev_offset = member.bit_offset / 8;
+	if ((err = kernel_find_field(prog, "struct ftrace_event_field", "name",
+				     &field_info.name)) ||
+	    (err = kernel_find_field(prog, "struct ftrace_event_field", "type",
+				     &field_info.type)) ||
+	    (err = kernel_find_field(prog, "struct ftrace_event_field",
+				     "offset", &field_info.offset)) ||
+	    (err = kernel_find_field(prog, "struct ftrace_event_field", "size",
+				     &field_info.size)) ||
+	    (err = kernel_find_field(prog, "struct ftrace_event_field",
+				     "is_signed", &field_info.is_signed)))
+		return err;
+
+	uint64_t common_fields;
+	err = ftrace_list_head_address(prog, "ftrace_common_fields",
+				       &common_fields);
+	if (err)
+		return err;
+	err = ftrace_read_fields(ftrace, &field_info, common_fields,
+				 &ftrace->common_fields);
+	if (err)
+		return err;
+
+	struct kernel_field call_class, call_name, call_type, call_print_fmt,
+			    call_flags, class_system, tp_name;
+	uint64_t list_offset, class_fields_offset;
+	if ((err = kernel_member_info(prog, "struct trace_event_call", "list",
+				      &member)))
+		return err;
+	list_offset = member.bit_offset / 8;
+	if ((err = kernel_member_info(prog, "struct trace_event_class",
+				      "fields", &member)))
+		return err;
+	class_fields_offset = member.bit_offset / 8;
+	struct drgn_member_info event_member;
+	if ((err = kernel_member_info(prog, "struct trace_event_call", "event",
+				      &event_member)) ||
+	    (err = kernel_find_field(prog, "struct trace_event", "type",
+				     &call_type)) ||
+	    (err = kernel_find_field(prog, "struct trace_event_call", "class",
+				     &call_class)) ||
+	    (err = kernel_find_field(prog, "struct trace_event_call", "name",
+				     &call_name)) ||
+	    (err = kernel_find_field(prog, "struct trace_event_call",
+				     "print_fmt", &call_print_fmt)) ||
+	    (err = kernel_find_field(prog, "struct trace_event_call", "flags",
+				     &call_flags)) ||
+	    (err = kernel_find_field(prog, "struct trace_event_class",
+				     "system", &class_system)) ||
+	    (err = kernel_find_field(prog, "struct tracepoint", "name",
+				     &tp_name)))
+		return err;
+	call_type.offset += event_member.bit_offset / 8;
+
+	struct drgn_object obj;
+	union drgn_value fl_tracepoint;
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, "TRACE_EVENT_FL_TRACEPOINT",
+				       NULL, DRGN_FIND_OBJECT_CONSTANT, &obj);
+	if (!err)
+		err = drgn_object_read_integer(&obj, &fl_tracepoint);
+	drgn_object_deinit(&obj);
+	if (err)
+		return err;
+
+	uint64_t head;
+	err = ftrace_list_head_address(prog, "ftrace_events", &head);
+	if (err)
+		return err;
+	uint64_t pos;
+	err = ftrace_read_word(ftrace, head, &pos);
+	if (err)
+		return err;
+	for (size_t i = 0; pos != head; i++) {
+		if (i >= FTRACE_MAX_LIST_LENGTH) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "ftrace_events list is too long");
+		}
+		uint64_t call = pos - list_offset;
+		uint64_t class, name, type, print_fmt, flags, system;
+		if ((err = kernel_read_field(prog, ftrace->bswap, call,
+					     call_class, &class)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, call,
+					     call_name, &name)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, call,
+					     call_type, &type)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, call,
+					     call_print_fmt, &print_fmt)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, call,
+					     call_flags, &flags)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, class,
+					     class_system, &system)))
+			return err;
+		/* name is a union with the tracepoint. */
+		if (flags & fl_tracepoint.uvalue) {
+			err = kernel_read_field(prog, ftrace->bswap, name,
+						tp_name, &name);
+			if (err)
+				return err;
+		}
+
+		struct ftrace_event_format *format =
+			ftrace_event_format_vector_append_entry(&ftrace->formats);
+		if (!format)
+			return &drgn_enomem;
+		*format = (struct ftrace_event_format){ .id = type };
+		ftrace_field_vector_init(&format->fields);
+		if ((err = ftrace_read_string(ftrace, name, &format->name)) ||
+		    (err = ftrace_read_string(ftrace, system,
+					      &format->system)) ||
+		    (err = ftrace_read_string(ftrace, print_fmt,
+					      &format->print_fmt)) ||
+		    (err = ftrace_read_fields(ftrace, &field_info,
+					      class + class_fields_offset,
+					      &format->fields)))
+			return err;
+
+		struct ftrace_event_id_map_entry entry = {
+			.key = format->id,
+			.value = ftrace->formats.size - 1,
+		};
+		if (ftrace_event_id_map_insert(&ftrace->ids, &entry, NULL) < 0)
+			return &drgn_enomem;
+
+		err = ftrace_read_word(ftrace, pos, &pos);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+static struct drgn_error *
+ftrace_find_ring_buffer(struct linux_helper_ftrace *ftrace,
+			uint64_t trace_array, uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = ftrace->prog;
+	struct drgn_member_info outer, inner;
+
+	if (!trace_array) {
+		err = ftrace_list_head_address(prog, "global_trace",
+					       &trace_array);
+		if (err)
+			return err;
+	}
+	/* Renamed from trace_buffer in Linux 5.6. */
+	err = kernel_member_info(prog, "struct trace_array", "array_buffer",
+				 &outer);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = kernel_member_info(prog, "struct trace_array",
+					 "trace_buffer", &outer);
+	}
+	if (err)
+		return err;
+	err = drgn_program_member_info(prog, outer.qualified_type.type,
+				       "buffer", &inner);
+	if (err)
+		return err;
+	return ftrace_read_word(ftrace,
+				trace_array + (outer.bit_offset +
+					       inner.bit_offset) / 8,
+				ret);
+}
+
+/* Collect the data pages of each CPU. */
+static struct drgn_error *ftrace_load_pages(struct linux_helper_ftrace *ftrace,
+					    uint64_t trace_array)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = ftrace->prog;
+	struct drgn_member_info member;
+
+	uint64_t ring_buffer;
+	err = ftrace_find_ring_buffer(ftrace, trace_array, &ring_buffer);
+	if (err)
+		return err;
+	if (!ring_buffer) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "trace array has no ring buffer");
+	}
+
+	/* struct ring_buffer was renamed to struct trace_buffer in Linux 5.6. */
+	const char *ring_buffer_type = "struct trace_buffer";
+	struct kernel_field buffers, cpus;
+	err = kernel_find_field(prog, ring_buffer_type, "buffers", &buffers);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		ring_buffer_type = "struct ring_buffer";
+		err = kernel_find_field(prog, ring_buffer_type, "buffers",
+					&buffers);
+	}
+	if (err)
+		return err;
+	err = kernel_find_field(prog, ring_buffer_type, "cpus", &cpus);
+	if (err)
+		return err;
+
+	struct kernel_field nr_pages, head_page, commit_page, reader_page;
+	struct kernel_field page_read, page_page;
+	uint64_t page_list_offset;
+	if ((err = kernel_find_field(prog, "struct ring_buffer_per_cpu",
+				     "nr_pages", &nr_pages)) ||
+	    (err = kernel_find_field(prog, "struct ring_buffer_per_cpu",
+				     "head_page", &head_page)) ||
+	    (err = kernel_find_field(prog, "struct ring_buffer_per_cpu",
+				     "commit_page", &commit_page)) ||
+	    (err = kernel_find_field(prog, "struct ring_buffer_per_cpu",
+				     "reader_page", &reader_page)) ||
+	    (err = kernel_find_field(prog, "struct buffer_page", "read",
+				     &page_read)) ||
+	    (err = kernel_find_field(prog, "struct buffer_page", "page",
+				     &page_page)) ||
+	    (err = kernel_member_info(prog, "struct buffer_page", "list",
+				      &member)))
+		return err;
+	page_list_offset = member.bit_offset / 8;
+
+	uint64_t num_cpus, buffers_address;
+	if ((err = kernel_read_field(prog, ftrace->bswap, ring_buffer, cpus,
+				     &num_cpus)) ||
+	    (err = kernel_read_field(prog, ftrace->bswap, ring_buffer, buffers,
+				     &buffers_address)))
+		return err;
+	/* cpus is an int. */
+	if (num_cpus > INT32_MAX) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "invalid number of ring buffer CPUs");
+	}
+	ftrace->cpus = calloc(num_cpus, sizeof(ftrace->cpus[0]));
+	ftrace->heap = malloc_array(num_cpus, sizeof(ftrace->heap[0]));
+	if ((num_cpus && (!ftrace->cpus || !ftrace->heap)))
+		return &drgn_enomem;
+	ftrace->num_cpus = num_cpus;
+	for (size_t i = 0; i < num_cpus; i++) {
+		ftrace->cpus[i].cpu = i;
+		kernel_uint64_vector_init(&ftrace->cpus[i].pages);
+	}
+
+	for (size_t i = 0; i < num_cpus; i++) {
+		struct ftrace_cpu *cpu = &ftrace->cpus[i];
+		uint64_t cpu_buffer;
+		err = ftrace_read_word(ftrace,
+				       buffers_address + i * ftrace->word_size,
+				       &cpu_buffer);
+		if (err)
+			return err;
+		/* Only possible CPUs have a buffer. */
+		if (!cpu_buffer)
+			continue;
+
+		uint64_t num_pages, head, commit, reader, data_page;
+		if ((err = kernel_read_field(prog, ftrace->bswap, cpu_buffer,
+					     nr_pages, &num_pages)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, cpu_buffer,
+					     head_page, &head)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, cpu_buffer,
+					     commit_page, &commit)) ||
+		    (err = kernel_read_field(prog, ftrace->bswap, cpu_buffer,
+					     reader_page, &reader)))
+			return err;
+
+		if (reader) {
+			if ((err = kernel_read_field(prog, ftrace->bswap,
+						     reader, page_read,
+						     &cpu->reader_read)) ||
+			    (err = kernel_read_field(prog, ftrace->bswap,
+						     reader, page_page,
+						     &data_page)))
+				return err;
+			if (!kernel_uint64_vector_append(&cpu->pages,
+							 &data_page))
+				return &drgn_enomem;
+		}
+		/* If the writer is on the reader page, the ring is empty. */
+		if (reader == commit || !head)
+			continue;
+		uint64_t page = head;
+		for (uint64_t j = 0; j <= num_pages; j++) {
+			uint64_t next;
+			if ((err = kernel_read_field(prog, ftrace->bswap, page,
+						     page_page,
+						     &data_page)) ||
+			    (err = ftrace_read_word(ftrace,
+						    page + page_list_offset,
+						    &next)))
+				return err;
+			if (!kernel_uint64_vector_append(&cpu->pages,
+							 &data_page))
+				return &drgn_enomem;
+			if (page == commit)
+				break;
+			/* The low bits of the list pointers are flags. */
+			page = (next & ~(uint64_t)3) - page_list_offset;
+		}
+	}
+	return NULL;
+}
+
+struct drgn_error *linux_helper_ftrace_create(struct drgn_program *prog,
+					      uint64_t trace_array,
+					      struct linux_helper_ftrace **ret)
+{
+	struct drgn_error *err;
+
+	if (!prog->vmcoreinfo.page_size) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "page size is not known");
+	}
+
+	struct linux_helper_ftrace *ftrace = calloc(1, sizeof(*ftrace));
+	if (!ftrace)
+		return &drgn_enomem;
+	ftrace->prog = prog;
+	ftrace->page_size = prog->vmcoreinfo.page_size;
+	ftrace_event_format_vector_init(&ftrace->formats);
+	ftrace_event_id_map_init(&ftrace->ids);
+	ftrace_field_vector_init(&ftrace->common_fields);
+
+	struct drgn_member_info data;
+	if ((err = drgn_program_bswap(prog, &ftrace->bswap)) ||
+	    (err = drgn_program_is_little_endian(prog,
+						 &ftrace->little_endian)) ||
+	    (err = drgn_program_word_size(prog, &ftrace->word_size)) ||
+	    (err = kernel_find_field(prog, "struct buffer_data_page",
+				     "time_stamp", &ftrace->time_stamp)) ||
+	    (err = kernel_find_field(prog, "struct buffer_data_page",
+				     "commit", &ftrace->commit)) ||
+	    (err = kernel_member_info(prog, "struct buffer_data_page", "data",
+				      &data)))
+		goto err;
+	ftrace->data_offset = data.bit_offset / 8;
+	if (ftrace->data_offset >= ftrace->page_size) {
+		err = drgn_error_create(DRGN_ERROR_OTHER,
+					"unexpected struct buffer_data_page layout");
+		goto err;
+	}
+
+	if ((err = ftrace_load_formats(ftrace)) ||
+	    (err = ftrace_load_pages(ftrace, trace_array)))
+		goto err;
+	*ret = ftrace;
+	return NULL;
+
+err:
+	linux_helper_ftrace_destroy(ftrace);
+	return err;
+}
+
+static struct drgn_error *ftrace_cpu_load_page(struct linux_helper_ftrace *ftrace,
+					       struct ftrace_cpu *cpu)
+{
+	struct drgn_error *err;
+	if (!cpu->page) {
+		cpu->page = malloc(ftrace->page_size);
+		if (!cpu->page)
+			return &drgn_enomem;
+	}
+	size_t i = cpu->next_page++;
+	err = drgn_program_read_memory(ftrace->prog, cpu->page,
+				       cpu->pages.data[i], ftrace->page_size,
+				       false);
+	if (err)
+		return err;
+	cpu->ts = kernel_field_get(cpu->page, 0, ftrace->time_stamp,
+				   ftrace->bswap);
+	uint64_t commit = kernel_field_get(cpu->page, 0, ftrace->commit,
+					   ftrace->bswap) & FTRACE_COMMIT_MASK;
+	cpu->pos = ftrace->data_offset;
+	cpu->data_end = ftrace->data_offset +
+			min(commit, ftrace->page_size - ftrace->data_offset);
+	cpu->skip_end = i == 0 ? ftrace->data_offset + cpu->reader_read : 0;
+	return NULL;
+}
+
+/* Decode events until the next data event of a CPU. */
+static struct drgn_error *ftrace_cpu_advance(struct linux_helper_ftrace *ftrace,
+					     struct ftrace_cpu *cpu)
+{
+	struct drgn_error *err;
+	struct kernel_field u32_field = { .size = 4 };
+
+	for (;;) {
+		if (cpu->data_end - cpu->pos < 4) {
+			if (cpu->next_page >= cpu->pages.size) {
+				cpu->has_event = false;
+				return NULL;
+			}
+			err = ftrace_cpu_load_page(ftrace, cpu);
+			if (err)
+				return err;
+			continue;
+		}
+
+		size_t pos = cpu->pos;
+		const char *p = cpu->page + pos;
+		size_t avail = cpu->data_end - pos - 4;
+		uint32_t header = kernel_field_get(p, 0, u32_field,
+						   ftrace->bswap);
+		/* type_len:5 and time_delta:27 are bit fields. */
+		unsigned int type_len;
+		uint32_t time_delta;
+		if (ftrace->little_endian) {
+			type_len = header & 0x1f;
+			time_delta = header >> 5;
+		} else {
+			type_len = header >> 27;
+			time_delta = header & ((UINT32_C(1) << 27) - 1);
+		}
+		uint64_t array0 = 0;
+		if (type_len > FTRACE_TYPE_DATA_TYPE_LEN_MAX || type_len == 0) {
+			if (avail < 4) {
+				cpu->pos = cpu->data_end;
+				continue;
+			}
+			array0 = kernel_field_get(p + 4, 0, u32_field,
+						  ftrace->bswap);
+		}
+
+		const char *data;
+		size_t size;
+		switch (type_len) {
+		case FTRACE_TYPE_PADDING:
+			/* Without a delta, the rest of the page is padding. */
+			if (time_delta == 0 || array0 > avail)
+				cpu->pos = cpu->data_end;
+			else
+				cpu->pos += 4 + array0;
+			continue;
+		case FTRACE_TYPE_TIME_EXTEND:
+			cpu->ts += (array0 << FTRACE_TS_SHIFT) + time_delta;
+			cpu->pos += 8;
+			continue;
+		case FTRACE_TYPE_TIME_STAMP: {
+			uint64_t ts = (array0 << FTRACE_TS_SHIFT) + time_delta;
+			if (cpu->ts & FTRACE_TS_MSB) {
+				ts |= cpu->ts & FTRACE_TS_MSB;
+				if (ts < cpu->ts)
+					ts += UINT64_C(1) << 59;
+			}
+			cpu->ts = ts;
+			cpu->pos += 8;
+			continue;
+		}
+		case 0:
+			/* The length includes array[0] itself. */
+			if (array0 < 4 || array0 > avail) {
+				cpu->pos = cpu->data_end;
+				continue;
+			}
+			data = p + 8;
+			size = array0 - 4;
+			cpu->pos += 4 + ((array0 + 3) & ~(uint64_t)3);
+			break;
+		default:
+			size = type_len * 4;
+			if (size > avail) {
+				cpu->pos = cpu->data_end;
+				continue;
+			}
+			data = p + 4;
+			cpu->pos += 4 + size;
+			break;
+		}
+		cpu->ts += time_delta;
+		/* Skip events that were already consumed. */
+		if (pos < cpu->skip_end || size < 2)
+			continue;
+
+		cpu->has_event = true;
+		cpu->event.cpu = cpu->cpu;
+		cpu->event.timestamp = cpu->ts;
+		cpu->event.type = kernel_field_get(data, 0,
+						   (struct kernel_field){
+							   .size = 2
+						   },
+						   ftrace->bswap);
+		struct ftrace_event_id_map_iterator it =
+			ftrace_event_id_map_search(&ftrace->ids,
+						   &cpu->event.type);
+		cpu->event.name = it.entry ?
+				  ftrace->formats.data[it.entry->value].name :
+				  NULL;
+		cpu->event.data = data;
+		cpu->event.size = size;
+		return NULL;
+	}
+}
+
+static bool ftrace_heap_less(struct linux_helper_ftrace *ftrace, size_t a,
+			     size_t b)
+{
+	const struct linux_helper_ftrace_event *x = &ftrace->cpus[a].event;
+	const struct linux_helper_ftrace_event *y = &ftrace->cpus[b].event;
+	return x->timestamp < y->timestamp ||
+	       (x->timestamp == y->timestamp && x->cpu < y->cpu);
+}
+
+static void ftrace_heap_push(struct linux_helper_ftrace *ftrace, size_t cpu)
+{
+	size_t i = ftrace->heap_size++;
+	while (i > 0) {
+		size_t parent = (i - 1) / 2;
+		if (!ftrace_heap_less(ftrace, cpu, ftrace->heap[parent]))
+			break;
+		ftrace->heap[i] = ftrace->heap[parent];
+		i = parent;
+	}
+	ftrace->heap[i] = cpu;
+}
+
+static size_t ftrace_heap_pop(struct linux_helper_ftrace *ftrace)
+{
+	size_t top = ftrace->heap[0];
+	size_t last = ftrace->heap[--ftrace->heap_size];
+	size_t i = 0;
+	for (;;) {
+		size_t child = 2 * i + 1;
+		if (child >= ftrace->heap_size)
+			break;
+		if (child + 1 < ftrace->heap_size &&
+		    ftrace_heap_less(ftrace, ftrace->heap[child + 1],
+				     ftrace->heap[child]))
+			child++;
+		if (!ftrace_heap_less(ftrace, ftrace->heap[child], last))
+			break;
+		ftrace->heap[i] = ftrace->heap[child];
+		i = child;
+	}
+	if (ftrace->heap_size)
+		ftrace->heap[i] = last;
+	return top;
+}
+
+struct drgn_error *
+linux_helper_ftrace_next(struct linux_helper_ftrace *ftrace,
+			 const struct linux_helper_ftrace_event **ret)
+{
+	struct drgn_error *err;
+
+	if (!ftrace->started) {
+		for (size_t i = 0; i < ftrace->num_cpus; i++) {
+			err = ftrace_cpu_advance(ftrace, &ftrace->cpus[i]);
+			if (err)
+				return err;
+			if (ftrace->cpus[i].has_event)
+				ftrace_heap_push(ftrace, i);
+		}
+		ftrace->started = true;
+	} else if (ftrace->last) {
+		/*
+		 * The previous event's data is in the page of its CPU, so that
+		 * CPU isn't advanced until now.
+		 */
+		struct ftrace_cpu *cpu = ftrace->last;
+		ftrace->last = NULL;
+		err = ftrace_cpu_advance(ftrace, cpu);
+		if (err)
+			return err;
+		if (cpu->has_event)
+			ftrace_heap_push(ftrace, cpu - ftrace->cpus);
+	}
+	if (!ftrace->heap_size)
+		return &drgn_stop;
+	ftrace->last = &ftrace->cpus[ftrace_heap_pop(ftrace)];
+	*ret = &ftrace->last->event;
+	return NULL;
+}
+
+static bool ftrace_append_escaped(struct string_builder *sb, const char *s,
+				  size_t len)
+{
+	for (size_t i = 0; i < len && s[i]; i++) {
+		unsigned char c = s[i];
+		if (isprint(c) && c != '\\') {
+			if (!string_builder_appendc(sb, c))
+				return false;
+		} else if (!string_builder_appendf(sb, "\\x%02x", c)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool ftrace_append_hex(struct string_builder *sb, const char *s,
+			      size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if (!string_builder_appendf(sb, "%02x", (unsigned char)s[i]))
+			return false;
+	}
+	return true;
+}
+
+static bool ftrace_append_field(struct linux_helper_ftrace *ftrace,
+				struct string_builder *sb,
+				const struct ftrace_field *field,
+				const char *data, size_t size)
+{
+	if (!string_builder_appendf(sb, " %s=", field->name))
+		return false;
+	if (field->offset > size || field->size > size - field->offset)
+		return string_builder_appendc(sb, '?');
+	const char *p = data + field->offset;
+
+	bool data_loc = strncmp(field->type, "__data_loc", 10) == 0;
+	bool rel_loc = strncmp(field->type, "__rel_loc", 9) == 0;
+	if ((data_loc || rel_loc) && field->size == 4) {
+		/* The offset is in the low 16 bits and the length in the high. */
+		uint32_t loc = kernel_field_get(p, 0,
+						(struct kernel_field){ .size = 4 },
+						ftrace->bswap);
+		size_t offset = loc & 0xffff, len = loc >> 16;
+		if (rel_loc)
+			offset += field->offset + field->size;
+		if (offset > size || len > size - offset)
+			return string_builder_appendc(sb, '?');
+		if (strstr(field->type, "char"))
+			return ftrace_append_escaped(sb, data + offset, len);
+		return ftrace_append_hex(sb, data + offset, len);
+	}
+	if (strchr(field->type, '[')) {
+		/* A flexible array at the end of the event has a size of 0. */
+		size_t len = field->size ? field->size : size - field->offset;
+		if (strncmp(field->type, "char", 4) == 0 ||
+		    strncmp(field->type, "const char", 10) == 0)
+			return ftrace_append_escaped(sb, p, len);
+		return ftrace_append_hex(sb, p, len);
+	}
+	switch (field->size) {
+	case 1:
+	case 2:
+	case 4:
+	case 8: {
+		uint64_t value = kernel_field_get(p, 0,
+						  (struct kernel_field){
+							  .size = field->size
+						  },
+						  ftrace->bswap);
+		if (field->is_signed) {
+			unsigned int shift = 64 - 8 * field->size;
+			int64_t svalue = (int64_t)(value << shift) >> shift;
+			return string_builder_appendf(sb, "%" PRId64, svalue);
+		} else if (strchr(field->type, '*')) {
+			return string_builder_appendf(sb, "0x%" PRIx64, value);
+		} else {
+			return string_builder_appendf(sb, "%" PRIu64, value);
+		}
+	}
+	default:
+		return ftrace_append_hex(sb, p, field->size);
+	}
+}
+
+struct drgn_error *
+linux_helper_ftrace_format(struct linux_helper_ftrace *ftrace,
+			   const struct linux_helper_ftrace_event *event,
+			   const char **ret, size_t *len_ret)
+{
+	struct string_builder *sb = &ftrace->text;
+	const char *data = event->data;
+	const struct ftrace_event_format *format = NULL;
+	struct ftrace_event_id_map_iterator it =
+		ftrace_event_id_map_search(&ftrace->ids, &event->type);
+	if (it.entry)
+		format = &ftrace->formats.data[it.entry->value];
+
+	int64_t pid = -1;
+	for (size_t i = 0; i < ftrace->common_fields.size; i++) {
+		const struct ftrace_field *field = &ftrace->common_fields.data[i];
+		if (strcmp(field->name, "common_pid") == 0 &&
+		    field->size == 4 && field->offset + 4 <= event->size) {
+			pid = (int32_t)kernel_field_get(data + field->offset, 0,
+							(struct kernel_field){
+								.size = 4
+							},
+							ftrace->bswap);
+			break;
+		}
+	}
+
+	sb->len = 0;
+	if (!string_builder_appendf(sb,
+				    "%8" PRId64 " [%03" PRIu64 "] %5" PRIu64 ".%06" PRIu64 ": ",
+				    pid, event->cpu,
+				    event->timestamp / 1000000000,
+				    event->timestamp % 1000000000 / 1000))
+		return &drgn_enomem;
+	if (format) {
+		if (!string_builder_appendf(sb, "%s:", format->name))
+			return &drgn_enomem;
+		for (size_t i = 0; i < format->fields.size; i++) {
+			if (!ftrace_append_field(ftrace, sb,
+						 &format->fields.data[i], data,
+						 event->size))
+				return &drgn_enomem;
+		}
+	} else if (!string_builder_appendf(sb, "[unknown type %u]:",
+					   (unsigned int)event->type) ||
+		   !string_builder_appendc(sb, ' ') ||
+		   !ftrace_append_hex(sb, data, event->size)) {
+		return &drgn_enomem;
+	}
+	*ret = sb->str;
+	*len_ret = sb->len;
+	return NULL;
+}
+
+/* Append an integer in the byte order of the program. */
+static bool ftrace_append_uint(struct linux_helper_ftrace *ftrace,
+			       struct string_builder *sb, uint64_t value,
+			       size_t size)
+{
+	char buf[8];
+	for (size_t i = 0; i < size; i++) {
+		size_t j = ftrace->little_endian ? i : size - 1 - i;
+		buf[j] = value >> (8 * i);
+	}
+	return string_builder_appendn(sb, buf, size);
+}
+
+static bool ftrace_append_field_format(struct string_builder *sb,
+				       const struct ftrace_field *field)
+{
+	/* Array sizes go after the name, like in the kernel's format files. */
+	const char *array = strchr(field->type, '[');
+	if (strncmp(field->type, "__data_loc", 10) == 0)
+		array = NULL;
+	if (array) {
+		return string_builder_appendf(sb,
+					      "\tfield:%.*s %s%s;\toffset:%u;\tsize:%u;\tsigned:%d;\n",
+					      (int)(array - field->type),
+					      field->type, field->name, array,
+					      field->offset, field->size,
+					      field->is_signed);
+	}
+	return string_builder_appendf(sb,
+				      "\tfield:%s %s;\toffset:%u;\tsize:%u;\tsigned:%d;\n",
+				      field->type, field->name, field->offset,
+				      field->size, field->is_signed);
+}
+
+/* Append a section with a 64-bit size containing an event format file. */
+static bool ftrace_append_format(struct linux_helper_ftrace *ftrace,
+				 struct string_builder *sb,
+				 const struct ftrace_event_format *format)
+{
+	size_t size_pos = sb->len;
+	if (!ftrace_append_uint(ftrace, sb, 0, 8))
+		return false;
+	size_t start = sb->len;
+	if (!string_builder_appendf(sb, "name: %s\nID: %u\nformat:\n",
+				    format->name, (unsigned int)format->id))
+		return false;
+	for (size_t i = 0; i < ftrace->common_fields.size; i++) {
+		if (!ftrace_append_field_format(sb,
+						&ftrace->common_fields.data[i]))
+			return false;
+	}
+	if (!string_builder_appendc(sb, '\n'))
+		return false;
+	for (size_t i = 0; i < format->fields.size; i++) {
+		if (!ftrace_append_field_format(sb, &format->fields.data[i]))
+			return false;
+	}
+	if (!string_builder_appendf(sb, "\nprint fmt: %s\n",
+				    format->print_fmt ? format->print_fmt :
+				    "\"\""))
+		return false;
+	/* Fill in the size now that it's known. */
+	struct string_builder size_sb = {};
+	bool ok = ftrace_append_uint(ftrace, &size_sb, sb->len - start, 8);
+	if (ok)
+		memcpy(sb->str + size_pos, size_sb.str, 8);
+	free(size_sb.str);
+	return ok;
+}
+
+/* Append a named section with a 64-bit size. */
+static bool ftrace_append_section(struct linux_helper_ftrace *ftrace,
+				  struct string_builder *sb, const char *name,
+				  const struct string_builder *content)
+{
+	return (string_builder_appendn(sb, name, strlen(name) + 1) &&
+		ftrace_append_uint(ftrace, sb, content->len, 8) &&
+		string_builder_appendn(sb, content->str, content->len));
+}
+
+static int ftrace_format_system_cmp(const void *_a, const void *_b)
+{
+	const struct ftrace_event_format *a = *(const struct ftrace_event_format **)_a;
+	const struct ftrace_event_format *b = *(const struct ftrace_event_format **)_b;
+	return strcmp(a->system, b->system);
+}
+
+/* Build the trace.dat header up to and including "flyrecord". */
+static struct drgn_error *
+ftrace_trace_dat_header(struct linux_helper_ftrace *ftrace,
+			struct string_builder *sb)
+{
+	struct drgn_error *err = NULL;
+	struct string_builder content = {};
+	const struct ftrace_event_format **sorted = NULL;
+
+	if (!string_builder_appendn(sb, "\027\010\104tracing6", 11) ||
+	    !string_builder_appendc(sb, '\0') ||
+	    !string_builder_appendc(sb, ftrace->little_endian ? 0 : 1) ||
+	    !string_builder_appendc(sb, ftrace->word_size) ||
+	    !ftrace_append_uint(ftrace, sb, ftrace->page_size, 4))
+		goto enomem;
+
+	if (!string_builder_appendf(&content,
+				    "\tfield: u64 timestamp;\toffset:%" PRIu64 ";\tsize:%" PRIu64 ";\tsigned:0;\n"
+				    "\tfield: local_t commit;\toffset:%" PRIu64 ";\tsize:%" PRIu64 ";\tsigned:1;\n"
+				    "\tfield: int overwrite;\toffset:%" PRIu64 ";\tsize:1;\tsigned:1;\n"
+				    "\tfield: char data;\toffset:%" PRIu64 ";\tsize:%" PRIu64 ";\tsigned:1;\n",
+				    ftrace->time_stamp.offset,
+				    ftrace->time_stamp.size,
+				    ftrace->commit.offset, ftrace->commit.size,
+				    ftrace->commit.offset, ftrace->data_offset,
+				    ftrace->page_size - ftrace->data_offset) ||
+	    !ftrace_append_section(ftrace, sb, "header_page", &content))
+		goto enomem;
+	content.len = 0;
+	if (!string_builder_appendf(&content,
+				    "# compressed entry header\n"
+				    "\ttype_len    :    5 bits\n"
+				    "\ttime_delta  :   27 bits\n"
+				    "\tarray       :   32 bits\n"
+				    "\n"
+				    "\tpadding     : type == %d\n"
+				    "\ttime_extend : type == %d\n"
+				    "\ttime_stamp : type == %d\n"
+				    "\tdata max type_len  == %d\n",
+				    FTRACE_TYPE_PADDING,
+				    FTRACE_TYPE_TIME_EXTEND,
+				    FTRACE_TYPE_TIME_STAMP,
+				    FTRACE_TYPE_DATA_TYPE_LEN_MAX) ||
+	    !ftrace_append_section(ftrace, sb, "header_event", &content))
+		goto enomem;
+
+	/* Events in the "ftrace" system go in their own section. */
+	size_t num_sorted = 0, num_ftrace = 0;
+	sorted = malloc_array(ftrace->formats.size, sizeof(sorted[0]));
+	if (!sorted && ftrace->formats.size)
+		goto enomem;
+	for (size_t i = 0; i < ftrace->formats.size; i++) {
+		const struct ftrace_event_format *format =
+			&ftrace->formats.data[i];
+		if (!format->name || !format->system)
+			continue;
+		sorted[num_sorted++] = format;
+		if (strcmp(format->system, "ftrace") == 0)
+			num_ftrace++;
+	}
+	qsort(sorted, num_sorted, sizeof(sorted[0]), ftrace_format_system_cmp);
+
+	if (!ftrace_append_uint(ftrace, sb, num_ftrace, 4))
+		goto enomem;
+	for (size_t i = 0; i < num_sorted; i++) {
+		if (strcmp(sorted[i]->system, "ftrace") == 0 &&
+		    !ftrace_append_format(ftrace, sb, sorted[i]))
+			goto enomem;
+	}
+
+	size_t num_systems = 0;
+	for (size_t i = 0; i < num_sorted; i++) {
+		if (strcmp(sorted[i]->system, "ftrace") != 0 &&
+		    (i == 0 ||
+		     strcmp(sorted[i]->system, sorted[i - 1]->system) != 0))
+			num_systems++;
+	}
+	if (!ftrace_append_uint(ftrace, sb, num_systems, 4))
+		goto enomem;
+	for (size_t i = 0; i < num_sorted;) {
+		size_t j = i + 1;
+		while (j < num_sorted &&
+		       strcmp(sorted[j]->system, sorted[i]->system) == 0)
+			j++;
+		if (strcmp(sorted[i]->system, "ftrace") != 0) {
+			if (!string_builder_appendn(sb, sorted[i]->system,
+						    strlen(sorted[i]->system) + 1) ||
+			    !ftrace_append_uint(ftrace, sb, j - i, 4))
+				goto enomem;
+			for (size_t k = i; k < j; k++) {
+				if (!ftrace_append_format(ftrace, sb,
+							  sorted[k]))
+					goto enomem;
+			}
+		}
+		i = j;
+	}
+
+	/* No kallsyms, printk formats, or saved command lines. */
+	if (!ftrace_append_uint(ftrace, sb, 0, 4) ||
+	    !ftrace_append_uint(ftrace, sb, 0, 4) ||
+	    !ftrace_append_uint(ftrace, sb, 0, 8) ||
+	    !ftrace_append_uint(ftrace, sb, ftrace->num_cpus, 4) ||
+	    !string_builder_appendn(sb, "flyrecord", sizeof("flyrecord")))
+		goto enomem;
+	goto out;
+
+enomem:
+	err = &drgn_enomem;
+out:
+	free(sorted);
+	free(content.str);
+	return err;
+}
+
+/* Get the number of data pages of a CPU that have any events. */
+static struct drgn_error *
+ftrace_cpu_count_pages(struct linux_helper_ftrace *ftrace,
+		       struct ftrace_cpu *cpu, uint64_t *ret)
+{
+	struct drgn_error *err;
+	uint64_t count = 0;
+	for (size_t i = 0; i < cpu->pages.size; i++) {
+		uint64_t commit;
+		err = kernel_read_field(ftrace->prog, ftrace->bswap,
+					cpu->pages.data[i], ftrace->commit,
+					&commit);
+		if (err)
+			return err;
+		commit &= FTRACE_COMMIT_MASK;
+		if (commit > (i == 0 ? cpu->reader_read : 0))
+			count++;
+	}
+	*ret = count;
+	return NULL;
+}
+
+struct drgn_error *
+linux_helper_ftrace_write_trace_dat(struct linux_helper_ftrace *ftrace,
+				    linux_helper_write_fn *fn, void *arg)
+{
+	struct drgn_error *err;
+	struct string_builder sb = {};
+	uint64_t *counts = NULL;
+	char *page = NULL;
+
+	err = ftrace_trace_dat_header(ftrace, &sb);
+	if (err)
+		goto out;
+
+	counts = malloc_array(ftrace->num_cpus, sizeof(counts[0]));
+	if (!counts && ftrace->num_cpus) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	for (size_t i = 0; i < ftrace->num_cpus; i++) {
+		err = ftrace_cpu_count_pages(ftrace, &ftrace->cpus[i],
+					     &counts[i]);
+		if (err)
+			goto out;
+	}
+
+	/* The data of each CPU starts on a page boundary. */
+	uint64_t offset = sb.len + 16 * ftrace->num_cpus;
+	offset = (offset + ftrace->page_size - 1) / ftrace->page_size *
+		 ftrace->page_size;
+	for (size_t i = 0; i < ftrace->num_cpus; i++) {
+		uint64_t size = counts[i] * ftrace->page_size;
+		if (!ftrace_append_uint(ftrace, &sb, offset, 8) ||
+		    !ftrace_append_uint(ftrace, &sb, size, 8)) {
+			err = &drgn_enomem;
+			goto out;
+		}
+		offset += size;
+	}
+	while (sb.len % ftrace->page_size) {
+		if (!string_builder_appendc(&sb, '\0')) {
+			err = &drgn_enomem;
+			goto out;
+		}
+	}
+	err = fn(sb.str, sb.len, arg);
+	if (err)
+		goto out;
+
+	page = malloc(ftrace->page_size);
+	if (!page) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	for (size_t i = 0; i < ftrace->num_cpus; i++) {
+		struct ftrace_cpu *cpu = &ftrace->cpus[i];
+		uint64_t written = 0;
+		for (size_t j = 0; j < cpu->pages.size && written < counts[i];
+		     j++) {
+			err = drgn_program_read_memory(ftrace->prog, page,
+						       cpu->pages.data[j],
+						       ftrace->page_size,
+						       false);
+			if (err)
+				goto out;
+			uint64_t commit = kernel_field_get(page, 0,
+							   ftrace->commit,
+							   ftrace->bswap) &
+					  FTRACE_COMMIT_MASK;
+			if (commit <= (j == 0 ? cpu->reader_read : 0))
+				continue;
+			err = fn(page, ftrace->page_size, arg);
+			if (err)
+				goto out;
+			written++;
+		}
+		/* Keep the offsets valid if the buffer changed. */
+		memset(page, 0, ftrace->page_size);
+		for (; written < counts[i]; written++) {
+			err = fn(page, ftrace->page_size, arg);
+			if (err)
+				goto out;
+		}
+	}
+out:
+	free(page);
+	free(counts);
+	free(sb.str);
+	return err;
+}
+
+/*
+ * Wait-for graph of blocked tasks.
+ *
+ * Tasks blocked on a mutex, rw_semaphore, or completion have a waiter
+ * structure on their stack which points to the task and is linked into the
+ * lock's wait list. The blocking frame found by unwinding tells us what kind of
+ * waiter to look for, the stack is scanned for it, and its wait list is walked
+ * to the list head in the lock. An edge goes from each waiter to the lock's
+ * owner, if the lock has one.
+ */
+
+/* TASK_NOLOAD tasks (e.g., TASK_IDLE) are sleeping, not blocked. */
+#define WAIT_GRAPH_TASK_NOLOAD 0x400
+/* The low bits of mutex::owner and rw_semaphore::owner are flags. */
+#define WAIT_GRAPH_OWNER_FLAGS 7
+#define WAIT_GRAPH_RWSEM_READER_OWNED 1
+/* Maximum number of candidate waiters checked per task. */
+#define WAIT_GRAPH_MAX_CANDIDATES 8
+/* Bound on wait list walks in case of corruption. */
+#define WAIT_GRAPH_MAX_WAITERS 65536
+/* Number of stacks read and scanned at a time. */
+#define WAIT_GRAPH_BATCH_SIZE 256
+
+static const struct {
+	const char *prefix;
+	enum linux_helper_lock_kind kind;
+} wait_graph_blocking_functions[] = {
+	/* Function names may have suffixes like .constprop.0. */
+	{ "__mutex_lock", LINUX_HELPER_LOCK_MUTEX },
+	{ "mutex_lock", LINUX_HELPER_LOCK_MUTEX },
+	{ "rwsem_down_", LINUX_HELPER_LOCK_RWSEM },
+	{ "__down_read", LINUX_HELPER_LOCK_RWSEM },
+	{ "__down_write", LINUX_HELPER_LOCK_RWSEM },
+	{ "down_read", LINUX_HELPER_LOCK_RWSEM },
+	{ "down_write", LINUX_HELPER_LOCK_RWSEM },
+	{ "__wait_for_common", LINUX_HELPER_LOCK_COMPLETION },
+	{ "wait_for_common", LINUX_HELPER_LOCK_COMPLETION },
+	{ "wait_for_completion", LINUX_HELPER_LOCK_COMPLETION },
+};
+
+struct wait_graph_lock_layout {
+	/* Whether the kernel's types for this kind of lock were found. */
+	bool found;
+	uint64_t waiter_list_offset, waiter_task_offset;
+	/* Offset of the wait list head in the lock. */
+	uint64_t lock_list_offset;
+	/* Size is 0 if the lock has no owner. */
+	struct kernel_field owner;
+};
+
+struct wait_graph_task {
+	/* Address of the task's stack in the stack buffer, if kind is set. */
+	uint64_t stack;
+	size_t num_candidates;
+	/* Addresses of possible waiters found on the stack. */
+	uint64_t candidates[WAIT_GRAPH_MAX_CANDIDATES];
+};
+
+DEFINE_VECTOR(linux_helper_blocked_task_vector, struct linux_helper_blocked_task)
+DEFINE_HASH_MAP(wait_graph_task_map, uint64_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+
+struct wait_graph_builder {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	uint64_t state_mask;
+	uint64_t thread_size;
+	struct kernel_field state, stack;
+	struct wait_graph_lock_layout layouts[LINUX_HELPER_LOCK_COMPLETION + 1];
+	struct drgn_qualified_type task_type;
+	/* Every task, to tell waiters apart from list heads. */
+	struct kernel_uint64_set all_tasks;
+	struct linux_helper_blocked_task_vector blocked;
+	/* Per-task scan state for the current batch. */
+	struct wait_graph_task *batch;
+	char *stacks;
+};
+
+static struct drgn_error *
+wait_graph_member_offset(struct drgn_program *prog, struct drgn_type *type,
+			 const char *member_name, uint64_t *ret,
+			 struct drgn_qualified_type *type_ret)
+{
+	struct drgn_member_info member;
+	struct drgn_error *err = drgn_program_member_info(prog, type,
+							  member_name, &member);
+	if (err)
+		return err;
+	*ret = member.bit_offset / 8;
+	if (type_ret)
+		*type_ret = member.qualified_type;
+	return NULL;
+}
+
+/*
+ * Look up the layout of a kind of lock. A kernel that doesn't have the expected
+ * types isn't an error; those locks just aren't resolved.
+ */
+static struct drgn_error *
+wait_graph_lock_layout_init(struct drgn_program *prog,
+			    const char *waiter_type_name,
+			    const char *waiter_list_member,
+			    const char *waiter_task_member,
+			    const char *lock_type_name,
+			    const char *lock_list_member,
+			    const char *owner_member,
+			    struct wait_graph_lock_layout *ret)
+{
+	struct drgn_error *err;
+	struct drgn_qualified_type waiter_type, lock_type;
+	if ((err = drgn_program_find_type(prog, waiter_type_name, NULL,
+					  &waiter_type)) ||
+	    (err = drgn_program_find_type(prog, lock_type_name, NULL,
+					  &lock_type)) ||
+	    (err = wait_graph_member_offset(prog, waiter_type.type,
+					    waiter_list_member,
+					    &ret->waiter_list_offset, NULL)) ||
+	    (err = wait_graph_member_offset(prog, waiter_type.type,
+					    waiter_task_member,
+					    &ret->waiter_task_offset, NULL)) ||
+	    (err = wait_graph_member_offset(prog, lock_type.type,
+					    lock_list_member,
+					    &ret->lock_list_offset, NULL)))
+		goto out;
+	if (owner_member) {
+		err = kernel_find_field(prog, lock_type_name, owner_member,
+					&ret->owner);
+		if (err && err->code == DRGN_ERROR_LOOKUP) {
+			/* Older kernels don't track the owner. */
+			drgn_error_destroy(err);
+			err = NULL;
+		}
+		if (err)
+			return err;
+	}
+	ret->found = true;
+out:
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = NULL;
+	}
+	return err;
+}
+
+/* Completions use a simple wait queue since Linux 4.19. */
+static struct drgn_error *
+wait_graph_completion_layout_init(struct drgn_program *prog,
+				  struct wait_graph_lock_layout *ret)
+{
+	struct drgn_error *err;
+	struct drgn_qualified_type completion_type, wait_type;
+	uint64_t wait_offset;
+	err = drgn_program_find_type(prog, "struct completion", NULL,
+				     &completion_type);
+	if (!err) {
+		err = wait_graph_member_offset(prog, completion_type.type,
+					       "wait", &wait_offset,
+					       &wait_type);
+	}
+	if (err) {
+		if (err->code == DRGN_ERROR_LOOKUP) {
+			drgn_error_destroy(err);
+			err = NULL;
+		}
+		return err;
+	}
+
+	const char *tag = drgn_type_tag(wait_type.type);
+	if (tag && strcmp(tag, "swait_queue_head") == 0) {
+		err = wait_graph_lock_layout_init(prog, "struct swait_queue",
+						  "task_list", "task",
+						  "struct swait_queue_head",
+						  "task_list", NULL, ret);
+	} else {
+		/* struct wait_queue_entry was struct __wait_queue before 4.13. */
+		err = wait_graph_lock_layout_init(prog,
+						  "struct wait_queue_entry",
+						  "entry", "private",
+						  "struct wait_queue_head",
+						  "head", NULL, ret);
+		if (!err && !ret->found) {
+			err = wait_graph_lock_layout_init(prog,
+							  "struct __wait_queue",
+							  "task_list",
+							  "private",
+							  "struct __wait_queue_head",
+							  "task_list", NULL,
+							  ret);
+		}
+	}
+	ret->lock_list_offset += wait_offset;
+	return err;
+}
+
+static void wait_graph_builder_deinit(struct wait_graph_builder *builder)
+{
+	free(builder->stacks);
+	free(builder->batch);
+	for (size_t i = 0; i < builder->blocked.size; i++)
+		drgn_stack_trace_destroy(builder->blocked.data[i].trace);
+	linux_helper_blocked_task_vector_deinit(&builder->blocked);
+	kernel_uint64_set_deinit(&builder->all_tasks);
+}
+
+static struct drgn_error *
+wait_graph_builder_init(struct wait_graph_builder *builder,
+			struct drgn_program *prog, uint64_t state_mask)
+{
+	struct drgn_error *err;
+
+	memset(builder, 0, sizeof(*builder));
+	builder->prog = prog;
+	builder->state_mask = state_mask;
+	kernel_uint64_set_init(&builder->all_tasks);
+	linux_helper_blocked_task_vector_init(&builder->blocked);
+
+	if ((err = drgn_program_bswap(prog, &builder->bswap)) ||
+	    (err = drgn_program_word_size(prog, &builder->word_size)) ||
+	    (err = drgn_program_find_type(prog, "struct task_struct *", NULL,
+					  &builder->task_type)) ||
+	    (err = kernel_find_field(prog, "struct task_struct", "stack",
+				     &builder->stack)))
+		return err;
+	/* state was renamed to __state in Linux 5.14. */
+	err = kernel_find_field(prog, "struct task_struct", "__state",
+				&builder->state);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = kernel_find_field(prog, "struct task_struct", "state",
+					&builder->state);
+	}
+	if (err)
+		return err;
+
+	struct drgn_qualified_type thread_union;
+	err = drgn_program_find_type(prog, "union thread_union", NULL,
+				     &thread_union);
+	if (!err)
+		err = drgn_type_sizeof(thread_union.type, &builder->thread_size);
+	if (err)
+		return err;
+
+	if ((err = wait_graph_lock_layout_init(prog, "struct mutex_waiter",
+					       "list", "task", "struct mutex",
+					       "wait_list", "owner",
+					       &builder->layouts[LINUX_HELPER_LOCK_MUTEX])) ||
+	    (err = wait_graph_lock_layout_init(prog, "struct rwsem_waiter",
+					       "list", "task",
+					       "struct rw_semaphore",
+					       "wait_list", "owner",
+					       &builder->layouts[LINUX_HELPER_LOCK_RWSEM])) ||
+	    (err = wait_graph_completion_layout_init(prog,
+						     &builder->layouts[LINUX_HELPER_LOCK_COMPLETION])))
+		return err;
+
+	builder->batch = calloc(WAIT_GRAPH_BATCH_SIZE,
+				sizeof(builder->batch[0]));
+	builder->stacks = malloc_array(WAIT_GRAPH_BATCH_SIZE,
+				       builder->thread_size);
+	if (!builder->batch || !builder->stacks)
+		return &drgn_enomem;
+	return NULL;
+}
+
+static struct drgn_error *wait_graph_visit_task(uint64_t task, void *arg)
+{
+	struct drgn_error *err;
+	struct wait_graph_builder *builder = arg;
+
+	if (kernel_uint64_set_insert(&builder->all_tasks, &task, NULL) < 0)
+		return &drgn_enomem;
+	uint64_t state;
+	err = kernel_read_field(builder->prog, builder->bswap, task,
+				builder->state, &state);
+	if (err)
+		return err;
+	if (!(state & builder->state_mask) || (state & WAIT_GRAPH_TASK_NOLOAD))
+		return NULL;
+
+	struct linux_helper_blocked_task *blocked =
+		linux_helper_blocked_task_vector_append_entry(&builder->blocked);
+	if (!blocked)
+		return &drgn_enomem;
+	*blocked = (struct linux_helper_blocked_task){
+		.task = task,
+		.frame = SIZE_MAX,
+		.owner_index = SIZE_MAX,
+	};
+	return NULL;
+}
+
+/* Unwind a blocked task and find the frame where it blocked on a lock. */
+static struct drgn_error *
+wait_graph_unwind(struct wait_graph_builder *builder,
+		  struct linux_helper_blocked_task *blocked)
+{
+	struct drgn_error *err;
+	struct drgn_object obj;
+
+	drgn_object_init(&obj, builder->prog);
+	err = drgn_object_set_unsigned(&obj, builder->task_type, blocked->task,
+				       0);
+	if (err)
+		goto out;
+	err = drgn_object_stack_trace(&obj, &blocked->trace);
+	if (err) {
+		/* The task may have exited, so this isn't fatal. */
+		if (err->code == DRGN_ERROR_NO_MEMORY)
+			goto out;
+		drgn_error_destroy(err);
+		err = NULL;
+		blocked->trace = NULL;
+		goto out;
+	}
+
+	size_t num_frames = drgn_stack_trace_num_frames(blocked->trace);
+	for (size_t i = 0; i < num_frames; i++) {
+		struct drgn_stack_frame frame = { blocked->trace, i };
+		struct drgn_symbol *sym;
+		err = drgn_stack_frame_symbol(frame, &sym);
+		if (err) {
+			if (err->code == DRGN_ERROR_NO_MEMORY)
+				goto out;
+			drgn_error_destroy(err);
+			err = NULL;
+			continue;
+		}
+		const char *name = drgn_symbol_name(sym);
+		for (size_t j = 0; j < ARRAY_SIZE(wait_graph_blocking_functions);
+		     j++) {
+			const char *prefix = wait_graph_blocking_functions[j].prefix;
+			if (strncmp(name, prefix, strlen(prefix)) == 0) {
+				blocked->frame = i;
+				blocked->kind = wait_graph_blocking_functions[j].kind;
+				break;
+			}
+		}
+		drgn_symbol_destroy(sym);
+		if (blocked->frame != SIZE_MAX)
+			break;
+	}
+out:
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+struct wait_graph_scan_arg {
+	struct wait_graph_builder *builder;
+	size_t start;
+};
+
+static uint64_t wait_graph_stack_word(struct wait_graph_builder *builder,
+				      const char *stack, uint64_t offset)
+{
+	struct kernel_field field = { offset, builder->word_size };
+	return kernel_field_get(stack, 0, field, builder->bswap);
+}
+
+/*
+ * Scan a stack that was already read for waiters pointing to its task. This
+ * only touches the stack buffer, so it runs in parallel.
+ */
+static struct drgn_error *wait_graph_scan_stack(size_t i, void *arg)
+{
+	struct wait_graph_scan_arg *scan = arg;
+	struct wait_graph_builder *builder = scan->builder;
+	struct linux_helper_blocked_task *blocked =
+		&builder->blocked.data[scan->start + i];
+	struct wait_graph_task *state = &builder->batch[i];
+	const char *stack = builder->stacks + i * builder->thread_size;
+	const struct wait_graph_lock_layout *layout =
+		&builder->layouts[blocked->kind];
+	uint64_t word_size = builder->word_size;
+
+	if (!state->stack)
+		return NULL;
+	for (uint64_t offset = 0; offset + word_size <= builder->thread_size;
+	     offset += word_size) {
+		if (wait_graph_stack_word(builder, stack, offset) !=
+		    blocked->task)
+			continue;
+		if (offset < layout->waiter_task_offset)
+			continue;
+		uint64_t waiter = offset - layout->waiter_task_offset;
+		uint64_t node = waiter + layout->waiter_list_offset;
+		if (node + 2 * word_size > builder->thread_size)
+			continue;
+		uint64_t next = wait_graph_stack_word(builder, stack, node);
+		uint64_t prev = wait_graph_stack_word(builder, stack,
+						      node + word_size);
+		/* A queued waiter is never on an empty list. */
+		if (!next || !prev || next % word_size || prev % word_size ||
+		    next == state->stack + node)
+			continue;
+		state->candidates[state->num_candidates++] = state->stack +
+							     waiter;
+		if (state->num_candidates == WAIT_GRAPH_MAX_CANDIDATES)
+			break;
+	}
+	return NULL;
+}
+
+/*
+ * Walk the wait list of a candidate waiter to the list head in the lock.
+ * Returns 0 if the candidate isn't a valid waiter.
+ */
+static struct drgn_error *
+wait_graph_find_lock(struct wait_graph_builder *builder,
+		     const struct wait_graph_lock_layout *layout,
+		     uint64_t waiter, uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct kernel_field next_field = { 0, builder->word_size };
+	struct kernel_field prev_field = { builder->word_size,
+					   builder->word_size };
+	uint64_t node = waiter + layout->waiter_list_offset;
+	uint64_t prev = node, pos;
+
+	*ret = 0;
+	err = kernel_read_field(builder->prog, builder->bswap, node,
+				next_field, &pos);
+	if (err)
+		goto fault;
+	for (size_t i = 0; i < WAIT_GRAPH_MAX_WAITERS && pos != node; i++) {
+		uint64_t pos_prev, task;
+		err = kernel_read_field(builder->prog, builder->bswap, pos,
+					prev_field, &pos_prev);
+		if (err)
+			goto fault;
+		if (pos_prev != prev)
+			return NULL;
+		err = kernel_read_field(builder->prog, builder->bswap,
+					pos - layout->waiter_list_offset,
+					(struct kernel_field){
+						layout->waiter_task_offset,
+						builder->word_size
+					},
+					&task);
+		if (err)
+			goto fault;
+		/* The only node that isn't a waiter is the list head. */
+		if (!kernel_uint64_set_search(&builder->all_tasks,
+					      &task).entry) {
+			*ret = pos - layout->lock_list_offset;
+			return NULL;
+		}
+		prev = pos;
+		err = kernel_read_field(builder->prog, builder->bswap, pos,
+					next_field, &pos);
+		if (err)
+			goto fault;
+	}
+	return NULL;
+
+fault:
+	if (err->code == DRGN_ERROR_FAULT) {
+		drgn_error_destroy(err);
+		err = NULL;
+	}
+	return err;
+}
+
+static struct drgn_error *
+wait_graph_resolve(struct wait_graph_builder *builder,
+		   struct linux_helper_blocked_task *blocked,
+		   const struct wait_graph_task *state)
+{
+	struct drgn_error *err;
+	const struct wait_graph_lock_layout *layout =
+		&builder->layouts[blocked->kind];
+
+	for (size_t i = 0; i < state->num_candidates; i++) {
+		uint64_t lock;
+		err = wait_graph_find_lock(builder, layout,
+					   state->candidates[i], &lock);
+		if (err)
+			return err;
+		if (!lock)
+			continue;
+		blocked->waiter = state->candidates[i];
+		blocked->lock = lock;
+		if (!layout->owner.size)
+			return NULL;
+		uint64_t owner;
+		err = kernel_read_field(builder->prog, builder->bswap, lock,
+					layout->owner, &owner);
+		if (err) {
+			if (err->code != DRGN_ERROR_FAULT)
+				return err;
+			drgn_error_destroy(err);
+			return NULL;
+		}
+		/* A reader-owned rw_semaphore only records the last reader. */
+		if (blocked->kind == LINUX_HELPER_LOCK_RWSEM &&
+		    (owner & WAIT_GRAPH_RWSEM_READER_OWNED))
+			owner = 0;
+		blocked->owner = owner & ~(uint64_t)WAIT_GRAPH_OWNER_FLAGS;
+		return NULL;
+	}
+	return NULL;
+}
+
+/* Read, scan, and resolve a batch of blocked tasks. */
+static struct drgn_error *wait_graph_process_batch(struct wait_graph_builder *builder,
+						   size_t start, size_t end)
+{
+	struct drgn_error *err;
+
+	memset(builder->batch, 0, (end - start) * sizeof(builder->batch[0]));
+	for (size_t i = start; i < end; i++) {
+		struct linux_helper_blocked_task *blocked =
+			&builder->blocked.data[i];
+		if (blocked->kind == LINUX_HELPER_LOCK_NONE ||
+		    !builder->layouts[blocked->kind].found)
+			continue;
+		uint64_t stack;
+		err = kernel_read_field(builder->prog, builder->bswap,
+					blocked->task, builder->stack, &stack);
+		if (err)
+			return err;
+		if (!stack)
+			continue;
+		err = drgn_program_read_memory(builder->prog,
+					       builder->stacks +
+					       (i - start) * builder->thread_size,
+					       stack, builder->thread_size,
+					       false);
+		if (err) {
+			if (err->code != DRGN_ERROR_FAULT)
+				return err;
+			drgn_error_destroy(err);
+			continue;
+		}
+		builder->batch[i - start].stack = stack;
+	}
+
+	struct drgn_thread_pool *pool;
+	err = drgn_program_thread_pool(builder->prog, &pool);
+	if (err)
+		return err;
+	struct wait_graph_scan_arg arg = { builder, start };
+	err = drgn_thread_pool_for_each(pool, 0, end - start,
+					wait_graph_scan_stack, &arg);
+	if (err)
+		return err;
+
+	for (size_t i = start; i < end; i++) {
+		err = wait_graph_resolve(builder, &builder->blocked.data[i],
+					 &builder->batch[i - start]);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Every blocked task waits for at most one owner, so each connected component
+ * of the graph has at most one cycle, and chain lengths can be computed by
+ * following owners once.
+ */
+static struct drgn_error *wait_graph_analyze(struct wait_graph_builder *builder)
+{
+	struct drgn_error *err = NULL;
+	struct linux_helper_blocked_task *tasks = builder->blocked.data;
+	size_t num_tasks = builder->blocked.size;
+	struct wait_graph_task_map indices;
+	wait_graph_task_map_init(&indices);
+	enum { UNVISITED, ON_PATH, DONE } *visited = NULL;
+	size_t *path = NULL;
+
+	for (size_t i = 0; i < num_tasks; i++) {
+		struct wait_graph_task_map_entry entry = { tasks[i].task, i };
+		if (wait_graph_task_map_insert(&indices, &entry, NULL) < 0)
+			goto enomem;
+	}
+	for (size_t i = 0; i < num_tasks; i++) {
+		if (!tasks[i].owner)
+			continue;
+		struct wait_graph_task_map_iterator it =
+			wait_graph_task_map_search(&indices, &tasks[i].owner);
+		if (it.entry)
+			tasks[i].owner_index = it.entry->value;
+	}
+
+	visited = calloc(num_tasks, sizeof(visited[0]));
+	path = malloc_array(num_tasks, sizeof(path[0]));
+	if (num_tasks && (!visited || !path))
+		goto enomem;
+	for (size_t i = 0; i < num_tasks; i++) {
+		size_t path_len = 0, j = i;
+		while (j != SIZE_MAX && visited[j] == UNVISITED) {
+			visited[j] = ON_PATH;
+			path[path_len++] = j;
+			j = tasks[j].owner_index;
+		}
+		if (j != SIZE_MAX && visited[j] == ON_PATH) {
+			/* Found a new cycle starting at j. */
+			size_t cycle_start = path_len;
+			while (path[cycle_start - 1] != j)
+				cycle_start--;
+			cycle_start--;
+			for (size_t k = cycle_start; k < path_len; k++) {
+				tasks[path[k]].in_cycle = true;
+				tasks[path[k]].chain_length =
+					path_len - cycle_start;
+				visited[path[k]] = DONE;
+			}
+			path_len = cycle_start;
+		}
+		while (path_len > 0) {
+			struct linux_helper_blocked_task *task =
+				&tasks[path[--path_len]];
+			if (task->owner_index != SIZE_MAX) {
+				task->chain_length =
+					tasks[task->owner_index].chain_length + 1;
+			} else {
+				task->chain_length = task->owner ? 1 : 0;
+			}
+			visited[path[path_len]] = DONE;
+		}
+	}
+	goto out;
+
+enomem:
+	err = &drgn_enomem;
+out:
+	free(path);
+	free(visited);
+	wait_graph_task_map_deinit(&indices);
+	return err;
+}
+
+struct drgn_error *
+linux_helper_wait_graph_create(struct drgn_program *prog, uint64_t state_mask,
+			       struct linux_helper_wait_graph **ret)
+{
+	struct drgn_error *err;
+	struct wait_graph_builder builder;
+
+	err = wait_graph_builder_init(&builder, prog, state_mask);
+	if (err)
+		goto out;
+	err = kernel_for_each_task(prog, wait_graph_visit_task, &builder);
+	if (err)
+		goto out;
+	/*
+	 * Unwinding isn't thread-safe, so only scanning the stacks is done in
+	 * parallel.
+	 */
+	for (size_t i = 0; i < builder.blocked.size; i++) {
+		err = wait_graph_unwind(&builder, &builder.blocked.data[i]);
+		if (err)
+			goto out;
+	}
+	for (size_t i = 0; i < builder.blocked.size;
+	     i += WAIT_GRAPH_BATCH_SIZE) {
+		size_t end = builder.blocked.size - i < WAIT_GRAPH_BATCH_SIZE ?
+			     builder.blocked.size : i + WAIT_GRAPH_BATCH_SIZE;
+		err = wait_graph_process_batch(&builder, i, end);
+		if (err)
+			goto out;
+	}
+	err = wait_graph_analyze(&builder);
+	if (err)
+		goto out;
+
+	struct linux_helper_wait_graph *graph = malloc(sizeof(*graph));
+	if (!graph) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_blocked_task_vector_shrink_to_fit(&builder.blocked);
+	graph->tasks = builder.blocked.data;
+	graph->num_tasks = builder.blocked.size;
+	linux_helper_blocked_task_vector_init(&builder.blocked);
+	*ret = graph;
+out:
+	wait_graph_builder_deinit(&builder);
+	return err;
+}
+
+void linux_helper_wait_graph_destroy(struct linux_helper_wait_graph *graph)
+{
+	if (!graph)
+		return;
+	for (size_t i = 0; i < graph->num_tasks; i++)
+		drgn_stack_trace_destroy(graph->tasks[i].trace);
+	free(graph->tasks);
+	free(graph);
+}
+
+/*
+ * Runqueue snapshot.
+ *
+ * Each struct rq is read in one piece, and the trees and lists of runnable
+ * entities hanging off of it are walked by reading only the pointers and the
+ * few scheduling fields of each entity and task.
+ */
+
+/* Bound on tree and list walks in case of corruption. */
+#define RQ_SNAPSHOT_MAX_ENTITIES (1 << 20)
+/* Bound on nesting of task group entities. */
+#define RQ_SNAPSHOT_MAX_GROUP_DEPTH 64
+
+DEFINE_VECTOR(linux_helper_rq_cpu_vector, struct linux_helper_rq_cpu)
+DEFINE_VECTOR(linux_helper_rq_task_vector, struct linux_helper_rq_task)
+
+struct rq_snapshot_builder {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	uint64_t runqueues;
+	uint64_t rq_size;
+	char *rq_buf;
+	/* struct rq, with offsets of nested fields relative to the rq. */
+	struct kernel_field rq_curr, rq_clock, rq_clock_task, rq_nr_running;
+	struct kernel_field cfs_min_vruntime;
+	uint64_t cfs_offset, rt_offset;
+	/* struct cfs_rq, struct rt_rq, and struct dl_rq. */
+	uint64_t cfs_root_offset, rt_queue_offset, dl_root_offset;
+	uint64_t rt_queue_length;
+	/* struct rb_node */
+	uint64_t rb_right_offset, rb_left_offset;
+	/* struct sched_entity, with my_q size 0 without group scheduling. */
+	uint64_t se_run_node_offset;
+	struct kernel_field se_my_q;
+	/* struct sched_rt_entity */
+	uint64_t rt_run_list_offset;
+	struct kernel_field rt_my_q;
+	/* struct sched_dl_entity */
+	uint64_t dl_rb_node_offset;
+	/* struct task_struct, with nested fields relative to the task. */
+	uint64_t task_se_offset, task_rt_offset, task_dl_offset;
+	struct kernel_field task_policy, task_prio, task_vruntime,
+			    task_sum_exec_runtime, task_deadline;
+	uint64_t task_span_start, task_span_size;
+	char *task_buf;
+	/*
+	 * rq->curr of the CPU being walked. Unlike CFS, running RT and deadline
+	 * tasks stay on their queues, so they're skipped there.
+	 */
+	uint64_t curr;
+	struct kernel_uint64_vector rb_stack;
+	struct linux_helper_rq_cpu_vector cpus;
+	struct linux_helper_rq_task_vector tasks;
+};
+
+static struct drgn_error *
+rq_snapshot_builder_init(struct rq_snapshot_builder *builder,
+			 struct drgn_program *prog)
+{
+	struct drgn_error *err;
+	struct drgn_program *p = prog;
+
+	memset(builder, 0, sizeof(*builder));
+	builder->prog = prog;
+	kernel_uint64_vector_init(&builder->rb_stack);
+	linux_helper_rq_cpu_vector_init(&builder->cpus);
+	linux_helper_rq_task_vector_init(&builder->tasks);
+
+	if ((err = drgn_program_bswap(prog, &builder->bswap)) ||
+	    (err = drgn_program_word_size(prog, &builder->word_size)))
+		return err;
+
+	struct drgn_object obj;
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, "runqueues", NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (!err) {
+		if (obj.is_reference) {
+			builder->runqueues = obj.reference.address;
+			err = drgn_object_sizeof(&obj, &builder->rq_size);
+		} else {
+			err = drgn_error_create(DRGN_ERROR_TYPE,
+						"runqueues is not a reference");
+		}
+	}
+	drgn_object_deinit(&obj);
+	if (err)
+		return err;
+
+	uint64_t dl_offset;
+	struct drgn_member_info member;
+	if ((err = kernel_find_field(p, "struct rq", "curr",
+				     &builder->rq_curr)) ||
+	    (err = kernel_find_field(p, "struct rq", "clock",
+				     &builder->rq_clock)) ||
+	    (err = kernel_find_field(p, "struct rq", "clock_task",
+				     &builder->rq_clock_task)) ||
+	    (err = kernel_find_field(p, "struct rq", "nr_running",
+				     &builder->rq_nr_running)) ||
+	    (err = kernel_member_offset(p, "struct rq", "cfs",
+					&builder->cfs_offset)) ||
+	    (err = kernel_member_offset(p, "struct rq", "rt",
+					&builder->rt_offset)) ||
+	    (err = kernel_member_offset(p, "struct rq", "dl", &dl_offset)) ||
+	    (err = kernel_find_field(p, "struct cfs_rq", "min_vruntime",
+				     &builder->cfs_min_vruntime)) ||
+	    (err = kernel_rb_root_offset(p, "struct cfs_rq",
+					 "tasks_timeline",
+					 &builder->cfs_root_offset)) ||
+	    (err = kernel_rb_root_offset(p, "struct dl_rq", "root",
+					 &builder->dl_root_offset)) ||
+	    (err = kernel_member_offset(p, "struct rt_rq", "active",
+					&builder->rt_queue_offset)) ||
+	    (err = kernel_member_info(p, "struct rt_prio_array", "queue",
+				      &member)) ||
+	    (err = kernel_member_offset(p, "struct rb_node", "rb_right",
+					&builder->rb_right_offset)) ||
+	    (err = kernel_member_offset(p, "struct rb_node", "rb_left",
+					&builder->rb_left_offset)) ||
+	    (err = kernel_member_offset(p, "struct sched_entity", "run_node",
+					&builder->se_run_node_offset)) ||
+	    (err = kernel_find_optional_field(p, "struct sched_entity", "my_q",
+					      &builder->se_my_q)) ||
+	    (err = kernel_member_offset(p, "struct sched_rt_entity", "run_list",
+					&builder->rt_run_list_offset)) ||
+	    (err = kernel_find_optional_field(p, "struct sched_rt_entity",
+					      "my_q", &builder->rt_my_q)) ||
+	    (err = kernel_member_offset(p, "struct sched_dl_entity", "rb_node",
+					&builder->dl_rb_node_offset)) ||
+	    (err = kernel_member_offset(p, "struct task_struct", "se",
+					&builder->task_se_offset)) ||
+	    (err = kernel_member_offset(p, "struct task_struct", "rt",
+					&builder->task_rt_offset)) ||
+	    (err = kernel_member_offset(p, "struct task_struct", "dl",
+					&builder->task_dl_offset)) ||
+	    (err = kernel_find_field(p, "struct task_struct", "policy",
+				     &builder->task_policy)) ||
+	    (err = kernel_find_field(p, "struct task_struct", "prio",
+				     &builder->task_prio)) ||
+	    (err = kernel_find_field(p, "struct sched_entity", "vruntime",
+				     &builder->task_vruntime)) ||
+	    (err = kernel_find_field(p, "struct sched_entity",
+				     "sum_exec_runtime",
+				     &builder->task_sum_exec_runtime)) ||
+	    (err = kernel_find_field(p, "struct sched_dl_entity", "deadline",
+				     &builder->task_deadline)))
+		return err;
+	builder->rt_queue_offset += member.bit_offset / 8;
+	if (drgn_type_kind(member.qualified_type.type) != DRGN_TYPE_ARRAY) {
+		return drgn_error_create(DRGN_ERROR_TYPE,
+					 "unexpected struct rt_prio_array layout");
+	}
+	builder->rt_queue_length =
+		drgn_type_length(member.qualified_type.type);
+
+	/* Make the nested fields relative to the outer structures. */
+	builder->cfs_min_vruntime.offset += builder->cfs_offset;
+	builder->task_vruntime.offset += builder->task_se_offset;
+	builder->task_sum_exec_runtime.offset += builder->task_se_offset;
+	builder->task_deadline.offset += builder->task_dl_offset;
+	builder->cfs_root_offset += builder->cfs_offset;
+	builder->rt_queue_offset += builder->rt_offset;
+	builder->dl_root_offset += dl_offset;
+	uint64_t rt_queue_size = builder->rt_queue_length * 2 *
+				 builder->word_size;
+	if (builder->cfs_root_offset + builder->word_size > builder->rq_size ||
+	    builder->rt_queue_offset + rt_queue_size > builder->rq_size ||
+	    builder->dl_root_offset + builder->word_size > builder->rq_size) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "unexpected struct rq layout");
+	}
+
+	struct kernel_field task_fields[] = {
+		builder->task_policy, builder->task_prio,
+		builder->task_vruntime, builder->task_sum_exec_runtime,
+		builder->task_deadline,
+	};
+	kernel_field_span(task_fields, ARRAY_SIZE(task_fields),
+			  &builder->task_span_start, &builder->task_span_size);
+
+	builder->rq_buf = malloc(builder->rq_size);
+	builder->task_buf = malloc(builder->task_span_size);
+	if (!builder->rq_buf || !builder->task_buf)
+		return &drgn_enomem;
+	return NULL;
+}
+
+static void rq_snapshot_builder_deinit(struct rq_snapshot_builder *builder)
+{
+	free(builder->task_buf);
+	free(builder->rq_buf);
+	linux_helper_rq_task_vector_deinit(&builder->tasks);
+	linux_helper_rq_cpu_vector_deinit(&builder->cpus);
+	kernel_uint64_vector_deinit(&builder->rb_stack);
+}
+
+static struct drgn_error *rq_snapshot_read_word(struct rq_snapshot_builder *builder,
+						uint64_t address, uint64_t *ret)
+{
+	struct kernel_field field = { .size = builder->word_size };
+	return kernel_read_field(builder->prog, builder->bswap, address, field,
+				 ret);
+}
+
+static struct drgn_error *
+rq_snapshot_add_task(struct rq_snapshot_builder *builder, uint64_t cpu,
+		     uint64_t task, enum linux_helper_rq_queue queue)
+{
+	struct drgn_error *err;
+
+	err = drgn_program_read_memory(builder->prog, builder->task_buf,
+				       task + builder->task_span_start,
+				       builder->task_span_size, false);
+	if (err)
+		return err;
+	struct linux_helper_rq_task *entry =
+		linux_helper_rq_task_vector_append_entry(&builder->tasks);
+	if (!entry)
+		return &drgn_enomem;
+	const char *buf = builder->task_buf;
+	uint64_t start = builder->task_span_start;
+	bool bswap = builder->bswap;
+	*entry = (struct linux_helper_rq_task){
+		.cpu = cpu,
+		.task = task,
+		.queue = queue,
+		.policy = kernel_field_get(buf, start, builder->task_policy,
+					   bswap),
+		.prio = kernel_field_get(buf, start, builder->task_prio,
+					 bswap),
+		.vruntime = kernel_field_get(buf, start,
+					     builder->task_vruntime, bswap),
+		.deadline = kernel_field_get(buf, start,
+					     builder->task_deadline, bswap),
+		.sum_exec_runtime =
+			kernel_field_get(buf, start,
+					 builder->task_sum_exec_runtime,
+					 bswap),
+	};
+	return NULL;
+}
+
+typedef struct drgn_error *rq_snapshot_node_fn(struct rq_snapshot_builder *builder,
+					       uint64_t cpu, uint64_t node,
+					       unsigned int depth);
+
+/* Visit an rbtree in order, i.e., from the leftmost (earliest) node. */
+static struct drgn_error *rq_snapshot_walk_rb(struct rq_snapshot_builder *builder,
+					      uint64_t cpu, uint64_t root,
+					      rq_snapshot_node_fn *fn,
+					      unsigned int depth)
+{
+	struct drgn_error *err;
+	/* Nested walks share the stack, so only use the part above ours. */
+	size_t base = builder->rb_stack.size;
+	uint64_t node = root;
+	size_t visited = 0;
+
+	for (;;) {
+		while (node) {
+			if (!kernel_uint64_vector_append(&builder->rb_stack,
+							 &node))
+				return &drgn_enomem;
+			err = rq_snapshot_read_word(builder,
+						    node +
+						    builder->rb_left_offset,
+						    &node);
+			if (err)
+				return err;
+		}
+		if (builder->rb_stack.size == base)
+			return NULL;
+		node = builder->rb_stack.data[--builder->rb_stack.size];
+		if (++visited > RQ_SNAPSHOT_MAX_ENTITIES) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "runqueue tree is too large");
+		}
+		err = fn(builder, cpu, node, depth);
+		if (err)
+			return err;
+		err = rq_snapshot_read_word(builder,
+					    node + builder->rb_right_offset,
+					    &node);
+		if (err)
+			return err;
+	}
+}
+
+static struct drgn_error *rq_snapshot_cfs_node(struct rq_snapshot_builder *builder,
+					       uint64_t cpu, uint64_t node,
+					       unsigned int depth)
+{
+	struct drgn_error *err;
+	uint64_t se = node - builder->se_run_node_offset;
+	if (builder->se_my_q.size) {
+		/* A group entity has the group's runqueue. */
+		uint64_t my_q;
+		err = kernel_read_field(builder->prog, builder->bswap, se,
+					builder->se_my_q, &my_q);
+		if (err)
+			return err;
+		if (my_q) {
+			if (depth >= RQ_SNAPSHOT_MAX_GROUP_DEPTH) {
+				return drgn_error_create(DRGN_ERROR_OTHER,
+							 "task groups are nested too deeply");
+			}
+			uint64_t root;
+			err = rq_snapshot_read_word(builder,
+						    my_q +
+						    builder->cfs_root_offset -
+						    builder->cfs_offset,
+						    &root);
+			if (err)
+				return err;
+			return rq_snapshot_walk_rb(builder, cpu, root,
+						   rq_snapshot_cfs_node,
+						   depth + 1);
+		}
+	}
+	return rq_snapshot_add_task(builder, cpu, se - builder->task_se_offset,
+				    LINUX_HELPER_RQ_FAIR);
+}
+
+static struct drgn_error *rq_snapshot_dl_node(struct rq_snapshot_builder *builder,
+					      uint64_t cpu, uint64_t node,
+					      unsigned int depth)
+{
+	uint64_t task = (node - builder->dl_rb_node_offset -
+			 builder->task_dl_offset);
+	if (task == builder->curr)
+		return NULL;
+	return rq_snapshot_add_task(builder, cpu, task,
+				    LINUX_HELPER_RQ_DEADLINE);
+}
+
+/*
+ * Walk the priority lists of an rt_rq. queue is the address of the array of
+ * list heads, and heads is its contents if it was already read, or NULL.
+ */
+static struct drgn_error *rq_snapshot_walk_rt(struct rq_snapshot_builder *builder,
+					      uint64_t cpu, uint64_t queue,
+					      const char *heads,
+					      unsigned int depth)
+{
+	struct drgn_error *err;
+	struct kernel_field word_field = { .size = builder->word_size };
+	size_t visited = 0;
+
+	for (uint64_t i = 0; i < builder->rt_queue_length; i++) {
+		uint64_t head = queue + i * 2 * builder->word_size;
+		uint64_t pos;
+		if (heads) {
+			pos = kernel_field_get(heads +
+					       i * 2 * builder->word_size,
+					       0, word_field, builder->bswap);
+		} else {
+			err = rq_snapshot_read_word(builder, head, &pos);
+			if (err)
+				return err;
+		}
+		while (pos != head) {
+			if (++visited > RQ_SNAPSHOT_MAX_ENTITIES) {
+				return drgn_error_create(DRGN_ERROR_OTHER,
+							 "runqueue list is too long");
+			}
+			uint64_t rt_se = pos - builder->rt_run_list_offset;
+			uint64_t my_q = 0;
+			if (builder->rt_my_q.size) {
+				err = kernel_read_field(builder->prog,
+							builder->bswap, rt_se,
+							builder->rt_my_q,
+							&my_q);
+				if (err)
+					return err;
+			}
+			if (my_q) {
+				if (depth >= RQ_SNAPSHOT_MAX_GROUP_DEPTH) {
+					return drgn_error_create(DRGN_ERROR_OTHER,
+								 "task groups are nested too deeply");
+				}
+				err = rq_snapshot_walk_rt(builder, cpu,
+							  my_q +
+							  builder->rt_queue_offset -
+							  builder->rt_offset,
+							  NULL, depth + 1);
+				if (err)
+					return err;
+			} else if (rt_se - builder->task_rt_offset !=
+				   builder->curr) {
+				err = rq_snapshot_add_task(builder, cpu,
+							   rt_se -
+							   builder->task_rt_offset,
+							   LINUX_HELPER_RQ_RT);
+				if (err)
+					return err;
+			}
+			err = rq_snapshot_read_word(builder, pos, &pos);
+			if (err)
+				return err;
+		}
+	}
+	return NULL;
+}
+
+static struct drgn_error *rq_snapshot_cpu(struct rq_snapshot_builder *builder,
+					  uint64_t cpu, uint64_t offset)
+{
+	struct drgn_error *err;
+	uint64_t rq = builder->runqueues + offset;
+	const char *buf = builder->rq_buf;
+	bool bswap = builder->bswap;
+	struct kernel_field word_field = { .size = builder->word_size };
+
+	/* The whole rq is read at once rather than field by field. */
+	err = drgn_program_read_memory(builder->prog, builder->rq_buf, rq,
+				       builder->rq_size, false);
+	if (err)
+		return err;
+	struct linux_helper_rq_cpu *entry =
+		linux_helper_rq_cpu_vector_append_entry(&builder->cpus);
+	if (!entry)
+		return &drgn_enomem;
+	*entry = (struct linux_helper_rq_cpu){
+		.cpu = cpu,
+		.rq = rq,
+		.curr = kernel_field_get(buf, 0, builder->rq_curr, bswap),
+		.clock = kernel_field_get(buf, 0, builder->rq_clock, bswap),
+		.clock_task = kernel_field_get(buf, 0, builder->rq_clock_task,
+					       bswap),
+		.nr_running = kernel_field_get(buf, 0, builder->rq_nr_running,
+					       bswap),
+		.min_vruntime = kernel_field_get(buf, 0,
+						 builder->cfs_min_vruntime,
+						 bswap),
+	};
+	uint64_t curr = builder->curr = entry->curr;
+
+	if (curr) {
+		err = rq_snapshot_add_task(builder, cpu, curr,
+					   LINUX_HELPER_RQ_CURRENT);
+		if (err)
+			return err;
+	}
+	err = rq_snapshot_walk_rb(builder, cpu,
+				  kernel_field_get(buf + builder->dl_root_offset,
+						   0, word_field, bswap),
+				  rq_snapshot_dl_node, 0);
+	if (err)
+		return err;
+	err = rq_snapshot_walk_rt(builder, cpu, rq + builder->rt_queue_offset,
+				  buf + builder->rt_queue_offset, 0);
+	if (err)
+		return err;
+	return rq_snapshot_walk_rb(builder, cpu,
+				   kernel_field_get(buf +
+						    builder->cfs_root_offset,
+						    0, word_field, bswap),
+				   rq_snapshot_cfs_node, 0);
+}
+
+struct drgn_error *
+linux_helper_rq_snapshot_create(struct drgn_program *prog,
+				struct linux_helper_rq_snapshot **ret)
+{
+	struct drgn_error *err;
+	struct rq_snapshot_builder builder;
+	struct kernel_uint64_vector cpus = VECTOR_INIT;
+	struct kernel_uint64_vector offsets = VECTOR_INIT;
+
+	err = rq_snapshot_builder_init(&builder, prog);
+	if (err)
+		goto out;
+	err = kernel_possible_cpus(prog, builder.bswap, builder.word_size,
+				   &cpus, &offsets);
+	if (err)
+		goto out;
+	for (size_t i = 0; i < offsets.size; i++) {
+		err = rq_snapshot_cpu(&builder, cpus.data[i], offsets.data[i]);
+		if (err)
+			goto out;
+	}
+
+	struct linux_helper_rq_snapshot *snapshot = malloc(sizeof(*snapshot));
+	if (!snapshot) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_rq_cpu_vector_shrink_to_fit(&builder.cpus);
+	linux_helper_rq_task_vector_shrink_to_fit(&builder.tasks);
+	snapshot->cpus = builder.cpus.data;
+	snapshot->num_cpus = builder.cpus.size;
+	snapshot->tasks = builder.tasks.data;
+	snapshot->num_tasks = builder.tasks.size;
+	linux_helper_rq_cpu_vector_init(&builder.cpus);
+	linux_helper_rq_task_vector_init(&builder.tasks);
+	*ret = snapshot;
+out:
+	kernel_uint64_vector_deinit(&offsets);
+	kernel_uint64_vector_deinit(&cpus);
+	rq_snapshot_builder_deinit(&builder);
+	return err;
+}
+
+void linux_helper_rq_snapshot_destroy(struct linux_helper_rq_snapshot *snapshot)
+{
+	if (!snapshot)
+		return;
+	free(snapshot->tasks);
+	free(snapshot->cpus);
+	free(snapshot);
+}
+
+/*
+ * vmap areas.
+ *
+ * Allocated areas are kept in an rbtree (one per vmap node since Linux 6.9).
+ * The trees are walked breadth-first so that each level of nodes is read with
+ * one batch of scattered reads, followed by one batch for the struct vm_struct
+ * of every area.
+ */
+
+/* Bound on the number of areas in case of corruption. */
+#define VMAP_AREAS_MAX (1 << 26)
+
+DEFINE_VECTOR(linux_helper_vmap_area_vector, struct linux_helper_vmap_area)
+DEFINE_VECTOR(linux_helper_vmap_caller_vector, struct linux_helper_vmap_caller)
+DEFINE_HASH_MAP(vmap_caller_map, uint64_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+
+struct vmap_areas_builder {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	/* struct vmap_area, with the struct rb_node fields made relative. */
+	uint64_t rb_node_offset;
+	struct kernel_field va_start, va_end, va_vm, rb_left, rb_right;
+	uint64_t va_span_start, va_span_size;
+	/* struct vm_struct */
+	struct kernel_field vm_addr, vm_flags, vm_nr_pages, vm_caller;
+	uint64_t vm_span_start, vm_span_size;
+	struct kernel_read_vector reads;
+	struct kernel_char_vector staging, buf;
+	/* struct rb_node * of the current and next levels of the trees. */
+	struct kernel_uint64_vector level, next_level;
+	struct linux_helper_vmap_area_vector areas;
+	struct linux_helper_vmap_caller_vector callers;
+};
+
+static struct drgn_error *
+vmap_areas_builder_init(struct vmap_areas_builder *builder,
+			struct drgn_program *prog)
+{
+	struct drgn_error *err;
+
+	builder->prog = prog;
+	kernel_read_vector_init(&builder->reads);
+	kernel_char_vector_init(&builder->staging);
+	kernel_char_vector_init(&builder->buf);
+	kernel_uint64_vector_init(&builder->level);
+	kernel_uint64_vector_init(&builder->next_level);
+	linux_helper_vmap_area_vector_init(&builder->areas);
+	linux_helper_vmap_caller_vector_init(&builder->callers);
+
+	if ((err = drgn_program_bswap(prog, &builder->bswap)) ||
+	    (err = drgn_program_word_size(prog, &builder->word_size)))
+		return err;
+
+	struct drgn_member_info member;
+	err = kernel_member_info(prog, "struct vmap_area", "rb_node", &member);
+	if (err)
+		return err;
+	builder->rb_node_offset = member.bit_offset / 8;
+	if ((err = kernel_find_field(prog, "struct vmap_area", "va_start",
+				     &builder->va_start)) ||
+	    (err = kernel_find_field(prog, "struct vmap_area", "va_end",
+				     &builder->va_end)) ||
+	    (err = kernel_find_field(prog, "struct vmap_area", "vm",
+				     &builder->va_vm)) ||
+	    (err = kernel_find_field(prog, "struct rb_node", "rb_left",
+				     &builder->rb_left)) ||
+	    (err = kernel_find_field(prog, "struct rb_node", "rb_right",
+				     &builder->rb_right)) ||
+	    (err = kernel_find_field(prog, "struct vm_struct", "addr",
+				     &builder->vm_addr)) ||
+	    (err = kernel_find_field(prog, "struct vm_struct", "flags",
+				     &builder->vm_flags)) ||
+	    (err = kernel_find_field(prog, "struct vm_struct", "nr_pages",
+				     &builder->vm_nr_pages)) ||
+	    (err = kernel_find_field(prog, "struct vm_struct", "caller",
+				     &builder->vm_caller)))
+		return err;
+	builder->rb_left.offset += builder->rb_node_offset;
+	builder->rb_right.offset += builder->rb_node_offset;
+
+	struct kernel_field va_fields[] = {
+		builder->va_start, builder->va_end, builder->va_vm,
+		builder->rb_left, builder->rb_right,
+	};
+	kernel_field_span(va_fields, ARRAY_SIZE(va_fields),
+			  &builder->va_span_start, &builder->va_span_size);
+	struct kernel_field vm_fields[] = {
+		builder->vm_addr, builder->vm_flags, builder->vm_nr_pages,
+		builder->vm_caller,
+	};
+	kernel_field_span(vm_fields, ARRAY_SIZE(vm_fields),
+			  &builder->vm_span_start, &builder->vm_span_size);
+	return NULL;
+}
+
+static void vmap_areas_builder_deinit(struct vmap_areas_builder *builder)
+{
+	linux_helper_vmap_caller_vector_deinit(&builder->callers);
+	linux_helper_vmap_area_vector_deinit(&builder->areas);
+	kernel_uint64_vector_deinit(&builder->next_level);
+	kernel_uint64_vector_deinit(&builder->level);
+	kernel_char_vector_deinit(&builder->buf);
+	kernel_char_vector_deinit(&builder->staging);
+	kernel_read_vector_deinit(&builder->reads);
+}
+
+static struct drgn_error *vmap_areas_add_root(struct vmap_areas_builder *builder,
+					      uint64_t root)
+{
+	uint64_t node;
+	struct kernel_field field = { .size = builder->word_size };
+	struct drgn_error *err = kernel_read_field(builder->prog,
+						   builder->bswap, root, field,
+						   &node);
+	if (err)
+		return err;
+	if (node && !kernel_uint64_vector_append(&builder->level, &node))
+		return &drgn_enomem;
+	return NULL;
+}
+
+/*
+ * Find the root of the busy tree of each vmap node, or vmap_area_root before
+ * Linux 6.9.
+ */
+static struct drgn_error *vmap_areas_find_roots(struct vmap_areas_builder *builder)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = builder->prog;
+	struct drgn_object obj;
+
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, "vmap_nodes", NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = drgn_program_find_object(prog, "vmap_area_root", NULL,
+					       DRGN_FIND_OBJECT_VARIABLE,
+					       &obj);
+		if (err)
+			goto out;
+		if (!obj.is_reference) {
+			err = drgn_error_create(DRGN_ERROR_TYPE,
+						"vmap_area_root is not a reference");
+			goto out;
+		}
+		/* rb_node is the only member of struct rb_root. */
+		err = vmap_areas_add_root(builder, obj.reference.address);
+		goto out;
+	} else if (err) {
+		goto out;
+	}
+
+	uint64_t nodes, nr_nodes, node_size;
+	struct drgn_member_info busy, root;
+	struct drgn_qualified_type node_type;
+	if ((err = drgn_object_read_unsigned(&obj, &nodes)) ||
+	    (err = drgn_program_find_object(prog, "nr_vmap_nodes", NULL,
+					    DRGN_FIND_OBJECT_VARIABLE, &obj)) ||
+	    (err = drgn_object_read_unsigned(&obj, &nr_nodes)) ||
+	    (err = drgn_program_find_type(prog, "struct vmap_node", NULL,
+					  &node_type)) ||
+	    (err = drgn_type_sizeof(node_type.type, &node_size)) ||
+	    (err = drgn_program_member_info(prog, node_type.type, "busy",
+					    &busy)) ||
+	    (err = drgn_program_member_info(prog, busy.qualified_type.type,
+					    "root", &root)))
+		goto out;
+	uint64_t root_offset = (busy.bit_offset + root.bit_offset) / 8;
+	for (uint64_t i = 0; i < nr_nodes; i++) {
+		err = vmap_areas_add_root(builder,
+					  nodes + i * node_size + root_offset);
+		if (err)
+			goto out;
+	}
+out:
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+/* Read every level of the trees, adding an area for every node. */
+static struct drgn_error *vmap_areas_walk(struct vmap_areas_builder *builder)
+{
+	struct drgn_error *err;
+	uint64_t span_start = builder->va_span_start;
+	uint64_t span_size = builder->va_span_size;
+	bool bswap = builder->bswap;
+
+	while (builder->level.size) {
+		size_t n = builder->level.size;
+		if (n > VMAP_AREAS_MAX - builder->areas.size) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "too many vmap areas");
+		}
+		builder->reads.size = 0;
+		if (!kernel_read_vector_reserve(&builder->reads, n) ||
+		    !kernel_char_vector_reserve(&builder->buf, n * span_size) ||
+		    !linux_helper_vmap_area_vector_reserve(&builder->areas,
+							   builder->areas.size + n))
+			return &drgn_enomem;
+		for (size_t i = 0; i < n; i++) {
+			struct kernel_read *read =
+				kernel_read_vector_append_entry(&builder->reads);
+			read->address = (builder->level.data[i] -
+					 builder->rb_node_offset + span_start);
+			read->index = i;
+		}
+		err = kernel_read_scattered(builder->prog, &builder->reads,
+					    span_size, false, &builder->staging,
+					    builder->buf.data);
+		if (err)
+			return err;
+
+		builder->next_level.size = 0;
+		for (size_t i = 0; i < n; i++) {
+			const char *p = builder->buf.data + i * span_size;
+			uint64_t start = kernel_field_get(p, span_start,
+							  builder->va_start,
+							  bswap);
+			uint64_t end = kernel_field_get(p, span_start,
+							builder->va_end, bswap);
+			struct linux_helper_vmap_area *area =
+				linux_helper_vmap_area_vector_append_entry(&builder->areas);
+			*area = (struct linux_helper_vmap_area){
+				.va = (builder->level.data[i] -
+				       builder->rb_node_offset),
+				.start = start,
+				.size = end - start,
+				.vm = kernel_field_get(p, span_start,
+						       builder->va_vm, bswap),
+				.mapped_pages = UINT64_MAX,
+			};
+			uint64_t children[] = {
+				kernel_field_get(p, span_start,
+						 builder->rb_left, bswap),
+				kernel_field_get(p, span_start,
+						 builder->rb_right, bswap),
+			};
+			for (size_t j = 0; j < ARRAY_SIZE(children); j++) {
+				if (children[j] &&
+				    !kernel_uint64_vector_append(&builder->next_level,
+								 &children[j]))
+					return &drgn_enomem;
+			}
+		}
+		struct kernel_uint64_vector tmp = builder->level;
+		builder->level = builder->next_level;
+		builder->next_level = tmp;
+	}
+	return NULL;
+}
+
+/* Read the struct vm_struct of every area that has one. */
+static struct drgn_error *vmap_areas_read_vms(struct vmap_areas_builder *builder)
+{
+	struct drgn_error *err;
+	struct linux_helper_vmap_area *areas = builder->areas.data;
+	size_t num_areas = builder->areas.size;
+	uint64_t span_start = builder->vm_span_start;
+	uint64_t span_size = builder->vm_span_size;
+	bool bswap = builder->bswap;
+
+	builder->reads.size = 0;
+	for (size_t i = 0; i < num_areas; i++) {
+		if (!areas[i].vm)
+			continue;
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&builder->reads);
+		if (!read)
+			return &drgn_enomem;
+		read->address = areas[i].vm + span_start;
+		read->index = builder->reads.size - 1;
+	}
+	if (!kernel_char_vector_reserve(&builder->buf,
+					builder->reads.size * span_size))
+		return &drgn_enomem;
+	/*
+	 * The vm pointer isn't always valid (e.g., before Linux 5.4, it was
+	 * only set if the area had the VM_VM_AREA flag), so faults aren't
+	 * fatal, and the vm_struct must point back to the area.
+	 */
+	err = kernel_read_scattered(builder->prog, &builder->reads, span_size,
+				    true, &builder->staging, builder->buf.data);
+	if (err)
+		return err;
+
+	const char *p = builder->buf.data;
+	for (size_t i = 0; i < num_areas; i++) {
+		if (!areas[i].vm)
+			continue;
+		if (kernel_field_get(p, span_start, builder->vm_addr, bswap) ==
+		    areas[i].start) {
+			areas[i].flags = kernel_field_get(p, span_start,
+							  builder->vm_flags,
+							  bswap);
+			areas[i].caller = kernel_field_get(p, span_start,
+							   builder->vm_caller,
+							   bswap);
+			areas[i].nr_pages =
+				kernel_field_get(p, span_start,
+						 builder->vm_nr_pages, bswap);
+		} else {
+			areas[i].vm = 0;
+		}
+		p += span_size;
+	}
+	return NULL;
+}
+
+/*
+ * Count the pages of each area that are mapped in the kernel page table. The
+ * areas are sorted, so the iterator only needs to be restarted when there is a
+ * gap between areas.
+ */
+static struct drgn_error *
+vmap_areas_count_mapped(struct vmap_areas_builder *builder)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = builder->prog;
+	struct linux_helper_vmap_area *areas = builder->areas.data;
+	size_t num_areas = builder->areas.size;
+
+	err = kernel_pgtable_check(prog);
+	if (err)
+		return err;
+	uint64_t page_size = prog->vmcoreinfo.page_size;
+	if (!page_size) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "page size is not known");
+	}
+	if (!num_areas)
+		return NULL;
+
+	struct pgtable_iterator *it;
+	err = kernel_pgtable_iterator_begin(prog,
+					    prog->vmcoreinfo.swapper_pg_dir,
+					    areas[0].start, &it);
+	if (err)
+		return err;
+	pgtable_iterator_next_fn *next =
+		prog->platform.arch->linux_kernel_pgtable_iterator_next;
+	/* Last range returned by the iterator. */
+	uint64_t range_start = 0, range_end = 0;
+	bool range_mapped = false;
+	for (size_t i = 0; i < num_areas; i++) {
+		uint64_t pos = areas[i].start;
+		uint64_t end = pos + areas[i].size;
+		uint64_t mapped = 0;
+		while (pos < end) {
+			if (pos < range_start || pos >= range_end) {
+				if (it->virt_addr != pos) {
+					it->virt_addr = pos;
+					prog->platform.arch->pgtable_iterator_arch_init(it->arch);
+				}
+				uint64_t phys_addr;
+				err = next(it, &range_start, &phys_addr);
+				if (err)
+					goto out;
+				range_end = it->virt_addr;
+				/* The last range may wrap around. */
+				if (range_end <= range_start)
+					range_end = UINT64_MAX;
+				range_mapped = phys_addr != UINT64_MAX;
+			}
+			uint64_t n = min(range_end, end) - pos;
+			if (range_mapped)
+				mapped += n;
+			pos += n;
+		}
+		areas[i].mapped_pages = mapped / page_size;
+	}
+	err = NULL;
+out:
+	prog->pgtable_it_in_use = false;
+	return err;
+}
+
+/* Sum the areas by caller. */
+static struct drgn_error *
+vmap_areas_aggregate(struct vmap_areas_builder *builder, bool validate)
+{
+	struct drgn_error *err = NULL;
+	struct vmap_caller_map indices;
+
+	vmap_caller_map_init(&indices);
+	for (size_t i = 0; i < builder->areas.size; i++) {
+		struct linux_helper_vmap_area *area = &builder->areas.data[i];
+		struct vmap_caller_map_entry entry = {
+			area->caller, builder->callers.size,
+		};
+		struct vmap_caller_map_iterator it;
+		int r = vmap_caller_map_insert(&indices, &entry, &it);
+		if (r < 0) {
+			err = &drgn_enomem;
+			goto out;
+		} else if (r > 0) {
+			struct linux_helper_vmap_caller *caller =
+				linux_helper_vmap_caller_vector_append_entry(&builder->callers);
+			if (!caller) {
+				err = &drgn_enomem;
+				goto out;
+			}
+			*caller = (struct linux_helper_vmap_caller){
+				.caller = area->caller,
+				.mapped_pages = validate ? 0 : UINT64_MAX,
+			};
+		}
+		struct linux_helper_vmap_caller *caller =
+			&builder->callers.data[it.entry->value];
+		caller->count++;
+		caller->size += area->size;
+		caller->nr_pages += area->nr_pages;
+		if (validate)
+			caller->mapped_pages += area->mapped_pages;
+	}
+out:
+	vmap_caller_map_deinit(&indices);
+	return err;
+}
+
+static int vmap_area_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_vmap_area *a = _a, *b = _b;
+	if (a->start < b->start)
+		return -1;
+	else if (a->start > b->start)
+		return 1;
+	else
+		return 0;
+}
+
+static int vmap_caller_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_vmap_caller *a = _a, *b = _b;
+	/* Largest total size first. */
+	if (a->size > b->size)
+		return -1;
+	else if (a->size < b->size)
+		return 1;
+	else if (a->caller < b->caller)
+		return -1;
+	else if (a->caller > b->caller)
+		return 1;
+	else
+		return 0;
+}
+
+struct drgn_error *
+linux_helper_vmap_areas_create(struct drgn_program *prog, bool validate,
+			       struct linux_helper_vmap_areas **ret)
+{
+	struct drgn_error *err;
+	struct vmap_areas_builder builder;
+
+	err = vmap_areas_builder_init(&builder, prog);
+	if (err)
+		goto out;
+	err = vmap_areas_find_roots(&builder);
+	if (err)
+		goto out;
+	err = vmap_areas_walk(&builder);
+	if (err)
+		goto out;
+	qsort(builder.areas.data, builder.areas.size,
+	      sizeof(builder.areas.data[0]), vmap_area_cmp);
+	err = vmap_areas_read_vms(&builder);
+	if (err)
+		goto out;
+	if (validate) {
+		err = vmap_areas_count_mapped(&builder);
+		if (err)
+			goto out;
+	}
+	err = vmap_areas_aggregate(&builder, validate);
+	if (err)
+		goto out;
+	qsort(builder.callers.data, builder.callers.size,
+	      sizeof(builder.callers.data[0]), vmap_caller_cmp);
+
+	struct linux_helper_vmap_areas *areas = malloc(sizeof(*areas));
+	if (!areas) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_vmap_area_vector_shrink_to_fit(&builder.areas);
+	linux_helper_vmap_caller_vector_shrink_to_fit(&builder.callers);
+	areas->areas = builder.areas.data;
+	areas->num_areas = builder.areas.size;
+	areas->callers = builder.callers.data;
+	areas->num_callers = builder.callers.size;
+	linux_helper_vmap_area_vector_init(&builder.areas);
+	linux_helper_vmap_caller_vector_init(&builder.callers);
+	*ret = areas;
+out:
+	vmap_areas_builder_deinit(&builder);
+	return err;
+}
+
+void linux_helper_vmap_areas_destroy(struct linux_helper_vmap_areas *areas)
+{
+	if (!areas)
+		return;
+	free(areas->callers);
+	free(areas->areas);
+	free(areas);
+}
+
+/*
+ * Timers.
+ *
+ * The per-CPU timer_bases and hrtimer_bases of every CPU are each read in one
+ * batch. Then the hlists of the timer wheel buckets and the hrtimer rbtrees are
+ * walked in lockstep across all CPUs, one batch of scattered reads for each
+ * step.
+ */
+
+/* Bound on the number of timers in case of corruption. */
+#define TIMERS_MAX (1 << 24)
+
+DEFINE_VECTOR(linux_helper_timer_vector, struct linux_helper_timer)
+DEFINE_VECTOR(linux_helper_timer_callback_vector,
+	      struct linux_helper_timer_callback)
+DEFINE_HASH_MAP(timer_callback_map, uint64_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+
+/* A list or tree node to read and where it came from. */
+struct timers_node {
+	uint64_t address;
+	uint64_t cpu;
+	uint32_t base;
+};
+
+DEFINE_VECTOR(timers_node_vector, struct timers_node)
+
+struct timers_builder {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	struct kernel_uint64_vector cpus, offsets;
+	/* Per-CPU struct timer_base timer_bases[NR_BASES]. */
+	uint64_t timer_bases, timer_bases_size, timer_base_size;
+	uint64_t vectors_offset, wheel_size;
+	/* struct timer_list, with entry.next relative to the timer. */
+	uint64_t timer_entry_offset;
+	struct kernel_field timer_next, timer_expires, timer_function;
+	uint64_t timer_span_start, timer_span_size;
+	/* Per-CPU struct hrtimer_cpu_base hrtimer_bases. */
+	uint64_t hrtimer_bases, hrtimer_bases_size;
+	uint64_t clock_base_offset, clock_base_size, nr_clock_bases;
+	/* Offset of the rbtree root in struct hrtimer_clock_base. */
+	uint64_t active_root_offset;
+	/* struct hrtimer, with node.node and node.expires made relative. */
+	uint64_t hrtimer_node_offset;
+	struct kernel_field hrtimer_left, hrtimer_right, hrtimer_expires,
+			    hrtimer_function;
+	uint64_t hrtimer_span_start, hrtimer_span_size;
+	struct kernel_read_vector reads;
+	struct kernel_char_vector staging, buf;
+	struct timers_node_vector level, next_level;
+	struct linux_helper_timer_vector timers;
+	struct linux_helper_timer_callback_vector callbacks;
+};
+
+/*
+ * Get the address and size of a per-CPU array variable and the size of its
+ * elements.
+ */
+static struct drgn_error *timers_percpu_array(struct drgn_program *prog,
+					      const char *name,
+					      uint64_t *address_ret,
+					      uint64_t *size_ret,
+					      uint64_t *element_size_ret)
+{
+	struct drgn_error *err;
+	struct drgn_object obj;
+
+	drgn_object_init(&obj, prog);
+	err = drgn_program_find_object(prog, name, NULL,
+				       DRGN_FIND_OBJECT_VARIABLE, &obj);
+	if (err)
+		goto out;
+	struct drgn_type *type = drgn_underlying_type(obj.type);
+	if (!obj.is_reference ||
+	    (element_size_ret && drgn_type_kind(type) != DRGN_TYPE_ARRAY)) {
+		err = drgn_error_format(DRGN_ERROR_TYPE, "unexpected %s", name);
+		goto out;
+	}
+	*address_ret = obj.reference.address;
+	err = drgn_object_sizeof(&obj, size_ret);
+	if (err || !element_size_ret)
+		goto out;
+	err = drgn_type_sizeof(drgn_type_type(type).type, element_size_ret);
+out:
+	drgn_object_deinit(&obj);
+	return err;
+}
+
+static struct drgn_error *timers_builder_init(struct timers_builder *builder,
+					      struct drgn_program *prog)
+{
+	struct drgn_error *err;
+	struct drgn_program *p = prog;
+
+	builder->prog = prog;
+	kernel_uint64_vector_init(&builder->cpus);
+	kernel_uint64_vector_init(&builder->offsets);
+	kernel_read_vector_init(&builder->reads);
+	kernel_char_vector_init(&builder->staging);
+	kernel_char_vector_init(&builder->buf);
+	timers_node_vector_init(&builder->level);
+	timers_node_vector_init(&builder->next_level);
+	linux_helper_timer_vector_init(&builder->timers);
+	linux_helper_timer_callback_vector_init(&builder->callbacks);
+
+	if ((err = drgn_program_bswap(prog, &builder->bswap)) ||
+	    (err = drgn_program_word_size(prog, &builder->word_size)))
+		return err;
+
+	/* The timer wheel has been per-CPU timer_bases since Linux 4.8. */
+	struct drgn_member_info vectors;
+	uint64_t entry_next_offset;
+	if ((err = timers_percpu_array(p, "timer_bases", &builder->timer_bases,
+				       &builder->timer_bases_size,
+				       &builder->timer_base_size)) ||
+	    (err = kernel_member_info(p, "struct timer_base", "vectors",
+				      &vectors)) ||
+	    (err = kernel_member_offset(p, "struct timer_list", "entry",
+					&builder->timer_entry_offset)) ||
+	    (err = kernel_member_offset(p, "struct hlist_node", "next",
+					&entry_next_offset)) ||
+	    (err = kernel_find_field(p, "struct timer_list", "expires",
+				     &builder->timer_expires)) ||
+	    (err = kernel_find_field(p, "struct timer_list", "function",
+				     &builder->timer_function)))
+		return err;
+	builder->vectors_offset = vectors.bit_offset / 8;
+	builder->wheel_size = drgn_type_length(vectors.qualified_type.type);
+	builder->timer_next = (struct kernel_field){
+		builder->timer_entry_offset + entry_next_offset,
+		builder->word_size,
+	};
+	struct kernel_field timer_fields[] = {
+		builder->timer_next, builder->timer_expires,
+		builder->timer_function,
+	};
+	kernel_field_span(timer_fields, ARRAY_SIZE(timer_fields),
+			  &builder->timer_span_start, &builder->timer_span_size);
+
+	struct drgn_member_info clock_base;
+	uint64_t active_offset, timerqueue_node_offset, rb_node_offset;
+	struct kernel_field rb_left, rb_right;
+	if ((err = timers_percpu_array(p, "hrtimer_bases",
+				       &builder->hrtimer_bases,
+				       &builder->hrtimer_bases_size, NULL)) ||
+	    (err = kernel_member_info(p, "struct hrtimer_cpu_base",
+				      "clock_base", &clock_base)) ||
+	    (err = drgn_type_sizeof(drgn_type_type(clock_base.qualified_type.type).type,
+				    &builder->clock_base_size)) ||
+	    (err = kernel_member_offset(p, "struct hrtimer_clock_base",
+					"active", &active_offset)))
+		return err;
+	builder->clock_base_offset = clock_base.bit_offset / 8;
+	builder->nr_clock_bases =
+		drgn_type_length(clock_base.qualified_type.type);
+	/* struct timerqueue_head has an rb_root_cached since Linux 4.20. */
+	err = kernel_rb_root_offset(p, "struct timerqueue_head", "rb_root",
+				    &builder->active_root_offset);
+	if (err && err->code == DRGN_ERROR_LOOKUP) {
+		drgn_error_destroy(err);
+		err = kernel_member_offset(p, "struct timerqueue_head", "head",
+					   &builder->active_root_offset);
+	}
+	if (err)
+		return err;
+	builder->active_root_offset += active_offset;
+
+	if ((err = kernel_member_offset(p, "struct hrtimer", "node",
+					&timerqueue_node_offset)) ||
+	    (err = kernel_member_offset(p, "struct timerqueue_node", "node",
+					&rb_node_offset)) ||
+	    (err = kernel_find_field(p, "struct timerqueue_node", "expires",
+				     &builder->hrtimer_expires)) ||
+	    (err = kernel_find_field(p, "struct rb_node", "rb_left",
+				     &rb_left)) ||
+	    (err = kernel_find_field(p, "struct rb_node", "rb_right",
+				     &rb_right)) ||
+	    (err = kernel_find_field(p, "struct hrtimer", "function",
+				     &builder->hrtimer_function)))
+		return err;
+	builder->hrtimer_node_offset = timerqueue_node_offset + rb_node_offset;
+	builder->hrtimer_expires.offset += timerqueue_node_offset;
+	builder->hrtimer_left = rb_left;
+	builder->hrtimer_left.offset += builder->hrtimer_node_offset;
+	builder->hrtimer_right = rb_right;
+	builder->hrtimer_right.offset += builder->hrtimer_node_offset;
+	struct kernel_field hrtimer_fields[] = {
+		builder->hrtimer_left, builder->hrtimer_right,
+		builder->hrtimer_expires, builder->hrtimer_function,
+	};
+	kernel_field_span(hrtimer_fields, ARRAY_SIZE(hrtimer_fields),
+			  &builder->hrtimer_span_start,
+			  &builder->hrtimer_span_size);
+
+	return kernel_possible_cpus(prog, builder->bswap, builder->word_size,
+				    &builder->cpus, &builder->offsets);
+}
+
+static void timers_builder_deinit(struct timers_builder *builder)
+{
+	linux_helper_timer_callback_vector_deinit(&builder->callbacks);
+	linux_helper_timer_vector_deinit(&builder->timers);
+	timers_node_vector_deinit(&builder->next_level);
+	timers_node_vector_deinit(&builder->level);
+	kernel_char_vector_deinit(&builder->buf);
+	kernel_char_vector_deinit(&builder->staging);
+	kernel_read_vector_deinit(&builder->reads);
+	kernel_uint64_vector_deinit(&builder->offsets);
+	kernel_uint64_vector_deinit(&builder->cpus);
+}
+
+/* Read a per-CPU variable of every CPU into builder->buf. */
+static struct drgn_error *timers_read_percpu(struct timers_builder *builder,
+					     uint64_t address, uint64_t size)
+{
+	size_t num_cpus = builder->offsets.size;
+
+	builder->reads.size = 0;
+	if (!kernel_read_vector_reserve(&builder->reads, num_cpus) ||
+	    !kernel_char_vector_reserve(&builder->buf, num_cpus * size))
+		return &drgn_enomem;
+	for (size_t i = 0; i < num_cpus; i++) {
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&builder->reads);
+		read->address = address + builder->offsets.data[i];
+		read->index = i;
+	}
+	return kernel_read_scattered(builder->prog, &builder->reads, size,
+				     false, &builder->staging,
+				     builder->buf.data);
+}
+
+static struct drgn_error *timers_add_root(struct timers_builder *builder,
+					  const char *p, uint64_t cpu,
+					  uint32_t base)
+{
+	struct kernel_field word_field = { .size = builder->word_size };
+	uint64_t node = kernel_field_get(p, 0, word_field, builder->bswap);
+	if (!node)
+		return NULL;
+	struct timers_node *entry =
+		timers_node_vector_append_entry(&builder->level);
+	if (!entry)
+		return &drgn_enomem;
+	*entry = (struct timers_node){ node, cpu, base };
+	return NULL;
+}
+
+/*
+ * Walk the lists or trees starting from the nodes in builder->level, adding a
+ * timer for every node.
+ */
+static struct drgn_error *timers_walk(struct timers_builder *builder,
+				      enum linux_helper_timer_kind kind)
+{
+	struct drgn_error *err;
+	bool wheel = kind == LINUX_HELPER_TIMER_WHEEL;
+	bool bswap = builder->bswap;
+	uint64_t node_offset, span_start, span_size;
+	struct kernel_field expires, function, links[2];
+	size_t num_links;
+
+	if (wheel) {
+		node_offset = builder->timer_entry_offset;
+		span_start = builder->timer_span_start;
+		span_size = builder->timer_span_size;
+		expires = builder->timer_expires;
+		function = builder->timer_function;
+		links[0] = builder->timer_next;
+		num_links = 1;
+	} else {
+		node_offset = builder->hrtimer_node_offset;
+		span_start = builder->hrtimer_span_start;
+		span_size = builder->hrtimer_span_size;
+		expires = builder->hrtimer_expires;
+		function = builder->hrtimer_function;
+		links[0] = builder->hrtimer_left;
+		links[1] = builder->hrtimer_right;
+		num_links = 2;
+	}
+
+	while (builder->level.size) {
+		size_t n = builder->level.size;
+		if (n > TIMERS_MAX - builder->timers.size) {
+			return drgn_error_create(DRGN_ERROR_OTHER,
+						 "too many timers");
+		}
+		builder->reads.size = 0;
+		if (!kernel_read_vector_reserve(&builder->reads, n) ||
+		    !kernel_char_vector_reserve(&builder->buf, n * span_size) ||
+		    !linux_helper_timer_vector_reserve(&builder->timers,
+						       builder->timers.size + n))
+			return &drgn_enomem;
+		for (size_t i = 0; i < n; i++) {
+			struct kernel_read *read =
+				kernel_read_vector_append_entry(&builder->reads);
+			read->address = (builder->level.data[i].address -
+					 node_offset + span_start);
+			read->index = i;
+		}
+		err = kernel_read_scattered(builder->prog, &builder->reads,
+					    span_size, false, &builder->staging,
+					    builder->buf.data);
+		if (err)
+			return err;
+
+		builder->next_level.size = 0;
+		for (size_t i = 0; i < n; i++) {
+			const struct timers_node *node =
+				&builder->level.data[i];
+			const char *p = builder->buf.data + i * span_size;
+			struct linux_helper_timer *timer =
+				linux_helper_timer_vector_append_entry(&builder->timers);
+			*timer = (struct linux_helper_timer){
+				.cpu = node->cpu,
+				.kind = kind,
+				.base = node->base,
+				.timer = node->address - node_offset,
+				.expires = kernel_field_get(p, span_start,
+							    expires, bswap),
+				.function = kernel_field_get(p, span_start,
+							     function, bswap),
+			};
+			for (size_t j = 0; j < num_links; j++) {
+				uint64_t link = kernel_field_get(p, span_start,
+								 links[j],
+								 bswap);
+				if (!link)
+					continue;
+				struct timers_node *next =
+					timers_node_vector_append_entry(&builder->next_level);
+				if (!next)
+					return &drgn_enomem;
+				*next = (struct timers_node){
+					link, node->cpu, node->base,
+				};
+			}
+		}
+		struct timers_node_vector tmp = builder->level;
+		builder->level = builder->next_level;
+		builder->next_level = tmp;
+	}
+	return NULL;
+}
+
+static struct drgn_error *timers_scan_wheel(struct timers_builder *builder)
+{
+	struct drgn_error *err;
+	uint64_t size = builder->timer_bases_size;
+	uint64_t nr_bases = size / builder->timer_base_size;
+
+	err = timers_read_percpu(builder, builder->timer_bases, size);
+	if (err)
+		return err;
+	builder->level.size = 0;
+	for (size_t i = 0; i < builder->offsets.size; i++) {
+		for (uint64_t base = 0; base < nr_bases; base++) {
+			const char *vectors = (builder->buf.data + i * size +
+					       base * builder->timer_base_size +
+					       builder->vectors_offset);
+			for (uint64_t j = 0; j < builder->wheel_size; j++) {
+				err = timers_add_root(builder,
+						      vectors +
+						      j * builder->word_size,
+						      builder->cpus.data[i],
+						      base);
+				if (err)
+					return err;
+			}
+		}
+	}
+	return timers_walk(builder, LINUX_HELPER_TIMER_WHEEL);
+}
+
+static struct drgn_error *timers_scan_hrtimers(struct timers_builder *builder)
+{
+	struct drgn_error *err;
+	uint64_t size = builder->hrtimer_bases_size;
+
+	err = timers_read_percpu(builder, builder->hrtimer_bases, size);
+	if (err)
+		return err;
+	builder->level.size = 0;
+	for (size_t i = 0; i < builder->offsets.size; i++) {
+		for (uint64_t base = 0; base < builder->nr_clock_bases;
+		     base++) {
+			err = timers_add_root(builder,
+					      builder->buf.data + i * size +
+					      builder->clock_base_offset +
+					      base * builder->clock_base_size +
+					      builder->active_root_offset,
+					      builder->cpus.data[i], base);
+			if (err)
+				return err;
+		}
+	}
+	return timers_walk(builder, LINUX_HELPER_TIMER_HRTIMER);
+}
+
+/* Count the timers by callback. */
+static struct drgn_error *timers_aggregate(struct timers_builder *builder)
+{
+	struct drgn_error *err = NULL;
+	struct timer_callback_map indices;
+
+	timer_callback_map_init(&indices);
+	for (size_t i = 0; i < builder->timers.size; i++) {
+		struct linux_helper_timer *timer = &builder->timers.data[i];
+		struct timer_callback_map_entry entry = {
+			timer->function, builder->callbacks.size,
+		};
+		struct timer_callback_map_iterator it;
+		int r = timer_callback_map_insert(&indices, &entry, &it);
+		if (r < 0) {
+			err = &drgn_enomem;
+			goto out;
+		} else if (r > 0) {
+			struct linux_helper_timer_callback *callback =
+				linux_helper_timer_callback_vector_append_entry(&builder->callbacks);
+			if (!callback) {
+				err = &drgn_enomem;
+				goto out;
+			}
+			*callback = (struct linux_helper_timer_callback){
+				.function = timer->function,
+			};
+		}
+		struct linux_helper_timer_callback *callback =
+			&builder->callbacks.data[it.entry->value];
+		if (timer->kind == LINUX_HELPER_TIMER_WHEEL)
+			callback->num_timers++;
+		else
+			callback->num_hrtimers++;
+	}
+out:
+	timer_callback_map_deinit(&indices);
+	return err;
+}
+
+static int timer_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_timer *a = _a, *b = _b;
+	if (a->cpu != b->cpu)
+		return a->cpu < b->cpu ? -1 : 1;
+	if (a->kind != b->kind)
+		return a->kind < b->kind ? -1 : 1;
+	if (a->base != b->base)
+		return a->base < b->base ? -1 : 1;
+	if (a->expires != b->expires)
+		return a->expires < b->expires ? -1 : 1;
+	if (a->timer != b->timer)
+		return a->timer < b->timer ? -1 : 1;
+	return 0;
+}
+
+static int timer_callback_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_timer_callback *a = _a, *b = _b;
+	size_t a_count = a->num_timers + a->num_hrtimers;
+	size_t b_count = b->num_timers + b->num_hrtimers;
+	/* Most timers first. */
+	if (a_count != b_count)
+		return a_count > b_count ? -1 : 1;
+	if (a->function != b->function)
+		return a->function < b->function ? -1 : 1;
+	return 0;
+}
+
+struct drgn_error *linux_helper_timers_create(struct drgn_program *prog,
+					      struct linux_helper_timers **ret)
+{
+	struct drgn_error *err;
+	struct timers_builder builder;
+
+	err = timers_builder_init(&builder, prog);
+	if (err)
+		goto out;
+	err = timers_scan_wheel(&builder);
+	if (err)
+		goto out;
+	err = timers_scan_hrtimers(&builder);
+	if (err)
+		goto out;
+	qsort(builder.timers.data, builder.timers.size,
+	      sizeof(builder.timers.data[0]), timer_cmp);
+	err = timers_aggregate(&builder);
+	if (err)
+		goto out;
+	qsort(builder.callbacks.data, builder.callbacks.size,
+	      sizeof(builder.callbacks.data[0]), timer_callback_cmp);
+
+	struct linux_helper_timers *timers = malloc(sizeof(*timers));
+	if (!timers) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_timer_vector_shrink_to_fit(&builder.timers);
+	linux_helper_timer_callback_vector_shrink_to_fit(&builder.callbacks);
+	timers->timers = builder.timers.data;
+	timers->num_timers = builder.timers.size;
+	timers->callbacks = builder.callbacks.data;
+	timers->num_callbacks = builder.callbacks.size;
+	linux_helper_timer_vector_init(&builder.timers);
+	linux_helper_timer_callback_vector_init(&builder.callbacks);
+	*ret = timers;
+out:
+	timers_builder_deinit(&builder);
+	return err;
+}
+
+void linux_helper_timers_destroy(struct linux_helper_timers *timers)
+{
+	if (!timers)
+		return;
+	free(timers->callbacks);
+	free(timers->timers);
+	free(timers);
+}
+
+/*
+ * blk-mq requests.
+ *
+ * Hardware queues often share a struct blk_mq_tags, so each distinct one is
+ * only scanned once. The set bits of its sbitmaps are found a word at a time,
+ * then the request pointers for every set bit and the requests themselves are
+ * each read in one batch of scattered reads.
+ */
+
+/* Bounds on sbitmaps in case of corruption. */
+#define BLK_MQ_MAX_MAP_NR 65536
+#define BLK_MQ_MAX_HW_QUEUES 65536
+/* REQ_OP_MASK since Linux 4.10. */
+#define BLK_MQ_REQ_OP_MASK 0xff
+
+DEFINE_VECTOR(linux_helper_blk_mq_request_vector,
+	      struct linux_helper_blk_mq_request)
+DEFINE_HASH_MAP(blk_mq_index_map, uint64_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+
+struct blk_mq_hctx {
+	/* Index of the queue. */
+	size_t queue;
+	uint64_t hctx;
+	uint32_t index;
+};
+
+DEFINE_VECTOR(blk_mq_hctx_vector, struct blk_mq_hctx)
+
+/*
+ * A slot of blk_mq_tags::rqs or blk_mq_tags::static_rqs for a set bit, and the
+ * hardware queue that it was found through.
+ */
+struct blk_mq_slot {
+	uint64_t address;
+	uint64_t rq;
+	size_t hctx;
+};
+
+DEFINE_VECTOR(blk_mq_slot_vector, struct blk_mq_slot)
+
+struct blk_mq_scan {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	/* struct request_queue */
+	struct kernel_field q_nr_hw_queues, q_queue_hw_ctx;
+	/* hctx_table replaced queue_hw_ctx in Linux 6.7. */
+	uint64_t q_hctx_table_offset;
+	/* struct blk_mq_hw_ctx */
+	struct kernel_field hctx_tags, hctx_sched_tags, hctx_queue_num;
+	uint64_t hctx_span_start, hctx_span_size;
+	/* struct blk_mq_tags */
+	struct kernel_field tags_nr_tags, tags_nr_reserved_tags, tags_rqs,
+			    tags_static_rqs;
+	/*
+	 * The struct sbitmap_queues were embedded in struct blk_mq_tags except
+	 * in Linux 5.11-5.15, when they were pointers.
+	 */
+	bool sbq_is_pointer;
+	struct kernel_field tags_bitmap_tags, tags_breserved_tags;
+	uint64_t tags_span_start, tags_span_size;
+	/* struct sbitmap_queue::sb and struct sbitmap */
+	uint64_t sbq_sb_offset;
+	struct kernel_field sb_depth, sb_shift, sb_map_nr, sb_map;
+	uint64_t sb_span_start, sb_span_size;
+	/* struct sbitmap_word, with cleared since Linux 5.0. */
+	uint64_t sbw_size;
+	struct kernel_field sbw_word, sbw_cleared;
+	/* struct request; mq_hctx, start_time_ns, and state are optional. */
+	struct kernel_field rq_q, rq_mq_hctx, rq_cmd_flags, rq_sector,
+			    rq_data_len, rq_tag, rq_internal_tag,
+			    rq_start_time_ns, rq_state;
+	uint64_t rq_span_start, rq_span_size;
+
+	struct blk_mq_index_map queue_indices, hctx_indices;
+	struct blk_mq_hctx_vector hctxs;
+	struct kernel_uint64_set tags_seen, rqs_seen;
+	struct blk_mq_slot_vector slots;
+	struct kernel_read_vector reads;
+	struct kernel_char_vector staging, buf;
+	struct linux_helper_blk_mq_request_vector requests;
+};
+
+static struct drgn_error *blk_mq_scan_init(struct blk_mq_scan *scan,
+					   struct drgn_program *prog)
+{
+	struct drgn_error *err;
+	struct drgn_program *p = prog;
+
+	scan->prog = prog;
+	blk_mq_index_map_init(&scan->queue_indices);
+	blk_mq_index_map_init(&scan->hctx_indices);
+	blk_mq_hctx_vector_init(&scan->hctxs);
+	kernel_uint64_set_init(&scan->tags_seen);
+	kernel_uint64_set_init(&scan->rqs_seen);
+	blk_mq_slot_vector_init(&scan->slots);
+	kernel_read_vector_init(&scan->reads);
+	kernel_char_vector_init(&scan->staging);
+	kernel_char_vector_init(&scan->buf);
+	linux_helper_blk_mq_request_vector_init(&scan->requests);
+
+	if ((err = drgn_program_bswap(prog, &scan->bswap)) ||
+	    (err = drgn_program_word_size(prog, &scan->word_size)))
+		return err;
+
+	if ((err = kernel_find_field(p, "struct request_queue",
+				     "nr_hw_queues", &scan->q_nr_hw_queues)) ||
+	    (err = kernel_find_optional_field(p, "struct request_queue",
+					      "queue_hw_ctx",
+					      &scan->q_queue_hw_ctx)))
+		return err;
+	if (!scan->q_queue_hw_ctx.size) {
+		err = kernel_member_offset(p, "struct request_queue",
+					   "hctx_table",
+					   &scan->q_hctx_table_offset);
+		if (err)
+			return err;
+	}
+
+	if ((err = kernel_find_field(p, "struct blk_mq_hw_ctx", "tags",
+				     &scan->hctx_tags)) ||
+	    (err = kernel_find_field(p, "struct blk_mq_hw_ctx", "sched_tags",
+				     &scan->hctx_sched_tags)) ||
+	    (err = kernel_find_field(p, "struct blk_mq_hw_ctx", "queue_num",
+				     &scan->hctx_queue_num)))
+		return err;
+	struct kernel_field hctx_fields[] = {
+		scan->hctx_tags, scan->hctx_sched_tags, scan->hctx_queue_num,
+	};
+	kernel_field_span(hctx_fields, ARRAY_SIZE(hctx_fields),
+			  &scan->hctx_span_start, &scan->hctx_span_size);
+
+	struct drgn_member_info bitmap_tags, breserved_tags;
+	if ((err = kernel_find_field(p, "struct blk_mq_tags", "nr_tags",
+				     &scan->tags_nr_tags)) ||
+	    (err = kernel_find_field(p, "struct blk_mq_tags",
+				     "nr_reserved_tags",
+				     &scan->tags_nr_reserved_tags)) ||
+	    (err = kernel_find_field(p, "struct blk_mq_tags", "rqs",
+				     &scan->tags_rqs)) ||
+	    (err = kernel_find_field(p, "struct blk_mq_tags", "static_rqs",
+				     &scan->tags_static_rqs)) ||
+	    (err = kernel_member_info(p, "struct blk_mq_tags", "bitmap_tags",
+				      &bitmap_tags)) ||
+	    (err = kernel_member_info(p, "struct blk_mq_tags",
+				      "breserved_tags", &breserved_tags)))
+		return err;
+	scan->sbq_is_pointer =
+		drgn_type_kind(drgn_underlying_type(bitmap_tags.qualified_type.type)) ==
+		DRGN_TYPE_POINTER;
+	scan->tags_bitmap_tags = (struct kernel_field){
+		bitmap_tags.bit_offset / 8,
+		scan->sbq_is_pointer ? scan->word_size : 0,
+	};
+	scan->tags_breserved_tags = (struct kernel_field){
+		breserved_tags.bit_offset / 8,
+		scan->sbq_is_pointer ? scan->word_size : 0,
+	};
+	struct kernel_field tags_fields[] = {
+		scan->tags_nr_tags, scan->tags_nr_reserved_tags,
+		scan->tags_rqs, scan->tags_static_rqs,
+		scan->tags_bitmap_tags, scan->tags_breserved_tags,
+	};
+	kernel_field_span(tags_fields, ARRAY_SIZE(tags_fields),
+			  &scan->tags_span_start, &scan->tags_span_size);
+
+	struct drgn_qualified_type sbw_type;
+	if ((err = kernel_member_offset(p, "struct sbitmap_queue", "sb",
+					&scan->sbq_sb_offset)) ||
+	    (err = kernel_find_field(p, "struct sbitmap", "depth",
+				     &scan->sb_depth)) ||
+	    (err = kernel_find_field(p, "struct sbitmap", "shift",
+				     &scan->sb_shift)) ||
+	    (err = kernel_find_field(p, "struct sbitmap", "map_nr",
+				     &scan->sb_map_nr)) ||
+	    (err = kernel_find_field(p, "struct sbitmap", "map",
+				     &scan->sb_map)) ||
+	    (err = drgn_program_find_type(p, "struct sbitmap_word", NULL,
+					  &sbw_type)) ||
+	    (err = drgn_type_sizeof(sbw_type.type, &scan->sbw_size)) ||
+	    (err = kernel_find_field(p, "struct sbitmap_word", "word",
+				     &scan->sbw_word)) ||
+	    (err = kernel_find_optional_field(p, "struct sbitmap_word",
+					      "cleared", &scan->sbw_cleared)))
+		return err;
+	struct kernel_field sb_fields[] = {
+		scan->sb_depth, scan->sb_shift, scan->sb_map_nr, scan->sb_map,
+	};
+	kernel_field_span(sb_fields, ARRAY_SIZE(sb_fields),
+			  &scan->sb_span_start, &scan->sb_span_size);
+
+	if ((err = kernel_find_field(p, "struct request", "q",
+				     &scan->rq_q)) ||
+	    (err = kernel_find_optional_field(p, "struct request", "mq_hctx",
+					      &scan->rq_mq_hctx)) ||
+	    (err = kernel_find_field(p, "struct request", "cmd_flags",
+				     &scan->rq_cmd_flags)) ||
+	    (err = kernel_find_field(p, "struct request", "__sector",
+				     &scan->rq_sector)) ||
+	    (err = kernel_find_field(p, "struct request", "__data_len",
+				     &scan->rq_data_len)) ||
+	    (err = kernel_find_field(p, "struct request", "tag",
+				     &scan->rq_tag)) ||
+	    (err = kernel_find_field(p, "struct request", "internal_tag",
+				     &scan->rq_internal_tag)) ||
+	    (err = kernel_find_optional_field(p, "struct request",
+					      "start_time_ns",
+					      &scan->rq_start_time_ns)) ||
+	    (err = kernel_find_optional_field(p, "struct request", "state",
+					      &scan->rq_state)))
+		return err;
+	struct kernel_field rq_fields[] = {
+		scan->rq_q, scan->rq_mq_hctx, scan->rq_cmd_flags,
+		scan->rq_sector, scan->rq_data_len, scan->rq_tag,
+		scan->rq_internal_tag, scan->rq_start_time_ns, scan->rq_state,
+	};
+	kernel_field_span(rq_fields, ARRAY_SIZE(rq_fields),
+			  &scan->rq_span_start, &scan->rq_span_size);
+	return NULL;
+}
+
+static void blk_mq_scan_deinit(struct blk_mq_scan *scan)
+{
+	linux_helper_blk_mq_request_vector_deinit(&scan->requests);
+	kernel_char_vector_deinit(&scan->buf);
+	kernel_char_vector_deinit(&scan->staging);
+	kernel_read_vector_deinit(&scan->reads);
+	blk_mq_slot_vector_deinit(&scan->slots);
+	kernel_uint64_set_deinit(&scan->rqs_seen);
+	kernel_uint64_set_deinit(&scan->tags_seen);
+	blk_mq_hctx_vector_deinit(&scan->hctxs);
+	blk_mq_index_map_deinit(&scan->hctx_indices);
+	blk_mq_index_map_deinit(&scan->queue_indices);
+}
+
+static struct drgn_error *blk_mq_add_hctx(struct blk_mq_scan *scan,
+					  size_t queue, uint64_t hctx)
+{
+	if (!hctx)
+		return NULL;
+	struct blk_mq_hctx *entry = blk_mq_hctx_vector_append_entry(&scan->hctxs);
+	if (!entry)
+		return &drgn_enomem;
+	*entry = (struct blk_mq_hctx){ .queue = queue, .hctx = hctx };
+	return NULL;
+}
+
+/* Look up a hardware queue in request_queue::hctx_table. */
+static struct drgn_error *blk_mq_hctx_table_lookup(struct blk_mq_scan *scan,
+						   uint64_t q, uint64_t index,
+						   uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_qualified_type xarray_type;
+	struct drgn_object root, entry;
+
+	err = drgn_program_find_type(scan->prog, "struct xarray *", NULL,
+				     &xarray_type);
+	if (err)
+		return err;
+	drgn_object_init(&root, scan->prog);
+	drgn_object_init(&entry, scan->prog);
+	err = drgn_object_set_unsigned(&root, xarray_type,
+				       q + scan->q_hctx_table_offset, 0);
+	if (err)
+		goto out;
+	err = linux_helper_radix_tree_lookup(&entry, &root, index);
+	if (err)
+		goto out;
+	err = drgn_object_read_unsigned(&entry, ret);
+out:
+	drgn_object_deinit(&entry);
+	drgn_object_deinit(&root);
+	return err;
+}
+
+/* Add the hardware queues of a struct request_queue. */
+static struct drgn_error *blk_mq_scan_queue(struct blk_mq_scan *scan,
+					    size_t queue, uint64_t q)
+{
+	struct drgn_error *err;
+
+	struct blk_mq_index_map_entry entry = { q, queue };
+	int r = blk_mq_index_map_insert(&scan->queue_indices, &entry, NULL);
+	if (r < 0)
+		return &drgn_enomem;
+	else if (r == 0)
+		return NULL; /* Duplicate. */
+
+	uint64_t nr_hw_queues;
+	err = kernel_read_field(scan->prog, scan->bswap, q,
+				scan->q_nr_hw_queues, &nr_hw_queues);
+	if (err)
+		return err;
+	if (nr_hw_queues > BLK_MQ_MAX_HW_QUEUES) {
+		return drgn_error_format(DRGN_ERROR_OTHER,
+					 "request_queue 0x%" PRIx64 " has too many hardware queues",
+					 q);
+	}
+
+	if (!scan->q_queue_hw_ctx.size) {
+		for (uint64_t i = 0; i < nr_hw_queues; i++) {
+			uint64_t hctx;
+			err = blk_mq_hctx_table_lookup(scan, q, i, &hctx);
+			if (err)
+				return err;
+			err = blk_mq_add_hctx(scan, queue, hctx);
+			if (err)
+				return err;
+		}
+		return NULL;
+	}
+
+	uint64_t queue_hw_ctx;
+	err = kernel_read_field(scan->prog, scan->bswap, q,
+				scan->q_queue_hw_ctx, &queue_hw_ctx);
+	if (err)
+		return err;
+	/* Legacy (non-mq) queues don't have any hardware queues. */
+	if (!queue_hw_ctx || !nr_hw_queues)
+		return NULL;
+	size_t size = nr_hw_queues * scan->word_size;
+	if (!kernel_char_vector_reserve(&scan->buf, size))
+		return &drgn_enomem;
+	err = drgn_program_read_memory(scan->prog, scan->buf.data,
+				       queue_hw_ctx, size, false);
+	if (err)
+		return err;
+	struct kernel_field word_field = { .size = scan->word_size };
+	for (uint64_t i = 0; i < nr_hw_queues; i++) {
+		err = blk_mq_add_hctx(scan, queue,
+				      kernel_field_get(scan->buf.data +
+						       i * scan->word_size, 0,
+						       word_field,
+						       scan->bswap));
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/*
+ * Add a slot for each set bit of an sbitmap. Bit i corresponds to tag base + i,
+ * which is stored in the slot at array + tag * word_size.
+ */
+static struct drgn_error *blk_mq_scan_sbitmap(struct blk_mq_scan *scan,
+					      uint64_t sb, uint64_t base,
+					      uint64_t array, uint64_t nr_tags,
+					      size_t hctx)
+{
+	struct drgn_error *err;
+	char sb_buf[64];
+	bool bswap = scan->bswap;
+
+	if (scan->sb_span_size > sizeof(sb_buf)) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "struct sbitmap is too large");
+	}
+	err = drgn_program_read_memory(scan->prog, sb_buf,
+				       sb + scan->sb_span_start,
+				       scan->sb_span_size, false);
+	if (err)
+		return err;
+	uint64_t start = scan->sb_span_start;
+	uint64_t depth = kernel_field_get(sb_buf, start, scan->sb_depth, bswap);
+	uint64_t shift = kernel_field_get(sb_buf, start, scan->sb_shift, bswap);
+	uint64_t map_nr = kernel_field_get(sb_buf, start, scan->sb_map_nr,
+					   bswap);
+	uint64_t map = kernel_field_get(sb_buf, start, scan->sb_map, bswap);
+	if (!map_nr || !map)
+		return NULL;
+	if (map_nr > BLK_MQ_MAX_MAP_NR || shift >= 8 * scan->word_size) {
+		return drgn_error_format(DRGN_ERROR_OTHER,
+					 "invalid sbitmap at 0x%" PRIx64, sb);
+	}
+
+	size_t size = map_nr * scan->sbw_size;
+	if (!kernel_char_vector_reserve(&scan->buf, size))
+		return &drgn_enomem;
+	err = drgn_program_read_memory(scan->prog, scan->buf.data, map, size,
+				       false);
+	if (err)
+		return err;
+	for (uint64_t i = 0; i < map_nr; i++) {
+		const char *p = scan->buf.data + i * scan->sbw_size;
+		uint64_t word = kernel_field_get(p, 0, scan->sbw_word, bswap);
+		/* Cleared bits are free but haven't been removed from word. */
+		word &= ~kernel_field_get(p, 0, scan->sbw_cleared, bswap);
+		uint64_t word_depth = i == map_nr - 1 ?
+				      depth - (i << shift) :
+				      UINT64_C(1) << shift;
+		if (word_depth < 64)
+			word &= (UINT64_C(1) << word_depth) - 1;
+		while (word) {
+			uint64_t tag = base + (i << shift) +
+				       __builtin_ctzll(word);
+			word &= word - 1;
+			if (tag >= nr_tags)
+				break;
+			struct blk_mq_slot *slot =
+				blk_mq_slot_vector_append_entry(&scan->slots);
+			if (!slot)
+				return &drgn_enomem;
+			*slot = (struct blk_mq_slot){
+				.address = array + tag * scan->word_size,
+				.hctx = hctx,
+			};
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Scan a struct blk_mq_tags. Driver tags map to requests through rqs, and
+ * scheduler tags map to requests through static_rqs.
+ */
+static struct drgn_error *blk_mq_scan_tags(struct blk_mq_scan *scan,
+					   uint64_t tags, bool sched,
+					   size_t hctx)
+{
+	struct drgn_error *err;
+	char tags_buf[128];
+	bool bswap = scan->bswap;
+
+	if (!tags)
+		return NULL;
+	int r = kernel_uint64_set_insert(&scan->tags_seen, &tags, NULL);
+	if (r < 0)
+		return &drgn_enomem;
+	else if (r == 0)
+		return NULL;
+
+	if (scan->tags_span_size > sizeof(tags_buf)) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "struct blk_mq_tags is too large");
+	}
+	uint64_t start = scan->tags_span_start;
+	err = drgn_program_read_memory(scan->prog, tags_buf, tags + start,
+				       scan->tags_span_size, false);
+	if (err)
+		return err;
+	uint64_t nr_tags = kernel_field_get(tags_buf, start,
+					    scan->tags_nr_tags, bswap);
+	uint64_t nr_reserved_tags =
+		kernel_field_get(tags_buf, start, scan->tags_nr_reserved_tags,
+				 bswap);
+	uint64_t array = kernel_field_get(tags_buf, start,
+					  sched ? scan->tags_static_rqs :
+					  scan->tags_rqs, bswap);
+	if (!array)
+		return NULL;
+
+	uint64_t bitmap_tags, breserved_tags;
+	if (scan->sbq_is_pointer) {
+		bitmap_tags = kernel_field_get(tags_buf, start,
+					       scan->tags_bitmap_tags, bswap);
+		breserved_tags = kernel_field_get(tags_buf, start,
+						  scan->tags_breserved_tags,
+						  bswap);
+	} else {
+		bitmap_tags = tags + scan->tags_bitmap_tags.offset;
+		breserved_tags = tags + scan->tags_breserved_tags.offset;
+	}
+	if (nr_reserved_tags && breserved_tags) {
+		err = blk_mq_scan_sbitmap(scan,
+					  breserved_tags + scan->sbq_sb_offset,
+					  0, array, nr_tags, hctx);
+		if (err)
+			return err;
+	}
+	if (bitmap_tags) {
+		err = blk_mq_scan_sbitmap(scan,
+					  bitmap_tags + scan->sbq_sb_offset,
+					  nr_reserved_tags, array, nr_tags,
+					  hctx);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+/* Read every hardware queue and scan its driver and scheduler tags. */
+static struct drgn_error *blk_mq_scan_hctxs(struct blk_mq_scan *scan)
+{
+	struct drgn_error *err;
+	size_t n = scan->hctxs.size;
+	uint64_t span_start = scan->hctx_span_start;
+	uint64_t span_size = scan->hctx_span_size;
+	bool bswap = scan->bswap;
+
+	if (!n)
+		return NULL;
+	scan->reads.size = 0;
+	if (!kernel_read_vector_reserve(&scan->reads, n) ||
+	    !kernel_char_vector_reserve(&scan->buf, n * span_size))
+		return &drgn_enomem;
+	for (size_t i = 0; i < n; i++) {
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&scan->reads);
+		read->address = scan->hctxs.data[i].hctx + span_start;
+		read->index = i;
+	}
+	err = kernel_read_scattered(scan->prog, &scan->reads, span_size, false,
+				    &scan->staging, scan->buf.data);
+	if (err)
+		return err;
+
+	/* Scanning reuses the buffer, so save the tags first. */
+	uint64_t *tags = malloc_array(n, 2 * sizeof(*tags));
+	if (!tags)
+		return &drgn_enomem;
+	for (size_t i = 0; i < n; i++) {
+		const char *p = scan->buf.data + i * span_size;
+		struct blk_mq_hctx *hctx = &scan->hctxs.data[i];
+		hctx->index = kernel_field_get(p, span_start,
+					       scan->hctx_queue_num, bswap);
+		tags[2 * i] = kernel_field_get(p, span_start, scan->hctx_tags,
+					       bswap);
+		tags[2 * i + 1] = kernel_field_get(p, span_start,
+						   scan->hctx_sched_tags,
+						   bswap);
+		struct blk_mq_index_map_entry entry = { hctx->hctx, i };
+		if (blk_mq_index_map_insert(&scan->hctx_indices, &entry,
+					    NULL) < 0) {
+			err = &drgn_enomem;
+			goto out;
+		}
+	}
+	for (size_t i = 0; i < n; i++) {
+		err = blk_mq_scan_tags(scan, tags[2 * i], false, i);
+		if (err)
+			goto out;
+		err = blk_mq_scan_tags(scan, tags[2 * i + 1], true, i);
+		if (err)
+			goto out;
+	}
+	err = NULL;
+out:
+	free(tags);
+	return err;
+}
+
+/* Read the request pointers in every slot, then the requests. */
+static struct drgn_error *blk_mq_read_requests(struct blk_mq_scan *scan)
+{
+	struct drgn_error *err;
+	struct blk_mq_slot *slots = scan->slots.data;
+	size_t num_slots = scan->slots.size;
+	bool bswap = scan->bswap;
+
+	scan->reads.size = 0;
+	if (!kernel_read_vector_reserve(&scan->reads, num_slots) ||
+	    !kernel_char_vector_reserve(&scan->buf,
+					num_slots * scan->word_size))
+		return &drgn_enomem;
+	for (size_t i = 0; i < num_slots; i++) {
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&scan->reads);
+		read->address = slots[i].address;
+		read->index = i;
+	}
+	err = kernel_read_scattered(scan->prog, &scan->reads, scan->word_size,
+				    false, &scan->staging, scan->buf.data);
+	if (err)
+		return err;
+	struct kernel_field word_field = { .size = scan->word_size };
+	scan->reads.size = 0;
+	for (size_t i = 0; i < num_slots; i++) {
+		slots[i].rq = kernel_field_get(scan->buf.data +
+					       i * scan->word_size, 0,
+					       word_field, bswap);
+		/*
+		 * A request with both a driver tag and a scheduler tag is
+		 * found twice.
+		 */
+		if (!slots[i].rq)
+			continue;
+		int r = kernel_uint64_set_insert(&scan->rqs_seen, &slots[i].rq,
+						 NULL);
+		if (r < 0)
+			return &drgn_enomem;
+		else if (r == 0)
+			continue;
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&scan->reads);
+		read->address = slots[i].rq + scan->rq_span_start;
+		read->index = i;
+	}
+
+	uint64_t span_start = scan->rq_span_start;
+	uint64_t span_size = scan->rq_span_size;
+	if (!kernel_char_vector_reserve(&scan->buf, num_slots * span_size))
+		return &drgn_enomem;
+	err = kernel_read_scattered(scan->prog, &scan->reads, span_size, false,
+				    &scan->staging, scan->buf.data);
+	if (err)
+		return err;
+	for (size_t i = 0; i < scan->reads.size; i++) {
+		size_t slot_index = scan->reads.data[i].index;
+		struct blk_mq_slot *slot = &slots[slot_index];
+		const char *p = scan->buf.data + slot_index * span_size;
+
+		uint64_t q = kernel_field_get(p, span_start, scan->rq_q, bswap);
+		struct blk_mq_index_map_iterator it =
+			blk_mq_index_map_search(&scan->queue_indices, &q);
+		if (!it.entry)
+			continue;
+		size_t queue = it.entry->value;
+		size_t hctx_index = slot->hctx;
+		if (scan->rq_mq_hctx.size) {
+			uint64_t mq_hctx = kernel_field_get(p, span_start,
+							    scan->rq_mq_hctx,
+							    bswap);
+			it = blk_mq_index_map_search(&scan->hctx_indices,
+						     &mq_hctx);
+			if (!it.entry)
+				continue;
+			hctx_index = it.entry->value;
+		}
+		struct blk_mq_hctx *hctx = &scan->hctxs.data[hctx_index];
+		/* Tags may be shared with hardware queues of other queues. */
+		if (hctx->queue != queue)
+			continue;
+
+		uint64_t cmd_flags = kernel_field_get(p, span_start,
+						      scan->rq_cmd_flags,
+						      bswap);
+		struct linux_helper_blk_mq_request *request =
+			linux_helper_blk_mq_request_vector_append_entry(&scan->requests);
+		if (!request)
+			return &drgn_enomem;
+		*request = (struct linux_helper_blk_mq_request){
+			.queue = queue,
+			.hctx = hctx->hctx,
+			.hctx_index = hctx->index,
+			.rq = slot->rq,
+			.tag = kernel_field_get(p, span_start, scan->rq_tag,
+						bswap),
+			.internal_tag = kernel_field_get(p, span_start,
+							 scan->rq_internal_tag,
+							 bswap),
+			.op = cmd_flags & BLK_MQ_REQ_OP_MASK,
+			.cmd_flags = cmd_flags,
+			.sector = kernel_field_get(p, span_start,
+						   scan->rq_sector, bswap),
+			.size = kernel_field_get(p, span_start,
+						 scan->rq_data_len, bswap),
+			.start_time_ns = kernel_field_get(p, span_start,
+							  scan->rq_start_time_ns,
+							  bswap),
+			.state = (scan->rq_state.size ?
+				  kernel_field_get(p, span_start,
+						   scan->rq_state, bswap) :
+				  UINT32_MAX),
+		};
+	}
+	return NULL;
+}
+
+static int blk_mq_request_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_blk_mq_request *a = _a, *b = _b;
+	if (a->queue != b->queue)
+		return a->queue < b->queue ? -1 : 1;
+	if (a->hctx_index != b->hctx_index)
+		return a->hctx_index < b->hctx_index ? -1 : 1;
+	/* Undispatched requests (tag -1) sort last. */
+	if (a->tag != b->tag)
+		return (uint32_t)a->tag < (uint32_t)b->tag ? -1 : 1;
+	if (a->internal_tag != b->internal_tag) {
+		return ((uint32_t)a->internal_tag < (uint32_t)b->internal_tag ?
+			-1 : 1);
+	}
+	if (a->rq != b->rq)
+		return a->rq < b->rq ? -1 : 1;
+	return 0;
+}
+
+struct drgn_error *
+linux_helper_blk_mq_requests_create(struct drgn_program *prog,
+				    const uint64_t *queues, size_t num_queues,
+				    struct linux_helper_blk_mq_requests **ret)
+{
+	struct drgn_error *err;
+	struct blk_mq_scan scan;
+
+	err = blk_mq_scan_init(&scan, prog);
+	if (err)
+		goto out;
+	for (size_t i = 0; i < num_queues; i++) {
+		err = blk_mq_scan_queue(&scan, i, queues[i]);
+		if (err)
+			goto out;
+	}
+	err = blk_mq_scan_hctxs(&scan);
+	if (err)
+		goto out;
+	err = blk_mq_read_requests(&scan);
+	if (err)
+		goto out;
+	qsort(scan.requests.data, scan.requests.size,
+	      sizeof(scan.requests.data[0]), blk_mq_request_cmp);
+
+	struct linux_helper_blk_mq_requests *requests =
+		malloc(sizeof(*requests));
+	if (!requests) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_blk_mq_request_vector_shrink_to_fit(&scan.requests);
+	requests->requests = scan.requests.data;
+	requests->num_requests = scan.requests.size;
+	linux_helper_blk_mq_request_vector_init(&scan.requests);
+	*ret = requests;
+out:
+	blk_mq_scan_deinit(&scan);
+	return err;
+}
+
+void
+linux_helper_blk_mq_requests_destroy(struct linux_helper_blk_mq_requests *requests)
+{
+	if (!requests)
+		return;
+	free(requests->requests);
+	free(requests);
+}
+
+/*
+ * Page usage by memcg.
+ *
+ * struct pages are read from the vmemmap in large chunks. The pages of a chunk
+ * are decoded in parallel ranges into runs of consecutive pages with the same
+ * kind, memcg, and mapping, and the runs are merged in order afterwards, so
+ * that only the merge needs hash table lookups. Tail pages of compound pages
+ * are counted like their head page.
+ */
+
+/* Number of pages read at a time. */
+#define PAGE_USAGE_CHUNK_PAGES 65536
+/* Number of pages decoded by one task. */
+#define PAGE_USAGE_TASK_PAGES 4096
+/* Parts of the vmemmap may not be mapped; faults are handled per read. */
+#define PAGE_USAGE_READ_SIZE 4096
+/* Low bits of page->mapping, a.k.a. PAGE_MAPPING_ANON and PAGE_MAPPING_FLAGS. */
+#define PAGE_USAGE_MAPPING_ANON 1
+#define PAGE_USAGE_MAPPING_FLAGS 3
+/* PAGE_TYPE_BASE when page types were inverted bits (Linux 6.8-6.11). */
+#define PAGE_USAGE_PAGE_TYPE_BASE 0x80000000
+
+/* Kinds of pages other than enum linux_helper_page_kind. */
+enum {
+	/* Not counted. */
+	PAGE_USAGE_NONE = LINUX_HELPER_NUM_PAGE_KINDS,
+	/* Tail page whose head page was decoded by a previous task. */
+	PAGE_USAGE_TAIL,
+};
+
+struct page_usage_key {
+	uint64_t memcg;
+	/* Page cache mapping, or 0. */
+	uint64_t mapping;
+	int kind;
+};
+
+struct page_usage_run {
+	struct page_usage_key key;
+	/* Head page if key.kind is PAGE_USAGE_TAIL. */
+	uint64_t head;
+	uint64_t count;
+};
+
+DEFINE_VECTOR(page_usage_run_vector, struct page_usage_run)
+
+struct page_usage_task {
+	struct page_usage_run_vector runs;
+	/* Last page in the range that wasn't a tail page, or 0. */
+	uint64_t last_head;
+	struct page_usage_key last_key;
+};
+
+struct page_usage_inode_key {
+	size_t memcg;
+	uint64_t mapping;
+};
+
+static struct hash_pair
+page_usage_inode_key_hash_pair(const struct page_usage_inode_key *key)
+{
+	return hash_pair_from_avalanching_hash(hash_combine(key->memcg,
+							   key->mapping));
+}
+
+static bool page_usage_inode_key_eq(const struct page_usage_inode_key *a,
+				    const struct page_usage_inode_key *b)
+{
+	return a->memcg == b->memcg && a->mapping == b->mapping;
+}
+
+DEFINE_HASH_MAP(page_usage_memcg_map, uint64_t, size_t, int_key_hash_pair,
+		scalar_key_eq)
+DEFINE_HASH_MAP(page_usage_inode_map, struct page_usage_inode_key, size_t,
+		page_usage_inode_key_hash_pair, page_usage_inode_key_eq)
+DEFINE_VECTOR(linux_helper_memcg_usage_vector, struct linux_helper_memcg_usage)
+DEFINE_VECTOR(linux_helper_memcg_inode_vector, struct linux_helper_memcg_inode)
+
+struct page_usage_scan {
+	struct drgn_program *prog;
+	bool bswap;
+	uint8_t word_size;
+	uint64_t vmemmap;
+	uint64_t page_size;
+	/*
+	 * struct page. memcg is memcg_data since Linux 5.11 and mem_cgroup
+	 * before that. page_type is optional.
+	 */
+	struct kernel_field flags, mapping, memcg, compound_head, page_type;
+	/* Flag bits of memcg_data that mean it isn't a struct mem_cgroup *. */
+	uint64_t memcg_flags;
+	/* Masks of enum pageflags bits, or 0 if missing. */
+	uint64_t pg_lru, pg_unevictable, pg_swapbacked, pg_slab;
+	/*
+	 * If pg_slab is 0, slab pages are identified by page_type instead:
+	 * either the top byte is PGTY_slab, or the inverted PG_slab bit is
+	 * clear. UINT64_MAX if missing.
+	 */
+	uint64_t pgty_slab, page_type_slab;
+	/* struct address_space */
+	struct kernel_field host;
+
+	struct page_usage_task tasks[PAGE_USAGE_CHUNK_PAGES /
+				     PAGE_USAGE_TASK_PAGES];
+	/* Last page that wasn't a tail page in the previous tasks, or 0. */
+	uint64_t last_head;
+	struct page_usage_key last_key;
+
+	struct page_usage_memcg_map memcg_indices;
+	struct linux_helper_memcg_usage_vector memcgs;
+	struct page_usage_inode_map inode_indices;
+	/* The inode member is the mapping until the end. */
+	struct linux_helper_memcg_inode_vector inodes;
+	struct kernel_read_vector reads;
+	struct kernel_char_vector staging, buf;
+};
+
+/*
+ * Get the value of an enumerator of an enum type, or UINT64_MAX if the type or
+ * enumerator is missing.
+ */
+static struct drgn_error *kernel_enumerator_value(struct drgn_program *prog,
+						  const char *type_name,
+						  const char *name,
+						  uint64_t *ret)
+{
+	struct drgn_error *err;
+	struct drgn_qualified_type qualified_type;
+
+	*ret = UINT64_MAX;
+	err = drgn_program_find_type(prog, type_name, NULL, &qualified_type);
+	if (err) {
+		if (err->code != DRGN_ERROR_LOOKUP)
+			return err;
+		drgn_error_destroy(err);
+		return NULL;
+	}
+	struct drgn_type *type = drgn_underlying_type(qualified_type.type);
+	if (drgn_type_kind(type) != DRGN_TYPE_ENUM ||
+	    !drgn_type_is_complete(type))
+		return NULL;
+	const struct drgn_type_enumerator *enumerators =
+		drgn_type_enumerators(type);
+	size_t num_enumerators = drgn_type_num_enumerators(type);
+	for (size_t i = 0; i < num_enumerators; i++) {
+		if (strcmp(enumerators[i].name, name) == 0) {
+			*ret = enumerators[i].uvalue;
+			break;
+		}
+	}
+	return NULL;
+}
+
+/* Get the mask of an enum pageflags bit, or 0 if it is missing. */
+static struct drgn_error *page_usage_flag(struct page_usage_scan *scan,
+					  const char *name, uint64_t *ret)
+{
+	uint64_t bit;
+	struct drgn_error *err = kernel_enumerator_value(scan->prog,
+							 "enum pageflags",
+							 name, &bit);
+	if (err)
+		return err;
+	*ret = bit < 64 ? UINT64_C(1) << bit : 0;
+	return NULL;
+}
+
+static struct drgn_error *page_usage_scan_init(struct page_usage_scan *scan,
+					       struct drgn_program *prog,
+					       uint64_t vmemmap)
+{
+	struct drgn_error *err;
+
+	memset(scan, 0, sizeof(*scan));
+	scan->prog = prog;
+	scan->vmemmap = vmemmap;
+	for (size_t i = 0; i < ARRAY_SIZE(scan->tasks); i++)
+		page_usage_run_vector_init(&scan->tasks[i].runs);
+	page_usage_memcg_map_init(&scan->memcg_indices);
+	linux_helper_memcg_usage_vector_init(&scan->memcgs);
+	page_usage_inode_map_init(&scan->inode_indices);
+	linux_helper_memcg_inode_vector_init(&scan->inodes);
+	kernel_read_vector_init(&scan->reads);
+	kernel_char_vector_init(&scan->staging);
+	kernel_char_vector_init(&scan->buf);
+
+	if ((err = drgn_program_bswap(prog, &scan->bswap)) ||
+	    (err = drgn_program_word_size(prog, &scan->word_size)))
+		return err;
+
+	struct drgn_qualified_type page_type;
+	err = drgn_program_find_type(prog, "struct page", NULL, &page_type);
+	if (err)
+		return err;
+	err = drgn_type_sizeof(page_type.type, &scan->page_size);
+	if (err)
+		return err;
+	if (!scan->page_size ||
+	    scan->page_size * PAGE_USAGE_CHUNK_PAGES > KERNEL_READ_MAX) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "unsupported struct page size");
+	}
+
+	if ((err = kernel_find_field(prog, "struct page", "flags",
+				     &scan->flags)) ||
+	    (err = kernel_find_field(prog, "struct page", "mapping",
+				     &scan->mapping)) ||
+	    (err = kernel_find_optional_field(prog, "struct page",
+					      "compound_head",
+					      &scan->compound_head)) ||
+	    (err = kernel_find_optional_field(prog, "struct page",
+					      "page_type", &scan->page_type)) ||
+	    (err = kernel_find_optional_field(prog, "struct page",
+					      "memcg_data", &scan->memcg)))
+		return err;
+	if (scan->memcg.size) {
+		uint64_t nr_flags;
+		err = kernel_enumerator_value(prog,
+					      "enum page_memcg_data_flags",
+					      "__NR_MEMCG_DATA_FLAGS",
+					      &nr_flags);
+		if (err)
+			return err;
+		scan->memcg_flags = nr_flags < 64 ?
+				    (UINT64_C(1) << nr_flags) - 1 : 3;
+	} else {
+		/* Without CONFIG_MEMCG, every page is counted under 0. */
+		err = kernel_find_optional_field(prog, "struct page",
+						 "mem_cgroup", &scan->memcg);
+		if (err)
+			return err;
+	}
+
+	if ((err = page_usage_flag(scan, "PG_lru", &scan->pg_lru)) ||
+	    (err = page_usage_flag(scan, "PG_unevictable",
+				   &scan->pg_unevictable)) ||
+	    (err = page_usage_flag(scan, "PG_swapbacked",
+				   &scan->pg_swapbacked)) ||
+	    (err = page_usage_flag(scan, "PG_slab", &scan->pg_slab)))
+		return err;
+	if (!scan->pg_lru) {
+		return drgn_error_create(DRGN_ERROR_LOOKUP,
+					 "could not find PG_lru");
+	}
+	scan->pgty_slab = scan->page_type_slab = UINT64_MAX;
+	if (!scan->pg_slab && scan->page_type.size) {
+		err = kernel_enumerator_value(prog, "enum pagetype",
+					      "PGTY_slab", &scan->pgty_slab);
+		if (err)
+			return err;
+		if (scan->pgty_slab == UINT64_MAX) {
+			err = kernel_enumerator_value(prog, "enum pagetype",
+						      "PG_slab",
+						      &scan->page_type_slab);
+			if (err)
+				return err;
+		}
+	}
+
+	return kernel_find_field(prog, "struct address_space", "host",
+				 &scan->host);
+}
+
+static void page_usage_scan_deinit(struct page_usage_scan *scan)
+{
+	kernel_char_vector_deinit(&scan->buf);
+	kernel_char_vector_deinit(&scan->staging);
+	kernel_read_vector_deinit(&scan->reads);
+	linux_helper_memcg_inode_vector_deinit(&scan->inodes);
+	page_usage_inode_map_deinit(&scan->inode_indices);
+	linux_helper_memcg_usage_vector_deinit(&scan->memcgs);
+	page_usage_memcg_map_deinit(&scan->memcg_indices);
+	for (size_t i = 0; i < ARRAY_SIZE(scan->tasks); i++)
+		page_usage_run_vector_deinit(&scan->tasks[i].runs);
+}
+
+/* Classify a struct page that isn't a tail page. */
+static void page_usage_classify(struct page_usage_scan *scan, const char *p,
+				struct page_usage_key *ret)
+{
+	bool bswap = scan->bswap;
+	uint64_t flags = kernel_field_get(p, 0, scan->flags, bswap);
+	uint64_t mapping = kernel_field_get(p, 0, scan->mapping, bswap);
+	uint64_t memcg = kernel_field_get(p, 0, scan->memcg, bswap);
+	uint64_t page_type = kernel_field_get(p, 0, scan->page_type, bswap);
+
+	*ret = (struct page_usage_key){ .kind = PAGE_USAGE_NONE };
+	bool slab;
+	if (scan->pg_slab) {
+		slab = flags & scan->pg_slab;
+	} else if (scan->pgty_slab != UINT64_MAX) {
+		slab = (page_type >> 24) == scan->pgty_slab;
+	} else if (scan->page_type_slab != UINT64_MAX) {
+		slab = ((page_type &
+			 (PAGE_USAGE_PAGE_TYPE_BASE | scan->page_type_slab)) ==
+			PAGE_USAGE_PAGE_TYPE_BASE);
+	} else {
+		slab = false;
+	}
+	if (slab) {
+		ret->kind = LINUX_HELPER_PAGE_SLAB;
+	} else if (!(flags & scan->pg_lru)) {
+		return;
+	} else if (flags & scan->pg_unevictable) {
+		ret->kind = LINUX_HELPER_PAGE_UNEVICTABLE;
+	} else if (scan->pg_swapbacked ?
+		   (flags & scan->pg_swapbacked) :
+		   (mapping & PAGE_USAGE_MAPPING_ANON)) {
+		/* Shmem pages are swap-backed, so they're on the anon LRUs. */
+		ret->kind = LINUX_HELPER_PAGE_ANON;
+	} else {
+		ret->kind = LINUX_HELPER_PAGE_FILE;
+	}
+	/*
+	 * Slab pages since Linux 5.9 have a vector of object cgroups instead of
+	 * a memcg, since their objects may be charged to different memcgs.
+	 */
+	ret->memcg = memcg & scan->memcg_flags ? 0 : memcg;
+	if (ret->kind != LINUX_HELPER_PAGE_SLAB &&
+	    !(mapping & PAGE_USAGE_MAPPING_FLAGS))
+		ret->mapping = mapping;
+}
+
+static bool page_usage_run_matches(const struct page_usage_run *run,
+				   const struct page_usage_key *key,
+				   uint64_t head)
+{
+	return (run->key.kind == key->kind && run->key.memcg == key->memcg &&
+		run->key.mapping == key->mapping && run->head == head);
+}
+
+struct page_usage_decode_arg {
+	struct page_usage_scan *scan;
+	uint64_t start_pfn;
+	size_t num_pages;
+};
+
+/* Decode the ith range of pages in a chunk into runs. */
+static struct drgn_error *page_usage_decode_range(size_t i, void *arg)
+{
+	struct page_usage_decode_arg *decode = arg;
+	struct page_usage_scan *scan = decode->scan;
+	struct page_usage_task *task = &scan->tasks[i];
+	size_t start = i * PAGE_USAGE_TASK_PAGES;
+	size_t end = min(start + PAGE_USAGE_TASK_PAGES, decode->num_pages);
+
+	task->runs.size = 0;
+	task->last_head = 0;
+	for (size_t j = start; j < end; j++) {
+		const char *p = scan->buf.data + j * scan->page_size;
+		uint64_t page = (scan->vmemmap +
+				 (decode->start_pfn + j) * scan->page_size);
+		struct page_usage_key key;
+		uint64_t head = 0;
+		uint64_t compound_head = kernel_field_get(p, 0,
+							  scan->compound_head,
+							  scan->bswap);
+		if (compound_head & 1) {
+			if (task->last_head &&
+			    compound_head - 1 == task->last_head) {
+				key = task->last_key;
+			} else {
+				key = (struct page_usage_key){
+					.kind = PAGE_USAGE_TAIL,
+				};
+				head = compound_head - 1;
+			}
+		} else {
+			page_usage_classify(scan, p, &key);
+			task->last_head = page;
+			task->last_key = key;
+		}
+
+		if (task->runs.size &&
+		    page_usage_run_matches(&task->runs.data[task->runs.size - 1],
+					   &key, head)) {
+			task->runs.data[task->runs.size - 1].count++;
+			continue;
+		}
+		struct page_usage_run *run =
+			page_usage_run_vector_append_entry(&task->runs);
+		if (!run)
+			return &drgn_enomem;
+		*run = (struct page_usage_run){
+			.key = key,
+			.head = head,
+			.count = 1,
+		};
+	}
+	return NULL;
+}
+
+static struct drgn_error *page_usage_add(struct page_usage_scan *scan,
+					 const struct page_usage_key *key,
+					 uint64_t count)
+{
+	if (key->kind >= LINUX_HELPER_NUM_PAGE_KINDS)
+		return NULL;
+
+	struct page_usage_memcg_map_entry memcg_entry = {
+		key->memcg, scan->memcgs.size,
+	};
+	struct page_usage_memcg_map_iterator memcg_it;
+	int r = page_usage_memcg_map_insert(&scan->memcg_indices, &memcg_entry,
+					    &memcg_it);
+	if (r < 0)
+		return &drgn_enomem;
+	if (r > 0) {
+		struct linux_helper_memcg_usage *usage =
+			linux_helper_memcg_usage_vector_append_entry(&scan->memcgs);
+		if (!usage) {
+			page_usage_memcg_map_delete_iterator(&scan->memcg_indices,
+							     memcg_it);
+			return &drgn_enomem;
+		}
+		*usage = (struct linux_helper_memcg_usage){
+			.memcg = key->memcg,
+		};
+	}
+	size_t memcg = memcg_it.entry->value;
+	scan->memcgs.data[memcg].pages[key->kind] += count;
+
+	if (!key->mapping)
+		return NULL;
+	struct page_usage_inode_map_entry inode_entry = {
+		{ memcg, key->mapping }, scan->inodes.size,
+	};
+	struct page_usage_inode_map_iterator inode_it;
+	r = page_usage_inode_map_insert(&scan->inode_indices, &inode_entry,
+					&inode_it);
+	if (r < 0)
+		return &drgn_enomem;
+	if (r > 0) {
+		struct linux_helper_memcg_inode *inode =
+			linux_helper_memcg_inode_vector_append_entry(&scan->inodes);
+		if (!inode) {
+			page_usage_inode_map_delete_iterator(&scan->inode_indices,
+							     inode_it);
+			return &drgn_enomem;
+		}
+		*inode = (struct linux_helper_memcg_inode){
+			.memcg = memcg,
+			.inode = key->mapping,
+		};
+	}
+	scan->inodes.data[inode_it.entry->value].pages += count;
+	return NULL;
+}
+
+/* Merge the runs of every task for a chunk in order. */
+static struct drgn_error *page_usage_merge(struct page_usage_scan *scan,
+					   size_t num_tasks)
+{
+	struct drgn_error *err;
+	static const struct page_usage_key none = { .kind = PAGE_USAGE_NONE };
+
+	for (size_t i = 0; i < num_tasks; i++) {
+		struct page_usage_task *task = &scan->tasks[i];
+		for (size_t j = 0; j < task->runs.size; j++) {
+			struct page_usage_run *run = &task->runs.data[j];
+			const struct page_usage_key *key = &run->key;
+			/* The head may be outside of the scanned range. */
+			if (key->kind == PAGE_USAGE_TAIL) {
+				key = (scan->last_head &&
+				       run->head == scan->last_head) ?
+				      &scan->last_key : &none;
+			}
+			err = page_usage_add(scan, key, run->count);
+			if (err)
+				return err;
+		}
+		if (task->last_head) {
+			scan->last_head = task->last_head;
+			scan->last_key = task->last_key;
+		}
+	}
+	return NULL;
+}
+
+static struct drgn_error *page_usage_scan_chunk(struct page_usage_scan *scan,
+						struct drgn_thread_pool *pool,
+						uint64_t start_pfn,
+						size_t num_pages)
+{
+	struct drgn_error *err;
+	uint64_t address = scan->vmemmap + start_pfn * scan->page_size;
+	uint64_t size = num_pages * scan->page_size;
+	size_t num_reads = (size + PAGE_USAGE_READ_SIZE - 1) /
+			   PAGE_USAGE_READ_SIZE;
+
+	scan->reads.size = 0;
+	if (!kernel_read_vector_reserve(&scan->reads, num_reads) ||
+	    !kernel_char_vector_reserve(&scan->buf,
+					num_reads * PAGE_USAGE_READ_SIZE))
+		return &drgn_enomem;
+	for (size_t i = 0; i < num_reads; i++) {
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&scan->reads);
+		read->address = address + i * PAGE_USAGE_READ_SIZE;
+		read->index = i;
+	}
+	/* Pages in holes in the vmemmap are zeroed, so they aren't counted. */
+	err = kernel_read_scattered(scan->prog, &scan->reads,
+				    PAGE_USAGE_READ_SIZE, true, &scan->staging,
+				    scan->buf.data);
+	if (err)
+		return err;
+
+	size_t num_tasks = (num_pages + PAGE_USAGE_TASK_PAGES - 1) /
+			   PAGE_USAGE_TASK_PAGES;
+	struct page_usage_decode_arg arg = { scan, start_pfn, num_pages };
+	err = drgn_thread_pool_for_each(pool, 0, num_tasks,
+					page_usage_decode_range, &arg);
+	if (err)
+		return err;
+	return page_usage_merge(scan, num_tasks);
+}
+
+/* Replace the mapping of every inode entry with its host. */
+static struct drgn_error *page_usage_read_hosts(struct page_usage_scan *scan)
+{
+	struct drgn_error *err;
+	size_t n = scan->inodes.size;
+
+	scan->reads.size = 0;
+	if (!kernel_read_vector_reserve(&scan->reads, n) ||
+	    !kernel_char_vector_reserve(&scan->buf, n * scan->host.size))
+		return &drgn_enomem;
+	for (size_t i = 0; i < n; i++) {
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&scan->reads);
+		read->address = scan->inodes.data[i].inode + scan->host.offset;
+		read->index = i;
+	}
+	err = kernel_read_scattered(scan->prog, &scan->reads, scan->host.size,
+				    true, &scan->staging, scan->buf.data);
+	if (err)
+		return err;
+	for (size_t i = 0; i < n; i++) {
+		scan->inodes.data[i].inode =
+			kernel_field_get(scan->buf.data + i * scan->host.size,
+					 scan->host.offset, scan->host,
+					 scan->bswap);
+	}
+	return NULL;
+}
+
+static uint64_t memcg_usage_total(const struct linux_helper_memcg_usage *usage)
+{
+	uint64_t total = 0;
+	for (int i = 0; i < LINUX_HELPER_NUM_PAGE_KINDS; i++)
+		total += usage->pages[i];
+	return total;
+}
+
+static int memcg_usage_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_memcg_usage *a = _a, *b = _b;
+	uint64_t a_total = memcg_usage_total(a);
+	uint64_t b_total = memcg_usage_total(b);
+	if (a_total != b_total)
+		return a_total > b_total ? -1 : 1;
+	if (a->memcg != b->memcg)
+		return a->memcg < b->memcg ? -1 : 1;
+	return 0;
+}
+
+static int memcg_inode_cmp(const void *_a, const void *_b)
+{
+	const struct linux_helper_memcg_inode *a = _a, *b = _b;
+	if (a->memcg != b->memcg)
+		return a->memcg < b->memcg ? -1 : 1;
+	if (a->pages != b->pages)
+		return a->pages > b->pages ? -1 : 1;
+	if (a->inode != b->inode)
+		return a->inode < b->inode ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Sort the memcgs and inodes and only keep the first max_inodes inodes of each
+ * memcg.
+ */
+static struct drgn_error *page_usage_finish(struct page_usage_scan *scan,
+					    size_t max_inodes)
+{
+	struct linux_helper_memcg_usage *memcgs = scan->memcgs.data;
+	size_t num_memcgs = scan->memcgs.size;
+	struct linux_helper_memcg_inode *inodes = scan->inodes.data;
+
+	qsort(memcgs, num_memcgs, sizeof(memcgs[0]), memcg_usage_cmp);
+	/* The memcg map is still valid for finding the new indices. */
+	size_t *new_indices = malloc_array(num_memcgs ? num_memcgs : 1,
+					   sizeof(*new_indices));
+	if (!new_indices)
+		return &drgn_enomem;
+	for (size_t i = 0; i < num_memcgs; i++) {
+		struct page_usage_memcg_map_iterator it =
+			page_usage_memcg_map_search(&scan->memcg_indices,
+						    &memcgs[i].memcg);
+		new_indices[it.entry->value] = i;
+	}
+	size_t num_inodes = 0;
+	for (size_t i = 0; i < scan->inodes.size; i++) {
+		/* The mapping was freed or isn't really a page cache page. */
+		if (!inodes[i].inode)
+			continue;
+		inodes[num_inodes] = inodes[i];
+		inodes[num_inodes].memcg = new_indices[inodes[i].memcg];
+		num_inodes++;
+	}
+	free(new_indices);
+
+	qsort(inodes, num_inodes, sizeof(inodes[0]), memcg_inode_cmp);
+	size_t kept = 0, in_memcg = 0;
+	for (size_t i = 0; i < num_inodes; i++) {
+		if (i == 0 || inodes[i].memcg != inodes[i - 1].memcg)
+			in_memcg = 0;
+		if (in_memcg++ < max_inodes)
+			inodes[kept++] = inodes[i];
+	}
+	scan->inodes.size = kept;
+	return NULL;
+}
+
+struct drgn_error *
+linux_helper_page_usage_create(struct drgn_program *prog, uint64_t vmemmap,
+			       uint64_t start_pfn, uint64_t end_pfn,
+			       size_t max_inodes,
+			       struct linux_helper_page_usage **ret)
+{
+	struct drgn_error *err;
+	struct page_usage_scan *scan = malloc(sizeof(*scan));
+	if (!scan)
+		return &drgn_enomem;
+
+	err = page_usage_scan_init(scan, prog, vmemmap);
+	if (err)
+		goto out;
+
+	struct drgn_thread_pool *pool;
+	err = drgn_program_thread_pool(prog, &pool);
+	if (err)
+		goto out;
+	for (uint64_t pfn = start_pfn; pfn < end_pfn;) {
+		size_t num_pages = min(end_pfn - pfn,
+				       (uint64_t)PAGE_USAGE_CHUNK_PAGES);
+		err = page_usage_scan_chunk(scan, pool, pfn, num_pages);
+		if (err)
+			goto out;
+		pfn += num_pages;
+	}
+	err = page_usage_read_hosts(scan);
+	if (err)
+		goto out;
+	err = page_usage_finish(scan, max_inodes);
+	if (err)
+		goto out;
+
+	struct linux_helper_page_usage *usage = malloc(sizeof(*usage));
+	if (!usage) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	linux_helper_memcg_usage_vector_shrink_to_fit(&scan->memcgs);
+	linux_helper_memcg_inode_vector_shrink_to_fit(&scan->inodes);
+	usage->memcgs = scan->memcgs.data;
+	usage->num_memcgs = scan->memcgs.size;
+	usage->inodes = scan->inodes.data;
+	usage->num_inodes = scan->inodes.size;
+	linux_helper_memcg_usage_vector_init(&scan->memcgs);
+	linux_helper_memcg_inode_vector_init(&scan->inodes);
+	*ret = usage;
+out:
+	page_usage_scan_deinit(scan);
+	free(scan);
+	return err;
+}
+
+void linux_helper_page_usage_destroy(struct linux_helper_page_usage *usage)
+{
+	if (!usage)
+		return;
+	free(usage->inodes);
+	free(usage->memcgs);
+	free(usage);
+}
+
+struct drgn_error *linux_helper_memcg_lru_sizes(struct drgn_program *prog,
+						const uint64_t *memcgs,
+						size_t num_memcgs,
+						uint64_t num_nodes,
+						uint64_t **ret,
+						size_t *num_lrus_ret)
+{
+	struct drgn_error *err;
+	bool bswap;
+	uint8_t word_size;
+	uint64_t nodeinfo_offset;
+	struct drgn_member_info lru_zone_size;
+
+	if ((err = drgn_program_bswap(prog, &bswap)) ||
+	    (err = drgn_program_word_size(prog, &word_size)) ||
+	    (err = kernel_member_offset(prog, "struct mem_cgroup", "nodeinfo",
+					&nodeinfo_offset)) ||
+	    (err = kernel_member_info(prog, "struct mem_cgroup_per_node",
+				      "lru_zone_size", &lru_zone_size)))
+		return err;
+	/* unsigned long lru_zone_size[MAX_NR_ZONES][NR_LRU_LISTS] */
+	struct drgn_type *zones_type =
+		drgn_underlying_type(lru_zone_size.qualified_type.type);
+	struct drgn_type *lrus_type = NULL;
+	if (drgn_type_kind(zones_type) == DRGN_TYPE_ARRAY &&
+	    drgn_type_is_complete(zones_type)) {
+		lrus_type = drgn_underlying_type(drgn_type_type(zones_type).type);
+		if (drgn_type_kind(lrus_type) != DRGN_TYPE_ARRAY ||
+		    !drgn_type_is_complete(lrus_type))
+			lrus_type = NULL;
+	}
+	if (!lrus_type || num_nodes > 65536) {
+		return drgn_error_create(DRGN_ERROR_TYPE,
+					 "unsupported struct mem_cgroup_per_node");
+	}
+	uint64_t num_zones = drgn_type_length(zones_type);
+	uint64_t num_lrus = drgn_type_length(lrus_type);
+	uint64_t sizes_size = num_zones * num_lrus * word_size;
+	uint64_t nodeinfo_size = num_nodes * word_size;
+
+	uint64_t *sizes = calloc(num_memcgs * num_nodes * num_lrus + 1,
+				 sizeof(*sizes));
+	if (!sizes)
+		return &drgn_enomem;
+	struct kernel_read_vector reads = VECTOR_INIT;
+	struct kernel_char_vector staging = VECTOR_INIT, nodeinfo = VECTOR_INIT;
+	struct kernel_char_vector buf = VECTOR_INIT;
+	struct kernel_field word_field = { .size = word_size };
+
+	/* Read the nodeinfo array of every memcg. */
+	if (!kernel_read_vector_reserve(&reads,
+					num_memcgs * (num_nodes + 1)) ||
+	    !kernel_char_vector_reserve(&nodeinfo,
+					num_memcgs * nodeinfo_size)) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	for (size_t i = 0; i < num_memcgs; i++) {
+		if (!memcgs[i])
+			continue;
+		struct kernel_read *read =
+			kernel_read_vector_append_entry(&reads);
+		read->address = memcgs[i] + nodeinfo_offset;
+		read->index = i;
+	}
+	err = kernel_read_scattered(prog, &reads, nodeinfo_size, false,
+				    &staging, nodeinfo.data);
+	if (err)
+		goto out;
+
+	/* Then read lru_zone_size of every node. */
+	size_t num_memcg_reads = reads.size;
+	for (size_t i = 0; i < num_memcg_reads; i++) {
+		size_t memcg = reads.data[i].index;
+		for (uint64_t node = 0; node < num_nodes; node++) {
+			uint64_t pn = kernel_field_get(nodeinfo.data +
+						       memcg * nodeinfo_size,
+						       0,
+						       (struct kernel_field){
+							       node * word_size,
+							       word_size
+						       }, bswap);
+			if (!pn)
+				continue;
+			struct kernel_read *read =
+				kernel_read_vector_append_entry(&reads);
+			read->address = pn + lru_zone_size.bit_offset / 8;
+			read->index = memcg * num_nodes + node;
+		}
+	}
+	memmove(reads.data, reads.data + num_memcg_reads,
+		(reads.size - num_memcg_reads) * sizeof(reads.data[0]));
+	reads.size -= num_memcg_reads;
+	if (!kernel_char_vector_reserve(&buf,
+					num_memcgs * num_nodes * sizes_size)) {
+		err = &drgn_enomem;
+		goto out;
+	}
+	err = kernel_read_scattered(prog, &reads, sizes_size, false, &staging,
+				    buf.data);
+	if (err)
+		goto out;
+	for (size_t i = 0; i < reads.size; i++) {
+		size_t index = reads.data[i].index;
+		const char *p = buf.data + index * sizes_size;
+		for (uint64_t zone = 0; zone < num_zones; zone++) {
+			for (uint64_t lru = 0; lru < num_lrus; lru++) {
+				sizes[index * num_lrus + lru] +=
+					kernel_field_get(p, 0, word_field,
+							 bswap);
+				p += word_size;
+			}
+		}
+	}
+	*ret = sizes;
+	*num_lrus_ret = num_lrus;
+	sizes = NULL;
+out:
+	free(sizes);
+	kernel_char_vector_deinit(&buf);
+	kernel_char_vector_deinit(&nodeinfo);
+	kernel_char_vector_deinit(&staging);
+	kernel_read_vector_deinit(&reads);
+	return err;
+}
@@ -0,0 +1,140 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include "memory_budget.h"
+#include "minmax.h"
+
+void drgn_memory_budget_init(struct drgn_memory_budget *budget)
+{
+	budget->limit = 0;
+	budget->clock = 0;
+	budget->head.prev = budget->head.next = &budget->head;
+}
+
+size_t drgn_memory_budget_usage(struct drgn_memory_budget *budget)
+{
+	size_t total = 0;
+	drgn_memory_budget_for_each_cache(cache, budget)
+		total += cache->cost(cache);
+	return total;
+}
+
+/*
+ * Choose the evictable cache that hasn't been considered yet which was used
+ * least recently, breaking ties by cost.
+ */
+static struct drgn_cache *
+drgn_memory_budget_victim(struct drgn_memory_budget *budget, size_t *cost_ret)
+{
+	struct drgn_cache *victim = NULL;
+	size_t victim_cost = 0;
+	drgn_memory_budget_for_each_cache(cache, budget) {
+		if (!cache->shrink || cache->visited)
+			continue;
+		size_t cost = cache->cost(cache);
+		if (!cost)
+			continue;
+		if (!victim || cache->last_used < victim->last_used ||
+		    (cache->last_used == victim->last_used &&
+		     cost > victim_cost)) {
+			victim = cache;
+			victim_cost = cost;
+		}
+	}
+	*cost_ret = victim_cost;
+	return victim;
+}
+
+static void drgn_memory_budget_enforce(struct drgn_memory_budget *budget)
+{
+	if (!budget->limit)
+		return;
+	size_t total = drgn_memory_budget_usage(budget);
+	if (total <= budget->limit)
+		return;
+
+	/*
+	 * Shrink to a low watermark so that we don't have to shrink again on
+	 * the very next allocation.
+	 */
+	size_t low = budget->limit - budget->limit / 4;
+	drgn_memory_budget_for_each_cache(cache, budget)
+		cache->visited = false;
+	while (total > low) {
+		size_t cost;
+		struct drgn_cache *victim = drgn_memory_budget_victim(budget,
+								      &cost);
+		if (!victim)
+			break;
+		victim->visited = true;
+		size_t excess = total - low;
+		size_t target = cost > excess ? cost - excess : 0;
+		if (victim->busy) {
+			victim->pending_target = min(victim->pending_target,
+						     target);
+			total -= cost - target;
+		} else {
+			victim->shrink(victim, target);
+			victim->evictions++;
+			total -= cost - min(victim->cost(victim), cost);
+		}
+	}
+}
+
+void drgn_memory_budget_set_limit(struct drgn_memory_budget *budget,
+				  size_t limit)
+{
+	budget->limit = limit;
+	drgn_memory_budget_enforce(budget);
+}
+
+void drgn_cache_register(struct drgn_memory_budget *budget,
+			 struct drgn_cache *cache, const char *name,
+			 drgn_cache_cost_fn *cost,
+			 drgn_cache_shrink_fn *shrink)
+{
+	cache->name = name;
+	cache->cost = cost;
+	cache->shrink = shrink;
+	cache->evictions = 0;
+	cache->budget = budget;
+	cache->last_used = budget->clock;
+	cache->busy = 0;
+	cache->visited = false;
+	cache->pending_target = SIZE_MAX;
+	cache->prev = budget->head.prev;
+	cache->next = &budget->head;
+	cache->prev->next = cache;
+	budget->head.prev = cache;
+}
+
+void drgn_cache_unregister(struct drgn_cache *cache)
+{
+	if (!cache->budget)
+		return;
+	cache->prev->next = cache->next;
+	cache->next->prev = cache->prev;
+	cache->budget = NULL;
+}
+
+void drgn_cache_begin(struct drgn_cache *cache)
+{
+	cache->busy++;
+	cache->last_used = ++cache->budget->clock;
+}
+
+void drgn_cache_end(struct drgn_cache *cache)
+{
+	if (--cache->busy || cache->pending_target == SIZE_MAX)
+		return;
+	size_t target = cache->pending_target;
+	cache->pending_target = SIZE_MAX;
+	cache->shrink(cache, target);
+	cache->evictions++;
+}
+
+void drgn_cache_charge(struct drgn_cache *cache)
+{
+	cache->last_used = ++cache->budget->clock;
+	drgn_memory_budget_enforce(cache->budget);
+}
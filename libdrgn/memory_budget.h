@@ -0,0 +1,145 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+/**
+ * @file
+ *
+ * Memory budget for caches.
+ *
+ * See @ref MemoryBudget.
+ */
+
+#ifndef DRGN_MEMORY_BUDGET_H
+#define DRGN_MEMORY_BUDGET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @ingroup Internals
+ *
+ * @defgroup MemoryBudget Memory budget
+ *
+ * Shared memory limit for the caches of a program.
+ *
+ * Each cache that can grow without bound (types, members, paths, direct I/O
+ * blocks, etc.) registers a @ref drgn_cache with the @ref drgn_memory_budget
+ * of its program. The cache reports its estimated size through a callback and
+ * charges the budget after it grows. When the total exceeds the limit, the
+ * least recently used caches (the most expensive first among caches used at
+ * the same time) are asked to shrink until the total is back under a low
+ * watermark, so that a long session degrades to cache misses instead of
+ * running out of memory.
+ *
+ * A cache may hand out pointers into itself that are only valid while an
+ * operation on it is in progress. Such operations are bracketed by @ref
+ * drgn_cache_begin() and @ref drgn_cache_end(). A cache that is chosen while it
+ * is busy is shrunk when its outermost operation ends instead.
+ *
+ * Caches without a shrink callback (e.g., types, which objects refer to) can't
+ * be evicted, but they count toward the total.
+ *
+ * @{
+ */
+
+struct drgn_cache;
+struct drgn_memory_budget;
+
+/** Callback returning the estimated number of bytes used by a cache. */
+typedef size_t drgn_cache_cost_fn(struct drgn_cache *cache);
+
+/**
+ * Callback shrinking a cache to at most @p target estimated bytes.
+ *
+ * It may free more than necessary (e.g., by clearing the whole cache).
+ */
+typedef void drgn_cache_shrink_fn(struct drgn_cache *cache, size_t target);
+
+/** Cache registered with a @ref drgn_memory_budget. */
+struct drgn_cache {
+	/** Name of the cache for statistics. */
+	const char *name;
+	drgn_cache_cost_fn *cost;
+	/** Shrink callback, or @c NULL if the cache can't be evicted. */
+	drgn_cache_shrink_fn *shrink;
+	/** Number of times that the cache was shrunk by the budget. */
+	uint64_t evictions;
+	/** @privatesection */
+	struct drgn_memory_budget *budget;
+	struct drgn_cache *prev, *next;
+	uint64_t last_used;
+	unsigned int busy;
+	/* Whether the cache was already considered by the current shrink. */
+	bool visited;
+	/* Size to shrink to when the cache is no longer busy, or SIZE_MAX. */
+	size_t pending_target;
+};
+
+/** Memory limit shared by the caches of a program. */
+struct drgn_memory_budget {
+	/** Maximum total estimated size of the caches, or 0 for no limit. */
+	size_t limit;
+	/** @privatesection */
+	uint64_t clock;
+	/* Circular list of registered caches. */
+	struct drgn_cache head;
+};
+
+/** Initialize a @ref drgn_memory_budget with no limit. */
+void drgn_memory_budget_init(struct drgn_memory_budget *budget);
+
+/**
+ * Set the limit of a @ref drgn_memory_budget and shrink caches to fit it.
+ *
+ * @param[in] limit Limit in bytes, or 0 for no limit.
+ */
+void drgn_memory_budget_set_limit(struct drgn_memory_budget *budget,
+				  size_t limit);
+
+/** Get the total estimated size of the caches in a @ref drgn_memory_budget. */
+size_t drgn_memory_budget_usage(struct drgn_memory_budget *budget);
+
+/** Iterate over the caches registered with a @ref drgn_memory_budget. */
+#define drgn_memory_budget_for_each_cache(cache, budget)		\
+	for (struct drgn_cache *cache = (budget)->head.next;		\
+	     cache != &(budget)->head; cache = cache->next)
+
+/**
+ * Register a @ref drgn_cache with a @ref drgn_memory_budget.
+ *
+ * The cache must be unregistered with @ref drgn_cache_unregister() before it is
+ * freed.
+ */
+void drgn_cache_register(struct drgn_memory_budget *budget,
+			 struct drgn_cache *cache, const char *name,
+			 drgn_cache_cost_fn *cost,
+			 drgn_cache_shrink_fn *shrink);
+
+/** Unregister a @ref drgn_cache. This is a no-op if it isn't registered. */
+void drgn_cache_unregister(struct drgn_cache *cache);
+
+/**
+ * Start an operation on a @ref drgn_cache during which it must not be shrunk.
+ *
+ * This also marks the cache as recently used. Operations may be nested.
+ */
+void drgn_cache_begin(struct drgn_cache *cache);
+
+/**
+ * End an operation started with @ref drgn_cache_begin().
+ *
+ * If the budget chose to shrink the cache during the operation, it is shrunk
+ * now.
+ */
+void drgn_cache_end(struct drgn_cache *cache);
+
+/**
+ * Mark a @ref drgn_cache as recently used after it grew, shrinking the least
+ * recently used caches if the budget is exceeded.
+ */
+void drgn_cache_charge(struct drgn_cache *cache);
+
+/** @} */
+
+#endif /* DRGN_MEMORY_BUDGET_H */
@@ -6,12 +6,18 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "block_cache.h"
 #include "memory_reader.h"
 #include "minmax.h"
+#include "program.h"
+#include "read_engine.h"
+#include "vector.h"
 
 DEFINE_BINARY_SEARCH_TREE_FUNCTIONS(drgn_memory_segment_tree,
 				    binary_search_tree_scalar_cmp, splay)
 
+DEFINE_VECTOR(drgn_file_extent_vector, struct drgn_file_extent)
+
 void drgn_memory_reader_init(struct drgn_memory_reader *reader)
 {
 	drgn_memory_segment_tree_init(&reader->virtual_segments);
@@ -31,6 +37,22 @@ static void free_memory_segment_tree(struct drgn_memory_segment_tree *tree)
 	}
 }
 
+static size_t memory_segment_tree_size(struct drgn_memory_segment_tree *tree)
+{
+	size_t size = 0;
+	for (struct drgn_memory_segment_tree_iterator it =
+	     drgn_memory_segment_tree_first_post_order(tree);
+	     it.entry; it = drgn_memory_segment_tree_next_post_order(it))
+		size++;
+	return size;
+}
+
+size_t drgn_memory_reader_num_segments(struct drgn_memory_reader *reader)
+{
+	return (memory_segment_tree_size(&reader->virtual_segments) +
+		memory_segment_tree_size(&reader->physical_segments));
+}
+
 void drgn_memory_reader_deinit(struct drgn_memory_reader *reader)
 {
 	free_memory_segment_tree(&reader->physical_segments);
@@ -259,21 +281,273 @@ struct drgn_error *drgn_memory_reader_read(struct drgn_memory_reader *reader,
 	return NULL;
 }
 
-struct drgn_error *drgn_read_memory_file(void *buf, uint64_t address,
-					 size_t count, uint64_t offset,
-					 void *arg, bool physical)
+bool drgn_memory_reader_file_location(struct drgn_memory_reader *reader,
+				      uint64_t address, uint64_t size,
+				      bool physical,
+				      const struct drgn_memory_file_segment **segment_ret,
+				      uint64_t *offset_ret)
 {
-	struct drgn_memory_file_segment *file_segment = arg;
-	char *p = buf;
-	uint64_t file_offset = file_segment->file_offset + offset;
-	size_t file_count;
+	struct drgn_memory_segment_tree *tree = (physical ?
+						 &reader->physical_segments :
+						 &reader->virtual_segments);
+	struct drgn_memory_segment *segment =
+		drgn_memory_segment_tree_search_le(tree, &address).entry;
+	if (!segment || segment->read_fn != drgn_read_memory_file ||
+	    segment->address + segment->size <= address ||
+	    segment->address + segment->size - address < size)
+		return false;
+	struct drgn_memory_file_segment *file_segment = segment->arg;
+	uint64_t offset = address - segment->orig_address;
+	if (offset > file_segment->file_size ||
+	    file_segment->file_size - offset < size ||
+	    (file_segment->prog && file_segment->prog->block_cache))
+		return false;
+	*segment_ret = file_segment;
+	*offset_ret = file_segment->file_offset + offset;
+	return true;
+}
 
-	if (offset < file_segment->file_size) {
-		file_count = min((uint64_t)count,
-				 file_segment->file_size - offset);
-		count -= file_count;
-	} else {
-		file_count = 0;
+/*
+ * Get the index of the first extent in a data map which ends after the given
+ * offset, or the number of extents if there is none.
+ */
+static size_t drgn_file_data_map_search(const struct drgn_file_data_map *map,
+					uint64_t offset)
+{
+	size_t lo = 0, hi = map->num_extents;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (map->extents[mid].end <= offset)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+struct drgn_error *drgn_file_data_map_create(int fd, uint64_t size,
+					     struct drgn_file_data_map **ret)
+{
+	struct drgn_error *err;
+	struct drgn_file_extent_vector extents;
+	drgn_file_extent_vector_init(&extents);
+
+	uint64_t offset = 0;
+	while (offset < size) {
+		off_t data = lseek(fd, offset, SEEK_DATA);
+		off_t hole = data == -1 ? -1 : lseek(fd, data, SEEK_HOLE);
+		if (hole == -1) {
+			/* ENXIO means that there is no more data. */
+			if (errno == ENXIO)
+				break;
+			drgn_file_extent_vector_deinit(&extents);
+			/* The filesystem doesn't support SEEK_DATA. */
+			if (errno == EINVAL || errno == EOPNOTSUPP) {
+				*ret = NULL;
+				return NULL;
+			}
+			return drgn_error_create_os("lseek", errno, NULL);
+		}
+		struct drgn_file_extent extent = {
+			.start = data,
+			.end = min((uint64_t)hole, size),
+		};
+		if (extent.start >= size)
+			break;
+		if (!drgn_file_extent_vector_append(&extents, &extent)) {
+			err = &drgn_enomem;
+			goto err;
+		}
+		offset = hole;
+	}
+
+	/* Filesystems without holes report the whole file as data. */
+	if (extents.size == 1 && extents.data[0].start == 0 &&
+	    extents.data[0].end == size) {
+		drgn_file_extent_vector_deinit(&extents);
+		*ret = NULL;
+		return NULL;
+	}
+
+	struct drgn_file_data_map *map = malloc(sizeof(*map));
+	if (!map) {
+		err = &drgn_enomem;
+		goto err;
+	}
+	drgn_file_extent_vector_shrink_to_fit(&extents);
+	map->extents = extents.data;
+	map->num_extents = extents.size;
+	map->size = size;
+	*ret = map;
+	return NULL;
+
+err:
+	drgn_file_extent_vector_deinit(&extents);
+	return err;
+}
+
+void drgn_file_data_map_destroy(struct drgn_file_data_map *map)
+{
+	if (map) {
+		free(map->extents);
+		free(map);
+	}
+}
+
+/*
+ * Find the first hole in [offset, end) of a file segment (relative to the start
+ * of the segment). Returns false if there is none.
+ */
+static bool drgn_memory_file_segment_find_hole(struct drgn_memory_file_segment *file_segment,
+					       uint64_t offset, uint64_t end,
+					       uint64_t *start_ret,
+					       uint64_t *end_ret)
+{
+	/* Everything past the file data is zero-filled. */
+	uint64_t data_end = min(end, file_segment->file_size);
+	const struct drgn_file_data_map *map = file_segment->data_map;
+	if (map && offset < data_end) {
+		uint64_t file_offset = file_segment->file_offset + offset;
+		uint64_t file_end = file_segment->file_offset + data_end;
+		size_t i = drgn_file_data_map_search(map, file_offset);
+		uint64_t hole_start, hole_end;
+		if (i < map->num_extents && map->extents[i].start <= file_offset)
+			hole_start = map->extents[i++].end;
+		else
+			hole_start = file_offset;
+		/* Data past the end of the file is missing, not a hole. */
+		hole_end = (i < map->num_extents ? map->extents[i].start :
+			    map->size);
+		if (hole_start < min(file_end, hole_end)) {
+			*start_ret = hole_start - file_segment->file_offset;
+			/* A hole that reaches the end of the data continues. */
+			if (hole_end >= file_end)
+				*end_ret = end;
+			else
+				*end_ret = hole_end - file_segment->file_offset;
+			return true;
+		}
+	}
+	if (data_end < end) {
+		*start_ret = max(offset, data_end);
+		*end_ret = end;
+		return true;
+	}
+	return false;
+}
+
+void drgn_memory_reader_find_hole(struct drgn_memory_reader *reader,
+				  uint64_t address, uint64_t size,
+				  bool physical, uint64_t *start_ret,
+				  uint64_t *end_ret)
+{
+	struct drgn_memory_segment_tree *tree = (physical ?
+						 &reader->physical_segments :
+						 &reader->virtual_segments);
+	uint64_t end = address + size;
+	uint64_t hole_start = end, hole_end = end;
+
+	struct drgn_memory_segment_tree_iterator it =
+		drgn_memory_segment_tree_search_le(tree, &address);
+	if (!it.entry)
+		it = drgn_memory_segment_tree_first(tree);
+	else if (it.entry->address + it.entry->size <= address)
+		it = drgn_memory_segment_tree_next(it);
+	for (; it.entry && it.entry->address < end;
+	     it = drgn_memory_segment_tree_next(it)) {
+		struct drgn_memory_segment *segment = it.entry;
+		uint64_t start = max(address, segment->address);
+		uint64_t segment_end = min(end, segment->address +
+						segment->size);
+		/* A gap between segments ends the hole. */
+		if (hole_start != end && start != hole_end)
+			break;
+		if (segment->read_fn != drgn_read_memory_file) {
+			if (hole_start != end)
+				break;
+			continue;
+		}
+		uint64_t offset = start - segment->orig_address;
+		uint64_t rel_start, rel_end;
+		if (!drgn_memory_file_segment_find_hole(segment->arg, offset,
+							segment_end -
+							segment->orig_address,
+							&rel_start, &rel_end)) {
+			if (hole_start != end)
+				break;
+			continue;
+		}
+		if (hole_start == end) {
+			hole_start = segment->orig_address + rel_start;
+		} else if (rel_start != offset) {
+			/* The hole doesn't continue into this segment. */
+			break;
+		}
+		hole_end = segment->orig_address + rel_end;
+		/* The hole ends in this segment. */
+		if (hole_end < segment_end)
+			break;
+	}
+	*start_ret = hole_start;
+	*end_ret = hole_end;
+}
+
+/* Minimum size of a read from a file to submit to the read engine. */
+#define DRGN_READ_MEMORY_FILE_ASYNC_MIN (1024 * 1024)
+
+/*
+ * Read data from the file of a file segment. address is only used for error
+ * messages.
+ */
+static struct drgn_error *
+read_memory_file_data(struct drgn_memory_file_segment *file_segment, char *p,
+		      size_t file_count, uint64_t file_offset, uint64_t address)
+{
+	if (file_segment->prog && file_segment->prog->block_cache) {
+		struct drgn_error *err;
+		size_t done;
+
+		err = drgn_block_cache_read(file_segment->prog->block_cache, p,
+					    file_count, file_offset, &done);
+		if (err)
+			return err;
+		drgn_cache_charge(&file_segment->prog->direct_io_cache);
+		if (done < file_count) {
+			return drgn_error_create_fault("short read from memory file",
+						       address + done);
+		}
+		return NULL;
+	}
+	/*
+	 * Large reads are split up and kept in flight in parallel, which is
+	 * much faster on storage that can handle many requests at once.
+	 */
+	if (file_count >= DRGN_READ_MEMORY_FILE_ASYNC_MIN && file_segment->prog) {
+		struct drgn_error *err;
+		struct drgn_read_engine *engine;
+		size_t done;
+		int errnum;
+		uint64_t error_offset;
+
+		err = drgn_program_read_engine(file_segment->prog, &engine);
+		if (err)
+			return err;
+		err = drgn_read_engine_pread(engine, file_segment->fd, p,
+					     file_count, file_offset, &done,
+					     &errnum, &error_offset);
+		if (err)
+			return err;
+		if (errnum == EIO && file_segment->eio_is_fault) {
+			return drgn_error_create_fault("could not read memory",
+						       address + (error_offset -
+								  file_offset));
+		} else if (errnum) {
+			return drgn_error_create_os("pread", errnum, NULL);
+		} else if (done < file_count) {
+			return drgn_error_create_fault("short read from memory file",
+						       address + done);
+		}
+		return NULL;
 	}
 	while (file_count) {
 		ssize_t ret;
@@ -295,7 +569,86 @@ struct drgn_error *drgn_read_memory_file(void *buf, uint64_t address,
 		p += ret;
 		file_count -= ret;
 		file_offset += ret;
+		address += ret;
+	}
+	return NULL;
+}
+
+struct drgn_error *drgn_read_memory_file(void *buf, uint64_t address,
+					 size_t count, uint64_t offset,
+					 void *arg, bool physical)
+{
+	struct drgn_error *err;
+	struct drgn_memory_file_segment *file_segment = arg;
+	char *p = buf;
+	uint64_t file_offset = file_segment->file_offset + offset;
+	size_t file_count;
+
+	if (offset < file_segment->file_size) {
+		file_count = min((uint64_t)count,
+				 file_segment->file_size - offset);
+		count -= file_count;
+	} else {
+		file_count = 0;
+	}
+
+	const struct drgn_file_data_map *map = file_segment->data_map;
+	if (map) {
+		/* Only read the extents with data and zero the holes. */
+		size_t i = drgn_file_data_map_search(map, file_offset);
+		while (file_count) {
+			/*
+			 * Past the last extent, only the rest of the file is a
+			 * hole. Anything past the end of the file is read so
+			 * that a truncated file is a short read.
+			 */
+			uint64_t data_start = (i < map->num_extents ?
+					       map->extents[i].start :
+					       map->size);
+			uint64_t data_end = (i < map->num_extents ?
+					     map->extents[i].end :
+					     UINT64_MAX);
+			size_t n;
+			if (file_offset < data_start) {
+				n = min(data_start - file_offset,
+					(uint64_t)file_count);
+				memset(p, 0, n);
+			} else {
+				n = min(data_end - file_offset,
+					(uint64_t)file_count);
+				err = read_memory_file_data(file_segment, p, n,
+							    file_offset,
+							    address);
+				if (err)
+					return err;
+				i++;
+			}
+			p += n;
+			file_count -= n;
+			file_offset += n;
+			address += n;
+		}
+	} else if (file_count) {
+		err = read_memory_file_data(file_segment, p, file_count,
+					    file_offset, address);
+		if (err)
+			return err;
+		p += file_count;
 	}
 	memset(p, 0, count);
 	return NULL;
 }
+
+struct drgn_error *drgn_read_memory_mapped(void *buf, uint64_t address,
+					   size_t count, uint64_t offset,
+					   void *arg, bool physical)
+{
+	struct drgn_memory_mapped_segment *segment = arg;
+
+	if (offset > segment->size || count > segment->size - offset) {
+		return drgn_error_create_fault("could not read memory",
+					       address);
+	}
+	memcpy(buf, segment->data + offset, count);
+	return NULL;
+}
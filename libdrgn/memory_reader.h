@@ -81,6 +81,9 @@ void drgn_memory_reader_init(struct drgn_memory_reader *reader);
 /** Deinitialize a @ref drgn_memory_reader. */
 void drgn_memory_reader_deinit(struct drgn_memory_reader *reader);
 
+/** Get the number of segments in a @ref drgn_memory_reader. */
+size_t drgn_memory_reader_num_segments(struct drgn_memory_reader *reader);
+
 /** Return whether a @ref drgn_memory_reader has no segments. */
 bool drgn_memory_reader_empty(struct drgn_memory_reader *reader);
 
@@ -105,6 +108,76 @@ struct drgn_error *drgn_memory_reader_read(struct drgn_memory_reader *reader,
 					   void *buf, uint64_t address,
 					   size_t count, bool physical);
 
+/**
+ * Find the first hole in a range of a @ref drgn_memory_reader.
+ *
+ * A hole is a part of memory which is known to contain only zeroes without
+ * reading it: a hole in a sparse core dump file or the part of a segment past
+ * the end of its file data. Memory that isn't in any segment is not a hole.
+ *
+ * @param[in] address Start of the range.
+ * @param[in] size Size of the range.
+ * @param[in] physical Whether @c address is physical.
+ * @param[out] start_ret Start of the first hole in the range, or the end of the
+ * range if there are no holes.
+ * @param[out] end_ret End of the hole, truncated to the end of the range.
+ * Adjacent holes (e.g., in consecutive segments) are combined.
+ */
+void drgn_memory_reader_find_hole(struct drgn_memory_reader *reader,
+				  uint64_t address, uint64_t size,
+				  bool physical, uint64_t *start_ret,
+				  uint64_t *end_ret);
+
+/** Region of a file containing data. */
+struct drgn_file_extent {
+	/** Offset of the start of the region in the file. */
+	uint64_t start;
+	/** Offset of the end of the region in the file (exclusive). */
+	uint64_t end;
+};
+
+/**
+ * Map of the data in a sparse file.
+ *
+ * Filesystems don't allocate storage for ranges of a file that were never
+ * written (holes), and reading them returns zeroes. Core dumps of mostly unused
+ * memory are often sparse, so reads of holes are served without asking the
+ * filesystem to synthesize zeroes, and scanners can skip holes altogether (see
+ * @ref drgn_memory_reader_find_hole()).
+ */
+struct drgn_file_data_map {
+	/**
+	 * Extents containing data, sorted by offset and non-overlapping.
+	 * Anything between them is a hole.
+	 */
+	struct drgn_file_extent *extents;
+	/** Number of extents. */
+	size_t num_extents;
+	/**
+	 * Size of the file. Only ranges below this can be holes; anything past
+	 * it is missing (e.g., the file was truncated) and is read from the
+	 * file so that it fails like it would without the map.
+	 */
+	uint64_t size;
+};
+
+/**
+ * Build a @ref drgn_file_data_map with @c SEEK_DATA and @c SEEK_HOLE.
+ *
+ * If the file has no holes or the filesystem can't report them, @p ret is set
+ * to @c NULL.
+ *
+ * @param[in] fd File descriptor. Its file offset is changed.
+ * @param[in] size Size of the file.
+ * @param[out] ret Returned map, which must be freed with @ref
+ * drgn_file_data_map_destroy().
+ */
+struct drgn_error *drgn_file_data_map_create(int fd, uint64_t size,
+					     struct drgn_file_data_map **ret);
+
+/** Free a @ref drgn_file_data_map. */
+void drgn_file_data_map_destroy(struct drgn_file_data_map *map);
+
 /** Argument for @ref drgn_read_memory_file(). */
 struct drgn_memory_file_segment {
 	/** Offset in the file where the segment starts. */
@@ -122,6 +195,16 @@ struct drgn_memory_file_segment {
 	 * OS error.
 	 */
 	bool eio_is_fault;
+	/**
+	 * Program whose read engine is used for large reads, or @c NULL to
+	 * always read synchronously.
+	 */
+	struct drgn_program *prog;
+	/**
+	 * Holes in the file, or @c NULL if all of it should be read. Holes are
+	 * read as zeroes without accessing the file.
+	 */
+	const struct drgn_file_data_map *data_map;
 };
 
 /** @ref drgn_memory_read_fn which reads from a file. */
@@ -129,6 +212,42 @@ struct drgn_error *drgn_read_memory_file(void *buf, uint64_t address,
 					 size_t count, uint64_t offset,
 					 void *arg, bool physical);
 
+/**
+ * Find where a range of a @ref drgn_memory_reader is stored in a file.
+ *
+ * This only succeeds if the whole range is in the file data of a single
+ * segment read by @ref drgn_read_memory_file() without a block cache, so that
+ * it can be read with one <tt>pread(2)</tt>.
+ *
+ * @param[in] address Start of the range.
+ * @param[in] size Size of the range.
+ * @param[in] physical Whether @c address is physical.
+ * @param[out] segment_ret Returned file segment.
+ * @param[out] offset_ret Returned offset of the range in the file.
+ * @return Whether the range is in a file.
+ */
+bool drgn_memory_reader_file_location(struct drgn_memory_reader *reader,
+				      uint64_t address, uint64_t size,
+				      bool physical,
+				      const struct drgn_memory_file_segment **segment_ret,
+				      uint64_t *offset_ret);
+
+/** Argument for @ref drgn_read_memory_mapped(). */
+struct drgn_memory_mapped_segment {
+	/** Start of the segment in a memory mapping. */
+	const char *data;
+	/** Size of the segment. */
+	uint64_t size;
+};
+
+/**
+ * @ref drgn_memory_read_fn which copies directly from a memory mapping of a
+ * file (e.g., the RAM of a virtual machine), without any system calls.
+ */
+struct drgn_error *drgn_read_memory_mapped(void *buf, uint64_t address,
+					   size_t count, uint64_t offset,
+					   void *arg, bool physical);
+
 /** @} */
 
 #endif /* DRGN_MEMORY_READER_H */
@@ -1363,7 +1363,7 @@ struct drgn_error *drgn_object_member_dereference(struct drgn_object *res,
 {
 	struct drgn_error *err;
 	struct drgn_type *underlying_type;
-	struct drgn_member_value *member;
+	struct drgn_member_value member;
 	struct drgn_qualified_type qualified_type;
 
 	if (drgn_object_program(res) != drgn_object_program(obj)) {
@@ -1384,13 +1384,13 @@ struct drgn_error *drgn_object_member_dereference(struct drgn_object *res,
 	if (err)
 		return err;
 
-	err = drgn_lazy_type_evaluate(member->type, &qualified_type);
+	err = drgn_lazy_type_evaluate(member.type, &qualified_type);
 	if (err)
 		return err;
 
 	return drgn_object_dereference_offset(res, obj, qualified_type,
-					      member->bit_offset,
-					      member->bit_field_size);
+					      member.bit_offset,
+					      member.bit_field_size);
 }
 
 LIBDRGN_PUBLIC struct drgn_error *
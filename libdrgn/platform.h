@@ -75,6 +75,13 @@ struct drgn_architecture_info {
 	struct drgn_error *(*linux_kernel_live_direct_mapping_fallback)(struct drgn_program *,
 									uint64_t *,
 									uint64_t *);
+	/*
+	 * Translate an address in the kernel image mapping (e.g.,
+	 * swapper_pg_dir) to a physical address without the page table.
+	 */
+	struct drgn_error *(*linux_kernel_image_virt_to_phys)(struct drgn_program *,
+							      uint64_t,
+							      uint64_t *);
 	/* Size to allocate for pgtable_iterator::arch. */
 	size_t pgtable_iterator_arch_size;
 	/* Initialize pgtable_iterator::arch. */
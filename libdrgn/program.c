@@ -5,6 +5,7 @@
 #include <byteswap.h>
 #include <dwarf.h>
 #include <elf.h>
+#include <endian.h>
 #include <elfutils/libdw.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -13,18 +14,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/statfs.h>
 #include <unistd.h>
 
+#include "block_cache.h"
 #include "debug_info.h"
 #include "dwarf_index.h"
 #include "error.h"
+#include "helpers.h"
+#include "http_file.h"
 #include "language.h"
 #include "linux_kernel.h"
+#include "memory_budget.h"
 #include "memory_reader.h"
+#include "minmax.h"
 #include "object_index.h"
 #include "program.h"
+#include "read_engine.h"
 #include "symbol.h"
+#include "thread_pool.h"
 #include "vector.h"
 #include "util.h"
 
@@ -56,6 +66,217 @@ drgn_program_language(struct drgn_program *prog)
 	return drgn_language_or_default(prog->lang);
 }
 
+LIBDRGN_PUBLIC size_t drgn_program_num_threads(struct drgn_program *prog)
+{
+	return prog->num_threads ? prog->num_threads : drgn_num_available_cpus();
+}
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_program_set_num_threads(struct drgn_program *prog, size_t num_threads)
+{
+	if (num_threads != prog->num_threads) {
+		/*
+		 * The pool is recreated with the new size when it's needed. The
+		 * read engine may use the pool, so it goes with it.
+		 */
+		drgn_read_engine_destroy(prog->read_engine);
+		prog->read_engine = NULL;
+		drgn_thread_pool_destroy(prog->thread_pool);
+		prog->thread_pool = NULL;
+		prog->num_threads = num_threads;
+	}
+	return NULL;
+}
+
+struct drgn_error *drgn_program_thread_pool(struct drgn_program *prog,
+					    struct drgn_thread_pool **ret)
+{
+	if (!prog->thread_pool) {
+		struct drgn_error *err =
+			drgn_thread_pool_create(drgn_program_num_threads(prog),
+						&prog->thread_pool);
+		if (err)
+			return err;
+	}
+	*ret = prog->thread_pool;
+	return NULL;
+}
+
+LIBDRGN_PUBLIC size_t drgn_program_direct_io(struct drgn_program *prog)
+{
+	return prog->block_cache ? drgn_block_cache_size(prog->block_cache) : 0;
+}
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_program_set_direct_io(struct drgn_program *prog, size_t cache_size)
+{
+	struct drgn_error *err;
+
+	/* A remote core dump can only be read through its cache. */
+	if (prog->core_image) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "cache of remote core dump can't be changed");
+	}
+
+	drgn_block_cache_destroy(prog->block_cache);
+	prog->block_cache = NULL;
+	if (!cache_size)
+		return NULL;
+
+	struct stat st;
+	if (!prog->file_segments || (prog->flags & DRGN_PROGRAM_IS_LIVE) ||
+	    fstat(prog->core_fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "direct I/O is only supported for ELF core dump files");
+	}
+
+	/*
+	 * The original file descriptor is also used by libelf, which doesn't
+	 * do aligned reads, so open the file again.
+	 */
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", prog->core_fd);
+	int fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd == -1)
+		return drgn_error_create_os("open", errno, path);
+	err = drgn_block_cache_create(fd, cache_size, &prog->block_cache);
+	if (err)
+		close(fd);
+	return err;
+}
+
+static size_t drgn_program_direct_io_cost(struct drgn_cache *cache)
+{
+	struct drgn_program *prog = container_of(cache, struct drgn_program,
+						 direct_io_cache);
+	return prog->block_cache ?
+	       drgn_block_cache_resident(prog->block_cache) : 0;
+}
+
+static void drgn_program_direct_io_shrink(struct drgn_cache *cache,
+					  size_t target)
+{
+	struct drgn_program *prog = container_of(cache, struct drgn_program,
+						 direct_io_cache);
+	if (prog->block_cache)
+		drgn_block_cache_shrink(prog->block_cache, target);
+}
+
+LIBDRGN_PUBLIC void
+drgn_program_direct_io_stats(struct drgn_program *prog,
+			     struct drgn_direct_io_stats *ret)
+{
+	if (prog->block_cache)
+		*ret = *drgn_block_cache_stats(prog->block_cache);
+	else
+		memset(ret, 0, sizeof(*ret));
+}
+
+LIBDRGN_PUBLIC size_t drgn_program_memory_budget(struct drgn_program *prog)
+{
+	return prog->memory_budget.limit;
+}
+
+LIBDRGN_PUBLIC void drgn_program_set_memory_budget(struct drgn_program *prog,
+						   size_t budget)
+{
+	drgn_memory_budget_set_limit(&prog->memory_budget, budget);
+}
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_program_memory_usage(struct drgn_program *prog,
+			  drgn_memory_usage_fn *fn, void *arg)
+{
+	struct drgn_error *err;
+
+	if ((err = drgn_program_types_memory_usage(prog, fn, arg)) ||
+	    (err = drgn_debug_info_memory_usage(prog->_dbinfo, fn, arg)))
+		return err;
+
+	struct drgn_memory_usage prstatus = { .name = "prstatus" };
+	/* The notes themselves are part of the core dump. */
+	if (prog->prstatus_cached &&
+	    (prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL)) {
+		prstatus.size = (prog->prstatus_vector.capacity *
+				 sizeof(prog->prstatus_vector.data[0]));
+		prstatus.count = prog->prstatus_vector.size;
+	} else if (prog->prstatus_cached) {
+		prstatus.size = drgn_prstatus_map_memory_usage(&prog->prstatus_map);
+		prstatus.count = drgn_prstatus_map_size(&prog->prstatus_map);
+	}
+	err = fn(&prstatus, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage reader = {
+		.name = "memory_reader",
+		.count = drgn_memory_reader_num_segments(&prog->reader),
+	};
+	reader.size = reader.count * sizeof(struct drgn_memory_segment);
+	if (prog->core_data_map) {
+		reader.size += (sizeof(*prog->core_data_map) +
+				prog->core_data_map->num_extents *
+				sizeof(prog->core_data_map->extents[0]));
+	}
+	err = fn(&reader, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage direct_io = {
+		.name = "direct_io",
+		.evictions = prog->direct_io_cache.evictions,
+	};
+	if (prog->block_cache) {
+		direct_io.size = drgn_block_cache_resident(prog->block_cache);
+		direct_io.count = direct_io.size / DRGN_BLOCK_CACHE_BLOCK_SIZE;
+	}
+	err = fn(&direct_io, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage translation_cache = {
+		.name = "translation_cache",
+	};
+	linux_helper_translation_cache_memory_usage(prog->translation_cache,
+						    &translation_cache);
+	err = fn(&translation_cache, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage dentry_paths = { .name = "dentry_paths" };
+	linux_helper_dentry_path_cache_memory_usage(prog->dentry_path_cache,
+						    &dentry_paths);
+	return fn(&dentry_paths, arg);
+}
+
+struct drgn_error *drgn_program_read_engine(struct drgn_program *prog,
+					    struct drgn_read_engine **ret)
+{
+	struct drgn_error *err;
+
+	if (!prog->read_engine) {
+		struct drgn_thread_pool *pool;
+		err = drgn_program_thread_pool(prog, &pool);
+		if (err)
+			return err;
+		err = drgn_read_engine_create(pool, 32, true,
+					      &prog->read_engine);
+		if (err)
+			return err;
+		if (prog->core_fd != -1) {
+			err = drgn_read_engine_register_fd(prog->read_engine,
+							   prog->core_fd);
+			if (err) {
+				drgn_read_engine_destroy(prog->read_engine);
+				prog->read_engine = NULL;
+				return err;
+			}
+		}
+	}
+	*ret = prog->read_engine;
+	return NULL;
+}
+
 void drgn_program_set_platform(struct drgn_program *prog,
 			       const struct drgn_platform *platform)
 {
@@ -69,6 +290,10 @@ void drgn_program_init(struct drgn_program *prog,
 		       const struct drgn_platform *platform)
 {
 	memset(prog, 0, sizeof(*prog));
+	drgn_memory_budget_init(&prog->memory_budget);
+	drgn_cache_register(&prog->memory_budget, &prog->direct_io_cache,
+			    "direct_io", drgn_program_direct_io_cost,
+			    drgn_program_direct_io_shrink);
 	drgn_memory_reader_init(&prog->reader);
 	drgn_program_init_types(prog);
 	drgn_object_index_init(&prog->oindex);
@@ -86,22 +311,32 @@ void drgn_program_deinit(struct drgn_program *prog)
 			drgn_prstatus_map_deinit(&prog->prstatus_map);
 	}
 	free(prog->pgtable_it);
+	linux_helper_translation_cache_destroy(prog->translation_cache);
+	linux_helper_dentry_path_cache_destroy(prog->dentry_path_cache);
 
 	drgn_object_index_deinit(&prog->oindex);
 	drgn_program_deinit_types(prog);
 	drgn_memory_reader_deinit(&prog->reader);
 
 	free(prog->file_segments);
+	drgn_file_data_map_destroy(prog->core_data_map);
 
 #ifdef WITH_LIBKDUMPFILE
 	if (prog->kdump_ctx)
 		kdump_free(prog->kdump_ctx);
 #endif
+	drgn_read_engine_destroy(prog->read_engine);
+	drgn_cache_unregister(&prog->direct_io_cache);
+	drgn_block_cache_destroy(prog->block_cache);
 	elf_end(prog->core);
+	free(prog->core_image);
 	if (prog->core_fd != -1)
 		close(prog->core_fd);
+	if (prog->guest_memory)
+		munmap(prog->guest_memory, prog->guest_memory_size);
 
 	drgn_debug_info_destroy(prog->_dbinfo);
+	drgn_thread_pool_destroy(prog->thread_pool);
 }
 
 LIBDRGN_PUBLIC struct drgn_error *
@@ -176,6 +411,198 @@ static struct drgn_error *has_kdump_signature(const char *path, int fd,
 	return NULL;
 }
 
+/* Default size of the cache of a remote core dump. */
+#define DRGN_REMOTE_CORE_CACHE_SIZE (64 * 1024 * 1024)
+/* Number of bytes first read from the beginning of a remote core dump. */
+#define DRGN_REMOTE_CORE_PREFIX_SIZE (4 * 1024 * 1024)
+/* Maximum size of the headers and notes of a remote core dump. */
+#define DRGN_REMOTE_CORE_MAX_HEADERS_SIZE (256 * 1024 * 1024)
+
+/*
+ * Get the number of bytes at the beginning of an ELF file needed to parse its
+ * ELF header and section headers with libelf.
+ */
+static struct drgn_error *core_ehdr_span(const char *image, size_t size,
+					 uint64_t *ret)
+{
+	if (size < EI_NIDENT || memcmp(image, ELFMAG, SELFMAG) != 0)
+		goto not_core;
+
+	uint64_t ehsize, shoff;
+	uint16_t shnum, shentsize;
+	Elf_Data src = {
+		.d_buf = (void *)image,
+		.d_type = ELF_T_EHDR,
+		.d_version = EV_CURRENT,
+	};
+	if (image[EI_CLASS] == ELFCLASS64) {
+		Elf64_Ehdr ehdr;
+		Elf_Data dst = {
+			.d_buf = &ehdr,
+			.d_size = sizeof(ehdr),
+			.d_version = EV_CURRENT,
+		};
+		src.d_size = ehsize = sizeof(ehdr);
+		if (size < ehsize)
+			goto not_core;
+		if (!elf64_xlatetom(&dst, &src, image[EI_DATA]))
+			return drgn_error_libelf();
+		shoff = ehdr.e_shoff;
+		shnum = ehdr.e_shnum;
+		shentsize = sizeof(Elf64_Shdr);
+	} else if (image[EI_CLASS] == ELFCLASS32) {
+		Elf32_Ehdr ehdr;
+		Elf_Data dst = {
+			.d_buf = &ehdr,
+			.d_size = sizeof(ehdr),
+			.d_version = EV_CURRENT,
+		};
+		src.d_size = ehsize = sizeof(ehdr);
+		if (size < ehsize)
+			goto not_core;
+		if (!elf32_xlatetom(&dst, &src, image[EI_DATA]))
+			return drgn_error_libelf();
+		shoff = ehdr.e_shoff;
+		shnum = ehdr.e_shnum;
+		shentsize = sizeof(Elf32_Shdr);
+	} else {
+		goto not_core;
+	}
+
+	*ret = ehsize;
+	if (shoff) {
+		/*
+		 * If there are too many sections or program headers, the
+		 * counts are in the first section header.
+		 */
+		uint64_t end;
+		if (__builtin_add_overflow(shoff,
+					   (uint64_t)(shnum ? shnum : 1) *
+					   shentsize, &end))
+			goto not_core;
+		*ret = max(*ret, end);
+	}
+	return NULL;
+
+not_core:
+	return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+				 "not an ELF core file");
+}
+
+/*
+ * Get the number of bytes at the beginning of an ELF core file needed to parse
+ * its program headers and notes. @p size is the number of bytes that @p elf was
+ * created from.
+ */
+static struct drgn_error *core_phdrs_span(Elf *elf, size_t size, uint64_t *ret)
+{
+	GElf_Ehdr ehdr_mem, *ehdr = gelf_getehdr(elf, &ehdr_mem);
+	if (!ehdr || ehdr->e_type != ET_CORE) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "not an ELF core file");
+	}
+	size_t phnum;
+	if (elf_getphdrnum(elf, &phnum) != 0)
+		return drgn_error_libelf();
+	uint64_t span;
+	if (__builtin_add_overflow(ehdr->e_phoff,
+				   (uint64_t)phnum *
+				   gelf_fsize(elf, ELF_T_PHDR, 1, EV_CURRENT),
+				   &span)) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "ELF core file has invalid program headers");
+	}
+	if (span <= size) {
+		for (size_t i = 0; i < phnum; i++) {
+			GElf_Phdr phdr_mem, *phdr = gelf_getphdr(elf, i,
+								  &phdr_mem);
+			if (!phdr)
+				return drgn_error_libelf();
+			uint64_t end;
+			if (phdr->p_type != PT_NOTE)
+				continue;
+			if (__builtin_add_overflow(phdr->p_offset,
+						   phdr->p_filesz, &end)) {
+				return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+							 "ELF core file has invalid note segment");
+			}
+			span = max(span, end);
+		}
+	}
+	*ret = span;
+	return NULL;
+}
+
+/*
+ * Open an ELF core dump on an HTTP server. All reads go through the block
+ * cache, and libelf parses a copy of the beginning of the file that contains
+ * the headers and notes.
+ */
+static struct drgn_error *drgn_program_open_remote_core(struct drgn_program *prog,
+							const char *url)
+{
+	struct drgn_error *err;
+
+	struct drgn_block_source *source;
+	err = drgn_http_file_open(url, &source);
+	if (err)
+		return err;
+	size_t cache_size = DRGN_REMOTE_CORE_CACHE_SIZE;
+	char *env = getenv("DRGN_DIRECT_IO_CACHE_MB");
+	if (env && atoi(env) > 0)
+		cache_size = (size_t)atoi(env) << 20;
+	err = drgn_block_cache_create_from_source(source, cache_size,
+						  &prog->block_cache);
+	if (err) {
+		source->destroy(source);
+		return err;
+	}
+
+	size_t size = DRGN_REMOTE_CORE_PREFIX_SIZE;
+	for (;;) {
+		char *image = realloc(prog->core_image, size);
+		if (!image)
+			return &drgn_enomem;
+		prog->core_image = image;
+		size_t done;
+		err = drgn_block_cache_read(prog->block_cache, image, size, 0,
+					    &done);
+		if (err)
+			return err;
+		if (done >= KDUMP_SIG_LEN &&
+		    memcmp(image, KDUMP_SIGNATURE, KDUMP_SIG_LEN) == 0) {
+			return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+						 "kdump files can't be read over HTTP");
+		}
+
+		uint64_t need;
+		err = core_ehdr_span(image, done, &need);
+		if (err)
+			return err;
+		if (need <= done) {
+			prog->core = elf_memory(image, done);
+			if (!prog->core)
+				return drgn_error_libelf();
+			err = core_phdrs_span(prog->core, done, &need);
+			if (err)
+				return err;
+			if (need <= done)
+				return NULL;
+			elf_end(prog->core);
+			prog->core = NULL;
+		}
+		if (done < size) {
+			return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+						 "ELF core file is truncated");
+		}
+		if (need > DRGN_REMOTE_CORE_MAX_HEADERS_SIZE) {
+			return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+						 "ELF core file headers are too large");
+		}
+		size = need;
+	}
+}
+
 LIBDRGN_PUBLIC struct drgn_error *
 drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 {
@@ -189,31 +616,38 @@ drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 	const char *vmcoreinfo_note = NULL;
 	size_t vmcoreinfo_size = 0;
 	bool have_nt_taskstruct = false, is_proc_kcore;
+	bool is_remote = drgn_is_http_url(path);
 
 	err = drgn_program_check_initialized(prog);
 	if (err)
 		return err;
 
-	prog->core_fd = open(path, O_RDONLY);
-	if (prog->core_fd == -1)
-		return drgn_error_create_os("open", errno, path);
+	elf_version(EV_CURRENT);
 
-	err = has_kdump_signature(path, prog->core_fd, &is_kdump);
-	if (err)
-		goto out_fd;
-	if (is_kdump) {
-		err = drgn_program_set_kdump(prog);
+	if (is_remote) {
+		err = drgn_program_open_remote_core(prog, path);
 		if (err)
-			goto out_fd;
-		return NULL;
-	}
+			goto out_elf;
+	} else {
+		prog->core_fd = open(path, O_RDONLY);
+		if (prog->core_fd == -1)
+			return drgn_error_create_os("open", errno, path);
 
-	elf_version(EV_CURRENT);
+		err = has_kdump_signature(path, prog->core_fd, &is_kdump);
+		if (err)
+			goto out_fd;
+		if (is_kdump) {
+			err = drgn_program_set_kdump(prog);
+			if (err)
+				goto out_fd;
+			return NULL;
+		}
 
-	prog->core = elf_begin(prog->core_fd, ELF_C_READ, NULL);
-	if (!prog->core) {
-		err = drgn_error_libelf();
-		goto out_fd;
+		prog->core = elf_begin(prog->core_fd, ELF_C_READ, NULL);
+		if (!prog->core) {
+			err = drgn_error_libelf();
+			goto out_fd;
+		}
 	}
 
 	ehdr = gelf_getehdr(prog->core, &ehdr_mem);
@@ -290,7 +724,7 @@ drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 		}
 	}
 
-	if (have_nt_taskstruct) {
+	if (have_nt_taskstruct && !is_remote) {
 		/*
 		 * If the core file has an NT_TASKSTRUCT note and is in /proc,
 		 * then it's probably /proc/kcore.
@@ -307,7 +741,7 @@ drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 		is_proc_kcore = false;
 	}
 
-	if (vmcoreinfo_note && !is_proc_kcore) {
+	if (vmcoreinfo_note && !is_proc_kcore && !is_remote) {
 		char *env;
 
 		/* Use libkdumpfile for ELF vmcores if it was requested. */
@@ -327,6 +761,37 @@ drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 		goto out_elf;
 	}
 
+	if (!is_proc_kcore && !is_remote) {
+		char *env;
+		struct stat st;
+
+		/*
+		 * Core dumps of mostly unused memory are often sparse. Remember
+		 * where the holes are so that reading them doesn't touch the
+		 * filesystem.
+		 */
+		if (fstat(prog->core_fd, &st) == -1) {
+			err = drgn_error_create_os("fstat", errno, path);
+			goto out_segments;
+		}
+		if (S_ISREG(st.st_mode)) {
+			err = drgn_file_data_map_create(prog->core_fd,
+							st.st_size,
+							&prog->core_data_map);
+			if (err)
+				goto out_segments;
+		}
+
+		/* Use direct I/O for huge core dumps if it was requested. */
+		env = getenv("DRGN_DIRECT_IO_CACHE_MB");
+		if (env && atoi(env) > 0) {
+			err = drgn_program_set_direct_io(prog,
+							 (size_t)atoi(env) << 20);
+			if (err)
+				goto out_segments;
+		}
+	}
+
 	if ((is_proc_kcore || vmcoreinfo_note) &&
 	    platform.arch->linux_kernel_pgtable_iterator_next) {
 		/*
@@ -359,6 +824,8 @@ drgn_program_set_core_dump(struct drgn_program *prog, const char *path)
 		prog->file_segments[j].file_size = phdr->p_filesz;
 		prog->file_segments[j].fd = prog->core_fd;
 		prog->file_segments[j].eio_is_fault = false;
+		prog->file_segments[j].prog = prog;
+		prog->file_segments[j].data_map = prog->core_data_map;
 		err = drgn_program_add_memory_segment(prog, phdr->p_vaddr,
 						      phdr->p_memsz,
 						      drgn_read_memory_file,
@@ -465,11 +932,21 @@ out_segments:
 	drgn_memory_reader_init(&prog->reader);
 	free(prog->file_segments);
 	prog->file_segments = NULL;
+	drgn_file_data_map_destroy(prog->core_data_map);
+	prog->core_data_map = NULL;
 out_elf:
 	elf_end(prog->core);
 	prog->core = NULL;
 out_fd:
-	close(prog->core_fd);
+	/* The read engine may have registered the file. */
+	drgn_read_engine_destroy(prog->read_engine);
+	prog->read_engine = NULL;
+	drgn_block_cache_destroy(prog->block_cache);
+	prog->block_cache = NULL;
+	free(prog->core_image);
+	prog->core_image = NULL;
+	if (prog->core_fd != -1)
+		close(prog->core_fd);
 	prog->core_fd = -1;
 	return err;
 }
@@ -504,6 +981,8 @@ drgn_program_set_pid(struct drgn_program *prog, pid_t pid)
 	prog->file_segments[0].file_size = UINT64_MAX;
 	prog->file_segments[0].fd = prog->core_fd;
 	prog->file_segments[0].eio_is_fault = true;
+	prog->file_segments[0].prog = prog;
+	prog->file_segments[0].data_map = NULL;
 	err = drgn_program_add_memory_segment(prog, 0, UINT64_MAX,
 					      drgn_read_memory_file,
 					      prog->file_segments, false);
@@ -521,11 +1000,218 @@ out_segments:
 	free(prog->file_segments);
 	prog->file_segments = NULL;
 out_fd:
+	/* The read engine may have registered the file. */
+	drgn_read_engine_destroy(prog->read_engine);
+	prog->read_engine = NULL;
+	drgn_block_cache_destroy(prog->block_cache);
+	prog->block_cache = NULL;
 	close(prog->core_fd);
 	prog->core_fd = -1;
 	return err;
 }
 
+/* Guest physical address of the RAM above the PCI hole on x86-64. */
+#define DRGN_GUEST_HIGH_RAM_START (UINT64_C(4) << 30)
+
+/* Get the offset in the guest RAM file of a guest physical address. */
+static bool guest_phys_to_offset(struct drgn_program *prog, uint64_t phys_addr,
+				 uint64_t *ret)
+{
+	uint64_t low_size = prog->guest_segments[0].size;
+	uint64_t high_size = prog->guest_segments[1].size;
+	if (phys_addr < low_size) {
+		*ret = phys_addr;
+		return true;
+	} else if (phys_addr >= DRGN_GUEST_HIGH_RAM_START &&
+		   phys_addr - DRGN_GUEST_HIGH_RAM_START < high_size) {
+		*ret = low_size + (phys_addr - DRGN_GUEST_HIGH_RAM_START);
+		return true;
+	} else {
+		return false;
+	}
+}
+
+/*
+ * Find VMCOREINFO in the RAM of a virtual machine. The kernel allocates the
+ * note in its own pages, so only the beginning of each page is checked.
+ */
+static struct drgn_error *find_guest_vmcoreinfo(struct drgn_program *prog)
+{
+	static const char name[] = "VMCOREINFO";
+	const char *data = prog->guest_memory;
+	size_t size = prog->guest_memory_size;
+	/* Name padded to 4 bytes. */
+	size_t desc_offset = sizeof(Elf64_Nhdr) + ((sizeof(name) + 3) & ~3);
+
+	for (size_t offset = 0; size - offset > desc_offset; offset += 4096) {
+		const char *note = data + offset;
+		Elf64_Nhdr nhdr;
+		memcpy(&nhdr, note, sizeof(nhdr));
+		if (le32toh(nhdr.n_namesz) != sizeof(name) ||
+		    le32toh(nhdr.n_type) != 0 ||
+		    memcmp(note + sizeof(nhdr), name, sizeof(name)) != 0)
+			continue;
+		size_t descsz = le32toh(nhdr.n_descsz);
+		if (descsz > size - offset - desc_offset ||
+		    descsz < sizeof("OSRELEASE=") - 1 ||
+		    memcmp(note + desc_offset, "OSRELEASE=",
+			   sizeof("OSRELEASE=") - 1) != 0)
+			continue;
+		struct drgn_error *err = parse_vmcoreinfo(note + desc_offset,
+							  descsz,
+							  &prog->vmcoreinfo);
+		if (!err)
+			return NULL;
+		/* This may be a stale copy. Keep looking. */
+		drgn_error_destroy(err);
+	}
+	return drgn_error_create(DRGN_ERROR_OTHER,
+				 "could not find VMCOREINFO in guest memory");
+}
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_program_set_guest_memory(struct drgn_program *prog, const char *path,
+			      uint64_t pgtable, uint64_t low_ram_size)
+{
+	struct drgn_error *err;
+	struct drgn_platform platform;
+
+	err = drgn_program_check_initialized(prog);
+	if (err)
+		return err;
+
+	drgn_platform_from_arch(&arch_info_x86_64, true, true, &platform);
+	if (prog->has_platform &&
+	    prog->platform.arch != platform.arch) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "guest memory is only supported for x86-64");
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return drgn_error_create_os("open", errno, path);
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		err = drgn_error_create_os("fstat", errno, path);
+		close(fd);
+		return err;
+	}
+	if (st.st_size <= 0 || (uint64_t)st.st_size > SIZE_MAX) {
+		close(fd);
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "guest memory file has invalid size");
+	}
+	/*
+	 * The mapping is shared so that reads see the current contents of guest
+	 * memory.
+	 */
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err = drgn_error_create_os("mmap", errno, path);
+		close(fd);
+		return err;
+	}
+	close(fd);
+	prog->guest_memory = map;
+	prog->guest_memory_size = st.st_size;
+
+	if (!low_ram_size || low_ram_size > prog->guest_memory_size)
+		low_ram_size = prog->guest_memory_size;
+	if (low_ram_size > DRGN_GUEST_HIGH_RAM_START) {
+		err = drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					"low RAM size must be at most 4 GiB");
+		goto err;
+	}
+	prog->guest_segments[0].data = map;
+	prog->guest_segments[0].size = low_ram_size;
+	prog->guest_segments[1].data = (char *)map + low_ram_size;
+	prog->guest_segments[1].size = prog->guest_memory_size - low_ram_size;
+	err = drgn_program_add_memory_segment(prog, 0,
+					      prog->guest_segments[0].size,
+					      drgn_read_memory_mapped,
+					      &prog->guest_segments[0], true);
+	if (err)
+		goto err;
+	if (prog->guest_segments[1].size) {
+		err = drgn_program_add_memory_segment(prog,
+						      DRGN_GUEST_HIGH_RAM_START,
+						      prog->guest_segments[1].size,
+						      drgn_read_memory_mapped,
+						      &prog->guest_segments[1],
+						      true);
+		if (err)
+			goto err;
+	}
+
+	err = find_guest_vmcoreinfo(prog);
+	if (err)
+		goto err;
+	if (pgtable) {
+		/* Ignore the PCID and flag bits of CR3. */
+		pgtable &= UINT64_C(0xffffffffff000);
+	} else {
+		err = arch_info_x86_64.linux_kernel_image_virt_to_phys(prog,
+								      prog->vmcoreinfo.swapper_pg_dir,
+								      &pgtable);
+		if (err)
+			goto err;
+	}
+	uint64_t pgtable_offset;
+	if (!guest_phys_to_offset(prog, pgtable, &pgtable_offset) ||
+	    prog->guest_memory_size - pgtable_offset < 4096) {
+		err = drgn_error_format(DRGN_ERROR_INVALID_ARGUMENT,
+					"kernel page table 0x%" PRIx64 " is not in guest memory",
+					pgtable);
+		goto err;
+	}
+
+	/*
+	 * Virtual addresses are translated with the kernel page table, but the
+	 * page table iterator reads the top-level table by its virtual address,
+	 * so map that page directly.
+	 */
+	err = drgn_program_add_memory_segment(prog, 0, UINT64_MAX,
+					      read_memory_via_pgtable, prog,
+					      false);
+	if (err)
+		goto err;
+	prog->guest_segments[2].data = (char *)map + pgtable_offset;
+	prog->guest_segments[2].size = 4096;
+	err = drgn_program_add_memory_segment(prog,
+					      prog->vmcoreinfo.swapper_pg_dir &
+					      ~UINT64_C(4095),
+					      prog->guest_segments[2].size,
+					      drgn_read_memory_mapped,
+					      &prog->guest_segments[2], false);
+	if (err)
+		goto err;
+
+	err = drgn_program_add_object_finder(prog, linux_kernel_object_find,
+					     prog);
+	if (err)
+		goto err;
+	prog->flags |= DRGN_PROGRAM_IS_LINUX_KERNEL;
+	if (!prog->lang)
+		prog->lang = &drgn_language_c;
+	drgn_program_set_platform(prog, &platform);
+	return NULL;
+
+err:
+	drgn_memory_reader_deinit(&prog->reader);
+	drgn_memory_reader_init(&prog->reader);
+	memset(&prog->vmcoreinfo, 0, sizeof(prog->vmcoreinfo));
+	munmap(prog->guest_memory, prog->guest_memory_size);
+	prog->guest_memory = NULL;
+	prog->guest_memory_size = 0;
+	return err;
+}
+
+LIBDRGN_PUBLIC void
+drgn_program_flush_translation_cache(struct drgn_program *prog)
+{
+	linux_helper_translation_cache_flush(prog->translation_cache);
+}
+
 struct drgn_error *drgn_program_get_dbinfo(struct drgn_program *prog,
 					   struct drgn_debug_info **ret)
 {
@@ -614,7 +1300,8 @@ static int drgn_set_platform_from_dwarf(Dwfl_Module *module, void **userdatap,
 
 LIBDRGN_PUBLIC struct drgn_error *
 drgn_program_load_debug_info(struct drgn_program *prog, const char **paths,
-			     size_t n, bool load_default, bool load_main)
+			     size_t n, bool load_default, bool load_main,
+			     const struct drgn_index_profile *profile)
 {
 	struct drgn_error *err;
 
@@ -626,7 +1313,8 @@ drgn_program_load_debug_info(struct drgn_program *prog, const char **paths,
 	if (err)
 		return err;
 
-	err = drgn_debug_info_load(dbinfo, paths, n, load_default, load_main);
+	err = drgn_debug_info_load(dbinfo, paths, n, load_default, load_main,
+				   profile);
 	if ((!err || err->code == DRGN_ERROR_MISSING_DEBUG_INFO)) {
 		if (!prog->lang &&
 		    !(prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL))
@@ -821,7 +1509,7 @@ struct drgn_error *drgn_program_init_core_dump(struct drgn_program *prog,
 	err = drgn_program_set_core_dump(prog, path);
 	if (err)
 		return err;
-	err = drgn_program_load_debug_info(prog, NULL, 0, true, true);
+	err = drgn_program_load_debug_info(prog, NULL, 0, true, true, NULL);
 	if (err && err->code == DRGN_ERROR_MISSING_DEBUG_INFO) {
 		drgn_error_destroy(err);
 		err = NULL;
@@ -836,7 +1524,7 @@ struct drgn_error *drgn_program_init_kernel(struct drgn_program *prog)
 	err = drgn_program_set_kernel(prog);
 	if (err)
 		return err;
-	err = drgn_program_load_debug_info(prog, NULL, 0, true, true);
+	err = drgn_program_load_debug_info(prog, NULL, 0, true, true, NULL);
 	if (err && err->code == DRGN_ERROR_MISSING_DEBUG_INFO) {
 		drgn_error_destroy(err);
 		err = NULL;
@@ -851,7 +1539,7 @@ struct drgn_error *drgn_program_init_pid(struct drgn_program *prog, pid_t pid)
 	err = drgn_program_set_pid(prog, pid);
 	if (err)
 		return err;
-	err = drgn_program_load_debug_info(prog, NULL, 0, true, true);
+	err = drgn_program_load_debug_info(prog, NULL, 0, true, true, NULL);
 	if (err && err->code == DRGN_ERROR_MISSING_DEBUG_INFO) {
 		drgn_error_destroy(err);
 		err = NULL;
@@ -933,6 +1621,21 @@ drgn_program_read_memory(struct drgn_program *prog, void *buf, uint64_t address,
 				       physical);
 }
 
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_program_find_memory_hole(struct drgn_program *prog, uint64_t address,
+			      uint64_t size, bool physical,
+			      uint64_t *start_ret, uint64_t *end_ret)
+{
+	uint64_t end;
+	if (__builtin_add_overflow(address, size, &end)) {
+		return drgn_error_create(DRGN_ERROR_OVERFLOW,
+					 "memory range end is too large");
+	}
+	drgn_memory_reader_find_hole(&prog->reader, address, size, physical,
+				     start_ret, end_ret);
+	return NULL;
+}
+
 DEFINE_VECTOR(char_vector, char)
 
 LIBDRGN_PUBLIC struct drgn_error *
@@ -1185,17 +1888,17 @@ drgn_program_member_info(struct drgn_program *prog, struct drgn_type *type,
 			 const char *member_name, struct drgn_member_info *ret)
 {
 	struct drgn_error *err;
-	struct drgn_member_value *member;
+	struct drgn_member_value member;
 
 	err = drgn_program_find_member(prog, type, member_name,
 				       strlen(member_name), &member);
 	if (err)
 		return err;
 
-	err = drgn_lazy_type_evaluate(member->type, &ret->qualified_type);
+	err = drgn_lazy_type_evaluate(member.type, &ret->qualified_type);
 	if (err)
 		return err;
-	ret->bit_offset = member->bit_offset;
-	ret->bit_field_size = member->bit_field_size;
+	ret->bit_offset = member.bit_offset;
+	ret->bit_field_size = member.bit_field_size;
 	return NULL;
 }
@@ -22,14 +22,20 @@
 #include "drgn.h"
 #include "hash_table.h"
 #include "language.h"
+#include "memory_budget.h"
 #include "memory_reader.h"
 #include "object_index.h"
 #include "platform.h"
 #include "type.h"
 #include "vector.h"
 
+struct drgn_block_cache;
 struct drgn_debug_info;
+struct linux_helper_dentry_path_cache;
+struct linux_helper_translation_cache;
+struct drgn_read_engine;
 struct drgn_symbol;
+struct drgn_thread_pool;
 
 /**
  * @defgroup Internals Internals
@@ -61,6 +67,11 @@ struct vmcoreinfo {
 	uint64_t kaslr_offset;
 	/** Kernel page table. */
 	uint64_t swapper_pg_dir;
+	/**
+	 * Physical address that the start of the kernel image mapping maps to
+	 * (x86-64 only).
+	 */
+	uint64_t phys_base;
 	/** Whether 5-level paging was enabled. */
 	bool pgtable_l5_enabled;
 };
@@ -78,16 +89,41 @@ struct drgn_program {
 	struct drgn_memory_reader reader;
 	/* Elf core dump or /proc/pid/mem file segments. */
 	struct drgn_memory_file_segment *file_segments;
+	/* Holes in a sparse ELF core dump file, or NULL. */
+	struct drgn_file_data_map *core_data_map;
 	/* Elf core dump. Not valid for live programs or kdump files. */
 	Elf *core;
+	/*
+	 * Headers and notes of a remote ELF core dump that core was created
+	 * from, or NULL if the core dump is a local file.
+	 */
+	char *core_image;
 	/* File descriptor for ELF core dump, kdump file, or /proc/pid/mem. */
 	int core_fd;
+	/* Mapping of the RAM file of a virtual machine, or NULL. */
+	void *guest_memory;
+	size_t guest_memory_size;
+	/*
+	 * Segments of guest_memory: RAM below and above the PCI hole and the
+	 * top-level kernel page table.
+	 */
+	struct drgn_memory_mapped_segment guest_segments[3];
+	/*
+	 * Cache for reading the ELF core dump with direct I/O or over HTTP, or
+	 * NULL.
+	 */
+	struct drgn_block_cache *block_cache;
+	/* Budget registration of block_cache. */
+	struct drgn_cache direct_io_cache;
 	/* PID of live userspace program. */
 	pid_t pid;
 #ifdef WITH_LIBKDUMPFILE
 	kdump_ctx_t *kdump_ctx;
 #endif
 
+	/** Memory limit shared by the caches below. */
+	struct drgn_memory_budget memory_budget;
+
 	/*
 	 * Types.
 	 */
@@ -114,6 +150,11 @@ struct drgn_program {
 	 * enumerated types, are deduplicated.
 	 */
 	struct drgn_typep_vector created_types;
+	/**
+	 * Budget registration of @ref drgn_program::dedupe_types and @ref
+	 * drgn_program::created_types.
+	 */
+	struct drgn_cache types_cache;
 	/** Cache for @ref drgn_program_find_member(). */
 	struct drgn_member_map members;
 	/**
@@ -121,6 +162,11 @@ struct drgn_program {
 	 * drgn_program::members.
 	 */
 	struct drgn_type_set members_cached;
+	/**
+	 * Budget registration of @ref drgn_program::members and @ref
+	 * drgn_program::members_cached.
+	 */
+	struct drgn_cache members_cache;
 
 	/*
 	 * Debugging information.
@@ -136,6 +182,15 @@ struct drgn_program {
 	struct drgn_platform platform;
 	bool has_platform;
 	enum drgn_program_flags flags;
+	/*
+	 * Maximum number of threads for parallel work, or 0 for the number of
+	 * available CPUs.
+	 */
+	size_t num_threads;
+	/* Created lazily by drgn_program_thread_pool(). */
+	struct drgn_thread_pool *thread_pool;
+	/* Created lazily by drgn_program_read_engine(). */
+	struct drgn_read_engine *read_engine;
 
 	/*
 	 * Stack traces.
@@ -175,6 +230,10 @@ struct drgn_program {
 	 * to prevent address translation from recursing.
 	 */
 	bool pgtable_it_in_use;
+	/* Cache for linux_helper_read_vm(). Created lazily. */
+	struct linux_helper_translation_cache *translation_cache;
+	/* Cache for linux_helper_d_path(). Created lazily. */
+	struct linux_helper_dentry_path_cache *dentry_path_cache;
 };
 
 /** Initialize a @ref drgn_program. */
@@ -191,6 +250,23 @@ void drgn_program_deinit(struct drgn_program *prog);
 void drgn_program_set_platform(struct drgn_program *prog,
 			       const struct drgn_platform *platform);
 
+/**
+ * Get the thread pool of a @ref drgn_program, creating it if necessary.
+ *
+ * The pool has as many threads as allowed by @ref
+ * drgn_program_set_num_threads().
+ */
+struct drgn_error *drgn_program_thread_pool(struct drgn_program *prog,
+					    struct drgn_thread_pool **ret);
+
+/**
+ * Get the read engine of a @ref drgn_program, creating it if necessary.
+ *
+ * The core dump file (if any) is registered with the engine.
+ */
+struct drgn_error *drgn_program_read_engine(struct drgn_program *prog,
+					    struct drgn_read_engine **ret);
+
 /**
  * Implement @ref drgn_program_from_core_dump() on an initialized @ref
  * drgn_program.
@@ -258,6 +334,15 @@ drgn_program_word_size(struct drgn_program *prog, uint8_t *ret)
 	return NULL;
 }
 
+/**
+ * Return whether the memory of a @ref drgn_program may change at any time,
+ * i.e., it is live or it is the memory of a running virtual machine.
+ */
+static inline bool drgn_program_memory_may_change(struct drgn_program *prog)
+{
+	return (prog->flags & DRGN_PROGRAM_IS_LIVE) || prog->guest_memory;
+}
+
 struct drgn_error *drgn_program_get_dbinfo(struct drgn_program *prog,
 					   struct drgn_debug_info **ret);
 
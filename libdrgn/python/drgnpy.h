@@ -90,6 +90,23 @@ typedef struct {
 	struct pyobjectp_set objects;
 } Program;
 
+typedef struct {
+	PyObject_HEAD
+	Program *prog;
+	/* NULL once the map has been exhausted. */
+	struct linux_helper_bpf_map *map;
+	/* Entries read from the current batch and the next one to return. */
+	PyObject *batch;
+	Py_ssize_t i;
+} BpfMapIterator;
+
+typedef struct {
+	PyObject_HEAD
+	Program *prog;
+	struct linux_helper_ftrace *ftrace;
+	bool text;
+} FtraceEventIterator;
+
 typedef struct {
 	PyObject_HEAD
 	Program *prog;
@@ -142,17 +159,28 @@ typedef struct {
 	PyObject *name;
 } TypeParameter;
 
+typedef struct {
+	PyObject_HEAD
+	Program *prog;
+	struct drgn_watch *watch;
+	/* Tuple of the watched Objects, used to decode samples. */
+	PyObject *objects;
+} Watch;
+
 extern PyObject *Architecture_class;
 extern PyObject *FindObjectFlags_class;
+extern PyObject *IndexCategory_class;
 extern PyObject *PlatformFlags_class;
 extern PyObject *PrimitiveType_class;
 extern PyObject *ProgramFlags_class;
 extern PyObject *Qualifiers_class;
 extern PyObject *TypeKind_class;
 extern PyStructSequence_Desc Register_desc;
+extern PyTypeObject BpfMapIterator_type;
 extern PyTypeObject DrgnObject_type;
 extern PyTypeObject DrgnType_type;
 extern PyTypeObject FaultError_type;
+extern PyTypeObject FtraceEventIterator_type;
 extern PyTypeObject Language_type;
 extern PyTypeObject ObjectIterator_type;
 extern PyTypeObject Platform_type;
@@ -164,6 +192,7 @@ extern PyTypeObject Symbol_type;
 extern PyTypeObject TypeEnumerator_type;
 extern PyTypeObject TypeMember_type;
 extern PyTypeObject TypeParameter_type;
+extern PyTypeObject Watch_type;
 extern PyObject *MissingDebugInfoError;
 extern PyObject *OutOfBoundsError;
 
@@ -285,6 +314,35 @@ DrgnObject *drgnpy_linux_helper_pid_task(PyObject *self, PyObject *args,
 					 PyObject *kwds);
 DrgnObject *drgnpy_linux_helper_find_task(PyObject *self, PyObject *args,
 					  PyObject *kwds);
+PyObject *drgnpy_linux_helper_d_path(PyObject *self, PyObject *args,
+				     PyObject *kwds);
+PyObject *drgnpy_linux_helper_d_paths(PyObject *self, PyObject *args,
+				      PyObject *kwds);
+PyObject *drgnpy_linux_helper_dentry_path(PyObject *self, PyObject *args,
+					  PyObject *kwds);
+PyObject *drgnpy_linux_helper_find_open_files(PyObject *self, PyObject *args,
+					      PyObject *kwds);
+PyObject *drgnpy_linux_helper_bpf_map_items(PyObject *self, PyObject *args,
+					    PyObject *kwds);
+PyObject *drgnpy_linux_helper_ftrace_events(PyObject *self, PyObject *args,
+					    PyObject *kwds);
+PyObject *drgnpy_linux_helper_ftrace_write_trace_dat(PyObject *self,
+						     PyObject *args,
+						     PyObject *kwds);
+PyObject *drgnpy_linux_helper_wait_graph(PyObject *self, PyObject *args,
+					 PyObject *kwds);
+PyObject *drgnpy_linux_helper_runqueue_snapshot(PyObject *self, PyObject *args,
+						PyObject *kwds);
+PyObject *drgnpy_linux_helper_vmap_areas(PyObject *self, PyObject *args,
+					 PyObject *kwds);
+PyObject *drgnpy_linux_helper_timers(PyObject *self, PyObject *args,
+				     PyObject *kwds);
+PyObject *drgnpy_linux_helper_blk_mq_requests(PyObject *self, PyObject *args,
+					      PyObject *kwds);
+PyObject *drgnpy_linux_helper_page_usage(PyObject *self, PyObject *args,
+					 PyObject *kwds);
+PyObject *drgnpy_linux_helper_memcg_lru_sizes(PyObject *self, PyObject *args,
+					      PyObject *kwds);
 PyObject *drgnpy_linux_helper_task_state_to_char(PyObject *self, PyObject *args,
 						 PyObject *kwds);
 PyObject *drgnpy_linux_helper_kaslr_offset(PyObject *self, PyObject *args,
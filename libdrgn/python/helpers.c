@@ -2,8 +2,10 @@
 // SPDX-License-Identifier: GPL-3.0+
 
 #include "drgnpy.h"
+#include "../error.h"
 #include "../helpers.h"
 #include "../program.h"
+#include "../util.h"
 
 PyObject *drgnpy_linux_helper_read_vm(PyObject *self, PyObject *args,
 				      PyObject *kwds)
@@ -252,3 +254,1026 @@ PyObject *drgnpy_linux_helper_pgtable_l5_enabled(PyObject *self, PyObject *args,
 	else
 		Py_RETURN_FALSE;
 }
+
+static int object_unsigned_arg(DrgnObject *obj, uint64_t *ret)
+{
+	struct drgn_error *err = drgn_object_read_unsigned(&obj->obj, ret);
+	if (err) {
+		set_drgn_error(err);
+		return -1;
+	}
+	return 0;
+}
+
+PyObject *drgnpy_linux_helper_d_path(PyObject *self, PyObject *args,
+				     PyObject *kwds)
+{
+	static char *keywords[] = {"vfsmnt", "dentry", NULL};
+	struct drgn_error *err;
+	DrgnObject *vfsmnt, *dentry;
+	uint64_t vfsmnt_addr, dentry_addr;
+	const char *path;
+	size_t len;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O!:d_path", keywords,
+					 &DrgnObject_type, &vfsmnt,
+					 &DrgnObject_type, &dentry))
+		return NULL;
+
+	if (object_unsigned_arg(vfsmnt, &vfsmnt_addr) ||
+	    object_unsigned_arg(dentry, &dentry_addr))
+		return NULL;
+	err = linux_helper_d_path(&DrgnObject_prog(dentry)->prog, vfsmnt_addr,
+				  dentry_addr, &path, &len);
+	if (err)
+		return set_drgn_error(err);
+	return PyBytes_FromStringAndSize(path, len);
+}
+
+/* Get the mount and dentry from a struct path or struct path *. */
+static int path_arg(DrgnObject *path, struct drgn_object *tmp,
+		    uint64_t *vfsmnt_ret, uint64_t *dentry_ret)
+{
+	struct drgn_error *err;
+	bool is_pointer = (drgn_type_kind(drgn_underlying_type(path->obj.type))
+			   == DRGN_TYPE_POINTER);
+	if (is_pointer)
+		err = drgn_object_member_dereference(tmp, &path->obj, "mnt");
+	else
+		err = drgn_object_member(tmp, &path->obj, "mnt");
+	if (!err)
+		err = drgn_object_read_unsigned(tmp, vfsmnt_ret);
+	if (err)
+		goto err;
+	if (is_pointer)
+		err = drgn_object_member_dereference(tmp, &path->obj, "dentry");
+	else
+		err = drgn_object_member(tmp, &path->obj, "dentry");
+	if (!err)
+		err = drgn_object_read_unsigned(tmp, dentry_ret);
+	if (err)
+		goto err;
+	return 0;
+
+err:
+	set_drgn_error(err);
+	return -1;
+}
+
+static struct drgn_error *d_paths_append(size_t i, const char *path, size_t len,
+					 void *arg)
+{
+	PyObject *bytes = PyBytes_FromStringAndSize(path, len);
+	if (!bytes)
+		return drgn_error_from_python();
+	PyList_SET_ITEM((PyObject *)arg, i, bytes);
+	return NULL;
+}
+
+PyObject *drgnpy_linux_helper_d_paths(PyObject *self, PyObject *args,
+				      PyObject *kwds)
+{
+	static char *keywords[] = {"paths", NULL};
+	struct drgn_error *err;
+	PyObject *paths_obj;
+	PyObject *ret = NULL;
+	Program *prog = NULL;
+	struct drgn_object tmp;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O:d_paths", keywords,
+					 &paths_obj))
+		return NULL;
+
+	PyObject *paths = PySequence_Fast(paths_obj, "paths must be iterable");
+	if (!paths)
+		return NULL;
+	Py_ssize_t n = PySequence_Fast_GET_SIZE(paths);
+	if (n == 0) {
+		ret = PyList_New(0);
+		goto out_paths;
+	}
+
+	uint64_t *vfsmnts = malloc_array(n, sizeof(*vfsmnts));
+	uint64_t *dentries = malloc_array(n, sizeof(*dentries));
+	if (!vfsmnts || !dentries) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (Py_ssize_t i = 0; i < n; i++) {
+		PyObject *item = PySequence_Fast_GET_ITEM(paths, i);
+		if (!PyObject_TypeCheck(item, &DrgnObject_type)) {
+			PyErr_Format(PyExc_TypeError, "expected Object, not %s",
+				     Py_TYPE(item)->tp_name);
+			goto out_tmp;
+		}
+		if (!prog) {
+			prog = DrgnObject_prog((DrgnObject *)item);
+			drgn_object_init(&tmp, &prog->prog);
+		} else if (DrgnObject_prog((DrgnObject *)item) != prog) {
+			PyErr_SetString(PyExc_ValueError,
+					"paths are from different programs");
+			goto out_tmp;
+		}
+		if (path_arg((DrgnObject *)item, &tmp, &vfsmnts[i],
+			     &dentries[i]))
+			goto out_tmp;
+	}
+
+	ret = PyList_New(n);
+	if (!ret)
+		goto out_tmp;
+	err = linux_helper_d_paths(&prog->prog, vfsmnts, dentries, n,
+				   d_paths_append, ret);
+	if (err) {
+		Py_CLEAR(ret);
+		set_drgn_error(err);
+	}
+out_tmp:
+	if (prog)
+		drgn_object_deinit(&tmp);
+out:
+	free(dentries);
+	free(vfsmnts);
+out_paths:
+	Py_DECREF(paths);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_dentry_path(PyObject *self, PyObject *args,
+					  PyObject *kwds)
+{
+	static char *keywords[] = {"dentry", NULL};
+	struct drgn_error *err;
+	DrgnObject *dentry;
+	uint64_t dentry_addr;
+	const char *path;
+	size_t len;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!:dentry_path",
+					 keywords, &DrgnObject_type, &dentry))
+		return NULL;
+
+	if (object_unsigned_arg(dentry, &dentry_addr))
+		return NULL;
+	err = linux_helper_dentry_path(&DrgnObject_prog(dentry)->prog,
+				       dentry_addr, &path, &len);
+	if (err)
+		return set_drgn_error(err);
+	return PyBytes_FromStringAndSize(path, len);
+}
+
+struct find_open_files_arg {
+	Program *prog;
+	struct drgn_qualified_type task_type;
+	struct drgn_qualified_type file_type;
+	PyObject *list;
+};
+
+static struct drgn_error *find_open_files_append(uint64_t task, uint64_t fd,
+						 uint64_t file, void *arg)
+{
+	struct find_open_files_arg *find_arg = arg;
+	struct drgn_error *err;
+	DrgnObject *task_obj = NULL, *file_obj = NULL;
+	PyObject *item = NULL;
+
+	task_obj = DrgnObject_alloc(find_arg->prog);
+	if (!task_obj)
+		goto err;
+	err = drgn_object_set_unsigned(&task_obj->obj, find_arg->task_type,
+				       task, 0);
+	if (err)
+		goto out;
+	file_obj = DrgnObject_alloc(find_arg->prog);
+	if (!file_obj)
+		goto err;
+	err = drgn_object_set_unsigned(&file_obj->obj, find_arg->file_type,
+				       file, 0);
+	if (err)
+		goto out;
+	item = Py_BuildValue("OKO", task_obj, (unsigned long long)fd,
+			     file_obj);
+	if (!item || PyList_Append(find_arg->list, item))
+		goto err;
+	err = NULL;
+out:
+	Py_XDECREF(item);
+	Py_XDECREF(file_obj);
+	Py_XDECREF(task_obj);
+	return err;
+
+err:
+	err = drgn_error_from_python();
+	goto out;
+}
+
+PyObject *drgnpy_linux_helper_find_open_files(PyObject *self, PyObject *args,
+					      PyObject *kwds)
+{
+	static char *keywords[] = {
+		"prog", "tasks", "inode", "super_block", "f_op", NULL,
+	};
+	struct drgn_error *err;
+	struct find_open_files_arg arg = {};
+	PyObject *tasks_obj = Py_None;
+	struct index_arg inode = { .allow_none = true };
+	struct index_arg super_block = { .allow_none = true };
+	struct index_arg f_op = { .allow_none = true };
+	PyObject *tasks = NULL;
+	uint64_t *task_addrs = NULL;
+	size_t num_tasks = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds,
+					 "O!|O$O&O&O&:find_open_files",
+					 keywords, &Program_type, &arg.prog,
+					 &tasks_obj, index_converter, &inode,
+					 index_converter, &super_block,
+					 index_converter, &f_op))
+		return NULL;
+
+	if (tasks_obj != Py_None) {
+		tasks = PySequence_Fast(tasks_obj, "tasks must be iterable");
+		if (!tasks)
+			return NULL;
+		num_tasks = PySequence_Fast_GET_SIZE(tasks);
+		if (num_tasks == 0) {
+			arg.list = PyList_New(0);
+			goto out;
+		}
+		task_addrs = malloc_array(num_tasks, sizeof(*task_addrs));
+		if (!task_addrs) {
+			PyErr_NoMemory();
+			goto out;
+		}
+		for (size_t i = 0; i < num_tasks; i++) {
+			struct index_arg task = {};
+			if (!index_converter(PySequence_Fast_GET_ITEM(tasks, i),
+					     &task))
+				goto out;
+			task_addrs[i] = task.uvalue;
+		}
+	}
+
+	err = drgn_program_find_type(&arg.prog->prog, "struct task_struct *",
+				     NULL, &arg.task_type);
+	if (!err) {
+		err = drgn_program_find_type(&arg.prog->prog, "struct file *",
+					     NULL, &arg.file_type);
+	}
+	if (err) {
+		set_drgn_error(err);
+		goto out;
+	}
+
+	arg.list = PyList_New(0);
+	if (!arg.list)
+		goto out;
+	struct linux_helper_file_filter filter = {
+		.inode = inode.is_none ? 0 : inode.uvalue,
+		.super_block = super_block.is_none ? 0 : super_block.uvalue,
+		.f_op = f_op.is_none ? 0 : f_op.uvalue,
+	};
+	err = linux_helper_for_each_task_file(&arg.prog->prog, task_addrs,
+					      num_tasks, &filter,
+					      find_open_files_append, &arg);
+	if (err) {
+		Py_CLEAR(arg.list);
+		set_drgn_error(err);
+	}
+out:
+	free(task_addrs);
+	Py_XDECREF(tasks);
+	return arg.list;
+}
+
+static struct drgn_error *bpf_map_read_append(const void *key,
+					      size_t key_size,
+					      const void *value,
+					      size_t value_size, void *arg)
+{
+	PyObject *item = Py_BuildValue("y#y#", key, (Py_ssize_t)key_size,
+				       value, (Py_ssize_t)value_size);
+	if (!item)
+		return drgn_error_from_python();
+	int ret = PyList_Append((PyObject *)arg, item);
+	Py_DECREF(item);
+	if (ret)
+		return drgn_error_from_python();
+	return NULL;
+}
+
+/* Number of buckets or indices read into each batch. */
+#define BPF_MAP_BATCH_SIZE 65536
+
+PyObject *drgnpy_linux_helper_bpf_map_items(PyObject *self, PyObject *args,
+					    PyObject *kwds)
+{
+	static char *keywords[] = {"map", "sum_percpu", NULL};
+	struct drgn_error *err;
+	DrgnObject *map;
+	struct index_arg sum_percpu = {};
+	uint64_t map_addr;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|$O&:bpf_map_items",
+					 keywords, &DrgnObject_type, &map,
+					 index_converter, &sum_percpu))
+		return NULL;
+	if (sum_percpu.uvalue > UINT_MAX) {
+		PyErr_SetString(PyExc_ValueError,
+				"per-CPU sum size must be 1, 2, 4, or 8");
+		return NULL;
+	}
+	if (object_unsigned_arg(map, &map_addr))
+		return NULL;
+
+	PyTypeObject *type = &BpfMapIterator_type;
+	BpfMapIterator *it = (BpfMapIterator *)type->tp_alloc(type, 0);
+	if (!it)
+		return NULL;
+	err = linux_helper_bpf_map_create(&DrgnObject_prog(map)->prog,
+					  map_addr, sum_percpu.uvalue,
+					  &it->map);
+	if (err) {
+		Py_DECREF(it);
+		return set_drgn_error(err);
+	}
+	it->prog = DrgnObject_prog(map);
+	Py_INCREF(it->prog);
+	return (PyObject *)it;
+}
+
+static void BpfMapIterator_dealloc(BpfMapIterator *self)
+{
+	linux_helper_bpf_map_destroy(self->map);
+	Py_XDECREF(self->batch);
+	Py_XDECREF(self->prog);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *BpfMapIterator_next(BpfMapIterator *self)
+{
+	struct drgn_error *err;
+
+	while (!self->batch || self->i >= PyList_GET_SIZE(self->batch)) {
+		Py_CLEAR(self->batch);
+		if (!self->map)
+			return NULL;
+		self->batch = PyList_New(0);
+		if (!self->batch)
+			return NULL;
+		self->i = 0;
+		err = linux_helper_bpf_map_read(self->map, BPF_MAP_BATCH_SIZE,
+						bpf_map_read_append,
+						self->batch);
+		if (err == &drgn_stop) {
+			linux_helper_bpf_map_destroy(self->map);
+			self->map = NULL;
+		} else if (err) {
+			return set_drgn_error(err);
+		}
+	}
+	PyObject *item = PyList_GET_ITEM(self->batch, self->i++);
+	Py_INCREF(item);
+	return item;
+}
+
+PyTypeObject BpfMapIterator_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "_drgn._BpfMapIterator",
+	.tp_basicsize = sizeof(BpfMapIterator),
+	.tp_dealloc = (destructor)BpfMapIterator_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_iter = PyObject_SelfIter,
+	.tp_iternext = (iternextfunc)BpfMapIterator_next,
+};
+
+static int trace_array_arg(PyObject *o, uint64_t *ret)
+{
+	if (o == Py_None) {
+		*ret = 0;
+		return 0;
+	}
+	if (!PyObject_TypeCheck(o, &DrgnObject_type)) {
+		PyErr_Format(PyExc_TypeError,
+			     "expected Object or None, not %s",
+			     Py_TYPE(o)->tp_name);
+		return -1;
+	}
+	return object_unsigned_arg((DrgnObject *)o, ret);
+}
+
+PyObject *drgnpy_linux_helper_ftrace_events(PyObject *self, PyObject *args,
+					    PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "trace_array", "text", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *trace_array_obj = Py_None;
+	int text = 0;
+	uint64_t trace_array;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|O$p:ftrace_events",
+					 keywords, &Program_type, &prog,
+					 &trace_array_obj, &text))
+		return NULL;
+	if (trace_array_arg(trace_array_obj, &trace_array))
+		return NULL;
+
+	PyTypeObject *type = &FtraceEventIterator_type;
+	FtraceEventIterator *it = (FtraceEventIterator *)type->tp_alloc(type,
+									0);
+	if (!it)
+		return NULL;
+	err = linux_helper_ftrace_create(&prog->prog, trace_array,
+					 &it->ftrace);
+	if (err) {
+		Py_DECREF(it);
+		return set_drgn_error(err);
+	}
+	Py_INCREF(prog);
+	it->prog = prog;
+	it->text = text;
+	return (PyObject *)it;
+}
+
+static void FtraceEventIterator_dealloc(FtraceEventIterator *self)
+{
+	linux_helper_ftrace_destroy(self->ftrace);
+	Py_XDECREF(self->prog);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *FtraceEventIterator_next(FtraceEventIterator *self)
+{
+	struct drgn_error *err;
+	const struct linux_helper_ftrace_event *event;
+
+	err = linux_helper_ftrace_next(self->ftrace, &event);
+	if (err == &drgn_stop)
+		return NULL;
+	if (err)
+		return set_drgn_error(err);
+	if (self->text) {
+		const char *line;
+		size_t len;
+		err = linux_helper_ftrace_format(self->ftrace, event, &line,
+						 &len);
+		if (err)
+			return set_drgn_error(err);
+		return PyUnicode_DecodeUTF8(line, len, "replace");
+	}
+	return Py_BuildValue("KKzy#", (unsigned long long)event->cpu,
+			     (unsigned long long)event->timestamp, event->name,
+			     event->data, (Py_ssize_t)event->size);
+}
+
+PyTypeObject FtraceEventIterator_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "_drgn._FtraceEventIterator",
+	.tp_basicsize = sizeof(FtraceEventIterator),
+	.tp_dealloc = (destructor)FtraceEventIterator_dealloc,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_iter = PyObject_SelfIter,
+	.tp_iternext = (iternextfunc)FtraceEventIterator_next,
+};
+
+static struct drgn_error *ftrace_write_file(const void *buf, size_t count,
+					    void *arg)
+{
+	PyObject *ret = PyObject_CallMethod((PyObject *)arg, "write", "y#",
+					    buf, (Py_ssize_t)count);
+	if (!ret)
+		return drgn_error_from_python();
+	Py_DECREF(ret);
+	return NULL;
+}
+
+PyObject *drgnpy_linux_helper_ftrace_write_trace_dat(PyObject *self,
+						     PyObject *args,
+						     PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "file", "trace_array", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *file;
+	PyObject *trace_array_obj = Py_None;
+	uint64_t trace_array;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds,
+					 "O!O|O:ftrace_write_trace_dat",
+					 keywords, &Program_type, &prog, &file,
+					 &trace_array_obj))
+		return NULL;
+	if (trace_array_arg(trace_array_obj, &trace_array))
+		return NULL;
+
+	struct linux_helper_ftrace *ftrace;
+	err = linux_helper_ftrace_create(&prog->prog, trace_array, &ftrace);
+	if (err)
+		return set_drgn_error(err);
+	err = linux_helper_ftrace_write_trace_dat(ftrace, ftrace_write_file,
+						  file);
+	linux_helper_ftrace_destroy(ftrace);
+	if (err)
+		return set_drgn_error(err);
+	Py_RETURN_NONE;
+}
+
+static PyObject *blocked_task_tuple(Program *prog,
+				    struct linux_helper_blocked_task *blocked)
+{
+	static const char * const kind_names[] = {
+		[LINUX_HELPER_LOCK_MUTEX] = "mutex",
+		[LINUX_HELPER_LOCK_RWSEM] = "rwsem",
+		[LINUX_HELPER_LOCK_COMPLETION] = "completion",
+	};
+	PyObject *trace, *frame, *owner_index;
+
+	if (blocked->trace) {
+		StackTrace *ret =
+			(StackTrace *)StackTrace_type.tp_alloc(&StackTrace_type,
+							       0);
+		if (!ret)
+			return NULL;
+		/* The stack trace is now owned by the Python object. */
+		ret->trace = blocked->trace;
+		blocked->trace = NULL;
+		ret->prog = prog;
+		Py_INCREF(prog);
+		trace = (PyObject *)ret;
+	} else {
+		Py_INCREF(Py_None);
+		trace = Py_None;
+	}
+	if (blocked->frame == SIZE_MAX) {
+		Py_INCREF(Py_None);
+		frame = Py_None;
+	} else {
+		frame = PyLong_FromSize_t(blocked->frame);
+	}
+	if (blocked->owner_index == SIZE_MAX) {
+		Py_INCREF(Py_None);
+		owner_index = Py_None;
+	} else {
+		owner_index = PyLong_FromSize_t(blocked->owner_index);
+	}
+	if (!frame || !owner_index) {
+		Py_DECREF(trace);
+		Py_XDECREF(frame);
+		Py_XDECREF(owner_index);
+		return NULL;
+	}
+	return Py_BuildValue("KNNzKKNnO", (unsigned long long)blocked->task,
+			     trace, frame, kind_names[blocked->kind],
+			     (unsigned long long)blocked->lock,
+			     (unsigned long long)blocked->owner, owner_index,
+			     (Py_ssize_t)blocked->chain_length,
+			     blocked->in_cycle ? Py_True : Py_False);
+}
+
+PyObject *drgnpy_linux_helper_wait_graph(PyObject *self, PyObject *args,
+					 PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "state_mask", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	struct index_arg state_mask = {};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O&:wait_graph",
+					 keywords, &Program_type, &prog,
+					 index_converter, &state_mask))
+		return NULL;
+
+	struct linux_helper_wait_graph *graph;
+	err = linux_helper_wait_graph_create(&prog->prog, state_mask.uvalue,
+					     &graph);
+	if (err)
+		return set_drgn_error(err);
+	PyObject *list = PyList_New(graph->num_tasks);
+	if (!list)
+		goto out;
+	for (size_t i = 0; i < graph->num_tasks; i++) {
+		PyObject *item = blocked_task_tuple(prog, &graph->tasks[i]);
+		if (!item) {
+			Py_CLEAR(list);
+			goto out;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+out:
+	linux_helper_wait_graph_destroy(graph);
+	return list;
+}
+
+PyObject *drgnpy_linux_helper_runqueue_snapshot(PyObject *self, PyObject *args,
+						PyObject *kwds)
+{
+	static char *keywords[] = {"prog", NULL};
+	static const char * const queue_names[] = {
+		[LINUX_HELPER_RQ_CURRENT] = "current",
+		[LINUX_HELPER_RQ_DEADLINE] = "dl",
+		[LINUX_HELPER_RQ_RT] = "rt",
+		[LINUX_HELPER_RQ_FAIR] = "fair",
+	};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *cpus = NULL, *tasks = NULL, *ret = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!:runqueue_snapshot",
+					 keywords, &Program_type, &prog))
+		return NULL;
+
+	struct linux_helper_rq_snapshot *snapshot;
+	err = linux_helper_rq_snapshot_create(&prog->prog, &snapshot);
+	if (err)
+		return set_drgn_error(err);
+
+	cpus = PyList_New(snapshot->num_cpus);
+	if (!cpus)
+		goto out;
+	for (size_t i = 0; i < snapshot->num_cpus; i++) {
+		struct linux_helper_rq_cpu *cpu = &snapshot->cpus[i];
+		PyObject *item = Py_BuildValue("KKKKKKK",
+					       (unsigned long long)cpu->cpu,
+					       (unsigned long long)cpu->rq,
+					       (unsigned long long)cpu->curr,
+					       (unsigned long long)cpu->clock,
+					       (unsigned long long)cpu->clock_task,
+					       (unsigned long long)cpu->nr_running,
+					       (unsigned long long)cpu->min_vruntime);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(cpus, i, item);
+	}
+	tasks = PyList_New(snapshot->num_tasks);
+	if (!tasks)
+		goto out;
+	for (size_t i = 0; i < snapshot->num_tasks; i++) {
+		struct linux_helper_rq_task *task = &snapshot->tasks[i];
+		PyObject *item = Py_BuildValue("KKsIiKKK",
+					       (unsigned long long)task->cpu,
+					       (unsigned long long)task->task,
+					       queue_names[task->queue],
+					       (unsigned int)task->policy,
+					       (int)task->prio,
+					       (unsigned long long)task->vruntime,
+					       (unsigned long long)task->deadline,
+					       (unsigned long long)task->sum_exec_runtime);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(tasks, i, item);
+	}
+	ret = PyTuple_Pack(2, cpus, tasks);
+out:
+	Py_XDECREF(tasks);
+	Py_XDECREF(cpus);
+	linux_helper_rq_snapshot_destroy(snapshot);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_vmap_areas(PyObject *self, PyObject *args,
+					 PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "validate", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	int validate = 0;
+	PyObject *areas = NULL, *callers = NULL, *ret = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!|p:vmap_areas",
+					 keywords, &Program_type, &prog,
+					 &validate))
+		return NULL;
+
+	struct linux_helper_vmap_areas *result;
+	err = linux_helper_vmap_areas_create(&prog->prog, validate, &result);
+	if (err)
+		return set_drgn_error(err);
+
+	areas = PyList_New(result->num_areas);
+	if (!areas)
+		goto out;
+	for (size_t i = 0; i < result->num_areas; i++) {
+		struct linux_helper_vmap_area *area = &result->areas[i];
+		PyObject *item = Py_BuildValue("KKKKKKKK",
+					       (unsigned long long)area->va,
+					       (unsigned long long)area->start,
+					       (unsigned long long)area->size,
+					       (unsigned long long)area->vm,
+					       (unsigned long long)area->flags,
+					       (unsigned long long)area->caller,
+					       (unsigned long long)area->nr_pages,
+					       (unsigned long long)area->mapped_pages);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(areas, i, item);
+	}
+	callers = PyList_New(result->num_callers);
+	if (!callers)
+		goto out;
+	for (size_t i = 0; i < result->num_callers; i++) {
+		struct linux_helper_vmap_caller *caller = &result->callers[i];
+		PyObject *item = Py_BuildValue("KnKKK",
+					       (unsigned long long)caller->caller,
+					       (Py_ssize_t)caller->count,
+					       (unsigned long long)caller->size,
+					       (unsigned long long)caller->nr_pages,
+					       (unsigned long long)caller->mapped_pages);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(callers, i, item);
+	}
+	ret = PyTuple_Pack(2, areas, callers);
+out:
+	Py_XDECREF(callers);
+	Py_XDECREF(areas);
+	linux_helper_vmap_areas_destroy(result);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_timers(PyObject *self, PyObject *args,
+				     PyObject *kwds)
+{
+	static char *keywords[] = {"prog", NULL};
+	static const char * const kind_names[] = {
+		[LINUX_HELPER_TIMER_WHEEL] = "timer",
+		[LINUX_HELPER_TIMER_HRTIMER] = "hrtimer",
+	};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *timers = NULL, *callbacks = NULL, *ret = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!:timers", keywords,
+					 &Program_type, &prog))
+		return NULL;
+
+	struct linux_helper_timers *result;
+	err = linux_helper_timers_create(&prog->prog, &result);
+	if (err)
+		return set_drgn_error(err);
+
+	timers = PyList_New(result->num_timers);
+	if (!timers)
+		goto out;
+	for (size_t i = 0; i < result->num_timers; i++) {
+		struct linux_helper_timer *timer = &result->timers[i];
+		PyObject *item = Py_BuildValue("KsIKKK",
+					       (unsigned long long)timer->cpu,
+					       kind_names[timer->kind],
+					       (unsigned int)timer->base,
+					       (unsigned long long)timer->timer,
+					       (unsigned long long)timer->expires,
+					       (unsigned long long)timer->function);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(timers, i, item);
+	}
+	callbacks = PyList_New(result->num_callbacks);
+	if (!callbacks)
+		goto out;
+	for (size_t i = 0; i < result->num_callbacks; i++) {
+		struct linux_helper_timer_callback *callback =
+			&result->callbacks[i];
+		PyObject *item = Py_BuildValue("Knn",
+					       (unsigned long long)callback->function,
+					       (Py_ssize_t)callback->num_timers,
+					       (Py_ssize_t)callback->num_hrtimers);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(callbacks, i, item);
+	}
+	ret = PyTuple_Pack(2, timers, callbacks);
+out:
+	Py_XDECREF(callbacks);
+	Py_XDECREF(timers);
+	linux_helper_timers_destroy(result);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_blk_mq_requests(PyObject *self, PyObject *args,
+					      PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "queues", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *queues_obj, *queues, *ret = NULL;
+	uint64_t *queue_addrs = NULL;
+	struct linux_helper_blk_mq_requests *result = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O:blk_mq_requests",
+					 keywords, &Program_type, &prog,
+					 &queues_obj))
+		return NULL;
+
+	queues = PySequence_Fast(queues_obj, "queues must be iterable");
+	if (!queues)
+		return NULL;
+	size_t num_queues = PySequence_Fast_GET_SIZE(queues);
+	queue_addrs = malloc_array(num_queues ? num_queues : 1,
+				   sizeof(*queue_addrs));
+	if (!queue_addrs) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (size_t i = 0; i < num_queues; i++) {
+		struct index_arg queue = {};
+		if (!index_converter(PySequence_Fast_GET_ITEM(queues, i),
+				     &queue))
+			goto out;
+		queue_addrs[i] = queue.uvalue;
+	}
+
+	err = linux_helper_blk_mq_requests_create(&prog->prog, queue_addrs,
+						  num_queues, &result);
+	if (err) {
+		set_drgn_error(err);
+		goto out;
+	}
+
+	PyObject *list = PyList_New(result->num_requests);
+	if (!list)
+		goto out;
+	for (size_t i = 0; i < result->num_requests; i++) {
+		struct linux_helper_blk_mq_request *request =
+			&result->requests[i];
+		PyObject *state;
+		if (request->state == UINT32_MAX) {
+			state = Py_None;
+			Py_INCREF(state);
+		} else {
+			state = PyLong_FromUnsignedLong(request->state);
+			if (!state) {
+				Py_DECREF(list);
+				goto out;
+			}
+		}
+		PyObject *item = Py_BuildValue("nKIKiiIKKKKN",
+					       (Py_ssize_t)request->queue,
+					       (unsigned long long)request->hctx,
+					       (unsigned int)request->hctx_index,
+					       (unsigned long long)request->rq,
+					       (int)request->tag,
+					       (int)request->internal_tag,
+					       (unsigned int)request->op,
+					       (unsigned long long)request->cmd_flags,
+					       (unsigned long long)request->sector,
+					       (unsigned long long)request->size,
+					       (unsigned long long)request->start_time_ns,
+					       state);
+		if (!item) {
+			Py_DECREF(list);
+			goto out;
+		}
+		PyList_SET_ITEM(list, i, item);
+	}
+	ret = list;
+out:
+	linux_helper_blk_mq_requests_destroy(result);
+	free(queue_addrs);
+	Py_DECREF(queues);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_page_usage(PyObject *self, PyObject *args,
+					 PyObject *kwds)
+{
+	static char *keywords[] = {
+		"prog", "vmemmap", "start_pfn", "end_pfn", "max_inodes", NULL,
+	};
+	struct drgn_error *err;
+	Program *prog;
+	struct index_arg vmemmap = {}, start_pfn = {}, end_pfn = {};
+	struct index_arg max_inodes = {};
+	PyObject *memcgs = NULL, *inodes = NULL, *ret = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O&O&O&O&:page_usage",
+					 keywords, &Program_type, &prog,
+					 index_converter, &vmemmap,
+					 index_converter, &start_pfn,
+					 index_converter, &end_pfn,
+					 index_converter, &max_inodes))
+		return NULL;
+
+	struct linux_helper_page_usage *usage;
+	err = linux_helper_page_usage_create(&prog->prog, vmemmap.uvalue,
+					     start_pfn.uvalue, end_pfn.uvalue,
+					     max_inodes.uvalue, &usage);
+	if (err)
+		return set_drgn_error(err);
+
+	memcgs = PyList_New(usage->num_memcgs);
+	if (!memcgs)
+		goto out;
+	for (size_t i = 0; i < usage->num_memcgs; i++) {
+		struct linux_helper_memcg_usage *memcg = &usage->memcgs[i];
+		PyObject *item = Py_BuildValue("KKKKK",
+					       (unsigned long long)memcg->memcg,
+					       (unsigned long long)memcg->pages[LINUX_HELPER_PAGE_ANON],
+					       (unsigned long long)memcg->pages[LINUX_HELPER_PAGE_FILE],
+					       (unsigned long long)memcg->pages[LINUX_HELPER_PAGE_SLAB],
+					       (unsigned long long)memcg->pages[LINUX_HELPER_PAGE_UNEVICTABLE]);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(memcgs, i, item);
+	}
+	inodes = PyList_New(usage->num_inodes);
+	if (!inodes)
+		goto out;
+	for (size_t i = 0; i < usage->num_inodes; i++) {
+		struct linux_helper_memcg_inode *inode = &usage->inodes[i];
+		PyObject *item = Py_BuildValue("nKK", (Py_ssize_t)inode->memcg,
+					       (unsigned long long)inode->inode,
+					       (unsigned long long)inode->pages);
+		if (!item)
+			goto out;
+		PyList_SET_ITEM(inodes, i, item);
+	}
+	ret = PyTuple_Pack(2, memcgs, inodes);
+out:
+	Py_XDECREF(inodes);
+	Py_XDECREF(memcgs);
+	linux_helper_page_usage_destroy(usage);
+	return ret;
+}
+
+PyObject *drgnpy_linux_helper_memcg_lru_sizes(PyObject *self, PyObject *args,
+					      PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "memcgs", "num_nodes", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *memcgs_obj, *memcgs, *ret = NULL;
+	struct index_arg num_nodes = {};
+	uint64_t *memcg_addrs = NULL, *sizes = NULL;
+	size_t num_lrus;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!OO&:memcg_lru_sizes",
+					 keywords, &Program_type, &prog,
+					 &memcgs_obj, index_converter,
+					 &num_nodes))
+		return NULL;
+
+	memcgs = PySequence_Fast(memcgs_obj, "memcgs must be iterable");
+	if (!memcgs)
+		return NULL;
+	size_t num_memcgs = PySequence_Fast_GET_SIZE(memcgs);
+	memcg_addrs = malloc_array(num_memcgs ? num_memcgs : 1,
+				   sizeof(*memcg_addrs));
+	if (!memcg_addrs) {
+		PyErr_NoMemory();
+		goto out;
+	}
+	for (size_t i = 0; i < num_memcgs; i++) {
+		struct index_arg memcg = {};
+		if (!index_converter(PySequence_Fast_GET_ITEM(memcgs, i),
+				     &memcg))
+			goto out;
+		memcg_addrs[i] = memcg.uvalue;
+	}
+
+	err = linux_helper_memcg_lru_sizes(&prog->prog, memcg_addrs,
+					   num_memcgs, num_nodes.uvalue,
+					   &sizes, &num_lrus);
+	if (err) {
+		set_drgn_error(err);
+		goto out;
+	}
+
+	/* List of lists of tuples indexed by memcg, node, and LRU. */
+	PyObject *list = PyList_New(num_memcgs);
+	if (!list)
+		goto out;
+	for (size_t i = 0; i < num_memcgs; i++) {
+		PyObject *nodes = PyList_New(num_nodes.uvalue);
+		if (!nodes) {
+			Py_DECREF(list);
+			goto out;
+		}
+		PyList_SET_ITEM(list, i, nodes);
+		for (uint64_t node = 0; node < num_nodes.uvalue; node++) {
+			const uint64_t *node_sizes =
+				&sizes[(i * num_nodes.uvalue + node) * num_lrus];
+			PyObject *tuple = PyTuple_New(num_lrus);
+			if (!tuple) {
+				Py_DECREF(list);
+				goto out;
+			}
+			PyList_SET_ITEM(nodes, node, tuple);
+			for (size_t lru = 0; lru < num_lrus; lru++) {
+				PyObject *size =
+					PyLong_FromUnsignedLongLong(node_sizes[lru]);
+				if (!size) {
+					Py_DECREF(list);
+					goto out;
+				}
+				PyTuple_SET_ITEM(tuple, lru, size);
+			}
+		}
+	}
+	ret = list;
+out:
+	free(sizes);
+	free(memcg_addrs);
+	Py_DECREF(memcgs);
+	return ret;
+}
@@ -102,6 +102,44 @@ static PyMethodDef drgn_methods[] = {
 	 METH_VARARGS | METH_KEYWORDS},
 	{"_linux_helper_find_task", (PyCFunction)drgnpy_linux_helper_find_task,
 	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_d_path", (PyCFunction)drgnpy_linux_helper_d_path,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_d_paths", (PyCFunction)drgnpy_linux_helper_d_paths,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_dentry_path",
+	 (PyCFunction)drgnpy_linux_helper_dentry_path,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_find_open_files",
+	 (PyCFunction)drgnpy_linux_helper_find_open_files,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_bpf_map_items",
+	 (PyCFunction)drgnpy_linux_helper_bpf_map_items,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_ftrace_events",
+	 (PyCFunction)drgnpy_linux_helper_ftrace_events,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_ftrace_write_trace_dat",
+	 (PyCFunction)drgnpy_linux_helper_ftrace_write_trace_dat,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_wait_graph",
+	 (PyCFunction)drgnpy_linux_helper_wait_graph,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_runqueue_snapshot",
+	 (PyCFunction)drgnpy_linux_helper_runqueue_snapshot,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_vmap_areas",
+	 (PyCFunction)drgnpy_linux_helper_vmap_areas,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_timers", (PyCFunction)drgnpy_linux_helper_timers,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_blk_mq_requests",
+	 (PyCFunction)drgnpy_linux_helper_blk_mq_requests,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_page_usage", (PyCFunction)drgnpy_linux_helper_page_usage,
+	 METH_VARARGS | METH_KEYWORDS},
+	{"_linux_helper_memcg_lru_sizes",
+	 (PyCFunction)drgnpy_linux_helper_memcg_lru_sizes,
+	 METH_VARARGS | METH_KEYWORDS},
 	{"_linux_helper_kaslr_offset",
 	 (PyCFunction)drgnpy_linux_helper_kaslr_offset,
 	 METH_VARARGS | METH_KEYWORDS},
@@ -183,6 +221,7 @@ DRGNPY_PUBLIC PyMODINIT_FUNC PyInit__drgn(void)
 {
 	PyObject *m;
 	PyObject *host_platform_obj;
+	PyObject *with_libcurl;
 	PyObject *with_libkdumpfile;
 
 	m = PyModule_Create(&drgnmodule);
@@ -231,6 +270,12 @@ DRGNPY_PUBLIC PyMODINIT_FUNC PyInit__drgn(void)
 	if (PyType_Ready(&ObjectIterator_type) < 0)
 		goto err;
 
+	if (PyType_Ready(&BpfMapIterator_type) < 0)
+		goto err;
+
+	if (PyType_Ready(&FtraceEventIterator_type) < 0)
+		goto err;
+
 	if (PyType_Ready(&Platform_type) < 0)
 		goto err;
 	Py_INCREF(&Platform_type);
@@ -277,11 +322,24 @@ DRGNPY_PUBLIC PyMODINIT_FUNC PyInit__drgn(void)
 	Py_INCREF(&TypeParameter_type);
 	PyModule_AddObject(m, "TypeParameter", (PyObject *)&TypeParameter_type);
 
+	if (PyType_Ready(&Watch_type) < 0)
+		goto err;
+	Py_INCREF(&Watch_type);
+	PyModule_AddObject(m, "Watch", (PyObject *)&Watch_type);
+
 	host_platform_obj = Platform_wrap(&drgn_host_platform);
 	if (!host_platform_obj)
 		goto err;
 	PyModule_AddObject(m, "host_platform", host_platform_obj);
 
+#ifdef WITH_LIBCURL
+	with_libcurl = Py_True;
+#else
+	with_libcurl = Py_False;
+#endif
+	Py_INCREF(with_libcurl);
+	PyModule_AddObject(m, "_with_libcurl", with_libcurl);
+
 #ifdef WITH_LIBKDUMPFILE
 	with_libkdumpfile = Py_True;
 #else
@@ -427,20 +427,68 @@ static PyObject *Program_set_pid(Program *self, PyObject *args, PyObject *kwds)
 	Py_RETURN_NONE;
 }
 
+static PyObject *Program_set_guest_memory(Program *self, PyObject *args,
+					  PyObject *kwds)
+{
+	static char *keywords[] = {"path", "pgtable", "low_ram_size", NULL};
+	struct drgn_error *err;
+	struct path_arg path = {};
+	struct index_arg pgtable = { .allow_none = true };
+	struct index_arg low_ram_size = { .allow_none = true };
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|O&O&:set_guest_memory",
+					 keywords, path_converter, &path,
+					 index_converter, &pgtable,
+					 index_converter, &low_ram_size))
+		return NULL;
+
+	err = drgn_program_set_guest_memory(&self->prog, path.path,
+					    pgtable.is_none ? 0 : pgtable.uvalue,
+					    low_ram_size.is_none ?
+					    0 : low_ram_size.uvalue);
+	path_cleanup(&path);
+	if (err)
+		return set_drgn_error(err);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Program_flush_translation_cache(Program *self)
+{
+	drgn_program_flush_translation_cache(&self->prog);
+	Py_RETURN_NONE;
+}
+
 DEFINE_VECTOR(path_arg_vector, struct path_arg)
 
 static PyObject *Program_load_debug_info(Program *self, PyObject *args,
 					 PyObject *kwds)
 {
-	static char *keywords[] = {"paths", "default", "main", NULL};
+	static char *keywords[] = {
+		"paths", "default", "main", "index", "main_index", NULL,
+	};
 	struct drgn_error *err;
 	PyObject *paths_obj = Py_None;
 	int load_default = 0;
 	int load_main = 0;
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|Opp:load_debug_info",
-					 keywords, &paths_obj, &load_default,
-					 &load_main))
+	struct enum_arg index = {
+		.type = IndexCategory_class,
+		.value = DRGN_INDEX_ALL,
+	};
+	struct enum_arg main_index = {
+		.type = IndexCategory_class,
+		.value = -1,
+		.allow_none = true,
+	};
+	if (!PyArg_ParseTupleAndKeywords(args, kwds,
+					 "|Opp$O&O&:load_debug_info", keywords,
+					 &paths_obj, &load_default, &load_main,
+					 enum_converter, &index, enum_converter,
+					 &main_index))
 		return NULL;
+	struct drgn_index_profile profile = {
+		.main = main_index.value == -1 ? index.value : main_index.value,
+		.other = index.value,
+	};
 
 	struct path_arg_vector path_args = VECTOR_INIT;
 	const char **paths = NULL;
@@ -494,7 +542,7 @@ static PyObject *Program_load_debug_info(Program *self, PyObject *args,
 			paths[i] = path_args.data[i].path;
 	}
 	err = drgn_program_load_debug_info(&self->prog, paths, path_args.size,
-					   load_default, load_main);
+					   load_default, load_main, &profile);
 	free(paths);
 	if (err)
 		set_drgn_error(err);
@@ -512,7 +560,8 @@ static PyObject *Program_load_default_debug_info(Program *self)
 {
 	struct drgn_error *err;
 
-	err = drgn_program_load_debug_info(&self->prog, NULL, 0, true, true);
+	err = drgn_program_load_debug_info(&self->prog, NULL, 0, true, true,
+					   NULL);
 	if (err)
 		return set_drgn_error(err);
 	Py_RETURN_NONE;
@@ -552,6 +601,58 @@ static PyObject *Program_read(Program *self, PyObject *args, PyObject *kwds)
 	return buf;
 }
 
+static PyObject *Program_memory_holes(Program *self, PyObject *args,
+				      PyObject *kwds)
+{
+	static char *keywords[] = {"address", "size", "physical", NULL};
+	struct drgn_error *err;
+	struct index_arg address = {};
+	struct index_arg size = {};
+	int physical = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&O&|p:memory_holes",
+					 keywords, index_converter, &address,
+					 index_converter, &size, &physical))
+		return NULL;
+
+	uint64_t start = address.uvalue, end;
+	if (__builtin_add_overflow(start, size.uvalue, &end)) {
+		PyErr_SetString(PyExc_OverflowError,
+				"memory range end is too large");
+		return NULL;
+	}
+	PyObject *holes = PyList_New(0);
+	if (!holes)
+		return NULL;
+	while (start < end) {
+		uint64_t hole_start, hole_end;
+		err = drgn_program_find_memory_hole(&self->prog, start,
+						    end - start, physical,
+						    &hole_start, &hole_end);
+		if (err) {
+			set_drgn_error(err);
+			goto err;
+		}
+		if (hole_start == end)
+			break;
+		PyObject *item = Py_BuildValue("KK",
+					       (unsigned long long)hole_start,
+					       (unsigned long long)hole_end);
+		if (!item)
+			goto err;
+		int ret = PyList_Append(holes, item);
+		Py_DECREF(item);
+		if (ret)
+			goto err;
+		start = hole_end;
+	}
+	return holes;
+
+err:
+	Py_DECREF(holes);
+	return NULL;
+}
+
 #define METHOD_READ(x, type)							\
 static PyObject *Program_read_##x(Program *self, PyObject *args,		\
 				  PyObject *kwds)				\
@@ -858,6 +959,122 @@ static PyObject *Program_get_language(Program *self, void *arg)
 	return Language_wrap(drgn_program_language(&self->prog));
 }
 
+static PyObject *Program_get_num_threads(Program *self, void *arg)
+{
+	return PyLong_FromSize_t(drgn_program_num_threads(&self->prog));
+}
+
+static int Program_set_num_threads(Program *self, PyObject *value, void *arg)
+{
+	if (!value) {
+		PyErr_SetString(PyExc_AttributeError,
+				"can't delete num_threads attribute");
+		return -1;
+	}
+	size_t num_threads = PyLong_AsSize_t(value);
+	if (num_threads == (size_t)-1 && PyErr_Occurred())
+		return -1;
+	struct drgn_error *err = drgn_program_set_num_threads(&self->prog,
+							      num_threads);
+	if (err) {
+		set_drgn_error(err);
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *Program_get_direct_io(Program *self, void *arg)
+{
+	return PyLong_FromSize_t(drgn_program_direct_io(&self->prog));
+}
+
+static int Program_set_direct_io(Program *self, PyObject *value, void *arg)
+{
+	if (!value) {
+		PyErr_SetString(PyExc_AttributeError,
+				"can't delete direct_io attribute");
+		return -1;
+	}
+	size_t cache_size = PyLong_AsSize_t(value);
+	if (cache_size == (size_t)-1 && PyErr_Occurred())
+		return -1;
+	struct drgn_error *err = drgn_program_set_direct_io(&self->prog,
+							    cache_size);
+	if (err) {
+		set_drgn_error(err);
+		return -1;
+	}
+	return 0;
+}
+
+static PyObject *Program_direct_io_stats(Program *self)
+{
+	struct drgn_direct_io_stats stats;
+	drgn_program_direct_io_stats(&self->prog, &stats);
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:K,s:K}",
+			     "hits", (unsigned long long)stats.hits,
+			     "misses", (unsigned long long)stats.misses,
+			     "readahead_blocks",
+			     (unsigned long long)stats.readahead_blocks,
+			     "evictions", (unsigned long long)stats.evictions,
+			     "bytes_read", (unsigned long long)stats.bytes_read,
+			     "bytes_copied",
+			     (unsigned long long)stats.bytes_copied);
+}
+
+static PyObject *Program_get_memory_budget(Program *self, void *arg)
+{
+	return PyLong_FromSize_t(drgn_program_memory_budget(&self->prog));
+}
+
+static int Program_set_memory_budget(Program *self, PyObject *value,
+				     void *arg)
+{
+	if (!value) {
+		PyErr_SetString(PyExc_AttributeError,
+				"can't delete memory_budget attribute");
+		return -1;
+	}
+	size_t budget = PyLong_AsSize_t(value);
+	if (budget == (size_t)-1 && PyErr_Occurred())
+		return -1;
+	drgn_program_set_memory_budget(&self->prog, budget);
+	return 0;
+}
+
+static struct drgn_error *
+memory_usage_add(const struct drgn_memory_usage *usage, void *arg)
+{
+	PyObject *value = Py_BuildValue("{s:K,s:K,s:K}",
+					"size", (unsigned long long)usage->size,
+					"count",
+					(unsigned long long)usage->count,
+					"evictions",
+					(unsigned long long)usage->evictions);
+	if (!value)
+		return drgn_error_from_python();
+	int r = PyDict_SetItemString(arg, usage->name, value);
+	Py_DECREF(value);
+	if (r)
+		return drgn_error_from_python();
+	return NULL;
+}
+
+static PyObject *Program_memory_usage(Program *self)
+{
+	PyObject *ret = PyDict_New();
+	if (!ret)
+		return NULL;
+	struct drgn_error *err = drgn_program_memory_usage(&self->prog,
+							   memory_usage_add,
+							   ret);
+	if (err) {
+		Py_DECREF(ret);
+		return set_drgn_error(err);
+	}
+	return ret;
+}
+
 static PyMethodDef Program_methods[] = {
 	{"add_memory_segment", (PyCFunction)Program_add_memory_segment,
 	 METH_VARARGS | METH_KEYWORDS, drgn_Program_add_memory_segment_DOC},
@@ -871,6 +1088,14 @@ static PyMethodDef Program_methods[] = {
 	 drgn_Program_set_kernel_DOC},
 	{"set_pid", (PyCFunction)Program_set_pid, METH_VARARGS | METH_KEYWORDS,
 	 drgn_Program_set_pid_DOC},
+	{"set_guest_memory", (PyCFunction)Program_set_guest_memory,
+	 METH_VARARGS | METH_KEYWORDS, drgn_Program_set_guest_memory_DOC},
+	{"flush_translation_cache", (PyCFunction)Program_flush_translation_cache,
+	 METH_NOARGS, drgn_Program_flush_translation_cache_DOC},
+	{"direct_io_stats", (PyCFunction)Program_direct_io_stats, METH_NOARGS,
+	 drgn_Program_direct_io_stats_DOC},
+	{"memory_usage", (PyCFunction)Program_memory_usage, METH_NOARGS,
+	 drgn_Program_memory_usage_DOC},
 	{"load_debug_info", (PyCFunction)Program_load_debug_info,
 	 METH_VARARGS | METH_KEYWORDS, drgn_Program_load_debug_info_DOC},
 	{"load_default_debug_info",
@@ -880,6 +1105,8 @@ static PyMethodDef Program_methods[] = {
 	 drgn_Program___getitem___DOC},
 	{"read", (PyCFunction)Program_read, METH_VARARGS | METH_KEYWORDS,
 	 drgn_Program_read_DOC},
+	{"memory_holes", (PyCFunction)Program_memory_holes,
+	 METH_VARARGS | METH_KEYWORDS, drgn_Program_memory_holes_DOC},
 #define METHOD_DEF_READ(x)						\
 	{"read_"#x, (PyCFunction)Program_read_##x,			\
 	 METH_VARARGS | METH_KEYWORDS, drgn_Program_read_##x##_DOC}
@@ -944,6 +1171,12 @@ static PyGetSetDef Program_getset[] = {
 	 drgn_Program_platform_DOC},
 	{"language", (getter)Program_get_language, NULL,
 	 drgn_Program_language_DOC},
+	{"num_threads", (getter)Program_get_num_threads,
+	 (setter)Program_set_num_threads, drgn_Program_num_threads_DOC},
+	{"direct_io", (getter)Program_get_direct_io,
+	 (setter)Program_set_direct_io, drgn_Program_direct_io_DOC},
+	{"memory_budget", (getter)Program_get_memory_budget,
+	 (setter)Program_set_memory_budget, drgn_Program_memory_budget_DOC},
 	{},
 };
 
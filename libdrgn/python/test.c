@@ -10,9 +10,12 @@
  */
 
 #include "drgnpy.h"
+#include "../binary_buffer.h"
 #include "../lexer.h"
 #include "../path.h"
+#include "../read_engine.h"
 #include "../serialize.h"
+#include "../thread_pool.h"
 
 DRGNPY_PUBLIC void drgn_test_lexer_init(struct drgn_lexer *lexer,
 					drgn_lexer_func func, const char *str)
@@ -90,3 +93,109 @@ DRGNPY_PUBLIC uint64_t drgn_test_deserialize_bits(const void *buf,
 {
 	return deserialize_bits(buf, bit_offset, bit_size, little_endian);
 }
+
+static struct drgn_error *
+drgn_test_binary_buffer_error(struct binary_buffer *bb, const char *pos,
+			      const char *message)
+{
+	return drgn_error_create(DRGN_ERROR_OTHER, message);
+}
+
+DRGNPY_PUBLIC struct drgn_error *drgn_test_next_uleb128(const void *buf,
+							size_t len,
+							uint64_t *ret,
+							size_t *len_ret)
+{
+	struct binary_buffer bb;
+	binary_buffer_init(&bb, buf, len, true, drgn_test_binary_buffer_error);
+	struct drgn_error *err = binary_buffer_next_uleb128(&bb, ret);
+	*len_ret = bb.pos - (const char *)buf;
+	return err;
+}
+
+DRGNPY_PUBLIC struct drgn_error *drgn_test_next_sleb128(const void *buf,
+							size_t len,
+							int64_t *ret,
+							size_t *len_ret)
+{
+	struct binary_buffer bb;
+	binary_buffer_init(&bb, buf, len, true, drgn_test_binary_buffer_error);
+	struct drgn_error *err = binary_buffer_next_sleb128(&bb, ret);
+	*len_ret = bb.pos - (const char *)buf;
+	return err;
+}
+
+DRGNPY_PUBLIC struct drgn_error *drgn_test_skip_leb128(const void *buf,
+						       size_t len,
+						       size_t *len_ret)
+{
+	struct binary_buffer bb;
+	binary_buffer_init(&bb, buf, len, true, drgn_test_binary_buffer_error);
+	struct drgn_error *err = binary_buffer_skip_leb128(&bb);
+	*len_ret = bb.pos - (const char *)buf;
+	return err;
+}
+
+DRGNPY_PUBLIC struct drgn_error *
+drgn_test_thread_pool_create(size_t num_threads, struct drgn_thread_pool **ret)
+{
+	return drgn_thread_pool_create(num_threads, ret);
+}
+
+DRGNPY_PUBLIC void drgn_test_thread_pool_destroy(struct drgn_thread_pool *pool)
+{
+	drgn_thread_pool_destroy(pool);
+}
+
+DRGNPY_PUBLIC struct drgn_error *
+drgn_test_read_engine_create(struct drgn_thread_pool *pool,
+			     unsigned int queue_depth, bool use_io_uring,
+			     struct drgn_read_engine **ret)
+{
+	return drgn_read_engine_create(pool, queue_depth, use_io_uring, ret);
+}
+
+DRGNPY_PUBLIC void
+drgn_test_read_engine_destroy(struct drgn_read_engine *engine)
+{
+	drgn_read_engine_destroy(engine);
+}
+
+DRGNPY_PUBLIC bool
+drgn_test_read_engine_uses_io_uring(struct drgn_read_engine *engine)
+{
+	return drgn_read_engine_uses_io_uring(engine);
+}
+
+DRGNPY_PUBLIC struct drgn_error *
+drgn_test_read_engine_submit(struct drgn_read_engine *engine,
+			     struct drgn_read_request *req)
+{
+	return drgn_read_engine_submit(engine, req);
+}
+
+DRGNPY_PUBLIC size_t
+drgn_test_read_engine_pending(struct drgn_read_engine *engine)
+{
+	return drgn_read_engine_pending(engine);
+}
+
+DRGNPY_PUBLIC struct drgn_error *
+drgn_test_read_engine_wait(struct drgn_read_engine *engine, size_t min_complete)
+{
+	return drgn_read_engine_wait(engine, min_complete);
+}
+
+DRGNPY_PUBLIC bool drgn_test_read_engine_cancel(struct drgn_read_engine *engine)
+{
+	return drgn_read_engine_cancel(engine);
+}
+
+DRGNPY_PUBLIC struct drgn_error *
+drgn_test_read_engine_pread(struct drgn_read_engine *engine, int fd, void *buf,
+			    size_t count, uint64_t offset, size_t *done_ret,
+			    int *errnum_ret, uint64_t *error_offset_ret)
+{
+	return drgn_read_engine_pread(engine, fd, buf, count, offset, done_ret,
+				      errnum_ret, error_offset_ret);
+}
@@ -0,0 +1,263 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+
+#include "drgnpy.h"
+
+static Watch *Watch_new(PyTypeObject *subtype, PyObject *args, PyObject *kwds)
+{
+	static char *keywords[] = {"prog", "objects", "capacity", NULL};
+	struct drgn_error *err;
+	Program *prog;
+	PyObject *objects_arg;
+	struct index_arg capacity = { .uvalue = 1024 };
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O!O|O&:Watch", keywords,
+					 &Program_type, &prog, &objects_arg,
+					 index_converter, &capacity))
+		return NULL;
+
+	PyObject *objects = PySequence_Tuple(objects_arg);
+	if (!objects)
+		return NULL;
+
+	Watch *ret = (Watch *)subtype->tp_alloc(subtype, 0);
+	if (!ret) {
+		Py_DECREF(objects);
+		return NULL;
+	}
+	ret->prog = prog;
+	Py_INCREF(prog);
+	ret->objects = objects;
+
+	err = drgn_watch_create(&prog->prog, capacity.uvalue, &ret->watch);
+	if (err)
+		goto err;
+	for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(objects); i++) {
+		PyObject *item = PyTuple_GET_ITEM(objects, i);
+		if (!PyObject_TypeCheck(item, &DrgnObject_type)) {
+			PyErr_SetString(PyExc_TypeError,
+					"watched object must be Object");
+			goto err_py;
+		}
+		DrgnObject *obj = (DrgnObject *)item;
+		if (DrgnObject_prog(obj) != prog) {
+			PyErr_SetString(PyExc_ValueError,
+					"watched object is from different program");
+			goto err_py;
+		}
+		if (!obj->obj.is_reference) {
+			PyErr_SetString(PyExc_ValueError,
+					"watched object must be a reference");
+			goto err_py;
+		}
+		err = drgn_watch_add(ret->watch, obj->obj.reference.address,
+				     drgn_reference_object_size(&obj->obj),
+				     false);
+		if (err)
+			goto err;
+	}
+	return ret;
+
+err:
+	set_drgn_error(err);
+err_py:
+	Py_DECREF(ret);
+	return NULL;
+}
+
+static void Watch_dealloc(Watch *self)
+{
+	drgn_watch_destroy(self->watch);
+	Py_XDECREF(self->objects);
+	Py_XDECREF(self->prog);
+	Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *Watch_sample(Watch *self)
+{
+	struct drgn_error *err = drgn_watch_sample(self->watch);
+	if (err)
+		return set_drgn_error(err);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Watch_run(Watch *self, PyObject *args, PyObject *kwds)
+{
+	static char *keywords[] = {"interval", "count", NULL};
+	struct drgn_error *err;
+	double interval;
+	struct index_arg count = {};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "dO&:run", keywords,
+					 &interval, index_converter, &count))
+		return NULL;
+	if (!(interval >= 0.0) || interval > UINT64_MAX / 1000000000) {
+		PyErr_SetString(PyExc_ValueError, "invalid interval");
+		return NULL;
+	}
+	uint64_t interval_ns = llround(interval * 1000000000.0);
+
+	/*
+	 * Samples are taken at absolute deadlines so that the time spent taking
+	 * each sample doesn't accumulate as drift.
+	 */
+	struct timespec deadline;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	for (uint64_t i = 0; i < count.uvalue; i++) {
+		err = drgn_watch_sample(self->watch);
+		if (err)
+			return set_drgn_error(err);
+		if (i == count.uvalue - 1)
+			break;
+
+		deadline.tv_sec += interval_ns / 1000000000;
+		deadline.tv_nsec += interval_ns % 1000000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (now.tv_sec > deadline.tv_sec ||
+		    (now.tv_sec == deadline.tv_sec &&
+		     now.tv_nsec >= deadline.tv_nsec)) {
+			/*
+			 * We fell behind. Sample immediately and start over
+			 * from now rather than trying to catch up.
+			 */
+			deadline = now;
+		} else {
+			int ret;
+			do {
+				Py_BEGIN_ALLOW_THREADS
+				ret = clock_nanosleep(CLOCK_MONOTONIC,
+						      TIMER_ABSTIME, &deadline,
+						      NULL);
+				Py_END_ALLOW_THREADS
+				if (PyErr_CheckSignals() == -1)
+					return NULL;
+			} while (ret == EINTR);
+		}
+	}
+	Py_RETURN_NONE;
+}
+
+static PyObject *Watch_decode(Watch *self, const char *buf)
+{
+	struct drgn_error *err;
+	Py_ssize_t num_objects = PyTuple_GET_SIZE(self->objects);
+	PyObject *tuple = PyTuple_New(num_objects);
+	if (!tuple)
+		return NULL;
+	for (Py_ssize_t i = 0; i < num_objects; i++) {
+		const struct drgn_object *orig =
+			&((DrgnObject *)PyTuple_GET_ITEM(self->objects, i))->obj;
+		DrgnObject *obj = DrgnObject_alloc(self->prog);
+		if (!obj) {
+			Py_DECREF(tuple);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(tuple, i, (PyObject *)obj);
+		err = drgn_object_set_buffer(&obj->obj,
+					     drgn_object_qualified_type(orig),
+					     buf, orig->reference.bit_offset,
+					     orig->is_bit_field ?
+					     orig->bit_size : 0,
+					     orig->reference.little_endian ?
+					     DRGN_LITTLE_ENDIAN :
+					     DRGN_BIG_ENDIAN);
+		if (err) {
+			Py_DECREF(tuple);
+			return set_drgn_error(err);
+		}
+		buf += drgn_reference_object_size(orig);
+	}
+	return tuple;
+}
+
+static PyObject *Watch_samples(Watch *self)
+{
+	size_t num_samples = drgn_watch_num_samples(self->watch);
+	PyObject *list = PyList_New(num_samples);
+	if (!list)
+		return NULL;
+	for (size_t i = 0; i < num_samples; i++) {
+		uint64_t timestamp;
+		const char *buf = drgn_watch_get_sample(self->watch, i,
+							&timestamp);
+		PyObject *values = Watch_decode(self, buf);
+		if (!values)
+			goto err;
+		PyObject *item = Py_BuildValue("KN",
+					       (unsigned long long)timestamp,
+					       values);
+		if (!item)
+			goto err;
+		PyList_SET_ITEM(list, i, item);
+	}
+	return list;
+
+err:
+	Py_DECREF(list);
+	return NULL;
+}
+
+static PyObject *Watch_clear(Watch *self)
+{
+	drgn_watch_clear(self->watch);
+	Py_RETURN_NONE;
+}
+
+static PyObject *Watch_stats(Watch *self)
+{
+	struct drgn_watch_stats stats;
+	drgn_watch_stats(self->watch, &stats);
+	return Py_BuildValue("{s:K,s:K,s:K,s:K,s:O,s:K,s:K,s:K}",
+			     "samples", (unsigned long long)stats.samples,
+			     "dropped", (unsigned long long)stats.dropped,
+			     "reads_per_sample",
+			     (unsigned long long)stats.reads_per_sample,
+			     "untranslated",
+			     (unsigned long long)stats.untranslated,
+			     "batched", stats.batched ? Py_True : Py_False,
+			     "last_ns", (unsigned long long)stats.last_ns,
+			     "max_ns", (unsigned long long)stats.max_ns,
+			     "total_ns", (unsigned long long)stats.total_ns);
+}
+
+static Py_ssize_t Watch_length(Watch *self)
+{
+	return drgn_watch_num_samples(self->watch);
+}
+
+static PyMethodDef Watch_methods[] = {
+	{"sample", (PyCFunction)Watch_sample, METH_NOARGS,
+	 drgn_Watch_sample_DOC},
+	{"run", (PyCFunction)Watch_run, METH_VARARGS | METH_KEYWORDS,
+	 drgn_Watch_run_DOC},
+	{"samples", (PyCFunction)Watch_samples, METH_NOARGS,
+	 drgn_Watch_samples_DOC},
+	{"clear", (PyCFunction)Watch_clear, METH_NOARGS, drgn_Watch_clear_DOC},
+	{"stats", (PyCFunction)Watch_stats, METH_NOARGS, drgn_Watch_stats_DOC},
+	{},
+};
+
+static PySequenceMethods Watch_as_sequence = {
+	.sq_length = (lenfunc)Watch_length,
+};
+
+PyTypeObject Watch_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "_drgn.Watch",
+	.tp_basicsize = sizeof(Watch),
+	.tp_dealloc = (destructor)Watch_dealloc,
+	.tp_as_sequence = &Watch_as_sequence,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = drgn_Watch_DOC,
+	.tp_methods = Watch_methods,
+	.tp_new = (newfunc)Watch_new,
+};
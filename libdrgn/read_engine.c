@@ -0,0 +1,757 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#endif
+
+#include "error.h"
+#include "minmax.h"
+#include "read_engine.h"
+#include "thread_pool.h"
+#include "util.h"
+
+/* Number of file descriptors that can be registered with the ring. */
+#define DRGN_READ_ENGINE_MAX_FILES 8
+
+struct drgn_read_engine {
+	unsigned int queue_depth;
+	/* Requests which have been queued but not submitted yet. */
+	struct drgn_read_request *queued_head;
+	struct drgn_read_request **queued_tail;
+	size_t num_queued;
+	/* Requests which have been submitted but not reaped yet. */
+	size_t num_in_flight;
+
+	/* Buffers for drgn_read_engine_alloc_buffer(), allocated lazily. */
+	char *buffers;
+	/* Free list threaded through the first word of each free buffer. */
+	void *free_buffers;
+
+	bool use_io_uring;
+#ifdef HAVE_LINUX_IO_URING_H
+	struct {
+		int fd;
+		unsigned int sq_entries;
+		void *sq_ring;
+		size_t sq_ring_size;
+		void *cq_ring;
+		size_t cq_ring_size;
+		struct io_uring_sqe *sqes;
+		size_t sqes_size;
+		unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+		unsigned int *cq_head, *cq_tail, *cq_mask;
+		struct io_uring_cqe *cqes;
+		/*
+		 * Requests which have been submitted to the ring, linked
+		 * through next and prev so that they can be cancelled.
+		 */
+		struct drgn_read_request *in_flight;
+		/*
+		 * Registered file descriptors, or -1 for unused slots. This is
+		 * NULL if the file table hasn't been registered.
+		 */
+		int *files;
+		bool files_unsupported;
+		bool buffers_registered;
+	} ring;
+#endif
+
+	/* Fallback for when io_uring isn't available. */
+	struct drgn_thread_pool *pool;
+	struct drgn_task_group group;
+	bool group_active;
+	pthread_mutex_t done_lock;
+	/* Requests read by the thread pool. Protected by done_lock. */
+	struct drgn_read_request *done;
+};
+
+static void drgn_read_request_pread(struct drgn_read_request *req)
+{
+	while (req->done < req->count) {
+		ssize_t ret = pread(req->fd, (char *)req->buf + req->done,
+				    req->count - req->done,
+				    req->offset + req->done);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			req->errnum = errno;
+			break;
+		} else if (ret == 0) {
+			break;
+		}
+		req->done += ret;
+	}
+}
+
+static void drgn_read_engine_enqueue(struct drgn_read_engine *engine,
+				     struct drgn_read_request *req)
+{
+	req->next = NULL;
+	*engine->queued_tail = req;
+	engine->queued_tail = &req->next;
+	engine->num_queued++;
+}
+
+static struct drgn_read_request *
+drgn_read_engine_dequeue(struct drgn_read_engine *engine)
+{
+	struct drgn_read_request *req = engine->queued_head;
+	engine->queued_head = req->next;
+	if (!engine->queued_head)
+		engine->queued_tail = &engine->queued_head;
+	engine->num_queued--;
+	return req;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+static int io_uring_setup(unsigned int entries, struct io_uring_params *p)
+{
+	return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned int to_submit,
+			  unsigned int min_complete, unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+		       NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned int opcode, const void *arg,
+			     unsigned int nr_args)
+{
+	return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static void drgn_read_engine_ring_deinit(struct drgn_read_engine *engine)
+{
+	if (engine->ring.sqes)
+		munmap(engine->ring.sqes, engine->ring.sqes_size);
+	if (engine->ring.cq_ring && engine->ring.cq_ring != engine->ring.sq_ring)
+		munmap(engine->ring.cq_ring, engine->ring.cq_ring_size);
+	if (engine->ring.sq_ring)
+		munmap(engine->ring.sq_ring, engine->ring.sq_ring_size);
+	close(engine->ring.fd);
+	free(engine->ring.files);
+}
+
+/* Set up io_uring. Returns false if it isn't available. */
+static bool drgn_read_engine_ring_init(struct drgn_read_engine *engine)
+{
+	struct io_uring_params p = {};
+	engine->ring.fd = io_uring_setup(engine->queue_depth, &p);
+	if (engine->ring.fd == -1)
+		return false;
+	/*
+	 * IORING_OP_READ was added in Linux 5.6, which is also when
+	 * IORING_FEAT_RW_CUR_POS was added. Older kernels get the fallback.
+	 */
+	if (!(p.features & IORING_FEAT_RW_CUR_POS)) {
+		close(engine->ring.fd);
+		return false;
+	}
+	engine->ring.sq_entries = p.sq_entries;
+
+	engine->ring.sq_ring_size = (p.sq_off.array +
+				     p.sq_entries * sizeof(unsigned int));
+	engine->ring.cq_ring_size = (p.cq_off.cqes +
+				     p.cq_entries * sizeof(struct io_uring_cqe));
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		engine->ring.sq_ring_size = engine->ring.cq_ring_size =
+			max(engine->ring.sq_ring_size,
+			    engine->ring.cq_ring_size);
+	}
+	engine->ring.sq_ring = mmap(NULL, engine->ring.sq_ring_size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_POPULATE, engine->ring.fd,
+				    IORING_OFF_SQ_RING);
+	if (engine->ring.sq_ring == MAP_FAILED) {
+		engine->ring.sq_ring = NULL;
+		goto err;
+	}
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		engine->ring.cq_ring = engine->ring.sq_ring;
+	} else {
+		engine->ring.cq_ring = mmap(NULL, engine->ring.cq_ring_size,
+					    PROT_READ | PROT_WRITE,
+					    MAP_SHARED | MAP_POPULATE,
+					    engine->ring.fd,
+					    IORING_OFF_CQ_RING);
+		if (engine->ring.cq_ring == MAP_FAILED) {
+			engine->ring.cq_ring = NULL;
+			goto err;
+		}
+	}
+	engine->ring.sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	engine->ring.sqes = mmap(NULL, engine->ring.sqes_size,
+				 PROT_READ | PROT_WRITE,
+				 MAP_SHARED | MAP_POPULATE, engine->ring.fd,
+				 IORING_OFF_SQES);
+	if (engine->ring.sqes == MAP_FAILED) {
+		engine->ring.sqes = NULL;
+		goto err;
+	}
+
+	char *sq_ring = engine->ring.sq_ring;
+	engine->ring.sq_head = (unsigned int *)(sq_ring + p.sq_off.head);
+	engine->ring.sq_tail = (unsigned int *)(sq_ring + p.sq_off.tail);
+	engine->ring.sq_mask = (unsigned int *)(sq_ring + p.sq_off.ring_mask);
+	engine->ring.sq_array = (unsigned int *)(sq_ring + p.sq_off.array);
+	char *cq_ring = engine->ring.cq_ring;
+	engine->ring.cq_head = (unsigned int *)(cq_ring + p.cq_off.head);
+	engine->ring.cq_tail = (unsigned int *)(cq_ring + p.cq_off.tail);
+	engine->ring.cq_mask = (unsigned int *)(cq_ring + p.cq_off.ring_mask);
+	engine->ring.cqes = (struct io_uring_cqe *)(cq_ring + p.cq_off.cqes);
+	return true;
+
+err:
+	drgn_read_engine_ring_deinit(engine);
+	return false;
+}
+
+/* Return the registered file index of a file descriptor, or -1. */
+static int drgn_read_engine_file_index(struct drgn_read_engine *engine, int fd)
+{
+	if (!engine->ring.files)
+		return -1;
+	for (int i = 0; i < DRGN_READ_ENGINE_MAX_FILES; i++) {
+		if (engine->ring.files[i] == fd)
+			return i;
+	}
+	return -1;
+}
+
+static bool drgn_read_engine_is_fixed_buffer(struct drgn_read_engine *engine,
+					     void *buf, size_t count)
+{
+	return (engine->ring.buffers_registered &&
+		(char *)buf >= engine->buffers &&
+		(char *)buf + count <= engine->buffers +
+		(size_t)engine->queue_depth * DRGN_READ_ENGINE_BUFFER_SIZE);
+}
+
+static void drgn_read_engine_ring_link(struct drgn_read_engine *engine,
+				       struct drgn_read_request *req)
+{
+	req->prev = NULL;
+	req->next = engine->ring.in_flight;
+	if (req->next)
+		req->next->prev = req;
+	engine->ring.in_flight = req;
+}
+
+static void drgn_read_engine_ring_unlink(struct drgn_read_engine *engine,
+					 struct drgn_read_request *req)
+{
+	if (req->prev)
+		req->prev->next = req->next;
+	else
+		engine->ring.in_flight = req->next;
+	if (req->next)
+		req->next->prev = req->prev;
+}
+
+/* Submit as many queued requests as there is room for. */
+static struct drgn_error *
+drgn_read_engine_ring_flush(struct drgn_read_engine *engine)
+{
+	unsigned int tail = *engine->ring.sq_tail;
+	unsigned int mask = *engine->ring.sq_mask;
+	unsigned int to_submit = 0;
+	while (engine->num_queued &&
+	       tail - __atomic_load_n(engine->ring.sq_head, __ATOMIC_ACQUIRE) <
+	       engine->ring.sq_entries) {
+		struct drgn_read_request *req =
+			drgn_read_engine_dequeue(engine);
+		unsigned int index = tail & mask;
+		struct io_uring_sqe *sqe = &engine->ring.sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		char *buf = (char *)req->buf + req->done;
+		size_t len = min(req->count - req->done, (size_t)UINT32_MAX);
+		if (drgn_read_engine_is_fixed_buffer(engine, buf, len)) {
+			sqe->opcode = IORING_OP_READ_FIXED;
+			sqe->buf_index = 0;
+		} else {
+			sqe->opcode = IORING_OP_READ;
+		}
+		int file_index = drgn_read_engine_file_index(engine, req->fd);
+		if (file_index >= 0) {
+			sqe->fd = file_index;
+			sqe->flags = IOSQE_FIXED_FILE;
+		} else {
+			sqe->fd = req->fd;
+		}
+		sqe->off = req->offset + req->done;
+		sqe->addr = (uintptr_t)buf;
+		sqe->len = len;
+		sqe->user_data = (uintptr_t)req;
+		engine->ring.sq_array[index] = index;
+		tail++;
+		to_submit++;
+		drgn_read_engine_ring_link(engine, req);
+		engine->num_in_flight++;
+	}
+	if (!to_submit)
+		return NULL;
+	__atomic_store_n(engine->ring.sq_tail, tail, __ATOMIC_RELEASE);
+	while (to_submit) {
+		int ret = io_uring_enter(engine->ring.fd, to_submit, 0, 0);
+		if (ret == -1) {
+			/*
+			 * EAGAIN and EBUSY mean that the kernel is out of
+			 * resources until we reap completions. The entries
+			 * stay in the submission queue for the next call.
+			 */
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EBUSY)
+				break;
+			return drgn_error_create_os("io_uring_enter", errno,
+						    NULL);
+		}
+		to_submit -= ret;
+	}
+	return NULL;
+}
+
+static struct drgn_error *
+drgn_read_engine_ring_wait(struct drgn_read_engine *engine,
+			   size_t min_complete)
+{
+	struct drgn_error *err;
+	size_t completed = 0;
+	while (completed < min_complete &&
+	       (engine->num_in_flight || engine->num_queued)) {
+		err = drgn_read_engine_ring_flush(engine);
+		if (err)
+			return err;
+
+		unsigned int head = *engine->ring.cq_head;
+		if (head == __atomic_load_n(engine->ring.cq_tail,
+					    __ATOMIC_ACQUIRE)) {
+			int ret = io_uring_enter(engine->ring.fd,
+						 *engine->ring.sq_tail -
+						 __atomic_load_n(engine->ring.sq_head,
+								 __ATOMIC_ACQUIRE),
+						 1, IORING_ENTER_GETEVENTS);
+			if (ret == -1 && errno != EINTR && errno != EAGAIN &&
+			    errno != EBUSY) {
+				return drgn_error_create_os("io_uring_enter",
+							    errno, NULL);
+			}
+			continue;
+		}
+
+		struct io_uring_cqe *cqe =
+			&engine->ring.cqes[head & *engine->ring.cq_mask];
+		struct drgn_read_request *req =
+			(struct drgn_read_request *)(uintptr_t)cqe->user_data;
+		int res = cqe->res;
+		__atomic_store_n(engine->ring.cq_head, head + 1,
+				 __ATOMIC_RELEASE);
+		/* Left over from drgn_read_engine_ring_cancel(). */
+		if (!req)
+			continue;
+		drgn_read_engine_ring_unlink(engine, req);
+		engine->num_in_flight--;
+
+		if (res > 0) {
+			req->done += res;
+			if (req->done < req->count) {
+				/* Short read. Read the rest. */
+				drgn_read_engine_enqueue(engine, req);
+				continue;
+			}
+		} else if (res == -EINTR || res == -EAGAIN) {
+			drgn_read_engine_enqueue(engine, req);
+			continue;
+		} else if (res == -EINVAL || res == -EOPNOTSUPP) {
+			/* Some files can't be read through io_uring. */
+			drgn_read_request_pread(req);
+		} else if (res < 0) {
+			req->errnum = -res;
+		}
+		completed++;
+		if (req->complete)
+			req->complete(req);
+	}
+	return NULL;
+}
+
+static bool drgn_read_engine_ring_cancel(struct drgn_read_engine *engine)
+{
+	/*
+	 * Ask the kernel to cancel every request in flight. Cancellations have
+	 * a user_data of 0 so that their completions can be told apart from
+	 * reads. If the submission queue is full, the remaining requests are
+	 * simply waited for.
+	 */
+	unsigned int tail = *engine->ring.sq_tail;
+	unsigned int mask = *engine->ring.sq_mask;
+	for (struct drgn_read_request *req = engine->ring.in_flight;
+	     req && tail - __atomic_load_n(engine->ring.sq_head,
+					   __ATOMIC_ACQUIRE) <
+	     engine->ring.sq_entries;
+	     req = req->next) {
+		unsigned int index = tail & mask;
+		struct io_uring_sqe *sqe = &engine->ring.sqes[index];
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->opcode = IORING_OP_ASYNC_CANCEL;
+		sqe->fd = -1;
+		sqe->addr = (uintptr_t)req;
+		engine->ring.sq_array[index] = index;
+		tail++;
+	}
+	__atomic_store_n(engine->ring.sq_tail, tail, __ATOMIC_RELEASE);
+
+	while (engine->num_in_flight) {
+		unsigned int head = *engine->ring.cq_head;
+		if (head == __atomic_load_n(engine->ring.cq_tail,
+					    __ATOMIC_ACQUIRE)) {
+			int ret = io_uring_enter(engine->ring.fd,
+						 *engine->ring.sq_tail -
+						 __atomic_load_n(engine->ring.sq_head,
+								 __ATOMIC_ACQUIRE),
+						 1, IORING_ENTER_GETEVENTS);
+			if (ret == -1 && errno != EINTR && errno != EAGAIN &&
+			    errno != EBUSY)
+				return false;
+			continue;
+		}
+		struct io_uring_cqe *cqe =
+			&engine->ring.cqes[head & *engine->ring.cq_mask];
+		struct drgn_read_request *req =
+			(struct drgn_read_request *)(uintptr_t)cqe->user_data;
+		__atomic_store_n(engine->ring.cq_head, head + 1,
+				 __ATOMIC_RELEASE);
+		if (req) {
+			drgn_read_engine_ring_unlink(engine, req);
+			engine->num_in_flight--;
+		}
+	}
+	return true;
+}
+#endif /* HAVE_LINUX_IO_URING_H */
+
+struct pread_task_arg {
+	struct drgn_read_engine *engine;
+	struct drgn_read_request *req;
+};
+
+static struct drgn_error *pread_task(struct drgn_task_group *group, void *arg)
+{
+	struct pread_task_arg *a = arg;
+	drgn_read_request_pread(a->req);
+	pthread_mutex_lock(&a->engine->done_lock);
+	a->req->next = a->engine->done;
+	a->engine->done = a->req;
+	pthread_mutex_unlock(&a->engine->done_lock);
+	return NULL;
+}
+
+static void drgn_read_engine_pool_flush(struct drgn_read_engine *engine)
+{
+	while (engine->num_queued) {
+		if (!engine->group_active) {
+			drgn_task_group_init(&engine->group, engine->pool);
+			engine->group_active = true;
+		}
+		struct pread_task_arg arg = {
+			.engine = engine,
+			.req = drgn_read_engine_dequeue(engine),
+		};
+		engine->num_in_flight++;
+		drgn_task_group_spawn(&engine->group, pread_task, &arg,
+				      sizeof(arg));
+	}
+}
+
+static void drgn_read_engine_pool_cancel(struct drgn_read_engine *engine)
+{
+	/* Reads in the thread pool can't be interrupted, so wait for them. */
+	if (engine->group_active) {
+		drgn_task_group_wait(&engine->group);
+		engine->group_active = false;
+	}
+	engine->done = NULL;
+	engine->num_in_flight = 0;
+}
+
+static void drgn_read_engine_pool_wait(struct drgn_read_engine *engine,
+				       size_t min_complete)
+{
+	size_t completed = 0;
+	while (completed < min_complete &&
+	       (engine->num_in_flight || engine->num_queued)) {
+		drgn_read_engine_pool_flush(engine);
+
+		pthread_mutex_lock(&engine->done_lock);
+		struct drgn_read_request *done = engine->done;
+		engine->done = NULL;
+		pthread_mutex_unlock(&engine->done_lock);
+		if (!done) {
+			/* Our tasks can't fail. */
+			drgn_task_group_wait(&engine->group);
+			engine->group_active = false;
+			continue;
+		}
+		while (done) {
+			struct drgn_read_request *req = done;
+			done = req->next;
+			engine->num_in_flight--;
+			completed++;
+			if (req->complete)
+				req->complete(req);
+		}
+	}
+}
+
+struct drgn_error *drgn_read_engine_create(struct drgn_thread_pool *pool,
+					   unsigned int queue_depth,
+					   bool use_io_uring,
+					   struct drgn_read_engine **ret)
+{
+	struct drgn_read_engine *engine = calloc(1, sizeof(*engine));
+	if (!engine)
+		return &drgn_enomem;
+	engine->queue_depth = queue_depth ? queue_depth : 1;
+	engine->queued_tail = &engine->queued_head;
+	engine->pool = pool;
+	pthread_mutex_init(&engine->done_lock, NULL);
+#ifdef HAVE_LINUX_IO_URING_H
+	if (use_io_uring)
+		engine->use_io_uring = drgn_read_engine_ring_init(engine);
+#endif
+	*ret = engine;
+	return NULL;
+}
+
+void drgn_read_engine_destroy(struct drgn_read_engine *engine)
+{
+	if (!engine)
+		return;
+	/*
+	 * The kernel or the thread pool may still be writing to the buffers of
+	 * requests in flight, so cancel them before freeing anything.
+	 */
+	drgn_read_engine_cancel(engine);
+#ifdef HAVE_LINUX_IO_URING_H
+	if (engine->use_io_uring)
+		drgn_read_engine_ring_deinit(engine);
+#endif
+	pthread_mutex_destroy(&engine->done_lock);
+	free(engine->buffers);
+	free(engine);
+}
+
+bool drgn_read_engine_uses_io_uring(struct drgn_read_engine *engine)
+{
+	return engine->use_io_uring;
+}
+
+size_t drgn_read_engine_pending(struct drgn_read_engine *engine)
+{
+	return engine->num_queued + engine->num_in_flight;
+}
+
+struct drgn_error *drgn_read_engine_register_fd(struct drgn_read_engine *engine,
+						int fd)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (!engine->use_io_uring || engine->ring.files_unsupported ||
+	    drgn_read_engine_file_index(engine, fd) >= 0)
+		return NULL;
+	if (!engine->ring.files) {
+		int *files = malloc_array(DRGN_READ_ENGINE_MAX_FILES,
+					  sizeof(*files));
+		if (!files)
+			return &drgn_enomem;
+		for (int i = 0; i < DRGN_READ_ENGINE_MAX_FILES; i++)
+			files[i] = -1;
+		if (io_uring_register(engine->ring.fd, IORING_REGISTER_FILES,
+				      files, DRGN_READ_ENGINE_MAX_FILES)) {
+			/* Registering is an optimization, so don't fail. */
+			free(files);
+			engine->ring.files_unsupported = true;
+			return NULL;
+		}
+		engine->ring.files = files;
+	}
+	int index = drgn_read_engine_file_index(engine, -1);
+	if (index < 0)
+		return NULL;
+	struct io_uring_files_update update = {
+		.offset = index,
+		.fds = (uintptr_t)&fd,
+	};
+	if (io_uring_register(engine->ring.fd, IORING_REGISTER_FILES_UPDATE,
+			      &update, 1) == 1)
+		engine->ring.files[index] = fd;
+#endif
+	return NULL;
+}
+
+void drgn_read_engine_unregister_fd(struct drgn_read_engine *engine, int fd)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (!engine->use_io_uring)
+		return;
+	int index = drgn_read_engine_file_index(engine, fd);
+	if (index < 0)
+		return;
+	/* Requests in flight hold their own reference to the file. */
+	int unused = -1;
+	struct io_uring_files_update update = {
+		.offset = index,
+		.fds = (uintptr_t)&unused,
+	};
+	io_uring_register(engine->ring.fd, IORING_REGISTER_FILES_UPDATE,
+			  &update, 1);
+	engine->ring.files[index] = -1;
+#endif
+}
+
+struct drgn_error *drgn_read_engine_submit(struct drgn_read_engine *engine,
+					   struct drgn_read_request *req)
+{
+	if (drgn_read_engine_pending(engine) >= engine->queue_depth) {
+		struct drgn_error *err = drgn_read_engine_wait(engine, 1);
+		if (err)
+			return err;
+	}
+	req->done = 0;
+	req->errnum = 0;
+	drgn_read_engine_enqueue(engine, req);
+	return NULL;
+}
+
+struct drgn_error *drgn_read_engine_wait(struct drgn_read_engine *engine,
+					 size_t min_complete)
+{
+#ifdef HAVE_LINUX_IO_URING_H
+	if (engine->use_io_uring)
+		return drgn_read_engine_ring_wait(engine, min_complete);
+#endif
+	drgn_read_engine_pool_wait(engine, min_complete);
+	return NULL;
+}
+
+bool drgn_read_engine_cancel(struct drgn_read_engine *engine)
+{
+	engine->queued_head = NULL;
+	engine->queued_tail = &engine->queued_head;
+	engine->num_queued = 0;
+#ifdef HAVE_LINUX_IO_URING_H
+	if (engine->use_io_uring)
+		return drgn_read_engine_ring_cancel(engine);
+#endif
+	drgn_read_engine_pool_cancel(engine);
+	return true;
+}
+
+void *drgn_read_engine_alloc_buffer(struct drgn_read_engine *engine)
+{
+	if (!engine->buffers) {
+		size_t size = ((size_t)engine->queue_depth *
+			       DRGN_READ_ENGINE_BUFFER_SIZE);
+		void *buffers;
+		if (posix_memalign(&buffers, sysconf(_SC_PAGESIZE), size))
+			return NULL;
+		engine->buffers = buffers;
+		for (unsigned int i = engine->queue_depth; i-- > 0;) {
+			void *buf = (engine->buffers +
+				     (size_t)i * DRGN_READ_ENGINE_BUFFER_SIZE);
+			*(void **)buf = engine->free_buffers;
+			engine->free_buffers = buf;
+		}
+#ifdef HAVE_LINUX_IO_URING_H
+		/*
+		 * Registering pins the buffers, which can fail if
+		 * RLIMIT_MEMLOCK is low. The buffers still work unregistered.
+		 */
+		struct iovec iov = {
+			.iov_base = engine->buffers,
+			.iov_len = size,
+		};
+		if (engine->use_io_uring &&
+		    io_uring_register(engine->ring.fd,
+				      IORING_REGISTER_BUFFERS, &iov, 1) == 0)
+			engine->ring.buffers_registered = true;
+#endif
+	}
+	void *buf = engine->free_buffers;
+	if (buf)
+		engine->free_buffers = *(void **)buf;
+	return buf;
+}
+
+void drgn_read_engine_free_buffer(struct drgn_read_engine *engine, void *buf)
+{
+	*(void **)buf = engine->free_buffers;
+	engine->free_buffers = buf;
+}
+
+/* Size of each request made by drgn_read_engine_pread(). */
+#define DRGN_READ_ENGINE_CHUNK_SIZE (256 * 1024)
+
+struct drgn_error *drgn_read_engine_pread(struct drgn_read_engine *engine,
+					  int fd, void *buf, size_t count,
+					  uint64_t offset, size_t *done_ret,
+					  int *errnum_ret,
+					  uint64_t *error_offset_ret)
+{
+	struct drgn_error *err = NULL;
+	size_t num_reqs = ((count + DRGN_READ_ENGINE_CHUNK_SIZE - 1) /
+			   DRGN_READ_ENGINE_CHUNK_SIZE);
+	struct drgn_read_request *reqs = calloc(num_reqs, sizeof(*reqs));
+	if (!reqs)
+		return &drgn_enomem;
+	for (size_t i = 0; i < num_reqs; i++) {
+		size_t chunk_offset = i * DRGN_READ_ENGINE_CHUNK_SIZE;
+		reqs[i].fd = fd;
+		reqs[i].buf = (char *)buf + chunk_offset;
+		reqs[i].count = min(count - chunk_offset,
+				    (size_t)DRGN_READ_ENGINE_CHUNK_SIZE);
+		reqs[i].offset = offset + chunk_offset;
+		err = drgn_read_engine_submit(engine, &reqs[i]);
+		if (err)
+			break;
+	}
+	if (!err)
+		err = drgn_read_engine_wait(engine, SIZE_MAX);
+	if (err) {
+		/*
+		 * Reads may still be in flight into buf and reqs, so cancel
+		 * them before returning. If that fails, the kernel may still
+		 * write to reqs, so it has to be leaked.
+		 */
+		if (drgn_read_engine_cancel(engine))
+			free(reqs);
+		return err;
+	}
+
+	/* The result is the contiguous prefix that was read successfully. */
+	size_t done = 0;
+	*errnum_ret = 0;
+	for (size_t i = 0; i < num_reqs; i++) {
+		done += reqs[i].done;
+		if (reqs[i].errnum) {
+			*errnum_ret = reqs[i].errnum;
+			*error_offset_ret = reqs[i].offset + reqs[i].done;
+			break;
+		}
+		if (reqs[i].done < reqs[i].count)
+			break;
+	}
+	*done_ret = done;
+	free(reqs);
+	return NULL;
+}
@@ -0,0 +1,203 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+/**
+ * @file
+ *
+ * Asynchronous file read engine.
+ *
+ * See @ref ReadEngine.
+ */
+
+#ifndef DRGN_READ_ENGINE_H
+#define DRGN_READ_ENGINE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct drgn_error;
+struct drgn_thread_pool;
+
+/**
+ * @ingroup Internals
+ *
+ * @defgroup ReadEngine Read engine
+ *
+ * Asynchronous file reads.
+ *
+ * A @ref drgn_read_engine keeps many reads from files in flight at once, which
+ * is necessary to get the full bandwidth of fast storage (or to hide the
+ * latency of slow network block devices). Reads are described by @ref
+ * drgn_read_request, queued with @ref drgn_read_engine_submit(), and completed
+ * by @ref drgn_read_engine_wait(), which calls each request's completion
+ * callback.
+ *
+ * On Linux, the engine uses io_uring when it is available: queued requests are
+ * submitted in batches with a single system call, file descriptors are
+ * registered with the ring, and buffers allocated with @ref
+ * drgn_read_engine_alloc_buffer() are registered so that the kernel doesn't
+ * need to map them for every read. Otherwise, the engine falls back to calling
+ * <tt>pread(2)</tt> from tasks in a @ref drgn_thread_pool.
+ *
+ * A read engine is not thread-safe.
+ *
+ * @{
+ */
+
+struct drgn_read_engine;
+struct drgn_read_request;
+
+/** Callback for a completed @ref drgn_read_request. */
+typedef void drgn_read_complete_fn(struct drgn_read_request *req);
+
+/** Read from a file submitted to a @ref drgn_read_engine. */
+struct drgn_read_request {
+	/** File descriptor to read from. */
+	int fd;
+	/** Buffer to read into. */
+	void *buf;
+	/** Number of bytes to read. */
+	size_t count;
+	/** Offset in the file to read from. */
+	uint64_t offset;
+	/**
+	 * Function to call when the request completes, or @c NULL. This is
+	 * called from @ref drgn_read_engine_wait() and may submit more
+	 * requests.
+	 */
+	drgn_read_complete_fn *complete;
+	/** Argument for @ref complete. */
+	void *arg;
+	/**
+	 * Number of bytes read when the request completed. Short reads are
+	 * retried, so this is only less than @ref count if the end of the file
+	 * was reached or there was an error.
+	 */
+	size_t done;
+	/** @c errno of the error that the request failed with, or 0. */
+	int errnum;
+	/** @privatesection */
+	struct drgn_read_request *next;
+	struct drgn_read_request *prev;
+};
+
+/**
+ * Create a @ref drgn_read_engine.
+ *
+ * @param[in] pool Thread pool to use if io_uring is not available. It must
+ * outlive the engine.
+ * @param[in] queue_depth Maximum number of reads to keep in flight.
+ * @param[in] use_io_uring Whether to use io_uring if it is available. If @c
+ * false, the thread pool is always used.
+ * @param[out] ret Returned engine.
+ */
+struct drgn_error *drgn_read_engine_create(struct drgn_thread_pool *pool,
+					   unsigned int queue_depth,
+					   bool use_io_uring,
+					   struct drgn_read_engine **ret);
+
+/**
+ * Destroy a @ref drgn_read_engine.
+ *
+ * This cancels any requests which are still pending with @ref
+ * drgn_read_engine_cancel().
+ */
+void drgn_read_engine_destroy(struct drgn_read_engine *engine);
+
+/** Return whether a @ref drgn_read_engine uses io_uring. */
+bool drgn_read_engine_uses_io_uring(struct drgn_read_engine *engine);
+
+/**
+ * Register a file descriptor with a @ref drgn_read_engine.
+ *
+ * Reads from a registered file descriptor avoid looking up the file for every
+ * read. This is only an optimization, so it is not an error if the file
+ * descriptor can't be registered. A registered file descriptor must be
+ * unregistered with @ref drgn_read_engine_unregister_fd() before it is
+ * closed.
+ */
+struct drgn_error *drgn_read_engine_register_fd(struct drgn_read_engine *engine,
+						int fd);
+
+/** Unregister a file descriptor from a @ref drgn_read_engine. */
+void drgn_read_engine_unregister_fd(struct drgn_read_engine *engine, int fd);
+
+/**
+ * Queue a read.
+ *
+ * Queued reads are submitted in batches, either when enough of them have
+ * accumulated or by @ref drgn_read_engine_wait(). If the engine already has
+ * its maximum number of reads in flight, this waits for one of them to
+ * complete first.
+ *
+ * @param[in] req Request. It must remain valid until it is completed.
+ * @return @c NULL on success, non-@c NULL if waiting for room failed, in which
+ * case @p req was not queued.
+ */
+struct drgn_error *drgn_read_engine_submit(struct drgn_read_engine *engine,
+					   struct drgn_read_request *req);
+
+/** Get the number of requests which have been submitted but not completed. */
+size_t drgn_read_engine_pending(struct drgn_read_engine *engine);
+
+/**
+ * Submit any queued reads and wait for requests to complete, calling their
+ * completion callbacks.
+ *
+ * @param[in] min_complete Minimum number of requests to complete. This is
+ * capped at the number of pending requests, so @c SIZE_MAX waits for every
+ * request, including ones submitted by completion callbacks.
+ */
+struct drgn_error *drgn_read_engine_wait(struct drgn_read_engine *engine,
+					 size_t min_complete);
+
+/**
+ * Cancel every pending request without calling its completion callback.
+ *
+ * Queued requests are dropped. Requests in flight are cancelled (or waited for
+ * if they can't be cancelled) and reaped, after which their buffers may be
+ * freed. This is how to recover from an error from @ref
+ * drgn_read_engine_submit() or @ref drgn_read_engine_wait().
+ *
+ * @return @c true if every request was reaped, @c false if reaping failed, in
+ * which case requests may still be in flight and their buffers must not be
+ * freed.
+ */
+bool drgn_read_engine_cancel(struct drgn_read_engine *engine);
+
+/**
+ * Allocate a buffer for reads that is registered with the kernel.
+ *
+ * All buffers have the same size, @ref DRGN_READ_ENGINE_BUFFER_SIZE.
+ *
+ * @return Buffer, or @c NULL if none are available. Buffers are not
+ * registered when falling back to <tt>pread(2)</tt>, but they are still
+ * available.
+ */
+void *drgn_read_engine_alloc_buffer(struct drgn_read_engine *engine);
+
+/** Free a buffer returned by @ref drgn_read_engine_alloc_buffer(). */
+void drgn_read_engine_free_buffer(struct drgn_read_engine *engine, void *buf);
+
+/** Size of buffers returned by @ref drgn_read_engine_alloc_buffer(). */
+#define DRGN_READ_ENGINE_BUFFER_SIZE (128 * 1024)
+
+/**
+ * Read a contiguous range of a file with many requests in flight.
+ *
+ * @param[out] done_ret Returned number of bytes read. This is less than @p
+ * count if the end of the file was reached.
+ * @param[out] errnum_ret Returned @c errno of the first failed read, or 0.
+ * @param[out] error_offset_ret If @p errnum_ret is non-zero, returned offset
+ * in the file of the failed read.
+ */
+struct drgn_error *drgn_read_engine_pread(struct drgn_read_engine *engine,
+					  int fd, void *buf, size_t count,
+					  uint64_t offset, size_t *done_ret,
+					  int *errnum_ret,
+					  uint64_t *error_offset_ret);
+
+/** @} */
+
+#endif /* DRGN_READ_ENGINE_H */
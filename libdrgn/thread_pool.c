@@ -0,0 +1,421 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <sched.h>
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "error.h"
+#include "minmax.h"
+#include "thread_pool.h"
+#include "util.h"
+
+struct drgn_task {
+	/* Toward the top (older tasks) of the queue. */
+	struct drgn_task *prev;
+	/* Toward the bottom (newer tasks) of the queue. */
+	struct drgn_task *next;
+	struct drgn_task_group *group;
+	drgn_task_fn *fn;
+	alignas(max_align_t) unsigned char arg[];
+};
+
+/*
+ * The ends of a queue are only modified with the lock held, but they are also
+ * read without it to skip empty queues cheaply.
+ */
+struct drgn_task_queue {
+	pthread_mutex_t lock;
+	struct drgn_task *top;
+	struct drgn_task *bottom;
+	struct drgn_thread_pool *pool;
+	/* Keep queues of different threads in different cache lines. */
+	char padding[64];
+};
+
+struct drgn_thread_pool {
+	/* Protects sleeping and shutdown and is used with the conditions. */
+	pthread_mutex_t lock;
+	/* Signaled when a task is queued or the pool is shutting down. */
+	pthread_cond_t work_cond;
+	/* Broadcast when the last task in a group finishes. */
+	pthread_cond_t done_cond;
+	/*
+	 * Upper bound on the number of queued tasks. This is incremented before
+	 * a task is pushed and decremented after it is popped, so it is never
+	 * less than the number of tasks actually in the queues.
+	 */
+	atomic_size_t num_queued;
+	/* Number of threads in the pool waiting for work. */
+	atomic_size_t num_sleeping;
+	bool shutdown;
+	size_t num_threads;
+	/* Started threads. Thread i uses queues[i + 1]. */
+	pthread_t *threads;
+	size_t num_started;
+	/* Queue 0 is shared by threads outside of the pool. */
+	struct drgn_task_queue *queues;
+};
+
+/* The pool that the current thread belongs to, if any, and its queue. */
+static __thread struct drgn_thread_pool *current_pool;
+static __thread size_t current_queue;
+
+static inline size_t drgn_thread_pool_self(struct drgn_thread_pool *pool)
+{
+	return current_pool == pool ? current_queue : 0;
+}
+
+static void drgn_task_queue_push(struct drgn_task_queue *queue,
+				 struct drgn_task *task)
+{
+	task->next = NULL;
+	pthread_mutex_lock(&queue->lock);
+	task->prev = queue->bottom;
+	if (queue->bottom)
+		queue->bottom->next = task;
+	else
+		__atomic_store_n(&queue->top, task, __ATOMIC_RELAXED);
+	__atomic_store_n(&queue->bottom, task, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&queue->lock);
+}
+
+static struct drgn_task *drgn_task_queue_pop(struct drgn_task_queue *queue)
+{
+	/* Avoid taking the lock of an empty queue. */
+	if (!__atomic_load_n(&queue->bottom, __ATOMIC_RELAXED))
+		return NULL;
+	pthread_mutex_lock(&queue->lock);
+	struct drgn_task *task = queue->bottom;
+	if (task) {
+		__atomic_store_n(&queue->bottom, task->prev, __ATOMIC_RELAXED);
+		if (task->prev)
+			task->prev->next = NULL;
+		else
+			__atomic_store_n(&queue->top, NULL, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return task;
+}
+
+static struct drgn_task *drgn_task_queue_steal(struct drgn_task_queue *queue)
+{
+	if (!__atomic_load_n(&queue->top, __ATOMIC_RELAXED))
+		return NULL;
+	pthread_mutex_lock(&queue->lock);
+	struct drgn_task *task = queue->top;
+	if (task) {
+		__atomic_store_n(&queue->top, task->next, __ATOMIC_RELAXED);
+		if (task->next)
+			task->next->prev = NULL;
+		else
+			__atomic_store_n(&queue->bottom, NULL, __ATOMIC_RELAXED);
+	}
+	pthread_mutex_unlock(&queue->lock);
+	return task;
+}
+
+/*
+ * Get a task from the current thread's queue, or steal one from another queue.
+ */
+static struct drgn_task *drgn_thread_pool_get_task(struct drgn_thread_pool *pool)
+{
+	if (!atomic_load(&pool->num_queued))
+		return NULL;
+	size_t self = drgn_thread_pool_self(pool);
+	size_t num_queues = pool->num_threads;
+	struct drgn_task *task = drgn_task_queue_pop(&pool->queues[self]);
+	for (size_t i = 1; !task && i < num_queues; i++) {
+		task = drgn_task_queue_steal(&pool->queues[(self + i) %
+							   num_queues]);
+	}
+	if (task)
+		atomic_fetch_sub(&pool->num_queued, 1);
+	return task;
+}
+
+static void drgn_task_group_finish_one(struct drgn_task_group *group)
+{
+	struct drgn_thread_pool *pool = group->pool;
+	if (atomic_fetch_sub(&group->pending, 1) == 1) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void drgn_task_run(struct drgn_task *task)
+{
+	struct drgn_task_group *group = task->group;
+	if (!drgn_task_group_cancelled(group)) {
+		struct drgn_error *err = task->fn(group, task->arg);
+		if (err)
+			drgn_task_group_cancel(group, err);
+	}
+	free(task);
+	drgn_task_group_finish_one(group);
+}
+
+static void *drgn_thread_pool_thread(void *arg)
+{
+	struct drgn_task_queue *queue = arg;
+	struct drgn_thread_pool *pool = queue->pool;
+	current_pool = pool;
+	current_queue = queue - pool->queues;
+	for (;;) {
+		struct drgn_task *task = drgn_thread_pool_get_task(pool);
+		if (task) {
+			drgn_task_run(task);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		atomic_fetch_add(&pool->num_sleeping, 1);
+		while (!pool->shutdown && !atomic_load(&pool->num_queued))
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		atomic_fetch_sub(&pool->num_sleeping, 1);
+		bool shutdown = pool->shutdown;
+		pthread_mutex_unlock(&pool->lock);
+		if (shutdown)
+			return NULL;
+	}
+}
+
+size_t drgn_num_available_cpus(void)
+{
+	cpu_set_t set;
+	if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+		int count = CPU_COUNT(&set);
+		if (count > 0)
+			return count;
+	}
+	long ret = sysconf(_SC_NPROCESSORS_ONLN);
+	return ret > 0 ? ret : 1;
+}
+
+struct drgn_error *drgn_thread_pool_create(size_t num_threads,
+					   struct drgn_thread_pool **ret)
+{
+	if (num_threads == 0)
+		num_threads = 1;
+
+	struct drgn_thread_pool *pool = calloc(1, sizeof(*pool));
+	if (!pool)
+		return &drgn_enomem;
+	pool->num_threads = num_threads;
+	pool->queues = malloc_array(num_threads, sizeof(*pool->queues));
+	pool->threads = malloc_array(num_threads - 1, sizeof(*pool->threads));
+	if (!pool->queues || (num_threads > 1 && !pool->threads)) {
+		free(pool->threads);
+		free(pool->queues);
+		free(pool);
+		return &drgn_enomem;
+	}
+	for (size_t i = 0; i < num_threads; i++) {
+		struct drgn_task_queue *queue = &pool->queues[i];
+		pthread_mutex_init(&queue->lock, NULL);
+		queue->top = queue->bottom = NULL;
+		queue->pool = pool;
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	atomic_init(&pool->num_queued, 0);
+	atomic_init(&pool->num_sleeping, 0);
+
+	/*
+	 * If we can't start as many threads as requested, make do with the ones
+	 * that we could start. Tasks are always run by a waiting thread, too.
+	 */
+	for (size_t i = 1; i < num_threads; i++) {
+		if (pthread_create(&pool->threads[i - 1], NULL,
+				   drgn_thread_pool_thread, &pool->queues[i]))
+			break;
+		pool->num_started++;
+	}
+	*ret = pool;
+	return NULL;
+}
+
+void drgn_thread_pool_destroy(struct drgn_thread_pool *pool)
+{
+	if (!pool)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (size_t i = 0; i < pool->num_started; i++)
+		pthread_join(pool->threads[i], NULL);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_mutex_destroy(&pool->lock);
+	for (size_t i = 0; i < pool->num_threads; i++)
+		pthread_mutex_destroy(&pool->queues[i].lock);
+	free(pool->threads);
+	free(pool->queues);
+	free(pool);
+}
+
+size_t drgn_thread_pool_num_threads(struct drgn_thread_pool *pool)
+{
+	return pool->num_started + 1;
+}
+
+void drgn_task_group_init(struct drgn_task_group *group,
+			  struct drgn_thread_pool *pool)
+{
+	group->pool = pool;
+	atomic_init(&group->pending, 0);
+	atomic_init(&group->cancelled, false);
+	pthread_mutex_init(&group->lock, NULL);
+	group->err = NULL;
+}
+
+void drgn_task_group_spawn(struct drgn_task_group *group, drgn_task_fn *fn,
+			   const void *arg, size_t arg_size)
+{
+	struct drgn_thread_pool *pool = group->pool;
+	struct drgn_task *task = malloc(sizeof(*task) + arg_size);
+	if (!task) {
+		if (!drgn_task_group_cancelled(group)) {
+			struct drgn_error *err = fn(group, (void *)arg);
+			if (err)
+				drgn_task_group_cancel(group, err);
+		}
+		return;
+	}
+	task->group = group;
+	task->fn = fn;
+	memcpy(task->arg, arg, arg_size);
+
+	atomic_fetch_add(&group->pending, 1);
+	atomic_fetch_add(&pool->num_queued, 1);
+	drgn_task_queue_push(&pool->queues[drgn_thread_pool_self(pool)], task);
+	if (atomic_load(&pool->num_sleeping)) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->work_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+void drgn_task_group_cancel(struct drgn_task_group *group,
+			    struct drgn_error *err)
+{
+	pthread_mutex_lock(&group->lock);
+	if (group->err)
+		drgn_error_destroy(err);
+	else
+		group->err = err;
+	pthread_mutex_unlock(&group->lock);
+	atomic_store(&group->cancelled, true);
+}
+
+struct drgn_error *drgn_task_group_wait(struct drgn_task_group *group)
+{
+	struct drgn_thread_pool *pool = group->pool;
+	while (atomic_load(&group->pending)) {
+		/*
+		 * Help with any queued task, not just ones from this group,
+		 * since tasks from this group may be waiting for them.
+		 */
+		struct drgn_task *task = drgn_thread_pool_get_task(pool);
+		if (task) {
+			drgn_task_run(task);
+			continue;
+		}
+		/*
+		 * The remaining tasks are running in other threads. Sleep until
+		 * one of them finishes the group.
+		 */
+		pthread_mutex_lock(&pool->lock);
+		while (atomic_load(&group->pending) &&
+		       !atomic_load(&pool->num_queued))
+			pthread_cond_wait(&pool->done_cond, &pool->lock);
+		pthread_mutex_unlock(&pool->lock);
+	}
+	pthread_mutex_destroy(&group->lock);
+	return group->err;
+}
+
+#ifdef _OPENMP
+/*
+ * When libdrgn is configured with --enable-openmp, parallel loops run on the
+ * OpenMP runtime instead, e.g., so that they share threads with an application
+ * that already uses OpenMP. Task groups always use the pool.
+ */
+struct drgn_error *drgn_thread_pool_for_each(struct drgn_thread_pool *pool,
+					     size_t start, size_t end,
+					     drgn_for_each_fn *fn, void *arg)
+{
+	if (start >= end)
+		return NULL;
+	struct drgn_error *err = NULL;
+	atomic_bool cancelled;
+	atomic_init(&cancelled, false);
+	int num_threads = min(drgn_thread_pool_num_threads(pool), end - start);
+	#pragma omp parallel for schedule(dynamic) num_threads(num_threads)
+	for (size_t i = start; i < end; i++) {
+		if (atomic_load_explicit(&cancelled, memory_order_relaxed))
+			continue;
+		struct drgn_error *cur_err = fn(i, arg);
+		if (cur_err) {
+			#pragma omp critical(drgn_thread_pool_for_each)
+			if (err) {
+				drgn_error_destroy(cur_err);
+			} else {
+				err = cur_err;
+				atomic_store(&cancelled, true);
+			}
+		}
+	}
+	return err;
+}
+#else
+struct drgn_for_each_state {
+	atomic_size_t next;
+	size_t end;
+	drgn_for_each_fn *fn;
+	void *arg;
+};
+
+static struct drgn_error *drgn_for_each_task(struct drgn_task_group *group,
+					     void *arg)
+{
+	struct drgn_for_each_state *state = *(struct drgn_for_each_state **)arg;
+	while (!drgn_task_group_cancelled(group)) {
+		size_t i = atomic_fetch_add(&state->next, 1);
+		if (i >= state->end)
+			break;
+		struct drgn_error *err = state->fn(i, state->arg);
+		if (err)
+			return err;
+	}
+	return NULL;
+}
+
+struct drgn_error *drgn_thread_pool_for_each(struct drgn_thread_pool *pool,
+					     size_t start, size_t end,
+					     drgn_for_each_fn *fn, void *arg)
+{
+	if (start >= end)
+		return NULL;
+	struct drgn_for_each_state state = {
+		.end = end,
+		.fn = fn,
+		.arg = arg,
+	};
+	atomic_init(&state.next, start);
+	struct drgn_for_each_state *statep = &state;
+	/* One task per thread; each one claims indices until none are left. */
+	size_t num_tasks = min(drgn_thread_pool_num_threads(pool), end - start);
+	struct drgn_task_group group;
+	drgn_task_group_init(&group, pool);
+	for (size_t i = 0; i < num_tasks; i++) {
+		drgn_task_group_spawn(&group, drgn_for_each_task, &statep,
+				      sizeof(statep));
+	}
+	return drgn_task_group_wait(&group);
+}
+#endif
@@ -0,0 +1,174 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+/**
+ * @file
+ *
+ * Work-stealing thread pool.
+ *
+ * See @ref ThreadPool.
+ */
+
+#ifndef DRGN_THREAD_POOL_H
+#define DRGN_THREAD_POOL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct drgn_error;
+
+/**
+ * @ingroup Internals
+ *
+ * @defgroup ThreadPool Thread pool
+ *
+ * Work-stealing thread pool.
+ *
+ * A @ref drgn_thread_pool runs tasks on a fixed number of threads. Each thread
+ * in the pool has its own queue of tasks: a thread pushes tasks that it creates
+ * onto and pops tasks from the bottom of its own queue, and when its queue is
+ * empty, it steals tasks from the top of other threads' queues. Threads outside
+ * of the pool share an additional queue.
+ *
+ * Tasks are created in a @ref drgn_task_group. Waiting for a task group with
+ * @ref drgn_task_group_wait() runs queued tasks in the waiting thread until
+ * every task in the group has finished, so the thread that creates the work
+ * always helps with it, and a pool with one thread runs everything in the
+ * caller. Tasks may create more tasks in their own group or wait for nested
+ * groups.
+ *
+ * The first error returned by a task cancels its group: tasks in the group
+ * which haven't started yet are skipped, and running tasks can check @ref
+ * drgn_task_group_cancelled() to stop early.
+ *
+ * @{
+ */
+
+/** Pool of threads for running tasks. */
+struct drgn_thread_pool;
+
+/**
+ * Create a @ref drgn_thread_pool.
+ *
+ * @param[in] num_threads Number of threads which may run tasks, including the
+ * thread waiting for a @ref drgn_task_group. @c num_threads - 1 threads are
+ * started. If this is 0 or 1, no threads are started.
+ * @param[out] ret Returned pool.
+ */
+struct drgn_error *drgn_thread_pool_create(size_t num_threads,
+					   struct drgn_thread_pool **ret);
+
+/**
+ * Destroy a @ref drgn_thread_pool.
+ *
+ * There must not be any outstanding task groups.
+ */
+void drgn_thread_pool_destroy(struct drgn_thread_pool *pool);
+
+/**
+ * Get the number of threads which may run tasks in a @ref drgn_thread_pool,
+ * including a waiting thread.
+ */
+size_t drgn_thread_pool_num_threads(struct drgn_thread_pool *pool);
+
+/** Get the number of CPUs that the calling process may run on. */
+size_t drgn_num_available_cpus(void);
+
+/** Group of tasks which are waited for and cancelled together. */
+struct drgn_task_group {
+	/** @privatesection */
+	struct drgn_thread_pool *pool;
+	/* Number of tasks which have been created but haven't finished. */
+	atomic_size_t pending;
+	atomic_bool cancelled;
+	pthread_mutex_t lock;
+	/* First error. Protected by lock. */
+	struct drgn_error *err;
+};
+
+/**
+ * Task function.
+ *
+ * @param[in] group Group that the task belongs to.
+ * @param[in] arg Copy of the argument passed to @ref drgn_task_group_spawn().
+ * @return @c NULL on success, non-@c NULL on error. An error cancels @p
+ * group.
+ */
+typedef struct drgn_error *drgn_task_fn(struct drgn_task_group *group,
+					void *arg);
+
+/** Initialize an empty @ref drgn_task_group. */
+void drgn_task_group_init(struct drgn_task_group *group,
+			  struct drgn_thread_pool *pool);
+
+/**
+ * Create a task in a @ref drgn_task_group.
+ *
+ * @param[in] fn Task function.
+ * @param[in] arg Argument to copy into the task.
+ * @param[in] arg_size Size of @p arg in bytes.
+ *
+ * If the task can't be allocated, it is run immediately in the calling thread
+ * instead, so this can't fail.
+ */
+void drgn_task_group_spawn(struct drgn_task_group *group, drgn_task_fn *fn,
+			   const void *arg, size_t arg_size);
+
+/**
+ * Cancel a @ref drgn_task_group.
+ *
+ * @param[in] err Error to report. This will be returned from @ref
+ * drgn_task_group_wait(). If the group was already cancelled with an error,
+ * this error is destroyed.
+ */
+void drgn_task_group_cancel(struct drgn_task_group *group,
+			    struct drgn_error *err);
+
+/**
+ * Return whether a @ref drgn_task_group has been cancelled.
+ *
+ * This allows tasks other than the one that encountered an error to "fail
+ * fast".
+ */
+static inline bool drgn_task_group_cancelled(struct drgn_task_group *group)
+{
+	return atomic_load_explicit(&group->cancelled, memory_order_relaxed);
+}
+
+/**
+ * Wait for every task in a @ref drgn_task_group to finish and deinitialize the
+ * group.
+ *
+ * @return @c NULL if the group wasn't cancelled, the error that it was
+ * cancelled with otherwise.
+ */
+struct drgn_error *drgn_task_group_wait(struct drgn_task_group *group);
+
+/**
+ * Function called for each index by @ref drgn_thread_pool_for_each().
+ *
+ * @return @c NULL on success, non-@c NULL on error.
+ */
+typedef struct drgn_error *drgn_for_each_fn(size_t i, void *arg);
+
+/**
+ * Call a function for each index in a range in parallel and wait for all of
+ * the calls to finish.
+ *
+ * Indices are handed out dynamically, so this is suitable for items which take
+ * varying amounts of time. After the first error, no more indices are handed
+ * out.
+ *
+ * @param[in] start First index.
+ * @param[in] end One past the last index.
+ * @return @c NULL on success, the first error otherwise.
+ */
+struct drgn_error *drgn_thread_pool_for_each(struct drgn_thread_pool *pool,
+					     size_t start, size_t end,
+					     drgn_for_each_fn *fn, void *arg);
+
+/** @} */
+
+#endif /* DRGN_THREAD_POOL_H */
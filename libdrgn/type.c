@@ -332,6 +332,7 @@ static struct drgn_error *find_or_create_type(struct drgn_type *key,
 		free(type);
 		return &drgn_enomem;
 	}
+	drgn_cache_charge(&prog->types_cache);
 	*ret = type;
 	return NULL;
 }
@@ -510,6 +511,7 @@ drgn_compound_type_create(struct drgn_compound_type_builder *builder,
 		free(type);
 		return &drgn_enomem;
 	}
+	drgn_cache_charge(&builder->prog->types_cache);
 
 	drgn_type_member_vector_shrink_to_fit(&builder->members);
 
@@ -611,6 +613,7 @@ struct drgn_error *drgn_enum_type_create(struct drgn_enum_type_builder *builder,
 		free(type);
 		return &drgn_enomem;
 	}
+	drgn_cache_charge(&builder->prog->types_cache);
 
 	drgn_type_enumerator_vector_shrink_to_fit(&builder->enumerators);
 
@@ -811,6 +814,7 @@ drgn_function_type_create(struct drgn_function_type_builder *builder,
 		free(type);
 		return &drgn_enomem;
 	}
+	drgn_cache_charge(&builder->prog->types_cache);
 
 	drgn_type_parameter_vector_shrink_to_fit(&builder->parameters);
 
@@ -1359,6 +1363,40 @@ struct drgn_error *drgn_error_member_not_found(struct drgn_type *type,
 	return err;
 }
 
+static size_t drgn_program_types_cost(struct drgn_cache *cache)
+{
+	struct drgn_program *prog = container_of(cache, struct drgn_program,
+						 types_cache);
+	return (drgn_dedupe_type_set_size(&prog->dedupe_types) +
+		prog->created_types.size) *
+	       (sizeof(struct drgn_type) + sizeof(struct drgn_type *));
+}
+
+static size_t drgn_program_members_cost(struct drgn_cache *cache)
+{
+	struct drgn_program *prog = container_of(cache, struct drgn_program,
+						 members_cache);
+	return drgn_member_map_size(&prog->members) *
+	       sizeof(struct drgn_member_map_entry) +
+	       drgn_type_set_size(&prog->members_cached) *
+	       sizeof(struct drgn_type *);
+}
+
+static void drgn_program_members_shrink(struct drgn_cache *cache,
+					size_t target)
+{
+	struct drgn_program *prog = container_of(cache, struct drgn_program,
+						 members_cache);
+	/*
+	 * Members are cached a whole type at a time, so there's nothing
+	 * smaller to evict than the whole cache.
+	 */
+	drgn_member_map_deinit(&prog->members);
+	drgn_member_map_init(&prog->members);
+	drgn_type_set_deinit(&prog->members_cached);
+	drgn_type_set_init(&prog->members_cached);
+}
+
 void drgn_program_init_types(struct drgn_program *prog)
 {
 	for (size_t i = 0; i < ARRAY_SIZE(prog->void_types); i++) {
@@ -1373,10 +1411,21 @@ void drgn_program_init_types(struct drgn_program *prog)
 	drgn_typep_vector_init(&prog->created_types);
 	drgn_member_map_init(&prog->members);
 	drgn_type_set_init(&prog->members_cached);
+	/*
+	 * Objects refer to types, so they can't be evicted, but they count
+	 * toward the budget.
+	 */
+	drgn_cache_register(&prog->memory_budget, &prog->types_cache, "types",
+			    drgn_program_types_cost, NULL);
+	drgn_cache_register(&prog->memory_budget, &prog->members_cache,
+			    "members", drgn_program_members_cost,
+			    drgn_program_members_shrink);
 }
 
 void drgn_program_deinit_types(struct drgn_program *prog)
 {
+	drgn_cache_unregister(&prog->members_cache);
+	drgn_cache_unregister(&prog->types_cache);
 	drgn_member_map_deinit(&prog->members);
 	drgn_type_set_deinit(&prog->members_cached);
 
@@ -1418,6 +1467,62 @@ void drgn_program_deinit_types(struct drgn_program *prog)
 	}
 }
 
+static size_t drgn_type_memory_usage(struct drgn_type *type)
+{
+	size_t size = sizeof(*type);
+	if (drgn_type_has_members(type)) {
+		size += (drgn_type_num_members(type) *
+			 sizeof(struct drgn_type_member));
+	}
+	if (drgn_type_has_enumerators(type)) {
+		size += (drgn_type_num_enumerators(type) *
+			 sizeof(struct drgn_type_enumerator));
+	}
+	if (drgn_type_has_parameters(type)) {
+		size += (drgn_type_num_parameters(type) *
+			 sizeof(struct drgn_type_parameter));
+	}
+	return size;
+}
+
+struct drgn_error *drgn_program_types_memory_usage(struct drgn_program *prog,
+						   drgn_memory_usage_fn *fn,
+						   void *arg)
+{
+	struct drgn_error *err;
+
+	struct drgn_memory_usage created = {
+		.name = "created_types",
+		.size = (prog->created_types.capacity *
+			 sizeof(prog->created_types.data[0])),
+		.count = prog->created_types.size,
+	};
+	for (size_t i = 0; i < prog->created_types.size; i++)
+		created.size += drgn_type_memory_usage(prog->created_types.data[i]);
+	err = fn(&created, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage deduplicated = {
+		.name = "deduplicated_types",
+		.size = drgn_dedupe_type_set_memory_usage(&prog->dedupe_types),
+		.count = drgn_dedupe_type_set_size(&prog->dedupe_types),
+	};
+	deduplicated.size += deduplicated.count * sizeof(struct drgn_type);
+	err = fn(&deduplicated, arg);
+	if (err)
+		return err;
+
+	struct drgn_memory_usage members = {
+		.name = "members",
+		.size = (drgn_member_map_memory_usage(&prog->members) +
+			 drgn_type_set_memory_usage(&prog->members_cached)),
+		.count = drgn_member_map_size(&prog->members),
+		.evictions = prog->members_cache.evictions,
+	};
+	return fn(&members, arg);
+}
+
 LIBDRGN_PUBLIC struct drgn_error *
 drgn_program_add_type_finder(struct drgn_program *prog, drgn_type_find_fn fn,
 			     void *arg)
@@ -1694,7 +1799,7 @@ struct drgn_error *drgn_program_find_member(struct drgn_program *prog,
 					    struct drgn_type *type,
 					    const char *member_name,
 					    size_t member_name_len,
-					    struct drgn_member_value **ret)
+					    struct drgn_member_value *ret)
 {
 	const struct drgn_member_key key = {
 		.type = drgn_underlying_type(type),
@@ -1705,7 +1810,7 @@ struct drgn_error *drgn_program_find_member(struct drgn_program *prog,
 	struct drgn_member_map_iterator it =
 		drgn_member_map_search_hashed(&prog->members, &key, hp);
 	if (it.entry) {
-		*ret = &it.entry->value;
+		*ret = it.entry->value;
 		return NULL;
 	}
 
@@ -1728,20 +1833,29 @@ struct drgn_error *drgn_program_find_member(struct drgn_program *prog,
 					cached_hp).entry)
 		return drgn_error_member_not_found(type, member_name);
 
+	/*
+	 * Evaluating the types of unnamed members may create types, which can
+	 * make the budget shrink this cache, so hold it until we're done.
+	 */
+	drgn_cache_begin(&prog->members_cache);
 	struct drgn_error *err = drgn_program_cache_members(prog, key.type,
 							    key.type, 0);
 	if (err)
-		return err;
+		goto out;
 
 	if (drgn_type_set_insert_searched(&prog->members_cached, &key.type,
-					  cached_hp, NULL) == -1)
-		return &drgn_enomem;
-
-	it = drgn_member_map_search_hashed(&prog->members, &key, hp);
-	if (it.entry) {
-		*ret = &it.entry->value;
-		return NULL;
+					  cached_hp, NULL) == -1) {
+		err = &drgn_enomem;
+		goto out;
 	}
+	drgn_cache_charge(&prog->members_cache);
 
-	return drgn_error_member_not_found(type, member_name);
+	it = drgn_member_map_search_hashed(&prog->members, &key, hp);
+	if (it.entry)
+		*ret = it.entry->value;
+	else
+		err = drgn_error_member_not_found(type, member_name);
+out:
+	drgn_cache_end(&prog->members_cache);
+	return err;
 }
@@ -678,6 +678,13 @@ enum drgn_object_kind drgn_type_object_kind(struct drgn_type *type);
 void drgn_program_init_types(struct drgn_program *prog);
 /** Deinitialize type-related fields in a @ref drgn_program. */
 void drgn_program_deinit_types(struct drgn_program *prog);
+/**
+ * Report the memory usage of the created types, deduplicated types, and member
+ * cache of a @ref drgn_program.
+ */
+struct drgn_error *drgn_program_types_memory_usage(struct drgn_program *prog,
+						   drgn_memory_usage_fn *fn,
+						   void *arg);
 
 /**
  * Find a parsed type in a @ref drgn_program.
@@ -725,7 +732,7 @@ struct drgn_error *drgn_program_find_member(struct drgn_program *prog,
 					    struct drgn_type *type,
 					    const char *member_name,
 					    size_t member_name_len,
-					    struct drgn_member_value **ret);
+					    struct drgn_member_value *ret);
 
 /** @} */
 
@@ -0,0 +1,451 @@
+// Copyright (c) Facebook, Inc. and its affiliates.
+// SPDX-License-Identifier: GPL-3.0+
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "drgn.h"
+#include "error.h"
+#include "helpers.h"
+#include "memory_reader.h"
+#include "minmax.h"
+#include "program.h"
+#include "read_engine.h"
+#include "util.h"
+#include "vector.h"
+
+/*
+ * Locations which are at most this many bytes apart in a file are read
+ * together, since reading a few extra bytes is much cheaper than another read.
+ */
+#define DRGN_WATCH_MERGE_GAP 512
+
+struct drgn_watch_location {
+	uint64_t address;
+	uint64_t size;
+	bool physical;
+	/* Offset of the location in a sample. */
+	size_t sample_offset;
+	/*
+	 * Index of the range that the location is read from, or SIZE_MAX if it
+	 * is read with the memory reader.
+	 */
+	size_t range;
+	/*
+	 * While compiling, the file segment and offset of the location in the
+	 * file. Afterwards, the offset of the location in its range.
+	 */
+	const struct drgn_memory_file_segment *file_segment;
+	uint64_t offset;
+};
+
+/* Contiguous range of a file read by every sample. */
+struct drgn_watch_range {
+	struct drgn_read_request req;
+	bool eio_is_fault;
+	/* Address of the first location in the range, for errors. */
+	uint64_t address;
+};
+
+DEFINE_VECTOR(drgn_watch_location_vector, struct drgn_watch_location)
+DEFINE_VECTOR(drgn_watch_range_vector, struct drgn_watch_range)
+
+struct drgn_watch {
+	struct drgn_program *prog;
+	struct drgn_watch_location_vector locations;
+	struct drgn_watch_range_vector ranges;
+	bool compiled;
+	/*
+	 * Whether reads of a failed sample couldn't be cancelled, so the ranges
+	 * were leaked and the watch can't be sampled anymore.
+	 */
+	bool broken;
+	/* Engine to submit the reads of a sample with, or NULL to pread(). */
+	struct drgn_read_engine *engine;
+	/* Buffer that the ranges are read into. */
+	char *range_buf;
+	/* A sample being taken. */
+	char *scratch;
+	/* Size of a sample. */
+	size_t sample_size;
+	/*
+	 * Ring buffer of samples. Each entry is stride bytes: a uint64_t
+	 * timestamp followed by the sample.
+	 */
+	char *ring;
+	size_t capacity;
+	size_t stride;
+	/* Index of the oldest sample. */
+	size_t head;
+	size_t count;
+	struct drgn_watch_stats stats;
+};
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_watch_create(struct drgn_program *prog, size_t capacity,
+		  struct drgn_watch **ret)
+{
+	if (!capacity) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "watch capacity must be positive");
+	}
+	struct drgn_watch *watch = calloc(1, sizeof(*watch));
+	if (!watch)
+		return &drgn_enomem;
+	watch->prog = prog;
+	drgn_watch_location_vector_init(&watch->locations);
+	drgn_watch_range_vector_init(&watch->ranges);
+	watch->capacity = capacity;
+	*ret = watch;
+	return NULL;
+}
+
+LIBDRGN_PUBLIC void drgn_watch_destroy(struct drgn_watch *watch)
+{
+	if (!watch)
+		return;
+	free(watch->ring);
+	free(watch->scratch);
+	free(watch->range_buf);
+	drgn_watch_range_vector_deinit(&watch->ranges);
+	drgn_watch_location_vector_deinit(&watch->locations);
+	free(watch);
+}
+
+LIBDRGN_PUBLIC struct drgn_error *
+drgn_watch_add(struct drgn_watch *watch, uint64_t address, uint64_t size,
+	       bool physical)
+{
+	if (watch->compiled) {
+		return drgn_error_create(DRGN_ERROR_INVALID_ARGUMENT,
+					 "cannot add to watch after it was sampled");
+	}
+	uint64_t end;
+	size_t sample_size;
+	if (!size || size > SIZE_MAX ||
+	    __builtin_add_overflow(address, size, &end) ||
+	    __builtin_add_overflow(watch->sample_size, (size_t)size,
+				   &sample_size)) {
+		return drgn_error_create(DRGN_ERROR_OVERFLOW,
+					 "watched location size is invalid");
+	}
+	struct drgn_watch_location *loc =
+		drgn_watch_location_vector_append_entry(&watch->locations);
+	if (!loc)
+		return &drgn_enomem;
+	loc->address = address;
+	loc->size = size;
+	loc->physical = physical;
+	loc->sample_offset = watch->sample_size;
+	watch->sample_size = sample_size;
+	return NULL;
+}
+
+/*
+ * Find where a location is stored in a file, translating a virtual address
+ * in the Linux kernel with the page table if it isn't mapped directly.
+ */
+static bool drgn_watch_translate(struct drgn_program *prog,
+				 struct drgn_watch_location *loc)
+{
+	if (drgn_memory_reader_file_location(&prog->reader, loc->address,
+					     loc->size, loc->physical,
+					     &loc->file_segment, &loc->offset))
+		return true;
+	if (loc->physical || !(prog->flags & DRGN_PROGRAM_IS_LINUX_KERNEL))
+		return false;
+	uint64_t phys_addr, contiguous;
+	struct drgn_error *err =
+		linux_helper_translate_vm(prog, prog->vmcoreinfo.swapper_pg_dir,
+					  loc->address, &phys_addr,
+					  &contiguous);
+	if (err) {
+		drgn_error_destroy(err);
+		return false;
+	}
+	return (contiguous >= loc->size &&
+		drgn_memory_reader_file_location(&prog->reader, phys_addr,
+						 loc->size, true,
+						 &loc->file_segment,
+						 &loc->offset));
+}
+
+static int drgn_watch_location_cmp(const void *a, const void *b)
+{
+	const struct drgn_watch_location *loc1 =
+		*(struct drgn_watch_location * const *)a;
+	const struct drgn_watch_location *loc2 =
+		*(struct drgn_watch_location * const *)b;
+	if (loc1->file_segment->fd != loc2->file_segment->fd)
+		return loc1->file_segment->fd < loc2->file_segment->fd ? -1 : 1;
+	if (loc1->offset != loc2->offset)
+		return loc1->offset < loc2->offset ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Translate every location to a file offset and merge nearby locations into
+ * ranges.
+ */
+static struct drgn_error *drgn_watch_compile(struct drgn_watch *watch)
+{
+	struct drgn_error *err;
+	struct drgn_program *prog = watch->prog;
+	size_t num_locations = watch->locations.size;
+
+	struct drgn_watch_location **sorted =
+		malloc_array(num_locations, sizeof(*sorted));
+	if (!sorted && num_locations)
+		return &drgn_enomem;
+	size_t num_sorted = 0;
+	for (size_t i = 0; i < num_locations; i++) {
+		struct drgn_watch_location *loc = &watch->locations.data[i];
+		loc->range = SIZE_MAX;
+		if (drgn_watch_translate(prog, loc))
+			sorted[num_sorted++] = loc;
+	}
+	qsort(sorted, num_sorted, sizeof(*sorted), drgn_watch_location_cmp);
+
+	size_t range_buf_size = 0;
+	for (size_t i = 0; i < num_sorted; i++) {
+		struct drgn_watch_location *loc = sorted[i];
+		struct drgn_watch_range *range =
+			watch->ranges.size ?
+			&watch->ranges.data[watch->ranges.size - 1] : NULL;
+		if (range && range->req.fd == loc->file_segment->fd &&
+		    loc->offset - range->req.offset <=
+		    range->req.count + DRGN_WATCH_MERGE_GAP) {
+			uint64_t end = loc->offset + loc->size;
+			if (end - range->req.offset > range->req.count) {
+				range_buf_size += (end - range->req.offset -
+						   range->req.count);
+				range->req.count = end - range->req.offset;
+			}
+		} else {
+			range = drgn_watch_range_vector_append_entry(&watch->ranges);
+			if (!range) {
+				err = &drgn_enomem;
+				goto err;
+			}
+			memset(range, 0, sizeof(*range));
+			range->req.fd = loc->file_segment->fd;
+			range->req.offset = loc->offset;
+			range->req.count = loc->size;
+			range->eio_is_fault = loc->file_segment->eio_is_fault;
+			range->address = loc->address;
+			range_buf_size += loc->size;
+		}
+		loc->range = watch->ranges.size - 1;
+		loc->offset -= range->req.offset;
+	}
+
+	watch->range_buf = malloc(range_buf_size);
+	watch->scratch = malloc(watch->sample_size);
+	watch->stride = sizeof(uint64_t) + watch->sample_size;
+	/* Keep the timestamps aligned. */
+	watch->stride = (watch->stride + 7) & ~(size_t)7;
+	watch->ring = malloc_array(watch->capacity, watch->stride);
+	if ((!watch->range_buf && range_buf_size) ||
+	    (!watch->scratch && watch->sample_size) || !watch->ring) {
+		err = &drgn_enomem;
+		goto err;
+	}
+	range_buf_size = 0;
+	for (size_t i = 0; i < watch->ranges.size; i++) {
+		watch->ranges.data[i].req.buf = watch->range_buf + range_buf_size;
+		range_buf_size += watch->ranges.data[i].req.count;
+	}
+
+	/*
+	 * With io_uring, all of the reads are submitted with one system call.
+	 * Otherwise, the overhead of handing them to threads would outweigh
+	 * any parallelism for such small reads.
+	 */
+	if (watch->ranges.size > 1) {
+		struct drgn_read_engine *engine;
+		err = drgn_program_read_engine(prog, &engine);
+		if (err)
+			drgn_error_destroy(err);
+		else if (drgn_read_engine_uses_io_uring(engine))
+			watch->engine = engine;
+	}
+
+	watch->stats.reads_per_sample = watch->ranges.size;
+	watch->stats.untranslated = num_locations - num_sorted;
+	watch->stats.batched = watch->engine != NULL;
+	watch->compiled = true;
+	free(sorted);
+	return NULL;
+
+err:
+	free(sorted);
+	free(watch->ring);
+	watch->ring = NULL;
+	free(watch->scratch);
+	watch->scratch = NULL;
+	free(watch->range_buf);
+	watch->range_buf = NULL;
+	watch->ranges.size = 0;
+	return err;
+}
+
+static struct drgn_error *drgn_watch_read_ranges(struct drgn_watch *watch)
+{
+	struct drgn_error *err;
+
+	if (watch->engine) {
+		for (size_t i = 0; i < watch->ranges.size; i++) {
+			err = drgn_read_engine_submit(watch->engine,
+						      &watch->ranges.data[i].req);
+			if (err)
+				goto cancel;
+		}
+		err = drgn_read_engine_wait(watch->engine, SIZE_MAX);
+		if (err)
+			goto cancel;
+	} else {
+		for (size_t i = 0; i < watch->ranges.size; i++) {
+			struct drgn_read_request *req =
+				&watch->ranges.data[i].req;
+			req->done = 0;
+			req->errnum = 0;
+			while (req->done < req->count) {
+				ssize_t ret = pread(req->fd,
+						    (char *)req->buf + req->done,
+						    req->count - req->done,
+						    req->offset + req->done);
+				if (ret == -1) {
+					if (errno == EINTR)
+						continue;
+					req->errnum = errno;
+					break;
+				} else if (ret == 0) {
+					break;
+				}
+				req->done += ret;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < watch->ranges.size; i++) {
+		struct drgn_watch_range *range = &watch->ranges.data[i];
+		if (range->req.errnum == EIO && range->eio_is_fault) {
+			return drgn_error_create_fault("could not read memory",
+						       range->address);
+		} else if (range->req.errnum) {
+			return drgn_error_create_os("pread", range->req.errnum,
+						    NULL);
+		} else if (range->req.done < range->req.count) {
+			return drgn_error_create_fault("short read from memory file",
+						       range->address);
+		}
+	}
+	return NULL;
+
+cancel:
+	if (!drgn_read_engine_cancel(watch->engine)) {
+		/*
+		 * Reads may still complete into the ranges, so they can never
+		 * be freed or reused.
+		 */
+		drgn_watch_range_vector_init(&watch->ranges);
+		watch->range_buf = NULL;
+		watch->engine = NULL;
+		watch->broken = true;
+	}
+	return err;
+}
+
+static inline uint64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+LIBDRGN_PUBLIC struct drgn_error *drgn_watch_sample(struct drgn_watch *watch)
+{
+	struct drgn_error *err;
+
+	if (watch->broken) {
+		return drgn_error_create(DRGN_ERROR_OTHER,
+					 "watch reads could not be cancelled after an error");
+	}
+	if (!watch->compiled) {
+		err = drgn_watch_compile(watch);
+		if (err)
+			return err;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	err = drgn_watch_read_ranges(watch);
+	if (err)
+		return err;
+	for (size_t i = 0; i < watch->locations.size; i++) {
+		struct drgn_watch_location *loc = &watch->locations.data[i];
+		char *dst = watch->scratch + loc->sample_offset;
+		if (loc->range == SIZE_MAX) {
+			err = drgn_program_read_memory(watch->prog, dst,
+						       loc->address, loc->size,
+						       loc->physical);
+			if (err)
+				return err;
+		} else {
+			memcpy(dst,
+			       (char *)watch->ranges.data[loc->range].req.buf +
+			       loc->offset,
+			       loc->size);
+		}
+	}
+
+	size_t slot;
+	if (watch->count < watch->capacity) {
+		slot = (watch->head + watch->count++) % watch->capacity;
+	} else {
+		/* Overwrite the oldest sample. */
+		slot = watch->head;
+		watch->head = (watch->head + 1) % watch->capacity;
+		watch->stats.dropped++;
+	}
+	char *entry = watch->ring + slot * watch->stride;
+	uint64_t timestamp = timespec_to_ns(&start);
+	memcpy(entry, &timestamp, sizeof(timestamp));
+	memcpy(entry + sizeof(timestamp), watch->scratch, watch->sample_size);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	uint64_t elapsed = timespec_to_ns(&end) - timestamp;
+	watch->stats.samples++;
+	watch->stats.last_ns = elapsed;
+	watch->stats.max_ns = max(watch->stats.max_ns, elapsed);
+	watch->stats.total_ns += elapsed;
+	return NULL;
+}
+
+LIBDRGN_PUBLIC size_t drgn_watch_num_samples(struct drgn_watch *watch)
+{
+	return watch->count;
+}
+
+LIBDRGN_PUBLIC const void *drgn_watch_get_sample(struct drgn_watch *watch,
+						 size_t i,
+						 uint64_t *timestamp_ret)
+{
+	char *entry = (watch->ring +
+		       ((watch->head + i) % watch->capacity) * watch->stride);
+	memcpy(timestamp_ret, entry, sizeof(*timestamp_ret));
+	return entry + sizeof(*timestamp_ret);
+}
+
+LIBDRGN_PUBLIC void drgn_watch_clear(struct drgn_watch *watch)
+{
+	watch->head = watch->count = 0;
+}
+
+LIBDRGN_PUBLIC void drgn_watch_stats(struct drgn_watch *watch,
+				     struct drgn_watch_stats *ret)
+{
+	*ret = watch->stats;
+}
@@ -11,10 +11,12 @@ prefixes = [
     "DW_CHILDREN",
     "DW_FORM",
     "DW_LANG",
+    "DW_LNCT",
     "DW_LNE",
     "DW_LNS",
     "DW_OP",
     "DW_TAG",
+    "DW_UT",
 ]
 
 if __name__ == "__main__":
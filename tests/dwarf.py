@@ -341,6 +341,23 @@ class DW_LANG(enum.IntEnum):
             return hex(value)
 
 
+class DW_LNCT(enum.IntEnum):
+    path = 0x1
+    directory_index = 0x2
+    timestamp = 0x3
+    size = 0x4
+    MD5 = 0x5
+    lo_user = 0x2000
+    hi_user = 0x3FFF
+
+    @classmethod
+    def str(cls, value: int) -> Text:
+        try:
+            return f"DW_LNCT_{cls(value).name}"
+        except ValueError:
+            return hex(value)
+
+
 class DW_LNE(enum.IntEnum):
     end_sequence = 0x1
     set_address = 0x2
@@ -658,3 +675,21 @@ class DW_TAG(enum.IntEnum):
             return f"DW_TAG_{cls(value).name}"
         except ValueError:
             return hex(value)
+
+
+class DW_UT(enum.IntEnum):
+    compile = 0x1
+    type = 0x2
+    partial = 0x3
+    skeleton = 0x4
+    split_compile = 0x5
+    split_type = 0x6
+    lo_user = 0x80
+    hi_user = 0xFF
+
+    @classmethod
+    def str(cls, value: int) -> Text:
+        try:
+            return f"DW_UT_{cls(value).name}"
+        except ValueError:
+            return hex(value)
@@ -4,7 +4,7 @@
 from collections import namedtuple
 import os.path
 
-from tests.dwarf import DW_AT, DW_FORM, DW_TAG
+from tests.dwarf import DW_AT, DW_FORM, DW_LNCT, DW_TAG, DW_UT
 from tests.elf import ET, PT, SHT
 from tests.elfwriter import ElfSection, create_elf_file
 
@@ -35,12 +35,20 @@ def _append_sleb128(buf, value):
             buf.append(byte | 0x80)
 
 
+def _append_string(buf, value):
+    offset = len(buf)
+    buf.extend(value.encode())
+    buf.append(0)
+    return offset
+
+
 def _compile_debug_abbrev(cu_die):
     buf = bytearray()
     code = 1
+    decl_file = 1
 
     def aux(die):
-        nonlocal code
+        nonlocal code, decl_file
         _append_uleb128(buf, code)
         code += 1
         _append_uleb128(buf, die.tag)
@@ -48,6 +56,13 @@ def _compile_debug_abbrev(cu_die):
         for attrib in die.attribs:
             _append_uleb128(buf, attrib.name)
             _append_uleb128(buf, attrib.form)
+            if attrib.name == DW_AT.decl_file:
+                value = decl_file
+                decl_file += 1
+            else:
+                value = attrib.value
+            if attrib.form == DW_FORM.implicit_const:
+                _append_sleb128(buf, value)
         buf.append(0)
         buf.append(0)
         if die.children:
@@ -59,16 +74,51 @@ def _compile_debug_abbrev(cu_die):
     return buf
 
 
-def _compile_debug_info(cu_die, little_endian, bits):
+def _compile_debug_info(
+    cu_die,
+    little_endian,
+    bits,
+    version,
+    debug_str,
+    str_offsets,
+    abbrev_offset=0,
+    type_signature=None,
+    *,
+    dwo_id=None,
+    alt=None,
+    die_offsets=None,
+):
     buf = bytearray()
     byteorder = "little" if little_endian else "big"
 
     buf.extend(b"\0\0\0\0")  # unit_length
-    buf.extend((4).to_bytes(2, byteorder))  # version
-    buf.extend((0).to_bytes(4, byteorder))  # debug_abbrev_offset
-    buf.append(bits // 8)  # address_size
+    buf.extend(version.to_bytes(2, byteorder))  # version
+    if version >= 5:
+        # unit_type
+        if type_signature is not None:
+            buf.append(DW_UT.type)
+        elif cu_die.tag == DW_TAG.skeleton_unit:
+            buf.append(DW_UT.skeleton)
+        elif dwo_id is not None:
+            buf.append(DW_UT.split_compile)
+        elif cu_die.tag == DW_TAG.partial_unit:
+            buf.append(DW_UT.partial)
+        else:
+            buf.append(DW_UT.compile)
+        buf.append(bits // 8)  # address_size
+        buf.extend(abbrev_offset.to_bytes(4, byteorder))  # debug_abbrev_offset
+        if dwo_id is not None:
+            buf.extend(dwo_id.to_bytes(8, byteorder))  # dwo_id
+    else:
+        buf.extend(abbrev_offset.to_bytes(4, byteorder))  # debug_abbrev_offset
+        buf.append(bits // 8)  # address_size
+    if type_signature is not None:
+        buf.extend(type_signature.to_bytes(8, byteorder))  # type_signature
+        type_offset_offset = len(buf)
+        buf.extend(b"\0\0\0\0")  # type_offset
 
-    die_offsets = []
+    if die_offsets is None:
+        die_offsets = []
     relocations = []
     code = 1
     decl_file = 1
@@ -105,12 +155,21 @@ def _compile_debug_info(cu_die, little_endian, bits):
             elif attrib.form == DW_FORM.string:
                 buf.extend(value.encode())
                 buf.append(0)
+            elif attrib.form == DW_FORM.strx1:
+                buf.append(len(str_offsets))
+                str_offsets.append(_append_string(debug_str, value))
             elif attrib.form == DW_FORM.ref4:
                 relocations.append((len(buf), value))
                 buf.extend(b"\0\0\0\0")
+            elif attrib.form == DW_FORM.ref_sig8:
+                buf.extend(value.to_bytes(8, byteorder))
+            elif attrib.form == DW_FORM.GNU_ref_alt:
+                buf.extend(alt.die_offsets[value].to_bytes(4, byteorder))
+            elif attrib.form == DW_FORM.GNU_strp_alt:
+                buf.extend(_append_string(alt.debug_str, value).to_bytes(4, byteorder))
             elif attrib.form == DW_FORM.sec_offset:
-                buf.extend(b"\0\0\0\0")
-            elif attrib.form == DW_FORM.flag_present:
+                buf.extend(value.to_bytes(4, byteorder))
+            elif attrib.form in (DW_FORM.flag_present, DW_FORM.implicit_const):
                 pass
             elif attrib.form == DW_FORM.exprloc:
                 _append_uleb128(buf, len(value))
@@ -129,6 +188,11 @@ def _compile_debug_info(cu_die, little_endian, bits):
 
     for offset, index in relocations:
         buf[offset : offset + 4] = die_offsets[index].to_bytes(4, byteorder)
+    if type_signature is not None:
+        # The type DIE is the first child of the type unit DIE.
+        buf[type_offset_offset : type_offset_offset + 4] = die_offsets[0].to_bytes(
+            4, byteorder
+        )
     return buf
 
 
@@ -195,39 +259,307 @@ def _compile_debug_line(cu_die, little_endian):
     return buf
 
 
-def compile_dwarf(dies, little_endian=True, bits=64, *, lang=None):
+def _compile_debug_line_v5(cu_die, little_endian, bits, debug_line_str):
+    buf = bytearray()
+    byteorder = "little" if little_endian else "big"
+
+    buf.extend(b"\0\0\0\0")  # unit_length
+    buf.extend((5).to_bytes(2, byteorder))  # version
+    buf.append(bits // 8)  # address_size
+    buf.append(0)  # segment_selector_size
+    buf.extend(b"\0\0\0\0")  # header_length
+    buf.append(1)  # minimum_instruction_length
+    buf.append(1)  # maximum_operations_per_instruction
+    buf.append(1)  # default_is_stmt
+    buf.append(1)  # line_base
+    buf.append(1)  # line_range
+    buf.append(1)  # opcode_base
+    # Don't need standard_opcode_length
+
+    decl_files = []
+
+    def collect_decl_files(die):
+        for attrib in die.attribs:
+            if attrib.name == DW_AT.decl_file:
+                decl_files.append(attrib.value)
+        if die.children:
+            for child in die.children:
+                collect_decl_files(child)
+
+    collect_decl_files(cu_die)
+
+    buf.append(1)  # directory_entry_format_count
+    _append_uleb128(buf, DW_LNCT.path)
+    _append_uleb128(buf, DW_FORM.line_strp)
+    directories = ["/usr/src"] + [
+        os.path.dirname(path) for path in decl_files if os.path.dirname(path)
+    ]
+    _append_uleb128(buf, len(directories))  # directories_count
+    for directory in directories:
+        offset = _append_string(debug_line_str, directory)
+        buf.extend(offset.to_bytes(4, byteorder))
+
+    buf.append(2)  # file_name_entry_format_count
+    _append_uleb128(buf, DW_LNCT.path)
+    _append_uleb128(buf, DW_FORM.line_strp)
+    _append_uleb128(buf, DW_LNCT.directory_index)
+    _append_uleb128(buf, DW_FORM.udata)
+    # File 0 is the primary source file.
+    _append_uleb128(buf, len(decl_files) + 1)  # file_names_count
+    offset = _append_string(debug_line_str, "main.c")
+    buf.extend(offset.to_bytes(4, byteorder))
+    _append_uleb128(buf, 0)
+    directory = 1
+    for path in decl_files:
+        dirname, basename = os.path.split(path)
+        offset = _append_string(debug_line_str, basename)
+        buf.extend(offset.to_bytes(4, byteorder))
+        if dirname:
+            _append_uleb128(buf, directory)
+            directory += 1
+        else:
+            _append_uleb128(buf, 0)
+
+    unit_length = len(buf) - 4
+    buf[:4] = unit_length.to_bytes(4, byteorder)
+    header_length = unit_length - 8
+    buf[8:12] = header_length.to_bytes(4, byteorder)
+    return buf
+
+
+_AltFile = namedtuple("_AltFile", ["die_offsets", "debug_str"])
+
+
+def _compile_dwarf_sections(
+    dies, little_endian, bits, lang, version, type_units, alt=None
+):
     if isinstance(dies, DwarfDie):
         dies = (dies,)
     assert all(isinstance(die, DwarfDie) for die in dies)
+    unit_attribs = []
+    if lang is not None:
+        unit_attribs.append(DwarfAttrib(DW_AT.language, DW_FORM.data1, lang))
+    if version >= 5:
+        # Skip the .debug_str_offsets header.
+        unit_attribs.append(DwarfAttrib(DW_AT.str_offsets_base, DW_FORM.sec_offset, 8))
     cu_attribs = [
         DwarfAttrib(DW_AT.comp_dir, DW_FORM.string, "/usr/src"),
         DwarfAttrib(DW_AT.stmt_list, DW_FORM.sec_offset, 0),
+        *unit_attribs,
     ]
-    if lang is not None:
-        cu_attribs.append(DwarfAttrib(DW_AT.language, DW_FORM.data1, lang))
     cu_die = DwarfDie(DW_TAG.compile_unit, cu_attribs, dies)
 
-    return create_elf_file(
-        ET.EXEC,
-        [
-            ElfSection(p_type=PT.LOAD, vaddr=0xFFFF0000, data=b""),
+    byteorder = "little" if little_endian else "big"
+    debug_str = bytearray(b"\0")
+    str_offsets = []
+    debug_abbrev = _compile_debug_abbrev(cu_die)
+    debug_info = _compile_debug_info(
+        cu_die, little_endian, bits, version, debug_str, str_offsets, alt=alt
+    )
+    debug_types = bytearray()
+    for signature, type_die in type_units:
+        tu_die = DwarfDie(DW_TAG.type_unit, unit_attribs, (type_die,))
+        abbrev_offset = len(debug_abbrev)
+        debug_abbrev.extend(_compile_debug_abbrev(tu_die))
+        (debug_info if version >= 5 else debug_types).extend(
+            _compile_debug_info(
+                tu_die,
+                little_endian,
+                bits,
+                version,
+                debug_str,
+                str_offsets,
+                abbrev_offset,
+                signature,
+            )
+        )
+    sections = [
+        ElfSection(p_type=PT.LOAD, vaddr=0xFFFF0000, data=b""),
+        ElfSection(name=".debug_abbrev", sh_type=SHT.PROGBITS, data=debug_abbrev),
+        ElfSection(name=".debug_info", sh_type=SHT.PROGBITS, data=debug_info),
+    ]
+    if debug_types:
+        sections.append(
+            ElfSection(name=".debug_types", sh_type=SHT.PROGBITS, data=debug_types)
+        )
+    if version >= 5:
+        debug_line_str = bytearray()
+        sections.append(
             ElfSection(
-                name=".debug_abbrev",
+                name=".debug_line",
                 sh_type=SHT.PROGBITS,
-                data=_compile_debug_abbrev(cu_die),
-            ),
+                data=_compile_debug_line_v5(
+                    cu_die, little_endian, bits, debug_line_str
+                ),
+            )
+        )
+        sections.append(
+            ElfSection(
+                name=".debug_line_str", sh_type=SHT.PROGBITS, data=debug_line_str
+            )
+        )
+        debug_str_offsets = bytearray()
+        debug_str_offsets.extend((4 + 4 * len(str_offsets)).to_bytes(4, byteorder))
+        debug_str_offsets.extend((5).to_bytes(2, byteorder))  # version
+        debug_str_offsets.extend(b"\0\0")  # padding
+        for offset in str_offsets:
+            debug_str_offsets.extend(offset.to_bytes(4, byteorder))
+        sections.append(
             ElfSection(
-                name=".debug_info",
+                name=".debug_str_offsets",
                 sh_type=SHT.PROGBITS,
-                data=_compile_debug_info(cu_die, little_endian, bits),
-            ),
+                data=debug_str_offsets,
+            )
+        )
+    else:
+        sections.append(
             ElfSection(
                 name=".debug_line",
                 sh_type=SHT.PROGBITS,
                 data=_compile_debug_line(cu_die, little_endian),
-            ),
-            ElfSection(name=".debug_str", sh_type=SHT.PROGBITS, data=b"\0"),
-        ],
+            )
+        )
+    sections.append(ElfSection(name=".debug_str", sh_type=SHT.PROGBITS, data=debug_str))
+    return sections
+
+
+# type_units is a sequence of (signature, DwarfDie) pairs. Each DIE is placed in
+# a type unit with the given signature so that it can be referenced with
+# DW_FORM.ref_sig8. Type units go in .debug_types before DWARF 5 and in
+# .debug_info as of DWARF 5.
+def compile_dwarf(
+    dies, little_endian=True, bits=64, *, lang=None, version=4, type_units=()
+):
+    return create_elf_file(
+        ET.EXEC,
+        _compile_dwarf_sections(dies, little_endian, bits, lang, version, type_units),
         little_endian=little_endian,
         bits=bits,
     )
+
+
+def _compile_build_id_note(build_id, little_endian):
+    byteorder = "little" if little_endian else "big"
+    buf = bytearray()
+    buf.extend((4).to_bytes(4, byteorder))  # n_namesz
+    buf.extend(len(build_id).to_bytes(4, byteorder))  # n_descsz
+    buf.extend((3).to_bytes(4, byteorder))  # n_type = NT_GNU_BUILD_ID
+    buf.extend(b"GNU\0")
+    buf.extend(build_id)
+    buf.extend(bytes(-len(build_id) % 4))
+    return buf
+
+
+# Compile a debug file as processed by dwz along with its alternate file, which
+# contains alt_dies in a partial unit. In dies, DW_FORM.GNU_ref_alt refers to
+# the alt_dies by index, and the value of a DW_FORM.GNU_strp_alt attribute is
+# placed in the alternate .debug_str. The debug file refers to the alternate
+# file by alt_name, which is resolved relative to the directory containing the
+# debug file. Returns a (debug file, alternate file) pair.
+def compile_dwz_dwarf(
+    dies,
+    alt_dies,
+    alt_name,
+    little_endian=True,
+    bits=64,
+    *,
+    lang=None,
+    build_id=bytes(range(20)),
+):
+    if isinstance(alt_dies, DwarfDie):
+        alt_dies = (alt_dies,)
+    pu_die = DwarfDie(DW_TAG.partial_unit, (), alt_dies)
+    alt = _AltFile([], bytearray(b"\0"))
+    alt_debug_abbrev = _compile_debug_abbrev(pu_die)
+    alt_debug_info = _compile_debug_info(
+        pu_die,
+        little_endian,
+        bits,
+        4,
+        alt.debug_str,
+        [],
+        die_offsets=alt.die_offsets,
+    )
+
+    sections = _compile_dwarf_sections(dies, little_endian, bits, lang, 4, (), alt)
+    sections.append(
+        ElfSection(
+            name=".gnu_debugaltlink",
+            sh_type=SHT.PROGBITS,
+            data=alt_name.encode() + b"\0" + build_id,
+        )
+    )
+    alt_sections = [
+        ElfSection(
+            name=".note.gnu.build-id",
+            sh_type=SHT.NOTE,
+            data=_compile_build_id_note(build_id, little_endian),
+        ),
+        ElfSection(name=".debug_abbrev", sh_type=SHT.PROGBITS, data=alt_debug_abbrev),
+        ElfSection(name=".debug_info", sh_type=SHT.PROGBITS, data=alt_debug_info),
+        ElfSection(name=".debug_str", sh_type=SHT.PROGBITS, data=alt.debug_str),
+    ]
+    return (
+        create_elf_file(ET.EXEC, sections, little_endian=little_endian, bits=bits),
+        create_elf_file(ET.EXEC, alt_sections, little_endian=little_endian, bits=bits),
+    )
+
+
+# Compile a DWARF 5 skeleton unit and the split DWARF object file containing
+# dies. The skeleton unit refers to the object file by dwo_name, which is
+# resolved relative to the directory containing the skeleton file. Returns a
+# (skeleton file, split DWARF object file) pair.
+def compile_split_dwarf(
+    dies, dwo_name, little_endian=True, bits=64, *, lang=None, dwo_id=0x1234ABCD
+):
+    if isinstance(dies, DwarfDie):
+        dies = (dies,)
+    skeleton_die = DwarfDie(
+        DW_TAG.skeleton_unit,
+        (
+            DwarfAttrib(DW_AT.comp_dir, DW_FORM.string, "/usr/src"),
+            DwarfAttrib(DW_AT.dwo_name, DW_FORM.string, dwo_name),
+        ),
+    )
+    split_attribs = []
+    if lang is not None:
+        split_attribs.append(DwarfAttrib(DW_AT.language, DW_FORM.data1, lang))
+    split_die = DwarfDie(DW_TAG.compile_unit, split_attribs, dies)
+
+    debug_str = bytearray(b"\0")
+    sections = [
+        ElfSection(p_type=PT.LOAD, vaddr=0xFFFF0000, data=b""),
+        ElfSection(
+            name=".debug_abbrev",
+            sh_type=SHT.PROGBITS,
+            data=_compile_debug_abbrev(skeleton_die),
+        ),
+        ElfSection(
+            name=".debug_info",
+            sh_type=SHT.PROGBITS,
+            data=_compile_debug_info(
+                skeleton_die, little_endian, bits, 5, debug_str, [], dwo_id=dwo_id
+            ),
+        ),
+        ElfSection(name=".debug_str", sh_type=SHT.PROGBITS, data=debug_str),
+    ]
+    dwo_debug_str = bytearray(b"\0")
+    dwo_sections = [
+        ElfSection(
+            name=".debug_abbrev.dwo",
+            sh_type=SHT.PROGBITS,
+            data=_compile_debug_abbrev(split_die),
+        ),
+        ElfSection(
+            name=".debug_info.dwo",
+            sh_type=SHT.PROGBITS,
+            data=_compile_debug_info(
+                split_die, little_endian, bits, 5, dwo_debug_str, [], dwo_id=dwo_id
+            ),
+        ),
+        ElfSection(name=".debug_str.dwo", sh_type=SHT.PROGBITS, data=dwo_debug_str),
+    ]
+    return (
+        create_elf_file(ET.EXEC, sections, little_endian=little_endian, bits=bits),
+        create_elf_file(ET.REL, dwo_sections, little_endian=little_endian, bits=bits),
+    )
@@ -113,7 +113,7 @@ def create_elf_file(
             shdr_struct.pack_into(
                 buf,
                 shdr_offset,
-                shstrtab.data.index(section.name.encode()),  # sh_name
+                shstrtab.data.index(section.name.encode() + b"\0"),  # sh_name
                 section.sh_type,  # sh_type
                 0,  # sh_flags
                 section.vaddr,  # sh_addr
@@ -3,21 +3,24 @@
 
 import errno
 from fcntl import ioctl
+import mmap
 import os
 import os.path
 import sys
 import tempfile
+import threading
 
 from drgn.helpers.linux.block import (
     disk_devt,
     disk_name,
     for_each_disk,
     for_each_partition,
+    inflight_requests,
     part_devt,
     part_name,
 )
 from drgn.helpers.linux.device import MAJOR, MINOR, MKDEV
-from tests.helpers.linux import LinuxHelperTestCase
+from tests.helpers.linux import LinuxHelperTestCase, wait_until
 
 LOOP_SET_FD = 0x4C00
 LOOP_SET_STATUS64 = 0x4C04
@@ -26,12 +29,14 @@ LOOP_CTL_GET_FREE = 0x4C82
 
 LO_FLAGS_AUTOCLEAR = 4
 
+LOOP_SIZE = 1024 * 1024 * 1024
+
 
 class TestBlock(LinuxHelperTestCase):
     @staticmethod
     def _losetup():
         with tempfile.TemporaryFile() as temp:
-            os.truncate(temp.fileno(), 1024 * 1024 * 1024)
+            os.truncate(temp.fileno(), LOOP_SIZE)
             with open("/dev/loop-control", "r") as loop_control:
                 while True:
                     index = ioctl(loop_control.fileno(), LOOP_CTL_GET_FREE)
@@ -123,3 +128,49 @@ class TestBlock(LinuxHelperTestCase):
         else:
             self.fail("loop partition not found")
         self.assertEqual(part_name(part), os.path.basename(self.loop.name).encode())
+
+    def test_inflight_requests(self):
+        if not self.loop:
+            self.skipTest("could not create loop device")
+        rdev = os.stat(self.loop.fileno()).st_rdev
+        devt = MKDEV(os.major(rdev), os.minor(rdev))
+
+        # Keep the loop device busy with direct reads so that there are
+        # requests in flight.
+        stop = threading.Event()
+
+        def read_loop():
+            fd = os.open(self.loop.name, os.O_RDONLY | os.O_DIRECT)
+            try:
+                buf = mmap.mmap(-1, 1024 * 1024)
+                offset = 0
+                while not stop.is_set():
+                    os.lseek(fd, offset, os.SEEK_SET)
+                    os.readv(fd, [buf])
+                    offset = (offset + len(buf)) % LOOP_SIZE
+            finally:
+                os.close(fd)
+
+        threads = [threading.Thread(target=read_loop) for _ in range(4)]
+        for thread in threads:
+            thread.start()
+        try:
+            found = []
+
+            def find_loop_requests():
+                for request in inflight_requests(self.prog):
+                    # The request may complete while we look at it, so only
+                    # check fields that don't change.
+                    self.assertEqual(request.rq.q, request.disk.queue)
+                    self.assertEqual(request.hctx.queue_num, request.hctx_index)
+                    if disk_devt(request.disk) == devt:
+                        found.append(request)
+                return found
+
+            wait_until(find_loop_requests)
+        finally:
+            stop.set()
+            for thread in threads:
+                thread.join()
+        for request in found:
+            self.assertLessEqual(request.sector * 512 + request.size, LOOP_SIZE)
@@ -0,0 +1,196 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import ctypes
+import os
+import platform
+import struct
+
+from drgn import cast
+from drgn.helpers.linux.bpf import bpf_map_items
+from drgn.helpers.linux.fs import fget
+from drgn.helpers.linux.pid import find_task
+from tests.helpers.linux import LinuxHelperTestCase
+
+_SYS_bpf = {
+    "aarch64": 280,
+    "ppc64le": 361,
+    "s390x": 351,
+    "x86_64": 321,
+}.get(platform.machine())
+
+_syscall = ctypes.CDLL(None, use_errno=True).syscall
+_syscall.restype = ctypes.c_long
+
+BPF_MAP_CREATE = 0
+BPF_MAP_LOOKUP_ELEM = 1
+BPF_MAP_UPDATE_ELEM = 2
+
+BPF_MAP_TYPE_HASH = 1
+BPF_MAP_TYPE_ARRAY = 2
+BPF_MAP_TYPE_PERCPU_HASH = 5
+BPF_MAP_TYPE_PERCPU_ARRAY = 6
+BPF_MAP_TYPE_LRU_HASH = 9
+BPF_MAP_TYPE_LRU_PERCPU_HASH = 10
+
+PERCPU_MAP_TYPES = {
+    BPF_MAP_TYPE_PERCPU_HASH,
+    BPF_MAP_TYPE_PERCPU_ARRAY,
+    BPF_MAP_TYPE_LRU_PERCPU_HASH,
+}
+
+
+def _bpf(cmd, attr):
+    # union bpf_attr must be zero-padded to the size the kernel expects.
+    buf = ctypes.create_string_buffer(attr, 128)
+    ret = _syscall(_SYS_bpf, cmd, buf, len(buf))
+    if ret == -1:
+        errno = ctypes.get_errno()
+        raise OSError(errno, os.strerror(errno))
+    return ret
+
+
+def _bpf_elem(cmd, fd, key, value):
+    key_buf = ctypes.create_string_buffer(key, len(key))
+    value_buf = ctypes.create_string_buffer(value, len(value))
+    _bpf(
+        cmd,
+        struct.pack(
+            "=IIQQQ",
+            fd,
+            0,
+            ctypes.addressof(key_buf),
+            ctypes.addressof(value_buf),
+            0,
+        ),
+    )
+    return value_buf.raw
+
+
+def num_possible_cpus():
+    with open("/sys/devices/system/cpu/possible", "r") as f:
+        return max(int(cpus.split("-")[-1]) for cpus in f.read().split(",")) + 1
+
+
+class TestBpf(LinuxHelperTestCase):
+    KEY_SIZE = 4
+    VALUE_SIZE = 12
+    MAX_ENTRIES = 64
+
+    def setUp(self):
+        super().setUp()
+        if _SYS_bpf is None:
+            self.skipTest(f"bpf syscall number unknown for {platform.machine()}")
+        self.num_cpus = num_possible_cpus()
+
+    def create_map(self, map_type):
+        try:
+            fd = _bpf(
+                BPF_MAP_CREATE,
+                struct.pack(
+                    "=IIII",
+                    map_type,
+                    self.KEY_SIZE,
+                    self.VALUE_SIZE,
+                    self.MAX_ENTRIES,
+                ),
+            )
+        except OSError as e:
+            self.skipTest(f"could not create BPF map: {e}")
+        self.addCleanup(os.close, fd)
+        return fd
+
+    def value_size(self, map_type):
+        if map_type in PERCPU_MAP_TYPES:
+            return ((self.VALUE_SIZE + 7) & ~7) * self.num_cpus
+        return self.VALUE_SIZE
+
+    def update(self, fd, map_type, key, value):
+        if map_type in PERCPU_MAP_TYPES:
+            # Give each CPU a different value.
+            stride = (self.VALUE_SIZE + 7) & ~7
+            value = b"".join(
+                struct.pack(
+                    "=III", *(x + cpu for x in struct.unpack("=III", value))
+                ).ljust(stride, b"\0")
+                for cpu in range(self.num_cpus)
+            )
+        _bpf_elem(BPF_MAP_UPDATE_ELEM, fd, key, value)
+
+    def lookup(self, fd, map_type, key):
+        return _bpf_elem(BPF_MAP_LOOKUP_ELEM, fd, key, bytes(self.value_size(map_type)))
+
+    def bpf_map(self, fd):
+        file = fget(find_task(self.prog, os.getpid()), fd)
+        return cast("struct bpf_map *", file.private_data)
+
+    def _test_map(self, map_type):
+        fd = self.create_map(map_type)
+        is_array = map_type in (BPF_MAP_TYPE_ARRAY, BPF_MAP_TYPE_PERCPU_ARRAY)
+        if is_array:
+            keys = range(self.MAX_ENTRIES)
+        else:
+            keys = range(0, 3 * self.MAX_ENTRIES // 2, 3)
+        for i in keys:
+            self.update(
+                fd,
+                map_type,
+                struct.pack("=I", i),
+                struct.pack("=III", i, i * i, 0xDEADBEEF),
+            )
+
+        # LRU maps may evict entries before they are full, so compare against
+        # whatever lookups find.
+        expected = {}
+        for i in keys:
+            key = struct.pack("=I", i)
+            try:
+                expected[key] = self.lookup(fd, map_type, key)
+            except FileNotFoundError:
+                pass
+        self.assertTrue(expected)
+
+        items = list(bpf_map_items(self.bpf_map(fd)))
+        self.assertEqual(len(items), len(expected))
+        self.assertEqual(dict(items), expected)
+
+        if map_type in PERCPU_MAP_TYPES:
+            for key, value in bpf_map_items(self.bpf_map(fd), sum_percpu=4):
+                i = struct.unpack("=I", key)[0]
+                offset = self.num_cpus * (self.num_cpus - 1) // 2
+                self.assertEqual(
+                    value,
+                    struct.pack(
+                        "=III",
+                        *(
+                            (x * self.num_cpus + offset) & 0xFFFFFFFF
+                            for x in (i, i * i, 0xDEADBEEF)
+                        ),
+                    ),
+                )
+
+    def test_hash(self):
+        self._test_map(BPF_MAP_TYPE_HASH)
+
+    def test_array(self):
+        self._test_map(BPF_MAP_TYPE_ARRAY)
+
+    def test_percpu_hash(self):
+        self._test_map(BPF_MAP_TYPE_PERCPU_HASH)
+
+    def test_percpu_array(self):
+        self._test_map(BPF_MAP_TYPE_PERCPU_ARRAY)
+
+    def test_lru_hash(self):
+        self._test_map(BPF_MAP_TYPE_LRU_HASH)
+
+    def test_lru_percpu_hash(self):
+        self._test_map(BPF_MAP_TYPE_LRU_PERCPU_HASH)
+
+    def test_unsupported(self):
+        # BPF_MAP_TYPE_PROG_ARRAY
+        fd = _bpf(BPF_MAP_CREATE, struct.pack("=IIII", 3, 4, 4, 1))
+        self.addCleanup(os.close, fd)
+        self.assertRaisesRegex(
+            ValueError, "unsupported BPF map type", bpf_map_items, self.bpf_map(fd)
+        )
@@ -0,0 +1,73 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import os
+import signal
+
+from drgn.helpers.linux.deadlock import (
+    blocked_tasks,
+    find_deadlocks,
+    longest_wait_chains,
+)
+from drgn.helpers.linux.sched import task_state_to_char
+from tests.helpers.linux import LinuxHelperTestCase, proc_state, wait_until
+
+
+def fork_and_read(fd):
+    pid = os.fork()
+    if pid == 0:
+        try:
+            os.read(fd, 1)
+        finally:
+            os._exit(1)
+    return pid
+
+
+class TestDeadlock(LinuxHelperTestCase):
+    def test_blocked_tasks(self):
+        graph = blocked_tasks(self.prog, interruptible=True)
+        self.assertTrue(graph)
+        # Other blocked tasks may wake up after the graph is built, so only
+        # check the graph against itself.
+        for blocked in graph:
+            if blocked.waits_for is not None:
+                self.assertEqual(blocked.waits_for.task, blocked.owner)
+        # A live system shouldn't be deadlocked.
+        self.assertEqual(find_deadlocks(graph), [])
+        for chain in longest_wait_chains(graph):
+            for a, b in zip(chain, chain[1:]):
+                self.assertIs(a.waits_for, b)
+
+    def test_wait_chain(self):
+        # n_tty_read() holds the tty's atomic_read_lock mutex while it waits for
+        # input, so a second reader blocks on the mutex owned by the first.
+        master, slave = os.openpty()
+        pids = []
+        try:
+            for _ in range(2):
+                pids.append(fork_and_read(slave))
+                wait_until(lambda: proc_state(pids[-1]) == "S")
+            owner_pid, waiter_pid = pids
+
+            graph = blocked_tasks(self.prog, interruptible=True)
+            by_pid = {blocked.task.pid.value_(): blocked for blocked in graph}
+            owner = by_pid[owner_pid]
+            waiter = by_pid[waiter_pid]
+
+            # Our readers stay blocked, so their states can be checked.
+            self.assertEqual(task_state_to_char(owner.task), "S")
+            self.assertEqual(task_state_to_char(waiter.task), "S")
+            self.assertEqual(waiter.lock_type, "mutex")
+            self.assertIsNotNone(waiter.lock)
+            self.assertEqual(waiter.owner, owner.task)
+            self.assertIs(waiter.waits_for, owner)
+            self.assertEqual(waiter.chain_length, 1)
+            self.assertFalse(waiter.in_cycle)
+            self.assertIsNone(owner.waits_for)
+            self.assertIn([waiter, owner], longest_wait_chains(graph, len(graph)))
+        finally:
+            for pid in pids:
+                os.kill(pid, signal.SIGKILL)
+                os.waitpid(pid, 0)
+            os.close(master)
+            os.close(slave)
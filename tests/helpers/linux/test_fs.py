@@ -7,8 +7,10 @@ import tempfile
 
 from drgn.helpers.linux.fs import (
     d_path,
+    d_paths,
     dentry_path,
     fget,
+    find_open_files,
     for_each_file,
     for_each_mount,
     inode_path,
@@ -42,6 +44,26 @@ class TestFs(LinuxHelperTestCase):
         task = find_task(self.prog, os.getpid())
         self.assertEqual(d_path(task.fs.pwd.address_of_()), os.fsencode(os.getcwd()))
 
+    def test_d_paths(self):
+        with tempfile.TemporaryDirectory(prefix="drgn-tests-") as dir:
+            paths = [
+                os.fsencode(os.path.abspath(os.path.join(dir, name)))
+                for name in ("a", "b", "c")
+            ]
+            files = [open(path, "w") for path in paths]
+            try:
+                task = find_task(self.prog, os.getpid())
+                f_paths = [fget(task, f.fileno()).f_path for f in files]
+                self.assertEqual(d_paths(f_paths), paths)
+                self.assertEqual(
+                    d_paths(f_path.address_of_() for f_path in f_paths), paths
+                )
+                self.assertEqual(d_paths([task.fs.root]), [b"/"])
+                self.assertEqual(d_paths([]), [])
+            finally:
+                for f in files:
+                    f.close()
+
     def test_dentry_path(self):
         pwd = os.fsencode(os.getcwd())
         task = find_task(self.prog, os.getpid())
@@ -84,3 +106,34 @@ class TestFs(LinuxHelperTestCase):
                 {fd for fd, file in for_each_file(task)},
                 {int(entry.name) for entry in dir},
             )
+
+    def test_find_open_files(self):
+        with tempfile.NamedTemporaryFile(prefix="drgn-tests-") as f:
+            task = find_task(self.prog, os.getpid())
+            file = fget(task, f.fileno())
+            inode = file.f_inode
+            expected = (os.getpid(), f.fileno(), file.value_())
+            for kwds in (
+                {"inode": inode},
+                {"super_block": inode.i_sb},
+                {"f_op": file.f_op},
+                {"inode": inode, "f_op": file.f_op},
+            ):
+                with self.subTest(**{key: hex(value) for key, value in kwds.items()}):
+                    found = [
+                        (t.tgid.value_(), fd, open_file.value_())
+                        for t, fd, open_file in find_open_files(self.prog, **kwds)
+                    ]
+                    self.assertIn(expected, found)
+            self.assertEqual(
+                [
+                    (fd, open_file.value_())
+                    for _, fd, open_file in find_open_files(
+                        self.prog, [task], inode=inode
+                    )
+                ],
+                [(f.fileno(), file.value_())],
+            )
+            self.assertEqual(
+                find_open_files(self.prog, [task], f_op=file.f_op + 1), []
+            )
@@ -0,0 +1,112 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import io
+import os
+import tempfile
+import time
+
+from drgn.helpers.linux.ftrace import (
+    ftrace_events,
+    ftrace_lines,
+    ftrace_write_trace_dat,
+)
+from tests.helpers.linux import LinuxHelperTestCase, mount, umount
+
+
+class TestFtrace(LinuxHelperTestCase):
+    def setUp(self):
+        super().setUp()
+        try:
+            self.prog["global_trace"]
+        except KeyError:
+            self.skipTest("kernel not built with CONFIG_TRACING")
+        self.tracefs = self.find_tracefs()
+
+    def find_tracefs(self):
+        for path in ("/sys/kernel/tracing", "/sys/kernel/debug/tracing"):
+            if os.path.exists(os.path.join(path, "trace_marker")):
+                return path
+        path = tempfile.mkdtemp()
+        self.addCleanup(os.rmdir, path)
+        try:
+            mount("tracefs", path, "tracefs", 0, "")
+        except OSError as e:
+            self.skipTest(f"could not mount tracefs: {e}")
+        self.addCleanup(umount, path)
+        return path
+
+    def write_markers(self):
+        # Write two markers from one CPU so that we know where to find them and
+        # how far apart their timestamps are.
+        cpu = min(os.sched_getaffinity(0))
+        markers = [
+            f"drgn test {os.getpid()} {time.monotonic_ns()} {i}".encode()
+            for i in range(2)
+        ]
+        tracing_on = os.path.join(self.tracefs, "tracing_on")
+        with open(tracing_on, "r") as f:
+            old_tracing_on = f.read()
+        old_affinity = os.sched_getaffinity(0)
+        try:
+            with open(tracing_on, "w") as f:
+                f.write("1")
+            os.sched_setaffinity(0, {cpu})
+            fd = os.open(os.path.join(self.tracefs, "trace_marker"), os.O_WRONLY)
+            try:
+                os.write(fd, markers[0])
+                time.sleep(0.01)
+                os.write(fd, markers[1])
+            finally:
+                os.close(fd)
+        finally:
+            os.sched_setaffinity(0, old_affinity)
+            with open(tracing_on, "w") as f:
+                f.write(old_tracing_on)
+        return cpu, markers
+
+    def test_ftrace_events(self):
+        cpu, markers = self.write_markers()
+        events = list(ftrace_events(self.prog))
+
+        prev = {}
+        last = 0
+        for event_cpu, timestamp, name, data in events:
+            self.assertGreaterEqual(timestamp, last)
+            self.assertGreaterEqual(timestamp, prev.get(event_cpu, 0))
+            last = prev[event_cpu] = timestamp
+            self.assertIsInstance(data, bytes)
+
+        found = []
+        for marker in markers:
+            matches = [
+                event for event in events if event[2] == "print" and marker in event[3]
+            ]
+            self.assertEqual(len(matches), 1)
+            found.append(matches[0])
+        for event in found:
+            self.assertEqual(event[0], cpu)
+        timestamps = [event[1] for event in found]
+        self.assertGreater(timestamps[0], 0)
+        self.assertGreaterEqual(timestamps[1] - timestamps[0], 10 * 1000 * 1000)
+        self.assertLess(timestamps[1] - timestamps[0], 60 * 1000 * 1000 * 1000)
+
+    def test_ftrace_lines(self):
+        cpu, markers = self.write_markers()
+        lines = list(ftrace_lines(self.prog))
+        for marker in markers:
+            matches = [line for line in lines if marker.decode() in line]
+            self.assertEqual(len(matches), 1)
+            self.assertIn(f" {os.getpid()} [{cpu:03}] ", matches[0])
+            self.assertIn(" print:", matches[0])
+
+    def test_ftrace_write_trace_dat(self):
+        cpu, markers = self.write_markers()
+        f = io.BytesIO()
+        ftrace_write_trace_dat(self.prog, f)
+        data = f.getvalue()
+        self.assertTrue(data.startswith(b"\x17\x08\x44tracing6\0"))
+        # The page containing the events is copied after the header.
+        header_end = data.index(b"flyrecord\0")
+        for marker in markers:
+            self.assertGreater(data.find(marker), header_end)
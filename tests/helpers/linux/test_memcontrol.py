@@ -0,0 +1,49 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import mmap
+
+from drgn.helpers.linux.memcontrol import (
+    for_each_mem_cgroup,
+    memcg_lru_sizes,
+    memcg_page_usage,
+)
+from tests.helpers.linux import LinuxHelperTestCase
+
+
+class TestMemcontrol(LinuxHelperTestCase):
+    def setUp(self):
+        super().setUp()
+        try:
+            self.prog["root_mem_cgroup"]
+        except KeyError:
+            self.skipTest("kernel does not have memory cgroups")
+
+    def test_memcg_lru_sizes(self):
+        memcgs = list(for_each_mem_cgroup(self.prog))
+        self.assertEqual(memcgs[0], self.prog["root_mem_cgroup"])
+        sizes = memcg_lru_sizes(self.prog, memcgs)
+        self.assertEqual([size.memcg for size in sizes], memcgs)
+        for size in sizes:
+            for node in size.nodes:
+                self.assertIn("inactive_file", node)
+                self.assertIn("unevictable", node)
+        self.assertTrue(
+            any(sum(node.values()) for size in sizes for node in size.nodes)
+        )
+
+    def test_memcg_page_usage(self):
+        with mmap.mmap(-1, 16 * mmap.PAGESIZE) as map:
+            map.write(b"x" * len(map))
+            usage = memcg_page_usage(self.prog, max_inodes=3)
+        totals = [u.anon + u.file + u.slab + u.unevictable for u in usage]
+        self.assertEqual(totals, sorted(totals, reverse=True))
+        self.assertLessEqual(sum(totals), self.prog["max_pfn"].value_())
+        self.assertGreater(sum(u.anon for u in usage), 0)
+        self.assertGreater(sum(u.file for u in usage), 0)
+        for u in usage:
+            self.assertLessEqual(len(u.inodes), 3)
+            pages = [pages for _, pages in u.inodes]
+            self.assertEqual(pages, sorted(pages, reverse=True))
+            for inode, _ in u.inodes:
+                self.assertEqual(inode.type_.type_name(), "struct inode *")
@@ -6,6 +6,7 @@ import ctypes
 import mmap
 import os
 import platform
+import signal
 import struct
 import tempfile
 import unittest
@@ -20,9 +21,11 @@ from drgn.helpers.linux.mm import (
     pfn_to_page,
     pfn_to_virt,
     virt_to_pfn,
+    vmalloc_callers,
+    vmap_areas,
 )
 from drgn.helpers.linux.pid import find_task
-from tests.helpers.linux import LinuxHelperTestCase, mlock
+from tests.helpers.linux import LinuxHelperTestCase, fork_and_pause, mlock
 
 
 class TestMm(LinuxHelperTestCase):
@@ -128,3 +131,66 @@ class TestMm(LinuxHelperTestCase):
             proc_environ = f.read().split(b"\0")[:-1]
         task = find_task(self.prog, os.getpid())
         self.assertEqual(environ(task), proc_environ)
+
+    def test_vmap_areas(self):
+        areas = vmap_areas(self.prog)
+        self.assertTrue(areas)
+        for prev, area in zip(areas, areas[1:]):
+            self.assertLessEqual(prev.start + prev.size, area.start)
+        # Areas are freed and reused while the test runs, so only check the
+        # snapshot against itself here.
+        for area in areas:
+            if area.symbol is not None:
+                self.assertLessEqual(area.symbol.address, area.caller)
+                self.assertLess(area.caller, area.symbol.address + area.symbol.size)
+            self.assertIsNone(area.mapped_pages)
+
+        # /proc/vmallocinfo can change between reads, so only check that most
+        # of the areas it lists were found.
+        with open("/proc/vmallocinfo", "r") as f:
+            starts = {int(line.split("-", 1)[0], 16) for line in f}
+        found = {area.start for area in areas}
+        self.assertGreaterEqual(len(starts & found), 0.9 * len(starts))
+
+    def test_vmap_areas_stack(self):
+        # With CONFIG_VMAP_STACK, the stack of a task is a vmalloc area that
+        # lasts as long as the task.
+        pid = fork_and_pause()
+        try:
+            task = find_task(self.prog, pid)
+            try:
+                vm = task.stack_vm_area
+            except AttributeError:
+                self.skipTest("kernel not built with CONFIG_VMAP_STACK")
+            vm_addr = vm.value_()
+            start = vm.addr.value_()
+            caller = vm.caller.value_()
+            nr_pages = vm.nr_pages.value_()
+            areas = vmap_areas(self.prog)
+        finally:
+            os.kill(pid, signal.SIGKILL)
+            os.waitpid(pid, 0)
+
+        matches = [area for area in areas if area.vm.value_() == vm_addr]
+        self.assertEqual(len(matches), 1)
+        area = matches[0]
+        self.assertEqual(area.start, start)
+        self.assertGreaterEqual(area.size, nr_pages * mmap.PAGESIZE)
+        self.assertEqual(area.caller, caller)
+        self.assertEqual(area.nr_pages, nr_pages)
+
+    @unittest.skipUnless(platform.machine() == "x86_64", "machine is not x86_64")
+    def test_vmap_areas_validate(self):
+        for area in vmap_areas(self.prog, validate=True):
+            self.assertIsNotNone(area.mapped_pages)
+            self.assertLessEqual(area.mapped_pages * mmap.PAGESIZE, area.size)
+
+    def test_vmalloc_callers(self):
+        callers = vmalloc_callers(self.prog)
+        self.assertTrue(callers)
+        for prev, caller in zip(callers, callers[1:]):
+            self.assertGreaterEqual(prev.size, caller.size)
+        for caller in callers:
+            self.assertGreater(caller.count, 0)
+            self.assertGreaterEqual(caller.size, caller.nr_pages * mmap.PAGESIZE)
+        self.assertTrue(any(caller.symbol is not None for caller in callers))
@@ -7,7 +7,7 @@ import signal
 import unittest
 
 from drgn.helpers.linux.pid import find_task
-from drgn.helpers.linux.sched import task_state_to_char
+from drgn.helpers.linux.sched import runqueue_snapshot, task_state_to_char
 from tests.helpers.linux import (
     LinuxHelperTestCase,
     fork_and_pause,
@@ -41,6 +41,41 @@ class TestSched(LinuxHelperTestCase):
 
         os.waitpid(pid, 0)
 
+    def test_runqueue_snapshot(self):
+        task = find_task(self.prog, os.getpid())
+        snapshot = runqueue_snapshot(self.prog)
+        self.assertTrue(snapshot)
+        for rq in snapshot:
+            if rq.tasks:
+                self.assertEqual(rq.tasks[0].queue, "current")
+                self.assertEqual(rq.tasks[0].task, rq.curr)
+        # We are running, so we must be the current task of some CPU.
+        self.assertIn(task, [rq.curr for rq in snapshot])
+
+    def test_runqueue_snapshot_rt_current(self):
+        # A running real-time task stays on its queue, but it should only be
+        # reported as the current task.
+        try:
+            os.sched_setscheduler(0, os.SCHED_FIFO, os.sched_param(1))
+        except PermissionError:
+            self.skipTest("could not set SCHED_FIFO")
+        try:
+            task = find_task(self.prog, os.getpid())
+            snapshot = runqueue_snapshot(self.prog)
+        finally:
+            os.sched_setscheduler(0, os.SCHED_OTHER, os.sched_param(0))
+        tasks = [rq_task.task.value_() for rq in snapshot for rq_task in rq.tasks]
+        self.assertEqual(len(tasks), len(set(tasks)))
+        self.assertEqual(
+            [
+                rq_task.queue
+                for rq in snapshot
+                for rq_task in rq.tasks
+                if rq_task.task == task
+            ],
+            ["current"],
+        )
+
     @unittest.skip("GCC 10 breaks THREAD_SIZE object finder")
     def test_thread_size(self):
         # As far as I can tell, there's no way to query this value from
@@ -0,0 +1,85 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import os
+import signal
+import threading
+import time
+
+from drgn import container_of
+from drgn.helpers.linux.timer import pending_timers, timer_callbacks
+from tests.helpers.linux import LinuxHelperTestCase, proc_state, wait_until
+
+SLEEP_SECONDS = 60
+
+
+class TestTimer(LinuxHelperTestCase):
+    def test_pending_timers(self):
+        timers = pending_timers(self.prog)
+        self.assertTrue(any(timer.kind == "timer" for timer in timers))
+        self.assertTrue(any(timer.kind == "hrtimer" for timer in timers))
+        # Timers are re-armed all the time on a running kernel, so only check
+        # the snapshot against itself.
+        kinds = {"timer": 0, "hrtimer": 1}
+        keys = [
+            (timer.cpu, kinds[timer.kind], timer.base, timer.expires)
+            for timer in timers
+        ]
+        self.assertEqual(keys, sorted(keys))
+        for timer in timers:
+            if timer.symbol is not None:
+                self.assertEqual(timer.symbol.address, timer.function)
+
+    def test_pending_timers_sleeper(self):
+        # A process sleeping with a timeout has a pending hrtimer that expires
+        # when the sleep ends.
+        start = time.monotonic_ns()
+        pid = os.fork()
+        if pid == 0:
+            try:
+                time.sleep(SLEEP_SECONDS)
+            finally:
+                os._exit(0)
+        try:
+            wait_until(lambda: proc_state(pid) == "S")
+            end = time.monotonic_ns()
+            timers = pending_timers(self.prog)
+        finally:
+            os.kill(pid, signal.SIGKILL)
+            os.waitpid(pid, 0)
+
+        hrtimer_wakeup = self.prog.symbol("hrtimer_wakeup").address
+        found = [
+            timer
+            for timer in timers
+            if timer.kind == "hrtimer"
+            and timer.function == hrtimer_wakeup
+            and container_of(timer.timer, "struct hrtimer_sleeper", "timer").task.pid
+            == pid
+        ]
+        self.assertEqual(len(found), 1)
+        timer = found[0]
+        self.assertEqual(timer.symbol.name, "hrtimer_wakeup")
+        # Allow for the timer slack.
+        self.assertGreaterEqual(timer.expires, start + SLEEP_SECONDS * 10**9)
+        self.assertLessEqual(timer.expires, end + (SLEEP_SECONDS + 1) * 10**9)
+
+    def test_timer_callbacks(self):
+        # A thread sleeping with a timeout has a pending hrtimer.
+        event = threading.Event()
+        thread = threading.Thread(target=event.wait, args=(60,))
+        thread.start()
+        try:
+            time.sleep(0.1)
+            callbacks = timer_callbacks(self.prog)
+        finally:
+            event.set()
+            thread.join()
+        for prev, callback in zip(callbacks, callbacks[1:]):
+            self.assertGreaterEqual(
+                prev.timers + prev.hrtimers, callback.timers + callback.hrtimers
+            )
+        self.assertIn(
+            "hrtimer_wakeup",
+            [callback.symbol.name for callback in callbacks if callback.symbol],
+        )
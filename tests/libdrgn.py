@@ -272,3 +272,205 @@ def deserialize_bits(buf, bit_offset, bit_size, little_endian):
     return _drgn_cdll.drgn_test_deserialize_bits(
         c_buf, bit_offset, bit_size, little_endian
     )
+
+
+_drgn_cdll.drgn_test_next_uleb128.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_next_uleb128.argtypes = [
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_uint64),
+    ctypes.POINTER(ctypes.c_size_t),
+]
+_drgn_cdll.drgn_test_next_sleb128.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_next_sleb128.argtypes = [
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_int64),
+    ctypes.POINTER(ctypes.c_size_t),
+]
+_drgn_cdll.drgn_test_skip_leb128.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_skip_leb128.argtypes = [
+    ctypes.c_char_p,
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_size_t),
+]
+
+
+# next_uleb128() and next_sleb128() return the decoded value and the number of
+# bytes consumed. skip_leb128() returns the number of bytes consumed.
+def next_uleb128(buf):
+    value = ctypes.c_uint64()
+    length = ctypes.c_size_t()
+    _check_err(
+        _drgn_cdll.drgn_test_next_uleb128(
+            buf, len(buf), ctypes.pointer(value), ctypes.pointer(length)
+        )
+    )
+    return value.value, length.value
+
+
+def next_sleb128(buf):
+    value = ctypes.c_int64()
+    length = ctypes.c_size_t()
+    _check_err(
+        _drgn_cdll.drgn_test_next_sleb128(
+            buf, len(buf), ctypes.pointer(value), ctypes.pointer(length)
+        )
+    )
+    return value.value, length.value
+
+
+def skip_leb128(buf):
+    length = ctypes.c_size_t()
+    _check_err(_drgn_cdll.drgn_test_skip_leb128(buf, len(buf), ctypes.pointer(length)))
+    return length.value
+
+
+_drgn_cdll.drgn_test_thread_pool_create.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_thread_pool_create.argtypes = [
+    ctypes.c_size_t,
+    ctypes.POINTER(ctypes.c_void_p),
+]
+_drgn_cdll.drgn_test_thread_pool_destroy.restype = None
+_drgn_cdll.drgn_test_thread_pool_destroy.argtypes = [ctypes.c_void_p]
+
+
+class _drgn_read_request(ctypes.Structure):
+    _fields_ = [
+        ("fd", ctypes.c_int),
+        ("buf", ctypes.c_void_p),
+        ("count", ctypes.c_size_t),
+        ("offset", ctypes.c_uint64),
+        ("complete", ctypes.c_void_p),
+        ("arg", ctypes.c_void_p),
+        ("done", ctypes.c_size_t),
+        ("errnum", ctypes.c_int),
+        ("next", ctypes.c_void_p),
+        ("prev", ctypes.c_void_p),
+    ]
+
+
+_drgn_cdll.drgn_test_read_engine_create.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_read_engine_create.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_uint,
+    ctypes.c_bool,
+    ctypes.POINTER(ctypes.c_void_p),
+]
+_drgn_cdll.drgn_test_read_engine_destroy.restype = None
+_drgn_cdll.drgn_test_read_engine_destroy.argtypes = [ctypes.c_void_p]
+_drgn_cdll.drgn_test_read_engine_uses_io_uring.restype = ctypes.c_bool
+_drgn_cdll.drgn_test_read_engine_uses_io_uring.argtypes = [ctypes.c_void_p]
+_drgn_cdll.drgn_test_read_engine_submit.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_read_engine_submit.argtypes = [
+    ctypes.c_void_p,
+    ctypes.POINTER(_drgn_read_request),
+]
+_drgn_cdll.drgn_test_read_engine_pending.restype = ctypes.c_size_t
+_drgn_cdll.drgn_test_read_engine_pending.argtypes = [ctypes.c_void_p]
+_drgn_cdll.drgn_test_read_engine_wait.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_read_engine_wait.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+_drgn_cdll.drgn_test_read_engine_cancel.restype = ctypes.c_bool
+_drgn_cdll.drgn_test_read_engine_cancel.argtypes = [ctypes.c_void_p]
+_drgn_cdll.drgn_test_read_engine_pread.restype = ctypes.POINTER(_drgn_error)
+_drgn_cdll.drgn_test_read_engine_pread.argtypes = [
+    ctypes.c_void_p,
+    ctypes.c_int,
+    ctypes.c_void_p,
+    ctypes.c_size_t,
+    ctypes.c_uint64,
+    ctypes.POINTER(ctypes.c_size_t),
+    ctypes.POINTER(ctypes.c_int),
+    ctypes.POINTER(ctypes.c_uint64),
+]
+
+
+class ReadRequest:
+    def __init__(self, fd, count, offset):
+        self._buf = ctypes.create_string_buffer(count)
+        self._req = _drgn_read_request(
+            fd=fd,
+            buf=ctypes.cast(self._buf, ctypes.c_void_p),
+            count=count,
+            offset=offset,
+        )
+
+    @property
+    def data(self):
+        return self._buf.raw[: self._req.done]
+
+    @property
+    def done(self):
+        return self._req.done
+
+    @property
+    def errnum(self):
+        return self._req.errnum
+
+
+class ReadEngine:
+    def __init__(self, num_threads=2, queue_depth=8, use_io_uring=True):
+        self._pool = ctypes.c_void_p()
+        self._engine = ctypes.c_void_p()
+        # Requests must stay alive for as long as the engine may use them.
+        self._requests = []
+        _check_err(
+            _drgn_cdll.drgn_test_thread_pool_create(
+                num_threads, ctypes.pointer(self._pool)
+            )
+        )
+        _check_err(
+            _drgn_cdll.drgn_test_read_engine_create(
+                self._pool, queue_depth, use_io_uring, ctypes.pointer(self._engine)
+            )
+        )
+
+    def __del__(self):
+        if self._engine:
+            _drgn_cdll.drgn_test_read_engine_destroy(self._engine)
+        if self._pool:
+            _drgn_cdll.drgn_test_thread_pool_destroy(self._pool)
+
+    @property
+    def uses_io_uring(self):
+        return _drgn_cdll.drgn_test_read_engine_uses_io_uring(self._engine)
+
+    def submit(self, fd, count, offset=0):
+        req = ReadRequest(fd, count, offset)
+        _check_err(
+            _drgn_cdll.drgn_test_read_engine_submit(
+                self._engine, ctypes.pointer(req._req)
+            )
+        )
+        self._requests.append(req)
+        return req
+
+    def pending(self):
+        return _drgn_cdll.drgn_test_read_engine_pending(self._engine)
+
+    def wait(self, min_complete=ctypes.c_size_t(-1).value):
+        _check_err(_drgn_cdll.drgn_test_read_engine_wait(self._engine, min_complete))
+
+    def cancel(self):
+        return _drgn_cdll.drgn_test_read_engine_cancel(self._engine)
+
+    # Returns the data that was read, the errno of the first failed read (or
+    # 0), and the file offset of the failed read.
+    def pread(self, fd, count, offset=0):
+        buf = ctypes.create_string_buffer(count)
+        done = ctypes.c_size_t()
+        errnum = ctypes.c_int()
+        error_offset = ctypes.c_uint64()
+        _check_err(
+            _drgn_cdll.drgn_test_read_engine_pread(
+                self._engine,
+                fd,
+                buf,
+                count,
+                offset,
+                ctypes.pointer(done),
+                ctypes.pointer(errnum),
+                ctypes.pointer(error_offset),
+            )
+        )
+        return buf.raw[: done.value], errnum.value, error_offset.value
@@ -8,6 +8,7 @@ import unittest
 
 from drgn import (
     FindObjectFlags,
+    IndexCategory,
     Language,
     Object,
     Program,
@@ -19,7 +20,14 @@ from drgn import (
 )
 from tests import DEFAULT_LANGUAGE, TestCase
 from tests.dwarf import DW_AT, DW_ATE, DW_FORM, DW_LANG, DW_TAG
-from tests.dwarfwriter import DwarfAttrib, DwarfDie, compile_dwarf
+from tests.dwarfwriter import (
+    DwarfAttrib,
+    DwarfDie,
+    compile_dwarf,
+    compile_dwz_dwarf,
+    compile_split_dwarf,
+)
+from tests.libdrgn import next_sleb128, next_uleb128, skip_leb128
 
 bool_die = DwarfDie(
     DW_TAG.base_type,
@@ -937,6 +945,312 @@ class TestTypes(TestCase):
                     (point_type(prog), other_point_type(prog)),
                 )
 
+    def test_dwarf5(self):
+        dies = [
+            DwarfDie(
+                DW_TAG.base_type,
+                (
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 4),
+                    DwarfAttrib(DW_AT.encoding, DW_FORM.data1, DW_ATE.signed),
+                    DwarfAttrib(DW_AT.name, DW_FORM.strx1, "int"),
+                ),
+            ),
+            DwarfDie(
+                DW_TAG.structure_type,
+                [
+                    DwarfAttrib(DW_AT.name, DW_FORM.strx1, "point"),
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 8),
+                    DwarfAttrib(DW_AT.decl_file, DW_FORM.implicit_const, "foo.c"),
+                ],
+                [
+                    DwarfDie(
+                        DW_TAG.member,
+                        [
+                            DwarfAttrib(DW_AT.name, DW_FORM.strx1, "x"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 0),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ],
+                    ),
+                    DwarfDie(
+                        DW_TAG.member,
+                        [
+                            DwarfAttrib(DW_AT.name, DW_FORM.strx1, "y"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 4),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ],
+                    ),
+                ],
+            ),
+            DwarfDie(
+                DW_TAG.structure_type,
+                [
+                    DwarfAttrib(DW_AT.name, DW_FORM.strx1, "point"),
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 8),
+                    DwarfAttrib(DW_AT.decl_file, DW_FORM.udata, "bar/baz.c"),
+                ],
+                [
+                    DwarfDie(
+                        DW_TAG.member,
+                        [
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "a"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 0),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ],
+                    ),
+                    DwarfDie(
+                        DW_TAG.member,
+                        [
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "b"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 4),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ],
+                    ),
+                ],
+            ),
+        ]
+
+        prog = dwarf_program(dies, version=5)
+        self.assertEqual(prog.type("int"), prog.int_type("int", 4, True))
+        self.assertEqual(
+            prog.type("struct point", "foo.c"),
+            prog.struct_type(
+                "point",
+                8,
+                (
+                    TypeMember(prog.int_type("int", 4, True), "x"),
+                    TypeMember(prog.int_type("int", 4, True), "y", 32),
+                ),
+            ),
+        )
+        self.assertEqual(
+            prog.type("struct point", "bar/baz.c"),
+            prog.struct_type(
+                "point",
+                8,
+                (
+                    TypeMember(prog.int_type("int", 4, True), "a"),
+                    TypeMember(prog.int_type("int", 4, True), "b", 32),
+                ),
+            ),
+        )
+
+    def test_type_units(self):
+        int_die = DwarfDie(
+            DW_TAG.base_type,
+            (
+                DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 4),
+                DwarfAttrib(DW_AT.encoding, DW_FORM.data1, DW_ATE.signed),
+                DwarfAttrib(DW_AT.name, DW_FORM.string, "int"),
+            ),
+        )
+        point_die = DwarfDie(
+            DW_TAG.structure_type,
+            (
+                DwarfAttrib(DW_AT.name, DW_FORM.string, "point"),
+                DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 8),
+            ),
+            (
+                DwarfDie(
+                    DW_TAG.member,
+                    (
+                        DwarfAttrib(DW_AT.name, DW_FORM.string, "x"),
+                        DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 0),
+                        DwarfAttrib(DW_AT.type, DW_FORM.ref_sig8, 1),
+                    ),
+                ),
+                DwarfDie(
+                    DW_TAG.member,
+                    (
+                        DwarfAttrib(DW_AT.name, DW_FORM.string, "y"),
+                        DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 4),
+                        DwarfAttrib(DW_AT.type, DW_FORM.ref_sig8, 1),
+                    ),
+                ),
+            ),
+        )
+        dies = (
+            DwarfDie(
+                DW_TAG.typedef,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.string, "point_t"),
+                    DwarfAttrib(DW_AT.type, DW_FORM.ref_sig8, 2),
+                ),
+            ),
+        )
+        # The duplicate type unit for struct point should be ignored.
+        type_units = ((1, int_die), (2, point_die), (2, point_die))
+        for version in (4, 5):
+            with self.subTest(version=version):
+                prog = dwarf_program(dies, version=version, type_units=type_units)
+                point_type = prog.struct_type(
+                    "point",
+                    8,
+                    (
+                        TypeMember(prog.int_type("int", 4, True), "x"),
+                        TypeMember(prog.int_type("int", 4, True), "y", 32),
+                    ),
+                )
+                self.assertEqual(prog.type("struct point"), point_type)
+                self.assertEqual(
+                    prog.type("point_t"), prog.typedef_type("point_t", point_type)
+                )
+
+    def test_dwz(self):
+        alt_dies = (
+            int_die,
+            DwarfDie(
+                DW_TAG.structure_type,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.string, "point"),
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 8),
+                ),
+                (
+                    DwarfDie(
+                        DW_TAG.member,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "x"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 0),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ),
+                    ),
+                    DwarfDie(
+                        DW_TAG.member,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "y"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 4),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ),
+                    ),
+                ),
+            ),
+        )
+        dies = (
+            DwarfDie(
+                DW_TAG.typedef,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.GNU_strp_alt, "point_t"),
+                    DwarfAttrib(DW_AT.type, DW_FORM.GNU_ref_alt, 1),
+                ),
+            ),
+            DwarfDie(
+                DW_TAG.variable,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.GNU_strp_alt, "origin"),
+                    DwarfAttrib(DW_AT.type, DW_FORM.GNU_ref_alt, 1),
+                    DwarfAttrib(
+                        DW_AT.location,
+                        DW_FORM.exprloc,
+                        b"\x03\x00\x00\xff\xff\x00\x00\x00\x00",
+                    ),
+                ),
+            ),
+        )
+        debug_file, alt_file = compile_dwz_dwarf(dies, alt_dies, "alt.debug")
+        prog = Program()
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "main.debug")
+            with open(path, "wb") as f:
+                f.write(debug_file)
+            with open(os.path.join(dir, "alt.debug"), "wb") as f:
+                f.write(alt_file)
+            prog.load_debug_info([path])
+
+        point_type = prog.struct_type(
+            "point",
+            8,
+            (
+                TypeMember(prog.int_type("int", 4, True), "x"),
+                TypeMember(prog.int_type("int", 4, True), "y", 32),
+            ),
+        )
+        # Types defined only in the partial unit in the alternate file.
+        self.assertEqual(prog.type("int"), prog.int_type("int", 4, True))
+        self.assertEqual(prog.type("struct point"), point_type)
+        # Names in the alternate .debug_str and types referenced with
+        # DW_FORM_GNU_ref_alt.
+        self.assertEqual(prog.type("point_t"), prog.typedef_type("point_t", point_type))
+        self.assertEqual(prog["origin"], Object(prog, point_type, address=0xFFFF0000))
+
+    def test_split_dwarf(self):
+        dies = (
+            int_die,
+            DwarfDie(
+                DW_TAG.structure_type,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.string, "point"),
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 8),
+                ),
+                (
+                    DwarfDie(
+                        DW_TAG.member,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "x"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 0),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ),
+                    ),
+                    DwarfDie(
+                        DW_TAG.member,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "y"),
+                            DwarfAttrib(DW_AT.data_member_location, DW_FORM.data1, 4),
+                            DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        ),
+                    ),
+                ),
+            ),
+            DwarfDie(
+                DW_TAG.enumeration_type,
+                (
+                    DwarfAttrib(DW_AT.name, DW_FORM.string, "color"),
+                    DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                    DwarfAttrib(DW_AT.byte_size, DW_FORM.data1, 4),
+                ),
+                (
+                    DwarfDie(
+                        DW_TAG.enumerator,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "RED"),
+                            DwarfAttrib(DW_AT.const_value, DW_FORM.data1, 0),
+                        ),
+                    ),
+                    DwarfDie(
+                        DW_TAG.enumerator,
+                        (
+                            DwarfAttrib(DW_AT.name, DW_FORM.string, "BLUE"),
+                            DwarfAttrib(DW_AT.const_value, DW_FORM.data1, 1),
+                        ),
+                    ),
+                ),
+            ),
+        )
+        skeleton_file, dwo_file = compile_split_dwarf(dies, "main.dwo")
+        prog = Program()
+        with tempfile.TemporaryDirectory() as dir:
+            path = os.path.join(dir, "main")
+            with open(path, "wb") as f:
+                f.write(skeleton_file)
+            with open(os.path.join(dir, "main.dwo"), "wb") as f:
+                f.write(dwo_file)
+            prog.load_debug_info([path])
+
+        # Everything is only defined in the split DWARF object file; the
+        # skeleton unit has no children.
+        int_type = prog.int_type("int", 4, True)
+        self.assertEqual(
+            prog.type("struct point"),
+            prog.struct_type(
+                "point",
+                8,
+                (TypeMember(int_type, "x"), TypeMember(int_type, "y", 32)),
+            ),
+        )
+        color_type = prog.enum_type(
+            "color", int_type, (TypeEnumerator("RED", 0), TypeEnumerator("BLUE", 1))
+        )
+        self.assertEqual(prog.type("enum color"), color_type)
+        self.assertEqual(prog["BLUE"], Object(prog, color_type, 1))
+
     def test_bit_field_data_bit_offset(self):
         dies = (
             DwarfDie(
@@ -3314,6 +3628,45 @@ class TestObjects(TestCase):
             FindObjectFlags.CONSTANT,
         )
 
+    def test_index_profile(self):
+        dies = test_type_dies(
+            (
+                int_die,
+                DwarfDie(
+                    DW_TAG.variable,
+                    (
+                        DwarfAttrib(DW_AT.name, DW_FORM.string, "x"),
+                        DwarfAttrib(DW_AT.type, DW_FORM.ref4, 0),
+                        DwarfAttrib(
+                            DW_AT.location,
+                            DW_FORM.exprloc,
+                            b"\x03\x04\x03\x02\x01\xff\xff\xff\xff",
+                        ),
+                    ),
+                ),
+            )
+        )
+        for index in (IndexCategory.TYPES, IndexCategory.FUNCTIONS):
+            with self.subTest(index=index):
+                prog = Program()
+                with tempfile.NamedTemporaryFile() as f:
+                    f.write(compile_dwarf(dies))
+                    f.flush()
+                    prog.load_debug_info([f.name], index=index)
+                # Names outside of the profile are indexed on demand.
+                self.assertEqual(
+                    prog["x"],
+                    Object(
+                        prog,
+                        prog.int_type("int", 4, True),
+                        address=0xFFFFFFFF01020304,
+                    ),
+                )
+                self.assertEqual(prog.type("int"), prog.int_type("int", 4, True))
+                self.assertRaisesRegex(
+                    LookupError, "could not find", prog.object, "y"
+                )
+
     def test_variable_no_address(self):
         prog = dwarf_program(
             test_type_dies(
@@ -3717,3 +4070,101 @@ class TestProgram(TestCase):
         )
         self.assertFalse(dwarf_program(dies)["x"].prog_.flags & ProgramFlags.IS_LIVE)
         self.assertEqual(dwarf_program(dies)["x"].type_.name, "int")
+
+
+class TestLeb128(TestCase):
+    # Decode each case on its own and followed by trailing data, which must not
+    # be consumed.
+    def _test_decode(self, func, cases):
+        for encoded, value in cases:
+            for buf in (encoded, encoded + bytes(8)):
+                with self.subTest(func=func.__name__, buf=buf):
+                    self.assertEqual(func(buf), (value, len(encoded)))
+                    self.assertEqual(skip_leb128(buf), len(encoded))
+
+    def _test_error(self, func, cases):
+        for encoded, message in cases:
+            for buf in (encoded, encoded + bytes(8)):
+                with self.subTest(func=func.__name__, buf=buf):
+                    self.assertRaisesRegex(Exception, message, func, buf)
+
+    def test_uleb128(self):
+        self._test_decode(
+            next_uleb128,
+            (
+                (b"\x00", 0),
+                (b"\x7f", 127),
+                (b"\x80\x01", 128),
+                (b"\xe5\x8e\x26", 624485),
+                (b"\xff" * 7 + b"\x7f", (1 << 56) - 1),
+                (b"\xff" * 8 + b"\x7f", (1 << 63) - 1),
+                # Maximum length.
+                (b"\x80" * 9 + b"\x01", 1 << 63),
+                (b"\xff" * 9 + b"\x01", (1 << 64) - 1),
+                # Overlong encodings.
+                (b"\x80\x00", 0),
+                (b"\x81\x80\x80\x00", 1),
+                (b"\xff" * 7 + b"\x80\x00", (1 << 49) - 1),
+                (b"\x80" * 9 + b"\x00", 0),
+            ),
+        )
+
+    def test_uleb128_overflow(self):
+        self._test_error(
+            next_uleb128,
+            (
+                (b"\xff" * 9 + b"\x02", "ULEB128 number overflows"),
+                (b"\xff" * 9 + b"\x7f", "ULEB128 number overflows"),
+                # Overlong encodings can't be longer than 10 bytes.
+                (b"\x80" * 10 + b"\x00", "ULEB128 number overflows"),
+            ),
+        )
+
+    def test_uleb128_truncated(self):
+        for buf in (b"", b"\x80", b"\xff" * 8, b"\x80" * 9):
+            with self.subTest(buf=buf):
+                self.assertRaisesRegex(
+                    Exception, "expected ULEB128 number", next_uleb128, buf
+                )
+                if buf:
+                    self.assertRaisesRegex(
+                        Exception, "expected LEB128 number", skip_leb128, buf
+                    )
+
+    def test_sleb128(self):
+        self._test_decode(
+            next_sleb128,
+            (
+                (b"\x00", 0),
+                (b"\x3f", 63),
+                (b"\x40", -64),
+                (b"\x7f", -1),
+                (b"\x80\x7f", -128),
+                (b"\xff\x00", 127),
+                (b"\xc0\xbb\x78", -123456),
+                # Maximum length.
+                (b"\xff" * 9 + b"\x00", (1 << 63) - 1),
+                (b"\x80" * 9 + b"\x7f", -(1 << 63)),
+                # Overlong encodings.
+                (b"\xff\x7f", -1),
+                (b"\x80\x80\x00", 0),
+                (b"\xff" * 9 + b"\x7f", -1),
+            ),
+        )
+
+    def test_sleb128_overflow(self):
+        self._test_error(
+            next_sleb128,
+            (
+                (b"\x80" * 9 + b"\x01", "SLEB128 number overflows"),
+                (b"\xff" * 9 + b"\x7e", "SLEB128 number overflows"),
+                (b"\x80" * 10 + b"\x00", "SLEB128 number overflows"),
+            ),
+        )
+
+    def test_sleb128_truncated(self):
+        for buf in (b"", b"\x80", b"\xff" * 8, b"\x80" * 9):
+            with self.subTest(buf=buf):
+                self.assertRaisesRegex(
+                    Exception, "expected SLEB128 number", next_sleb128, buf
+                )
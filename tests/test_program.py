@@ -2,11 +2,17 @@
 # SPDX-License-Identifier: GPL-3.0+
 
 import ctypes
+import errno
+import http.server
 import itertools
 import os
+import re
+import struct
 import tempfile
+import threading
 import unittest.mock
 
+import drgn
 from drgn import (
     Architecture,
     FaultError,
@@ -38,6 +44,34 @@ def zero_memory_read(address, count, offset, physical):
     return bytes(count)
 
 
+class RangeRequestHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+    data = b""
+    ranges = []
+
+    def do_GET(self):
+        match = re.fullmatch(r"bytes=([0-9]+)-([0-9]+)", self.headers["Range"] or "")
+        if not match:
+            self.send_error(400)
+            return
+        start = int(match.group(1))
+        end = min(int(match.group(2)), len(self.data) - 1)
+        self.ranges.append((start, end))
+        if start >= len(self.data):
+            self.send_response(416)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        self.send_response(206)
+        self.send_header("Content-Range", f"bytes {start}-{end}/{len(self.data)}")
+        self.send_header("Content-Length", str(end - start + 1))
+        self.end_headers()
+        self.wfile.write(self.data[start : end + 1])
+
+    def log_message(self, format, *args):
+        pass
+
+
 class TestProgram(unittest.TestCase):
     def test_set_pid(self):
         # Debug the running Python interpreter itself.
@@ -107,6 +141,19 @@ class TestProgram(unittest.TestCase):
     def test_language(self):
         self.assertEqual(Program().language, DEFAULT_LANGUAGE)
 
+    def test_num_threads(self):
+        prog = Program()
+        self.assertGreaterEqual(prog.num_threads, 1)
+        default = prog.num_threads
+        prog.num_threads = 1
+        self.assertEqual(prog.num_threads, 1)
+        prog.num_threads = 0
+        self.assertEqual(prog.num_threads, default)
+        with self.assertRaises(OverflowError):
+            prog.num_threads = -1
+        with self.assertRaises(TypeError):
+            prog.num_threads = "1"
+
 
 class TestMemory(TestCase):
     def test_simple_read(self):
@@ -637,6 +684,71 @@ class TestTypes(MockProgramTestCase):
             ),
         )
 
+    def test_memory_budget(self):
+        self.assertEqual(self.prog.memory_budget, 0)
+        ptr = Object(
+            self.prog, self.prog.pointer_type(self.point_type), value=0xFFFF0000
+        )
+        self.assertEqual(ptr.member_("y").address_, 0xFFFF0004)
+        usage = self.prog.memory_usage()
+        self.assertGreater(usage["created_types"]["size"], 0)
+        self.assertGreater(usage["members"]["size"], 0)
+
+        # Types can't be evicted, so a tiny budget only shrinks other caches.
+        self.prog.memory_budget = 1
+        self.assertEqual(self.prog.memory_budget, 1)
+        usage = self.prog.memory_usage()
+        self.assertGreater(usage["created_types"]["size"], 0)
+        self.assertEqual(usage["members"], {"size": 0, "count": 0, "evictions": 1})
+
+        # Members cached by a lookup are evicted after it finishes.
+        self.assertEqual(ptr.member_("x").address_, 0xFFFF0000)
+        self.assertEqual(
+            self.prog.memory_usage()["members"],
+            {"size": 0, "count": 0, "evictions": 2},
+        )
+
+        self.prog.memory_budget = 0
+        self.assertEqual(ptr.member_("x").address_, 0xFFFF0000)
+        self.assertGreater(self.prog.memory_usage()["members"]["size"], 0)
+        self.assertRaises(OverflowError, setattr, self.prog, "memory_budget", -1)
+
+    def test_memory_usage(self):
+        usage = self.prog.memory_usage()
+        for name in (
+            "created_types",
+            "deduplicated_types",
+            "members",
+            "module_sections",
+            "dwarf_types",
+            "dwarf_index_dies",
+            "dwarf_index_names",
+            "dwarf_index_specifications",
+            "dwarf_index_type_units",
+            "dwarf_index_cus",
+            "prstatus",
+            "memory_reader",
+            "direct_io",
+            "translation_cache",
+            "dentry_paths",
+        ):
+            self.assertEqual(usage[name].keys(), {"size", "count", "evictions"})
+        self.assertEqual(usage["dwarf_index_dies"]["count"], 0)
+
+        self.prog.struct_type("memory_usage_test", 0, ())
+        self.prog.int_type("memory_usage_test_t", 4, True)
+        self.prog.add_memory_segment(0x100000000000, 8, lambda *args: bytes(8))
+        new_usage = self.prog.memory_usage()
+        for name, count in (
+            ("created_types", 1),
+            ("deduplicated_types", 1),
+            ("memory_reader", 1),
+        ):
+            self.assertEqual(
+                new_usage[name]["count"], usage[name]["count"] + count, name
+            )
+            self.assertGreater(new_usage[name]["size"], usage[name]["size"], name)
+
 
 class TestObjects(MockProgramTestCase):
     def test_invalid_finder(self):
@@ -781,3 +893,457 @@ class TestCoreDump(TestCase):
             f.flush()
             prog.set_core_dump(f.name)
         self.assertEqual(prog.read(0xFFFF0000, len(data) + 4), data + bytes(4))
+        self.assertEqual(
+            prog.memory_holes(0xFFFF0000, len(data) + 4),
+            [(0xFFFF0000 + len(data), 0xFFFF0000 + len(data) + 4)],
+        )
+        self.assertEqual(prog.memory_holes(0xFFFF0000, len(data)), [])
+        # Memory that isn't in the core dump isn't a hole.
+        self.assertEqual(prog.memory_holes(0, 0x1000), [])
+
+    def test_sparse(self):
+        size = 2 * 1024 * 1024
+        data = b"hello" + bytes(size - 10) + b"world"
+        elf = create_elf_file(
+            ET.CORE,
+            [
+                ElfSection(
+                    p_type=PT.LOAD,
+                    vaddr=0xFFFF0000,
+                    data=data,
+                    memsz=size + 4096,
+                    p_align=4096,
+                ),
+            ],
+        )
+        prog = Program()
+        with tempfile.NamedTemporaryFile() as f:
+            # Only write the blocks that aren't zero.
+            for i in range(0, len(elf), 4096):
+                if any(elf[i : i + 4096]):
+                    f.seek(i)
+                    f.write(elf[i : i + 4096])
+            f.truncate(len(elf))
+            f.flush()
+            try:
+                sparse = os.lseek(f.fileno(), 0, os.SEEK_HOLE) < len(elf)
+            except OSError:
+                sparse = False
+            prog.set_core_dump(f.name)
+
+            self.assertEqual(prog.read(0xFFFF0000, size + 4096), data + bytes(4096))
+            self.assertEqual(prog.read(0xFFFF0000 + size - 8, 8), b"\0\0\0world")
+            holes = prog.memory_holes(0xFFFF0000, size + 4096)
+            # The part past the end of the file data is always a hole.
+            self.assertEqual(holes[-1], (0xFFFF0000 + size, 0xFFFF0000 + size + 4096))
+            if not sparse:
+                return
+            self.assertEqual(len(holes), 2)
+            start, end = holes[0]
+            # Filesystems may allocate blocks bigger than 4 KB.
+            self.assertLessEqual(0xFFFF0000 + 5, start)
+            self.assertLessEqual(start, 0xFFFF0000 + 64 * 1024)
+            self.assertLessEqual(0xFFFF0000 + size - 64 * 1024, end)
+            self.assertLessEqual(end, 0xFFFF0000 + size - 5)
+            self.assertEqual(
+                prog.memory_holes(start + 4096, 8192), [(start + 4096, start + 12288)]
+            )
+
+    def test_sparse_truncated(self):
+        size = 2 * 1024 * 1024
+        data = b"hello" + bytes(size - 5)
+        elf = create_elf_file(
+            ET.CORE,
+            [
+                ElfSection(
+                    p_type=PT.LOAD,
+                    vaddr=0xFFFF0000,
+                    data=data,
+                    p_align=4096,
+                ),
+            ],
+        )
+        offset = elf.index(b"hello")
+        prog = Program()
+        with tempfile.NamedTemporaryFile() as f:
+            # The file ends halfway through the segment, after a hole.
+            f.write(elf[: offset + 4096])
+            f.truncate(offset + size // 2)
+            f.flush()
+            prog.set_core_dump(f.name)
+
+            self.assertEqual(prog.read(0xFFFF0000, size // 2), data[: size // 2])
+            self.assertRaisesRegex(
+                FaultError,
+                "short read from memory file",
+                prog.read,
+                0xFFFF0000 + size // 2,
+                8,
+            )
+            self.assertRaises(FaultError, prog.read, 0xFFFF0000, size)
+            # The missing part isn't a hole.
+            for start, end in prog.memory_holes(0xFFFF0000, size):
+                self.assertLessEqual(end, 0xFFFF0000 + size // 2)
+
+    def test_direct_io(self):
+        data = os.urandom(3 * 1024 * 1024 + 5)
+        prog = Program()
+        self.assertEqual(prog.direct_io, 0)
+        self.assertRaises(ValueError, setattr, prog, "direct_io", 1024 * 1024)
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(
+                create_elf_file(
+                    ET.CORE,
+                    [
+                        ElfSection(
+                            p_type=PT.LOAD,
+                            vaddr=0xFFFF0000,
+                            data=data,
+                            memsz=len(data) + 4,
+                        ),
+                    ],
+                )
+            )
+            f.flush()
+            prog.set_core_dump(f.name)
+        try:
+            prog.direct_io = 16 * 1024 * 1024
+        except OSError as e:
+            if e.errno == errno.EINVAL:
+                self.skipTest("file system does not support O_DIRECT")
+            raise
+        self.assertGreaterEqual(prog.direct_io, 16 * 1024 * 1024)
+        self.assertEqual(prog.read(0xFFFF0000, len(data) + 4), data + bytes(4))
+        for i in range(0, len(data), 4096):
+            self.assertEqual(prog.read(0xFFFF0000 + i, 8), data[i : i + 8])
+        stats = prog.direct_io_stats()
+        self.assertGreater(stats["hits"], 0)
+        self.assertGreater(stats["bytes_read"], 0)
+        self.assertEqual(
+            stats["bytes_copied"],
+            len(data) + sum(min(8, len(data) - i) for i in range(0, len(data), 4096)),
+        )
+
+        prog.memory_budget = 1024 * 1024
+        self.assertLessEqual(prog.memory_usage()["direct_io"]["size"], 1024 * 1024)
+        self.assertGreater(prog.direct_io_stats()["evictions"], 0)
+        self.assertEqual(prog.read(0xFFFF0000, len(data) + 4), data + bytes(4))
+
+        prog.direct_io = 0
+        self.assertEqual(prog.direct_io, 0)
+        self.assertEqual(prog.direct_io_stats()["hits"], 0)
+        self.assertEqual(prog.read(0xFFFF0000, len(data)), data)
+
+    @unittest.skipUnless(drgn._with_libcurl, "drgn was built without libcurl")
+    def test_remote(self):
+        data = os.urandom(3 * 1024 * 1024 + 5)
+
+        class Handler(RangeRequestHandler):
+            ranges = []
+
+        Handler.data = create_elf_file(
+            ET.CORE,
+            [
+                ElfSection(
+                    p_type=PT.LOAD,
+                    vaddr=0xFFFF0000,
+                    data=data,
+                    memsz=len(data) + 4,
+                ),
+            ],
+        )
+        server = http.server.ThreadingHTTPServer(("127.0.0.1", 0), Handler)
+        thread = threading.Thread(target=server.serve_forever)
+        thread.start()
+        try:
+            url = f"http://127.0.0.1:{server.server_address[1]}/vmcore"
+            prog = Program()
+            prog.set_core_dump(url)
+            self.assertGreater(prog.direct_io, 0)
+            self.assertRaises(ValueError, setattr, prog, "direct_io", 0)
+            self.assertEqual(prog.read(0xFFFF0000, len(data) + 4), data + bytes(4))
+            for i in range(0, len(data), 4096):
+                self.assertEqual(prog.read(0xFFFF0000 + i, 8), data[i : i + 8])
+            self.assertGreater(prog.direct_io_stats()["hits"], 0)
+            # Misses were fetched as several ranges in parallel.
+            self.assertGreater(len(Handler.ranges), 2)
+
+            Handler.data = b"not a core dump"
+            self.assertRaisesRegex(
+                ValueError, "not an ELF core file", Program().set_core_dump, url
+            )
+        finally:
+            server.shutdown()
+            thread.join()
+            server.server_close()
+
+
+class TestGuestMemory(TestCase):
+    # swapper_pg_dir is at physical address 0x102000.
+    VMCOREINFO = b"""\
+OSRELEASE=5.10.0
+PAGESIZE=4096
+SYMBOL(swapper_pg_dir)=ffffffff80002000
+NUMBER(phys_base)=1048576
+"""
+    DIRECT_MAP = 0xFFFF888000000000
+
+    @staticmethod
+    def _entry(ram, table, index, value):
+        ram[table + 8 * index : table + 8 * index + 8] = struct.pack("<Q", value)
+
+    def _guest_ram(self):
+        ram = bytearray(8 * 1024 * 1024)
+        # VMCOREINFO note at the beginning of a page.
+        ram[0x1000:0x1018] = (
+            struct.pack("<3I", 11, len(self.VMCOREINFO), 0) + b"VMCOREINFO\0\0"
+        )
+        ram[0x1018 : 0x1018 + len(self.VMCOREINFO)] = self.VMCOREINFO
+        # PGD -> PUD -> PMD -> PTE for the start of the direct mapping.
+        self._entry(ram, 0x102000, (self.DIRECT_MAP >> 39) & 511, 0x103003)
+        self._entry(ram, 0x103000, 0, 0x104003)
+        self._entry(ram, 0x104000, 0, 0x105003)
+        self._entry(ram, 0x105000, 0, 0x200003)
+        # 2 MB huge page.
+        self._entry(ram, 0x104000, 1, 0x400083)
+        ram[0x200000:0x200008] = b"pte page"
+        ram[0x201000:0x201008] = b"new page"
+        ram[0x401000:0x401008] = b"pmd page"
+        return ram
+
+    def test_guest_memory(self):
+        with tempfile.NamedTemporaryFile() as f:
+            ram = self._guest_ram()
+            f.write(ram)
+            f.flush()
+            prog = Program()
+            prog.set_guest_memory(f.name)
+            self.assertEqual(prog.platform.arch, Architecture.X86_64)
+            self.assertTrue(prog.flags & ProgramFlags.IS_LINUX_KERNEL)
+            self.assertFalse(prog.flags & ProgramFlags.IS_LIVE)
+            self.assertEqual(prog.read(self.DIRECT_MAP, 8), b"pte page")
+            self.assertEqual(prog.read(self.DIRECT_MAP + 0x201000, 8), b"pmd page")
+            self.assertEqual(prog.read(0x200000, 8, True), b"pte page")
+            self.assertRaises(FaultError, prog.read, self.DIRECT_MAP + 0x1000, 8)
+            # The guest is running, so translations aren't cached.
+            self.assertEqual(prog.memory_usage()["translation_cache"]["count"], 0)
+
+            # The guest remaps the page, which is seen immediately.
+            f.seek(0x105000)
+            f.write(struct.pack("<Q", 0x201003))
+            f.flush()
+            self.assertEqual(prog.read(self.DIRECT_MAP, 8), b"new page")
+
+            self.assertRaisesRegex(
+                ValueError,
+                "program memory was already initialized",
+                prog.set_guest_memory,
+                f.name,
+            )
+
+    def test_pgtable(self):
+        with tempfile.NamedTemporaryFile() as f:
+            ram = self._guest_ram()
+            # Another PGD sharing the lower levels except for the PTE table.
+            self._entry(ram, 0x106000, (self.DIRECT_MAP >> 39) & 511, 0x107003)
+            self._entry(ram, 0x107000, 0, 0x108003)
+            self._entry(ram, 0x108000, 0, 0x109003)
+            self._entry(ram, 0x109000, 0, 0x201003)
+            f.write(ram)
+            f.flush()
+            prog = Program()
+            self.assertRaisesRegex(
+                ValueError,
+                "not in guest memory",
+                prog.set_guest_memory,
+                f.name,
+                pgtable=0x7FFFF000,
+            )
+            # A failed attempt doesn't leave anything behind. The PCID bits of
+            # CR3 are ignored.
+            prog.set_guest_memory(f.name, pgtable=0x106001)
+            self.assertEqual(prog.read(self.DIRECT_MAP, 8), b"new page")
+
+    def test_low_ram_size(self):
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(self._guest_ram())
+            f.flush()
+            prog = Program()
+            prog.set_guest_memory(f.name, low_ram_size=0x400000)
+            self.assertEqual(prog.read(0x200000, 8, True), b"pte page")
+            self.assertEqual(prog.read(0x100001000, 8, True), b"pmd page")
+            self.assertRaises(FaultError, prog.read, 0x401000, 8, True)
+
+    def test_no_vmcoreinfo(self):
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(bytes(1024 * 1024))
+            f.flush()
+            self.assertRaisesRegex(
+                Exception,
+                "could not find VMCOREINFO",
+                Program().set_guest_memory,
+                f.name,
+            )
+
+
+class TestWatch(TestCase):
+    ADDRESS = 0xFFFF0000
+
+    def test_watch(self):
+        data = struct.pack("<2i", 1, 2) + bytes(4096) + struct.pack("<Q", 3)
+        elf = create_elf_file(
+            ET.CORE,
+            [
+                ElfSection(
+                    p_type=PT.LOAD,
+                    vaddr=self.ADDRESS,
+                    data=data,
+                    memsz=len(data) + 4,
+                ),
+            ],
+        )
+        offset = elf.index(data)
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(elf)
+            f.flush()
+            prog = Program()
+            prog.set_core_dump(f.name)
+            watch = drgn.Watch(
+                prog,
+                [
+                    Object(prog, "int", address=self.ADDRESS),
+                    Object(prog, "int", address=self.ADDRESS + 4),
+                    Object(prog, "unsigned long", address=self.ADDRESS + 4104),
+                    # Past the end of the file data.
+                    Object(prog, "int", address=self.ADDRESS + len(data)),
+                ],
+                capacity=2,
+            )
+            self.assertEqual(len(watch), 0)
+            watch.sample()
+            f.seek(offset)
+            f.write(struct.pack("<i", 10))
+            f.seek(offset + 4104)
+            f.write(struct.pack("<Q", 30))
+            f.flush()
+            watch.sample()
+            watch.sample()
+
+            samples = watch.samples()
+            self.assertEqual(len(watch), 2)
+            self.assertEqual(len(samples), 2)
+            self.assertLessEqual(samples[0][0], samples[1][0])
+            for timestamp, values in samples:
+                self.assertEqual([value.value_() for value in values], [10, 2, 30, 0])
+                self.assertEqual(
+                    [value.type_.name for value in values],
+                    ["int", "int", "unsigned long", "int"],
+                )
+
+            stats = watch.stats()
+            self.assertEqual(stats["samples"], 3)
+            self.assertEqual(stats["dropped"], 1)
+            # The first two objects are read together.
+            self.assertEqual(stats["reads_per_sample"], 2)
+            self.assertEqual(stats["untranslated"], 1)
+            self.assertLessEqual(stats["last_ns"], stats["max_ns"])
+            self.assertLessEqual(stats["max_ns"], stats["total_ns"])
+
+            watch.clear()
+            self.assertEqual(watch.samples(), [])
+            watch.run(0.001, 3)
+            self.assertEqual(len(watch), 2)
+            self.assertEqual(watch.stats()["samples"], 6)
+
+    def test_byteorder(self):
+        prog = mock_program(
+            segments=[
+                MockMemorySegment(b"\x01\x02\x03\x04", virt_addr=self.ADDRESS),
+            ]
+        )
+        watch = drgn.Watch(
+            prog,
+            [
+                Object(prog, "int", address=self.ADDRESS),
+                Object(prog, "int", address=self.ADDRESS, byteorder="big"),
+            ],
+        )
+        watch.sample()
+        self.assertEqual(
+            [value.value_() for value in watch.samples()[0][1]],
+            [0x04030201, 0x01020304],
+        )
+
+    def test_invalid(self):
+        prog = Program(MOCK_PLATFORM)
+        self.assertRaises(TypeError, drgn.Watch, prog, [1])
+        self.assertRaisesRegex(
+            ValueError,
+            "must be a reference",
+            drgn.Watch,
+            prog,
+            [Object(prog, "int", value=1)],
+        )
+        self.assertRaises(ValueError, drgn.Watch, prog, [], capacity=0)
+        self.assertRaises(ValueError, drgn.Watch(prog, []).run, -1.0, 1)
+
+    def test_fault(self):
+        prog = Program(MOCK_PLATFORM)
+        prog.add_memory_segment(self.ADDRESS, 4, zero_memory_read)
+        watch = drgn.Watch(prog, [Object(prog, "int", address=self.ADDRESS + 4)])
+        self.assertRaises(FaultError, watch.sample)
+        self.assertEqual(len(watch), 0)
+
+    def test_read_engine_error(self):
+        def io_uring_fds():
+            fds = set()
+            for fd in os.listdir("/proc/self/fd"):
+                try:
+                    if os.readlink(f"/proc/self/fd/{fd}") == "anon_inode:[io_uring]":
+                        fds.add(int(fd))
+                except OSError:
+                    pass
+            return fds
+
+        data = struct.pack("<i", 1) + bytes(4096) + struct.pack("<Q", 2)
+        elf = create_elf_file(
+            ET.CORE,
+            [ElfSection(p_type=PT.LOAD, vaddr=self.ADDRESS, data=data)],
+        )
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(elf)
+            f.flush()
+            before = io_uring_fds()
+            prog = Program()
+            prog.set_core_dump(f.name)
+            # Two ranges, so they're read with the read engine.
+            watch = drgn.Watch(
+                prog,
+                [
+                    Object(prog, "int", address=self.ADDRESS),
+                    Object(prog, "unsigned long", address=self.ADDRESS + 4100),
+                ],
+            )
+            watch.sample()
+            if not watch.stats()["batched"]:
+                self.skipTest("io_uring is not available")
+            (ring_fd,) = io_uring_fds() - before
+
+            # Replacing the ring with another file makes io_uring_enter() fail,
+            # so the reads can't be submitted or cancelled.
+            saved_fd = os.dup(ring_fd)
+            null_fd = os.open(os.devnull, os.O_RDONLY)
+            try:
+                os.dup2(null_fd, ring_fd)
+                self.assertRaises(OSError, watch.sample)
+                self.assertEqual(len(watch), 1)
+                os.dup2(saved_fd, ring_fd)
+                self.assertRaisesRegex(
+                    Exception, "could not be cancelled", watch.sample
+                )
+                self.assertEqual(len(watch), 1)
+                self.assertEqual(watch.stats()["samples"], 1)
+            finally:
+                os.dup2(saved_fd, ring_fd)
+                os.close(saved_fd)
+                os.close(null_fd)
@@ -0,0 +1,100 @@
+# Copyright (c) Facebook, Inc. and its affiliates.
+# SPDX-License-Identifier: GPL-3.0+
+
+import errno
+import os
+import tempfile
+import unittest
+
+from tests.libdrgn import ReadEngine
+
+# drgn_read_engine_pread() splits reads into 256 KiB chunks.
+CHUNK_SIZE = 256 * 1024
+
+
+class _ReadEngineTests:
+    use_io_uring = None
+
+    def setUp(self):
+        self.engine = ReadEngine(use_io_uring=self.use_io_uring)
+        if self.engine.uses_io_uring != self.use_io_uring:
+            self.skipTest("io_uring is not available")
+        self.data = os.urandom(3 * CHUNK_SIZE + 1234)
+        self.file = tempfile.TemporaryFile()
+        self.file.write(self.data)
+        self.file.flush()
+
+    def tearDown(self):
+        self.file.close()
+
+    def test_pread(self):
+        self.assertEqual(
+            self.engine.pread(self.file.fileno(), len(self.data)), (self.data, 0, 0)
+        )
+
+    def test_pread_offset(self):
+        self.assertEqual(
+            self.engine.pread(self.file.fileno(), CHUNK_SIZE + 1, 12345),
+            (self.data[12345 : 12345 + CHUNK_SIZE + 1], 0, 0),
+        )
+
+    def test_pread_past_end(self):
+        self.assertEqual(
+            self.engine.pread(self.file.fileno(), len(self.data) + 4096, 1000),
+            (self.data[1000:], 0, 0),
+        )
+
+    def test_pread_error(self):
+        fd = os.open(tempfile.gettempdir(), os.O_RDONLY | os.O_DIRECTORY)
+        try:
+            self.assertEqual(
+                self.engine.pread(fd, 2 * CHUNK_SIZE, 0), (b"", errno.EISDIR, 0)
+            )
+        finally:
+            os.close(fd)
+
+    def test_submit(self):
+        # More requests than the queue depth, so submitting has to wait for
+        # room.
+        reqs = [
+            self.engine.submit(self.file.fileno(), 4096, offset)
+            for offset in range(0, len(self.data), 4096)
+        ]
+        self.engine.wait()
+        self.assertEqual(self.engine.pending(), 0)
+        for req in reqs:
+            self.assertEqual(req.errnum, 0)
+        self.assertEqual(b"".join(req.data for req in reqs), self.data)
+
+    def test_cancel_queued(self):
+        reqs = [self.engine.submit(self.file.fileno(), 4096) for _ in range(4)]
+        self.assertTrue(self.engine.cancel())
+        self.assertEqual(self.engine.pending(), 0)
+        for req in reqs:
+            self.assertEqual(req.done, 0)
+        # The engine is still usable after cancelling.
+        self.test_pread()
+
+
+class TestReadEngineIoUring(_ReadEngineTests, unittest.TestCase):
+    use_io_uring = True
+
+    def test_cancel_in_flight(self):
+        r, w = os.pipe()
+        try:
+            reqs = [self.engine.submit(r, 16) for _ in range(4)]
+            os.write(w, b"x" * 16)
+            # Submits everything. One read gets the data, and the rest block.
+            self.engine.wait(1)
+            self.assertEqual(self.engine.pending(), 3)
+            self.assertTrue(self.engine.cancel())
+            self.assertEqual(self.engine.pending(), 0)
+            self.assertEqual(sorted(req.data for req in reqs), [b""] * 3 + [b"x" * 16])
+            self.test_pread()
+        finally:
+            os.close(r)
+            os.close(w)
+
+
+class TestReadEngineThreadPool(_ReadEngineTests, unittest.TestCase):
+    use_io_uring = False
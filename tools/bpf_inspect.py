@@ -11,7 +11,12 @@ import argparse
 import sys
 
 from drgn.helpers import enum_type_to_class
-from drgn.helpers.linux import bpf_map_for_each, bpf_prog_for_each, hlist_for_each_entry
+from drgn.helpers.linux import (
+    bpf_map_for_each,
+    bpf_map_items,
+    bpf_prog_for_each,
+    hlist_for_each_entry,
+)
 
 BpfMapType = enum_type_to_class(prog.type("enum bpf_map_type"), "BpfMapType")
 BpfProgType = enum_type_to_class(prog.type("enum bpf_prog_type"), "BpfProgType")
@@ -114,6 +119,16 @@ def list_bpf_maps(args):
         print(f"{id_:>6}: {type_:32} {name}")
 
 
+def dump_bpf_map(args):
+    for map_ in bpf_map_for_each(prog):
+        if map_.id == args.id:
+            break
+    else:
+        sys.exit(f"BPF map {args.id} not found")
+    for key, value in bpf_map_items(map_, sum_percpu=args.sum):
+        print(f"{key.hex()}: {value.hex()}")
+
+
 def main():
     parser = argparse.ArgumentParser(
         description=DESCRIPTION, formatter_class=argparse.RawTextHelpFormatter
@@ -128,6 +143,19 @@ def main():
     map_parser = subparsers.add_parser("map", aliases=["m"], help="list BPF maps")
     map_parser.set_defaults(func=list_bpf_maps)
 
+    dump_parser = subparsers.add_parser(
+        "dump", aliases=["d"], help="dump the contents of a BPF map"
+    )
+    dump_parser.add_argument("id", type=int, help="BPF map ID")
+    dump_parser.add_argument(
+        "--sum",
+        type=int,
+        choices=(1, 2, 4, 8),
+        default=0,
+        help="sum per-CPU values as arrays of integers of this size in bytes",
+    )
+    dump_parser.set_defaults(func=dump_bpf_map)
+
     args = parser.parse_args()
     args.func(args)
 